@@ -98,6 +98,7 @@ static fr_dict_attr_t const *attr_ms_chap_response;
 static fr_dict_attr_t const *attr_packet_dst_ip_address;
 static fr_dict_attr_t const *attr_packet_dst_ipv6_address;
 static fr_dict_attr_t const *attr_packet_dst_port;
+static fr_dict_attr_t const *attr_packet_original_timestamp;
 static fr_dict_attr_t const *attr_packet_src_ip_address;
 static fr_dict_attr_t const *attr_packet_src_ipv6_address;
 static fr_dict_attr_t const *attr_packet_src_port;
@@ -120,6 +121,7 @@ fr_dict_attr_autoload_t radclient_dict_attr[] = {
 	{ .out = &attr_packet_dst_ip_address, .name = "Packet-Dst-IP-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_freeradius },
 	{ .out = &attr_packet_dst_ipv6_address, .name = "Packet-Dst-IPv6-Address", .type = FR_TYPE_IPV6_ADDR, .dict = &dict_freeradius },
 	{ .out = &attr_packet_dst_port, .name = "Packet-Dst-Port", .type = FR_TYPE_UINT16, .dict = &dict_freeradius },
+	{ .out = &attr_packet_original_timestamp, .name = "Packet-Original-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_freeradius },
 	{ .out = &attr_packet_src_ip_address, .name = "Packet-Src-IP-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_freeradius },
 	{ .out = &attr_packet_src_ipv6_address, .name = "Packet-Src-IPv6-Address", .type = FR_TYPE_IPV6_ADDR, .dict = &dict_freeradius },
 	{ .out = &attr_packet_src_port, .name = "Packet-Src-Port", .type = FR_TYPE_UINT16, .dict = &dict_freeradius },
@@ -156,12 +158,56 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "  -s                     Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>              read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>           Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -T <speed>             Replay packets at their Packet-Original-Timestamp, 'speed' times faster.\n");
 	fprintf(stderr, "  -v                     Show program version information.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	fr_exit_now(EXIT_SUCCESS);
 }
 
+/** Add a reply latency to the histogram
+ *
+ */
+static void latency_add(fr_time_delta_t delay)
+{
+	uint64_t	usec = (delay > 0) ? fr_time_delta_to_usec(delay) : 0;
+	unsigned int	shift, idx;
+
+	if (usec < (1 << RC_LATENCY_SUB_BITS)) {
+		idx = usec;
+	} else {
+		shift = fr_high_bit_pos(usec) - 1 - RC_LATENCY_SUB_BITS;
+		idx = ((shift + 1) << RC_LATENCY_SUB_BITS) + ((usec >> shift) & ((1 << RC_LATENCY_SUB_BITS) - 1));
+	}
+
+	stats.latency[idx]++;
+	stats.latency_count++;
+}
+
+/** Return the latency (in usec) below which a given fraction of replies fall
+ *
+ */
+static uint64_t latency_percentile(double fraction)
+{
+	uint64_t	target, seen = 0;
+	unsigned int	idx, shift;
+
+	if (!stats.latency_count) return 0;
+
+	target = (uint64_t) (fraction * stats.latency_count);
+	if (target >= stats.latency_count) target = stats.latency_count - 1;
+
+	for (idx = 0; idx < RC_LATENCY_BUCKETS; idx++) {
+		seen += stats.latency[idx];
+		if (seen > target) break;
+	}
+
+	if (idx < (1 << RC_LATENCY_SUB_BITS)) return idx;
+
+	shift = (idx >> RC_LATENCY_SUB_BITS) - 1;
+	return ((uint64_t) ((1 << RC_LATENCY_SUB_BITS) + (idx & ((1 << RC_LATENCY_SUB_BITS) - 1)))) << shift;
+}
+
 /*
  *	Free a radclient struct, which may (or may not)
  *	already be in the list.
@@ -499,6 +545,8 @@ static int radclient_init(TALLOC_CTX *ctx, rc_file_pair_t *files)
 				request->packet->code = vp->vp_uint32;
 			} else if (vp->da == attr_packet_dst_port) {
 				request->packet->socket.inet.dst_port = vp->vp_uint16;
+			} else if (vp->da == attr_packet_original_timestamp) {
+				request->replay_at = vp->vp_date;
 			} else if ((vp->da == attr_packet_dst_ip_address) ||
 				   (vp->da == attr_packet_dst_ipv6_address)) {
 				memcpy(&request->packet->socket.inet.dst_ipaddr, &vp->vp_ip, sizeof(request->packet->socket.inet.dst_ipaddr));
@@ -873,6 +921,7 @@ static int send_one_packet(rc_request_t *request)
 		}
 
 		request->timestamp = fr_time();
+		request->first_sent = request->timestamp;
 		request->tries = 1;
 		request->resend++;
 
@@ -1040,6 +1089,12 @@ static int recv_one_packet(fr_time_t wait_time)
 	request->reply = reply;
 	reply = NULL;
 
+	/*
+	 *	Measure from the first transmission, so that
+	 *	retransmissions count against the latency.
+	 */
+	latency_add(fr_time() - request->first_sent);
+
 	/*
 	 *	If this fails, we're out of memory.
 	 */
@@ -1128,6 +1183,10 @@ int main(int argc, char **argv)
 	FILE		*fp;
 	int		do_summary = false;
 	int		persec = 0;
+	fr_time_t	next_send = 0;
+	double		replay_speed = 0;
+	fr_time_t	replay_start = 0;
+	fr_unix_time_t	replay_base = 0;
 	int		parallel = 1;
 	rc_request_t	*this;
 	int		force_af = AF_UNSPEC;
@@ -1171,7 +1230,7 @@ int main(int argc, char **argv)
 	default_log.fd = STDOUT_FILENO;
 	default_log.print_level = false;
 
-	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:n:p:P:r:sS:t:vx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:n:p:P:r:sS:t:T:vx")) != -1) switch (c) {
 		case '4':
 			force_af = AF_INET;
 			break;
@@ -1315,6 +1374,11 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'T':
+			replay_speed = atof(optarg);
+			if (replay_speed <= 0) usage();
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1349,6 +1413,13 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	/*
+	 *	radclient is single threaded, so vendors can be
+	 *	loaded whenever they're used in a packet we send
+	 *	or receive.
+	 */
+	fr_dict_global_lazy_vendors(true);
+
 	if (fr_radius_init() < 0) {
 		fr_perror("radclient");
 		return 1;
@@ -1545,6 +1616,33 @@ int main(int argc, char **argv)
 			if (n > 0) {
 				n--;
 
+				/*
+				 *	Replaying a capture.  Keep the gaps
+				 *	between the original packets, scaled
+				 *	by the replay speed.  Replies are read
+				 *	while we wait.
+				 */
+				if (replay_speed && this->replay_at && !this->resend) {
+					fr_time_t now = fr_time();
+					fr_time_t when;
+
+					if (!replay_start) {
+						replay_start = now;
+						replay_base = this->replay_at;
+					}
+
+					when = replay_start;
+					if (this->replay_at > replay_base) {
+						when += (fr_time_t) ((this->replay_at - replay_base) / replay_speed);
+					}
+
+					sleep_time = 0;
+					while (now < when) {
+						recv_one_packet(when - now);
+						now = fr_time();
+					}
+				}
+
 				/*
 				 *	Send the current packet.
 				 */
@@ -1558,25 +1656,33 @@ int main(int argc, char **argv)
 				 *	the next packet, if told to.
 				 */
 				if (persec) {
-					fr_time_delta_t psec;
-
-					psec = (persec == 1) ? fr_time_delta_from_sec(1) : (1000000 / persec);
+					fr_time_t now = fr_time();
 
 					/*
 					 *	Don't sleep elsewhere.
 					 */
 					sleep_time = 0;
 
-
 					/*
-					 *	Sleep for milliseconds,
-					 *	portably.
+					 *	Packets are sent on a fixed
+					 *	schedule, no matter how long
+					 *	it took to send this one, or
+					 *	how slowly the server replies.
+					 *	If we fall behind, we send the
+					 *	next packets immediately to
+					 *	catch up.
 					 *
-					 *	If we get an error or
-					 *	a signal, treat it like
-					 *	a normal timeout.
+					 *	Replies are read while we wait,
+					 *	so that their latency isn't
+					 *	inflated by our sleeping.
 					 */
-					select(0, NULL, NULL, NULL, &fr_time_delta_to_timeval(psec));
+					if (!next_send) next_send = now;
+					next_send += NSEC / persec;
+
+					while (now < next_send) {
+						recv_one_packet(next_send - now);
+						now = fr_time();
+					}
 				}
 
 				/*
@@ -1647,6 +1753,21 @@ int main(int argc, char **argv)
 		      stats.passed,
 		      stats.failed
 		);
+
+		if (stats.latency_count) {
+			fr_perror("Latency (usec):\n"
+			      "\tp50           : %" PRIu64 "\n"
+			      "\tp90           : %" PRIu64 "\n"
+			      "\tp99           : %" PRIu64 "\n"
+			      "\tp99.9         : %" PRIu64 "\n"
+			      "\tmax           : %" PRIu64,
+			      latency_percentile(0.50),
+			      latency_percentile(0.90),
+			      latency_percentile(0.99),
+			      latency_percentile(0.999),
+			      latency_percentile(1.0)
+			);
+		}
 	}
 
 	if ((stats.lost > 0) || (stats.failed > 0)) {
@@ -50,12 +50,24 @@ extern "C" {
 #define RDEBUG(fmt, ...)	if (do_output && (fr_debug_lvl > 0)) fprintf(fr_log_fp, "(%" PRIu64 ") " fmt "\n", request->num, ## __VA_ARGS__)
 #define RDEBUG2(fmt, ...)	if (do_output && (fr_debug_lvl > 1)) fprintf(fr_log_fp, "(%" PRIu64 ") " fmt "\n", request->num, ## __VA_ARGS__)
 
+/*
+ *	Latency histogram.  Values below 2^RC_LATENCY_SUB_BITS usec
+ *	get their own bucket.  Above that, each power of two is split
+ *	into 2^RC_LATENCY_SUB_BITS buckets, so every bucket is accurate
+ *	to within about 6%.
+ */
+#define RC_LATENCY_SUB_BITS	4
+#define RC_LATENCY_BUCKETS	(64 << RC_LATENCY_SUB_BITS)
+
 typedef struct {
 	uint64_t accepted;			//!< Requests to which we received a accept
 	uint64_t rejected;			//!< Requests to which we received a reject
 	uint64_t lost;				//!< Requests to which we received no response
 	uint64_t passed;			//!< Requests which passed a filter
 	uint64_t failed;			//!< Requests which failed a fitler
+
+	uint64_t latency_count;			//!< Number of replies in the latency histogram.
+	uint64_t latency[RC_LATENCY_BUCKETS];	//!< Time from first transmission to reply, in usec.
 } rc_stats_t;
 
 typedef struct {
@@ -76,6 +88,8 @@ struct rc_request {
 
 	fr_pair_t		*password;	//!< Password.Cleartext
 	fr_time_delta_t		timestamp;
+	fr_time_t		first_sent;	//!< When the first copy of the current packet was sent.
+	fr_unix_time_t		replay_at;	//!< Packet-Original-Timestamp, for replaying with -T.
 
 	fr_radius_packet_t	*packet;	//!< The outgoing request.
 	fr_radius_packet_t	*reply;		//!< The incoming response.
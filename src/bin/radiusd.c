@@ -49,6 +49,7 @@ RCSID("$Id$")
 #include <fcntl.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 
 #ifdef HAVE_GETOPT_H
 #  include <getopt.h>
@@ -147,6 +148,177 @@ static void thread_detach(UNUSED void *uctx)
 	xlat_thread_detach();
 }
 
+static volatile sig_atomic_t supervisor_signal;
+
+static void sig_supervisor(int sig)
+{
+	supervisor_signal = sig;
+}
+
+static void supervisor_kill(pid_t const *children, uint32_t num, int sig)
+{
+	uint32_t i;
+
+	for (i = 0; i < num; i++) if (children[i] > 0) kill(children[i], sig);
+}
+
+/** Start "processes" copies of the server, and restart any which crash
+ *
+ * The children carry on with the normal startup, and bind their own
+ * listeners.  The UDP listeners use SO_REUSEPORT, so all of the
+ * children share the same ports.
+ *
+ * Only the first child inherits the pipe to the daemonizing parent,
+ * so the parent exits once that child is running.
+ *
+ * @param[in] config		The main config.
+ * @param[in,out] from_child	Write end of the pipe to the parent, or -1.
+ * @param[out] exit_status	For the supervisor to exit with.
+ * @return
+ *	- 1 in a child, which should continue starting the server.
+ *	- 0 in the supervisor, after all of the children have exited.
+ *	- -1 on error.
+ */
+static int supervisor_run(main_config_t *config, int *from_child, int *exit_status)
+{
+	pid_t		*children;
+	uint32_t	i, running = 0;
+	bool		stopping = false;
+
+	*exit_status = EXIT_SUCCESS;
+
+	children = talloc_zero_array(NULL, pid_t, config->processes);
+	if (!children) return -1;
+
+	if ((fr_set_signal(SIGTERM, sig_supervisor) < 0) ||
+	    (fr_set_signal(SIGINT, sig_supervisor) < 0) ||
+	    (fr_set_signal(SIGHUP, sig_supervisor) < 0)) {
+		PERROR("Failed installing supervisor signal handlers");
+		talloc_free(children);
+		return -1;
+	}
+
+	INFO("Starting %u server processes", config->processes);
+
+	for (;;) {
+		pid_t	pid;
+		int	stat_loc;
+
+		for (i = 0; !stopping && (i < config->processes); i++) {
+			if (children[i] > 0) continue;
+
+			pid = fork();
+			if (pid < 0) {
+				ERROR("Couldn't fork server process %u: %s", i, fr_syserror(errno));
+				*exit_status = EXIT_FAILURE;
+				stopping = true;
+				supervisor_kill(children, config->processes, SIGTERM);
+				break;
+			}
+
+			if (pid == 0) {
+				talloc_free(children);
+
+				signal(SIGTERM, SIG_DFL);
+				signal(SIGINT, SIG_DFL);
+				signal(SIGHUP, SIG_DFL);
+
+				if ((i != 0) && (*from_child >= 0)) {
+					close(*from_child);
+					*from_child = -1;
+				}
+
+				config->process_index = i;
+				config->write_pid = false;	/* The supervisor owns the PID file */
+				return 1;
+			}
+
+			DEBUG("Started server process %u, PID %d", i, (int) pid);
+			children[i] = pid;
+			running++;
+		}
+
+		/*
+		 *	The first child now has the only copy of the
+		 *	pipe, so that the parent sees it closed if that
+		 *	child fails to start.
+		 */
+		if (*from_child >= 0) {
+			close(*from_child);
+			*from_child = -1;
+		}
+
+		if (running == 0) break;
+
+		switch (supervisor_signal) {
+		case 0:
+			break;
+
+		case SIGHUP:
+			supervisor_kill(children, config->processes, SIGHUP);
+			break;
+
+		default:
+			if (!stopping) INFO("Signalled to terminate, stopping server processes");
+			stopping = true;
+			supervisor_kill(children, config->processes, SIGTERM);
+			break;
+		}
+		supervisor_signal = 0;
+
+		pid = waitpid(-1, &stat_loc, WNOHANG);
+		if (pid <= 0) {
+			if ((pid < 0) && (errno == ECHILD)) break;
+
+			/*
+			 *	Signals interrupt the sleep, so they
+			 *	are forwarded without any delay.
+			 */
+			sleep(1);
+			continue;
+		}
+
+		for (i = 0; i < config->processes; i++) if (children[i] == pid) break;
+		if (i == config->processes) continue;	/* Something started by a trigger */
+
+		children[i] = 0;
+		running--;
+
+		if (stopping) continue;
+
+		/*
+		 *	Crashes are restarted, after a short delay so
+		 *	that a process which crashes on every packet
+		 *	doesn't spin.
+		 */
+		if (WIFSIGNALED(stat_loc)) {
+			ERROR("Server process %u (PID %d) exited on signal %d, restarting",
+			      i, (int) pid, WTERMSIG(stat_loc));
+			sleep(1);
+			continue;
+		}
+
+		/*
+		 *	A process which exits by itself was either told
+		 *	to via its control socket, or failed to start.
+		 *	Either way, all of them should stop.
+		 */
+		if (WEXITSTATUS(stat_loc) != EXIT_SUCCESS) {
+			ERROR("Server process %u (PID %d) exited with status %d, stopping",
+			      i, (int) pid, WEXITSTATUS(stat_loc));
+			*exit_status = EXIT_FAILURE;
+		} else {
+			INFO("Server process %u (PID %d) exited, stopping", i, (int) pid);
+		}
+		stopping = true;
+		supervisor_kill(children, config->processes, SIGTERM);
+	}
+
+	talloc_free(children);
+
+	return 0;
+}
+
 #define EXIT_WITH_FAILURE \
 do { \
 	ret = EXIT_FAILURE; \
@@ -639,6 +811,14 @@ int main(int argc, char *argv[])
 	 */
 	if (check_config) radmin = false;
 
+	/*
+	 *	The console would only talk to one of them.
+	 */
+	if (radmin && (config->processes > 1)) {
+		fprintf(stderr, "%s: The -r option cannot be used with \"processes > 1\"\n", config->name);
+		EXIT_WITH_FAILURE;
+	}
+
 	if (fr_radmin_start(config, radmin) < 0) EXIT_WITH_FAILURE;
 
 	/*
@@ -721,6 +901,40 @@ int main(int argc, char *argv[])
 #endif
 	}
 
+	/*
+	 *	Run the supervisor.  It returns in each of the
+	 *	children, and again when they have all exited.
+	 */
+	if (!check_config && (config->processes > 1)) {
+		int exit_status;
+
+		if (config->write_pid) {
+			FILE *fp;
+
+			fp = fopen(config->pid_file, "w");
+			if (!fp) {
+				ERROR("Failed creating PID file %s: %s", config->pid_file, fr_syserror(errno));
+				EXIT_WITH_FAILURE;
+			}
+			fprintf(fp, "%d\n", (int) getpid());
+			fclose(fp);
+		}
+
+		switch (supervisor_run(config, &from_child[1], &exit_status)) {
+		case 1:
+			break;
+
+		case 0:
+			if (config->daemonize && config->write_pid) unlink(config->pid_file);
+			ret = exit_status;
+			goto cleanup;
+
+		default:
+			if (config->daemonize && config->write_pid) unlink(config->pid_file);
+			EXIT_WITH_FAILURE;
+		}
+	}
+
 	/*
 	 *  Ensure that we're using the CORRECT pid after forking, NOT the one
 	 *  we started with.
@@ -767,6 +981,58 @@ int main(int argc, char *argv[])
 	 */
 	if (log_global_init(&default_log, config->daemonize) < 0) EXIT_WITH_FAILURE;
 
+	/*
+	 *  Move log writes to their own thread, before any
+	 *  other threads start logging.
+	 */
+	if (config->log_async &&
+	    (fr_log_async_start(&default_log, config->log_async_queue_size, config->log_async_block) < 0)) {
+		PERROR("Failed starting log thread");
+		EXIT_WITH_FAILURE;
+	}
+
+	/*
+	 *	The configuration has been compiled, so every vendor
+	 *	it references has been loaded.  Workers may look up
+	 *	attributes concurrently, so the dictionaries must not
+	 *	change from here on.
+	 */
+	fr_dict_global_lazy_vendors_freeze();
+
+	/*
+	 *	Must be set before the ring buffers for the channels
+	 *	are allocated.
+	 */
+	talloc_huge_pages_set(config->huge_pages);
+
+	/*
+	 *	Lock everything we have now, and everything we allocate
+	 *	later, into RAM.  The threads haven't started yet, so
+	 *	their stacks will be locked, too.
+	 */
+	if (config->lock_memory) {
+#ifdef MCL_FUTURE
+		struct rlimit limit;
+
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			ERROR("Failed locking memory: %s", fr_syserror(errno));
+			EXIT_WITH_FAILURE;
+		}
+
+		/*
+		 *	Once we've dropped privileges, allocations fail if
+		 *	they would take us over the limit.
+		 */
+		if ((getrlimit(RLIMIT_MEMLOCK, &limit) == 0) && (limit.rlim_cur != RLIM_INFINITY)) {
+			WARN("RLIMIT_MEMLOCK is %llu bytes.  Allocations above that will fail",
+			     (unsigned long long) limit.rlim_cur);
+		}
+#else
+		ERROR("lock_memory is not supported on this platform");
+		EXIT_WITH_FAILURE;
+#endif
+	}
+
 	/*
 	 *	Start the network / worker threads.
 	 */
@@ -778,10 +1044,29 @@ int main(int argc, char *argv[])
 		schedule->max_workers = config->max_workers;
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
+		schedule->scale_min_workers = config->scale_min_workers;
+		schedule->scale_max_workers = config->scale_max_workers;
+		schedule->scale_interval = config->scale_interval;
+		schedule->network_cpus = config->network_cpus;
+		schedule->worker_cpus = config->worker_cpus;
+
+		/*
+		 *	Each server process publishes its own segment.
+		 */
+		if (config->stats_file && (config->processes > 1)) {
+			schedule->stats_file = talloc_typed_asprintf(schedule, "%s.%u",
+								     config->stats_file, config->process_index);
+		} else {
+			schedule->stats_file = config->stats_file;
+		}
 
 		schedule->network.max_outstanding = config->max_requests;
+		schedule->network.max_queue_delay = config->max_queue_delay;
 		schedule->worker.max_requests = config->max_requests;
 		schedule->worker.max_request_time = config->max_request_time;
+		schedule->worker.max_free_requests = config->max_free_requests;
+		schedule->worker.max_cached_regexes = config->max_cached_regexes;
+		schedule->worker.busy_poll = config->busy_poll;
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -890,7 +1175,7 @@ int main(int argc, char *argv[])
 	 *  If we don't get this far, then we just close the pipe on exit, and the
 	 *  parent gets a read failure.
 	 */
-	if (config->daemonize) {
+	if (from_child[1] >= 0) {
 		if (write(from_child[1], "\001", 1) < 0) {
 			WARN("Failed informing parent of successful start: %s",
 			     fr_syserror(errno));
@@ -981,7 +1266,7 @@ int main(int argc, char *argv[])
 	 *  We're exiting, so we can delete the PID file.
 	 *  (If it doesn't exist, we can ignore the error returned by unlink)
 	 */
-	if (config->daemonize) unlink(config->pid_file);
+	if (config->daemonize && config->write_pid) unlink(config->pid_file);
 
 	/*
 	 *  Free memory in an explicit and consistent order
@@ -1018,6 +1303,13 @@ cleanup:
 	 */
 	(void) fr_schedule_destroy(&sc);
 
+	/*
+	 *  All the other threads have exited, so write out
+	 *  anything still queued, and go back to logging
+	 *  synchronously.
+	 */
+	fr_log_async_stop(&default_log);
+
 	/*
 	 *  Frees request specific logging resources which is OK
 	 *  because all the requests will have been stopped.
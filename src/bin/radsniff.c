@@ -50,7 +50,7 @@ static rs_t *conf;
 static struct timeval start_pcap = {0, 0};
 static char timestr[50];
 
-static rbtree_t *request_tree = NULL;
+static fr_hash_table_t *request_tree = NULL;
 static rbtree_t *link_tree = NULL;
 static fr_event_list_t *events;
 static bool cleanup;
@@ -981,7 +981,7 @@ static int _request_free(rs_request_t *request)
 	 *	something has gone very badly wrong.
 	 */
 	if (request->in_request_tree) {
-		ret = rbtree_deletebydata(request_tree, request);
+		ret = fr_hash_table_delete(request_tree, request);
 		RS_ASSERT(ret);
 	}
 
@@ -1091,6 +1091,40 @@ static int rs_packet_cmp(rs_request_t const *a, rs_request_t const *b)
 	return fr_packet_cmp(a->expect, b->expect);
 }
 
+static int _rs_packet_cmp(void const *one, void const *two)
+{
+	return rs_packet_cmp(one, two);
+}
+
+/** Hash the fields of the expected packet which rs_packet_cmp compares
+ *
+ */
+static uint32_t rs_packet_hash(void const *data)
+{
+	rs_request_t const		*request = data;
+	fr_socket_t const		*socket = &request->expect->socket;
+	uint32_t			hash;
+
+	hash = fr_hash(&request->expect->id, sizeof(request->expect->id));
+	hash = fr_hash_update(&socket->inet.src_port, sizeof(socket->inet.src_port), hash);
+	hash = fr_hash_update(&socket->inet.dst_port, sizeof(socket->inet.dst_port), hash);
+
+	switch (socket->inet.src_ipaddr.af) {
+	case AF_INET:
+		hash = fr_hash_update(&socket->inet.src_ipaddr.addr.v4, sizeof(socket->inet.src_ipaddr.addr.v4), hash);
+		break;
+
+	case AF_INET6:
+		hash = fr_hash_update(&socket->inet.src_ipaddr.addr.v6, sizeof(socket->inet.src_ipaddr.addr.v6), hash);
+		break;
+
+	default:
+		break;
+	}
+
+	return hash;
+}
+
 static inline int rs_response_to_pcap(rs_event_t *event, rs_request_t *request, struct pcap_pkthdr const *header,
 				      uint8_t const *data)
 {
@@ -1388,7 +1422,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	{
 		/* look for a matching request and use it for decoding */
 		search.expect = packet;
-		original = rbtree_finddata(request_tree, &search);
+		original = fr_hash_table_find_by_data(request_tree, &search);
 
 		/*
 		 *	Verify this code is allowed
@@ -1607,7 +1641,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			rs_request_t *tuple;
 
 			original = rbtree_finddata(link_tree, &search);
-			tuple = rbtree_finddata(request_tree, &search);
+			tuple = fr_hash_table_find_by_data(request_tree, &search);
 
 			/*
 			 *	If the packet we matched using attributes is not the same
@@ -1621,7 +1655,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	Detect duplicates using the normal 5-tuple of src/dst ips/ports id
 		 */
 		} else {
-			original = rbtree_finddata(request_tree, &search);
+			original = fr_hash_table_find_by_data(request_tree, &search);
 			if (original && (memcmp(original->expect->vector, packet->vector,
 			    			sizeof(original->expect->vector)) != 0)) {
 				/*
@@ -1671,7 +1705,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 			/* Request may need to be reinserted as the 5 tuple of the response may of changed */
 			if (rs_packet_cmp(original, &search) != 0) {
-				rbtree_deletebydata(request_tree, original);
+				fr_hash_table_delete(request_tree, original);
 			}
 
 			/* replace expected packets and vps */
@@ -1731,10 +1765,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		}
 
 		if (!original->in_request_tree) {
-			bool ret;
+			int ret;
 
 			/* We should never have conflicts */
-			ret = rbtree_insert(request_tree, original);
+			ret = fr_hash_table_insert(request_tree, original);
 			RS_ASSERT(ret);
 			original->in_request_tree = true;
 		}
@@ -2723,9 +2757,10 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 *	Setup the request tree
+	 *	Setup the request tree.  This is looked up for every
+	 *	packet, so it's a hash table.
 	 */
-	request_tree = rbtree_talloc_alloc(conf, (rbcmp) rs_packet_cmp, rs_request_t, _unmark_request, 0);
+	request_tree = fr_hash_table_create(conf, rs_packet_hash, _rs_packet_cmp, _unmark_request);
 	if (!request_tree) {
 		ERROR("Failed creating request tree");
 		goto finish;
@@ -89,6 +89,11 @@ typedef struct {
 	fr_event_timer_t const	*ev;			//!< Multi-Handle timer.
 	uint64_t		transfers;		//!< How many transfers are current in progress.
 	CURLM			*mandle;		//!< The multi handle.
+
+	bool			multiplex;		//!< Options the handle was created with.
+	long			max_host_connections;	//!< Only used to find shared handles.
+	unsigned int		refs;			//!< How many modules are using a shared handle.
+	fr_dlist_t		entry;			//!< In the thread's list of shared handles.
 } fr_curl_handle_t;
 
 /** Structure representing an individual request being passed to curl for processing
@@ -124,6 +129,10 @@ fr_curl_io_request_t	*fr_curl_io_request_alloc(TALLOC_CTX *ctx);
 
 fr_curl_handle_t	*fr_curl_io_init(TALLOC_CTX *ctx, fr_event_list_t *el, bool multiplex);
 
+fr_curl_handle_t	*fr_curl_io_shared_init(fr_event_list_t *el, bool multiplex, long max_host_connections);
+
+void			fr_curl_io_shared_free(fr_curl_handle_t *mhandle);
+
 int			fr_curl_init(void);
 
 void			fr_curl_free(void);
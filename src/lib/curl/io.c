@@ -32,6 +32,11 @@
 #include <curl/curl.h>
 #include <talloc.h>
 
+/** Multi-handles shared by all the curl based modules in this thread
+ *
+ */
+static _Thread_local fr_dlist_head_t *curl_shared_handles;
+
 /*
  *  CURL headers do:
  *
@@ -579,6 +584,7 @@ fr_curl_handle_t *fr_curl_io_init(TALLOC_CTX *ctx,
 	MEM(mhandle = talloc_zero(ctx, fr_curl_handle_t));
 	mhandle->el = el;
 	mhandle->mandle = mandle;
+	mhandle->multiplex = multiplex;
 	talloc_set_destructor(mhandle, _mhandle_free);
 
 	SET_MOPTION(mandle, CURLMOPT_TIMERFUNCTION, _fr_curl_io_timer_modify);
@@ -598,3 +604,82 @@ error:
 
 	return NULL;
 }
+
+/** Get a multi-handle shared with the other curl based modules in this thread
+ *
+ * libcurl keeps its connection cache in the multi-handle.  If the
+ * modules talking to the same server share one, connections are
+ * reused between them, and there are fewer file descriptors open.
+ * Completed transfers are returned to whichever request started them,
+ * whichever module that was.
+ *
+ * Modules which need different multi-handle options get different
+ * handles.
+ *
+ * @param[in] el			for this thread.
+ * @param[in] multiplex			Run multiple requests over the same connection simultaneously.
+ *					HTTP/2 only.
+ * @param[in] max_host_connections	Maximum number of connections to each server, 0 for no limit.
+ * @return
+ *	- A multi-handle.  Must be freed with #fr_curl_io_shared_free.
+ *	- NULL on error.
+ */
+fr_curl_handle_t *fr_curl_io_shared_init(fr_event_list_t *el, bool multiplex, long max_host_connections)
+{
+	fr_curl_handle_t	*mhandle = NULL;
+	CURLMcode		ret;
+
+	if (!curl_shared_handles) {
+		MEM(curl_shared_handles = talloc_zero(NULL, fr_dlist_head_t));
+		fr_dlist_talloc_init(curl_shared_handles, fr_curl_handle_t, entry);
+	}
+
+	while ((mhandle = fr_dlist_next(curl_shared_handles, mhandle))) {
+		if ((mhandle->multiplex == multiplex) &&
+		    (mhandle->max_host_connections == max_host_connections)) {
+			fr_assert(mhandle->el == el);
+			mhandle->refs++;
+			return mhandle;
+		}
+	}
+
+	mhandle = fr_curl_io_init(curl_shared_handles, el, multiplex);
+	if (!mhandle) goto error;
+
+	if (max_host_connections) {
+		ret = curl_multi_setopt(mhandle->mandle, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_connections);
+		if (ret != CURLM_OK) {
+			ERROR("Failed setting curl option CURLMOPT_MAX_HOST_CONNECTIONS: %s (%i)",
+			      curl_multi_strerror(ret), ret);
+			talloc_free(mhandle);
+			goto error;
+		}
+	}
+	mhandle->max_host_connections = max_host_connections;
+	mhandle->refs = 1;
+	fr_dlist_insert_tail(curl_shared_handles, mhandle);
+
+	return mhandle;
+
+error:
+	if (fr_dlist_empty(curl_shared_handles)) TALLOC_FREE(curl_shared_handles);
+
+	return NULL;
+}
+
+/** Release a multi-handle from #fr_curl_io_shared_init
+ *
+ * It's freed when the last module using it releases it.
+ */
+void fr_curl_io_shared_free(fr_curl_handle_t *mhandle)
+{
+	if (!mhandle) return;
+
+	fr_assert(mhandle->refs > 0);
+	if (--mhandle->refs > 0) return;
+
+	fr_dlist_remove(curl_shared_handles, mhandle);
+	talloc_free(mhandle);
+
+	if (fr_dlist_empty(curl_shared_handles)) TALLOC_FREE(curl_shared_handles);
+}
@@ -72,6 +72,33 @@ static char const *eap_codes[] = {
 	"Failure"
 };
 
+/** Allocate type data for an EAP packet, with room for the EAP header in front of it
+ *
+ * The type data is written directly into the buffer which will hold
+ * the wire format packet, so eap_wireformat() only has to fill in
+ * the header, instead of copying the type data into a new buffer.
+ *
+ * This only helps Request and Response packets, which carry type data.
+ *
+ * @param[in] packet	to allocate type data for.
+ * @param[in] len	of the type data.
+ * @return
+ *	- The type data buffer.
+ *	- NULL on error.
+ */
+uint8_t *eap_packet_type_data_alloc(eap_packet_t *packet, size_t len)
+{
+	TALLOC_FREE(packet->packet);
+
+	packet->packet = talloc_array(packet, uint8_t, EAP_HEADER_LEN + 1 /* EAP Method */ + len);
+	if (!packet->packet) return NULL;
+
+	packet->type.data = packet->packet + EAP_HEADER_LEN + 1;
+	packet->type.length = len;
+
+	return packet->type.data;
+}
+
 /*
  *	EAP packet format to be sent over the wire
  *
@@ -90,15 +117,11 @@ static int eap_wireformat(eap_packet_t *reply)
 {
 	eap_packet_raw_t	*header;
 	uint16_t total_length = 0;
+	uint8_t	*old_packet = NULL;
+	bool	in_place = false;
 
 	if (!reply) return 0;
 
-	/*
-	 *	If reply->packet is set, then the wire format
-	 *	has already been calculated, just succeed.
-	 */
-	if(reply->packet != NULL) return 0;
-
 	total_length = EAP_HEADER_LEN;
 	if (reply->code < 3) {
 		total_length += 1/* EAP Method */;
@@ -107,7 +130,30 @@ static int eap_wireformat(eap_packet_t *reply)
 		}
 	}
 
-	reply->packet = talloc_array(reply, uint8_t, total_length);
+	/*
+	 *	If reply->packet is set, then either the wire format
+	 *	has already been calculated, or the type data was
+	 *	allocated with eap_packet_type_data_alloc(), and
+	 *	already sits where it needs to be.
+	 */
+	if (reply->packet != NULL) {
+		if (reply->type.data != (reply->packet + EAP_HEADER_LEN + 1)) return 0;
+
+		/*
+		 *	Success and Failure packets carry no type data,
+		 *	and the type data length may have been changed
+		 *	after it was allocated.  Either way the packet
+		 *	needs a new buffer of the right size.
+		 */
+		if (total_length == talloc_array_length(reply->packet)) {
+			in_place = true;
+		} else {
+			old_packet = reply->packet;	/* Still holds the type data */
+			reply->packet = NULL;
+		}
+	}
+
+	if (!in_place) reply->packet = talloc_array(reply, uint8_t, total_length);
 	header = (eap_packet_raw_t *)reply->packet;
 	if (!header) {
 		return -1;
@@ -134,9 +180,13 @@ static int eap_wireformat(eap_packet_t *reply)
 		 * Zero length/No typedata is supported as long as
 		 * type is defined
 		 */
-		if (reply->type.data && reply->type.length > 0) {
+		if (!in_place && reply->type.data && reply->type.length > 0) {
 			memcpy(&header->data[1], reply->type.data, reply->type.length);
-			talloc_free(reply->type.data);
+			if (old_packet) {
+				talloc_free(old_packet);
+			} else {
+				talloc_free(reply->type.data);
+			}
 			reply->type.data = reply->packet + EAP_HEADER_LEN + 1/*EAPtype*/;
 		}
 	}
@@ -61,5 +61,6 @@ rlm_rcode_t	eap_continue(eap_session_t *eap_session) CC_HINT(nonnull);
 rlm_rcode_t	eap_fail(eap_session_t *eap_session) CC_HINT(nonnull);
 rlm_rcode_t 	eap_success(eap_session_t *eap_session) CC_HINT(nonnull);
 rlm_rcode_t 	eap_compose(eap_session_t *eap_session) CC_HINT(nonnull);
+uint8_t		*eap_packet_type_data_alloc(eap_packet_t *packet, size_t len) CC_HINT(nonnull);
 eap_round_t	*eap_round_build(eap_session_t *eap_session, eap_packet_raw_t **eap_packet_p);
 
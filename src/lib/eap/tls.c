@@ -86,7 +86,9 @@ fr_table_num_ordered_t const eap_tls_status_table[] = {
 
 	{ L("first"),			EAP_TLS_RECORD_RECV_FIRST	},
 	{ L("more"),			EAP_TLS_RECORD_RECV_MORE	},
-	{ L("complete"),			EAP_TLS_RECORD_RECV_COMPLETE	}
+	{ L("complete"),			EAP_TLS_RECORD_RECV_COMPLETE	},
+
+	{ L("yield"),			EAP_TLS_YIELD			}
 };
 size_t eap_tls_status_table_len = NUM_ELEMENTS(eap_tls_status_table);
 
@@ -165,9 +167,8 @@ int eap_tls_compose(request_t *request, eap_session_t *eap_session, eap_tls_stat
 	 *	Identifier value in the subsequent fragment contained
 	 *	within an EAP-Reponse.
 	 */
-	eap_round->request->type.data = p = talloc_array(eap_round->request, uint8_t, len);
+	p = eap_packet_type_data_alloc(eap_round->request, len);
 	if (!p) return -1;
-	eap_round->request->type.length = len;
 
 	*p++ = flags;
 
@@ -827,6 +828,7 @@ ignore_length:
  *	- EAP_TLS_HANDLED if we need to send an additional request to the peer.
  *	- EAP_TLS_ESTABLISHED if the handshake completed successfully, and there's
  *	  no more data to send.
+ *	- EAP_TLS_YIELD if the handshake is waiting for an async crypto operation.
  */
 static eap_tls_status_t eap_tls_handshake(request_t *request, eap_session_t *eap_session)
 {
@@ -842,6 +844,8 @@ static eap_tls_status_t eap_tls_handshake(request_t *request, eap_session_t *eap
 		return EAP_TLS_FAIL;
 	}
 
+	if (fr_tls_session_async_pending(tls_session)) return EAP_TLS_YIELD;
+
 	/*
 	 *	FIXME: return success/fail.
 	 *
@@ -900,6 +904,7 @@ static eap_tls_status_t eap_tls_handshake(request_t *request, eap_session_t *eap
  * @return
  *	- EAP_TLS_ESTABLISHED
  *	- EAP_TLS_HANDLED
+ *	- EAP_TLS_YIELD
  */
 eap_tls_status_t eap_tls_process(request_t *request, eap_session_t *eap_session)
 {
@@ -915,6 +920,16 @@ eap_tls_status_t eap_tls_process(request_t *request, eap_session_t *eap_session)
 
 	fr_assert(request->parent);	/* must be a subrequest */
 
+	/*
+	 *	We're being resumed after an async crypto operation
+	 *	completed.  The EAP packet has already been consumed,
+	 *	so just continue the handshake.
+	 */
+	if (fr_tls_session_async_pending(tls_session)) {
+		RDEBUG2("Continuing EAP-TLS after async crypto operation");
+		return eap_tls_handshake(request, eap_session);
+	}
+
 	RDEBUG2("Continuing EAP-TLS");
 
 	/*
@@ -1051,6 +1066,34 @@ eap_tls_status_t eap_tls_process(request_t *request, eap_session_t *eap_session)
 	return status;
 }
 
+/** Yield until the async crypto operation the handshake is waiting on completes
+ *
+ * Call when #eap_tls_process returns EAP_TLS_YIELD.  The resume function
+ * should call #eap_tls_process again, usually by calling the module's
+ * process method.
+ *
+ * @param[out] p_result		Result of yield.  Only set on error.
+ * @param[in] request		the current subrequest.
+ * @param[in] eap_session	which is waiting.
+ * @param[in] resume		function to call when the operation is complete.
+ * @return
+ *	- UNLANG_ACTION_YIELD on success.
+ *	- UNLANG_ACTION_CALCULATE_RESULT on error.
+ */
+unlang_action_t eap_tls_yield(rlm_rcode_t *p_result, request_t *request, eap_session_t *eap_session,
+			      unlang_module_resume_t resume)
+{
+	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
+	fr_tls_session_t	*tls_session = eap_tls_session->tls_session;
+
+	if (fr_tls_session_async_wait(request, tls_session) < 0) {
+		fr_tls_cache_deny(tls_session);
+		RETURN_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, resume, NULL, eap_session);
+}
+
 /** Create a new fr_tls_session_t associated with an #eap_session_t
  *
  * Creates a new server fr_tls_session_t and associates it with an #eap_session_t
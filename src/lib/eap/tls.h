@@ -51,6 +51,7 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/tls/base.h>
 #include <freeradius-devel/eap/base.h>
+#include <freeradius-devel/unlang/module.h>
 
 #define TLS_HEADER_LEN 4
 #define TLS_HEADER_LENGTH_FIELD_LEN 4
@@ -108,7 +109,9 @@ typedef enum {
 	 */
 	EAP_TLS_RECORD_RECV_FIRST,    			//!< Received first fragment of a record.
 	EAP_TLS_RECORD_RECV_MORE,    			//!< Received additional fragment of a record.
-	EAP_TLS_RECORD_RECV_COMPLETE 			//!< Received final fragment of a record.
+	EAP_TLS_RECORD_RECV_COMPLETE,			//!< Received final fragment of a record.
+
+	EAP_TLS_YIELD					//!< Handshake is waiting for an async crypto operation.
 } eap_tls_status_t;
 
 typedef struct {
@@ -156,6 +159,9 @@ extern size_t eap_tls_status_table_len;
  */
 eap_tls_status_t	eap_tls_process(request_t *request, eap_session_t *eap_session) CC_HINT(nonnull);
 
+unlang_action_t		eap_tls_yield(rlm_rcode_t *p_result, request_t *request, eap_session_t *eap_session,
+				      unlang_module_resume_t resume) CC_HINT(nonnull);
+
 int			eap_tls_start(request_t *request, eap_session_t *eap_session) CC_HINT(nonnull);
 
 int			eap_tls_success(request_t *request, eap_session_t *eap_session,
@@ -12,6 +12,7 @@ SOURCES	:= \
 	queue.c \
 	ring_buffer.c \
 	schedule.c \
+	stats_shm.c \
 	worker.c
 
 TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-util.la
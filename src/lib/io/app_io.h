@@ -66,6 +66,7 @@ typedef struct {
 
 	fr_io_track_create_t		track;		//!< create a tracking structure
 	fr_io_track_cmp_t		compare;	//!< compare two tracking structures
+	fr_io_track_hash_t		hash;		//!< hash a tracking structure
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
@@ -88,6 +88,27 @@ typedef void (*fr_app_entry_point_set_t)(void const *instance, request_t *reques
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Reply to a packet in the network thread, without sending it to a worker
+ *
+ * This is for packets such as Status-Server, where the reply doesn't
+ * depend on running any policies.
+ *
+ * @param[in] instance		of the #fr_app_t.
+ * @param[in] client		which sent the packet.
+ * @param[out] reply		where to write the reply.
+ * @param[in] reply_len		size of the reply buffer.
+ * @param[in] buffer		raw packet.
+ * @param[in] buflen		length of the packet.
+ * @param[in] overloaded	whether the workers are shedding load.
+ * @return
+ *	- <0 don't reply to the packet, and don't process it.
+ *	- 0 process the packet as usual.
+ *	- >0 the length of the reply.
+ */
+typedef ssize_t (*fr_app_fast_reply_t)(void const *instance, RADCLIENT const *client,
+				       uint8_t *reply, size_t reply_len,
+				       uint8_t *buffer, size_t buflen, bool overloaded);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -131,6 +152,9 @@ typedef struct {
 							///< change based on the packet we received.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_fast_reply_t		fast_reply;	//!< Reply to the packet without running it.
+							///< May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
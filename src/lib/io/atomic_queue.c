@@ -260,6 +260,137 @@ bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
 	return true;
 }
 
+/** Push multiple pointers into the atomic queue
+ *
+ * Claims a contiguous range of free entries with a single atomic
+ * update of the head, instead of one per pointer.  If the queue
+ * doesn't have room for all of the entries, as many as will fit are
+ * pushed.
+ *
+ * @param[in] aq	The atomic queue to add data to.
+ * @param[in] data	array of pointers to push.  None of them may be NULL.
+ * @param[in] num	number of entries in the array.
+ * @return
+ *	- the number of entries which were pushed.
+ *	- 0 on queue full.
+ */
+size_t fr_atomic_queue_push_batch(fr_atomic_queue_t *aq, void **data, size_t num)
+{
+	int64_t head, i, count;
+
+	if (!data || !num) return 0;
+
+	head = load(aq->head);
+
+	for (;;) {
+		int64_t seq, diff;
+
+		seq = aquire(aq->entry[ head % aq->size ].seq);
+		diff = (seq - head);
+
+		/*
+		 *	head is larger than the current entry, the queue is full.
+		 */
+		if (diff < 0) return 0;
+
+		/*
+		 *	Someone else has already written to this entry.  Get the new head pointer, and continue.
+		 */
+		if (diff > 0) {
+			head = load(aq->head);
+			continue;
+		}
+
+		/*
+		 *	Find out how many of the following entries
+		 *	are also free.  We stop at the first one
+		 *	which isn't, so that the range is contiguous.
+		 */
+		for (count = 1; count < (int64_t) num; count++) {
+			seq = aquire(aq->entry[ (head + count) % aq->size ].seq);
+			if (seq != (head + count)) break;
+		}
+
+		/*
+		 *	Claim the whole range at once.  If the write
+		 *	fails, "head" has been updated, and we
+		 *	re-check the entries.
+		 */
+		if (cas_add(aq->head, head, count)) break;
+	}
+
+	/*
+	 *	The range [head, head + count) is now ours.  Store
+	 *	the data, and make each entry visible to the readers.
+	 */
+	for (i = 0; i < count; i++) {
+		fr_atomic_queue_entry_t *entry = &aq->entry[ (head + i) % aq->size ];
+
+		entry->data = data[i];
+		store(entry->seq, head + i + 1);
+	}
+
+	return (size_t) count;
+}
+
+/** Pop multiple pointers from the atomic queue
+ *
+ * Claims a contiguous range of used entries with a single atomic
+ * update of the tail, instead of one per pointer.
+ *
+ * @param[in] aq	the atomic queue to retrieve data from.
+ * @param[out] data	array where the pointers are written.
+ * @param[in] num	maximum number of pointers to pop.
+ * @return
+ *	- the number of entries which were popped.
+ *	- 0 on queue empty.
+ */
+size_t fr_atomic_queue_pop_batch(fr_atomic_queue_t *aq, void **data, size_t num)
+{
+	int64_t tail, i, count;
+
+	if (!data || !num) return 0;
+
+	tail = load(aq->tail);
+
+	for (;;) {
+		int64_t seq, diff;
+
+		seq = aquire(aq->entry[ tail % aq->size ].seq);
+		diff = (seq - (tail + 1));
+
+		/*
+		 *	tail is smaller than the current entry, the queue is empty.
+		 */
+		if (diff < 0) return 0;
+
+		if (diff > 0) {
+			tail = load(aq->tail);
+			continue;
+		}
+
+		for (count = 1; count < (int64_t) num; count++) {
+			seq = aquire(aq->entry[ (tail + count) % aq->size ].seq);
+			if (seq != (tail + count + 1)) break;
+		}
+
+		if (cas_add(aq->tail, tail, count)) break;
+	}
+
+	/*
+	 *	Copy the pointers to the caller BEFORE updating the
+	 *	queue entries, and then mark the entries as unused.
+	 */
+	for (i = 0; i < count; i++) {
+		fr_atomic_queue_entry_t *entry = &aq->entry[ (tail + i) % aq->size ];
+
+		data[i] = entry->data;
+		store(entry->seq, tail + i + aq->size);
+	}
+
+	return (size_t) count;
+}
+
 size_t fr_atomic_queue_size(fr_atomic_queue_t *aq)
 {
 	return aq->size;
@@ -43,6 +43,7 @@ RCSIDH(atomic_queue_h, "$Id$")
 
 #define cas_incr(_store, _var)    atomic_compare_exchange_strong_explicit(&_store, &_var, _var + 1, memory_order_release, memory_order_relaxed)
 #define cas_decr(_store, _var)    atomic_compare_exchange_strong_explicit(&_store, &_var, _var - 1, memory_order_release, memory_order_relaxed)
+#define cas_add(_store, _var, _n) atomic_compare_exchange_strong_explicit(&_store, &_var, _var + _n, memory_order_release, memory_order_relaxed)
 #define load(_var)           atomic_load_explicit(&_var, memory_order_relaxed)
 #define aquire(_var)         atomic_load_explicit(&_var, memory_order_acquire)
 #define store(_store, _var)  atomic_store_explicit(&_store, _var, memory_order_release);
@@ -57,6 +58,8 @@ fr_atomic_queue_t	*fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size);
 void			fr_atomic_queue_free(fr_atomic_queue_t **aq);
 bool			fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data);
 bool			fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data);
+size_t			fr_atomic_queue_push_batch(fr_atomic_queue_t *aq, void **data, size_t num);
+size_t			fr_atomic_queue_pop_batch(fr_atomic_queue_t *aq, void **data, size_t num);
 size_t			fr_atomic_queue_size(fr_atomic_queue_t *aq);
 
 #ifdef WITH_VERIFY_PTR
@@ -299,6 +299,23 @@ typedef void *(*fr_io_track_create_t)(TALLOC_CTX *ctx, uint8_t const *packet, si
  */
 typedef int (*fr_io_track_cmp_t)(void const *instance, void *thread_instance, RADCLIENT *client, void const *one, void const *two);
 
+/** Hash a tracking structure for storing in a duplicate detection table.
+ *
+ * If the transport provides this function, the duplicate detection
+ * table is an open addressing hash table instead of an rbtree.
+ *
+ * The hash MUST be computed over the same fields which are checked
+ * by the fr_io_track_cmp_t function.  i.e. packets which compare as
+ * identical MUST have the same hash.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in] thread_instance	the thread instance for this function
+ * @param[in] client		the client associated with this packet
+ * @param[in] packet		packet tracking structure
+ * @return the hash of the tracking structure.
+ */
+typedef uint32_t (*fr_io_track_hash_t)(void const *instance, void *thread_instance, RADCLIENT *client, void const *packet);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
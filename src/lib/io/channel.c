@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/util/log.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/probe.h>
 
 #ifdef HAVE_STDATOMIC_H
 #  include <stdatomic.h>
@@ -79,6 +80,11 @@ size_t channel_direction_len = NUM_ELEMENTS(channel_direction);
  */
 #define ATOMIC_QUEUE_SIZE (1024)
 
+/*
+ *	How many messages we pull from the atomic queue at once.
+ */
+#define RECV_BATCH_SIZE (32)
+
 typedef enum fr_channel_signal_t {
 	FR_CHANNEL_SIGNAL_ERROR			= FR_CHANNEL_ERROR,
 	FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER	= FR_CHANNEL_DATA_READY_RESPONDER,
@@ -131,6 +137,9 @@ typedef struct {
 
 	atomic_bool		active;		//!< Whether the channel is active.
 
+	atomic_bool		polling;	//!< This end is busy-polling its queue, and doesn't
+						///< need to be signalled.
+
 	fr_channel_stats_t	stats;		//!< channel statistics
 } fr_channel_end_t;
 
@@ -311,6 +320,8 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	if (!fr_cond_assert_msg(atomic_load(&ch->end[TO_RESPONDER].active), "Channel not active")) return -1;
 
+	FR_PROBE2(channel_send_request, ch, cd);
+
 	/*
 	 *	Same thread?  Just call the "recv" function directly.
 	 */
@@ -356,6 +367,22 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	MPRINT("REQUESTOR requests %"PRIu64", num_outstanding %"PRIu64"\n", requestor->stats.packets, requestor->stats.outstanding);
 
+	/*
+	 *	The responder is busy-polling its queue, and will see
+	 *	the message without being woken up.
+	 *
+	 *	The fence pairs with the one in
+	 *	fr_channel_responder_poll_stop().  Either we see that
+	 *	the responder is polling, or it sees our message
+	 *	after it stops polling.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&ch->end[TO_REQUESTOR].polling, memory_order_relaxed)) {
+		MPRINT("REQUESTOR SKIPS signal, responder is polling\n");
+		requestor->stats.signals_skipped++;
+		return 0;
+	}
+
 #if ENABLE_SKIPS
 	/*
 	 *	We just sent the first packet.  There can't possibly be a reply, so don't bother looking.
@@ -406,9 +433,10 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
  */
 bool fr_channel_recv_reply(fr_channel_t *ch)
 {
-	fr_channel_data_t *cd;
+	fr_channel_data_t *cd[RECV_BATCH_SIZE];
 	fr_channel_end_t *requestor;
 	fr_atomic_queue_t *aq;
+	size_t i, num;
 
 	fr_assert(ch->end[TO_RESPONDER].recv != NULL);
 
@@ -418,44 +446,54 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
 	/*
 	 *	It's OK for the queue to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	num = fr_atomic_queue_pop_batch(aq, (void **) cd, RECV_BATCH_SIZE);
+	if (!num) return false;
 
 	/*
-	 *	We want an exponential moving average for round trip
-	 *	time, where "alpha" is a number between [0,1)
-	 *
-	 *	RTT_new = alpha * RTT_old + (1 - alpha) * RTT_sample
-	 *
-	 *	BUT we use fixed-point arithmetic, so we need to use inverse alpha,
-	 *	which works out to the following equation:
-	 *
-	 *	RTT_new = (RTT_sample + (ialpha - 1) * RTT_old) / ialpha
-	 *
-	 *	NAKs have zero processing time, so we ignore them for
-	 *	the purpose of RTT.
+	 *	Update the channel state for all of the replies
+	 *	before running any callbacks.  The callbacks may
+	 *	re-enter the channel, and pop more replies.
 	 */
-	if (cd->reply.processing_time) {
-		ch->processing_time = RTT(ch->processing_time, cd->reply.processing_time);
-	}
-	ch->cpu_time = cd->reply.cpu_time;
+	for (i = 0; i < num; i++) {
+		FR_PROBE2(channel_recv_reply, ch, cd[i]);
 
-	/*
-	 *	Update the outbound channel with the knowledge that
-	 *	we've received one more reply, and with the responders
-	 *	ACK.
-	 */
-	fr_assert(requestor->stats.outstanding > 0);
-	fr_assert(cd->live.sequence > requestor->ack);
-	fr_assert(cd->live.sequence <= requestor->sequence); /* must have fewer replies than requests */
+		/*
+		 *	We want an exponential moving average for round trip
+		 *	time, where "alpha" is a number between [0,1)
+		 *
+		 *	RTT_new = alpha * RTT_old + (1 - alpha) * RTT_sample
+		 *
+		 *	BUT we use fixed-point arithmetic, so we need to use inverse alpha,
+		 *	which works out to the following equation:
+		 *
+		 *	RTT_new = (RTT_sample + (ialpha - 1) * RTT_old) / ialpha
+		 *
+		 *	NAKs have zero processing time, so we ignore them for
+		 *	the purpose of RTT.
+		 */
+		if (cd[i]->reply.processing_time) {
+			ch->processing_time = RTT(ch->processing_time, cd[i]->reply.processing_time);
+		}
+		ch->cpu_time = cd[i]->reply.cpu_time;
 
-	requestor->stats.outstanding--;
-	requestor->ack = cd->live.sequence;
-	requestor->their_view_of_my_sequence = cd->live.ack;
+		/*
+		 *	Update the outbound channel with the knowledge that
+		 *	we've received one more reply, and with the responders
+		 *	ACK.
+		 */
+		fr_assert(requestor->stats.outstanding > 0);
+		fr_assert(cd[i]->live.sequence > requestor->ack);
+		fr_assert(cd[i]->live.sequence <= requestor->sequence); /* must have fewer replies than requests */
 
-	fr_assert(requestor->stats.last_read_other <= cd->m.when);
-	requestor->stats.last_read_other = cd->m.when;
+		requestor->stats.outstanding--;
+		requestor->ack = cd[i]->live.sequence;
+		requestor->their_view_of_my_sequence = cd[i]->live.ack;
 
-	ch->end[TO_RESPONDER].recv(ch->end[TO_RESPONDER].recv_uctx, ch, cd);
+		fr_assert(requestor->stats.last_read_other <= cd[i]->m.when);
+		requestor->stats.last_read_other = cd[i]->m.when;
+	}
+
+	for (i = 0; i < num; i++) ch->end[TO_RESPONDER].recv(ch->end[TO_RESPONDER].recv_uctx, ch, cd[i]);
 
 	return true;
 }
@@ -470,9 +508,10 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
  */
 bool fr_channel_recv_request(fr_channel_t *ch)
 {
-	fr_channel_data_t *cd;
+	fr_channel_data_t *cd[RECV_BATCH_SIZE];
 	fr_channel_end_t *responder;
 	fr_atomic_queue_t *aq;
+	size_t i, num;
 
 	aq = ch->end[TO_RESPONDER].aq;
 	responder = &(ch->end[TO_REQUESTOR]);
@@ -480,19 +519,29 @@ bool fr_channel_recv_request(fr_channel_t *ch)
 	/*
 	 *	It's OK for the queue to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	num = fr_atomic_queue_pop_batch(aq, (void **) cd, RECV_BATCH_SIZE);
+	if (!num) return false;
+
+	/*
+	 *	As with replies, update the state first.  The
+	 *	callback may send a reply, which in turn reads more
+	 *	requests from the queue.
+	 */
+	for (i = 0; i < num; i++) {
+		FR_PROBE2(channel_recv_request, ch, cd[i]);
 
-	fr_assert(cd->live.sequence > responder->ack);
-	fr_assert(cd->live.sequence >= responder->sequence); /* must have more requests than replies */
+		fr_assert(cd[i]->live.sequence > responder->ack);
+		fr_assert(cd[i]->live.sequence >= responder->sequence); /* must have more requests than replies */
 
-	responder->stats.outstanding++;
-	responder->ack = cd->live.sequence;
-	responder->their_view_of_my_sequence = cd->live.ack;
+		responder->stats.outstanding++;
+		responder->ack = cd[i]->live.sequence;
+		responder->their_view_of_my_sequence = cd[i]->live.ack;
 
-	fr_assert(responder->stats.last_read_other <= cd->m.when);
-	responder->stats.last_read_other = cd->m.when;
+		fr_assert(responder->stats.last_read_other <= cd[i]->m.when);
+		responder->stats.last_read_other = cd[i]->m.when;
+	}
 
-	ch->end[TO_REQUESTOR].recv(ch->end[TO_REQUESTOR].recv_uctx, ch, cd);
+	for (i = 0; i < num; i++) ch->end[TO_REQUESTOR].recv(ch->end[TO_REQUESTOR].recv_uctx, ch, cd[i]);
 
 	return true;
 }
@@ -515,6 +564,8 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	if (!fr_cond_assert_msg(atomic_load(&ch->end[TO_REQUESTOR].active), "Channel not active")) return -1;
 
+	FR_PROBE2(channel_send_reply, ch, cd);
+
 	/*
 	 *	Same thread?  Just call the "recv" function directly.
 	 */
@@ -631,6 +682,38 @@ int fr_channel_null_reply(fr_channel_t *ch)
 
 
 
+/** Take back a request which the responder hasn't read yet
+ *
+ * This function should be called only from the requestor.  The
+ * request is removed from the responders inbound queue, and is no
+ * longer counted as outstanding on this channel.  The caller is then
+ * free to send it on a different channel.
+ *
+ * The responder may be reading from the same queue at the same time,
+ * which is fine.  Each message is seen by only one of us.
+ *
+ * @param[in] ch	the channel to take the request from.
+ * @param[out] p_cd	where the request is written.
+ * @return
+ *	- true if a request was taken back.
+ *	- false if the responder has already read all of the requests.
+ */
+bool fr_channel_recall_request(fr_channel_t *ch, fr_channel_data_t **p_cd)
+{
+	fr_channel_end_t *requestor;
+
+	if (ch->same_thread) return false;
+
+	requestor = &(ch->end[TO_RESPONDER]);
+
+	if (!fr_atomic_queue_pop(requestor->aq, (void **) p_cd)) return false;
+
+	fr_assert(requestor->stats.outstanding > 0);
+	requestor->stats.outstanding--;
+
+	return true;
+}
+
 /** Signal a channel that the responder is sleeping
  *
  * This function should be called from the responders idle loop.
@@ -667,6 +750,60 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 }
 
 
+/** Tell the requestor that the responder is busy-polling the channel
+ *
+ * While the responder is polling, the requestor skips signalling it
+ * when it sends a request.  The responder must call
+ * fr_channel_responder_poll_stop(), and then check the channel one
+ * more time, before it sleeps.
+ *
+ * @param[in] ch	the channel which the responder is polling.
+ */
+void fr_channel_responder_poll_start(fr_channel_t *ch)
+{
+	fr_channel_end_t *responder;
+
+	if (ch->same_thread) return;
+
+	responder = &(ch->end[TO_REQUESTOR]);
+	responder->stats.polls++;
+
+	atomic_store_explicit(&responder->polling, true, memory_order_relaxed);
+}
+
+/** Tell the requestor that the responder has stopped polling the channel
+ *
+ * Any request sent after this function returns will be signalled.
+ * Requests sent before it may not have been signalled, so the
+ * responder must check the channel after calling this function.
+ *
+ * @param[in] ch	the channel which the responder was polling.
+ */
+void fr_channel_responder_poll_stop(fr_channel_t *ch)
+{
+	if (ch->same_thread) return;
+
+	atomic_store_explicit(&ch->end[TO_REQUESTOR].polling, false, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/** Check a channel for requests while the responder is busy-polling
+ *
+ * @param[in] ch	the channel to check.
+ * @return
+ *	- true if there was a message received
+ *	- false if there are no more messages
+ */
+bool fr_channel_responder_poll(fr_channel_t *ch)
+{
+	if (ch->same_thread || !atomic_load(&ch->end[TO_RESPONDER].active)) return false;
+
+	if (!fr_channel_recv_request(ch)) return false;
+
+	ch->end[TO_REQUESTOR].stats.polls_with_data++;
+	return true;
+}
+
 /** Service a control-plane message
  *
  * @param[in] when		The current time.
@@ -963,6 +1100,7 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "requestor\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.signals);
 	fr_log(log, L_INFO, file, line, "\tsignals re-sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.resignals);
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.signals_skipped);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\toutstanding = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.outstanding);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.packets);
@@ -973,6 +1111,8 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 
 	fr_log(log, L_INFO, file, line, "responder\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64"\n", ch->end[TO_REQUESTOR].stats.signals);
+	fr_log(log, L_INFO, file, line, "\tpolls = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.polls);
+	fr_log(log, L_INFO, file, line, "\tpolls with data = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.polls_with_data);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.packets);
 	fr_log(log, L_INFO, file, line, "\tmessage interval (RTT) = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.message_interval);
@@ -81,6 +81,10 @@ typedef struct {
 	uint64_t       		outstanding; 	//!< Number of outstanding requests with no reply.
 	uint64_t		signals;	//!< Number of kevent signals we've sent.
 	uint64_t		resignals;	//!< Number of signals resent.
+	uint64_t		signals_skipped; //!< Number of signals skipped because the other end was polling.
+
+	uint64_t		polls;		//!< Number of times we busy-polled the channel.
+	uint64_t		polls_with_data; //!< Number of times busy-polling found a message.
 
 	uint64_t		packets;	//!< Number of actual data packets.
 
@@ -128,6 +132,7 @@ typedef struct {
 		struct {
 			fr_time_t		recv_time;	//!< time original request was received (network -> worker)
 			bool			is_dup;		//!< dup, new, etc.
+			bool			stolen;		//!< moved from a busy worker to an idle one.
 		} request;
 
 		struct {
@@ -160,6 +165,7 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *frontend, fr_cont
 
 int	fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cm) CC_HINT(nonnull);
 bool	fr_channel_recv_request(fr_channel_t *ch) CC_HINT(nonnull);
+bool	fr_channel_recall_request(fr_channel_t *ch, fr_channel_data_t **p_cd) CC_HINT(nonnull);
 
 int	fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd) CC_HINT(nonnull);
 int	fr_channel_null_reply(fr_channel_t *ch) CC_HINT(nonnull);
@@ -172,6 +178,10 @@ int	fr_channel_set_recv_request(fr_channel_t *ch, void *ctx, fr_channel_recv_cal
 
 int	fr_channel_responder_sleeping(fr_channel_t *ch) CC_HINT(nonnull);
 
+void	fr_channel_responder_poll_start(fr_channel_t *ch) CC_HINT(nonnull);
+void	fr_channel_responder_poll_stop(fr_channel_t *ch) CC_HINT(nonnull);
+bool	fr_channel_responder_poll(fr_channel_t *ch) CC_HINT(nonnull);
+
 int	fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c, struct kevent const *kev) CC_HINT(nonnull);
 fr_channel_event_t	fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size) CC_HINT(nonnull);
 
@@ -35,6 +35,17 @@ RCSID("$Id$")
 #include <string.h>
 #include <sys/event.h>
 
+/*
+ *	On Linux, signal with an eventfd instead of a pipe.  It's one
+ *	descriptor instead of two, a signal is one counter increment
+ *	instead of a byte in a pipe buffer, and one read() returns the
+ *	total number of signals, no matter how many there are.
+ */
+#ifdef __linux__
+#  include <sys/eventfd.h>
+#  define CONTROL_EVENTFD (1)
+#endif
+
 #define FR_CONTROL_MAX_TYPES	(32)
 
 /*
@@ -81,41 +92,99 @@ struct fr_control_s {
 
 	fr_atomic_queue_t	*aq;			//!< destination AQ
 
-	int			pipe[2];       		//!< our pipes
+	int			pipe[2];       		//!< our pipes.  Both are the same eventfd on Linux.
 
 	bool			same_thread;		//!< are the two ends in the same thread
 
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
 
+/** Copy the data out of a control-plane message, and mark it as done
+ *
+ */
+static ssize_t control_message_copy(fr_control_message_t *m, uint32_t *p_id, void *data, size_t data_size)
+{
+	uint8_t *p;
+
+	fr_assert(m->status == FR_CONTROL_MESSAGE_USED);
+
+	/*
+	 *	There isn't enough room to store the data, die.
+	 */
+	if (data_size < m->data_size) {
+		fr_strerror_printf("Allocation size should be at least %zd", m->data_size);
+		return -(m->data_size);
+	}
+
+	p = (uint8_t *) m;
+	data_size = m->data_size;
+	memcpy(data, p + sizeof(*m), data_size);
+
+	m->status = FR_CONTROL_MESSAGE_DONE;
+	*p_id = m->id;
+	return data_size;
+}
+
 static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
 {
 	fr_control_t *c = talloc_get_type_abort(uctx, fr_control_t);
-	ssize_t i, num;
+	ssize_t num;
 	fr_time_t now;
-	char read_buffer[256];
 	uint8_t	data[256];
+	fr_control_message_t *m[32];
+#ifdef CONTROL_EVENTFD
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) != sizeof(count)) return;
+	num = (count > SSIZE_MAX) ? SSIZE_MAX : (ssize_t) count;
+#else
+	char read_buffer[256];
 
 	num = read(fd, read_buffer, sizeof(read_buffer));
 	if (num <= 0) return;
+#endif
 
 	now = fr_time();
 
-	for (i = 0; i < num; i++) {
-		uint32_t id = 0;
-		size_t message_size;
+	/*
+	 *	Each signal is one message.  Pull them off of the
+	 *	queue in batches, which is cheaper than one at a
+	 *	time.
+	 */
+	while (num > 0) {
+		size_t i, popped;
+
+		popped = fr_atomic_queue_pop_batch(c->aq, (void **) m,
+						   ((size_t) num < NUM_ELEMENTS(m)) ? (size_t) num : NUM_ELEMENTS(m));
+		if (!popped) return;
+
+		num -= (ssize_t) popped;
+
+		for (i = 0; i < popped; i++) {
+			uint32_t id = 0;
+			ssize_t message_size;
 
-		message_size = fr_control_message_pop(c->aq, &id, data, sizeof(data));
-		if (!message_size) return;
+			message_size = control_message_copy(m[i], &id, data, sizeof(data));
+			if (message_size <= 0) continue;
 
-		if (id >= FR_CONTROL_MAX_TYPES) continue;
+			if (id >= FR_CONTROL_MAX_TYPES) continue;
 
-		if (!c->type[id].callback) continue;
+			if (!c->type[id].callback) continue;
 
-		c->type[id].callback(c->type[id].ctx, data, message_size, now);
+			c->type[id].callback(c->type[id].ctx, data, message_size, now);
+		}
 	}
 }
 
+/** Close the signalling descriptors
+ *
+ */
+static void control_close(fr_control_t *c)
+{
+	close(c->pipe[0]);
+	if (c->pipe[1] != c->pipe[0]) close(c->pipe[1]);
+}
+
 /** Free a control structure
  *
  *  This function really only calls the underlying "garbage collect".
@@ -131,8 +200,7 @@ static int _control_free(fr_control_t *c)
 #endif
 	(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
 
-	close(c->pipe[0]);
-	close(c->pipe[1]);
+	control_close(c);
 
 	return 0;
 }
@@ -158,6 +226,15 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_atomic_
 	c->el = el;
 	c->aq = aq;
 
+#ifdef CONTROL_EVENTFD
+	c->pipe[0] = c->pipe[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (c->pipe[0] < 0) {
+		talloc_free(c);
+		fr_strerror_printf("Failed opening eventfd for control socket: %s", fr_syserror(errno));
+		return NULL;
+	}
+	talloc_set_destructor(c, _control_free);
+#else
 	if (pipe((int *) &c->pipe) < 0) {
 		talloc_free(c);
 		fr_strerror_printf("Failed opening pipe for control socket: %s", fr_syserror(errno));
@@ -170,6 +247,7 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_atomic_
 	 */
 	(void) fcntl(c->pipe[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
 	(void) fcntl(c->pipe[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+#endif
 
 	if (fr_event_fd_insert(c, el, c->pipe[0], pipe_read, NULL, NULL, c) < 0) {
 		talloc_free(c);
@@ -353,9 +431,19 @@ int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
+#ifdef CONTROL_EVENTFD
+	{
+		uint64_t one = 1;
+
+		while (write(c->pipe[1], &one, sizeof(one)) == 0) {
+			/* nothing */
+		}
+	}
+#else
 	while (write(c->pipe[1], ".", 1) == 0) {
 		/* nothing */
 	}
+#endif
 
 	return 0;
 }
@@ -376,30 +464,13 @@ int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
  */
 ssize_t fr_control_message_pop(fr_atomic_queue_t *aq, uint32_t *p_id, void *data, size_t data_size)
 {
-	uint8_t *p;
 	fr_control_message_t *m;
 
 	MPRINT("CONTROL pop aq %p\n", aq);
 
 	if (!fr_atomic_queue_pop(aq, (void **) &m)) return 0;
 
-	fr_assert(m->status == FR_CONTROL_MESSAGE_USED);
-
-	/*
-	 *	There isn't enough room to store the data, die.
-	 */
-	if (data_size < m->data_size) {
-		fr_strerror_printf("Allocation size should be at least %zd", m->data_size);
-		return -(m->data_size);
-	}
-
-	p = (uint8_t *) m;
-	data_size = m->data_size;
-	memcpy(data, p + sizeof(*m), data_size);
-
-	m->status = FR_CONTROL_MESSAGE_DONE;
-	*p_id = m->id;
-	return data_size;
+	return control_message_copy(m, p_id, data, data_size);
 }
 
 
@@ -472,8 +543,7 @@ int fr_control_same_thread(fr_control_t *c)
 {
 	c->same_thread = true;
 	(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
-	close(c->pipe[0]);
-	close(c->pipe[1]);
+	control_close(c);
 
 	/*
 	 *	Nothing more to do now that everything is gone.
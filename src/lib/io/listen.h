@@ -39,6 +39,13 @@ struct fr_listen {
 
 	bool			connected;		//!< is this for a connected socket?
 	bool			track_duplicates;	//!< do we track duplicate packets?
+	bool			read_pending;		//!< the app_io has buffered more packets, and
+							///< read() should be called again without
+							///< waiting for the file descriptor.
+	bool			reuse_port;		//!< set by open().  The app_io can open one socket
+							///< per network thread, all bound to the same address.
+	uint32_t		reuse_port_index;	//!< set before open().  Which socket of the group this is.
+	uint32_t		reuse_port_max;		//!< set before open().  How many sockets there will be.
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
 };
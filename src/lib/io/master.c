@@ -31,13 +31,14 @@
 #include <freeradius-devel/unlang/base.h>
 
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/oahash.h>
 #include <freeradius-devel/util/syserror.h>
 
 typedef struct {
 	fr_event_list_t			*el;				//!< event list, for the master socket.
 	fr_network_t			*nr;				//!< network for the master socket
 
-	fr_trie_t			*trie;				//!< trie of clients
+	fr_trie_t			*trie;				//!< trie of clients, only used by this thread.
 	fr_heap_t			*pending_clients;		//!< heap of pending clients
 	fr_heap_t			*alive_clients;			//!< heap of active clients
 
@@ -48,6 +49,7 @@ typedef struct {
 	// @todo - count num_nak_clients, and num_nak_connections, too
 	uint32_t			num_connections;		//!< number of dynamic connections
 	uint32_t			num_pending_packets;   		//!< number of pending packets
+	uint32_t			num_pending_clients;		//!< number of dynamic clients being defined
 } fr_io_thread_t;
 
 /** A saved packet
@@ -94,17 +96,24 @@ struct fr_io_client_s {
 	bool				use_connected;	//!< does this client allow connected sub-sockets?
 	bool				ready_to_delete; //!< are we ready to delete this client?
 	bool				in_trie;	//!< is the client in the trie?
+	bool				defining;	//!< counted in thread->num_pending_clients
 
 	fr_io_instance_t const		*inst;		//!< parent instance for master IO handler
 	fr_io_thread_t			*thread;
 	fr_event_timer_t const		*ev;		//!< when we clean up the client
 	rbtree_t			*table;		//!< tracking table for packets
+	fr_oahash_t			*hash_table;	//!< tracking table for packets, if app_io->hash is set
 
 	fr_heap_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
 
 	pthread_mutex_t			mutex;		//!< for parent / child signaling
 	fr_hash_table_t			*ht;		//!< for tracking connected sockets
+
+	uint64_t			tokens;		//!< for the max_packets_per_second token bucket
+	fr_time_t			tokens_refill;	//!< when the token bucket was last refilled
+	uint64_t			rate_limited;	//!< number of packets dropped by the rate limit
+	fr_rate_limit_t			rate_limit_log;	//!< so we don't complain about every dropped packet
 };
 
 /** Track a connection
@@ -155,12 +164,37 @@ static int track_free(fr_io_track_t *track)
 	return 0;
 }
 
+/*
+ *	The tracking table is either an rbtree, or an open addressing
+ *	hash table if the transport knows how to hash packets.
+ */
+static inline void *track_table_find(fr_io_client_t *client, fr_io_track_t const *track)
+{
+	if (client->hash_table) return fr_oahash_find(client->hash_table, track);
+
+	return rbtree_finddata(client->table, track);
+}
+
+static inline bool track_table_insert(fr_io_client_t *client, fr_io_track_t const *track)
+{
+	if (client->hash_table) return fr_oahash_insert(client->hash_table, track);
+
+	return rbtree_insert(client->table, track);
+}
+
+static inline bool track_table_delete(fr_io_client_t *client, fr_io_track_t const *track)
+{
+	if (client->hash_table) return (fr_oahash_remove(client->hash_table, track) != NULL);
+
+	return rbtree_deletebydata(client->table, track);
+}
+
 static int track_dedup_free(fr_io_track_t *track)
 {
-	fr_assert(track->client->table != NULL);
-	fr_assert(rbtree_finddata(track->client->table, track) != NULL);
+	fr_assert((track->client->table != NULL) || (track->client->hash_table != NULL));
+	fr_assert(track_table_find(track->client, track) != NULL);
 
-	if (!rbtree_deletebydata(track->client->table, track)) {
+	if (!track_table_delete(track->client, track)) {
 		fr_assert(0);
 	}
 
@@ -240,6 +274,23 @@ static int8_t address_cmp(void const *one, void const *two)
 	return fr_ipaddr_cmp(&a->socket.inet.dst_ipaddr, &b->socket.inet.dst_ipaddr);
 }
 
+/*
+ *	Hash only the fields which are checked by address_cmp().
+ */
+static uint32_t address_hash(fr_io_address_t const *address)
+{
+	uint32_t hash;
+	fr_ipaddr_t const *src = &address->socket.inet.src_ipaddr;
+	fr_ipaddr_t const *dst = &address->socket.inet.dst_ipaddr;
+
+	hash = fr_hash(&address->socket.inet.src_port, sizeof(address->socket.inet.src_port));
+	hash = fr_hash_update(&address->socket.inet.dst_port, sizeof(address->socket.inet.dst_port), hash);
+	hash = fr_hash_update(&address->socket.inet.ifindex, sizeof(address->socket.inet.ifindex), hash);
+
+	hash = fr_hash_update(&src->addr, (src->af == AF_INET6) ? sizeof(src->addr.v6) : sizeof(src->addr.v4), hash);
+	return fr_hash_update(&dst->addr, (dst->af == AF_INET6) ? sizeof(dst->addr.v6) : sizeof(dst->addr.v4), hash);
+}
+
 static uint32_t connection_hash(void const *ctx)
 {
 	uint32_t hash;
@@ -291,6 +342,24 @@ static int track_cmp(void const *one, void const *two)
 						a->packet, b->packet);
 }
 
+static uint32_t track_hash(void const *ctx)
+{
+	uint32_t hash;
+	fr_io_track_t const *track = talloc_get_type_abort_const(ctx, fr_io_track_t);
+
+	fr_assert(!track->client->connection);
+
+	/*
+	 *	Unconnected sockets must hash src/dst ip/port, too.
+	 */
+	hash = track->client->inst->app_io->hash(track->client->inst->app_io_instance,
+						 track->client->thread->child->thread_instance,
+						 track->client->radclient,
+						 track->packet);
+
+	return fr_hash_update(&hash, sizeof(hash), address_hash(track->address));
+}
+
 
 static int track_connected_cmp(void const *one, void const *two)
 {
@@ -315,6 +384,18 @@ static int track_connected_cmp(void const *one, void const *two)
 						a->packet, b->packet);
 }
 
+static uint32_t track_connected_hash(void const *ctx)
+{
+	fr_io_track_t const *track = talloc_get_type_abort_const(ctx, fr_io_track_t);
+
+	fr_assert(track->client->connection);
+
+	return track->client->inst->app_io->hash(track->client->inst->app_io_instance,
+						 track->client->connection->child->thread_instance,
+						 track->client->connection->client->radclient,
+						 track->packet);
+}
+
 
 static fr_io_pending_packet_t *pending_packet_pop(fr_io_thread_t *thread)
 {
@@ -528,8 +609,13 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	 *	#todo - unify the code with static clients?
 	 */
 	if (inst->app_io->track_duplicates) {
-		MEM(connection->client->table = rbtree_talloc_alloc(client, track_connected_cmp, fr_io_track_t,
-								    NULL, RBTREE_FLAG_NONE));
+		if (inst->app_io->hash) {
+			MEM(connection->client->hash_table = fr_oahash_alloc(client, track_connected_hash,
+									     track_connected_cmp, 0));
+		} else {
+			MEM(connection->client->table = rbtree_talloc_alloc(client, track_connected_cmp, fr_io_track_t,
+									    NULL, RBTREE_FLAG_NONE));
+		}
 	}
 
 	/*
@@ -895,7 +981,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	/*
 	 *	No existing duplicate.  Return the new tracking entry.
 	 */
-	old = rbtree_finddata(client->table, track);
+	old = track_table_find(client, track);
 	if (!old) goto do_insert;
 
 	fr_assert(old->client == client);
@@ -905,7 +991,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	 *
 	 *	2020-08-17, this assertion fails randomly in travis.
 	 *	Which means that "track" was in the free list, *and*
-	 *	in the rbtree.
+	 *	in the tracking table.
 	 */
 	fr_assert(old != track);
 
@@ -964,7 +1050,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	} else {
 		fr_assert(client == old->client);
 
-		if (!rbtree_deletebydata(client->table, old)) {
+		if (!track_table_delete(client, old)) {
 			fr_assert(0);
 		}
 		if (old->ev) (void) fr_event_timer_delete(&old->ev);
@@ -975,7 +1061,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	}
 
 do_insert:
-	if (!rbtree_insert(client->table, track)) {
+	if (!track_table_insert(client, track)) {
 		fr_assert(0);
 	}
 
@@ -1067,12 +1153,26 @@ static int8_t alive_client_cmp(void const *one, void const *two)
  *	This function is only used for the "main" socket.  Clients
  *	from connections do not use it.
  */
+/** The dynamic client is no longer being defined
+ *
+ */
+static inline void client_defined(fr_io_client_t *client)
+{
+	if (!client->defining) return;
+
+	fr_assert(client->thread->num_pending_clients > 0);
+	client->thread->num_pending_clients--;
+	client->defining = false;
+}
+
 static int _client_live_free(fr_io_client_t *client)
 {
 	fr_assert(client->in_trie);
 	fr_assert(!client->connection);
 	fr_assert(fr_heap_num_elements(client->thread->alive_clients) > 0);
 
+	client_defined(client);
+
 	if (client->pending) TALLOC_FREE(client->pending);
 
 	(void) fr_trie_remove(client->thread->trie, &client->src_ipaddr.addr, client->src_ipaddr.prefix);
@@ -1081,6 +1181,47 @@ static int _client_live_free(fr_io_client_t *client)
 	return 0;
 }
 
+/** Take a token from the client's bucket
+ *
+ *  The bucket holds one second worth of packets, and is refilled at
+ *  max_packets_per_second.  So a client can send a short burst, but
+ *  not more than the configured rate over time.
+ *
+ * @return
+ *	- true if the packet is allowed.
+ *	- false if the client is over its rate limit.
+ */
+static bool client_take_token(fr_io_instance_t const *inst, fr_io_client_t *client, fr_time_t now)
+{
+	fr_time_delta_t	elapsed;
+	uint64_t	add;
+
+	if (!client->tokens_refill || ((now - client->tokens_refill) >= NSEC)) {
+		client->tokens = inst->max_packets_per_second;
+		client->tokens_refill = now;
+
+	} else if (now > client->tokens_refill) {
+		elapsed = now - client->tokens_refill;
+		add = ((uint64_t) elapsed * inst->max_packets_per_second) / NSEC;
+
+		/*
+		 *	Only move the refill time forward by the
+		 *	tokens we added, so that slow senders don't
+		 *	lose the fractional tokens.
+		 */
+		if (add > 0) {
+			client->tokens += add;
+			if (client->tokens > inst->max_packets_per_second) client->tokens = inst->max_packets_per_second;
+			client->tokens_refill += (add * NSEC) / inst->max_packets_per_second;
+		}
+	}
+
+	if (!client->tokens) return false;
+
+	client->tokens--;
+	return true;
+}
+
 /**  Implement 99% of the read routines.
  *
  *  The app_io->read does the transport-specific data read.
@@ -1267,6 +1408,12 @@ do_read:
 		 */
 		packet_len = inst->app_io->read(child, (void **) &local_address, &recv_time,
 					  buffer, buffer_len, leftover, priority, is_dup);
+
+		/*
+		 *	Tell the network side whether or not the
+		 *	child has more packets for us.
+		 */
+		li->read_pending = child->read_pending;
 		if (packet_len <= 0) {
 			return packet_len;
 		}
@@ -1375,6 +1522,22 @@ do_read:
 				return 0;
 			}
 
+			/*
+			 *	Each new dynamic client runs a virtual
+			 *	server to define it.  Don't start too
+			 *	many of those at once.  The packet is
+			 *	dropped without creating a NAK entry,
+			 *	so the client's retransmission will try
+			 *	again.
+			 */
+			if (inst->max_pending_clients && (thread->num_pending_clients >= inst->max_pending_clients)) {
+				DEBUG("proto_%s - ignoring packet from client IP address %pV - "
+				      "too many dynamic clients are being defined",
+				      inst->app_io->name, fr_box_ipaddr(address.socket.inet.src_ipaddr));
+				if (accept_fd >= 0) close(accept_fd);
+				return 0;
+			}
+
 			/*
 			 *	Look up the allowed networks.
 			 */
@@ -1453,8 +1616,12 @@ do_read:
 		 */
 		if (inst->app_io->track_duplicates) {
 			fr_assert(inst->app_io->compare != NULL);
-			MEM(client->table = rbtree_talloc_alloc(client, track_cmp, fr_io_track_t,
-								NULL, RBTREE_FLAG_NONE));
+			if (inst->app_io->hash) {
+				MEM(client->hash_table = fr_oahash_alloc(client, track_hash, track_cmp, 0));
+			} else {
+				MEM(client->table = rbtree_talloc_alloc(client, track_cmp, fr_io_track_t,
+									NULL, RBTREE_FLAG_NONE));
+			}
 		}
 
 		/*
@@ -1495,6 +1662,11 @@ do_read:
 		 *	function.
 		 */
 		talloc_set_destructor(client, _client_live_free);
+
+		if (state == PR_CLIENT_PENDING) {
+			client->defining = true;
+			thread->num_pending_clients++;
+		}
 	}
 
 have_client:
@@ -1514,6 +1686,20 @@ have_client:
 		return 0;
 	}
 
+	/*
+	 *	Enforce the per-client packet rate.  This is done
+	 *	before the packet is tracked or decoded, so a client
+	 *	which floods us costs little more than the read.
+	 *	Packets which were pending have already been checked.
+	 */
+	if (inst->max_packets_per_second && !track && !client_take_token(inst, client, recv_time)) {
+		client->rate_limited++;
+		RATE_LIMIT_LOCAL(&client->rate_limit_log, WARN,
+				 "proto_%s - Client %s is over max_packets_per_second - dropping packet (%" PRIu64 " dropped so far)",
+				 inst->app_io->name, client->radclient->shortname, client->rate_limited);
+		return 0;
+	}
+
 	/*
 	 *	No connected sockets, OR we are the connected socket.
 	 *
@@ -1577,6 +1763,39 @@ have_client:
 			 *	Got to free this if we don't process the packet.
 			 */
 			new_track = track;
+
+			/*
+			 *	Some packets can be answered here,
+			 *	without sending them to a worker.  The
+			 *	reply goes through mod_write() as
+			 *	usual, so that it is cached for
+			 *	duplicates.  A one byte reply tells
+			 *	mod_write() not to respond.
+			 */
+			if ((client->state != PR_CLIENT_PENDING) && inst->app->fast_reply) {
+				fr_network_t	*nr = connection ? connection->nr : thread->nr;
+				uint8_t		reply[256];
+				ssize_t		slen;
+
+				slen = inst->app->fast_reply(inst->app_instance, client->radclient,
+							     reply, sizeof(reply), buffer, packet_len,
+							     fr_network_overloaded(nr));
+				if (slen != 0) {
+					if (slen < 0) {
+						reply[0] = false;
+						slen = 1;
+					}
+
+					client->packets++;
+					if (client->ev) {
+						talloc_const_free(client->ev);
+						client->ready_to_delete = false;
+					}
+
+					fr_network_listen_write(nr, li, reply, slen, track, track->timestamp);
+					return 0;
+				}
+			}
 		}
 
 		/*
@@ -2250,6 +2469,12 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 		goto reread;
 	}
 
+	/*
+	 *	The client has been either accepted or rejected, so
+	 *	it no longer counts against max_pending_clients.
+	 */
+	client_defined(client);
+
 	/*
 	 *	The dynamic client was NOT defined.  Set it's state to
 	 *	NAK, delete all pending packets, and close the
@@ -2259,6 +2484,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 		client->state = PR_CLIENT_NAK;
 		TALLOC_FREE(client->pending);
 		if (client->table) TALLOC_FREE(client->table);
+		if (client->hash_table) TALLOC_FREE(client->hash_table);
 		fr_assert(client->packets == 0);
 
 		/*
@@ -2506,6 +2732,22 @@ reread:
 /** Close the socket.
  *
  */
+/** Flush any data which the child has queued for writing
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 static int mod_close(fr_listen_t *li)
 {
 	fr_io_instance_t const *inst;
@@ -2874,25 +3116,26 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Create a listener, and open its socket
+ *
+ * @param[in] ctx			to allocate the listener in.
+ * @param[in] inst			the master IO instance.
+ * @param[in] sc			the scheduler.
+ * @param[in] default_message_size	for the message ring buffer.
+ * @param[in] num_messages		for the message ring buffer.
+ * @param[in] index			of this socket in the SO_REUSEPORT group.
+ * @param[in] max			number of sockets the group may have.
+ * @return
+ *	- NULL on error.
+ *	- the new listener.
+ */
+static fr_listen_t *master_io_listen_open(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+					  size_t default_message_size, size_t num_messages,
+					  uint32_t index, uint32_t max)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2965,6 +3208,8 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	 */
 	child->app_io = inst->app_io;
 	child->track_duplicates = inst->app_io->track_duplicates;
+	child->reuse_port_index = index;
+	child->reuse_port_max = max;
 
 	if (child->app_io->thread_inst_size > 0) {
 		child->thread_instance = talloc_zero_array(NULL, uint8_t,
@@ -2994,10 +3239,11 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	if (inst->app_io->open(child) < 0) {
 		cf_log_err(inst->app_io_conf, "Failed opening %s interface", inst->app_io->name);
 		talloc_free(li);
-		return -1;
+		return NULL;
 	}
 
 	li->fd = child->fd;	/* copy this back up */
+	li->reuse_port = child->reuse_port;
 
 	if (!child->app_io->get_name) {
 		child->name = child->app_io->name;
@@ -3007,9 +3253,11 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other sockets in a
+	 *	SO_REUSEPORT group are deliberately on the same
+	 *	address, so we only check the first one.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (index == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3020,21 +3268,65 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 			ERROR("got socket %d %d\n", child->app_io_addr->inet.src_port, other->app_io_addr->inet.src_port);
 
 			talloc_free(li);
-			return -1;
+			return NULL;
 		}
 
 		(void) listen_record(child);
 	}
 
+	return li;
+}
+
+int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	fr_listen_t	*li;
+	uint32_t	i, max;
+
 	/*
-	 *	Add the socket to the scheduler, where it might end up
-	 *	in a different thread.
+	 *	No IO paths, so we don't initialize them.
 	 */
-	if (!fr_schedule_listen_add(sc, li)) {
-		talloc_free(li);
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
 		return -1;
 	}
 
+	max = fr_schedule_num_networks(sc);
+
+	li = master_io_listen_open(ctx, inst, sc, default_message_size, num_messages, 0, max);
+	if (!li) return -1;
+
+	/*
+	 *	The transport can only have one socket for this
+	 *	address.  Add it to the scheduler, where it might end
+	 *	up in a different thread.
+	 */
+	if (!li->reuse_port) max = 1;
+
+	/*
+	 *	Otherwise each network thread gets its own socket,
+	 *	all bound to the same address.  The kernel spreads
+	 *	the packets across them, and all packets from one
+	 *	client go to the same socket.  The dedup and client
+	 *	tracking for that client then stays in one thread.
+	 */
+	for (i = 0; i < max; i++) {
+		if ((i > 0) &&
+		    !(li = master_io_listen_open(ctx, inst, sc, default_message_size, num_messages, i, max))) {
+			return -1;
+		}
+
+		if (!fr_schedule_listen_add_id(sc, li, i)) {
+			talloc_free(li);
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -3051,6 +3343,7 @@ fr_app_io_t fr_master_app_io = {
 
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.inject			= mod_inject,
 
 	.open			= mod_open,
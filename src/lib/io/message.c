@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/util/strerror.h>
 
+#include <limits.h>
 #include <string.h>
 
 /*
@@ -49,7 +50,15 @@ RCSID("$Id$")
  *
  *  The message set starts off with a small array of message headers,
  *  and a small ring buffer.  If an array/buffer fills up, a new one
- *  is allocated at double the size of the previous one.
+ *  is allocated at double the size of the previous one.  If the
+ *  arrays fill up again before we've allocated even twice the number
+ *  of messages in the largest one, the load is still rising, so the
+ *  new one is four times the size instead.
+ *
+ *  The arrays are only freed by the GC when they're empty, and it
+ *  always keeps the two largest arrays.  When the owner is idle, it
+ *  can call fr_message_set_shrink() to free all empty arrays, so that
+ *  the memory used after a burst of traffic is given back.
  *
  * The array / buffers are themselves kept in fixed-size arrays, of
  *  MSG_ARRAY_SIZE.  The reason is that the memory for fr_message_set_t
@@ -106,6 +115,13 @@ struct fr_message_set_s {
 	int			allocated;
 	int			freed;
 
+	int			mr_grown_at;	//!< "allocated" when we last added a message array
+	int			rb_grown_at;	//!< "allocated" when we last added a ring buffer
+
+	uint64_t		grown;		//!< number of message arrays and ring buffers added
+	uint64_t		shrunk;		//!< number of message arrays and ring buffers freed
+	int			peak_messages;	//!< most messages in the message arrays at once
+
 	fr_ring_buffer_t	*mr_array[MSG_ARRAY_SIZE]; //!< array of message arrays
 
 	fr_ring_buffer_t	*rb_array[MSG_ARRAY_SIZE]; //!< array of ring buffers
@@ -252,21 +268,24 @@ fr_message_t *fr_message_localize(TALLOC_CTX *ctx, fr_message_t *m, size_t messa
 		return NULL;
 	}
 
-	l = talloc_memdup(ctx, m, message_size);
+	/*
+	 *	The message and its data are copied into one chunk,
+	 *	so that localizing a message costs one allocation,
+	 *	and fr_message_done() frees both at once.
+	 */
+	l = talloc_size(ctx, message_size + m->data_size);
 	if (!l) {
-	nomem:
 		fr_strerror_const("Failed allocating memory");
 		return NULL;
 	}
+	talloc_set_name_const(l, "fr_message_t");
 
+	memcpy(l, m, message_size);
 	l->data = NULL;
 
 	if (l->data_size) {
-		l->data = talloc_memdup(l, m->data, l->data_size);
-		if (!l->data) {
-			talloc_free(l);
-			goto nomem;
-		}
+		l->data = ((uint8_t *) l) + message_size;
+		memcpy(l->data, m->data, l->data_size);
 	}
 
 	l->status = FR_MESSAGE_LOCALIZED;
@@ -470,6 +489,7 @@ static void fr_message_gc(fr_message_set_t *ms, int max_to_clean)
 		 */
 		ms->mr_max -= arrays_freed;
 		ms->mr_current = ms->mr_max;
+		ms->shrunk += arrays_freed;
 
 #ifndef NDEBUG
 		MPRINT("NUM RB ARRAYS NOW %d\n", ms->mr_max + 1);
@@ -568,6 +588,7 @@ static void fr_message_gc(fr_message_set_t *ms, int max_to_clean)
 		 */
 		ms->rb_max -= arrays_freed;
 		ms->rb_current = ms->rb_max;
+		ms->shrunk += arrays_freed;
 
 #ifndef NDEBUG
 		MPRINT("NUM RB ARRAYS NOW %d\n", ms->rb_max + 1);
@@ -674,6 +695,7 @@ static fr_message_t *fr_message_ring_alloc(fr_message_set_t *ms, fr_ring_buffer_
 static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleaned)
 {
 	int i;
+	size_t size;
 	fr_message_t *m;
 	fr_ring_buffer_t *mr;
 
@@ -685,6 +707,12 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	 *	there's room, so we grab a message and go find a ring
 	 *	buffer.
 	 */
+	/*
+	 *	Messages are only marked free when they're GC'd, so
+	 *	this is the number which are using the arrays.
+	 */
+	if ((ms->allocated - ms->freed) > ms->peak_messages) ms->peak_messages = ms->allocated - ms->freed;
+
 	mr = ms->mr_array[ms->mr_current];
 	m = (fr_message_t *) fr_ring_buffer_alloc(mr, ms->message_size);
 	if (m) {
@@ -750,13 +778,20 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 
 	/*
 	 *	Allocate another message ring, double the size
-	 *	of the previous maximum.
+	 *	of the previous maximum.  Or four times the size, if
+	 *	we're still growing.
 	 */
-	mr = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
+	size = fr_ring_buffer_size(ms->mr_array[ms->mr_max]);
+	if ((ms->mr_max > 0) &&
+	    ((size_t) (ms->allocated - ms->mr_grown_at) < (2 * (size / ms->message_size)))) size *= 2;
+
+	mr = fr_ring_buffer_create(ms, size * 2);
 	if (!mr) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		return NULL;
 	}
+	ms->mr_grown_at = ms->allocated;
+	ms->grown++;
 
 	/*
 	 *	Set the new one as current for all new
@@ -794,6 +829,7 @@ static fr_message_t *fr_message_get_ring_buffer(fr_message_set_t *ms, fr_message
 						bool cleaned_up)
 {
 	int i;
+	size_t size;
 	fr_ring_buffer_t *rb;
 
 	/*
@@ -872,14 +908,23 @@ static fr_message_t *fr_message_get_ring_buffer(fr_message_set_t *ms, fr_message
 
 alloc_rb:
 	/*
-	 *	Allocate another message ring, double the size
-	 *	of the previous maximum.
+	 *	Allocate another ring buffer, double the size of the
+	 *	previous maximum.  Or four times the size, if we're
+	 *	still growing, using the same test as for the message
+	 *	arrays.
 	 */
-	rb = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->rb_array[ms->rb_max]) * 2);
+	size = fr_ring_buffer_size(ms->rb_array[ms->rb_max]);
+	if ((ms->rb_max > 0) &&
+	    ((size_t) (ms->allocated - ms->rb_grown_at) <
+	     (2 * (fr_ring_buffer_size(ms->mr_array[ms->mr_max]) / ms->message_size)))) size *= 2;
+
+	rb = fr_ring_buffer_create(ms, size * 2);
 	if (!rb) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		goto cleanup;
 	}
+	ms->rb_grown_at = ms->allocated;
+	ms->grown++;
 
 	MPRINT("RING BUFFER DOUBLES\n");
 
@@ -1308,6 +1353,90 @@ void fr_message_set_gc(fr_message_set_t *ms)
 	fr_message_gc(ms, 1 << 24);
 }
 
+/** Free the empty entries of a message array or ring buffer array
+ *
+ *  If all of the entries are empty, the smallest one is kept.
+ *
+ * @param[in] array	of ring buffers.
+ * @param[in,out] max	highest used entry in the array.
+ * @return the number of entries which were freed.
+ */
+static int fr_message_array_shrink(fr_ring_buffer_t **array, int *max)
+{
+	int	i, used, freed;
+	bool	all_empty = true;
+
+	for (i = 0; i <= *max; i++) {
+		if (fr_ring_buffer_used(array[i]) > 0) {
+			all_empty = false;
+			break;
+		}
+	}
+
+	used = freed = 0;
+	for (i = 0; i <= *max; i++) {
+		if ((fr_ring_buffer_used(array[i]) > 0) || (all_empty && (i == 0))) {
+			array[used++] = array[i];
+			continue;
+		}
+
+		TALLOC_FREE(array[i]);
+		freed++;
+	}
+
+	for (i = used; i <= *max; i++) array[i] = NULL;
+	*max = used - 1;
+
+	return freed;
+}
+
+/** Give memory back after a burst of traffic
+ *
+ *  This function should be called by the originator when it has
+ *  been idle for a while.  It cleans up all "done" messages, and
+ *  then frees all empty message arrays and ring buffers.  Unlike
+ *  the GC done during allocation, it doesn't keep the two largest
+ *  ones around.
+ *
+ * @param[in] ms the message set
+ */
+void fr_message_set_shrink(fr_message_set_t *ms)
+{
+	int i;
+
+	(void) talloc_get_type_abort(ms, fr_message_set_t);
+
+	for (i = 0; i <= ms->mr_max; i++) {
+		(void) fr_message_ring_gc(ms, ms->mr_array[i], INT_MAX);
+	}
+
+	ms->shrunk += fr_message_array_shrink(ms->mr_array, &ms->mr_max);
+	ms->shrunk += fr_message_array_shrink(ms->rb_array, &ms->rb_max);
+
+	ms->mr_current = ms->mr_max;
+	ms->rb_current = ms->rb_max;
+}
+
+/** Get statistics for the message set
+ *
+ * @param[in] ms	the message set
+ * @param[out] stats	where the statistics are written.
+ */
+void fr_message_set_stats(fr_message_set_t *ms, fr_message_set_stats_t *stats)
+{
+	int i;
+
+	(void) talloc_get_type_abort(ms, fr_message_set_t);
+
+	stats->grown = ms->grown;
+	stats->shrunk = ms->shrunk;
+	stats->peak_messages = ms->peak_messages;
+	stats->size = 0;
+
+	for (i = 0; i <= ms->mr_max; i++) stats->size += fr_ring_buffer_size(ms->mr_array[i]);
+	for (i = 0; i <= ms->rb_max; i++) stats->size += fr_ring_buffer_size(ms->rb_array[i]);
+}
+
 /** Print debug information about the message set.
  *
  * @param[in] ms the message set
@@ -1321,6 +1450,9 @@ void fr_message_set_debug(fr_message_set_t *ms, FILE *fp)
 
 	fprintf(fp, "message arrays = %d\t(current %d)\n", ms->mr_max + 1, ms->mr_current);
 	fprintf(fp, "ring buffers   = %d\t(current %d)\n", ms->rb_max + 1, ms->rb_current);
+	fprintf(fp, "grown          = %" PRIu64 "\n", ms->grown);
+	fprintf(fp, "shrunk         = %" PRIu64 "\n", ms->shrunk);
+	fprintf(fp, "peak messages  = %d\n", ms->peak_messages);
 
 	for (i = 0; i <= ms->mr_max; i++) {
 		fr_ring_buffer_t *mr = ms->mr_array[i];
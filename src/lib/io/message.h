@@ -51,6 +51,16 @@ typedef struct {
 	size_t			rb_size;	//!< cache-aligned size in the ring buffer
 } fr_message_t;
 
+/** Statistics for a message set
+ *
+ */
+typedef struct {
+	uint64_t		grown;		//!< number of message arrays and ring buffers added
+	uint64_t		shrunk;		//!< number of message arrays and ring buffers freed
+	int			peak_messages;	//!< most messages in use at once
+	size_t			size;		//!< current size of the message arrays and ring buffers
+} fr_message_set_stats_t;
+
 fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size) CC_HINT(nonnull);
 
 fr_message_t *fr_message_reserve(fr_message_set_t *ms, size_t reserve_size) CC_HINT(nonnull);
@@ -64,6 +74,8 @@ fr_message_t *fr_message_localize(TALLOC_CTX *ctx, fr_message_t *m, size_t messa
 
 int fr_message_set_messages_used(fr_message_set_t *ms) CC_HINT(nonnull);
 void fr_message_set_gc(fr_message_set_t *ms) CC_HINT(nonnull);
+void fr_message_set_shrink(fr_message_set_t *ms) CC_HINT(nonnull);
+void fr_message_set_stats(fr_message_set_t *ms, fr_message_set_stats_t *stats) CC_HINT(nonnull);
 
 void fr_message_set_debug(fr_message_set_t *ms, FILE *fp) CC_HINT(nonnull);
 
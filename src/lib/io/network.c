@@ -33,6 +33,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/probe.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/rbtree.h>
 #include <freeradius-devel/util/syserror.h>
@@ -48,6 +49,13 @@ RCSID("$Id$")
 
 #define MAX_WORKERS 64
 
+/*
+ *	How often we check the queue delay of each worker.  As with
+ *	CoDel, a worker is overloaded when even the fastest request in
+ *	the interval was delayed by more than max_queue_delay.
+ */
+#define QUEUE_DELAY_INTERVAL (NSEC / 10)
+
 static _Thread_local fr_ring_buffer_t *fr_network_rb;
 
 typedef struct {
@@ -70,6 +78,14 @@ typedef struct {
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
 	fr_io_stats_t		stats;
+	uint64_t		stolen;			//!< requests taken from busy workers, and given to this one
+
+	fr_time_t		queue_delay_start;	//!< start of the current measurement interval
+	fr_time_delta_t		queue_delay_min;	//!< smallest queue delay seen in this interval
+	bool			overloaded;		//!< queue delay is above max_queue_delay
+
+	bool			draining;		//!< being removed, no new requests are sent to it.
+	fr_dlist_t		entry;			//!< in the list of draining workers
 } fr_network_worker_t;
 
 typedef struct {
@@ -92,6 +108,7 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		flush_entry;		//!< in the list of sockets with replies to write
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -112,6 +129,7 @@ struct fr_network_s {
 	char const		*name;			//!< Network ID for logging.
 
 	bool			started;		//!< Set to true when the first worker is added.
+	bool			exiting;		//!< Set to true when we've started closing the workers.
 	bool			suspended;		//!< whether or not we're suspended.
 
 	fr_log_t const		*log;			//!< log destination
@@ -126,8 +144,12 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have replies to write in this
+							///< iteration of the event loop.
 
 	fr_io_stats_t		stats;
+	uint64_t		num_shed;		//!< packets dropped because the worker was overloaded
+	uint64_t		num_max_outstanding;	//!< packets dropped because of max_outstanding
 
 	rbtree_t		*sockets;		//!< list of sockets we're managing, ordered by the listener
 	rbtree_t		*sockets_by_num;       	//!< ordered by number;
@@ -143,6 +165,8 @@ struct fr_network_s {
 
 	fr_network_config_t	config;			//!< configuration
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+	fr_dlist_head_t		draining;		//!< workers which are finishing their requests before
+							///< their channel is closed.
 };
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
@@ -154,10 +178,10 @@ static int8_t reply_cmp(void const *one, void const *two)
 	fr_channel_data_t const *a = one, *b = two;
 	int ret;
 
-	ret = (a->priority > b->priority) - (a->priority < b->priority);
+	ret = COMPARE_PREFER_LARGER(a->priority, b->priority);
 	if (ret != 0) return ret;
 
-	return (a->m.when > b->m.when) - (a->m.when < b->m.when);
+	return COMPARE_PREFER_SMALLER(a->m.when, b->m.when);
 }
 
 static int8_t waiting_cmp(void const *one, void const *two)
@@ -165,10 +189,10 @@ static int8_t waiting_cmp(void const *one, void const *two)
 	fr_channel_data_t const *a = one, *b = two;
 	int ret;
 
-	ret = (a->priority > b->priority) - (a->priority < b->priority);
+	ret = COMPARE_PREFER_LARGER(a->priority, b->priority);
 	if (ret != 0) return ret;
 
-	return (a->reply.request_time > b->reply.request_time) - (a->reply.request_time < b->reply.request_time);
+	return COMPARE_PREFER_SMALLER(a->reply.request_time, b->reply.request_time);
 }
 
 static int socket_listen_cmp(void const *one, void const *two)
@@ -282,6 +306,28 @@ int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker)
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER, &worker, sizeof(worker));
 }
 
+/** Remove a worker from a network
+ *
+ *  The network stops sending new requests to the worker.  Once the
+ *  worker has replied to the requests it already has, the channel is
+ *  closed.  When all of its channels are closed, the worker exits.
+ *
+ * @param nr the network
+ * @param worker the worker
+ */
+int fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker)
+{
+	fr_ring_buffer_t *rb;
+
+	rb = fr_network_rb_init();
+	if (!rb) return -1;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+	(void) talloc_get_type_abort(worker, fr_worker_t);
+
+	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER_REMOVE, &worker, sizeof(worker));
+}
+
 /** Signal the network to read from a listener
  *
  * @param nr the network
@@ -425,6 +471,64 @@ static void fr_network_unsuspend(fr_network_t *nr)
 #define IALPHA (8)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
+/** Track how long requests wait in a worker
+ *
+ *  The queue delay is the time from when the request was received to
+ *  when the reply came back, less the time the worker spent actually
+ *  processing it.  It includes the time spent in the channel, in the
+ *  worker's runnable heap, and the time spent waiting for backends.
+ *
+ *  Like CoDel, we use the minimum delay over an interval.  A burst of
+ *  slow requests doesn't mark the worker as overloaded, but a standing
+ *  queue does.
+ */
+static void fr_network_worker_queue_delay(fr_network_t *nr, fr_network_worker_t *worker, fr_channel_data_t *cd)
+{
+	fr_time_t	now = fr_time();
+	fr_time_delta_t	delay = 0;
+
+	if (now > cd->reply.request_time) delay = now - cd->reply.request_time;
+	if (delay > cd->reply.processing_time) {
+		delay -= cd->reply.processing_time;
+	} else {
+		delay = 0;
+	}
+
+	if (!worker->queue_delay_start) {
+		worker->queue_delay_start = now;
+		worker->queue_delay_min = delay;
+		return;
+	}
+
+	if (delay < worker->queue_delay_min) worker->queue_delay_min = delay;
+
+	if ((now - worker->queue_delay_start) < QUEUE_DELAY_INTERVAL) return;
+
+	worker->overloaded = (worker->queue_delay_min > nr->config.max_queue_delay);
+	worker->queue_delay_start = now;
+	worker->queue_delay_min = delay;
+}
+
+/** Close the channel to a worker which is being removed
+ *
+ *  The worker has replied to all of the requests we sent it.  When it
+ *  acks the close, we free our side of the channel.
+ *
+ * @param[in] nr	the network
+ * @param[in] worker	to close.
+ */
+static void fr_network_worker_close(fr_network_t *nr, fr_network_worker_t *worker)
+{
+	fr_assert(worker->draining);
+
+	if (!fr_dlist_entry_in_list(&worker->entry)) return;
+
+	DEBUG2("Closing channel to removed worker");
+
+	fr_dlist_remove(&nr->draining, worker);
+	fr_channel_signal_responder_close(worker->channel);
+}
+
 /** Callback which handles a message being received on the network side.
  *
  * @param[in] ctx the network
@@ -443,6 +547,7 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	 */
 	worker = fr_channel_requestor_uctx_get(ch);
 	worker->stats.out++;
+	if (nr->config.max_queue_delay) fr_network_worker_queue_delay(nr, worker, cd);
 	worker->cpu_time = cd->reply.cpu_time;
 	if (!worker->predicted) {
 		worker->predicted = cd->reply.processing_time;
@@ -459,6 +564,12 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 		fr_network_unsuspend(nr);
 	}
 
+	/*
+	 *	The worker is being removed, and has now replied to
+	 *	everything we sent it.  It can be closed.
+	 */
+	if (worker->draining && (worker->stats.in == worker->stats.out)) fr_network_worker_close(nr, worker);
+
 	/*
 	 *	Ensure that heap insert works.
 	 */
@@ -469,6 +580,116 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	}
 }
 
+/** Move unread requests from a busy worker to an idle one
+ *
+ *  A worker which is stuck in a slow module doesn't read its channel,
+ *  and the requests we sent it sit there while other workers have
+ *  nothing to do.  When a worker has replied to everything we sent
+ *  it, we take back up to half of the requests which the busiest
+ *  worker hasn't yet read, and send them to the idle worker instead.
+ *
+ *  Requests which a worker has already read are never moved.  The
+ *  worker has started them, and it owns them until it replies.
+ *
+ * @param[in] nr	the network
+ * @param[in] idle	the worker which has no outstanding requests.
+ */
+static void fr_network_worker_steal(fr_network_t *nr, fr_network_worker_t *idle)
+{
+	int			i;
+	uint64_t		backlog, max = 0;
+	fr_network_worker_t	*busy = NULL;
+	fr_channel_data_t	*cd;
+	fr_time_t		now;
+
+	if (nr->num_workers < 2) return;
+
+	if (idle->draining || idle->blocked || (idle->stats.in != idle->stats.out) || !fr_channel_active(idle->channel)) return;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		fr_network_worker_t *worker = nr->workers[i];
+
+		if (!worker || (worker == idle) || !fr_channel_active(worker->channel)) continue;
+
+		backlog = worker->stats.in - worker->stats.out;
+		if (backlog > max) {
+			max = backlog;
+			busy = worker;
+		}
+	}
+
+	/*
+	 *	Leave the busy worker with at least one request.
+	 */
+	if (!busy || (max < 2)) return;
+
+	now = fr_time();
+
+	for (backlog = max / 2; backlog > 0; backlog--) {
+		if (!fr_channel_recall_request(busy->channel, &cd)) break;
+
+		busy->stats.in--;
+		if (busy->cpu_time > busy->predicted) {
+			busy->cpu_time -= busy->predicted;
+		} else {
+			busy->cpu_time = 0;
+		}
+
+		/*
+		 *	There's now room in the busy workers queue.
+		 */
+		if (busy->blocked) {
+			busy->blocked = false;
+			nr->num_blocked--;
+			fr_network_unsuspend(nr);
+		}
+
+		/*
+		 *	The channel requires that messages are sent
+		 *	in time order.
+		 */
+		cd->m.when = now;
+		cd->request.stolen = true;
+
+		if (fr_channel_send_request(idle->channel, cd) == 0) {
+			idle->stats.in++;
+			idle->stolen++;
+			idle->cpu_time += idle->predicted;
+			continue;
+		}
+
+		/*
+		 *	The idle worker couldn't take it after all.
+		 *	Give it back.  We just took a message off of
+		 *	this queue, so there is room.
+		 */
+		cd->request.stolen = false;
+		if (fr_channel_send_request(busy->channel, cd) == 0) {
+			busy->stats.in++;
+			busy->cpu_time += busy->predicted;
+			break;
+		}
+
+		{
+			fr_network_socket_t *s;
+
+			s = rbtree_finddata(nr->sockets, &(fr_network_socket_t){ .listen = cd->listen });
+			if (s) {
+				fr_assert(s->outstanding > 0);
+				s->outstanding--;
+				s->stats.dropped++;
+				if (s->dead && !s->outstanding) talloc_free(s);
+			}
+		}
+
+		RATE_LIMIT_GLOBAL(PERROR, "Failed moving packet between workers - dropping packet");
+		talloc_free(cd->packet_ctx);
+		fr_message_done(&cd->m);
+		nr->stats.dropped++;
+		break;
+	}
+}
+
 /** Handle a network control message callback for a channel
  *
  * This is called from the event loop when we get a notification
@@ -501,6 +722,12 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 	case FR_CHANNEL_DATA_READY_REQUESTOR:
 		fr_assert(ch != NULL);
 		while (fr_channel_recv_reply(ch));
+
+		/*
+		 *	The worker may now have nothing to do.
+		 */
+		fr_network_worker_steal(nr, talloc_get_type_abort(fr_channel_requestor_uctx_get(ch),
+								  fr_network_worker_t));
 		break;
 
 	case FR_CHANNEL_DATA_READY_RESPONDER:
@@ -517,11 +744,21 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 								   fr_network_worker_t);
 		int			i;
 
+		DEBUG3("Worker acked our close request");
+
+		/*
+		 *	A worker which was removed is no longer in
+		 *	the array, and nothing else refers to it.
+		 */
+		if (w->draining) {
+			talloc_free(w);
+			break;
+		}
+
 		/*
 		 *	Remove this worker from the array
 		 */
 		for (i = 0; i < nr->num_workers; i++) {
-			DEBUG3("Worker acked our close request");
 			if (nr->workers[i] == w) {
 				nr->workers[i] = NULL;
 
@@ -530,7 +767,9 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 				/*
 				 *	Close the hole...
 				 */
-				memcpy(&nr->workers[i], &nr->workers[i + 1], ((nr->num_workers - i) - 1));
+				memmove(&nr->workers[i], &nr->workers[i + 1],
+					((nr->num_workers - i) - 1) * sizeof(nr->workers[0]));
+				nr->workers[nr->num_workers - 1] = NULL;
 				break;
 			}
 		}
@@ -615,9 +854,28 @@ retry:
 	if (nr->config.max_outstanding &&
 	    ((worker->stats.in - worker->stats.out) >= nr->config.max_outstanding)) {
 		RATE_LIMIT_GLOBAL(PERROR, "max_outstanding reached - dropping packet");
+		nr->num_max_outstanding++;
 		goto drop;
 	}
 
+	/*
+	 *	The worker has a standing queue.  Shed packets which
+	 *	aren't high priority, so that the ones which are get
+	 *	serviced before the NAS gives up on them.
+	 *
+	 *	If the worker has caught up, it can't be overloaded,
+	 *	even if we haven't had a reply to update the delay.
+	 */
+	if (worker->overloaded && (cd->priority < PRIORITY_HIGH)) {
+		if (worker->stats.in == worker->stats.out) {
+			worker->overloaded = false;
+		} else {
+			RATE_LIMIT_GLOBAL(WARN, "Worker queue delay is above max_queue_delay - dropping packet");
+			nr->num_shed++;
+			goto drop;
+		}
+	}
+
 	/*
 	 *	Send the message to the channel.  If we fail, drop the
 	 *	packet.  The only reason for failure is that the
@@ -723,13 +981,20 @@ next_message:
 	/*
 	 *	Poll this socket, but not too often.  We have to go
 	 *	service other sockets, too.
+	 *
+	 *	The exception is when the app_io has already read a
+	 *	batch of packets from the kernel.  The FD won't be
+	 *	readable again until the batch has been drained, so
+	 *	we go through all of it now.  The batch size limits
+	 *	how long we spend here.
 	 */
-	if (num_messages > 16) {
+	if ((num_messages > 16) && !s->listen->read_pending) {
 		s->cd = cd;
 		return;
 	}
 
 	cd->request.is_dup = false;
+	cd->request.stolen = false;
 	cd->priority = PRIORITY_NORMAL;
 
 	/*
@@ -745,6 +1010,16 @@ next_message:
 	data_size = s->listen->app_io->read(s->listen, &cd->packet_ctx, &cd->request.recv_time,
 					    cd->m.data, cd->m.rb_size, &s->leftover, &cd->priority, &cd->request.is_dup);
 	if (data_size == 0) {
+		/*
+		 *	The packet was discarded, but there are more
+		 *	in the batch.  Re-use the same buffer for the
+		 *	next one.
+		 */
+		if (s->listen->read_pending) {
+			num_messages++;
+			goto next_message;
+		}
+
 		/*
 		 *	Cache the message for later.  This is
 		 *	important for stream sockets, which can do
@@ -771,6 +1046,7 @@ next_message:
 	s->cd = NULL;
 
 	DEBUG3("Read %zd byte(s) from FD %u", data_size, sockfd);
+	FR_PROBE2(packet_recv, sockfd, data_size);
 	nr->stats.in++;
 	s->stats.in++;
 
@@ -834,6 +1110,20 @@ next_message:
 		s->outstanding++;
 	}
 
+	/*
+	 *	Datagram sockets don't have leftover data, but the
+	 *	app_io may have read multiple packets at once.
+	 *	Allocate room for the next one.
+	 */
+	if (!next && s->listen->read_pending) {
+		next = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!next) {
+			RATE_LIMIT_GLOBAL(ERROR, "Failed allocating message size %zd! - Deferring batched packets",
+					  s->listen->default_message_size);
+			return;
+		}
+	}
+
 	/*
 	 *	If there is a next message, go read it from the buffer.
 	 *
@@ -1007,6 +1297,7 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		}
 
 		s->written = 0;
+		FR_PROBE2(reply_sent, li->fd, cd->m.data_size);
 
 		/*
 		 *	Reset for the next message.
@@ -1021,6 +1312,36 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		cd = fr_heap_pop(s->waiting);
 	}
 
+	/*
+	 *	The app_io may have queued the packets instead of
+	 *	writing them.  Tell it to send them now.  If the
+	 *	socket isn't writable, wait for it to become
+	 *	writable, and then try again.
+	 */
+	if (li->app_io->flush && (li->app_io->flush(li) < 0)) {
+		if (errno != EWOULDBLOCK) {
+			PERROR("Failed flushing socket %s", s->listen->name);
+			if (li->app_io->error) li->app_io->error(li);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		if (!s->blocked) {
+			if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
+					       fr_network_read,
+					       fr_network_write,
+					       fr_network_error,
+					       s) < 0) {
+				PERROR("Failed adding write callback to event loop");
+				fr_network_socket_dead(nr, s);
+				return;
+			}
+
+			s->blocked = true;
+		}
+		return;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
@@ -1044,6 +1365,7 @@ static int _network_socket_free(fr_network_socket_t *s)
 
 	rbtree_deletebydata(nr->sockets, s);
 	rbtree_deletebydata(nr->sockets_by_num, s);
+	fr_dlist_remove(&nr->flush, s);
 
 	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
@@ -1255,6 +1577,12 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 		if (nr->workers[i]) continue;
 
 		nr->workers[i] = w;
+
+		/*
+		 *	The worker was started while we were exiting.
+		 *	Close it straight away, so that it exits too.
+		 */
+		if (nr->exiting) fr_channel_signal_responder_close(w->channel);
 		return;
 	}
 
@@ -1264,6 +1592,56 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	fr_assert(0 == 1);
 }
 
+/** Handle a network control message callback for a worker being removed
+ *
+ * @param[in] ctx the network
+ * @param[in] data the message
+ * @param[in] data_size size of the data
+ * @param[in] now the current time
+ */
+static void fr_network_worker_remove_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
+{
+	int i;
+	fr_network_t *nr = ctx;
+	fr_worker_t *worker;
+	fr_network_worker_t *w = NULL;
+
+	fr_assert(data_size == sizeof(worker));
+
+	memcpy(&worker, data, data_size);
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (nr->workers[i]->worker != worker) continue;
+
+		w = nr->workers[i];
+		break;
+	}
+
+	if (!w) return;
+
+	/*
+	 *	We always need somewhere to send packets.
+	 */
+	if (nr->num_workers == 1) {
+		ERROR("Refusing to remove the last worker");
+		return;
+	}
+
+	memmove(&nr->workers[i], &nr->workers[i + 1], ((nr->num_workers - i) - 1) * sizeof(nr->workers[0]));
+	nr->workers[--nr->num_workers] = NULL;
+
+	if (w->blocked) {
+		w->blocked = false;
+		nr->num_blocked--;
+		fr_network_unsuspend(nr);
+	}
+
+	w->draining = true;
+	fr_dlist_insert_tail(&nr->draining, w);
+
+	if (w->stats.in == w->stats.out) fr_network_worker_close(nr, w);
+}
+
 /** Handle a network control message callback for a packet sent to a socket
  *
  * @param[in] ctx the network
@@ -1326,6 +1704,7 @@ static int fr_network_pre_event(void *ctx, UNUSED fr_time_t wake)
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_network_socket_t *s;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	/*
@@ -1334,7 +1713,6 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 	 */
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
 		fr_listen_t *li;
-		fr_network_socket_t *s;
 
 		li = cd->listen;
 
@@ -1381,17 +1759,29 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		}
 
 		/*
-		 *	No pending message, let's try writing it.
+		 *	Queue the reply.  All of the replies for a
+		 *	socket are written together below, so that the
+		 *	app_io can coalesce them into fewer system
+		 *	calls.
 		 *
-		 *	If there is a pending message, then we're
-		 *	waiting for IO write to become ready.
+		 *	If the socket is blocked, then we're waiting
+		 *	for IO write to become ready, and the write
+		 *	callback will service the queue.
 		 */
-		if (!s->pending) {
-			fr_assert(!s->blocked);
-			(void) fr_heap_insert(s->waiting, cd);
-			fr_network_write(nr->el, s->listen->fd, 0, s);
+		(void) fr_heap_insert(s->waiting, cd);
+		if (!s->blocked && !fr_dlist_entry_in_list(&s->flush_entry)) {
+			fr_dlist_insert_tail(&nr->flush, s);
 		}
 	}
+
+	/*
+	 *	Write the queued replies, and flush them to the
+	 *	network.
+	 */
+	while ((s = fr_dlist_pop_head(&nr->flush)) != NULL) {
+		fr_assert(!s->pending);
+		fr_network_write(nr->el, s->listen->fd, 0, s);
+	}
 }
 
 /** Stop a network thread in an orderly way
@@ -1404,6 +1794,8 @@ int fr_network_destroy(fr_network_t *nr)
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
+	nr->exiting = true;
+
 	/*
 	 *	Close the network sockets
 	 */
@@ -1454,11 +1846,19 @@ int fr_network_destroy(fr_network_t *nr)
 	{
 		int i;
 
+		fr_network_worker_t *w;
+
 		for (i = 0; i < nr->num_workers; i++) {
 			fr_network_worker_t *worker = nr->workers[i];
 
 			fr_channel_signal_responder_close(worker->channel);
 		}
+
+		/*
+		 *	Workers which are being removed still have
+		 *	requests.  Close them anyway.
+		 */
+		while ((w = fr_dlist_head(&nr->draining)) != NULL) fr_network_worker_close(nr, w);
 	}
 
 	(void) fr_event_pre_delete(nr->el, fr_network_pre_event, nr);
@@ -1646,6 +2046,11 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	if (fr_control_callback_add(nr->control, FR_CONTROL_ID_WORKER_REMOVE, nr, fr_network_worker_remove_callback) < 0) {
+		fr_strerror_const_push("Failed adding worker removal callback");
+		goto fail2;
+	}
+
 	if (fr_control_callback_add(nr->control, FR_CONTROL_ID_INJECT, nr, fr_network_inject_callback) < 0) {
 		fr_strerror_const_push("Failed adding packet injection callback");
 		goto fail2;
@@ -1666,12 +2071,15 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
-	nr->replies = fr_heap_alloc(nr, reply_cmp, fr_channel_data_t, channel.heap_id);
+	nr->replies = fr_heap_dary_alloc(nr, reply_cmp, fr_channel_data_t, channel.heap_id, 4);
 	if (!nr->replies) {
 		fr_strerror_const_push("Failed creating heap for replies");
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+	fr_dlist_init(&nr->draining, fr_network_worker_t, entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
@@ -1697,6 +2105,33 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 	return nr;
 }
 
+/** Whether all of the workers are shedding load
+ *
+ *  i.e. a new packet which isn't high priority will be dropped, no
+ *  matter which worker it is sent to.
+ *
+ * @param[in] nr	the network
+ * @return
+ *	- true if every worker is overloaded or blocked.
+ *	- false otherwise.
+ */
+bool fr_network_overloaded(fr_network_t const *nr)
+{
+	int i;
+
+	if (!nr->num_workers) return false;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		fr_network_worker_t const *worker = nr->workers[i];
+
+		if (!worker) continue;
+
+		if (!worker->blocked && !worker->overloaded) return false;
+	}
+
+	return true;
+}
+
 int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats)
 {
 	if (num < 0) return -1;
@@ -1736,6 +2171,8 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
 	fprintf(fp, "count.sockets\t%u\n", rbtree_num_elements(nr->sockets));
+	fprintf(fp, "count.shed\t%" PRIu64 "\n", nr->num_shed);
+	fprintf(fp, "count.max_outstanding\t%" PRIu64 "\n", nr->num_max_outstanding);
 
 	return 0;
 }
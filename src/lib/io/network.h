@@ -44,6 +44,7 @@ extern "C" {
 
 typedef struct {
 	uint32_t	max_outstanding;
+	fr_time_delta_t	max_queue_delay;	//!< shed low priority packets when workers are slower than this
 } fr_network_config_t;
 
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
@@ -54,6 +55,8 @@ int		fr_network_directory_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull
 
 int		fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
 
+int		fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
+
 void		fr_network_listen_read(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 
 void		fr_network_listen_write(fr_network_t *nr, fr_listen_t *li, uint8_t const *packet, size_t packet_len,
@@ -71,6 +74,8 @@ int		fr_network_destroy(fr_network_t *nr) CC_HINT(nonnull);
 
 void		fr_network(fr_network_t *nr) CC_HINT(nonnull);
 
+bool		fr_network_overloaded(fr_network_t const *nr) CC_HINT(nonnull);
+
 int		fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats) CC_HINT(nonnull);
 
 void		fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log) CC_HINT(nonnull);
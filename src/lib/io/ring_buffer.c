@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/ring_buffer.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/talloc.h>
 #include <string.h>
 
 /*
@@ -91,8 +92,11 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 	size |= size >> 16;
 	size++;
 
-	rb->buffer = talloc_array(rb, uint8_t, size);
-	if (!rb->buffer) {
+	/*
+	 *	Large ring buffers are touched all over, so they're
+	 *	backed by huge pages if the administrator asked for it.
+	 */
+	if (!talloc_huge_page_array(rb, (void **)&rb->buffer, size)) {
 		talloc_free(rb);
 		goto fail;
 	}
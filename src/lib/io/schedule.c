@@ -29,6 +29,7 @@ RCSID("$Id$")
 #include <freeradius-devel/autoconf.h>
 
 #include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/io/stats_shm.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rbtree.h>
 #include <freeradius-devel/util/syserror.h>
@@ -36,6 +37,32 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
+#ifdef __linux__
+#  include <dirent.h>
+#  include <sched.h>
+#endif
+
+#ifndef CPU_SETSIZE
+#  define CPU_SETSIZE (1024)
+#endif
+
+#define MAX_WORKERS		(64)
+
+/*
+ *	How often each thread updates its slot in the statistics
+ *	segment.
+ */
+#define STATS_SHM_INTERVAL	fr_time_delta_from_sec(1)
+
+/*
+ *	Percentage of the available CPU time which the workers have to
+ *	use, for SCALE_CHECKS intervals in a row, before we add or
+ *	remove a worker.
+ */
+#define SCALE_UP_UTILIZATION	(80)
+#define SCALE_DOWN_UTILIZATION	(30)
+#define SCALE_CHECKS		(3)
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -87,8 +114,17 @@ typedef struct {
 
 	unsigned int	id;			//!< a unique ID
 	int		uses;			//!< how many network threads are using it
+	int		cpu;			//!< CPU this thread is pinned to, or -1.
+	int		node;			//!< NUMA node of that CPU, or -1.
 	fr_time_t	cpu_time;		//!< how much CPU time this worker has used
 
+	bool		dynamic;		//!< started at run time.  Nobody waits for us to start.
+	bool		retiring;		//!< removed from the networks, and will exit.
+	bool		commands;		//!< radmin commands have been registered.
+
+	fr_stats_shm_slot_t	*shm_slot;	//!< our slot in the statistics segment.
+	fr_event_timer_t const	*shm_ev;	//!< timer for updating the slot.
+
 	fr_dlist_t	entry;			//!< our entry into the linked list of workers
 
 	fr_schedule_t	*sc;			//!< the scheduler we are running under
@@ -107,6 +143,9 @@ typedef struct {
 	pthread_t	pthread_id;		//!< the thread of this network
 
 	unsigned int	id;			//!< a unique ID
+	int		cpu;			//!< CPU this thread is pinned to, or -1.
+	int		node;			//!< NUMA node of that CPU, or -1.
+	unsigned int	local_workers;		//!< number of workers on the same NUMA node.
 
 	fr_dlist_t	entry;			//!< our entry into the linked list of networks
 
@@ -116,6 +155,10 @@ typedef struct {
 	fr_network_t	*nr;			//!< the receive data structure
 
 	fr_event_timer_t const *ev;		//!< timer for stats_interval
+	fr_event_timer_t const *scale_ev;	//!< timer for scale_interval
+
+	fr_stats_shm_slot_t	*shm_slot;	//!< our slot in the statistics segment.
+	fr_event_timer_t const	*shm_ev;	//!< timer for updating the slot.
 } fr_schedule_network_t;
 
 
@@ -138,6 +181,14 @@ struct fr_schedule_s {
 	sem_t		worker_sem;		//!< for inter-thread signaling
 	sem_t		network_sem;		//!< for inter-thread signaling
 
+	pthread_mutex_t	mutex;			//!< protects the worker list, and the worker status
+						///< once the workers have started.
+
+	fr_time_t	scale_checked;		//!< when we last checked the worker utilization.
+	unsigned int	scale_above;		//!< checks in a row where utilization was high.
+	unsigned int	scale_below;		//!< checks in a row where utilization was low.
+	unsigned int	utilization;		//!< worker utilization, in percent, at the last check.
+
 	fr_schedule_thread_instantiate_t	worker_thread_instantiate;	//!< thread instantiation callback
 	fr_schedule_thread_detach_t		worker_thread_detach;
 
@@ -146,6 +197,14 @@ struct fr_schedule_s {
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
+
+	int		*network_cpus;		//!< CPUs that network threads are pinned to.
+	int		num_network_cpus;
+	int		*worker_cpus;		//!< CPUs that worker threads are pinned to.
+	int		num_worker_cpus;
+
+	fr_stats_shm_t	*stats_shm;		//!< statistics segment, or NULL.
+	fr_event_timer_t const *shm_ev;		//!< timer for updating the segment in single-threaded mode.
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -159,6 +218,213 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Parse a list of CPUs, e.g. "0-3,8,10-11"
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] out	the array of CPU numbers.
+ * @param[in] name	of the configuration item, for error messages.
+ * @param[in] str	the list to parse.
+ * @return
+ *	- <0 on error.
+ *	- the number of CPUs in the list.
+ */
+static int fr_schedule_cpus_parse(TALLOC_CTX *ctx, int **out, char const *name, char const *str)
+{
+	char const	*p = str;
+	int		*cpus = NULL;
+	int		num = 0;
+
+	while (*p) {
+		char		*q;
+		unsigned long	first, last, cpu;
+
+		first = last = strtoul(p, &q, 10);
+		if (q == p) {
+		invalid:
+			fr_strerror_printf("Invalid CPU list '%s' for %s", str, name);
+			talloc_free(cpus);
+			return -1;
+		}
+		p = q;
+
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &q, 10);
+			if ((q == p) || (last < first)) goto invalid;
+			p = q;
+		}
+
+		if (last >= CPU_SETSIZE) goto invalid;
+
+		for (cpu = first; cpu <= last; cpu++) {
+			MEM(cpus = talloc_realloc(ctx, cpus, int, num + 1));
+			cpus[num++] = (int) cpu;
+		}
+
+		if (*p == ',') {
+			p++;
+			if (!*p) goto invalid;
+			continue;
+		}
+
+		if (*p) goto invalid;
+	}
+
+	*out = cpus;
+	return num;
+}
+
+/** Find the NUMA node which a CPU is on
+ *
+ * Each "cpuN" directory in sysfs has a "nodeM" entry for the node it
+ * belongs to.
+ *
+ * @param[in] cpu	to look up.
+ * @return
+ *	- -1 if the node is unknown.
+ *	- the node number.
+ */
+static int fr_schedule_cpu_node(int cpu)
+{
+#ifdef __linux__
+	char		path[64];
+	DIR		*dir;
+	struct dirent	*dp;
+	int		node = -1;
+
+	if (cpu < 0) return -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir) return -1;
+
+	while ((dp = readdir(dir)) != NULL) {
+		char *q;
+		long n;
+
+		if (strncmp(dp->d_name, "node", 4) != 0) continue;
+
+		n = strtol(dp->d_name + 4, &q, 10);
+		if ((q == dp->d_name + 4) || *q || (n < 0)) continue;
+
+		node = (int) n;
+		break;
+	}
+	closedir(dir);
+
+	return node;
+#else
+	return -1;
+#endif
+}
+
+/** Pin the current thread to a CPU
+ *
+ * This is called before the thread allocates any memory.  With the
+ * default "first touch" policy, the kernel then places the thread's
+ * event list, message sets, and ring buffers on the NUMA node of the
+ * CPU we've been pinned to.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for log messages.
+ * @param[in] cpu	to pin to.  -1 means "don't pin".
+ * @param[in] node	the CPU is on, for log messages.
+ */
+static void fr_schedule_thread_pin(fr_schedule_t *sc, char const *name, int cpu, int node)
+{
+#ifdef __linux__
+	cpu_set_t	set;
+	int		ret;
+
+	if (cpu < 0) return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		WARN("%s - Failed pinning thread to CPU %d: %s", name, cpu, fr_syserror(ret));
+		return;
+	}
+
+	if (node < 0) {
+		INFO("%s - Pinned to CPU %d", name, cpu);
+	} else {
+		INFO("%s - Pinned to CPU %d on NUMA node %d", name, cpu, node);
+	}
+#else
+	if (cpu >= 0) WARN("%s - Pinning threads to CPUs is not supported on this platform", name);
+#endif
+}
+
+/** Whether a worker should be used by a network thread
+ *
+ * When we know which NUMA nodes the threads are on, network threads
+ * use only the workers on their own node.  If a network thread has
+ * no workers on its node, it uses all of them.
+ */
+static inline CC_HINT(always_inline) bool fr_schedule_same_node(fr_schedule_network_t const *sn,
+								  fr_schedule_worker_t const *sw)
+{
+	if ((sn->node < 0) || (sw->node < 0) || !sn->local_workers) return true;
+
+	return (sn->node == sw->node);
+}
+
+static void stats_shm_network_publish(fr_stats_shm_slot_t *slot, fr_network_t const *nr,
+				      fr_stats_shm_state_t state)
+{
+	uint64_t	stats[FR_STATS_SHM_MAX_STATS];
+
+	fr_stats_shm_publish(slot, state, stats, fr_network_stats(nr, NUM_ELEMENTS(stats), stats));
+}
+
+static void stats_shm_worker_publish(fr_stats_shm_slot_t *slot, fr_worker_t const *worker,
+				     fr_stats_shm_state_t state)
+{
+	uint64_t	stats[FR_STATS_SHM_MAX_STATS];
+	int		num;
+
+	num = fr_worker_stats(worker, NUM_ELEMENTS(stats) - 1, stats);
+	if (num < 0) return;
+	stats[num++] = fr_worker_cpu_used(worker);
+
+	fr_stats_shm_publish(slot, state, stats, num);
+}
+
+static void stats_shm_worker_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_schedule_worker_t	*sw = talloc_get_type_abort(uctx, fr_schedule_worker_t);
+
+	stats_shm_worker_publish(sw->shm_slot, sw->worker, FR_STATS_SHM_SLOT_RUNNING);
+
+	(void) fr_event_timer_at(sw->ctx, el, &sw->shm_ev, now + STATS_SHM_INTERVAL, stats_shm_worker_timer, sw);
+}
+
+static void stats_shm_network_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_schedule_network_t	*sn = talloc_get_type_abort(uctx, fr_schedule_network_t);
+
+	stats_shm_network_publish(sn->shm_slot, sn->nr, FR_STATS_SHM_SLOT_RUNNING);
+
+	(void) fr_event_timer_at(sn->ctx, el, &sn->shm_ev, now + STATS_SHM_INTERVAL, stats_shm_network_timer, sn);
+}
+
+/** Update both slots in single-threaded mode
+ *
+ */
+static void stats_shm_single_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_schedule_t		*sc = talloc_get_type_abort(uctx, fr_schedule_t);
+
+	stats_shm_network_publish(fr_stats_shm_network_slot(sc->stats_shm, 0), sc->single_network,
+				  FR_STATS_SHM_SLOT_RUNNING);
+	stats_shm_worker_publish(fr_stats_shm_worker_slot(sc->stats_shm, 0), sc->single_worker,
+				 FR_STATS_SHM_SLOT_RUNNING);
+
+	(void) fr_event_timer_at(sc, el, &sc->shm_ev, now + STATS_SHM_INTERVAL, stats_shm_single_timer, sc);
+}
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -177,6 +443,8 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
+	fr_schedule_thread_pin(sc, worker_name, sw->cpu, sw->node);
+
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", worker_name);
@@ -216,23 +484,44 @@ static void *fr_schedule_worker_thread(void *arg)
 		}
 	}
 
+	/*
+	 *	The scheduler may have stopped while a worker we added
+	 *	at run time was starting.  The networks are exiting,
+	 *	so we don't add ourselves to them.
+	 */
+	pthread_mutex_lock(&sc->mutex);
+	if (!sc->running) {
+		pthread_mutex_unlock(&sc->mutex);
+		status = FR_CHILD_EXITED;
+		goto fail;
+	}
+
 	sw->status = FR_CHILD_RUNNING;
 
 	/*
-	 *	Add this worker to all network threads.
+	 *	Add this worker to all network threads on the same
+	 *	NUMA node.
 	 */
 	for (sn = fr_dlist_head(&sc->networks);
 	       sn != NULL;
 	       sn = fr_dlist_next(&sc->networks, sn)) {
+		if (!fr_schedule_same_node(sn, sw)) continue;
+
 		(void) fr_network_worker_add(sn->nr, sw->worker);
 	}
+	pthread_mutex_unlock(&sc->mutex);
 
 	DEBUG3("%s - Started", worker_name);
 
 	/*
 	 *	Tell the originator that the thread has started.
 	 */
-	sem_post(&sc->worker_sem);
+	if (!sw->dynamic) sem_post(&sc->worker_sem);
+
+	if (sc->stats_shm) {
+		sw->shm_slot = fr_stats_shm_worker_slot(sc->stats_shm, sw->id);
+		if (sw->shm_slot) stats_shm_worker_timer(sw->el, fr_time(), sw);
+	}
 
 	/*
 	 *	Do all of the work.
@@ -241,10 +530,19 @@ static void *fr_schedule_worker_thread(void *arg)
 	 */
 	fr_worker(sw->worker);
 
+	if (sw->shm_slot) stats_shm_worker_publish(sw->shm_slot, sw->worker, FR_STATS_SHM_SLOT_EXITED);
+
 	status = FR_CHILD_EXITED;
 
 fail:
+	/*
+	 *	Radmin commands and the scaling checks look at the
+	 *	worker while holding the mutex.  Once the status has
+	 *	changed, they leave it alone.
+	 */
+	pthread_mutex_lock(&sc->mutex);
 	sw->status = status;
+	pthread_mutex_unlock(&sc->mutex);
 
 	if (sw->worker) {
 		fr_worker_destroy(sw->worker);
@@ -280,6 +578,386 @@ static void stats_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	(void) fr_event_timer_at(sn, el, &sn->ev, now + sn->sc->config->stats_interval, stats_timer, sn);
 }
 
+/** A worker which is, or will be, taking requests
+ *
+ */
+#define WORKER_ACTIVE(_sw) ((((_sw)->status == FR_CHILD_INITIALIZING) || ((_sw)->status == FR_CHILD_RUNNING)) && \
+			    !(_sw)->retiring)
+
+static int cmd_stats_worker(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	fr_schedule_worker_t	*sw = talloc_get_type_abort(ctx, fr_schedule_worker_t);
+	fr_schedule_t		*sc = sw->sc;
+	int			ret;
+
+	/*
+	 *	The worker may be exiting, so we can't look at it
+	 *	without the mutex.
+	 */
+	pthread_mutex_lock(&sc->mutex);
+	if ((sw->status != FR_CHILD_RUNNING) || !sw->worker) {
+		pthread_mutex_unlock(&sc->mutex);
+		fprintf(fp_err, "Worker %u is not running\n", sw->id);
+		return -1;
+	}
+
+	ret = fr_worker_cmd_stats(fp, fp_err, sw->worker, info);
+	pthread_mutex_unlock(&sc->mutex);
+
+	return ret;
+}
+
+/*
+ *	Workers may be stopped and started at run time, so the commands
+ *	refer to the scheduler's view of the worker, and not to the
+ *	fr_worker_t.
+ */
+static fr_cmd_table_t cmd_schedule_worker_table[] = {
+	{
+		.parent = "stats",
+		.name = "worker",
+		.help = "Statistics for workers threads.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats worker",
+		.add_name = true,
+		.name = "self",
+		.syntax = "[(count|cpu|memory|modules|folded)]",
+		.func = cmd_stats_worker,
+		.help = "Show statistics for a specific worker thread.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Start a new worker thread at run time
+ *
+ * The worker uses the lowest free ID, so that the IDs of the running
+ * workers stay contiguous.  It adds itself to the networks once it has
+ * started.
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] sc	the scheduler.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_schedule_worker_start(fr_schedule_t *sc)
+{
+	fr_schedule_worker_t	*sw = NULL;
+	unsigned int		id;
+
+	for (id = 0; id < MAX_WORKERS; id++) {
+		for (sw = fr_dlist_head(&sc->workers);
+		     sw != NULL;
+		     sw = fr_dlist_next(&sc->workers, sw)) {
+			if (sw->id == id) break;
+		}
+
+		if (!sw || (sw->status == FR_CHILD_FREE) ||
+		    (sw->status == FR_CHILD_EXITED) || (sw->status == FR_CHILD_FAIL)) break;
+	}
+
+	if (id == MAX_WORKERS) {
+		fr_strerror_printf("Already running the maximum of %u workers", MAX_WORKERS);
+		return -1;
+	}
+
+	if (!sw) {
+		MEM(sw = talloc_zero(sc, fr_schedule_worker_t));
+		sw->id = id;
+		sw->sc = sc;
+
+		sw->cpu = sw->node = -1;
+		if (sc->num_worker_cpus) {
+			sw->cpu = sc->worker_cpus[id % sc->num_worker_cpus];
+			sw->node = fr_schedule_cpu_node(sw->cpu);
+		}
+		fr_dlist_insert_tail(&sc->workers, sw);
+
+	} else if (sw->status != FR_CHILD_FREE) {
+		/*
+		 *	The old thread has exited.  Reap it, and
+		 *	consume the semaphore it posted on exit.
+		 */
+		if (pthread_join(sw->pthread_id, NULL) != 0) {
+			ERROR("Failed joining worker %u: %s", sw->id, fr_syserror(errno));
+		}
+		SEM_WAIT_INTR(&sc->worker_sem);
+	}
+
+	TALLOC_FREE(sw->ctx);
+	sw->el = NULL;
+	sw->worker = NULL;
+	sw->cpu_time = 0;
+	sw->retiring = false;
+	sw->dynamic = true;
+	sw->status = FR_CHILD_INITIALIZING;
+
+	if (!sw->commands) {
+		char buffer[32];
+
+		snprintf(buffer, sizeof(buffer), "%u", sw->id);
+		if (fr_command_register_hook(NULL, buffer, sw, cmd_schedule_worker_table) < 0) {
+			PWARN("Worker %u - Failed adding worker commands", sw->id);
+		} else {
+			sw->commands = true;
+		}
+	}
+
+	if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
+		sw->status = FR_CHILD_FREE;
+		fr_strerror_printf_push("Failed creating worker %u", sw->id);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Whether a worker can be stopped
+ *
+ * Every network it serves must have another worker to send packets to.
+ */
+static bool fr_schedule_worker_stoppable(fr_schedule_t *sc, fr_schedule_worker_t *sw)
+{
+	fr_schedule_network_t	*sn;
+	fr_schedule_worker_t	*other;
+
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		bool found = false;
+
+		if (!fr_schedule_same_node(sn, sw)) continue;
+
+		for (other = fr_dlist_head(&sc->workers);
+		     other != NULL;
+		     other = fr_dlist_next(&sc->workers, other)) {
+			if ((other == sw) || (other->status != FR_CHILD_RUNNING) || other->retiring) continue;
+			if (!fr_schedule_same_node(sn, other)) continue;
+
+			found = true;
+			break;
+		}
+
+		if (!found) return false;
+	}
+
+	return true;
+}
+
+/** Stop a worker thread at run time
+ *
+ * The worker with the highest ID is removed from the networks.  They
+ * stop sending it packets, and close their channels once it has
+ * replied to the ones it already has.  The worker then exits.
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] sc	the scheduler.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_schedule_worker_stop(fr_schedule_t *sc)
+{
+	fr_schedule_worker_t	*sw, *found = NULL;
+	fr_schedule_network_t	*sn;
+
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		if ((sw->status != FR_CHILD_RUNNING) || sw->retiring) continue;
+		if (found && (found->id > sw->id)) continue;
+		if (!fr_schedule_worker_stoppable(sc, sw)) continue;
+
+		found = sw;
+	}
+
+	if (!found) {
+		fr_strerror_const("No worker can be stopped");
+		return -1;
+	}
+
+	INFO("Worker %u - Stopping", found->id);
+
+	found->retiring = true;
+
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		if (!fr_schedule_same_node(sn, found)) continue;
+
+		(void) fr_network_worker_remove(sn->nr, found->worker);
+	}
+
+	return 0;
+}
+
+/** Start or stop workers until there are "num" of them
+ *
+ * @note Must be called with the mutex held.
+ */
+static int fr_schedule_workers_set(fr_schedule_t *sc, unsigned int num)
+{
+	fr_schedule_worker_t	*sw;
+	unsigned int		active = 0;
+
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		if (WORKER_ACTIVE(sw)) active++;
+	}
+
+	for (; active < num; active++) {
+		if (fr_schedule_worker_start(sc) < 0) return -1;
+	}
+
+	for (; active > num; active--) {
+		if (fr_schedule_worker_stop(sc) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Add or remove workers, based on how busy they've been
+ *
+ * The utilization is the CPU time which the workers spent processing
+ * requests since the last check, as a percentage of the time which
+ * was available to them.
+ */
+static void scale_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_schedule_network_t	*sn = talloc_get_type_abort(uctx, fr_schedule_network_t);
+	fr_schedule_t		*sc = sn->sc;
+	fr_schedule_worker_t	*sw;
+	fr_time_delta_t		elapsed;
+	uint64_t		used = 0;
+	unsigned int		num = 0, active = 0;
+
+	pthread_mutex_lock(&sc->mutex);
+
+	elapsed = now - sc->scale_checked;
+	sc->scale_checked = now;
+
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		fr_time_t cpu_time;
+
+		if (WORKER_ACTIVE(sw)) active++;
+
+		if ((sw->status != FR_CHILD_RUNNING) || sw->retiring || !sw->worker) continue;
+
+		cpu_time = fr_worker_cpu_used(sw->worker);
+		if (cpu_time > sw->cpu_time) used += cpu_time - sw->cpu_time;
+		sw->cpu_time = cpu_time;
+		num++;
+	}
+
+	if (!sc->running || !num || (elapsed <= 0)) goto done;
+
+	sc->utilization = (used * 100) / ((uint64_t) elapsed * num);
+
+	if (sc->utilization >= SCALE_UP_UTILIZATION) {
+		sc->scale_above++;
+		sc->scale_below = 0;
+	} else if (sc->utilization <= SCALE_DOWN_UTILIZATION) {
+		sc->scale_below++;
+		sc->scale_above = 0;
+	} else {
+		sc->scale_above = sc->scale_below = 0;
+	}
+
+	if ((sc->scale_above >= SCALE_CHECKS) && (active < sc->config->scale_max_workers)) {
+		sc->scale_above = 0;
+
+		INFO("Worker utilization is %u%%, adding a worker", sc->utilization);
+		if (fr_schedule_workers_set(sc, active + 1) < 0) PERROR("Failed adding worker");
+
+	} else if ((sc->scale_below >= SCALE_CHECKS) && (active > sc->config->scale_min_workers)) {
+		sc->scale_below = 0;
+
+		INFO("Worker utilization is %u%%, removing a worker", sc->utilization);
+		if (fr_schedule_workers_set(sc, active - 1) < 0) PERROR("Failed removing worker");
+	}
+
+done:
+	pthread_mutex_unlock(&sc->mutex);
+
+	(void) fr_event_timer_at(sn, el, &sn->scale_ev, now + sc->config->scale_interval, scale_timer, sn);
+}
+
+static int cmd_set_workers(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	fr_schedule_t	*sc = talloc_get_type_abort(ctx, fr_schedule_t);
+	int		num = atoi(info->argv[0]);
+
+	if ((num < 1) || (num > MAX_WORKERS)) {
+		fprintf(fp_err, "Invalid number of workers '%s'\n", info->argv[0]);
+		return -1;
+	}
+
+	pthread_mutex_lock(&sc->mutex);
+	if (fr_schedule_workers_set(sc, num) < 0) {
+		pthread_mutex_unlock(&sc->mutex);
+		fprintf(fp_err, "Failed changing the number of workers: %s\n", fr_strerror());
+		return -1;
+	}
+	pthread_mutex_unlock(&sc->mutex);
+
+	return 0;
+}
+
+static int cmd_show_workers(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_schedule_t		*sc = talloc_get_type_abort(ctx, fr_schedule_t);
+	fr_schedule_worker_t	*sw;
+	unsigned int		active = 0, stopping = 0;
+
+	pthread_mutex_lock(&sc->mutex);
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		if (WORKER_ACTIVE(sw)) active++;
+		if ((sw->status == FR_CHILD_RUNNING) && sw->retiring) stopping++;
+	}
+	pthread_mutex_unlock(&sc->mutex);
+
+	fprintf(fp, "workers.active\t\t%u\n", active);
+	fprintf(fp, "workers.stopping\t%u\n", stopping);
+	fprintf(fp, "workers.min\t\t%u\n", sc->config->scale_min_workers);
+	fprintf(fp, "workers.max\t\t%u\n", sc->config->scale_max_workers);
+	fprintf(fp, "workers.utilization\t%u\n", sc->utilization);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_schedule_table[] = {
+	{
+		.parent = "set",
+		.name = "workers",
+		.syntax = "INTEGER",
+		.func = cmd_set_workers,
+		.help = "Change the number of worker threads.",
+		.read_only = false
+	},
+
+	{
+		.parent = "show",
+		.name = "workers",
+		.func = cmd_show_workers,
+		.help = "Show the number of worker threads, and how busy they are.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 /** Initialize and run the network thread.
  *
  * @param[in] arg the fr_schedule_network_t
@@ -298,6 +976,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	INFO("%s - Starting", network_name);
 
+	fr_schedule_thread_pin(sc, network_name, sn->cpu, sn->node);
+
 	sn->ctx = ctx = talloc_init("%s", network_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", network_name);
@@ -330,6 +1010,23 @@ static void *fr_schedule_network_thread(void *arg)
 	 */
 	if (sc->config->stats_interval) (void) fr_event_timer_in(sn, el, &sn->ev, sn->sc->config->stats_interval, stats_timer, sn);
 
+	/*
+	 *	Publish our counters in the statistics segment.
+	 */
+	if (sc->stats_shm) {
+		sn->shm_slot = fr_stats_shm_network_slot(sc->stats_shm, sn->id);
+		if (sn->shm_slot) stats_shm_network_timer(el, fr_time(), sn);
+	}
+
+	/*
+	 *	The first network checks whether we need more, or
+	 *	fewer, workers.
+	 */
+	if ((sn->id == 0) && (sc->config->scale_min_workers < sc->config->scale_max_workers)) {
+		sc->scale_checked = fr_time();
+		(void) fr_event_timer_in(sn, el, &sn->scale_ev, sc->config->scale_interval, scale_timer, sn);
+	}
+
 	/*
 	 *	Call the main event processing loop of the network
 	 *	thread Will not return until the worker is about
@@ -337,6 +1034,8 @@ static void *fr_schedule_network_thread(void *arg)
 	 */
 	fr_network(sn->nr);
 
+	if (sn->shm_slot) stats_shm_network_publish(sn->shm_slot, sn->nr, FR_STATS_SHM_SLOT_EXITED);
+
 	status = FR_CHILD_EXITED;
 
 fail:
@@ -486,6 +1185,15 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		(void) fr_network_worker_add(sc->single_network, sc->single_worker);
 		DEBUG("Scheduler created in single-threaded mode");
 
+		if (sc->config->stats_file) {
+			sc->stats_shm = fr_stats_shm_create(sc, sc->config->stats_file, 1, 1);
+			if (!sc->stats_shm) {
+				PERROR("Failed creating statistics segment");
+				goto st_fail;
+			}
+			stats_shm_single_timer(el, fr_time(), sc);
+		}
+
 		if (fr_event_pre_insert(el, fr_worker_pre_event, sc->single_worker) < 0) {
 			fr_strerror_const("Failed adding pre-check to event list");
 			goto st_fail;
@@ -515,7 +1223,38 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		if (sc->config->max_networks < 1) sc->config->max_networks = 1;
 		if (sc->config->max_networks > 64) sc->config->max_networks = 64;
 		if (sc->config->max_workers < 1) sc->config->max_workers = 1;
-		if (sc->config->max_workers > 64) sc->config->max_workers = 64;
+		if (sc->config->max_workers > MAX_WORKERS) sc->config->max_workers = MAX_WORKERS;
+
+		if (sc->config->network_cpus) {
+			sc->num_network_cpus = fr_schedule_cpus_parse(sc, &sc->network_cpus,
+								      "network_cpus", sc->config->network_cpus);
+			if (sc->num_network_cpus < 0) {
+			cpus_fail:
+				PERROR("Failed parsing thread configuration");
+				talloc_free(sc);
+				return NULL;
+			}
+		}
+
+		if (sc->config->worker_cpus) {
+			sc->num_worker_cpus = fr_schedule_cpus_parse(sc, &sc->worker_cpus,
+								     "worker_cpus", sc->config->worker_cpus);
+			if (sc->num_worker_cpus < 0) goto cpus_fail;
+		}
+
+		/*
+		 *	Workers started at run time may use any ID up to
+		 *	MAX_WORKERS, so they all get a slot.
+		 */
+		if (sc->config->stats_file) {
+			sc->stats_shm = fr_stats_shm_create(sc, sc->config->stats_file,
+							    sc->config->max_networks, MAX_WORKERS);
+			if (!sc->stats_shm) {
+				PERROR("Failed creating statistics segment");
+				talloc_free(sc);
+				return NULL;
+			}
+		}
 	}
 
 	/*
@@ -538,6 +1277,21 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	pthread_mutex_init(&sc->mutex, NULL);
+
+	/*
+	 *	The workers may be scaled between these limits.  By
+	 *	default, we always run the configured number.
+	 */
+	if (!sc->config->scale_min_workers || (sc->config->scale_min_workers > sc->config->max_workers)) {
+		sc->config->scale_min_workers = sc->config->max_workers;
+	}
+	if (sc->config->scale_max_workers < sc->config->max_workers) {
+		sc->config->scale_max_workers = sc->config->max_workers;
+	}
+	if (sc->config->scale_max_workers > MAX_WORKERS) sc->config->scale_max_workers = MAX_WORKERS;
+	if (!sc->config->scale_interval) sc->config->scale_interval = fr_time_delta_from_sec(10);
+
 	/*
 	 *	Create the network threads first.
 	 */
@@ -556,6 +1310,16 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		sn->id = i;
 		sn->sc = sc;
 		sn->status = FR_CHILD_INITIALIZING;
+
+		/*
+		 *	Threads are given CPUs from the list in
+		 *	round-robin order.
+		 */
+		sn->cpu = sn->node = -1;
+		if (sc->num_network_cpus) {
+			sn->cpu = sc->network_cpus[i % sc->num_network_cpus];
+			sn->node = fr_schedule_cpu_node(sn->cpu);
+		}
 		fr_dlist_insert_head(&sc->networks, sn);
 
 		if (fr_schedule_pthread_create(&sn->pthread_id, fr_schedule_network_thread, sn) < 0) {
@@ -597,6 +1361,24 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	/*
+	 *	Count the workers which will be on the same NUMA node
+	 *	as each network thread.  This has to be done before
+	 *	any worker starts, as they use the counts to decide
+	 *	which network threads they will serve.
+	 */
+	for (i = 0; sc->num_worker_cpus && (i < sc->config->max_workers); i++) {
+		int node = fr_schedule_cpu_node(sc->worker_cpus[i % sc->num_worker_cpus]);
+
+		if (node < 0) continue;
+
+		for (sn = fr_dlist_head(&sc->networks);
+		     sn != NULL;
+		     sn = fr_dlist_next(&sc->networks, sn)) {
+			if (sn->node == node) sn->local_workers++;
+		}
+	}
+
 	/*
 	 *	Create all of the workers.
 	 */
@@ -615,6 +1397,12 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		sw->id = i;
 		sw->sc = sc;
 		sw->status = FR_CHILD_INITIALIZING;
+
+		sw->cpu = sw->node = -1;
+		if (sc->num_worker_cpus) {
+			sw->cpu = sc->worker_cpus[i % sc->num_worker_cpus];
+			sw->node = fr_schedule_cpu_node(sw->cpu);
+		}
 		fr_dlist_insert_head(&sc->workers, sw);
 
 		if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
@@ -657,18 +1445,22 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
-	for (sw = fr_dlist_head(&sc->workers), i = 0;
+	for (sw = fr_dlist_head(&sc->workers);
 	     sw != NULL;
-	     sw = next_sw, i++) {
+	     sw = fr_dlist_next(&sc->workers, sw)) {
 		char buffer[32];
 
-		next_sw = fr_dlist_next(&sc->workers, sw);
-
-		snprintf(buffer, sizeof(buffer), "%d", i);
-		if (fr_command_register_hook(NULL, buffer, sw->worker, cmd_worker_table) < 0) {
+		snprintf(buffer, sizeof(buffer), "%u", sw->id);
+		if (fr_command_register_hook(NULL, buffer, sw, cmd_schedule_worker_table) < 0) {
 			PERROR("Failed adding worker commands");
 			goto st_fail;
 		}
+		sw->commands = true;
+	}
+
+	if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+		PERROR("Failed adding scheduler commands");
+		goto st_fail;
 	}
 
 	for (sn = fr_dlist_head(&sc->networks), i = 0;
@@ -705,27 +1497,42 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 {
 	fr_schedule_t		*sc = *sc_to_free;
-	unsigned int		i;
+	unsigned int		i, num;
 	fr_schedule_worker_t	*sw;
 	fr_schedule_network_t	*sn;
 
 	if (!sc) return 0;
 
-	sc->running = false;
-
 	/*
 	 *	Single threaded mode: kill the only network / worker we have.
 	 */
 	if (sc->el) {
+		sc->running = false;
+
 		/*
 		 *	Destroy the network side first.  It tells the
 		 *	workers to close.
 		 */
+		if (sc->stats_shm) {
+			fr_event_timer_delete(&sc->shm_ev);
+			stats_shm_network_publish(fr_stats_shm_network_slot(sc->stats_shm, 0), sc->single_network,
+						  FR_STATS_SHM_SLOT_EXITED);
+			stats_shm_worker_publish(fr_stats_shm_worker_slot(sc->stats_shm, 0), sc->single_worker,
+						 FR_STATS_SHM_SLOT_EXITED);
+		}
 		fr_network_destroy(sc->single_network);
 		fr_worker_destroy(sc->single_worker);
 		goto done;
 	}
 
+	/*
+	 *	Workers which are starting check this, and don't add
+	 *	themselves to the networks.
+	 */
+	pthread_mutex_lock(&sc->mutex);
+	sc->running = false;
+	pthread_mutex_unlock(&sc->mutex);
+
 	/*
 	 *	Signal each network thread to exit.
 	 */
@@ -772,10 +1579,19 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 	 *	Wait for all worker threads to finish.  THEN clean up
 	 *	modules.  Otherwise, the modules will be removed from
 	 *	underneath the workers!
+	 *
+	 *	Workers which we failed to start at run time have no
+	 *	thread.
 	 */
-	for (i = 0; i < (unsigned int)fr_dlist_num_elements(&sc->workers); i++) {
-		DEBUG2("Scheduler - Waiting for semaphore indicating worker exit %u/%u", i + 1,
-		       (unsigned int)fr_dlist_num_elements(&sc->workers));
+	num = 0;
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		if (sw->status != FR_CHILD_FREE) num++;
+	}
+
+	for (i = 0; i < num; i++) {
+		DEBUG2("Scheduler - Waiting for semaphore indicating worker exit %u/%u", i + 1, num);
 		SEM_WAIT_INTR(&sc->worker_sem);
 	}
 	DEBUG2("Scheduler - All workers indicated exit complete");
@@ -786,6 +1602,8 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 	while ((sw = fr_dlist_head(&sc->workers)) != NULL) {
 		fr_dlist_remove(&sc->workers, sw);
 
+		if (sw->status == FR_CHILD_FREE) continue;
+
 		/*
 		 *	Ensure that the thread has exited before
 		 *	cleaning up the context.
@@ -804,6 +1622,7 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 
 	sem_destroy(&sc->network_sem);
 	sem_destroy(&sc->worker_sem);
+	pthread_mutex_destroy(&sc->mutex);
 done:
 	/*
 	 *	Now that all of the workers are done, we can return to
@@ -847,6 +1666,61 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	return nr;
 }
 
+/** Return the number of network threads
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads which a listener may be added to.
+ */
+unsigned int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return fr_dlist_num_elements(&sc->networks);
+}
+
+/** Add a fr_listen_t to a particular network thread.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] li the ctx and callbacks for the transport.
+ * @param[in] id of the network thread.  This is taken modulo the number
+ *		 of network threads.
+ * @return
+ *	- NULL on error
+ *	- the fr_network_t that the socket was added to.
+ */
+fr_network_t *fr_schedule_listen_add_id(fr_schedule_t *sc, fr_listen_t *li, unsigned int id)
+{
+	fr_network_t *nr = NULL;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) {
+		nr = sc->single_network;
+	} else {
+		fr_schedule_network_t *sn;
+
+		id %= fr_dlist_num_elements(&sc->networks);
+
+		for (sn = fr_dlist_head(&sc->networks);
+		     sn != NULL;
+		     sn = fr_dlist_next(&sc->networks, sn)) {
+			if (sn->id != id) continue;
+
+			nr = sn->nr;
+			break;
+		}
+
+		if (!nr) {
+			fr_strerror_printf("No network thread %u", id);
+			return NULL;
+		}
+	}
+
+	if (fr_network_listen_add(nr, li) < 0) return NULL;
+
+	return nr;
+}
+
 /** Add a directory NOTE_EXTEND to a scheduler.
  *
  * @param[in] sc the scheduler
@@ -68,6 +68,15 @@ typedef struct {
 	fr_network_config_t network;		//!< configuration for each network;
 
 	fr_time_delta_t	stats_interval;		//!< print channel statistics
+
+	uint32_t	scale_min_workers;	//!< fewest workers to scale down to.
+	uint32_t	scale_max_workers;	//!< most workers to scale up to.
+	fr_time_delta_t	scale_interval;		//!< how often to check worker utilization.
+
+	char const	*network_cpus;		//!< CPUs to pin network threads to, e.g. "0-3,8".
+	char const	*worker_cpus;		//!< CPUs to pin worker threads to.
+
+	char const	*stats_file;		//!< Shared memory segment to publish statistics in.
 } fr_schedule_config_t;
 
 int			fr_schedule_worker_id(void);
@@ -81,6 +90,8 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 int			fr_schedule_destroy(fr_schedule_t **sc);
 
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
+fr_network_t		*fr_schedule_listen_add_id(fr_schedule_t *sc, fr_listen_t *li, unsigned int id) CC_HINT(nonnull);
+unsigned int		fr_schedule_num_networks(fr_schedule_t const *sc) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
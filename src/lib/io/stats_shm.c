@@ -0,0 +1,282 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Statistics published in a shared memory segment
+ * @file io/stats_shm.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/stats_shm.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/time.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct fr_stats_shm_s {
+	char const		*filename;	//!< Of the segment.
+	fr_stats_shm_header_t	*hdr;		//!< Start of the mapping.
+	size_t			len;		//!< Length of the mapping.
+};
+
+static int _stats_shm_free(fr_stats_shm_t *shm)
+{
+	/*
+	 *	Collectors which still have it mapped see the last
+	 *	values.  Ones which look for it later see that the
+	 *	server has gone.
+	 */
+	unlink(shm->filename);
+	munmap(shm->hdr, shm->len);
+
+	return 0;
+}
+
+/** Create a statistics segment, and map it
+ *
+ * The segment is created under a temporary name, and renamed into
+ * place once it's been initialised.  Collectors which still have an
+ * old segment mapped keep the old file, and don't see it truncated.
+ *
+ * @param[in] ctx		to allocate the segment handle in.
+ *				Freeing it unmaps, and removes, the segment.
+ * @param[in] filename		of the segment.
+ * @param[in] num_networks	Number of network slots.
+ * @param[in] num_workers	Number of worker slots.
+ * @return
+ *	- The new segment handle.
+ *	- NULL on error.
+ */
+fr_stats_shm_t *fr_stats_shm_create(TALLOC_CTX *ctx, char const *filename,
+				    uint32_t num_networks, uint32_t num_workers)
+{
+	fr_stats_shm_t		*shm;
+	fr_stats_shm_slot_t	*slot;
+	char			*tmp;
+	size_t			len;
+	uint32_t		i;
+	int			fd;
+	void			*addr;
+
+	len = sizeof(fr_stats_shm_header_t) + ((size_t)(num_networks + num_workers) * sizeof(fr_stats_shm_slot_t));
+
+	tmp = talloc_typed_asprintf(NULL, "%s.tmp", filename);
+	if (!tmp) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fr_strerror_printf("Failed creating stats segment \"%s\": %s", tmp, fr_syserror(errno));
+		talloc_free(tmp);
+		return NULL;
+	}
+
+	if (ftruncate(fd, len) < 0) {
+		fr_strerror_printf("Failed sizing stats segment \"%s\": %s", tmp, fr_syserror(errno));
+	error:
+		close(fd);
+		unlink(tmp);
+		talloc_free(tmp);
+		return NULL;
+	}
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping stats segment \"%s\": %s", tmp, fr_syserror(errno));
+		goto error;
+	}
+
+	shm = talloc_zero(ctx, fr_stats_shm_t);
+	if (!shm) {
+		fr_strerror_const("Out of memory");
+		munmap(addr, len);
+		goto error;
+	}
+	shm->hdr = addr;
+	shm->len = len;
+	shm->filename = talloc_typed_strdup(shm, filename);
+
+	/*
+	 *	The file is zeroed by ftruncate(), so all of the
+	 *	slots start out as FR_STATS_SHM_SLOT_FREE.
+	 */
+	shm->hdr->version = FR_STATS_SHM_VERSION;
+	shm->hdr->size = len;
+	shm->hdr->pid = getpid();
+	shm->hdr->num_networks = num_networks;
+	shm->hdr->num_workers = num_workers;
+	shm->hdr->started = fr_time_to_unix_time(fr_time());
+
+	slot = (fr_stats_shm_slot_t *)(shm->hdr + 1);
+	for (i = 0; i < num_networks; i++) slot[i].id = i;
+	for (i = 0; i < num_workers; i++) slot[num_networks + i].id = i;
+
+	atomic_thread_fence(memory_order_release);
+	shm->hdr->magic = FR_STATS_SHM_MAGIC;
+
+	if (rename(tmp, filename) < 0) {
+		fr_strerror_printf("Failed renaming stats segment \"%s\" to \"%s\": %s",
+				   tmp, filename, fr_syserror(errno));
+		munmap(addr, len);
+		talloc_free(shm);
+		goto error;
+	}
+	close(fd);
+	talloc_free(tmp);
+
+	talloc_set_destructor(shm, _stats_shm_free);
+
+	return shm;
+}
+
+/** Return the slot a network thread writes to
+ *
+ */
+fr_stats_shm_slot_t *fr_stats_shm_network_slot(fr_stats_shm_t *shm, uint32_t id)
+{
+	if (id >= shm->hdr->num_networks) return NULL;
+
+	return &((fr_stats_shm_slot_t *)(shm->hdr + 1))[id];
+}
+
+/** Return the slot a worker thread writes to
+ *
+ */
+fr_stats_shm_slot_t *fr_stats_shm_worker_slot(fr_stats_shm_t *shm, uint32_t id)
+{
+	if (id >= shm->hdr->num_workers) return NULL;
+
+	return &((fr_stats_shm_slot_t *)(shm->hdr + 1))[shm->hdr->num_networks + id];
+}
+
+/** Update the counters in a slot
+ *
+ * Must only be called by the thread which owns the slot, as there's
+ * no locking between writers.
+ *
+ * @param[in] slot	to update.
+ * @param[in] state	of the thread.
+ * @param[in] stats	Counters to copy into the slot.
+ * @param[in] num_stats	Number of counters.
+ */
+void fr_stats_shm_publish(fr_stats_shm_slot_t *slot, fr_stats_shm_state_t state,
+			  uint64_t const *stats, int num_stats)
+{
+	uint_least32_t seq;
+
+	if (num_stats < 0) num_stats = 0;
+	if (num_stats > FR_STATS_SHM_MAX_STATS) num_stats = FR_STATS_SHM_MAX_STATS;
+
+	seq = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+	atomic_store_explicit(&slot->sequence, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->state = state;
+	slot->num_stats = num_stats;
+	slot->updated = fr_time_to_unix_time(fr_time());
+	memcpy(slot->stats, stats, num_stats * sizeof(slot->stats[0]));
+
+	atomic_store_explicit(&slot->sequence, seq + 2, memory_order_release);
+}
+
+/** Map a statistics segment read-only, for a collector
+ *
+ * @param[in] filename	of the segment.
+ * @param[out] len	Length of the mapping, for #fr_stats_shm_close.
+ * @return
+ *	- The segment header.  Use #fr_stats_shm_network, #fr_stats_shm_worker
+ *	  and #fr_stats_shm_slot_read to get the counters.
+ *	- NULL on error.
+ */
+fr_stats_shm_header_t const *fr_stats_shm_open(char const *filename, size_t *len)
+{
+	fr_stats_shm_header_t const	*hdr;
+	struct stat			st;
+	int				fd;
+	void				*addr;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening stats segment \"%s\": %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fr_strerror_printf("Failed examining stats segment \"%s\": %s", filename, fr_syserror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		fr_strerror_printf("Stats segment \"%s\" is too small", filename);
+		close(fd);
+		return NULL;
+	}
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping stats segment \"%s\": %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+	hdr = addr;
+
+	if (hdr->magic != FR_STATS_SHM_MAGIC) {
+		fr_strerror_printf("Stats segment \"%s\" is not initialised", filename);
+	error:
+		munmap(addr, st.st_size);
+		return NULL;
+	}
+	atomic_thread_fence(memory_order_acquire);
+
+	if (hdr->version != FR_STATS_SHM_VERSION) {
+		fr_strerror_printf("Stats segment \"%s\" has version %u, expected %u",
+				   filename, hdr->version, FR_STATS_SHM_VERSION);
+		goto error;
+	}
+
+	if ((hdr->size > (size_t)st.st_size) ||
+	    (hdr->size < (sizeof(*hdr) + ((size_t)(hdr->num_networks + hdr->num_workers) *
+					  sizeof(fr_stats_shm_slot_t))))) {
+		fr_strerror_printf("Stats segment \"%s\" is truncated", filename);
+		goto error;
+	}
+
+	*len = st.st_size;
+
+	return hdr;
+}
+
+/** Unmap a segment mapped with #fr_stats_shm_open
+ *
+ */
+void fr_stats_shm_close(fr_stats_shm_header_t const *hdr, size_t len)
+{
+	void *addr;
+
+	memcpy(&addr, &hdr, sizeof(addr));
+	munmap(addr, len);
+}
@@ -0,0 +1,167 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/stats_shm.h
+ * @brief Statistics published in a shared memory segment.
+ *
+ * The segment is a file, which the server maps, and updates in place.
+ * Collectors map the same file read-only, and read the counters
+ * without any system calls, or any work being done by the server.
+ *
+ * Each network and worker thread has its own slot, which only it
+ * writes to.  Each slot is protected by a sequence lock.  The writer
+ * makes the sequence odd before updating the slot, and even again
+ * afterwards.  A reader copies the slot, and retries if the sequence
+ * was odd, or changed whilst it was copying.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(stats_shm_h, "$Id$")
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+#include <freeradius-devel/util/talloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_STATS_SHM_MAGIC	(0x46525353)	//!< "FRSS"
+
+/** Version of the segment layout
+ *
+ * Bump this if any of the structures below change.  Readers must check
+ * it before looking at anything other than the header.
+ */
+#define FR_STATS_SHM_VERSION	(1)
+
+#define FR_STATS_SHM_MAX_STATS	(16)		//!< Counters in each slot.
+
+typedef enum {
+	FR_STATS_SHM_SLOT_FREE = 0,		//!< Never used.
+	FR_STATS_SHM_SLOT_RUNNING,		//!< Thread is running, and updating the slot.
+	FR_STATS_SHM_SLOT_EXITED		//!< Thread has exited.  The counters are its last ones.
+} fr_stats_shm_state_t;
+
+/** Start of the segment
+ *
+ * The network slots follow the header, then the worker slots.
+ */
+typedef struct {
+	uint32_t		magic;		//!< #FR_STATS_SHM_MAGIC, written once the segment is ready.
+	uint32_t		version;	//!< #FR_STATS_SHM_VERSION.
+	uint32_t		size;		//!< Of the whole segment.
+	uint32_t		pid;		//!< Of the server process which writes the segment.
+	uint32_t		num_networks;	//!< Number of network slots.
+	uint32_t		num_workers;	//!< Number of worker slots.
+	int64_t			started;	//!< When the server started, in nanoseconds since the epoch.
+} fr_stats_shm_header_t;
+
+/** Counters for one thread
+ *
+ * For network threads, stats[] holds the values from fr_network_stats():
+ * packets in, packets out, duplicates, dropped, and the number of workers.
+ *
+ * For worker threads, stats[] holds the values from fr_worker_stats():
+ * requests in, replies out, duplicates, dropped, NAKs, active requests
+ * and requests stolen, followed by the CPU time used, in nanoseconds.
+ */
+typedef struct {
+	atomic_uint_least32_t	sequence;	//!< Odd whilst the slot is being updated.
+	uint32_t		state;		//!< #fr_stats_shm_state_t.
+	uint32_t		num_stats;	//!< How many entries of stats[] are valid.
+	uint32_t		id;		//!< Of the network or worker.
+	int64_t			updated;	//!< When the slot was updated, in nanoseconds since the epoch.
+	uint64_t		stats[FR_STATS_SHM_MAX_STATS];
+} fr_stats_shm_slot_t;
+
+typedef struct fr_stats_shm_s fr_stats_shm_t;
+
+/** Return the network slot with the given ID
+ *
+ */
+static inline fr_stats_shm_slot_t const *fr_stats_shm_network(fr_stats_shm_header_t const *hdr, uint32_t id)
+{
+	if (id >= hdr->num_networks) return NULL;
+
+	return &((fr_stats_shm_slot_t const *)(hdr + 1))[id];
+}
+
+/** Return the worker slot with the given ID
+ *
+ */
+static inline fr_stats_shm_slot_t const *fr_stats_shm_worker(fr_stats_shm_header_t const *hdr, uint32_t id)
+{
+	if (id >= hdr->num_workers) return NULL;
+
+	return &((fr_stats_shm_slot_t const *)(hdr + 1))[hdr->num_networks + id];
+}
+
+/** Take a consistent copy of a slot
+ *
+ * @param[out] out	Where to copy the slot.
+ * @param[in] slot	to copy.
+ * @return
+ *	- true if a consistent copy was made.
+ *	- false if the slot was being updated on every attempt.
+ */
+static inline bool fr_stats_shm_slot_read(fr_stats_shm_slot_t *out, fr_stats_shm_slot_t const *slot)
+{
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		uint_least32_t seq;
+
+		seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		if (seq & 0x01) continue;
+
+		memcpy((uint8_t *)out + sizeof(out->sequence), (uint8_t const *)slot + sizeof(slot->sequence),
+		       sizeof(*out) - sizeof(out->sequence));
+		atomic_thread_fence(memory_order_acquire);
+
+		if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) == seq) return true;
+	}
+
+	return false;
+}
+
+fr_stats_shm_t			*fr_stats_shm_create(TALLOC_CTX *ctx, char const *filename,
+						     uint32_t num_networks, uint32_t num_workers);
+
+fr_stats_shm_slot_t		*fr_stats_shm_network_slot(fr_stats_shm_t *shm, uint32_t id);
+
+fr_stats_shm_slot_t		*fr_stats_shm_worker_slot(fr_stats_shm_t *shm, uint32_t id);
+
+void				fr_stats_shm_publish(fr_stats_shm_slot_t *slot, fr_stats_shm_state_t state,
+						     uint64_t const *stats, int num_stats);
+
+fr_stats_shm_header_t const	*fr_stats_shm_open(char const *filename, size_t *len);
+
+void				fr_stats_shm_close(fr_stats_shm_header_t const *hdr, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -59,8 +59,11 @@ RCSID("$Id$")
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/regex.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/probe.h>
 
 #include <stdalign.h>
 
@@ -76,6 +79,18 @@ static _Thread_local fr_worker_t *thread_local_worker;
 #define CACHE_LINE_SIZE	64
 static alignas(CACHE_LINE_SIZE) atomic_uint64_t request_number = 0;
 
+#define WORKER_MAX_PACKET_CODE	(256)	//!< Codes above this aren't tracked in request_memory.
+
+/** How much memory requests of one type were holding when they finished
+ *
+ */
+typedef struct {
+	fr_dict_t const		*dict;		//!< of the first request seen, for printing the packet type.
+	uint64_t		count;		//!< number of requests measured.
+	uint64_t		total;		//!< summed over all of them, for the average.
+	size_t			peak;		//!< high-water mark.
+} worker_request_memory_t;
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -103,9 +118,26 @@ struct fr_worker_s {
 	fr_io_stats_t		stats;		//!< input / output stats
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
 	fr_time_elapsed_t	wall_clock;	//!< histogram of wall clock time per request
+	fr_time_elapsed_t	wall_clock_priority[4];	//!< the same, for each priority class
 
 	uint64_t    		num_naks;	//!< number of messages which were nak'd
 	uint64_t    		num_active;	//!< number of active requests
+	uint64_t		num_stolen;	//!< number of requests which were moved to us from a busy worker
+	uint64_t		num_polls;	//!< number of times we busy-polled the channels before sleeping
+	uint64_t		num_poll_hits;	//!< number of times busy-polling found a request
+
+	fr_time_delta_t		busy_poll;	//!< how long we currently poll for, adapted to the load
+
+	request_slab_stats_t const *slab;	//!< recycling of request memory in this thread
+#ifdef HAVE_REGEX
+	regex_cache_stats_t const *regex;	//!< runtime compiled regexes kept by this thread
+#endif
+	module_thread_instance_t **module_threads;	//!< per-thread module instances, for statistics
+
+	fr_time_t		message_sets_checked;	//!< when we last looked at the message sets
+	fr_message_set_stats_t	message_sets;	//!< summed over all channels
+
+	worker_request_memory_t	request_memory[WORKER_MAX_PACKET_CODE];	//!< by packet code
 
 	fr_time_delta_t		predicted;	//!< How long we predict a request will take to execute.
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
@@ -122,6 +154,19 @@ struct fr_worker_s {
 
 static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
 
+static char const *worker_priority_names[] = { "now", "high", "normal", "low" };
+
+/** Map a packet priority to one of the PRIORITY_* classes
+ *
+ */
+static inline int worker_priority_class(uint32_t priority)
+{
+	if (priority >= PRIORITY_NOW) return 0;
+	if (priority >= PRIORITY_HIGH) return 1;
+	if (priority >= PRIORITY_NORMAL) return 2;
+	return 3;
+}
+
 /** Callback which handles a message being received on the worker side.
  *
  * @param[in] ctx the worker
@@ -133,6 +178,7 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	fr_worker_t *worker = ctx;
 
 	worker->stats.in++;
+	if (cd->request.stolen) worker->num_stolen++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
 	worker_request_bootstrap(worker, cd, fr_time());
@@ -337,6 +383,7 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	reply->reply.cpu_time = worker->tracking.running_total;
 	reply->reply.processing_time = 10; /* @todo - set to something better? */
 	reply->reply.request_time = cd->request.recv_time;
+	reply->priority = cd->priority;
 
 	reply->listen = cd->listen;
 	reply->packet_ctx = cd->packet_ctx;
@@ -456,6 +503,7 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 	reply->reply.cpu_time = worker->tracking.running_total;
 	reply->reply.processing_time = request->async->tracking.running_total;
 	reply->reply.request_time = request->async->recv_time;
+	reply->priority = request->async->priority;
 
 	reply->listen = request->async->listen;
 	reply->packet_ctx = request->async->packet_ctx;
@@ -465,6 +513,23 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 	 */
 	fr_time_elapsed_update(&worker->cpu_time, now, now + reply->reply.processing_time);
 	fr_time_elapsed_update(&worker->wall_clock, reply->reply.request_time, now);
+	fr_time_elapsed_update(&worker->wall_clock_priority[worker_priority_class(reply->priority)],
+			       reply->reply.request_time, now);
+
+	/*
+	 *	Record how big the request got.  This walks the same
+	 *	tree that talloc_free() is about to walk, so it's
+	 *	cheap compared to the processing we've just done.
+	 */
+	if (request->packet->code < WORKER_MAX_PACKET_CODE) {
+		worker_request_memory_t	*rm = &worker->request_memory[request->packet->code];
+		size_t			used = talloc_total_size(request);
+
+		if (!rm->dict) rm->dict = request->dict;
+		rm->count++;
+		rm->total += used;
+		if (used > rm->peak) rm->peak = used;
+	}
 
 	RDEBUG("Finished request");
 
@@ -559,9 +624,9 @@ static void worker_stop_request(fr_worker_t *worker, request_t *request, fr_time
  * @param[in] when	the current time
  * @param[in] uctx	the fr_worker_t.
  */
-static void worker_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_time_t when, void *uctx)
+static void worker_max_request_time(fr_event_list_t *el, UNUSED fr_time_t when, void *uctx)
 {
-	fr_time_t	now = fr_time();
+	fr_time_t	now = fr_event_list_time(el);
 	request_t		*request;
 	fr_worker_t	*worker = talloc_get_type_abort(uctx, fr_worker_t);
 
@@ -711,6 +776,8 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 
 	worker_request_init(worker, request, now);
 
+	FR_PROBE2(request_bootstrap, cd, request->number);
+
 	request->packet->timestamp = cd->request.recv_time; /* Legacy - Remove once everything looks at request->async */
 
 	/*
@@ -726,6 +793,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	request->async->channel = cd->channel.ch;
 
 	request->async->recv_time = cd->request.recv_time;
+	request->async->priority = cd->priority;
 
 
 	request->async->listen = cd->listen;
@@ -987,10 +1055,14 @@ static int8_t worker_runnable_cmp(void const *one, void const *two)
 	request_t const *a = one, *b = two;
 	int ret;
 
-	ret = (a->async->priority > b->async->priority) - (a->async->priority < b->async->priority);
+	/*
+	 *	Run higher priority requests first, and then the
+	 *	oldest ones.
+	 */
+	ret = COMPARE_PREFER_LARGER(a->async->priority, b->async->priority);
 	if (ret != 0) return ret;
 
-	return (a->async->recv_time > b->async->recv_time) - (a->async->recv_time < b->async->recv_time);
+	return COMPARE_PREFER_SMALLER(a->async->recv_time, b->async->recv_time);
 }
 
 /**
@@ -1114,6 +1186,9 @@ nomem:
 	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
 	CHECK_CONFIG(max_request_time, fr_time_delta_from_sec(30), fr_time_delta_from_sec(60));
 
+	if (worker->config.busy_poll > fr_time_delta_from_msec(1)) worker->config.busy_poll = fr_time_delta_from_msec(1);
+	worker->busy_poll = worker->config.busy_poll;
+
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, worker->config.max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
@@ -1122,6 +1197,20 @@ nomem:
 
 	worker->thread_id = pthread_self();
 	worker->el = el;
+
+	/*
+	 *	Requests, and the pairs and boxes they allocate, are
+	 *	recycled through thread local slabs, and unknown
+	 *	attributes are shared through a thread local cache, so
+	 *	they have to be set up in the worker thread.
+	 */
+	worker->slab = request_slab_init(worker->config.max_free_requests);
+	(void) fr_pair_slab_init(0);
+	(void) fr_dict_unknown_cache_init(0);
+	(void) fr_value_box_slab_init(0);
+#ifdef HAVE_REGEX
+	worker->regex = regex_cache_init(worker->config.max_cached_regexes);
+#endif
 	worker->log = logger;
 	worker->lvl = lvl;
 
@@ -1151,7 +1240,7 @@ nomem:
 		goto fail;
 	}
 
-	worker->runnable = fr_heap_talloc_alloc(worker, worker_runnable_cmp, request_t, runnable_id);
+	worker->runnable = fr_heap_dary_talloc_alloc(worker, worker_runnable_cmp, request_t, runnable_id, 4);
 	if (!worker->runnable) {
 		fr_strerror_const("Failed creating runnable heap");
 		goto fail;
@@ -1175,6 +1264,107 @@ nomem:
 }
 
 
+/** Poll the channels for a while before going to sleep
+ *
+ *  Waking up a sleeping worker costs the network thread a system
+ *  call to signal it, and costs the worker another to read the
+ *  signal.  At medium load, that happens for nearly every packet.
+ *  If we poll the channels briefly instead, we often pick up the
+ *  next request without either.  The network thread doesn't signal
+ *  channels which are being polled.
+ *
+ *  The time spent polling adapts to the load.  It is halved every
+ *  time polling finds nothing, and doubled (up to the configured
+ *  maximum) every time it finds a request.
+ *
+ * @param[in] worker	the worker
+ * @return
+ *	- true if a request was received.
+ *	- false if there was nothing to do.
+ */
+static bool worker_busy_poll(fr_worker_t *worker)
+{
+	int		i;
+	bool		found = false;
+	fr_time_t	start, now;
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		fr_channel_responder_poll_start(worker->channel[i]);
+	}
+
+	start = now = fr_time();
+	while (!found && ((now - start) < worker->busy_poll)) {
+		for (i = 0; i < worker->config.max_channels; i++) {
+			if (!worker->channel[i]) continue;
+
+			if (fr_channel_responder_poll(worker->channel[i])) found = true;
+		}
+
+		now = fr_time();
+	}
+
+	/*
+	 *	Requests which were sent before we stopped polling
+	 *	may not have been signalled, so check one last time.
+	 */
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		fr_channel_responder_poll_stop(worker->channel[i]);
+		if (fr_channel_responder_poll(worker->channel[i])) found = true;
+	}
+
+	worker->num_polls++;
+
+	if (found) {
+		worker->num_poll_hits++;
+
+		worker->busy_poll *= 2;
+		if (worker->busy_poll > worker->config.busy_poll) worker->busy_poll = worker->config.busy_poll;
+	} else {
+		worker->busy_poll /= 2;
+		if (worker->busy_poll < (worker->config.busy_poll / 16)) worker->busy_poll = worker->config.busy_poll / 16;
+	}
+
+	return found;
+}
+
+/** Update the message set statistics, and shrink them if we're idle
+ *
+ *  Replies are cleaned up lazily, so the message sets only grow
+ *  during bursts of traffic.  This gives the memory back once the
+ *  burst is over.
+ *
+ * @param[in] worker	the worker
+ * @param[in] idle	whether there are no requests in progress.
+ */
+static void worker_message_sets_check(fr_worker_t *worker, bool idle)
+{
+	fr_message_set_stats_t	total = { 0 }, stats;
+	int			i;
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		fr_message_set_t *ms;
+
+		if (!worker->channel[i]) continue;
+
+		ms = fr_channel_responder_uctx_get(worker->channel[i]);
+		if (!ms) continue;
+
+		if (idle) fr_message_set_shrink(ms);
+
+		fr_message_set_stats(ms, &stats);
+		total.grown += stats.grown;
+		total.shrunk += stats.shrunk;
+		total.peak_messages += stats.peak_messages;
+		total.size += stats.size;
+	}
+
+	worker->message_sets = total;
+}
+
 /** The main loop and entry point of the worker thread.
  *
  * @param[in] worker the worker data structure to manage
@@ -1183,9 +1373,16 @@ void fr_worker(fr_worker_t *worker)
 {
 	WORKER_VERIFY;
 
+	/*
+	 *	Module thread instances are created after the
+	 *	worker, so we can only grab them here.
+	 */
+	worker->module_threads = module_thread_array();
+
 	while (!worker->exiting) {
 		bool wait_for_event;
 		int num_events;
+		fr_time_t now;
 
 		WORKER_VERIFY;
 
@@ -1194,10 +1391,29 @@ void fr_worker(fr_worker_t *worker)
 		 *	the event loop, but we don't wait for events.
 		 */
 		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+
+		/*
+		 *	Nothing to do.  Look for new requests before
+		 *	we go to sleep.
+		 */
+		if (wait_for_event && worker->config.busy_poll && worker_busy_poll(worker)) {
+			wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+		}
+
 		if (wait_for_event) {
 			DEBUG4("Ready to process requests");
 		}
 
+		/*
+		 *	Look at the message sets about once a second.
+		 */
+		now = fr_time();
+		if ((now - worker->message_sets_checked) >= NSEC) {
+			worker_message_sets_check(worker, wait_for_event && (worker->num_active == 0));
+			module_thread_memory_update(worker->module_threads);
+			worker->message_sets_checked = now;
+		}
+
 		/*
 		 *	Check the event list.  If there's an error
 		 *	(e.g. exit), we stop looping and clean up.
@@ -1392,16 +1608,32 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	if (num >= 4) stats[3] = worker->stats.dropped;
 	if (num >= 5) stats[4] = worker->num_naks;
 	if (num >= 6) stats[5] = worker->num_active;
+	if (num >= 7) stats[6] = worker->num_stolen;
 
-	if (num <= 6) return num;
+	if (num <= 7) return num;
 
-	return 6;
+	return 7;
 }
 
-static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+/** Return how much CPU time the worker has spent processing requests
+ *
+ *  This is read without locking, and may be slightly out of date.
+ */
+fr_time_t fr_worker_cpu_used(fr_worker_t const *worker)
+{
+	return worker->tracking.running_total;
+}
+
+/** Print the "stats worker" output for a worker
+ *
+ *  This is exported so that the scheduler can wrap it for workers
+ *  which may be started and stopped at run time.
+ */
+int fr_worker_cmd_stats(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_worker_t const *worker = ctx;
 	fr_time_t when;
+	size_t i;
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "count") == 0)) {
 		fprintf(fp, "count.in\t\t\t%" PRIu64 "\n", worker->stats.in);
@@ -1410,6 +1642,9 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.dropped\t\t\t%" PRIu64 "\n", worker->stats.dropped);
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
+		fprintf(fp, "count.stolen\t\t\t%" PRIu64 "\n", worker->num_stolen);
+		fprintf(fp, "count.polls\t\t\t%" PRIu64 "\n", worker->num_polls);
+		fprintf(fp, "count.poll_hits\t\t\t%" PRIu64 "\n", worker->num_poll_hits);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
 	}
 
@@ -1429,6 +1664,74 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 
 		fr_time_elapsed_fprint(fp, &worker->cpu_time, "cpu.requests", 4);
 		fr_time_elapsed_fprint(fp, &worker->wall_clock, "time.requests", 4);
+
+		for (i = 0; i < NUM_ELEMENTS(worker_priority_names); i++) {
+			char prefix[32];
+
+			snprintf(prefix, sizeof(prefix), "time.%s", worker_priority_names[i]);
+			fr_time_elapsed_fprint(fp, &worker->wall_clock_priority[i], prefix, 4);
+		}
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "memory") == 0)) {
+		fprintf(fp, "memory.requests_used\t\t%u\n", worker->slab->num_used);
+		fprintf(fp, "memory.requests_used_max\t%u\n", worker->slab->hwm_used);
+		fprintf(fp, "memory.requests_free\t\t%u\n", worker->slab->num_free);
+		fprintf(fp, "memory.requests_free_max\t%u\n", worker->slab->max_free);
+		fprintf(fp, "memory.requests_alloced\t\t%" PRIu64 "\n", worker->slab->alloced);
+		fprintf(fp, "memory.requests_reused\t\t%" PRIu64 "\n", worker->slab->reused);
+		fprintf(fp, "memory.message_sets_size\t%zu\n", worker->message_sets.size);
+		fprintf(fp, "memory.message_sets_peak\t%d\n", worker->message_sets.peak_messages);
+		fprintf(fp, "memory.message_sets_grown\t%" PRIu64 "\n", worker->message_sets.grown);
+		fprintf(fp, "memory.message_sets_shrunk\t%" PRIu64 "\n", worker->message_sets.shrunk);
+#ifdef HAVE_REGEX
+		fprintf(fp, "memory.regexes_cached\t\t%u\n", worker->regex->num_entries);
+		fprintf(fp, "memory.regexes_cached_max\t%u\n", worker->regex->max_entries);
+		fprintf(fp, "memory.regexes_hits\t\t%" PRIu64 "\n", worker->regex->hits);
+		fprintf(fp, "memory.regexes_misses\t\t%" PRIu64 "\n", worker->regex->misses);
+#endif
+
+		for (i = 0; i < NUM_ELEMENTS(worker->request_memory); i++) {
+			worker_request_memory_t const	*rm = &worker->request_memory[i];
+			fr_dict_attr_t const		*da = NULL;
+			char const			*name = NULL;
+			char				buffer[16];
+
+			if (!rm->count) continue;
+
+			if (rm->dict) da = fr_dict_attr_by_name(NULL, fr_dict_root(rm->dict), "Packet-Type");
+			if (da) name = fr_dict_enum_name_by_value(da, fr_box_uint32(i));
+			if (!name) {
+				snprintf(buffer, sizeof(buffer), "%zu", i);
+				name = buffer;
+			}
+
+			fprintf(fp, "memory.request.%s.average\t%" PRIu64 "\n", name, rm->total / rm->count);
+			fprintf(fp, "memory.request.%s.peak\t%zu\n", name, rm->peak);
+		}
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "modules") == 0)) {
+		module_thread_instance_t **array = worker->module_threads;
+
+		/*
+		 *	The single threaded worker never calls
+		 *	fr_worker(), but it runs in our thread.
+		 */
+		if (!array && pthread_equal(pthread_self(), worker->thread_id)) array = module_thread_array();
+
+		module_thread_stats_fprint(fp, array);
+	}
+
+	/*
+	 *	Not key / value, so it's only printed if asked for.
+	 */
+	if ((info->argc > 0) && (strcmp(info->argv[0], "folded") == 0)) {
+		module_thread_instance_t **array = worker->module_threads;
+
+		if (!array && pthread_equal(pthread_self(), worker->thread_id)) array = module_thread_array();
+
+		module_thread_stats_folded_fprint(fp, worker->name, array);
 	}
 
 	return 0;
@@ -1446,8 +1749,8 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
-		.func = cmd_stats_worker,
+		.syntax = "[(count|cpu|memory|modules|folded)]",
+		.func = fr_worker_cmd_stats,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
 	},
@@ -66,6 +66,11 @@ typedef struct {
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
 
 	size_t		talloc_pool_size;	//!< for each request
+
+	uint32_t	max_free_requests;	//!< freed requests kept for reuse.  0 for the default.
+	uint32_t	max_cached_regexes;	//!< runtime compiled regexes kept for reuse.  0 for the default.
+
+	fr_time_delta_t	busy_poll;		//!< how long to poll the channels before sleeping.
 } fr_worker_config_t;
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
@@ -85,6 +90,10 @@ fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
 
+fr_time_t	fr_worker_cpu_used(fr_worker_t const *worker) CC_HINT(nonnull);
+
+int		fr_worker_cmd_stats(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info);
+
 #include <freeradius-devel/server/module.h>
 
 int		fr_worker_request_add(request_t *request, module_method_t process, void *ctx);
@@ -39,6 +39,7 @@ fr_table_num_sorted_t const fr_json_format_table[] = {
 size_t fr_json_format_table_len = NUM_ELEMENTS(fr_json_format_table);
 
 static fr_json_format_t const default_json_format = {
+	.output_mode = JSON_MODE_OBJECT,
 	.attr = { .prefix = NULL },
 	.value = { .value_as_array = true },
 };
@@ -362,86 +363,6 @@ void fr_json_version_print(void)
 }
 
 
-/** Convert fr_pair_t into a JSON object
- *
- * If format.value.enum_as_int is set, and the given VP is an enum
- * value, the integer value is returned as a json_object rather
- * than the text representation.
- *
- * If format.value.always_string is set then a numeric value pair
- * will be returned as a JSON string object.
- *
- * @param[in] ctx	Talloc context.
- * @param[out] out	returned json object.
- * @param[in] vp	to get the value of.
- * @param[in] format	format definition, or NULL.
- * @return
- *	- 1 if 'out' is the integer enum value, 0 otherwise
- *	- -1 on error.
- */
-static int json_afrom_value_box(TALLOC_CTX *ctx, json_object **out,
-				fr_pair_t *vp, fr_json_format_t const *format)
-{
-	struct json_object	*obj;
-	fr_value_box_t const	*vb;
-	fr_value_box_t		vb_str;
-	int			is_enum = 0;
-
-	fr_assert(vp);
-
-	vb = &vp->data;
-
-	if (format && format->value.enum_as_int) {
-		is_enum = fr_pair_value_enum_box(&vb, vp);
-		fr_assert(is_enum >= 0);
-	}
-
-	if (format && format->value.always_string) {
-		if (fr_value_box_cast(ctx, &vb_str, FR_TYPE_STRING, NULL, vb) == 0) {
-			vb = &vb_str;
-		} else {
-			return -1;
-		}
-	}
-
-	MEM(obj = json_object_from_value_box(ctx, vb));
-
-	if (format && format->value.always_string) {
-		fr_value_box_clear(&vb_str);
-	}
-
-	*out = obj;
-	return is_enum;
-}
-
-
-/** Add prefix to attribute name
- *
- * If the format "attr.prefix" string is set then prepend this
- * to the given attribute name, otherwise return name unchanged.
- *
- * @param[out] buf where to write the new name, if set
- * @param[in] buf_len length of buf
- * @param[in] name original attribute name
- * @param[in] format json format structure
- * @return pointer to name, or buf if the prefix was added
- */
-static inline char const *attr_name_with_prefix(char *buf, size_t buf_len, const char *name, fr_json_format_t const *format)
-{
-	int len;
-
-	if (!format->attr.prefix) return name;
-
-	len = snprintf(buf, buf_len, "%s:%s", format->attr.prefix, name);
-
-	if (len == (int)strlen(buf)) {
-		return buf;
-	}
-
-	return name;
-}
-
-
 /** Verify that the options in fr_json_format_t are valid
  *
  * Warnings are optional, will fatal error if the format is corrupt.
@@ -497,454 +418,464 @@ bool fr_json_format_verify(fr_json_format_t const *format, bool verbose)
 }
 
 
-/** Returns a JSON object representation of a list of value pairs
- *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
- *
- * This function generates the "object" format, JSON_MODE_OBJECT.
- * @see fr_json_format_s
- *
- * @param[in] ctx	Talloc context.
- * @param[in] vps	a list of value pairs.
- * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+/*
+ *	Characters which must be escaped in a JSON string, and the
+ *	character that follows the backslash.  Anything else below
+ *	0x20 is written as \u00XX.  '/' is escaped to match json-c.
  */
-static json_object *json_object_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-						fr_json_format_t const *format)
-{
-	fr_cursor_t		cursor;
-	fr_pair_t		*vp;
-	struct json_object	*obj;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
-
-	/* Check format and type */
-	fr_assert(format);
-	fr_assert(format->output_mode == JSON_MODE_OBJECT);
-
-	MEM(obj = json_object_new_object());
-
-	for (vp = fr_cursor_init(&cursor, vps);
-	     vp;
-	     vp = fr_cursor_next(&cursor)) {
-		char const		*attr_name;
-		struct json_object	*vp_object, *values, *value, *type_name;
-
-		/*
-		 *	Get attribute name and value.
-		 */
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
+static char const json_escape_chars[UINT8_MAX + 1] = {
+	['"'] = '"', ['\\'] = '\\', ['/'] = '/',
+	['\b'] = 'b', ['\f'] = 'f', ['\n'] = 'n', ['\r'] = 'r', ['\t'] = 't'
+};
 
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-		error:
-			json_object_put(obj);
-			return NULL;
-		}
+#define JSON_NEEDS_ESCAPE(_c) (((uint8_t)(_c) < 0x20) || json_escape_chars[(uint8_t)(_c)])
 
-		/*
-		 *	Look in the table to see if we already have
-		 *	a key for the attribute we're working on.
-		 */
-		if (!json_object_object_get_ex(obj, attr_name, &vp_object)) {
-			/*
-			 *	Wasn't there, so create a new object for this attribute.
-			 */
-			MEM(vp_object = json_object_new_object());
-			json_object_object_add(obj, attr_name, vp_object);
+/*
+ *	json-c keys objects by name, so attributes from different
+ *	dictionaries with the same name are grouped together.
+ */
+#define JSON_SAME_NAME(_a, _b) (((_a)->da == (_b)->da) || (strcmp((_a)->da->name, (_b)->da->name) == 0))
 
-			/*
-			 *	Add "type" to newly created keys.
-			 */
-			MEM(type_name = json_object_new_string(fr_table_str_by_value(fr_value_box_type_table,
-										     vp->vp_type, "<INVALID>")));
-			json_object_object_add(vp_object, "type", type_name);
+/** State for a single call to fr_json_print_pair_list()
+ *
+ */
+typedef struct {
+	fr_json_format_t const	*format;			//!< Formatting options.
+	char			prefix[FR_DICT_ATTR_MAX_NAME_LEN + 32];	//!< Escaped "<prefix>:", without quotes.
+	size_t			prefix_len;			//!< Length of the escaped prefix.
+} json_print_ctx_t;
 
-			/*
-			 *	Create a "value" array to hold any attribute values for this attribute...
-			 */
-			if (format->value.value_as_array) {
-				MEM(values = json_object_new_array());
-				json_object_object_add(vp_object, "value", values);
-			} else {
-				/*
-				 *	...unless this is the first time we've seen the attribute and
-				 *	value_as_array is false, in which case just add the value directly
-				 *	and move on to the next attribute.
-				 */
-				json_object_object_add(vp_object, "value", value);
-				continue;
-			}
+/** Write the JSON escaped form of a string, without quotes
+ *
+ * Runs of characters which don't need escaping are copied in one go.
+ *
+ * @param[out] out	Where to write the escaped string.
+ * @param[in] in	String to escape.
+ * @param[in] inlen	Length of in.
+ * @return
+ *	- >= 0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the escaped string.
+ */
+static ssize_t json_print_escaped(fr_sbuff_t *out, char const *in, size_t inlen)
+{
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	char const	*p = in, *end = in + inlen, *start;
+	uint8_t		c;
+
+	while (p < end) {
+		start = p;
+		while ((p < end) && !JSON_NEEDS_ESCAPE(*p)) p++;
+		if (p > start) FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, start, p - start);
+		if (p == end) break;
+
+		c = (uint8_t)*p++;
+		if (json_escape_chars[c]) {
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '\\', json_escape_chars[c]);
 		} else {
-			/*
-			 *	Find the 'values' array to add the current value to.
-			 */
-			if (!fr_cond_assert(json_object_object_get_ex(vp_object, "value", &values))) {
-				fr_strerror_const("Inconsistent JSON tree");
-				goto error;
-			}
-
-			/*
-			 *	If value_as_array is no set then "values" may not be an array, so it will
-			 *	need converting to an array to add this extra attribute.
-			 */
-			if (!format->value.value_as_array) {
-				json_type		type;
-				struct json_object	*convert_value = values;
-
-				/* Check "values" type */
-				type = json_object_get_type(values);
-
-				/* It wasn't an array, so turn it into one with the old value as the first entry */
-				if (type != json_type_array) {
-					MEM(values = json_object_new_array());
-					json_object_array_add(values, json_object_get(convert_value));
-					json_object_object_del(vp_object, "value");
-					json_object_object_add(vp_object, "value", values);
-				}
-			}
+			FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "\\u%04x", c);
 		}
-
-		/*
-		 *	Append to the JSON array.
-		 */
-		json_object_array_add(values, value);
 	}
 
-	return obj;
+	return fr_sbuff_set(out, &our_out);
 }
 
-
-/** Returns a JSON object representation of a list of value pairs
- *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+/** Write a string as a quoted JSON string
  *
- * This function generates the "simple object" format, JSON_MODE_OBJECT_SIMPLE.
- * @see fr_json_format_s
- *
- * @param[in] ctx	Talloc context.
- * @param[in] vps	a list of value pairs.
- * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @param[out] out	Where to write the JSON string.
+ * @param[in] in	String to write.
+ * @param[in] inlen	Length of in.
+ * @return
+ *	- >= 0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the string.
  */
-static json_object *json_smplobj_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-						 fr_json_format_t const *format)
+static ssize_t json_print_string(fr_sbuff_t *out, char const *in, size_t inlen)
 {
-	fr_cursor_t		cursor;
-	fr_pair_t		*vp;
-	struct json_object	*obj;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
-	json_type		type;
-
-	/* Check format and type */
-	fr_assert(format);
-	fr_assert(format->output_mode == JSON_MODE_OBJECT_SIMPLE);
-
-	MEM(obj = json_object_new_object());
-
-	for (vp = fr_cursor_init(&cursor, vps);
-	     vp;
-	     vp = fr_cursor_next(&cursor)) {
-		char const		*attr_name;
-		struct json_object	*vp_object, *value;
-		struct json_object	*values = NULL;
-		bool			add_single = false;
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
 
-		/*
-		 *	Get attribute name and value.
-		 */
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+	FR_SBUFF_RETURN(json_print_escaped, &our_out, in, inlen);
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
 
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-			json_object_put(obj);
-			return NULL;
-		}
+	return fr_sbuff_set(out, &our_out);
+}
 
-		/*
-		 *	See if we already have a key in the table we're working on,
-		 *	if not then create a new one.
-		 */
-		if (!json_object_object_get_ex(obj, attr_name, &vp_object)) {
-			if (format->value.value_as_array) {
-				/*
-				 *	We have been asked to ensure /all/ values are lists,
-				 *	even if there's only one attribute.
-				 */
-				MEM(values = json_object_new_array());
-				json_object_object_add(obj, attr_name, values);
-			} else {
-				/*
-				 *	Deal with it later on.
-				 */
-				add_single = true;
-			}
-		/*
-		 *	If we do have the key already, get its value array.
-		 */
-		} else {
-			type = json_object_get_type(vp_object);
+/** Write an integer in decimal form
+ *
+ * @param[out] out	Where to write the number.
+ * @param[in] num	Absolute value of the number.
+ * @param[in] negative	Whether to prefix the number with '-'.
+ * @return
+ *	- >= 0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the number.
+ */
+static inline ssize_t json_print_integer(fr_sbuff_t *out, uint64_t num, bool negative)
+{
+	char	buff[sizeof("-18446744073709551615")];
+	char	*end = buff + sizeof(buff), *p = end;
 
-			if (type == json_type_array) {
-				values = vp_object;
-			} else {
-				/*
-				 *	We've seen one of these before, but didn't add
-				 *	it as an array the first time. Sort that out.
-				 */
-				MEM(values = json_object_new_array());
-				json_object_array_add(values, json_object_get(vp_object));
-				json_object_object_del(obj, attr_name);
-				json_object_object_add(obj, attr_name, values);
-			}
-		}
+	do {
+		*--p = '0' + (num % 10);
+		num /= 10;
+	} while (num);
 
-		if (add_single) {
-			/*
-			 *	Only ever used the first time adding a new
-			 *	attribute when "value_as_array" is not set.
-			 */
-			json_object_object_add(obj, attr_name, value);
-		} else {
-			/*
-			 *	Otherwise we're always appending to a JSON array.
-			 */
-			json_object_array_add(values, value);
-		}
-	}
+	if (negative) *--p = '-';
 
-	return obj;
+	return fr_sbuff_in_bstrncpy(out, p, end - p);
 }
 
-
-/** Returns a JSON array representation of a list of value pairs
+/** Write the value of a pair as a JSON value
  *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * Numbers and booleans are written directly, everything else is
+ * printed in its presentation format as a JSON string.
  *
- * This function generates the "array" format, JSON_MODE_ARRAY.
- * @see fr_json_format_s
+ * If format.value.enum_as_int is set, and the given VP is an enum
+ * value, the integer value is written rather than the text
+ * representation.
  *
- * @param[in] ctx	Talloc context.
- * @param[in] vps	a list of value pairs.
+ * If format.value.always_string is set then numeric values are
+ * written as JSON strings.
+ *
+ * @param[out] out	Where to write the value.
+ * @param[in] vp	to get the value of.
  * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @return
+ *	- >= 0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the value.
  */
-static struct json_object *json_array_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-						      fr_json_format_t const *format)
+static ssize_t json_print_value(fr_sbuff_t *out, fr_pair_t *vp, fr_json_format_t const *format)
 {
-	fr_cursor_t		cursor;
-	fr_pair_t		*vp;
-	struct json_object	*obj;
-	struct json_object	*seen_attributes = NULL;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
-
-	/* Check format and type */
-	fr_assert(format);
-	fr_assert(format->output_mode == JSON_MODE_ARRAY);
+	fr_sbuff_t		our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_value_box_t const	*vb = &vp->data;
+	fr_dict_enum_t const	*enumv;
+	bool			quote = format->value.always_string;
+	bool			negative = false;
+	uint64_t		num;
+	int64_t			snum;
 
-	MEM(obj = json_object_new_array());
+	if (format->value.enum_as_int) {
+		(void) fr_pair_value_enum_box(&vb, vp);
 
 	/*
-	 *	If attribute values should be in a list format, then keep track
-	 *	of the attributes we've previously seen in a JSON object.
+	 *	We're writing PRESENTATION format so any
+	 *	attributes with enumeration values are
+	 *	written as their names.
 	 */
-	if (format->value.value_as_array) {
-		seen_attributes = json_object_new_object();
+	} else if (vb->enumv && (enumv = fr_dict_enum_by_value(vb->enumv, vb))) {
+		return json_print_string(out, enumv->name, strlen(enumv->name));
 	}
 
-	for (vp = fr_cursor_init(&cursor, vps);
-	     vp;
-	     vp = fr_cursor_next(&cursor)) {
-		char const		*attr_name;
-		struct json_object	*name, *value, *type_name;
-		struct json_object	*values = NULL;
-		struct json_object	*attrobj = NULL;
-		bool			already_seen = false;
+	switch (vb->type) {
+	case FR_TYPE_STRING:
+		return json_print_string(out, vb->vb_strvalue, vb->vb_length);
 
-		/*
-		 *	Get attribute name and value.
-		 */
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
+	case FR_TYPE_BOOL:
+		if (quote) goto do_string;
+		if (vb->vb_bool) return fr_sbuff_in_strcpy_literal(out, "true");
+		return fr_sbuff_in_strcpy_literal(out, "false");
 
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-			json_object_put(obj);
-			return NULL;
-		}
+	case FR_TYPE_UINT8:
+		num = vb->vb_uint8;
+		break;
 
-		if (format->value.value_as_array) {
-			/*
-			 *	Try and find this attribute in the "seen_attributes" object. If it is
-			 *	there then get the "values" array to add this attribute value to.
-			 */
-			already_seen = json_object_object_get_ex(seen_attributes, attr_name, &values);
-		}
+	case FR_TYPE_UINT16:
+		num = vb->vb_uint16;
+		break;
 
-		/*
-		 *	If we're adding all attributes to the toplevel array, or we're adding values
-		 *	to an array of an existing attribute but haven't seen it before, then we need
-		 *	to create a new JSON object for this attribute.
-		 */
-		if (!format->value.value_as_array || !already_seen) {
-			/*
-			 * Create object and add it to top-level array
-			 */
-			MEM(attrobj = json_object_new_object());
-			json_object_array_add(obj, attrobj);
+	case FR_TYPE_UINT32:
+		num = vb->vb_uint32;
+		break;
 
-			/*
-			 * Add the attribute name in the "name" key and the type in the "type" key
-			 */
-			MEM(name = json_object_new_string(attr_name));
-			json_object_object_add(attrobj, "name", name);
+	case FR_TYPE_UINT64:
+		num = vb->vb_uint64;
+		if (num > INT64_MAX) quote = true;	/* Most parsers can't represent it */
+		break;
 
-			MEM(type_name = json_object_new_string(fr_table_str_by_value(fr_value_box_type_table,
-										     vp->vp_type, "<INVALID>")));
-			json_object_object_add(attrobj, "type", type_name);
-		}
+	case FR_TYPE_INT8:
+		snum = vb->vb_int8;
+		goto do_signed;
 
-		if (format->value.value_as_array) {
-			/*
-			 *	We're adding values to an array for the first copy of this attribute
-			 *	that we saw. First time around we need to create an array.
-			 */
-			if (!already_seen) {
-				MEM(values = json_object_new_array());
-				/*
-				 * Add "value":[] key to the attribute object
-				 */
-				json_object_object_add(attrobj, "value", values);
-
-				/*
-				 * Also add to "seen_attributes" to check later
-				 */
-				json_object_object_add(seen_attributes, attr_name, json_object_get(values));
-			}
+	case FR_TYPE_INT16:
+		snum = vb->vb_int16;
+		goto do_signed;
 
-			/*
-			 *	Always add the value to the respective "values" array.
-			 */
-			json_object_array_add(values, value);
+	case FR_TYPE_INT32:
+		snum = vb->vb_int32;
+		goto do_signed;
+
+	case FR_TYPE_INT64:
+		snum = vb->vb_int64;
+	do_signed:
+		if (snum < 0) {
+			negative = true;
+			num = -(uint64_t)snum;
 		} else {
-			/*
-			 * This is simpler; just add a "value": key to the attribute object.
-			 */
-			json_object_object_add(attrobj, "value", value);
+			num = snum;
 		}
+		break;
 
-	}
+	default:
+	do_string:
+	{
+		char		buff[256];
+		char		*p = NULL;
+		ssize_t		slen;
 
-	/*
-	 *	No longer need the "seen_attributes" object, it was just used for tracking.
-	 */
-	if (format->value.value_as_array) {
-		json_object_put(seen_attributes);
+		/*
+		 *	Most values fit in the stack buffer,
+		 *	only allocate for the ones which don't.
+		 */
+		slen = fr_value_box_print(&FR_SBUFF_OUT(buff, sizeof(buff)), vb, NULL);
+		if (slen < 0) {
+			slen = fr_value_box_aprint(NULL, &p, vb, NULL);
+			if (!p) return -1;
+		}
+
+		slen = json_print_string(&our_out, p ? p : buff, (size_t)slen);
+		talloc_free(p);
+		if (slen < 0) return slen;
+
+		return fr_sbuff_set(out, &our_out);
+	}
 	}
 
-	return obj;
+	if (quote) FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+	FR_SBUFF_RETURN(json_print_integer, &our_out, num, negative);
+	if (quote) FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+
+	return fr_sbuff_set(out, &our_out);
 }
 
+/** Write the name of a pair as a quoted JSON string, with the configured prefix
+ *
+ * @param[out] out	Where to write the name.
+ * @param[in] vp	to get the name of.
+ * @param[in] jctx	holding the pre-escaped prefix.
+ * @return
+ *	- >= 0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the name.
+ */
+static inline ssize_t json_print_name(fr_sbuff_t *out, fr_pair_t const *vp, json_print_ctx_t const *jctx)
+{
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
 
-/** Returns a JSON array of a list of value pairs
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+	if (jctx->prefix_len) FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, jctx->prefix, jctx->prefix_len);
+	FR_SBUFF_RETURN(json_print_escaped, &our_out, vp->da->name, strlen(vp->da->name));
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+
+	return fr_sbuff_set(out, &our_out);
+}
+
+/** Write the type of a pair as a JSON "type" member
  *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * Type names never need escaping.
+ */
+static inline ssize_t json_print_type(fr_sbuff_t *out, fr_pair_t const *vp)
+{
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+
+	FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, "\"type\":\"");
+	FR_SBUFF_IN_STRCPY_RETURN(&our_out, fr_table_str_by_value(fr_value_box_type_table, vp->vp_type, "<INVALID>"));
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+
+	return fr_sbuff_set(out, &our_out);
+}
+
+/** Check whether a pair with the same name as vp appears before it in the list
  *
- * This function generates the "array_of_values" format,
- * JSON_MODE_ARRAY_OF_VALUES, listing just the attribute values.
- * @see fr_json_format_s
+ * Used to skip pairs whose values have already been written as part
+ * of an earlier group.  This is quadratic in the number of pairs, but
+ * the lists we encode are short, and it avoids building an index.
+ */
+static bool json_name_seen(fr_pair_list_t *vps, fr_pair_t const *vp)
+{
+	fr_cursor_t	cursor;
+	fr_pair_t	*prev;
+
+	for (prev = fr_cursor_init(&cursor, vps);
+	     prev && (prev != vp);
+	     prev = fr_cursor_next(&cursor)) {
+		if (JSON_SAME_NAME(prev, vp)) return true;
+	}
+
+	return false;
+}
+
+/** Write the values of all pairs with the same name as the current one
  *
- * @param[in] ctx	Talloc context.
- * @param[in] vps	a list of value pairs.
+ * The values are written as a JSON array if there is more than one
+ * of them, or if format.value.value_as_array is set.  Otherwise the
+ * single value is written on its own.
+ *
+ * @param[out] out	Where to write the values.
+ * @param[in] cursor	pointing at the first pair with this name.
+ * @param[in] vp	the current pair of the cursor.
  * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @return
+ *	- >= 0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the values.
  */
-static struct json_object *json_value_array_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-							    fr_json_format_t const *format)
+static ssize_t json_print_values(fr_sbuff_t *out, fr_cursor_t const *cursor, fr_pair_t *vp,
+				 fr_json_format_t const *format)
 {
-	fr_cursor_t		cursor;
-	fr_pair_t		*vp;
-	struct json_object	*obj;
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_cursor_t	next;
+	fr_pair_t	*sibling;
+	bool		array = format->value.value_as_array;
+
+	if (!array) {
+		fr_cursor_copy(&next, cursor);
+		while ((sibling = fr_cursor_next(&next))) {
+			if (JSON_SAME_NAME(sibling, vp)) {
+				array = true;
+				break;
+			}
+		}
 
-	/* Check format and type */
-	fr_assert(format);
-	fr_assert(format->output_mode == JSON_MODE_ARRAY_OF_VALUES);
+		if (!array) return json_print_value(out, vp, format);
+	}
 
-	MEM(obj = json_object_new_array());
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+	FR_SBUFF_RETURN(json_print_value, &our_out, vp, format);
 
-	/*
-	 *	This array format is very simple - just add all the
-	 *	attribute values to the array in order.
-	 */
-	for (vp = fr_cursor_init(&cursor, vps);
-	     vp;
-	     vp = fr_cursor_next(&cursor)) {
-		struct json_object	*value;
-
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-			json_object_put(obj);
-			return NULL;
-		}
+	fr_cursor_copy(&next, cursor);
+	while ((sibling = fr_cursor_next(&next))) {
+		if (!JSON_SAME_NAME(sibling, vp)) continue;
 
-		json_object_array_add(obj, value);
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		FR_SBUFF_RETURN(json_print_value, &our_out, sibling, format);
 	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
 
-	return obj;
+	return fr_sbuff_set(out, &our_out);
 }
 
-
-/** Returns a JSON array of a list of value pairs
+/** Write a JSON document representing a list of value pairs
+ *
+ * The document is written directly into the sbuff, without building
+ * an intermediary json-c object tree.  The output is the same as
+ * fr_json_afrom_pair_list() produces.
  *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * Keys in the object output modes, and groups of values, appear in
+ * the order their attributes first appear in the list.
  *
- * This function generates the "array_of_names" format,
- * JSON_MODE_ARRAY_OF_NAMES, listing just the attribute names.
  * @see fr_json_format_s
  *
- * @param[in] ctx	Talloc context.
+ * @param[out] out	Where to write the JSON document.
  * @param[in] vps	a list of value pairs.
- * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @param[in] format	Formatting control, can be NULL to use default format.
+ * @return
+ *	- >= 0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the document.
  */
-static struct json_object *json_attr_array_afrom_pair_list(UNUSED TALLOC_CTX *ctx, fr_pair_list_t *vps,
-							   fr_json_format_t const *format)
+ssize_t fr_json_print_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
 {
+	fr_sbuff_t		our_out = FR_SBUFF_NO_ADVANCE(out);
 	fr_cursor_t		cursor;
 	fr_pair_t		*vp;
-	struct json_object	*obj;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
+	json_print_ctx_t	jctx;
+	bool			comma = false;
 
-	/* Check format and type */
-	fr_assert(format);
-	fr_assert(format->output_mode == JSON_MODE_ARRAY_OF_NAMES);
+	if (!format) format = &default_json_format;
 
-	MEM(obj = json_object_new_array());
+	jctx.format = format;
+	jctx.prefix_len = 0;
 
 	/*
-	 *	Add all the attribute names to the array in order.
+	 *	Escape the prefix once, rather than for every
+	 *	attribute.  As before, a prefix which is too
+	 *	long is ignored.
 	 */
-	for (vp = fr_cursor_init(&cursor, vps);
-	     vp;
-	     vp = fr_cursor_next(&cursor)) {
-		char const		*attr_name;
-		struct json_object	*value;
+	if (format->attr.prefix) {
+		fr_sbuff_t	prefix = FR_SBUFF_OUT(jctx.prefix, sizeof(jctx.prefix));
+
+		if ((json_print_escaped(&prefix, format->attr.prefix, strlen(format->attr.prefix)) >= 0) &&
+		    (fr_sbuff_in_char(&prefix, ':') > 0)) jctx.prefix_len = fr_sbuff_used(&prefix);
+	}
+
+	switch (format->output_mode) {
+	case JSON_MODE_OBJECT:
+	case JSON_MODE_OBJECT_SIMPLE:
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '{');
+		for (vp = fr_cursor_init(&cursor, vps);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) {
+			if (json_name_seen(vps, vp)) continue;
+
+			if (comma) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+			comma = true;
+
+			FR_SBUFF_RETURN(json_print_name, &our_out, vp, &jctx);
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, ':');
+
+			if (format->output_mode == JSON_MODE_OBJECT) {
+				FR_SBUFF_IN_CHAR_RETURN(&our_out, '{');
+				FR_SBUFF_RETURN(json_print_type, &our_out, vp);
+				FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"value\":");
+				FR_SBUFF_RETURN(json_print_values, &our_out, &cursor, vp, format);
+				FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
+			} else {
+				FR_SBUFF_RETURN(json_print_values, &our_out, &cursor, vp, format);
+			}
+		}
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
+		break;
+
+	case JSON_MODE_ARRAY:
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+		for (vp = fr_cursor_init(&cursor, vps);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) {
+			/*
+			 *	With value_as_array, each attribute gets one
+			 *	object holding all of its values.
+			 */
+			if (format->value.value_as_array && json_name_seen(vps, vp)) continue;
+
+			if (comma) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+			comma = true;
 
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
-		value = json_object_new_string(attr_name);
+			FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, "{\"name\":");
+			FR_SBUFF_RETURN(json_print_name, &our_out, vp, &jctx);
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+			FR_SBUFF_RETURN(json_print_type, &our_out, vp);
+			FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"value\":");
+			if (format->value.value_as_array) {
+				FR_SBUFF_RETURN(json_print_values, &our_out, &cursor, vp, format);
+			} else {
+				FR_SBUFF_RETURN(json_print_value, &our_out, vp, format);
+			}
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
+		}
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
+		break;
+
+	case JSON_MODE_ARRAY_OF_VALUES:
+	case JSON_MODE_ARRAY_OF_NAMES:
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+		for (vp = fr_cursor_init(&cursor, vps);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) {
+			if (comma) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+			comma = true;
+
+			if (format->output_mode == JSON_MODE_ARRAY_OF_NAMES) {
+				FR_SBUFF_RETURN(json_print_name, &our_out, vp, &jctx);
+			} else {
+				FR_SBUFF_RETURN(json_print_value, &our_out, vp, format);
+			}
+		}
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
+		break;
 
-		json_object_array_add(obj, value);
+	default:
+		/* This should never happen */
+		fr_assert(0);
+		fr_strerror_const("Invalid JSON output mode");
+		return -1;
 	}
 
-	return obj;
+	return fr_sbuff_set(out, &our_out);
 }
 
 
@@ -983,40 +914,17 @@ static struct json_object *json_attr_array_afrom_pair_list(UNUSED TALLOC_CTX *ct
 char *fr_json_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
 			      fr_json_format_t const *format)
 {
-	struct json_object	*obj = NULL;
-	const char		*p;
-	char			*out;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
 
-	if (!format) format = &default_json_format;
+	MEM(fr_sbuff_init_talloc(ctx, &sbuff, &tctx, 1024, SIZE_MAX));
 
-	switch (format->output_mode) {
-	case JSON_MODE_OBJECT:
-		MEM(obj = json_object_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_OBJECT_SIMPLE:
-		MEM(obj = json_smplobj_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY:
-		MEM(obj = json_array_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY_OF_VALUES:
-		MEM(obj = json_value_array_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY_OF_NAMES:
-		MEM(obj = json_attr_array_afrom_pair_list(ctx, vps, format));
-		break;
-	default:
-		/* This should never happen */
-		fr_assert(0);
+	if (fr_json_print_pair_list(&sbuff, vps, format) < 0) {
+		fr_strerror_const_push("Failed writing JSON document");
+		talloc_free(sbuff.buff);
+		return NULL;
 	}
+	fr_sbuff_trim_talloc(&sbuff, SIZE_MAX);
 
-	MEM(p = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
-	MEM(out = talloc_typed_strdup(ctx, p));
-
-	/*
-	 * Free the JSON structure, it's not needed any more
-	 */
-	json_object_put(obj);
-
-	return out;
+	return sbuff.buff;
 }
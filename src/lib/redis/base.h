@@ -119,6 +119,11 @@ typedef struct {
 
 	fr_time_delta_t		reconnection_delay;
 
+	fr_ipaddr_t		local_network;	//!< Prefer replicas in this network for read only commands.
+	bool			local_network_is_set;	//!< Whether local_network was configured.
+	fr_time_delta_t		max_replica_lag;	//!< Don't use replicas which haven't heard from
+							//!< their master for longer than this.
+
 	char const		*log_prefix;
 } fr_redis_conf_t;
 
@@ -129,7 +134,9 @@ typedef struct {
 	{ FR_CONF_OFFSET("password", FR_TYPE_STRING | FR_TYPE_SECRET, fr_redis_conf_t, password) }, \
 	{ FR_CONF_OFFSET("max_nodes", FR_TYPE_UINT8, fr_redis_conf_t, max_nodes), .dflt = "20" }, \
 	{ FR_CONF_OFFSET("max_alt", FR_TYPE_UINT32, fr_redis_conf_t, max_alt), .dflt = "3" }, \
-	{ FR_CONF_OFFSET("max_redirects", FR_TYPE_UINT32, fr_redis_conf_t, max_redirects), .dflt = "2" }
+	{ FR_CONF_OFFSET("max_redirects", FR_TYPE_UINT32, fr_redis_conf_t, max_redirects), .dflt = "2" }, \
+	{ FR_CONF_OFFSET_IS_SET("local_network", FR_TYPE_COMBO_IP_PREFIX, fr_redis_conf_t, local_network) }, \
+	{ FR_CONF_OFFSET("max_replica_lag", FR_TYPE_TIME_DELTA, fr_redis_conf_t, max_replica_lag), .dflt = "0" }
 
 void		fr_redis_version_print(void);
 
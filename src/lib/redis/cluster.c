@@ -1452,6 +1452,64 @@ static int _cluster_conn_free(fr_redis_conn_t *conn)
 	return 0;
 }
 
+/** Check a replica is keeping up with its master
+ *
+ * The lag is only checked when connections are opened, so
+ * pool.lifetime limits how long a lagging replica can be used for.
+ *
+ * @param[in] handle	to the node.
+ * @param[in] node	we're connecting to.
+ * @return
+ *	- 0 if the node is a master, or a replica within max_replica_lag.
+ *	- -1 if the replica is disconnected from its master, or lagging.
+ */
+static int cluster_replica_lag_check(redisContext *handle, fr_redis_cluster_node_t *node)
+{
+	redisReply	*reply;
+	char const	*log_prefix = node->cluster->log_prefix;
+	char const	*p;
+	int		ret = -1;
+
+	DEBUG3("%s - [%i] Executing: INFO replication", log_prefix, node->id);
+	reply = redisCommand(handle, "INFO replication");
+	if (!reply) {
+		ERROR("%s - [%i] Failed executing INFO: %s", log_prefix, node->id, handle->errstr);
+		return -1;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING) {
+		ERROR("%s - [%i] Unexpected reply of type %s to INFO", log_prefix, node->id,
+		      fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		goto finish;
+	}
+
+	if (!strstr(reply->str, "role:slave")) {
+		ret = 0;
+		goto finish;
+	}
+
+	if (!strstr(reply->str, "master_link_status:up")) {
+		ERROR("%s - [%i] Replica is not connected to its master", log_prefix, node->id);
+		goto finish;
+	}
+
+	p = strstr(reply->str, "master_last_io_seconds_ago:");
+	if (p) {
+		long lag = strtol(p + sizeof("master_last_io_seconds_ago:") - 1, NULL, 10);
+
+		if (fr_time_delta_from_sec(lag) > node->cluster->conf->max_replica_lag) {
+			ERROR("%s - [%i] Replica last heard from its master %lis ago, exceeds max_replica_lag",
+			      log_prefix, node->id, lag);
+			goto finish;
+		}
+	}
+	ret = 0;
+
+finish:
+	fr_redis_reply_free(&reply);
+	return ret;
+}
+
 /** Create a new connection to a Redis node
  *
  * @param[in] ctx to allocate connection structure in. Will be freed at the same time as the pool.
@@ -1544,6 +1602,32 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delt
 		}
 	}
 
+	/*
+	 *	Replicas redirect every command to the master
+	 *	unless the connection is marked as read only.
+	 *	It's harmless if the node is actually a master.
+	 */
+	if (!node->is_master) {
+		DEBUG3("%s - [%i] Executing: READONLY", log_prefix, node->id);
+		reply = redisCommand(handle, "READONLY");
+		if (!reply) {
+			ERROR("%s - [%i] Failed executing READONLY: %s", log_prefix, node->id, handle->errstr);
+			goto error;
+		}
+
+		/*
+		 *	Servers which aren't in cluster mode reject
+		 *	READONLY.  They'll serve reads anyway.
+		 */
+		if ((reply->type == REDIS_REPLY_ERROR) && (strstr(reply->str, "cluster") == NULL)) {
+			ERROR("%s - [%i] Failed executing READONLY: %s", log_prefix, node->id, reply->str);
+			goto error;
+		}
+		fr_redis_reply_free(&reply);
+
+		if (node->cluster->conf->max_replica_lag && (cluster_replica_lag_check(handle, node) < 0)) goto error;
+	}
+
 	conn = talloc_zero(ctx, fr_redis_conn_t);
 	conn->handle = handle;
 	talloc_set_destructor(conn, _cluster_conn_free);
@@ -1607,6 +1691,22 @@ fr_redis_cluster_node_t const *fr_redis_cluster_master(fr_redis_cluster_t *clust
 	return &cluster->node[key_slot->master];
 }
 
+/** Whether a node is in the local_network
+ *
+ */
+static inline bool cluster_node_is_local(fr_redis_cluster_t const *cluster, fr_redis_cluster_node_t const *node)
+{
+	fr_ipaddr_t		addr = node->addr.inet.dst_ipaddr;
+	fr_ipaddr_t const	*network = &cluster->conf->local_network;
+
+	if (addr.af != network->af) return false;
+
+	fr_ipaddr_mask(&addr, network->prefix);
+	addr.scope_id = network->scope_id;
+
+	return (fr_ipaddr_cmp(&addr, network) == 0);
+}
+
 /** Return the slave node that would be used for a particular key
  *
  * @param[in] cluster		To resolve key in.
@@ -1698,7 +1798,8 @@ int fr_redis_cluster_port(uint16_t *out, fr_redis_cluster_node_t const *node)
  *	slot will be chosen.
  * @param[in] key_len Length of the key.
  * @param[in] read_only If true, will use random slave pool in preference to the master, falling
- *	back to the master if no slaves are available.
+ *	back to the master if no slaves are available.  Slaves in the local_network are
+ *	tried first.
  * @return
  *	- REDIS_RCODE_TRY_AGAIN - try your command with this connection (provided via command).
  *	- REDIS_RCODE_RECONNECT - when no additional connections available.
@@ -1731,13 +1832,24 @@ again:
 	 *	1. Try each of the slaves for the key slot
 	 *	2. Fall through to trying the master, and a single alternate node.
 	 */
-	if (read_only) {
-		first = fr_rand() & key_slot->slave_num;
+	if (read_only && key_slot->slave_num) {
+		bool local_pass = cluster->conf->local_network_is_set;
+
+		first = fr_rand() % key_slot->slave_num;
+	slaves:
 		for (i = 0; i < key_slot->slave_num; i++) {
 			uint8_t node_id;
 
 			node_id = key_slot->slave[(first + i) % key_slot->slave_num];
 			node = &cluster->node[node_id];
+
+			/*
+			 *	Try slaves in the local network first,
+			 *	then the rest.
+			 */
+			if (cluster->conf->local_network_is_set &&
+			    (cluster_node_is_local(cluster, node) != local_pass)) continue;
+
 			*conn = fr_pool_connection_get(node->pool, request);
 			if (!*conn) {
 				RDEBUG2("[%i] No connections available (key slot %zu slave %i)",
@@ -1748,6 +1860,11 @@ again:
 
 			goto finish;
 		}
+
+		if (local_pass) {
+			local_pass = false;
+			goto slaves;
+		}
 		/* Fall through to using key slot master or alternate */
 	}
 
@@ -35,6 +35,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/hex.h>
+#include <freeradius-devel/util/lpm.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/trie.h>
 
@@ -56,9 +57,19 @@ struct rad_client_list {
 	fr_trie_t	*v6_tcp;
 #else
 	rbtree_t	*tree[129];
+
+	uint32_t	num_v4;			//!< Number of IPv4 clients in the trees.
+	fr_lpm_t	*v4_udp;		//!< IPv4 UDP lookups, once there are enough clients.
+	fr_lpm_t	*v4_tcp;		//!< IPv4 TCP lookups, once there are enough clients.
 #endif
 };
 
+/*
+ *	The global client list is built when the server starts, and
+ *	is read-only after that, so network threads search it without
+ *	locks.  Dynamic clients never go here.  They live in a trie
+ *	which is owned by one network thread (see master.c).
+ */
 static RADCLIENT_LIST	*root_clients = NULL;	//!< Global client list.
 
 #ifndef WITH_TRIE
@@ -79,6 +90,66 @@ static int client_cmp(void const *one, void const *two)
 	return a->proto - b->proto;
 }
 
+/*
+ *	Searching the trees costs one lookup for every prefix length
+ *	that has clients.  Once there are enough IPv4 clients, we
+ *	also put them into fixed stride tables, where a lookup is at
+ *	most three array reads.  The tables cost ~320KB each, so
+ *	small lists don't get them.
+ */
+#define CLIENT_LPM_THRESHOLD	(256)
+
+static int client_lpm_add(RADCLIENT_LIST *clients, RADCLIENT *client)
+{
+	if (client->ipaddr.af != AF_INET) return 0;
+
+	if ((client->proto != IPPROTO_TCP) &&
+	    (fr_lpm_insert(clients->v4_udp, &client->ipaddr, client) < 0)) return -1;
+
+	if ((client->proto != IPPROTO_UDP) &&
+	    (fr_lpm_insert(clients->v4_tcp, &client->ipaddr, client) < 0)) return -1;
+
+	return 0;
+}
+
+static int _client_lpm_add(void *data, void *uctx)
+{
+	return client_lpm_add(uctx, talloc_get_type_abort(data, RADCLIENT));
+}
+
+/** (Re)build the IPv4 lookup tables from the trees
+ *
+ * If anything fails, we just go back to searching the trees.
+ */
+static void client_lpm_build(RADCLIENT_LIST *clients)
+{
+	int i;
+
+	TALLOC_FREE(clients->v4_udp);
+	TALLOC_FREE(clients->v4_tcp);
+
+	if (clients->num_v4 < CLIENT_LPM_THRESHOLD) return;
+
+	clients->v4_udp = fr_lpm_alloc(clients);
+	clients->v4_tcp = fr_lpm_alloc(clients);
+	if (!clients->v4_udp || !clients->v4_tcp) goto error;
+
+	/*
+	 *	Shorter prefixes first.  The table doesn't care, but
+	 *	it does less work that way.
+	 */
+	for (i = 0; i <= 32; i++) {
+		if (!clients->tree[i]) continue;
+
+		if (rbtree_walk(clients->tree[i], RBTREE_IN_ORDER, _client_lpm_add, clients) != 0) goto error;
+	}
+
+	return;
+
+error:
+	TALLOC_FREE(clients->v4_udp);
+	TALLOC_FREE(clients->v4_tcp);
+}
 #endif
 
 void client_list_free(void)
@@ -328,6 +399,17 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 		client_free(client);
 		return false;
 	}
+
+	if (client->ipaddr.af == AF_INET) {
+		clients->num_v4++;
+
+		if (!clients->v4_udp) {
+			if (clients->num_v4 == CLIENT_LPM_THRESHOLD) client_lpm_build(clients);
+
+		} else if (client_lpm_add(clients, client) < 0) {
+			client_lpm_build(clients);
+		}
+	}
 #endif
 
 	/*
@@ -362,7 +444,16 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 
 	if (!clients->tree[client->ipaddr.prefix]) return;
 
-	(void) rbtree_deletebydata(clients->tree[client->ipaddr.prefix], client);
+	if (!rbtree_deletebydata(clients->tree[client->ipaddr.prefix], client)) return;
+
+	/*
+	 *	The tables can't remove prefixes, so rebuild them.
+	 *	Deleting clients is rare.
+	 */
+	if (client->ipaddr.af == AF_INET) {
+		clients->num_v4--;
+		if (clients->v4_udp) client_lpm_build(clients);
+	}
 #endif
 }
 
@@ -393,6 +484,10 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 
 	return fr_trie_lookup(trie, &ipaddr->addr, ipaddr->prefix);
 #else
+	if ((ipaddr->af == AF_INET) && (ipaddr->prefix == 32) && clients->v4_udp) {
+		if (proto == IPPROTO_UDP) return fr_lpm_lookup(clients->v4_udp, ipaddr);
+		if (proto == IPPROTO_TCP) return fr_lpm_lookup(clients->v4_tcp, ipaddr);
+	}
 
 	if (proto == AF_INET) {
 		max = 32;
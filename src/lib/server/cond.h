@@ -102,6 +102,8 @@ ssize_t	cond_print(fr_sbuff_t *out, fr_cond_t const *c);
 
 bool fr_cond_walk(fr_cond_t *head, bool (*callback)(fr_cond_t *cond, void *uctx), void *uctx);
 
+void fr_cond_reorder(fr_cond_t *head);
+
 int fr_cond_from_map(TALLOC_CTX *ctx, fr_cond_t **head, map_t *map);
 
 #ifdef __cplusplus
@@ -198,6 +198,7 @@ static int cond_do_regex(request_t *request, fr_cond_t const *c,
 	int		ret;
 
 	regex_t		*preg, *rreg = NULL;
+	bool		cached = false;
 	fr_regmatch_t	*regmatch;
 
 	if (!fr_cond_assert(lhs != NULL)) return -1;
@@ -213,8 +214,8 @@ static int cond_do_regex(request_t *request, fr_cond_t const *c,
 	default:
 		if (!fr_cond_assert(rhs && rhs->type == FR_TYPE_STRING)) return -1;
 		if (!fr_cond_assert(rhs && rhs->vb_strvalue)) return -1;
-		slen = regex_compile(request, &rreg, rhs->vb_strvalue, rhs->vb_length,
-				     tmpl_regex_flags(map->rhs), true, true);
+		slen = regex_compile_cached(request, &rreg, &cached, rhs->vb_strvalue, rhs->vb_length,
+					    tmpl_regex_flags(map->rhs), true);
 		if (slen <= 0) {
 			REMARKER(rhs->vb_strvalue, -slen, "%s", fr_strerror());
 			EVAL_DEBUG("FAIL %d", __LINE__);
@@ -222,6 +223,7 @@ static int cond_do_regex(request_t *request, fr_cond_t const *c,
 			return -1;
 		}
 		preg = rreg;
+		if (cached) rreg = NULL;	/* owned by the cache */
 		break;
 	}
 
@@ -1627,6 +1627,149 @@ bool fr_cond_walk(fr_cond_t *c, bool (*callback)(fr_cond_t *cond, void *uctx), v
 	return true;
 }
 
+/*
+ *	Longest list of operands we'll reorder.
+ */
+#define COND_REORDER_MAX	(64)
+
+/** Estimate how expensive an operand is to evaluate
+ *
+ * Only operands which have no side effects, and which can't fail
+ * at run time, are given a cost.  Regexes set capture groups, xlats
+ * and execs can do anything, and paircompare callbacks are opaque,
+ * so they're never moved.
+ *
+ * @return
+ *	- -1 if the operand must be evaluated where it was written.
+ *	- The relative cost of evaluating it otherwise.
+ */
+static int cond_cost(fr_cond_t const *c)
+{
+	map_t const	*map;
+	int		cost, max = 0;
+
+	switch (c->type) {
+	case COND_TYPE_TRUE:
+	case COND_TYPE_FALSE:
+	case COND_TYPE_RCODE:
+		return 0;
+
+	case COND_TYPE_TMPL:
+		if (tmpl_is_attr(c->data.vpt) || tmpl_is_list(c->data.vpt)) return 1;
+		return -1;
+
+	case COND_TYPE_MAP:
+		map = c->data.map;
+
+		if ((c->pass2_fixup != PASS2_FIXUP_NONE) ||
+		    (map->op == T_OP_REG_EQ) || (map->op == T_OP_REG_NE) ||
+		    !tmpl_is_attr(map->lhs)) return -1;
+
+		/*
+		 *	The RHS was cast to the type of the
+		 *	LHS when the condition was parsed.
+		 */
+		if (tmpl_is_data(map->rhs)) return 2;
+
+		if (tmpl_is_attr(map->rhs) && (tmpl_da(map->lhs)->type == tmpl_da(map->rhs)->type)) return 3;
+
+		return -1;
+
+	case COND_TYPE_CHILD:
+		for (c = c->data.child; c; c = c->next) {
+			if ((c->type == COND_TYPE_AND) || (c->type == COND_TYPE_OR)) continue;
+
+			cost = cond_cost(c);
+			if (cost < 0) return -1;
+			if (cost > max) max = cost;
+		}
+		return max + 1;
+
+	default:
+		return -1;
+	}
+}
+
+/** Swap the contents of two operands, leaving them in place in the list
+ *
+ */
+static void cond_swap(fr_cond_t *a, fr_cond_t *b)
+{
+	fr_cond_t tmp = *a;
+
+	a->type = b->type;
+	a->data = b->data;
+	a->negate = b->negate;
+	a->pass2_fixup = b->pass2_fixup;
+
+	b->type = tmp.type;
+	b->data = tmp.data;
+	b->negate = tmp.negate;
+	b->pass2_fixup = tmp.pass2_fixup;
+
+	if (a->type == COND_TYPE_CHILD) cond_reparent(a->data.child, a);
+	if (b->type == COND_TYPE_CHILD) cond_reparent(b->data.child, b);
+}
+
+/** Reorder operands so that cheap checks are evaluated first
+ *
+ * Within a list of operands joined by the same operator, runs of
+ * operands with no side effects are sorted by cost.  Operands are
+ * never moved across one which has side effects, so anything which
+ * was evaluated before still is, and the result doesn't change.
+ * Only the contents of operands are swapped, so the head of the
+ * list stays the same.
+ *
+ * Must be called after pass2 fixups, when all attributes are resolved.
+ *
+ * @param[in] head	of the condition to reorder.
+ */
+void fr_cond_reorder(fr_cond_t *head)
+{
+	fr_cond_t	*ops[COND_REORDER_MAX];
+	int		cost[COND_REORDER_MAX];
+	int		i, j, num = 0;
+	fr_cond_t	*c;
+	fr_cond_type_t	join = COND_TYPE_INVALID;
+
+	for (c = head; c; c = c->next) {
+		if (c->type == COND_TYPE_CHILD) fr_cond_reorder(c->data.child);
+	}
+
+	for (c = head; c; c = c->next->next) {
+		if (num == COND_REORDER_MAX) return;
+
+		ops[num] = c;
+		cost[num] = cond_cost(c);
+		num++;
+
+		if (!c->next) break;
+
+		/*
+		 *	"a && b || c" is evaluated as "a && (b || c)",
+		 *	so we only reorder lists with one operator.
+		 */
+		if (join == COND_TYPE_INVALID) join = c->next->type;
+		if ((c->next->type != join) || !c->next->next) return;
+	}
+
+	/*
+	 *	Insertion sort, as the lists are short, and it's
+	 *	stable.  Operands with side effects are barriers.
+	 */
+	for (i = 1; i < num; i++) {
+		if (cost[i] < 0) continue;
+
+		for (j = i; (j > 0) && (cost[j - 1] > cost[j]); j--) {
+			int tmp = cost[j];
+
+			cond_swap(ops[j - 1], ops[j]);
+			cost[j] = cost[j - 1];
+			cost[j - 1] = tmp;
+		}
+	}
+}
+
 /** Convert a single map to a condition.
  *
  * @param ctx	the talloc context where the condition is allocated
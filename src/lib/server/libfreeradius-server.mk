@@ -23,6 +23,7 @@ SOURCES	:= \
 	map_async.c \
 	map_proc.c \
 	module.c \
+	offload.c \
 	paircmp.c \
 	pairmove.c \
 	password.c \
@@ -78,7 +78,16 @@ static int hostname_lookups_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF
 
 static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int num_workers_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int processes_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int min_workers_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int max_workers_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int scale_interval_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int free_requests_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int cached_regexes_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int busy_poll_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int max_queue_delay_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int lib_dir_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int lazy_dictionaries_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 
 static int talloc_memory_limit_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int talloc_pool_size_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
@@ -128,6 +137,9 @@ static const CONF_PARSER lib_dir_on_read_config[] = {
 	{ FR_CONF_OFFSET("libdir", FR_TYPE_STRING | FR_TYPE_ON_READ, main_config_t, lib_dir), .dflt = "${prefix}/lib",
 	  .func = lib_dir_parse },
 
+	{ FR_CONF_OFFSET("lazy_dictionaries", FR_TYPE_BOOL | FR_TYPE_ON_READ, main_config_t, lazy_dictionaries),
+	  .func = lazy_dictionaries_parse },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -142,6 +154,9 @@ static const CONF_PARSER log_config[] = {
 	{ FR_CONF_OFFSET("line_number", FR_TYPE_BOOL, main_config_t, log_line_number) },
 	{ FR_CONF_OFFSET("timestamp", FR_TYPE_BOOL, main_config_t, log_timestamp) },
 	{ FR_CONF_OFFSET("use_utc", FR_TYPE_BOOL, main_config_t, log_dates_utc) },
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, main_config_t, log_async), .dflt = "no" },
+	{ FR_CONF_OFFSET("async_queue_size", FR_TYPE_UINT32, main_config_t, log_async_queue_size), .dflt = "4096" },
+	{ FR_CONF_OFFSET("async_block", FR_TYPE_BOOL, main_config_t, log_async_block), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -159,10 +174,35 @@ static const CONF_PARSER resources[] = {
 };
 
 static const CONF_PARSER thread_config[] = {
+	{ FR_CONF_OFFSET("processes", FR_TYPE_UINT32, main_config_t, processes), .dflt = STRINGIFY(1),
+	  .func = processes_parse },
 	{ FR_CONF_OFFSET("num_networks", FR_TYPE_UINT32, main_config_t, max_networks), .dflt = STRINGIFY(1),
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", FR_TYPE_UINT32, main_config_t, max_workers), .dflt = STRINGIFY(4),
 	  .func = num_workers_parse },
+	{ FR_CONF_OFFSET("min_workers", FR_TYPE_UINT32, main_config_t, scale_min_workers), .dflt = "0",
+	  .func = min_workers_parse },
+	{ FR_CONF_OFFSET("max_workers", FR_TYPE_UINT32, main_config_t, scale_max_workers), .dflt = "0",
+	  .func = max_workers_parse },
+	{ FR_CONF_OFFSET("scale_interval", FR_TYPE_TIME_DELTA, main_config_t, scale_interval), .dflt = "10",
+	  .func = scale_interval_parse },
+
+	{ FR_CONF_OFFSET("network_cpus", FR_TYPE_STRING, main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", FR_TYPE_STRING, main_config_t, worker_cpus) },
+
+	{ FR_CONF_OFFSET("stats_file", FR_TYPE_FILE_OUTPUT, main_config_t, stats_file) },
+
+	{ FR_CONF_OFFSET("free_requests", FR_TYPE_UINT32, main_config_t, max_free_requests), .dflt = STRINGIFY(256),
+	  .func = free_requests_parse },
+	{ FR_CONF_OFFSET("cached_regexes", FR_TYPE_UINT32, main_config_t, max_cached_regexes), .dflt = STRINGIFY(256),
+	  .func = cached_regexes_parse },
+	{ FR_CONF_OFFSET("busy_poll", FR_TYPE_TIME_DELTA, main_config_t, busy_poll), .dflt = "0",
+	  .func = busy_poll_parse },
+	{ FR_CONF_OFFSET("max_queue_delay", FR_TYPE_TIME_DELTA, main_config_t, max_queue_delay), .dflt = "0",
+	  .func = max_queue_delay_parse },
+
+	{ FR_CONF_OFFSET("huge_pages", FR_TYPE_BOOL, main_config_t, huge_pages), .dflt = "no" },
+	{ FR_CONF_OFFSET("lock_memory", FR_TYPE_BOOL, main_config_t, lock_memory), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("stats_interval | FR_TYPE_HIDDEN", FR_TYPE_TIME_DELTA, main_config_t, stats_interval), },
 
@@ -367,6 +407,35 @@ static int lib_dir_parse(UNUSED TALLOC_CTX *ctx, UNUSED void *out, UNUSED void *
 	return 0;
 }
 
+/** Enable lazy loading of vendor dictionaries
+ *
+ * This is parsed as soon as it's read, as the protocol dictionaries
+ * are loaded by the listeners, before the main configuration is parsed.
+ */
+static int lazy_dictionaries_parse(UNUSED TALLOC_CTX *ctx, UNUSED void *out, UNUSED void *parent,
+				   CONF_ITEM *ci, UNUSED CONF_PARSER const *rule)
+{
+	CONF_PAIR	*cp = cf_item_to_pair(ci);
+	fr_value_box_t	box;
+	fr_type_t	type = FR_TYPE_BOOL;
+	main_config_t	*config;
+
+	fr_assert(main_config != NULL);
+
+	if (!cf_pair_value(cp) ||
+	    (fr_value_box_from_str(NULL, &box, &type, NULL, cf_pair_value(cp), -1, '\0', false) < 0)) {
+		cf_log_perr(ci, "Invalid value for 'lazy_dictionaries'");
+		return -1;
+	}
+
+	memcpy(&config, &main_config, sizeof(config)); /* const issues */
+	config->lazy_dictionaries = box.vb_bool;
+
+	fr_dict_global_lazy_vendors(config->lazy_dictionaries);
+
+	return 0;
+}
+
 /** Configured server name takes precedence over default values
  *
  */
@@ -461,6 +530,150 @@ static int num_workers_parse(TALLOC_CTX *ctx, void *out, void *parent,
 	return 0;
 }
 
+static int processes_parse(TALLOC_CTX *ctx, void *out, void *parent,
+			   CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.processes", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.processes", value, <=, 64);
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int min_workers_parse(TALLOC_CTX *ctx, void *out, void *parent,
+			     CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.min_workers", value, <=, 64);
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int max_workers_parse(TALLOC_CTX *ctx, void *out, void *parent,
+			     CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.max_workers", value, <=, 64);
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int scale_interval_parse(TALLOC_CTX *ctx, void *out, void *parent,
+				CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	fr_time_delta_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_TIME_DELTA_BOUND_CHECK("thread.scale_interval", value, >=, fr_time_delta_from_sec(1));
+	FR_TIME_DELTA_BOUND_CHECK("thread.scale_interval", value, <=, fr_time_delta_from_sec(3600));
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int free_requests_parse(TALLOC_CTX *ctx, void *out, void *parent,
+			       CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.free_requests", value, >=, 16);
+	FR_INTEGER_BOUND_CHECK("thread.free_requests", value, <=, 65536);
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int cached_regexes_parse(TALLOC_CTX *ctx, void *out, void *parent,
+				CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	uint32_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_INTEGER_BOUND_CHECK("thread.cached_regexes", value, >=, 16);
+	FR_INTEGER_BOUND_CHECK("thread.cached_regexes", value, <=, 65536);
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int busy_poll_parse(TALLOC_CTX *ctx, void *out, void *parent,
+			   CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	fr_time_delta_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_TIME_DELTA_BOUND_CHECK("thread.busy_poll", value, >=, 0);
+	FR_TIME_DELTA_BOUND_CHECK("thread.busy_poll", value, <=, fr_time_delta_from_msec(1));
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
+static int max_queue_delay_parse(TALLOC_CTX *ctx, void *out, void *parent,
+				 CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int		ret;
+	fr_time_delta_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	if (value) {
+		FR_TIME_DELTA_BOUND_CHECK("thread.max_queue_delay", value, >=, fr_time_delta_from_msec(1));
+		FR_TIME_DELTA_BOUND_CHECK("thread.max_queue_delay", value, <=, fr_time_delta_from_sec(10));
+	}
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
 
 static size_t config_escape_func(UNUSED request_t *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
 {
@@ -1325,5 +1538,15 @@ void main_config_hup(main_config_t *config)
 	}
 #endif
 
+	/*
+	 *	Configuration reloads aren't implemented in v4.  When
+	 *	they are, they can't stop the workers.  The client
+	 *	lists are read without locks, and each worker owns
+	 *	its module thread instances.  So the new configuration
+	 *	has to be built here, then handed to each worker over
+	 *	its control channel.  The worker swaps it in between
+	 *	requests, and the old copy is freed once no request
+	 *	is still using it.
+	 */
 	INFO("HUP - NYI in version 4");	/* Not yet implemented in v4 */
 }
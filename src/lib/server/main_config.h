@@ -88,6 +88,11 @@ struct main_config_s {
 	bool		log_timestamp;
 	bool		log_timestamp_is_set;
 
+	bool		log_async;			//!< Write log messages from a dedicated thread.
+	uint32_t	log_async_queue_size;		//!< Maximum number of queued messages per thread.
+	bool		log_async_block;		//!< Wait for space in the queue instead of dropping
+							///< messages.
+
 	int32_t		syslog_facility;
 
 	char const	*dict_dir;			//!< Where to load dictionaries from.
@@ -135,9 +140,25 @@ struct main_config_s {
 
 	size_t		talloc_memory_limit;		//!< Limit the amount of talloced memory the server uses.
 							//!< Only applicable in single threaded mode.
+	uint32_t	processes;			//!< How many server processes the supervisor starts.
+	uint32_t	process_index;			//!< Which of those processes this is, from 0.
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
+	uint32_t	scale_min_workers;		//!< for the scheduler
+	uint32_t	scale_max_workers;		//!< for the scheduler
+	fr_time_delta_t	scale_interval;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
+	char const	*network_cpus;			//!< for the scheduler
+	char const	*worker_cpus;			//!< for the scheduler
+	char const	*stats_file;			//!< for the scheduler
+	uint32_t	max_free_requests;		//!< for the scheduler
+	uint32_t	max_cached_regexes;		//!< for the scheduler
+	fr_time_delta_t	busy_poll;			//!< for the scheduler
+	fr_time_delta_t	max_queue_delay;		//!< for the scheduler
+	bool		lazy_dictionaries;		//!< Only load vendor dictionaries when referenced.
+
+	bool		huge_pages;			//!< Back ring buffers with huge pages.
+	bool		lock_memory;			//!< mlockall() so that nothing is swapped out.
 
 };
 
@@ -60,6 +60,13 @@ static fr_cmd_table_t cmd_module_table[];
 
 static int _module_instantiate(void *instance, UNUSED void *ctx);
 
+/** Pools created whilst modules are being instantiated
+ *
+ * Their initial connections are all opened in parallel, once every
+ * module has been instantiated.
+ */
+static fr_pool_t **module_pools_pending;
+
 /*
  *	Ordered by component
  */
@@ -140,6 +147,20 @@ static int cmd_show_module_list(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx
 	return 0;
 }
 
+static int cmd_show_module_memory(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	module_instance_t *mi = ctx;
+
+	/*
+	 *	Thread instance data is only safe to examine from
+	 *	its own thread, so it's in "stats worker".
+	 */
+	fprintf(fp, "instance.size\t\t%zu\n", talloc_total_size(mi->dl_inst->data));
+	fprintf(fp, "instance.blocks\t\t%zu\n", talloc_total_blocks(mi->dl_inst->data));
+
+	return 0;
+}
+
 static int cmd_show_module_status(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
 {
 	module_instance_t *mi = ctx;
@@ -187,6 +208,15 @@ static fr_cmd_table_t cmd_module_table[] = {
 		.read_only = true,
 	},
 
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "memory",
+		.func = cmd_show_module_memory,
+		.help = "Show how much memory the instance data of a module is using.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "show module",
 		.add_name = true,
@@ -547,7 +577,13 @@ fr_pool_t *module_connection_pool_init(CONF_SECTION *module,
 
 		fr_pool_enable_triggers(pool, trigger_prefix, trigger_args);
 
-		if (fr_pool_start(pool) < 0) {
+		if (module_pools_pending) {
+			size_t len = talloc_array_length(module_pools_pending);
+
+			MEM(module_pools_pending = talloc_realloc(NULL, module_pools_pending, fr_pool_t *, len + 1));
+			module_pools_pending[len] = pool;
+
+		} else if (fr_pool_start(pool) < 0) {
 			ERROR("%s: Starting initial connections failed", log_prefix);
 			return NULL;
 		}
@@ -1133,6 +1169,110 @@ module_thread_instance_t *module_thread_by_data(void const *data)
 	return array[mi->number];
 }
 
+/** Return the thread instance array for the current thread
+ *
+ * This lets other threads print statistics for this thread's module
+ * instances with #module_thread_stats_fprint.
+ */
+module_thread_instance_t **module_thread_array(void)
+{
+	return module_thread_inst_array;
+}
+
+/** Update the memory statistics for each of this thread's module instances
+ *
+ * Walks the talloc tree of every thread instance, so it should be
+ * called periodically, and only by the thread which owns the array.
+ *
+ * @param[in] array	of thread instances, as returned by #module_thread_array.
+ */
+void module_thread_memory_update(module_thread_instance_t * const *array)
+{
+	size_t i;
+
+	if (!array) return;
+
+	for (i = 0; i < talloc_array_length(array); i++) {
+		module_thread_instance_t *ti = array[i];
+
+		if (!ti || !ti->data) continue;
+
+		ti->mem_size = talloc_total_size(ti->data);
+		if (ti->mem_size > ti->mem_peak) ti->mem_peak = ti->mem_size;
+	}
+}
+
+/** Print per-thread statistics for each module instance
+ *
+ * @param[in] fp	to write to.
+ * @param[in] array	of thread instances, as returned by #module_thread_array.
+ */
+void module_thread_stats_fprint(FILE *fp, module_thread_instance_t * const *array)
+{
+	size_t i;
+
+	if (!array) return;
+
+	for (i = 0; i < talloc_array_length(array); i++) {
+		module_thread_instance_t const	*ti = array[i];
+		fr_time_delta_t			when;
+		char				prefix[128];
+
+		if (!ti) continue;
+
+		if (ti->mem_peak) {
+			fprintf(fp, "module.%s.memory\t\t%zu\n", ti->name, ti->mem_size);
+			fprintf(fp, "module.%s.memory_peak\t%zu\n", ti->name, ti->mem_peak);
+		}
+
+		if (!ti->total_calls) continue;
+
+		fprintf(fp, "module.%s.calls\t\t%" PRIu64 "\n", ti->name, ti->total_calls);
+		fprintf(fp, "module.%s.active\t\t%" PRIu64 "\n", ti->name, ti->active_callers);
+
+		when = ti->running_total;
+		fprintf(fp, "module.%s.running\t\t%u.%06u\n", ti->name,
+			(unsigned int) (when / NSEC), (unsigned int) (when % NSEC) / 1000);
+
+		when = ti->waiting_total;
+		fprintf(fp, "module.%s.waiting\t\t%u.%06u\n", ti->name,
+			(unsigned int) (when / NSEC), (unsigned int) (when % NSEC) / 1000);
+
+		snprintf(prefix, sizeof(prefix), "module.%s.time", ti->name);
+		fr_time_elapsed_fprint(fp, &ti->elapsed, prefix, 4);
+	}
+}
+
+/** Print the time spent in each module instance as folded stacks
+ *
+ * The output is one "<root>;<module> <usec>" line per module instance,
+ * which can be fed directly to flamegraph.pl.  Time spent yielded is
+ * printed under a separate "<root>;<module>;waiting" frame.
+ *
+ * @param[in] fp	to write to.
+ * @param[in] root	frame, usually the name of the thread.
+ * @param[in] array	of thread instances, as returned by #module_thread_array.
+ */
+void module_thread_stats_folded_fprint(FILE *fp, char const *root, module_thread_instance_t * const *array)
+{
+	size_t i;
+
+	if (!array) return;
+
+	for (i = 0; i < talloc_array_length(array); i++) {
+		module_thread_instance_t const *ti = array[i];
+
+		if (!ti || !ti->total_calls) continue;
+
+		if (ti->running_total >= 1000) {
+			fprintf(fp, "%s;%s %" PRIu64 "\n", root, ti->name, (uint64_t) (ti->running_total / 1000));
+		}
+		if (ti->waiting_total >= 1000) {
+			fprintf(fp, "%s;%s;waiting %" PRIu64 "\n", root, ti->name, (uint64_t) (ti->waiting_total / 1000));
+		}
+	}
+}
+
 /** Explicitly free a module if a fatal error occurs during bootstrap
  *
  * @param[in] mi	to free.
@@ -1222,6 +1362,7 @@ static int _module_thread_instantiate(void *instance, void *uctx)
 	ti->el = thread_inst_ctx->el;
 	ti->module = mi->module;
 	ti->mod_inst = mi->dl_inst->data;	/* For efficient lookups */
+	ti->name = mi->name;
 
 	if (mi->module->thread_inst_size) {
 		MEM(ti->data = talloc_zero_array(ti, uint8_t, mi->module->thread_inst_size));
@@ -1371,9 +1512,35 @@ static int _module_instantiate(void *instance, UNUSED void *ctx)
  */
 int modules_instantiate(void)
 {
+	fr_pool_t	**pools;
+	int		ret;
+
 	DEBUG2("#### Instantiating modules ####");
 
-	if (rbtree_walk(module_instance_name_tree, RBTREE_IN_ORDER, _module_instantiate, NULL) < 0) return -1;
+	/*
+	 *	Modules are instantiated one at a time, in the order
+	 *	their references require.  Opening connections is the
+	 *	slow part, and doesn't depend on anything else, so the
+	 *	initial connections for all pools are opened in
+	 *	parallel afterwards.  If a module needs a connection
+	 *	whilst it's being instantiated, the pool opens one on
+	 *	demand.
+	 */
+	MEM(module_pools_pending = talloc_array(NULL, fr_pool_t *, 0));
+
+	ret = rbtree_walk(module_instance_name_tree, RBTREE_IN_ORDER, _module_instantiate, NULL);
+
+	pools = module_pools_pending;
+	module_pools_pending = NULL;
+
+	if (ret == 0) {
+		DEBUG2("Opening initial connections for %zu pool(s)", talloc_array_length(pools));
+		ret = fr_pool_start_multi(pools, talloc_array_length(pools));
+		if (ret < 0) ERROR("Starting initial connections failed");
+	}
+	talloc_free(pools);
+
+	if (ret < 0) return -1;
 
 #ifndef NDEBUG
 	{
@@ -242,6 +242,19 @@ struct module_thread_instance_s {
 
 	uint64_t			total_calls;	//! total number of times we've been called
 	uint64_t			active_callers; //! number of active callers.  i.e. number of current yields
+
+	/** @name Statistics
+	 * @{
+ 	 */
+	char const			*name;		//!< Instance name, for printing statistics.
+	fr_time_delta_t			running_total;	//!< Time spent running module code.
+	fr_time_delta_t			waiting_total;	//!< Time spent yielded, waiting for I/O or timers.
+	fr_time_elapsed_t		elapsed;	//!< Wall clock time of each call, from the first
+							///< call until the module returned a result.
+	size_t				mem_size;	//!< Memory used by the thread instance data, as of
+							///< the last #module_thread_memory_update.
+	size_t				mem_peak;	//!< Largest mem_size we've seen.
+	/** @} */
 };
 
 /** Map string values to module state method
@@ -311,6 +324,15 @@ module_instance_t	*module_by_data(void const *data);
 module_thread_instance_t *module_thread(module_instance_t *mi);
 
 module_thread_instance_t *module_thread_by_data(void const *data);
+
+module_thread_instance_t **module_thread_array(void);
+
+void		module_thread_memory_update(module_thread_instance_t * const *array);
+
+void		module_thread_stats_fprint(FILE *fp, module_thread_instance_t * const *array) CC_HINT(nonnull(1));
+
+void		module_thread_stats_folded_fprint(FILE *fp, char const *root,
+						  module_thread_instance_t * const *array) CC_HINT(nonnull(1,2));
 /** @} */
 
 /** @name Module and module thread initialisation and instantiation
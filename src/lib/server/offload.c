@@ -0,0 +1,512 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/offload.c
+ * @brief Run blocking library calls in a pool of threads, whilst the request yields.
+ *
+ * Some libraries only have blocking APIs, e.g. Kerberos, winbind, or
+ * slow password hashes.  Calling them from a worker stops every other
+ * request on that worker until they return.
+ *
+ * Modules using this create one #fr_offload_t per instance, which
+ * starts a number of threads sharing a single queue, and one
+ * #fr_offload_thread_t per worker.  Requests yield whilst the call is
+ * queued or running.  When it's done, the offload thread wakes the
+ * worker up through a pipe, and the worker resumes the request.
+ *
+ * Module methods use #fr_offload_yield, and xlat functions use
+ * #fr_offload_xlat_yield.
+ *
+ * When too many calls are queued, new calls are run in the worker.
+ * This gives backpressure instead of an unbounded queue.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/offload.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct fr_offload_job_s fr_offload_job_t;
+
+/** A call waiting for, or running in, an offload thread
+ *
+ */
+struct fr_offload_job_s {
+	fr_offload_job_t	*next;		//!< In the queue, or the worker's done list.
+	fr_offload_thread_t	*ot;		//!< Worker which queued the job.
+	request_t		*request;	//!< NULL if the request was cancelled.
+	bool			finished;	//!< The request has been marked as resumable.
+
+	fr_offload_func_t	func;		//!< Blocking call.
+	unlang_module_resume_t	resume;		//!< Called in the worker when func returns.
+	xlat_func_resume_t	xlat_resume;	//!< Called instead of resume, for xlat functions.
+	void			*uctx;		//!< Passed to func and resume.  Freed with the job.
+};
+
+/** Threads for running blocking calls
+ *
+ * A single queue is shared by every worker.
+ */
+struct fr_offload_s {
+	pthread_mutex_t		mutex;		//!< Protects the queue, and done lists.
+	pthread_cond_t		cond;		//!< Signalled when a job is queued.
+
+	fr_offload_job_t	*head;		//!< Next job to run.
+	fr_offload_job_t	**tail;		//!< Where to queue the next job.
+	uint32_t		queued;		//!< How many jobs are waiting.
+	uint32_t		max_queued;	//!< Maximum which can be waiting.
+	bool			stop;		//!< Tell the threads to exit.
+
+	pthread_t		*threads;	//!< Running jobs.
+	uint32_t		num_threads;	//!< Number of threads started.
+};
+
+/** Per-worker state
+ *
+ */
+struct fr_offload_thread_s {
+	fr_offload_t		*offload;	//!< Pool the jobs run in.
+	fr_event_list_t		*el;		//!< This worker's event list.
+
+	int			fd[2];		//!< Offload threads write to fd[1] when a job is done.
+	fr_offload_job_t	*done;		//!< Finished jobs.  Protected by the pool mutex.
+	uint32_t		outstanding;	//!< Jobs queued or running for this worker.
+};
+
+CONF_PARSER const fr_offload_config[] = {
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, fr_offload_conf_t, threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", FR_TYPE_UINT32, fr_offload_conf_t, max_queued), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Run jobs until we're told to stop
+ *
+ */
+static void *offload_thread(void *arg)
+{
+	fr_offload_t		*offload = arg;
+	fr_offload_job_t	*job;
+	fr_offload_thread_t	*ot;
+
+	pthread_mutex_lock(&offload->mutex);
+	for (;;) {
+		while (!offload->head && !offload->stop) pthread_cond_wait(&offload->cond, &offload->mutex);
+		if (offload->stop) break;
+
+		job = offload->head;
+		offload->head = job->next;
+		if (!offload->head) offload->tail = &offload->head;
+		offload->queued--;
+		pthread_mutex_unlock(&offload->mutex);
+
+		job->func(job->uctx);
+
+		pthread_mutex_lock(&offload->mutex);
+		ot = job->ot;
+		job->next = ot->done;
+		ot->done = job;
+
+		/*
+		 *	If the pipe is full the worker
+		 *	already has a wakeup pending.
+		 */
+		if (write(ot->fd[1], "", 1) < 0) { /* nothing */ }
+	}
+	pthread_mutex_unlock(&offload->mutex);
+
+	return NULL;
+}
+
+/** Resume requests whose jobs have finished
+ *
+ */
+static void offload_done(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_offload_thread_t	*ot = talloc_get_type_abort(uctx, fr_offload_thread_t);
+	fr_offload_job_t	*job, *next;
+	char			buffer[64];
+
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	pthread_mutex_lock(&ot->offload->mutex);
+	job = ot->done;
+	ot->done = NULL;
+	pthread_mutex_unlock(&ot->offload->mutex);
+
+	for (; job; job = next) {
+		next = job->next;
+		ot->outstanding--;
+
+		if (!job->request) {
+			talloc_free(job);
+			continue;
+		}
+
+		job->finished = true;
+		unlang_interpret_mark_resumable(job->request);
+	}
+}
+
+/** Continue after a job has been run by an offload thread
+ *
+ */
+static unlang_action_t offload_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, void *rctx)
+{
+	fr_offload_job_t	*job = talloc_get_type_abort(rctx, fr_offload_job_t);
+	unlang_action_t		ua;
+
+	ua = job->resume(p_result, mctx, request, job->uctx);
+	talloc_free(job);
+
+	return ua;
+}
+
+/** Continue an xlat after a job has been run by an offload thread
+ *
+ */
+static xlat_action_t offload_xlat_resume(TALLOC_CTX *ctx, fr_cursor_t *out,
+					 request_t *request, void const *xlat_inst, void *xlat_thread_inst,
+					 fr_value_box_t **in, void *rctx)
+{
+	fr_offload_job_t	*job = talloc_get_type_abort(rctx, fr_offload_job_t);
+	xlat_action_t		xa;
+
+	xa = job->xlat_resume(ctx, out, request, xlat_inst, xlat_thread_inst, in, job->uctx);
+	talloc_free(job);
+
+	return xa;
+}
+
+/** Stop waiting for a job
+ *
+ * If the job is queued, or has finished, we free it.  Otherwise an
+ * offload thread is running it, and it's freed when it's done.
+ */
+static void offload_cancel(request_t *request, fr_offload_job_t *job)
+{
+	fr_offload_thread_t	*ot = job->ot;
+	fr_offload_t		*offload = ot->offload;
+	fr_offload_job_t	**job_p;
+
+	RDEBUG2("Cancelling offloaded call");
+
+	pthread_mutex_lock(&offload->mutex);
+	for (job_p = &offload->head; *job_p; job_p = &(*job_p)->next) {
+		if (*job_p != job) continue;
+
+		*job_p = job->next;
+		if (!*job_p) offload->tail = job_p;
+		offload->queued--;
+		pthread_mutex_unlock(&offload->mutex);
+
+		ot->outstanding--;
+		talloc_free(job);
+		return;
+	}
+	pthread_mutex_unlock(&offload->mutex);
+
+	/*
+	 *	Finished, and the resume function
+	 *	is never going to be called.
+	 */
+	if (job->finished) {
+		talloc_free(job);
+		return;
+	}
+
+	job->request = NULL;
+}
+
+/** Stop waiting for a job if the request is cancelled
+ *
+ */
+static void offload_signal(UNUSED module_ctx_t const *mctx, request_t *request, void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	offload_cancel(request, talloc_get_type_abort(rctx, fr_offload_job_t));
+}
+
+/** Stop waiting for a job if the request running the xlat is cancelled
+ *
+ */
+static void offload_xlat_signal(request_t *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
+				void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	offload_cancel(request, talloc_get_type_abort(rctx, fr_offload_job_t));
+}
+
+/** Queue a job for the offload threads
+ *
+ * @return
+ *	- The queued job.
+ *	- NULL if offloading is disabled, or the queue is full.  The caller
+ *	  should run func itself.
+ */
+static fr_offload_job_t *offload_queue(fr_offload_thread_t *ot, request_t *request,
+				       fr_offload_func_t func, void *uctx)
+{
+	fr_offload_t		*offload;
+	fr_offload_job_t	*job;
+
+	if (!ot || (ot->offload->queued >= ot->offload->max_queued)) return NULL;
+	offload = ot->offload;
+
+	MEM(job = talloc_zero(NULL, fr_offload_job_t));
+	job->ot = ot;
+	job->request = request;
+	job->func = func;
+	job->uctx = talloc_steal(job, uctx);
+
+	pthread_mutex_lock(&offload->mutex);
+	if (offload->queued >= offload->max_queued) {
+		pthread_mutex_unlock(&offload->mutex);
+		talloc_steal(NULL, uctx);
+		talloc_free(job);
+		return NULL;
+	}
+	*offload->tail = job;
+	offload->tail = &job->next;
+	offload->queued++;
+	pthread_cond_signal(&offload->cond);
+	pthread_mutex_unlock(&offload->mutex);
+
+	ot->outstanding++;
+
+	return job;
+}
+
+/** Run a blocking call in an offload thread, and yield the request
+ *
+ * If ot is NULL, or too many calls are queued, func is run in the
+ * worker, and resume is called immediately.
+ *
+ * @param[out] p_result	Result of resume, if it was called immediately.
+ * @param[in] mctx	Module context of the caller.
+ * @param[in] request	The current request.
+ * @param[in] ot	This worker's offload state, or NULL if offloading is disabled.
+ * @param[in] func	Blocking call to make.  Must not touch the request.
+ * @param[in] resume	Called in the worker once func has returned.
+ * @param[in] uctx	Passed to func and resume.  Must be talloced, and is freed,
+ *			along with its children, after resume returns, or when it's
+ *			no longer needed if the request is cancelled.
+ * @return
+ *	- UNLANG_ACTION_YIELD if the call was offloaded.
+ *	- Whatever resume returned otherwise.
+ */
+unlang_action_t fr_offload_yield(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				 fr_offload_thread_t *ot, fr_offload_func_t func,
+				 unlang_module_resume_t resume, void *uctx)
+{
+	fr_offload_job_t	*job;
+	unlang_action_t		ua;
+
+	job = offload_queue(ot, request, func, uctx);
+	if (!job) {
+		func(uctx);
+		ua = resume(p_result, mctx, request, uctx);
+		talloc_free(uctx);
+
+		return ua;
+	}
+	job->resume = resume;
+
+	return unlang_module_yield(request, offload_resume, offload_signal, job);
+}
+
+/** Run a blocking call in an offload thread, and yield the request running an xlat
+ *
+ * The same as #fr_offload_yield, but for xlat functions.  The first six
+ * arguments are those the xlat function was called with, and are passed
+ * to resume if it's called immediately.
+ *
+ * @param[in] ctx		to allocate output boxes in.
+ * @param[out] out		where to write output boxes.
+ * @param[in] request		The current request.
+ * @param[in] xlat_inst		of the calling xlat.
+ * @param[in] xlat_thread_inst	of the calling xlat.
+ * @param[in] in		arguments of the calling xlat.
+ * @param[in] ot		This worker's offload state, or NULL if offloading is disabled.
+ * @param[in] func		Blocking call to make.  Must not touch the request.
+ * @param[in] resume		Called in the worker once func has returned.
+ * @param[in] uctx		Passed to func and resume.  Must be talloced, and is freed
+ *				in the same way as for #fr_offload_yield.
+ * @return
+ *	- XLAT_ACTION_YIELD if the call was offloaded.
+ *	- Whatever resume returned otherwise.
+ */
+xlat_action_t fr_offload_xlat_yield(TALLOC_CTX *ctx, fr_cursor_t *out,
+				    request_t *request, void const *xlat_inst, void *xlat_thread_inst,
+				    fr_value_box_t **in,
+				    fr_offload_thread_t *ot, fr_offload_func_t func,
+				    xlat_func_resume_t resume, void *uctx)
+{
+	fr_offload_job_t	*job;
+	xlat_action_t		xa;
+
+	job = offload_queue(ot, request, func, uctx);
+	if (!job) {
+		func(uctx);
+		xa = resume(ctx, out, request, xlat_inst, xlat_thread_inst, in, uctx);
+		talloc_free(uctx);
+
+		return xa;
+	}
+	job->xlat_resume = resume;
+
+	return unlang_xlat_yield(request, offload_xlat_resume, offload_xlat_signal, job);
+}
+
+/** Stop the offload threads
+ *
+ */
+static int _offload_free(fr_offload_t *offload)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&offload->mutex);
+	offload->stop = true;
+	pthread_cond_broadcast(&offload->cond);
+	pthread_mutex_unlock(&offload->mutex);
+
+	for (i = 0; i < offload->num_threads; i++) pthread_join(offload->threads[i], NULL);
+
+	pthread_cond_destroy(&offload->cond);
+	pthread_mutex_destroy(&offload->mutex);
+
+	return 0;
+}
+
+/** Start a pool of offload threads
+ *
+ * @param[in] ctx	to allocate the pool in.  Freeing it stops the threads.
+ * @param[in] conf	how many threads to start, and how many calls can be queued.
+ * @return
+ *	- The new pool.
+ *	- NULL on error, or if conf->threads is 0.
+ */
+fr_offload_t *fr_offload_alloc(TALLOC_CTX *ctx, fr_offload_conf_t const *conf)
+{
+	fr_offload_t	*offload;
+	uint32_t	i;
+	int		ret;
+
+	if (!conf->threads) return NULL;
+
+	MEM(offload = talloc_zero(ctx, fr_offload_t));
+	MEM(offload->threads = talloc_array(offload, pthread_t, conf->threads));
+	pthread_mutex_init(&offload->mutex, NULL);
+	pthread_cond_init(&offload->cond, NULL);
+	offload->tail = &offload->head;
+	offload->max_queued = conf->max_queued;
+	talloc_set_destructor(offload, _offload_free);
+
+	for (i = 0; i < conf->threads; i++) {
+		ret = pthread_create(&offload->threads[i], NULL, offload_thread, offload);
+		if (ret != 0) {
+			fr_strerror_printf("Failed creating offload thread: %s", fr_syserror(ret));
+			talloc_free(offload);
+			return NULL;
+		}
+		offload->num_threads++;
+	}
+
+	return offload;
+}
+
+/** Wait for any jobs this worker still has running
+ *
+ * All the requests have been cancelled by now, so the jobs
+ * are only waiting to be freed.
+ */
+static int _offload_thread_free(fr_offload_thread_t *ot)
+{
+	fr_offload_t		*offload = ot->offload;
+	fr_offload_job_t	*job, *next;
+
+	(void) fr_event_fd_delete(ot->el, ot->fd[0], FR_EVENT_FILTER_IO);
+
+	while (ot->outstanding > 0) {
+		pthread_mutex_lock(&offload->mutex);
+		job = ot->done;
+		ot->done = NULL;
+		pthread_mutex_unlock(&offload->mutex);
+
+		if (!job) {
+			usleep(1000);
+			continue;
+		}
+
+		for (; job; job = next) {
+			next = job->next;
+			ot->outstanding--;
+			talloc_free(job);
+		}
+	}
+
+	close(ot->fd[0]);
+	close(ot->fd[1]);
+
+	return 0;
+}
+
+/** Set up a worker so it can offload calls
+ *
+ * @param[in] ctx	to allocate the state in, usually the module's thread instance data.
+ * @param[in] offload	pool to run the calls in.
+ * @param[in] el	of the worker.
+ * @return
+ *	- The new state.
+ *	- NULL on error.
+ */
+fr_offload_thread_t *fr_offload_thread_alloc(TALLOC_CTX *ctx, fr_offload_t *offload, fr_event_list_t *el)
+{
+	fr_offload_thread_t *ot;
+
+	MEM(ot = talloc_zero(ctx, fr_offload_thread_t));
+	ot->offload = offload;
+	ot->el = el;
+
+	if (pipe(ot->fd) < 0) {
+		fr_strerror_printf("Failed creating offload pipe: %s", fr_syserror(errno));
+		talloc_free(ot);
+		return NULL;
+	}
+
+	if ((fr_nonblock(ot->fd[0]) < 0) || (fr_nonblock(ot->fd[1]) < 0) ||
+	    (fr_event_fd_insert(ot, el, ot->fd[0], offload_done, NULL, NULL, ot) < 0)) {
+		fr_strerror_printf_push("Failed listening on offload pipe");
+		close(ot->fd[0]);
+		close(ot->fd[1]);
+		talloc_free(ot);
+		return NULL;
+	}
+	talloc_set_destructor(ot, _offload_thread_free);
+
+	return ot;
+}
@@ -0,0 +1,84 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/offload.h
+ * @brief Run blocking library calls in a pool of threads, whilst the request yields.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(offload_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_offload_s fr_offload_t;
+typedef struct fr_offload_thread_s fr_offload_thread_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/unlang/module.h>
+#include <freeradius-devel/unlang/xlat.h>
+#include <freeradius-devel/util/event.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Configuration for a pool of offload threads
+ *
+ * Usually parsed from an "offload { ... }" subsection with #fr_offload_config.
+ */
+typedef struct {
+	uint32_t		threads;	//!< How many threads to start.  0 disables offloading.
+	uint32_t		max_queued;	//!< Maximum number of calls waiting for a thread.
+} fr_offload_conf_t;
+
+extern CONF_PARSER const fr_offload_config[];
+
+/** A blocking call, run by an offload thread
+ *
+ * Must not touch the request, or anything else owned by the worker.
+ * Everything it needs should be copied into uctx.
+ *
+ * @param[in] uctx	passed to #fr_offload_yield.
+ */
+typedef void (*fr_offload_func_t)(void *uctx);
+
+fr_offload_t		*fr_offload_alloc(TALLOC_CTX *ctx, fr_offload_conf_t const *conf);
+
+fr_offload_thread_t	*fr_offload_thread_alloc(TALLOC_CTX *ctx, fr_offload_t *offload, fr_event_list_t *el);
+
+unlang_action_t		fr_offload_yield(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					 fr_offload_thread_t *ot, fr_offload_func_t func,
+					 unlang_module_resume_t resume, void *uctx);
+
+xlat_action_t		fr_offload_xlat_yield(TALLOC_CTX *ctx, fr_cursor_t *out,
+					      request_t *request, void const *xlat_inst, void *xlat_thread_inst,
+					      fr_value_box_t **in,
+					      fr_offload_thread_t *ot, fr_offload_func_t func,
+					      xlat_func_resume_t resume, void *uctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -315,6 +315,7 @@ int paircmp_pairs(UNUSED request_t *request, fr_pair_t *check, fr_pair_t *vp)
 	if ((check->op == T_OP_REG_EQ) || (check->op == T_OP_REG_NE)) {
 		ssize_t		slen;
 		regex_t		*preg = NULL;
+		bool		cached = false;
 		uint32_t	subcaptures;
 		fr_regmatch_t	*regmatch;
 
@@ -339,17 +340,18 @@ int paircmp_pairs(UNUSED request_t *request, fr_pair_t *check, fr_pair_t *vp)
 			REDEBUG("Error stringifying operand for regular expression");
 
 		regex_error:
-			talloc_free(preg);
+			if (!cached) talloc_free(preg);
 			talloc_free(expr);
 			talloc_free(value);
 			return -2;
 		}
 
 		/*
-		 *	Include substring matches.
+		 *	Include substring matches.  The same check items
+		 *	are evaluated for every request, so use the cache.
 		 */
-		slen = regex_compile(request, &preg, expr_p, talloc_array_length(expr_p) - 1,
-				     NULL, true, true);
+		slen = regex_compile_cached(request, &preg, &cached, expr_p, talloc_array_length(expr_p) - 1,
+					    &(fr_regex_flags_t){ 0 }, true);
 		if (slen <= 0) {
 			REMARKER(expr_p, -slen, "%s", fr_strerror());
 
@@ -381,7 +383,7 @@ int paircmp_pairs(UNUSED request_t *request, fr_pair_t *check, fr_pair_t *vp)
 		}
 
 		talloc_free(regmatch);
-		talloc_free(preg);
+		if (!cached) talloc_free(preg);
 		talloc_free(expr);
 		talloc_free(value);
 
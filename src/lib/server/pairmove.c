@@ -34,6 +34,70 @@ RCSID("$Id$")
 
 #include <ctype.h>
 
+/*
+ *	Below this many attributes in the "to" list, scanning it is
+ *	cheaper than building an index.
+ */
+#define PAIRMOVE_INDEX_MIN	(8)
+
+/** The attributes in the "to" list with a particular da
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;
+	int			first;		//!< Index of the first one in to_list.
+	int			last;		//!< Index of the last one in to_list.
+} pairmove_index_t;
+
+static uint32_t pairmove_index_hash(void const *data)
+{
+	pairmove_index_t const *a = data;
+
+	return fr_hash(&a->da, sizeof(a->da));
+}
+
+static int pairmove_index_cmp(void const *one, void const *two)
+{
+	pairmove_index_t const *a = one, *b = two;
+
+	return (a->da > b->da) - (a->da < b->da);
+}
+
+/** Index the "to" list by da
+ *
+ * Each entry of next_same is the index of the next attribute in
+ * to_list with the same da, or -1.  The da of an entry never changes,
+ * because attributes are only ever replaced by ones with the same da,
+ * so the chains stay valid as the list is edited.
+ */
+static fr_hash_table_t *pairmove_index_alloc(TALLOC_CTX *ctx, int **next_same, fr_pair_t **to_list, int to_count)
+{
+	fr_hash_table_t		*ht;
+	pairmove_index_t	*entries, *entry;
+	int			i, num = 0;
+
+	MEM(ht = fr_hash_table_create(ctx, pairmove_index_hash, pairmove_index_cmp, NULL));
+	MEM(entries = talloc_array(ht, pairmove_index_t, to_count));
+	MEM(*next_same = talloc_array(ht, int, to_count));
+
+	for (i = 0; i < to_count; i++) {
+		(*next_same)[i] = -1;
+
+		entry = fr_hash_table_find_by_data(ht, &(pairmove_index_t){ .da = to_list[i]->da });
+		if (entry) {
+			(*next_same)[entry->last] = i;
+			entry->last = i;
+			continue;
+		}
+
+		entry = &entries[num++];
+		*entry = (pairmove_index_t){ .da = to_list[i]->da, .first = i, .last = i };
+		MEM(fr_hash_table_insert(ht, entry) >= 0);
+	}
+
+	return ht;
+}
+
 /*
  *	The fr_pair_list_move() function in src/lib/valuepair.c does all sorts of
  *	extra magic that we don't want here.
@@ -52,6 +116,8 @@ void radius_pairmove(request_t *request, fr_pair_list_t *to, fr_pair_list_t *fro
 	fr_pair_t 	*to_copy = NULL;
 	bool		*edited = NULL;
 	TALLOC_CTX	*ctx;
+	fr_hash_table_t	*index = NULL;
+	int		*next_same = NULL;
 
 	/*
 	 *	Set up arrays for editing, to remove some of the
@@ -106,6 +172,17 @@ void radius_pairmove(request_t *request, fr_pair_list_t *to, fr_pair_list_t *fro
 	tailto = to_count;
 	edited = talloc_zero_array(request, bool, to_count);
 
+	/*
+	 *	For large lists, index the "to" list by da, so
+	 *	that we only look at the attributes which can
+	 *	match.  The order of the matches is the same as
+	 *	the order of the list, so the semantics of the
+	 *	operators don't change.
+	 */
+	if ((to_count >= PAIRMOVE_INDEX_MIN) && (from_count > 1)) {
+		index = pairmove_index_alloc(request, &next_same, to_list, to_count);
+	}
+
 	RDEBUG4("::: FROM %d TO %d MAX %d", from_count, to_count, count);
 
 	/*
@@ -127,7 +204,16 @@ void radius_pairmove(request_t *request, fr_pair_list_t *to, fr_pair_list_t *fro
 		if (from_list[i]->op == T_OP_ADD) goto do_append;
 
 		found = false;
-		for (j = 0; j < to_count; j++) {
+		if (index) {
+			pairmove_index_t *entry;
+
+			entry = fr_hash_table_find_by_data(index, &(pairmove_index_t){ .da = from_list[i]->da });
+			j = entry ? entry->first : -1;
+		} else {
+			j = (to_count > 0) ? 0 : -1;
+		}
+
+		for (; j >= 0; j = index ? next_same[j] : (((j + 1) < to_count) ? j + 1 : -1)) {
 			if (edited[j] || !to_list[j] || !from_list[i]) continue;
 
 			/*
@@ -324,4 +410,5 @@ void radius_pairmove(request_t *request, fr_pair_list_t *to, fr_pair_list_t *fro
 
 	talloc_free(to_list);
 	talloc_free(edited);
+	talloc_free(index);
 }
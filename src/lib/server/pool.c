@@ -35,9 +35,23 @@ RCSID("$Id$")
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/misc.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 #include <time.h>
 
 typedef struct fr_pool_connection_s fr_pool_connection_t;
+typedef _Atomic(fr_pool_connection_t *) fr_pool_connection_atomic_t;
+
+/** Number of threads which can keep a connection back from each pool
+ *
+ * Threads beyond this always go through the pool mutex.
+ */
+#define POOL_THREAD_SLOTS	(128)
+
+#define CACHE_LINE_SIZE		64
 
 static int connection_check(fr_pool_t *pool, request_t *request);
 
@@ -66,13 +80,31 @@ struct fr_pool_connection_s {
 						//!< handle.
 	bool		in_use;			//!< Whether the connection is currently reserved.
 
-	bool		needs_reconnecting;	//!< Reconnect this connection before use.
+	atomic_bool	needs_reconnecting;	//!< Reconnect this connection before use.
+						//!< Atomic as it's checked by threads without the mutex.
 
 #ifdef PTHREAD_DEBUG
 	pthread_t	pthread_id;		//!< When 'in_use == true'.
 #endif
 };
 
+/** A connection kept back from the pool for a single thread
+ *
+ * Lets a thread reserve and release the same connection repeatedly
+ * without taking the pool mutex.  A connection in a slot is counted as
+ * active by the pool, and is only given back (with the mutex held) when
+ * the pool needs it for another thread, or needs to manage it.
+ */
+typedef struct {
+	fr_pool_connection_atomic_t parked;	//!< Connection waiting to be reserved by the thread.
+						//!< Only ever exchanged, so the pool can take it back
+						//!< at any time.
+	fr_pool_connection_t	*owned;		//!< Connection taken from parked, and now reserved.
+						//!< Only used by the thread.
+	fr_time_t		last_locked;	//!< Last time the thread went through the mutex.
+						//!< Only used by the thread.
+} CC_HINT(aligned(CACHE_LINE_SIZE)) fr_pool_thread_slot_t;
+
 /** A connection pool
  *
  * Defines the configuration of the connection pool, all the counters and
@@ -110,7 +142,11 @@ struct fr_pool_s {
 	bool		spread;			//!< If true we spread requests over the connections,
 						//!< using the connection released longest ago, first.
 
+	bool		thread_cache;		//!< Let each thread keep a connection back
+						//!< from the pool, to avoid the mutex.
+
 	fr_heap_t	*heap;			//!< For the next connection heap
+	fr_pool_thread_slot_t	*slots;		//!< One per thread, indexed by #pool_thread_id.
 
 	fr_pool_connection_t	*head;		//!< Start of the connection list.
 	fr_pool_connection_t	*tail;		//!< End of the connection list.
@@ -163,9 +199,17 @@ static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", FR_TYPE_TIME_DELTA, fr_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", FR_TYPE_TIME_DELTA, fr_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", FR_TYPE_BOOL, fr_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("thread_cache", FR_TYPE_BOOL, fr_pool_t, thread_cache), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
 };
 
+/** Identifies the slot this thread uses in every pool
+ *
+ * Zero if not yet assigned, otherwise the slot index + 1.
+ */
+static _Thread_local uint32_t pool_thread_id;
+static atomic_uint_fast32_t pool_thread_id_next;
+
 /** Order connections by reserved most recently
  */
 static int8_t last_reserved_cmp(void const *one, void const *two)
@@ -259,6 +303,120 @@ static inline void fr_pool_trigger_exec(fr_pool_t *pool, request_t *request, cha
 	trigger_exec(request, pool->cs, name, true, &pool->trigger_args);
 }
 
+/** Return this thread's slot in the pool, assigning it one if necessary
+ *
+ * @param[in] pool	to get the slot in.
+ * @return
+ *	- The slot for this thread.
+ *	- NULL if the thread cache is disabled, or there are too many threads.
+ */
+static inline fr_pool_thread_slot_t *connection_slot(fr_pool_t *pool)
+{
+	if (!pool->slots) return NULL;
+
+	if (unlikely(!pool_thread_id)) pool_thread_id = atomic_fetch_add(&pool_thread_id_next, 1) + 1;
+	if (pool_thread_id > POOL_THREAD_SLOTS) return NULL;
+
+	return &pool->slots[pool_thread_id - 1];
+}
+
+/** Check whether a thread can keep using a connection without the mutex
+ *
+ * Anything which the pool may need to act on sends the thread
+ * through the mutex instead.
+ *
+ * @param[in] pool	the connection belongs to.
+ * @param[in] slot	of the current thread.
+ * @param[in] this	Connection to check.
+ * @param[in] now	Current time.
+ * @return
+ *	- true if the connection can stay with this thread.
+ *	- false if it should be given back to the pool.
+ */
+static inline bool connection_cache_usable(fr_pool_t *pool, fr_pool_thread_slot_t *slot,
+					   fr_pool_connection_t *this, fr_time_t now)
+{
+	if (atomic_load(&this->needs_reconnecting)) return false;
+
+	if ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) return false;
+
+	/*
+	 *	Go through the mutex at least once a second,
+	 *	so the pool still gets managed.
+	 */
+	return ((now - slot->last_locked) < NSEC);
+}
+
+/** Keep a connection back from the pool for the current thread
+ *
+ * The connection stays reserved as far as the pool is concerned.
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	the connection belongs to.
+ * @param[in] slot	of the current thread (may be NULL).
+ * @param[in] this	Connection to keep back.
+ * @return
+ *	- true if the connection is now in the slot.
+ *	- false if the slot was already full, or the connection can't be kept.
+ */
+static inline bool connection_park(fr_pool_t *pool, fr_pool_thread_slot_t *slot, fr_pool_connection_t *this)
+{
+	fr_pool_connection_t *empty = NULL;
+
+	if (!slot || atomic_load(&this->needs_reconnecting)) return false;
+
+	if ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) return false;
+
+	return atomic_compare_exchange_strong(&slot->parked, &empty, this);
+}
+
+/** Mark a reserved connection as unused, and make it available to all threads
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	the connection belongs to.
+ * @param[in] this	Connection to put back in the heap.
+ */
+static void connection_unreserve(fr_pool_t *pool, fr_pool_connection_t *this)
+{
+	this->in_use = false;
+
+	fr_assert(pool->state.active != 0);
+	pool->state.active--;
+
+	fr_heap_insert(pool->heap, this);
+}
+
+/** Take back all the connections threads are keeping from the pool
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	to reclaim connections for.
+ * @return the number of connections reclaimed.
+ */
+static uint32_t connection_reclaim(fr_pool_t *pool)
+{
+	uint32_t i, num, reclaimed = 0;
+
+	if (!pool->slots) return 0;
+
+	num = atomic_load(&pool_thread_id_next);
+	if (num > POOL_THREAD_SLOTS) num = POOL_THREAD_SLOTS;
+
+	for (i = 0; i < num; i++) {
+		fr_pool_connection_t *this;
+
+		this = atomic_exchange(&pool->slots[i].parked, NULL);
+		if (!this) continue;
+
+		connection_unreserve(pool, this);
+		reclaimed++;
+	}
+
+	return reclaimed;
+}
+
 /** Find a connection handle in the connection list
  *
  * Walks over the list of connections searching for a specified connection
@@ -289,6 +447,14 @@ static fr_pool_connection_t *connection_find(fr_pool_t *pool, void *conn)
 	 */
 	for (this = pool->head; this != NULL; this = this->next) {
 		if (this->connection == conn) {
+			fr_pool_thread_slot_t *slot = connection_slot(pool);
+
+			/*
+			 *	The caller is finishing with it,
+			 *	one way or another.
+			 */
+			if (slot && (slot->owned == this)) slot->owned = NULL;
+
 #ifdef PTHREAD_DEBUG
 			pthread_t pthread_id;
 
@@ -591,7 +757,7 @@ static int connection_manage(fr_pool_t *pool, request_t *request, fr_pool_connec
 	 */
 	if (this->in_use) return 1;
 
-	if (this->needs_reconnecting) {
+	if (atomic_load(&this->needs_reconnecting)) {
 		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): Needs reconnecting",
 			  this->number);
 	do_delete:
@@ -652,6 +818,13 @@ static int connection_check(fr_pool_t *pool, request_t *request)
 		return 1;
 	}
 
+	/*
+	 *	Connections kept back by threads count as
+	 *	active, so take them back before deciding
+	 *	what's idle.
+	 */
+	connection_reclaim(pool);
+
 	/*
 	 *	Some idle connections are OK, if they're within the
 	 *	configured "spare" range.  Any extra connections
@@ -806,13 +979,18 @@ static void *connection_get_internal(fr_pool_t *pool, request_t *request, bool s
 {
 	fr_time_t now;
 	fr_pool_connection_t *this;
+	fr_pool_thread_slot_t *slot;
 
 	if (!pool) return NULL;
 
+	slot = connection_slot(pool);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	now = fr_time();
+	if (slot) slot->last_locked = now;
 
+again:
 	/*
 	 *	Grab the link with the lowest latency, and check it
 	 *	for limits.  If "connection manage" says the link is
@@ -823,6 +1001,13 @@ static void *connection_get_internal(fr_pool_t *pool, request_t *request, bool s
 		if (!this) break;
 	} while (!connection_manage(pool, request, this, now));
 
+	/*
+	 *	Other threads may be keeping connections back
+	 *	that they're not using.  Share them out before
+	 *	spawning more.
+	 */
+	if (!this && connection_reclaim(pool)) goto again;
+
 	/*
 	 *	We have a working connection.  Extract it from the
 	 *	heap and use it.
@@ -1072,6 +1257,19 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	 */
 	FR_TIME_DELTA_BOUND_CHECK("connect_timeout", pool->connect_timeout, >=, fr_time_delta_from_msec(100));
 
+	/*
+	 *	One slot per thread, each in its own cache line,
+	 *	so threads using their own slots don't contend.
+	 */
+	if (pool->thread_cache) {
+		if (!talloc_aligned_array(pool, (void **)&pool->slots, CACHE_LINE_SIZE,
+					  sizeof(fr_pool_thread_slot_t) * POOL_THREAD_SLOTS)) {
+			ERROR("%s: Failed allocating thread slots", __FUNCTION__);
+			goto error;
+		}
+		memset(pool->slots, 0, sizeof(fr_pool_thread_slot_t) * POOL_THREAD_SLOTS);
+	}
+
 	/*
 	 *	Don't open any connections.  Instead, force the limits
 	 *	to only 1 connection.
@@ -1087,33 +1285,126 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 
 int fr_pool_start(fr_pool_t *pool)
 {
-	uint32_t		i;
-	fr_pool_connection_t 	*this;
+	return fr_pool_start_multi(&pool, 1);
+}
+
+#define POOL_START_THREADS	(16)	//!< Maximum number of threads opening initial connections.
+
+/** Initial connections which still need to be opened
+ *
+ */
+typedef struct {
+	fr_pool_t		**pools;	//!< Pools to open connections for.
+	uint32_t		*spawn;		//!< How many connections each pool needs.
+	bool			*failed;	//!< Whether opening a connection failed, per pool.
+	size_t			num_pools;	//!< Length of the arrays above.
+
+	uint32_t		total;		//!< The sum of spawn.
+	atomic_uint_fast32_t	next;		//!< Next connection to open, from 0..total.
+} pool_start_t;
+
+/** Open initial connections until there are none left
+ *
+ * Connections are numbered by pool, so each caller takes the next
+ * number, and works out which pool it belongs to.
+ */
+static void *pool_start_spawn(void *uctx)
+{
+	pool_start_t	*ps = uctx;
+	uint32_t	i, j;
+
+	while ((i = atomic_fetch_add_explicit(&ps->next, 1, memory_order_relaxed)) < ps->total) {
+		for (j = 0; i >= ps->spawn[j]; j++) i -= ps->spawn[j];
+
+		/*
+		 *	Get the time for each spawn attempt, as there
+		 *	could be a significant delay.
+		 */
+		if (!connection_spawn(ps->pools[j], NULL, fr_time(), false, true)) ps->failed[j] = true;
+	}
+
+	return NULL;
+}
+
+/** Create the initial connections for multiple pools in parallel
+ *
+ * Opening a connection usually means waiting for the other end, so
+ * with many pools, or a large "start" value, opening connections one
+ * after another makes startup slow.  Instead, every connection is
+ * opened by whichever of a small group of threads is free.  Opening
+ * connections is already done from multiple threads at run time, so
+ * create callbacks are expected to be thread safe.
+ *
+ * Connections which are already open count towards "start".
+ *
+ * @param[in] pools	to start.
+ * @param[in] num	number of pools.
+ * @return
+ *	- 0 if all pools were started.
+ *	- -1 if opening any connection failed.
+ */
+int fr_pool_start_multi(fr_pool_t **pools, size_t num)
+{
+	pool_start_t	ps = { .pools = pools, .num_pools = num };
+	fr_pool_t	*pool;
+	pthread_t	threads[POOL_START_THREADS - 1];
+	size_t		i, num_threads = 0;
+	int		ret = 0;
 
 	/*
 	 *	Don't spawn any connections
 	 */
-	if (check_config) return 0;
+	if (check_config || !num) return 0;
+
+	pool = pools[0];
+	ps.spawn = talloc_zero_array(NULL, uint32_t, num);
+	ps.failed = talloc_zero_array(NULL, bool, num);
+	if (!ps.spawn || !ps.failed) {
+		ERROR("Out of memory");
+		ret = -1;
+		goto finish;
+	}
+
+	for (i = 0; i < num; i++) {
+		pool = pools[i];
+
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->start > pool->state.num) ps.spawn[i] = pool->start - pool->state.num;
+		pthread_mutex_unlock(&pool->mutex);
+
+		ps.total += ps.spawn[i];
+	}
 
 	/*
-	 *	Create all of the connections, unless the admin says
-	 *	not to.
+	 *	This thread opens connections, too.  If there's only
+	 *	one to open, there's no need for any more threads.
 	 */
-	for (i = 0; i < pool->start; i++) {
-		/*
-		 *	Call time() once for each spawn attempt as there
-		 *	could be a significant delay.
-		 */
-		this = connection_spawn(pool, NULL, time(NULL), false, true);
-		if (!this) {
+	while ((num_threads < NUM_ELEMENTS(threads)) && ((num_threads + 1) < ps.total)) {
+		if (pthread_create(&threads[num_threads], NULL, pool_start_spawn, &ps) != 0) break;
+		num_threads++;
+	}
+
+	pool_start_spawn(&ps);
+
+	for (i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+
+	for (i = 0; i < num; i++) {
+		pool = pools[i];
+
+		if (ps.failed[i]) {
 			ERROR("Failed spawning initial connections");
-			return -1;
+			ret = -1;
+			continue;
 		}
+
+		fr_pool_trigger_exec(pool, NULL, "start");
 	}
 
-	fr_pool_trigger_exec(pool, NULL, "start");
+finish:
+	talloc_free(ps.spawn);
+	talloc_free(ps.failed);
 
-	return 0;
+	return ret;
 }
 
 /** Allocate a new pool using an existing one as a template
@@ -1227,6 +1518,12 @@ int fr_pool_reconnect(fr_pool_t *pool, request_t *request)
 	 */
 	pool->state.reconnecting = true;
 
+	/*
+	 *	Connections kept back by threads need
+	 *	reconnecting too.
+	 */
+	connection_reclaim(pool);
+
 	/*
 	 *	When the loop exits, we'll hold the lock for the pool,
 	 *	and we're guaranteed the connection create callback
@@ -1252,7 +1549,7 @@ int fr_pool_reconnect(fr_pool_t *pool, request_t *request)
 	 *	Mark all remaining connections in the pool as
 	 *	requiring reconnection.
 	 */
-	for (this = pool->head; this; this = this->next) this->needs_reconnecting = true;
+	for (this = pool->head; this; this = this->next) atomic_store(&this->needs_reconnecting, true);
 
 	/*
 	 *	Call the reconnect callback (if one's set)
@@ -1317,6 +1614,8 @@ void fr_pool_free(fr_pool_t *pool)
 
 	pthread_mutex_lock(&pool->mutex);
 
+	connection_reclaim(pool);
+
 	/*
 	 *	Don't loop over the list.  Just keep removing the head
 	 *	until they're all gone.
@@ -1350,6 +1649,10 @@ void fr_pool_free(fr_pool_t *pool)
  * on a connection spawning not already being in progress, and not being at the
  * 'max' connection limit.
  *
+ * If the thread cache is enabled, and this thread released a connection
+ * back into its slot, that connection is reserved again without taking
+ * the mutex.
+ *
  * @note fr_pool_connection_release must be called once the caller has finished
  * using the connection.
  *
@@ -1362,6 +1665,41 @@ void fr_pool_free(fr_pool_t *pool)
  */
 void *fr_pool_connection_get(fr_pool_t *pool, request_t *request)
 {
+	fr_pool_thread_slot_t	*slot;
+	fr_pool_connection_t	*this;
+	fr_time_t		now;
+
+	if (!pool) return NULL;
+
+	slot = connection_slot(pool);
+	if (!slot || slot->owned) goto slow;
+
+	this = atomic_exchange(&slot->parked, NULL);
+	if (!this) goto slow;
+
+	now = fr_time();
+	if (unlikely(!connection_cache_usable(pool, slot, this, now))) {
+		/*
+		 *	Let the pool decide what to do with it.
+		 */
+		pthread_mutex_lock(&pool->mutex);
+		connection_unreserve(pool, this);
+		pthread_mutex_unlock(&pool->mutex);
+		goto slow;
+	}
+
+	this->num_uses++;
+	this->last_reserved = now;
+#ifdef PTHREAD_DEBUG
+	this->pthread_id = pthread_self();
+#endif
+	slot->owned = this;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
+
+	return this->connection;
+
+slow:
 	return connection_get_internal(pool, request, true);
 }
 
@@ -1370,6 +1708,10 @@ void *fr_pool_connection_get(fr_pool_t *pool, request_t *request)
  * Will mark a connection as unused and decrement the number of active
  * connections.
  *
+ * If the thread cache is enabled, the connection is kept back in this
+ * thread's slot instead, so the next #fr_pool_connection_get from this
+ * thread can reserve it again without taking the mutex.
+ *
  * @see fr_pool_connection_get
  * @param[in] pool	to release the connection in.
  * @param[in] request	The current request.
@@ -1377,20 +1719,48 @@ void *fr_pool_connection_get(fr_pool_t *pool, request_t *request)
  */
 void fr_pool_connection_release(fr_pool_t *pool, request_t *request, void *conn)
 {
+	fr_pool_thread_slot_t	*slot;
 	fr_pool_connection_t	*this;
 	fr_time_delta_t		held;
 	bool			trigger_min = false, trigger_max = false;
 
+	if (!pool) return;
+
+	slot = connection_slot(pool);
+
+	/*
+	 *	Put a connection we got from our slot straight
+	 *	back, unless one of the triggers needs to fire.
+	 */
+	if (slot && slot->owned && (slot->owned->connection == conn)) {
+		fr_pool_connection_t	*empty = NULL;
+		fr_time_t		now = fr_time();
+
+		this = slot->owned;
+		held = now - this->last_reserved;
+
+		if (connection_cache_usable(pool, slot, this, now) &&
+		    !(pool->held_trigger_min && (held < pool->held_trigger_min)) &&
+		    !(pool->held_trigger_max && (held > pool->held_trigger_max))) {
+		    	slot->owned = NULL;
+			this->last_released = now;
+
+			if (likely(atomic_compare_exchange_strong(&slot->parked, &empty, this))) {
+				ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
+				return;
+			}
+		}
+	}
+
 	this = connection_find(pool, conn);
 	if (!this) return;
 
-	this->in_use = false;
-
 	/*
 	 *	Record when the connection was last released
 	 */
-	this->last_reserved = fr_time();
+	this->last_released = fr_time();
 	pool->state.last_released = this->last_released;
+	if (slot) slot->last_locked = this->last_released;
 
 	/*
 	 *	This is done inside the mutex to ensure
@@ -1410,7 +1780,7 @@ void fr_pool_connection_release(fr_pool_t *pool, request_t *request, void *conn)
 	    	pool->state.last_held_min = this->last_released;
 	}
 
-	if (pool->held_trigger_min &&
+	if (pool->held_trigger_max &&
 	    (held > pool->held_trigger_max) &&
 	    ((this->last_released - pool->state.last_held_max) >= NSEC)) {
 	    	trigger_max = true;
@@ -1418,17 +1788,16 @@ void fr_pool_connection_release(fr_pool_t *pool, request_t *request, void *conn)
 	}
 
 	/*
-	 *	Insert the connection in the heap.
+	 *	Keep the connection back for this thread, if it
+	 *	isn't already keeping one.  Otherwise insert the
+	 *	connection in the heap.
 	 *
 	 *	This will either be based on when we *started* using it
 	 *	(allowing fast links to be re-used, and slow links to be
 	 *	gradually expired), or when we released it (allowing
 	 *	the maximum amount of time between connection use).
 	 */
-	fr_heap_insert(pool->heap, this);
-
-	fr_assert(pool->state.active != 0);
-	pool->state.active--;
+	if (!connection_park(pool, slot, this)) connection_unreserve(pool, this);
 
 	ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
 
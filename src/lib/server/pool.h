@@ -65,7 +65,8 @@ struct fr_pool_state_s {
 	uint64_t	count;			//!< Number of connections spawned over the lifetime
 						//!< of the pool.
 	uint32_t       	num;			//!< Number of connections in the pool.
-	uint32_t	active;	 		//!< Number of currently reserved connections.
+	uint32_t	active;	 		//!< Number of currently reserved connections, including
+						//!< those kept back by threads.
 
 	bool		reconnecting;		//!< We are currently reconnecting the pool.
 };
@@ -136,6 +137,8 @@ fr_pool_t	*fr_pool_init(TALLOC_CTX *ctx,
 			      char const *log_prefix);
 int		fr_pool_start(fr_pool_t *pool);
 
+int		fr_pool_start_multi(fr_pool_t **pools, size_t num);
+
 fr_pool_t	*fr_pool_copy(TALLOC_CTX *ctx, fr_pool_t *pool, void *opaque);
 
 
@@ -28,6 +28,8 @@ RCSID("$Id$")
 #include <freeradius-devel/server/regex.h>
 #include <freeradius-devel/server/request_data.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/thread_local.h>
 
 #ifdef HAVE_REGEX
 
@@ -40,6 +42,176 @@ typedef struct {
 	fr_regmatch_t	*regmatch;	//!< Match vectors.
 } fr_regcapture_t;
 
+/** A regex compiled at runtime, and kept for reuse
+ *
+ */
+typedef struct {
+	char			*pattern;	//!< the expanded pattern.
+	size_t			len;		//!< length of the pattern.
+	fr_regex_flags_t	flags;		//!< flags the pattern was compiled with.
+	bool			subcaptures;	//!< whether subcaptures were enabled.
+	uint32_t		hash;		//!< of all of the above.
+	regex_t			*preg;		//!< the compiled pattern.
+} regex_cache_entry_t;
+
+typedef struct {
+	fr_hash_table_t		*ht;		//!< of regex_cache_entry_t.
+	regex_cache_stats_t	stats;		//!< usage of this cache.
+} regex_cache_t;
+
+static _Thread_local regex_cache_t *regex_cache; /* macro */
+
+#define REGEX_CACHE_MAX_ENTRIES (256)
+
+/*
+ *	The flags are bitfields, so we can't hash or compare the
+ *	structure directly.  Squash them into a single byte.
+ */
+static inline uint8_t regex_cache_flags(fr_regex_flags_t const *flags, bool subcaptures)
+{
+	return (flags->global << 0) | (flags->ignore_case << 1) | (flags->multiline << 2) |
+	       (flags->dot_all << 3) | (flags->unicode << 4) | (flags->extended << 5) | (subcaptures << 6);
+}
+
+static uint32_t regex_cache_entry_hash(void const *data)
+{
+	regex_cache_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int regex_cache_entry_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const *a = one, *b = two;
+	uint8_t a_flags, b_flags;
+
+	a_flags = regex_cache_flags(&a->flags, a->subcaptures);
+	b_flags = regex_cache_flags(&b->flags, b->subcaptures);
+	if (a_flags != b_flags) return (a_flags > b_flags) - (a_flags < b_flags);
+
+	if (a->len != b->len) return (a->len > b->len) - (a->len < b->len);
+
+	return memcmp(a->pattern, b->pattern, a->len);
+}
+
+static void _regex_cache_free_on_exit(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Return the regex cache for this thread, creating it if necessary
+ *
+ */
+static inline regex_cache_t *regex_cache_get(void)
+{
+	regex_cache_t *cache;
+
+	if (likely(regex_cache != NULL)) return regex_cache;
+
+	MEM(cache = talloc_zero(NULL, regex_cache_t));
+	MEM(cache->ht = fr_hash_table_create(cache, regex_cache_entry_hash, regex_cache_entry_cmp, NULL));
+	cache->stats.max_entries = REGEX_CACHE_MAX_ENTRIES;
+	fr_thread_local_set_destructor(regex_cache, _regex_cache_free_on_exit, cache);
+
+	return cache;
+}
+
+/** Initialise the thread local regex cache
+ *
+ * @param[in] max_entries	the number of compiled patterns to keep.
+ *				If 0, the default is used.
+ * @return the statistics for this threads regex cache.
+ */
+regex_cache_stats_t const *regex_cache_init(uint32_t max_entries)
+{
+	regex_cache_t *cache = regex_cache_get();
+
+	if (max_entries) cache->stats.max_entries = max_entries;
+
+	return &cache->stats;
+}
+
+/** Compile a dynamically expanded pattern, or return a previously compiled copy
+ *
+ * Patterns which are the result of an expansion are usually drawn
+ * from a small set, so compiling them on every evaluation is wasted
+ * effort.  We keep the compiled pattern in a thread local cache,
+ * and can therefore afford to JIT it.
+ *
+ * Cached patterns are marked as precompiled, so regex_sub_to_request()
+ * won't steal them, and they must not be freed by the caller.  Entries
+ * are never evicted; once the cache is full, patterns we haven't seen
+ * are compiled for one off use, as before.
+ *
+ * @param[in] ctx		To allocate one off patterns in.
+ * @param[out] out		Where to write the compiled pattern.
+ * @param[out] cached		Whether the pattern belongs to the cache.
+ *				If false, the caller must free it.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] flags		controlling matching.
+ * @param[in] subcaptures	Whether to compile the regular expression to store subcapture data.
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error.  Negative value is offset of parse error.
+ */
+ssize_t regex_compile_cached(TALLOC_CTX *ctx, regex_t **out, bool *cached,
+			     char const *pattern, size_t len,
+			     fr_regex_flags_t const *flags, bool subcaptures)
+{
+	regex_cache_t		*cache = regex_cache_get();
+	regex_cache_entry_t	find, *entry;
+	uint8_t			packed;
+	ssize_t			slen;
+
+	*out = NULL;
+	*cached = false;
+
+	packed = regex_cache_flags(flags, subcaptures);
+
+	find = (regex_cache_entry_t) {
+		.len = len,
+		.flags = *flags,
+		.subcaptures = subcaptures,
+		.hash = fr_hash_update(&packed, sizeof(packed), fr_hash(pattern, len))
+	};
+	memcpy(&find.pattern, &pattern, sizeof(find.pattern));
+
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (entry) {
+		cache->stats.hits++;
+		*out = entry->preg;
+		*cached = true;
+		return len;
+	}
+	cache->stats.misses++;
+
+	if ((uint32_t) fr_hash_table_num_elements(cache->ht) >= cache->stats.max_entries) {
+		return regex_compile(ctx, out, pattern, len, flags, subcaptures, true);
+	}
+
+	MEM(entry = talloc(cache, regex_cache_entry_t));
+	*entry = find;
+	MEM(entry->pattern = talloc_bstrndup(entry, pattern, len));
+
+	slen = regex_compile(entry, &entry->preg, entry->pattern, len, flags, subcaptures, false);
+	if (slen <= 0) {
+		talloc_free(entry);
+		return slen;
+	}
+
+	if (fr_hash_table_insert(cache->ht, entry) < 0) {
+		talloc_free(entry);
+		return regex_compile(ctx, out, pattern, len, flags, subcaptures, true);
+	}
+	cache->stats.num_entries++;
+
+	*out = entry->preg;
+	*cached = true;
+
+	return slen;
+}
+
 /** Adds subcapture values to request data
  *
  * Allows use of %{n} expansions.
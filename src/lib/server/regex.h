@@ -41,6 +41,22 @@ extern "C" {
  */
 #  define REQUEST_MAX_REGEX 32
 
+/** Usage of the thread local cache of runtime compiled patterns
+ *
+ */
+typedef struct {
+	uint32_t	max_entries;		//!< maximum number of patterns kept.
+	uint32_t	num_entries;		//!< patterns which are currently cached.
+	uint64_t	hits;			//!< lookups which found a compiled pattern.
+	uint64_t	misses;			//!< lookups which had to compile the pattern.
+} regex_cache_stats_t;
+
+regex_cache_stats_t const *regex_cache_init(uint32_t max_entries);
+
+ssize_t	regex_compile_cached(TALLOC_CTX *ctx, regex_t **out, bool *cached,
+			     char const *pattern, size_t len,
+			     fr_regex_flags_t const *flags, bool subcaptures);
+
 void	regex_sub_to_request(request_t *request, regex_t **preg, fr_regmatch_t **regmatch);
 
 int	regex_request_to_sub(TALLOC_CTX *ctx, char **out, request_t *request, uint32_t num);
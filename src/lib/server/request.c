@@ -28,11 +28,53 @@ RCSID("$Id$")
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/unlang/base.h>
 
-/** The thread local free list
+/** The thread local request slab
+ *
+ * Freed requests are reset and put back onto the free list, so that the
+ * next request can reuse the pooled memory without going back to malloc.
  *
  * Any entries remaining in the list will be freed when the thread is joined
  */
-static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
+typedef struct {
+	fr_dlist_head_t		free_list;	//!< request shells ready for reuse.
+	request_slab_stats_t	stats;		//!< usage of this slab.
+} request_slab_t;
+
+static _Thread_local request_slab_t *request_slab; /* macro */
+
+#define REQUEST_SLAB_MAX_FREE (256)
+
+/** Free any free requests when the thread is joined
+ *
+ */
+static void _request_slab_free_on_exit(void *arg)
+{
+	request_slab_t	*slab = talloc_get_type_abort(arg, request_slab_t);
+	request_t	*request;
+
+	/*
+	 *	See the destructor for why this works
+	 */
+	while ((request = fr_dlist_head(&slab->free_list))) talloc_free(request);
+	talloc_free(slab);
+}
+
+/** Return the request slab for this thread, creating it if necessary
+ *
+ */
+static inline request_slab_t *request_slab_get(void)
+{
+	request_slab_t *slab;
+
+	if (likely(request_slab != NULL)) return request_slab;
+
+	MEM(slab = talloc_zero(NULL, request_slab_t));
+	fr_dlist_init(&slab->free_list, request_t, free_entry);
+	slab->stats.max_free = REQUEST_SLAB_MAX_FREE;
+	fr_thread_local_set_destructor(request_slab, _request_slab_free_on_exit, slab);
+
+	return slab;
+}
 
 #ifndef NDEBUG
 static int _state_ctx_free(TALLOC_CTX *state)
@@ -59,14 +101,16 @@ static void request_init(char const *file, int line, request_t *request)
 	request->master_state = REQUEST_ACTIVE;
 
 	/*
-	 *	Initialise the stack
+	 *	Initialise the stack, unless we kept the
+	 *	old one when the request was recycled.
 	 */
-	MEM(request->stack = unlang_interpret_stack_alloc(request));
+	if (!request->stack) MEM(request->stack = unlang_interpret_stack_alloc(request));
 
 	/*
 	 *	Initialise the request data list
 	 */
 	request_data_list_init(&request->data);
+	memset(request->data_index, 0, sizeof(request->data_index));
 
 	/*
 	 *	Initialise the state_ctx
@@ -123,6 +167,8 @@ static void request_init(char const *file, int line, request_t *request)
  */
 static int _request_free(request_t *request)
 {
+	request_slab_t *slab;
+
 	fr_assert(!request->ev);
 
 	/*
@@ -140,9 +186,12 @@ static int _request_free(request_t *request)
 	 *	We keep a buffer of <active> + N requests per
 	 *	thread, to avoid spurious allocations.
 	 */
-	if (fr_dlist_num_elements(request_free_list) <= 256) {
+	slab = request_slab_get();
+	if (slab->stats.num_used > 0) slab->stats.num_used--;
+
+	if (fr_dlist_num_elements(&slab->free_list) < slab->stats.max_free) {
 		TALLOC_CTX		*state_ctx;
-		fr_dlist_head_t		*free_list;
+		void			*stack;
 
 		/*
 		 *	Ensure any data associated
@@ -153,21 +202,28 @@ static int _request_free(request_t *request)
 			fr_assert(!request->parent || (request->state_ctx != request->parent->state_ctx));
 			talloc_free_children(request->state_ctx);
 		}
-		free_list = request_free_list;
+		/*
+		 *	The stack is a large pooled object, so
+		 *	keep it, and just clear it out.
+		 */
+		stack = request->stack;
+		if (stack) talloc_steal(NULL, stack);
 
 		/*
 		 *	Reinitialise the request
 		 */
 		talloc_free_children(request);
+		if (stack) unlang_interpret_stack_reset(stack);
 		memset(request, 0, sizeof(*request));
 		request->component = "free_list";
 		request->state_ctx = state_ctx;		/* Use the old, now cleared, state_ctx */
+		if (stack) request->stack = talloc_steal(request, stack);
 
 		/*
 		 *	Reinsert into the free list
 		 */
-		fr_dlist_insert_head(free_list, request);
-		request_free_list = free_list;
+		fr_dlist_insert_head(&slab->free_list, request);
+		slab->stats.num_free = fr_dlist_num_elements(&slab->free_list);
 
 		return -1;	/* Prevent free */
  	}
@@ -215,19 +271,21 @@ really_free:
 	return 0;
 }
 
-/** Free any free requests when the thread is joined
+/** Set up the request slab for this thread
+ *
+ * Should be called by each worker, before it allocates any requests.
  *
+ * @param[in] max_free	the number of freed requests to keep for reuse.
+ *			If 0, the default is used.
+ * @return the statistics for this threads request slab.
  */
-static void _request_free_list_free_on_exit(void *arg)
+request_slab_stats_t const *request_slab_init(uint32_t max_free)
 {
-	fr_dlist_head_t *list = talloc_get_type_abort(arg, fr_dlist_head_t);
-	request_t		*request;
+	request_slab_t *slab = request_slab_get();
 
-	/*
-	 *	See the destructor for why this works
-	 */
-	while ((request = fr_dlist_head(list))) talloc_free(request);
-	talloc_free(list);
+	if (max_free) slab->stats.max_free = max_free;
+
+	return &slab->stats;
 }
 
 /** Create a new request_t data structure
@@ -235,22 +293,16 @@ static void _request_free_list_free_on_exit(void *arg)
  */
 request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx)
 {
-	request_t			*request;
-	fr_dlist_head_t		*free_list;
+	request_t		*request;
+	request_slab_t		*slab;
 
 	/*
-	 *	Setup the free list, or return the free
-	 *	list for this thread.
+	 *	Setup the slab, or return the slab
+	 *	for this thread.
 	 */
-	if (unlikely(!request_free_list)) {
-		MEM(free_list = talloc(NULL, fr_dlist_head_t));
-		fr_dlist_init(free_list, request_t, free_entry);
-		fr_thread_local_set_destructor(request_free_list, _request_free_list_free_on_exit, free_list);
-	} else {
-		free_list = request_free_list;
-	}
+	slab = request_slab_get();
 
-	request = fr_dlist_head(free_list);
+	request = fr_dlist_head(&slab->free_list);
 	if (!request) {
 		/*
 		 *	Only allocate requests in the NULL
@@ -271,14 +323,20 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx)
 							128				/* extra */
 							));
 		talloc_set_destructor(request, _request_free);
+		slab->stats.alloced++;
 	} else {
 		/*
 		 *	Remove from the free list, as we're
 		 *	about to use it!
 		 */
-		fr_dlist_remove(free_list, request);
+		fr_dlist_remove(&slab->free_list, request);
+		slab->stats.num_free = fr_dlist_num_elements(&slab->free_list);
+		slab->stats.reused++;
 	}
 
+	slab->stats.num_used++;
+	if (slab->stats.num_used > slab->stats.hwm_used) slab->stats.hwm_used = slab->stats.num_used;
+
 	request_init(file, line, request);
 
 	/*
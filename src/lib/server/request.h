@@ -66,6 +66,8 @@ typedef enum {
 } rad_master_state_t;
 #define REQUEST_MASTER_NUM_STATES (REQUEST_COUNTED + 1)
 
+#define REQUEST_DATA_INDEX_SIZE	(16)	//!< Slots in the request data index.  Must be a power of 2.
+
 typedef enum request_state_t {
 	REQUEST_INIT = 0,
 	REQUEST_RECV,
@@ -96,6 +98,8 @@ struct request_s {
 	request_state_t		request_state;	//!< state for the various protocol handlers.
 
 	fr_dlist_head_t		data;		//!< Request metadata.
+	struct request_data_s	*data_index[REQUEST_DATA_INDEX_SIZE];	//!< Recently used request data,
+						//!< indexed by a hash of the key.
 
 	rad_listen_t		*listener;	//!< The listener that received the request.
 	RADCLIENT		*client;	//!< The client that originally sent us the request.
@@ -177,6 +181,20 @@ struct request_s {
 #define RAD_REQUEST_OPTION_CTX	(1 << 1)
 #define RAD_REQUEST_OPTION_DETAIL (1 << 2)
 
+/** Usage of the thread local request slab
+ *
+ */
+typedef struct {
+	uint32_t	max_free;		//!< maximum number of freed requests kept for reuse.
+	uint32_t	num_free;		//!< freed requests which are available for reuse.
+	uint32_t	num_used;		//!< requests which are currently allocated.
+	uint32_t	hwm_used;		//!< high water mark of num_used.
+	uint64_t	alloced;		//!< requests allocated from the heap.
+	uint64_t	reused;			//!< requests taken from the free list.
+} request_slab_stats_t;
+
+request_slab_stats_t const *request_slab_init(uint32_t max_free);
+
 #define		request_alloc(_ctx) _request_alloc( __FILE__, __LINE__, _ctx)
 request_t		*_request_alloc(char const *file, int line, TALLOC_CTX *ctx);
 
@@ -25,6 +25,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/server/request_data.h>
 
 /** Per-request opaque data, added by modules
@@ -32,6 +33,7 @@ RCSID("$Id$")
  */
 struct request_data_s {
 	fr_dlist_t	list;			//!< Next opaque request data struct linked to this request.
+	request_data_t	**slot;			//!< Slot in the request's data_index which points to us.
 
 	void const	*unique_ptr;		//!< Key to lookup request data.
 	int		unique_int;		//!< Alternative key to lookup request data.
@@ -85,6 +87,57 @@ static char *request_data_description(TALLOC_CTX *ctx, request_data_t *rd)
 		return out;
 }
 
+/** Return the index slot for a key
+ *
+ * The index is a small direct mapped cache in front of request->data.
+ * Entries are only ever in the index whilst they're in request->data,
+ * and remove themselves from it when unlinked, so a hit doesn't
+ * need to be checked against the list.
+ */
+static inline request_data_t **request_data_slot(request_t *request, void const *unique_ptr, int unique_int)
+{
+	uint32_t hash;
+
+	hash = fr_hash(&unique_ptr, sizeof(unique_ptr));
+	hash = fr_hash_update(&unique_int, sizeof(unique_int), hash);
+
+	return &request->data_index[hash & (REQUEST_DATA_INDEX_SIZE - 1)];
+}
+
+/** Remove request data from its request's index
+ *
+ */
+static inline void request_data_unindex(request_data_t *rd)
+{
+	if (rd->slot && (*rd->slot == rd)) *rd->slot = NULL;
+	rd->slot = NULL;
+}
+
+/** Find request data in a request, using the index if possible
+ *
+ * Entries found by searching the list are added to the index,
+ * replacing whatever was in the slot.
+ */
+static request_data_t *request_data_find(request_t *request, void const *unique_ptr, int unique_int)
+{
+	request_data_t	**slot = request_data_slot(request, unique_ptr, unique_int);
+	request_data_t	*rd = *slot;
+
+	if (rd && (rd->unique_ptr == unique_ptr) && (rd->unique_int == unique_int)) return rd;
+
+	rd = NULL;
+	while ((rd = fr_dlist_next(&request->data, rd))) {
+		if ((rd->unique_ptr == unique_ptr) && (rd->unique_int == unique_int)) break;
+	}
+	if (!rd) return NULL;
+
+	if (*slot) (*slot)->slot = NULL;
+	*slot = rd;
+	rd->slot = slot;
+
+	return rd;
+}
+
 /* Initialise a dlist for storing request data
  *
  * @param[in] list to initialise.
@@ -122,6 +175,7 @@ static int _request_data_free(request_data_t *rd)
 	 *	of never running into use after free errors/
 	 */
 	fr_dlist_entry_unlink(&rd->list);
+	request_data_unindex(rd);
 
 	if (DEBUG_ENABLED4) desc = request_data_description(rd, rd);
 
@@ -205,10 +259,9 @@ int _request_data_add(request_t *request, void const *unique_ptr, int unique_int
 	if (type) opaque = _talloc_get_type_abort(opaque, type, __location__);
 #endif
 
-	while ((rd = fr_dlist_next(&request->data, rd))) {
-		if ((rd->unique_ptr != unique_ptr) || (rd->unique_int != unique_int)) continue;
-
-		fr_dlist_remove(&request->data, rd);	/* Unlink from the list */
+	rd = request_data_find(request, unique_ptr, unique_int);
+	if (rd) {
+		fr_dlist_remove(&request->data, rd);	/* Unlink from the list, it's added back below */
 
 		/*
 		 *	If caller requires custom behaviour on free
@@ -229,8 +282,6 @@ int _request_data_add(request_t *request, void const *unique_ptr, int unique_int
 			rd->free_on_parent = false;
 			TALLOC_FREE(rd);
 		}
-
-		break;	/* replace the existing entry */
 	}
 
 	/*
@@ -295,11 +346,10 @@ void *request_data_get(request_t *request, void const *unique_ptr, int unique_in
 
 	if (!request) return NULL;
 
-	while ((rd = fr_dlist_next(&request->data, rd))) {
+	rd = request_data_find(request, unique_ptr, unique_int);
+	if (rd) {
 		void *ptr;
 
-		if ((rd->unique_ptr != unique_ptr) || (rd->unique_int != unique_int)) continue;
-
 		ptr = rd->opaque;
 
 		rd->free_on_parent = false;	/* Don't free opaque data we're handing back */
@@ -342,9 +392,8 @@ void *request_data_reference(request_t *request, void const *unique_ptr, int uni
 
 	if (!request) return NULL;
 
-	while ((rd = fr_dlist_next(&request->data, rd))) {
-		if ((rd->unique_ptr != unique_ptr) || (rd->unique_int != unique_int)) continue;
-
+	rd = request_data_find(request, unique_ptr, unique_int);
+	if (rd) {
 #ifndef TALLOC_GET_TYPE_ABORT_NOOP
 		if (rd->type) rd->opaque = _talloc_get_type_abort(rd->opaque, rd->type, __location__);
 #endif
@@ -378,6 +427,7 @@ int request_data_by_persistance(fr_dlist_head_t *out, request_t *request, bool p
 		if (rd->persist != persist) continue;
 
 		prev = fr_dlist_remove(&request->data, rd);
+		request_data_unindex(rd);
 		fr_dlist_insert_tail(out, rd);
 		rd = prev;
 	}
@@ -414,6 +464,7 @@ int request_data_by_persistance_reparent(TALLOC_CTX *ctx, fr_dlist_head_t *out,
 		 *	Clear the list pointers...
 		 */
 		memset(&new->list, 0, sizeof(new->list));
+		new->slot = NULL;
 		rd->free_on_parent = false;
 		talloc_free(rd);
 
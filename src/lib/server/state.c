@@ -42,6 +42,16 @@
           \-> reply                 \-> reply                 \-> access-reject/access-accept
  * @endverbatim
  *
+ * State entries are local to the server process, and can't be shared
+ * between the members of a cluster.  The session-state pairs could be
+ * serialised, but the persistable request data is opaque.  It is
+ * usually live library state, such as an OpenSSL session in the middle
+ * of a handshake, and has talloc destructors, timers and open handles
+ * attached.  None of this can be moved to another process.  Deployments
+ * with more than one server must route all the packets of a
+ * conversation to the same server, e.g. by hashing on the State
+ * attribute, or on Calling-Station-Id.
+ *
  * @copyright 2014 The FreeRADIUS server project
  */
 RCSID("$Id$")
@@ -55,6 +65,14 @@ RCSID("$Id$")
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct fr_state_shard_s fr_state_shard_t;
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
@@ -100,6 +118,7 @@ typedef struct {
 	uint64_t		seq_start;			//!< Number of first request in this sequence.
 	time_t			cleanup;			//!< When this entry should be cleaned up.
 	fr_dlist_t		list;				//!< Entry in the list of things to expire.
+	fr_state_shard_t	*shard;				//!< Shard the entry lives in.
 
 	int			tries;
 
@@ -112,22 +131,37 @@ typedef struct {
 	request_t			*thawed;			//!< The request that thawed this entry.
 } fr_state_entry_t;
 
-struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
+/** One part of the state tree, with its own lock
+ *
+ * Entries are spread over the shards by the hash of their state value,
+ * so that workers handling different sessions rarely contend for the
+ * same mutex.  All entries have the same lifetime, so appending to the
+ * expiry list keeps it ordered by cleanup time.
+ */
+struct fr_state_shard_s {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	rbtree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+};
+
+#define STATE_SHARDS	(16)				//!< Must be a power of 2.
+
+struct fr_state_tree_s {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast32_t	num_entries;			//!< Entries in all of the shards.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	rbtree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 
 	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 
 	fr_dict_attr_t const	*da;				//!< State attribute used.
+
+	fr_state_shard_t	shards[STATE_SHARDS];		//!< Entries, split by the hash of their state value.
 };
 
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
@@ -135,6 +169,14 @@ struct fr_state_tree_s {
 
 static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
 
+/** Return the shard which holds a given state value
+ *
+ */
+static inline fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shards[fr_hash(entry->state, sizeof(entry->state)) & (STATE_SHARDS - 1)];
+}
+
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
  */
@@ -150,22 +192,29 @@ static int state_entry_cmp(void const *one, void const *two)
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	size_t			i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (!shard->tree) continue;	/* Partially initialised */
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(state, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -186,6 +235,7 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id)
 {
 	fr_state_tree_t *state;
+	size_t		i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
@@ -202,29 +252,35 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
+	state->thread_safe = thread_safe;
+	talloc_set_destructor(state, _state_tree_free);
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, list);
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = rbtree_talloc_alloc(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, list);
+
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_talloc_alloc(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			talloc_free(state);
+			return NULL;
+		}
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
-	state->thread_safe = thread_safe;
 
 	return state;
 }
@@ -239,9 +295,10 @@ static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
+	fr_dlist_remove(&entry->shard->to_expire, entry);
 
-	rbtree_deletebydata(state->tree, entry);
+	if (rbtree_deletebydata(entry->shard->tree, entry)) atomic_fetch_sub_explicit(&state->num_entries, 1,
+											memory_order_relaxed);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -284,35 +341,21 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Remove timed out entries from a shard
  *
- * @note Called with the mutex held.
+ * @note Called with the shard mutex held.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
-					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
+static uint64_t state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard, fr_dlist_head_t *to_free,
+				   time_t now, fr_state_entry_t *old)
 {
-	size_t			i;
-	uint32_t		x;
-	time_t			now = time(NULL);
-	fr_pair_t		*vp;
 	fr_state_entry_t	*entry, *next;
-
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
 	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
 
-	fr_dlist_init(&to_free, fr_state_entry_t, list);
-
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
+	for (entry = fr_dlist_head(&shard->to_expire);
 	     entry != NULL;
 	     entry = next) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
 
 		if (entry == old) continue;
 
@@ -321,7 +364,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		 */
 		if (entry->cleanup < now) {
 			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
+			fr_dlist_insert_tail(to_free, entry);
 			timed_out++;
 			continue;
 		}
@@ -329,9 +372,63 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		break;
 	}
 
-	state->timed_out += timed_out;
+	shard->timed_out += timed_out;
 
-	if (!old && (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions)) too_many = true;
+	return timed_out;
+}
+
+/** Free entries which have been unlinked from their shard
+ *
+ * We do it outside of the mutex as freeing may involve significantly
+ * more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed
+ * also, and it may have complex destructors associated with it.
+ */
+static inline void state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
+
+/** Create a new state entry
+ *
+ * @note Called with the mutex of old_shard held, if there is one.
+ *	It is released before the new entry is created.
+ * @note Returns with the mutex of the new entry's shard held.
+ *	If no entry is returned, no mutex is held.
+ */
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
+					    fr_pair_list_t *reply_list,
+					    fr_state_shard_t *old_shard, fr_state_entry_t *old)
+{
+	size_t			i;
+	uint32_t		x;
+	time_t			now = time(NULL);
+	fr_pair_t		*vp;
+	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
+
+	uint8_t			old_state[sizeof(old->state)];
+	int			old_tries = 0;
+	uint64_t		timed_out = 0;
+	bool			too_many = false;
+	fr_dlist_head_t		to_free;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
+	/*
+	 *	Clean up old entries.
+	 */
+	if (old_shard) timed_out = state_shard_expire(state, old_shard, &to_free, now, old);
+
+	if (!old && (atomic_load_explicit(&state->num_entries, memory_order_relaxed) >= state->max_sessions)) {
+		too_many = true;
+	}
 
 	/*
 	 *	Record the information from the old state, we may base the
@@ -353,24 +450,14 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 			fr_dlist_insert_tail(&to_free, old);
 		}
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (old_shard) PTHREAD_MUTEX_UNLOCK(&old_shard->mutex);
 
 	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
 
 	/*
 	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
 	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
+	state_entries_free(&to_free);
 
 	/*
 	 *	Have to do this post-cleanup, else we end up returning with
@@ -380,7 +467,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	if (too_many) {
 		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
 		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
 		return NULL;
 	}
 
@@ -389,14 +475,11 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 *	and would add significantly to contention.
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
-	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+	if (!entry) return NULL;
 
 	request_data_list_init(&entry->data);
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -483,8 +566,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -493,27 +574,53 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	if (!rbtree_insert(state->tree, entry)) {
+	entry->shard = shard = state_shard(state, entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	/*
+	 *	The old entry may have lived in a different
+	 *	shard, so clean up this one too.
+	 */
+	if (shard != old_shard) {
+		timed_out = state_shard_expire(state, shard, &to_free, now, NULL);
+		if (timed_out > 0) {
+			PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+			RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+			state_entries_free(&to_free);
+
+			PTHREAD_MUTEX_LOCK(&shard->mutex);
+		}
+	}
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		RERROR("Failed inserting state entry - Insertion into state tree failed");
 		fr_pair_delete_by_da(reply_list, state->da);
 		talloc_free(entry);
 		return NULL;
 	}
+	atomic_fetch_add_explicit(&state->num_entries, 1, memory_order_relaxed);
 
 	/*
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	fr_dlist_insert_tail(&shard->to_expire, entry);
 
 	return entry;
 }
 
 /** Find the entry, based on the State attribute
  *
+ * @note Returns with the mutex of the shard held, whether or not
+ *	an entry was found.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, request_t *request, fr_value_box_t const *vb)
+static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, fr_state_shard_t **shard_p,
+					  request_t *request, fr_value_box_t const *vb)
 {
+	fr_state_shard_t *shard;
 	fr_state_entry_t *entry, my_entry;
 
 	/*
@@ -543,7 +650,10 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, request_t *req
 	 */
 	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	*shard_p = shard = state_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = rbtree_finddata(shard->tree, &my_entry);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
@@ -556,19 +666,19 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, request_t *req
 void fr_state_discard(fr_state_tree_t *state, request_t *request)
 {
 	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 	fr_pair_t		*vp;
 
 	vp = fr_pair_find_by_da(&request->request_pairs, state->da);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	entry = state_entry_find(state, &shard, request, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		return;
 	}
 	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -606,6 +716,7 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 void fr_state_to_request(fr_state_tree_t *state, request_t *request)
 {
 	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 	TALLOC_CTX		*old_ctx = NULL;
 	fr_pair_t		*vp;
 
@@ -621,13 +732,12 @@ void fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	entry = state_entry_find(state, &shard, request, &vp->data);
 	if (entry) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);
 		if (entry->thawed) {
 			REDEBUG("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-			PTHREAD_MUTEX_UNLOCK(&state->mutex);
+			PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 			return;
 		}
 		if (request->state_ctx) old_ctx = request->state_ctx;	/* Store for later freeing */
@@ -643,7 +753,7 @@ void fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		entry->vps = NULL;
 		entry->thawed = request;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	if (request->state_pairs) {
 		RDEBUG2("Restored &session-state");
@@ -672,6 +782,7 @@ void fr_state_to_request(fr_state_tree_t *state, request_t *request)
 int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 {
 	fr_state_entry_t	*entry, *old = NULL;
+	fr_state_shard_t	*old_shard = NULL;
 	fr_dlist_head_t		data;
 	fr_pair_t		*vp;
 
@@ -687,12 +798,10 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 
 	vp = fr_pair_find_by_da(&request->request_pairs, state->da);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (vp) old = state_entry_find(state, request, &vp->data);
+	if (vp) old = state_entry_find(state, &old_shard, request, &vp->data);
 
-	entry = state_entry_create(state, request, &request->reply_pairs, old);
+	entry = state_entry_create(state, request, &request->reply_pairs, old_shard, old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
@@ -709,7 +818,7 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	request->state_ctx = NULL;
 	request->state_pairs = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&entry->shard->mutex);
 
 	RDEBUG3("%s - saved", state->da->name);
 	REQUEST_VERIFY(request);
@@ -850,7 +959,7 @@ void fr_state_detach(request_t *request, bool will_free)
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -858,7 +967,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	size_t		i;
+
+	for (i = 0; i < STATE_SHARDS; i++) timed_out += state->shards[i].timed_out;
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -866,5 +980,97 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	return atomic_load_explicit(&state->num_entries, memory_order_relaxed);
+}
+
+/** Return how much memory the entries are using
+ *
+ * Walks every entry, so this is for the occasional radmin query, not
+ * for anything in the request path.  Each shard is locked in turn, so
+ * the total is only a snapshot.
+ *
+ * @param[in] state	tree to examine.
+ * @param[out] blocks	number of talloc chunks.  May be NULL.
+ * @return the number of bytes allocated for the entries, their
+ *	session-state, and their persistable request data.
+ */
+size_t fr_state_entries_memory(fr_state_tree_t *state, size_t *blocks)
+{
+	size_t	size = 0, num = 0;
+	size_t	i;
+
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_shard_t	*shard = &state->shards[i];
+		fr_state_entry_t	*entry = NULL;
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		while ((entry = fr_dlist_next(&shard->to_expire, entry))) {
+			size += talloc_total_size(entry);
+			num += talloc_total_blocks(entry);
+
+			/*
+			 *	The session-state ctx isn't parented by
+			 *	the entry.  It's NULL if a request has the
+			 *	entry thawed.
+			 */
+			if (entry->ctx) {
+				size += talloc_total_size(entry->ctx);
+				num += talloc_total_blocks(entry->ctx);
+			}
+		}
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	if (blocks) *blocks = num;
+
+	return size;
+}
+
+static int cmd_stats_state(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_state_tree_t	*state = talloc_get_type_abort(ctx, fr_state_tree_t);
+	size_t		size, blocks;
+
+	size = fr_state_entries_memory(state, &blocks);
+
+	fprintf(fp, "entries.created		%" PRIu64 "\n", fr_state_entries_created(state));
+	fprintf(fp, "entries.timeout		%" PRIu64 "\n", fr_state_entries_timeout(state));
+	fprintf(fp, "entries.tracked		%u\n", fr_state_entries_tracked(state));
+	fprintf(fp, "memory.size		%zu\n", size);
+	fprintf(fp, "memory.blocks		%zu\n", blocks);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_state_table[] = {
+	{
+		.parent = "stats",
+		.name = "state",
+		.help = "Statistics for session-state trees.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats state",
+		.add_name = true,
+		.name = "self",
+		.func = cmd_stats_state,
+		.help = "Show entry counts and memory used by a session-state tree.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Register radmin commands for a state tree
+ *
+ * @param[in] state	to register commands for.
+ * @param[in] name	of the tree, as used in "stats state <name>".
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_state_tree_cmd_register(fr_state_tree_t *state, char const *name)
+{
+	return fr_command_register_hook(NULL, name, state, cmd_state_table);
 }
@@ -1426,6 +1426,53 @@ int tmpl_find_vp(fr_pair_t **out, request_t *request, tmpl_t const *vpt)
 
 	TMPL_VERIFY(vpt);
 
+	/*
+	 *	Most references are to the first instance of a
+	 *	top level attribute, e.g. &User-Name.  The
+	 *	tokenizer has already resolved the request, list
+	 *	and attribute, so we can skip the cursor machinery,
+	 *	and just walk the list.
+	 */
+	if (tmpl_is_attr(vpt) && (fr_dlist_num_elements(&vpt->data.attribute.ar) == 1)) {
+		tmpl_attr_t const	*ar = fr_dlist_head(&vpt->data.attribute.ar);
+		tmpl_request_t		*rr = NULL;
+		fr_pair_list_t		*list_head;
+
+		switch (ar->ar_num) {
+		case NUM_ANY:
+		case NUM_ALL:
+		case NUM_COUNT:
+			while ((rr = fr_dlist_next(&vpt->data.attribute.rr, rr))) {
+				if (tmpl_request_ptr(&request, rr->request) < 0) {
+					fr_strerror_printf("Request context \"%s\" not available",
+							   fr_table_str_by_value(tmpl_request_ref_table,
+										 rr->request, "<INVALID>"));
+					if (out) *out = NULL;
+					return -3;
+				}
+			}
+
+			list_head = tmpl_list_head(request, tmpl_list(vpt));
+			if (!list_head) {
+				fr_strerror_printf("List \"%s\" not available in this context",
+						   fr_table_str_by_value(pair_list_table, tmpl_list(vpt), "<INVALID>"));
+				if (out) *out = NULL;
+				return -2;
+			}
+
+			for (vp = *list_head; vp; vp = vp->next) if (fr_dict_attr_cmp(ar->ar_da, vp->da) == 0) break;
+			if (out) *out = vp;
+			if (!vp) {
+				fr_strerror_printf("No matching \"%s\" pairs found", ar->ar_da->name);
+				return -1;
+			}
+			return 0;
+
+		default:
+			break;
+		}
+	}
+
 	vp = tmpl_cursor_init(&err, request, &cc, &cursor, request, vpt);
 	tmpl_cursor_clear(&cc);
 
@@ -31,6 +31,12 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /*
  *	Public "thunk" API so that the various binaries can link to
  *	libfreeradius-server.a, and don't need to be linked to libfreeradius-io.a
@@ -43,17 +49,38 @@ fr_trigger_worker_t trigger_worker_request_add = NULL;
 static bool			triggers_init;
 static CONF_SECTION const	*trigger_exec_main, *trigger_exec_subcs;
 static rbtree_t			*trigger_last_fired_tree;
-static pthread_mutex_t		*trigger_mutex;
+
+/** How many triggers are waiting to run, or running
+ *
+ */
+static atomic_uint_fast32_t	trigger_queued;
 
 #define REQUEST_INDEX_TRIGGER_NAME	1
 #define REQUEST_INDEX_TRIGGER_ARGS	2
 
+/** Rate limited triggers fire at most once in this window
+ *
+ */
+#define TRIGGER_RATE_LIMIT_WINDOW	fr_time_delta_from_sec(1)
+
+/** Maximum number of triggers waiting to run
+ *
+ * During an outage, every connection attempt may fire a trigger.  Past
+ * this limit they're dropped, rather than forking a program for each one.
+ */
+#define TRIGGER_MAX_QUEUED		(64)
+
 /** Describes a rate limiting entry for a trigger
  *
+ * One is created for every trigger in the configuration when triggers
+ * are initialised.  The tree is never modified after that, so workers
+ * can search it without locking, and the fields are only updated
+ * atomically.
  */
 typedef struct {
-	CONF_ITEM	*ci;		//!< Config item this rate limit counter is associated with.
-	time_t		last_fired;	//!< When this trigger last fired.
+	CONF_ITEM const		*ci;		//!< Config item this rate limit counter is associated with.
+	atomic_int_fast64_t	last_fired;	//!< When this trigger last fired.
+	atomic_uint_fast32_t	suppressed;	//!< How many times it was suppressed since then.
 } trigger_last_fired_t;
 
 /** Retrieve attributes from a special trigger list
@@ -100,12 +127,6 @@ ssize_t trigger_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
 	return fr_value_box_aprint(request, out, &vp->data, NULL);
 }
 
-static int _mutex_free(pthread_mutex_t *mutex)
-{
-	pthread_mutex_destroy(mutex);
-	return 0;
-}
-
 static void _trigger_last_fired_free(void *data)
 {
 	talloc_free(data);
@@ -127,6 +148,35 @@ static int _trigger_last_fired_cmp(void const *a, void const *b)
 	return (lf_a->ci < lf_b->ci) - (lf_a->ci > lf_b->ci);
 }
 
+/** Create rate limiting entries for every trigger in a section
+ *
+ * @param[in] cs		to search.
+ * @param[in] in_trigger	whether cs is in a "trigger" section.
+ */
+static void trigger_last_fired_add(CONF_SECTION const *cs, bool in_trigger)
+{
+	CONF_ITEM		*ci = NULL;
+	trigger_last_fired_t	*found;
+
+	while ((ci = cf_item_next(cs, ci))) {
+		if (cf_item_is_section(ci)) {
+			CONF_SECTION *subcs = cf_item_to_section(ci);
+
+			trigger_last_fired_add(subcs, in_trigger || (strcmp(cf_section_name1(subcs), "trigger") == 0));
+			continue;
+		}
+
+		if (!in_trigger || !cf_item_is_pair(ci)) continue;
+
+		MEM(found = talloc(NULL, trigger_last_fired_t));
+		found->ci = ci;
+		atomic_init(&found->last_fired, 0);
+		atomic_init(&found->suppressed, 0);
+
+		if (!rbtree_insert(trigger_last_fired_tree, found)) talloc_free(found);
+	}
+}
+
 /** Set the global trigger section trigger_exec will search in, and register xlats
  *
  * This function exists because triggers are used by the connection pool, which
@@ -160,9 +210,12 @@ int trigger_exec_init(CONF_SECTION const *cs)
 							   _trigger_last_fired_cmp, trigger_last_fired_t,
 							   _trigger_last_fired_free, 0));
 
-	trigger_mutex = talloc(talloc_null_ctx(), pthread_mutex_t);
-	pthread_mutex_init(trigger_mutex, 0);
-	talloc_set_destructor(trigger_mutex, _mutex_free);
+	/*
+	 *	The whole configuration has been read by now, so
+	 *	we know every trigger which can fire.
+	 */
+	trigger_last_fired_add(cs, false);
+	atomic_init(&trigger_queued, 0);
 
 	triggers_init = true;
 
@@ -175,7 +228,6 @@ int trigger_exec_init(CONF_SECTION const *cs)
 void trigger_exec_free(void)
 {
 	TALLOC_FREE(trigger_last_fired_tree);
-	TALLOC_FREE(trigger_mutex);
 }
 
 /** Return whether triggers are enabled
@@ -194,6 +246,16 @@ typedef struct {
 	bool		expanded;
 } fr_trigger_t;
 
+/** Decrement the count of queued triggers when one is done
+ *
+ */
+static int _trigger_free(UNUSED fr_trigger_t *ctx)
+{
+	atomic_fetch_sub_explicit(&trigger_queued, 1, memory_order_relaxed);
+
+	return 0;
+}
+
 static unlang_action_t trigger_process(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	fr_trigger_t	*ctx = talloc_get_type_abort(mctx->instance, fr_trigger_t);
@@ -278,9 +340,10 @@ int trigger_exec(request_t *request, CONF_SECTION const *cs, char const *name, b
 	char const		*attr;
 	char const		*value;
 
-	request_t			*fake;
+	request_t		*fake;
 	fr_trigger_t		*ctx;
 	ssize_t			slen;
+	uint_fast32_t		suppressed = 0;
 
 	/*
 	 *	noop if trigger_exec_init was never called
@@ -349,28 +412,36 @@ int trigger_exec(request_t *request, CONF_SECTION const *cs, char const *name, b
 	 */
 	if (rate_limit) {
 		trigger_last_fired_t	find, *found;
-		time_t			now = time(NULL);
 
 		find.ci = ci;
 
-		pthread_mutex_lock(trigger_mutex);
-
 		found = rbtree_finddata(trigger_last_fired_tree, &find);
-		if (!found) {
-			MEM(found = talloc(NULL, trigger_last_fired_t));
-			found->ci = ci;
-			found->last_fired = 0;
-
-			rbtree_insert(trigger_last_fired_tree, found);
+		if (found) {
+			fr_time_t	now = fr_time();
+			int_fast64_t	last = atomic_load_explicit(&found->last_fired, memory_order_relaxed);
+
+			/*
+			 *	Send the rate_limited traps at most once
+			 *	per window.  If another thread fires it
+			 *	first, it counts as suppressed here.
+			 */
+			if (((now - last) < TRIGGER_RATE_LIMIT_WINDOW) ||
+			    !atomic_compare_exchange_strong(&found->last_fired, &last, now)) {
+				atomic_fetch_add_explicit(&found->suppressed, 1, memory_order_relaxed);
+				return -1;
+			}
+
+			suppressed = atomic_exchange(&found->suppressed, 0);
 		}
+	}
 
-		pthread_mutex_unlock(trigger_mutex);
-
-		/*
-		 *	Send the rate_limited traps at most once per second.
-		 */
-		if (found->last_fired == now) return -1;
-		found->last_fired = now;
+	/*
+	 *	Don't queue an unbounded number of programs.
+	 */
+	if (atomic_fetch_add_explicit(&trigger_queued, 1, memory_order_relaxed) >= TRIGGER_MAX_QUEUED) {
+		atomic_fetch_sub_explicit(&trigger_queued, 1, memory_order_relaxed);
+		RATE_LIMIT_GLOBAL_ROPTIONAL(RWARN, WARN, "Too many triggers queued, dropping %s", name);
+		return -1;
 	}
 
 	/*
@@ -386,6 +457,7 @@ int trigger_exec(request_t *request, CONF_SECTION const *cs, char const *name, b
 	if (args && (request_data_add(fake, &trigger_exec_main, REQUEST_INDEX_TRIGGER_ARGS, args,
 				      false, false, false) < 0)) {
 		talloc_free(fake);
+		atomic_fetch_sub_explicit(&trigger_queued, 1, memory_order_relaxed);
 		return -1;
 	}
 
@@ -397,14 +469,21 @@ int trigger_exec(request_t *request, CONF_SECTION const *cs, char const *name, b
 		if (request_data_add(fake, &trigger_exec_main, REQUEST_INDEX_TRIGGER_NAME,
 				     name_tmp, false, false, false) < 0) {
 			talloc_free(fake);
+			atomic_fetch_sub_explicit(&trigger_queued, 1, memory_order_relaxed);
 			return -1;
 		}
 	}
 
 	MEM(ctx = talloc_zero(fake, fr_trigger_t));
+	talloc_set_destructor(ctx, _trigger_free);
 	fr_pair_list_init(&ctx->vps);
 	ctx->name = talloc_strdup(ctx, value);
 
+	if (suppressed) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Trigger %s was suppressed %" PRIuFAST32 " time(s) since it last fired",
+			  name, suppressed);
+	}
+
 	if (request) {
 		if (request->request_pairs) {
 			(void) fr_pair_list_copy(ctx, &ctx->vps, &request->request_pairs);
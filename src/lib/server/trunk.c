@@ -41,6 +41,7 @@ typedef struct fr_trunk_s fr_trunk_t;
 #include <freeradius-devel/server/trigger.h>
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/probe.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/table.h>
 
@@ -111,6 +112,9 @@ struct fr_trunk_request_s {
 
 	fr_time_t		last_freed;		//!< Last time this request was freed.
 
+	fr_time_t		last_sent;		//!< Last time this request was sent.  Only set if
+							///< the trunk is latency_aware.
+
 	bool			bound_to_conn;		//!< Fail the request if there's an attempt to
 							///< re-enqueue it.
 
@@ -299,6 +303,8 @@ CONF_PARSER const fr_trunk_config[] = {
 
 	{ FR_CONF_OFFSET("manage_interval", FR_TYPE_TIME_DELTA, fr_trunk_conf_t, manage_interval), .dflt = "0.2" },
 
+	{ FR_CONF_OFFSET("latency_aware", FR_TYPE_BOOL, fr_trunk_conf_t, latency_aware), .dflt = "no" },
+
 	{ FR_CONF_OFFSET("connection", FR_TYPE_SUBSECTION, fr_trunk_conf_t, conn_conf), .subcs = (void const *) fr_trunk_config_connection, .subcs_size = sizeof(fr_trunk_config_connection) },
 	{ FR_CONF_POINTER("request", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) fr_trunk_config_request },
 
@@ -1055,6 +1061,8 @@ static void trunk_request_enter_sent(fr_trunk_request_t *treq)
 	 *	Update the connection's sent stats
 	 */
 	tconn->sent_count++;
+	trunk->pub.req_sent++;
+	if (trunk->conf.latency_aware) treq->last_sent = fr_time();
 
 	/*
 	 *	Enforces max_uses
@@ -1263,8 +1271,26 @@ static void trunk_request_enter_complete(fr_trunk_request_t *treq)
 
 	if (!fr_cond_assert(!tconn || (tconn->pub.trunk == trunk))) return;
 
+	FR_PROBE2(trunk_complete, treq, treq->pub.request);
+
 	switch (treq->pub.state) {
 	case FR_TRUNK_REQUEST_STATE_SENT:
+		/*
+		 *	Update the average before the request is
+		 *	removed, so the connection is reordered
+		 *	using the new value.
+		 */
+		if (treq->last_sent) {
+			fr_time_delta_t rtt = fr_time() - treq->last_sent;
+
+			if (!tconn->pub.rtt_avg) {
+				tconn->pub.rtt_avg = rtt;
+			} else {
+				tconn->pub.rtt_avg += (rtt - tconn->pub.rtt_avg) / 8;
+			}
+		}
+		FALL_THROUGH;
+
 	case FR_TRUNK_REQUEST_STATE_PENDING:
 		trunk_request_remove_from_conn(treq);
 		break;
@@ -1806,7 +1832,7 @@ void fr_trunk_request_signal_complete(fr_trunk_request_t *treq)
 	 *	then we need to add an argument to signal_complete
 	 *	to indicate if this is a successful read.
 	 */
-	if (IN_REQUEST_DEMUX(trunk)) trunk->pub.last_read_success = fr_time();
+	if (IN_REQUEST_DEMUX(trunk)) trunk->pub.last_read_success = fr_event_list_time(trunk->el);
 
 	switch (treq->pub.state) {
 	case FR_TRUNK_REQUEST_STATE_SENT:
@@ -2245,6 +2271,13 @@ fr_trunk_request_t *fr_trunk_request_alloc(fr_trunk_t *trunk, request_t *request
  * and signal what state they should enter next using one of the
  * fr_trunk_request_signal_* functions.
  *
+ * @note Identical requests are not coalesced.  Each treq has exactly one
+ *	request and rctx, which the #fr_trunk_request_complete_t callback
+ *	writes its result into.  Only the API client knows how to copy a
+ *	result into another rctx, and whether two preqs are identical.  An
+ *	API client which wants to collapse duplicate queries should keep its
+ *	own table of in-flight queries, and only enqueue the first.
+ *
  * @param[in,out] treq_out	A trunk request handle.  If the memory pointed to
  *				is NULL, a new treq will be allocated.
  *				Otherwise treq should point to memory allocated
@@ -2332,6 +2365,8 @@ fr_trunk_enqueue_t fr_trunk_request_enqueue(fr_trunk_request_t **treq_out, fr_tr
 		return ret;
 	}
 
+	FR_PROBE2(trunk_enqueue, *treq_out, request);
+
 	return ret;
 }
 
@@ -2649,6 +2684,13 @@ static inline void trunk_connection_writable(fr_trunk_connection_t *tconn)
 	if (!fr_trunk_request_count_by_connection(tconn,
 						  FR_TRUNK_REQUEST_STATE_PENDING |
 						  FR_TRUNK_REQUEST_STATE_PARTIAL)) return;
+
+	/*
+	 *	The mux callback is expected to write as many
+	 *	pending requests as the connection will take,
+	 *	so one call is one batch.
+	 */
+	trunk->pub.req_mux_calls++;
 	DO_REQUEST_MUX(tconn);
 }
 
@@ -3919,6 +3961,7 @@ static void trunk_manage(fr_trunk_t *trunk, fr_time_t now)
 			} else {
 				trunk_connection_enter_active(tconn);
 			}
+			trunk->pub.conn_scale_up++;
 			return;
 		}
 
@@ -3937,7 +3980,7 @@ static void trunk_manage(fr_trunk_t *trunk, fr_time_t now)
 		DEBUG3("Opening connection - Above target requests per connection (now %u, target %u)",
 		       ROUND_UP_DIV(req_count, conn_count), trunk->conf.target_req_per_conn);
 		/* last_open set by trunk_connection_spawn */
-		(void)trunk_connection_spawn(trunk, now);
+		if (trunk_connection_spawn(trunk, now) == 0) trunk->pub.conn_scale_up++;
 	}
 
 	/*
@@ -4051,7 +4094,7 @@ static void trunk_manage(fr_trunk_t *trunk, fr_time_t now)
 		}
 
 		trunk->pub.last_closed = now;
-
+		trunk->pub.conn_scale_down++;
 
 		return;
 	}
@@ -4410,6 +4453,31 @@ static int8_t _trunk_connection_order_by_shortest_queue(void const *one, void co
 	return 0;
 }
 
+/** Order connections by expected completion time
+ *
+ * A new request has to wait for the requests already on the connection,
+ * so its expected completion time is the number of requests (including
+ * itself) multiplied by the average response time.  Connections with no
+ * response times yet sort first, so they get sampled.
+ */
+static int8_t _trunk_connection_order_by_latency(void const *one, void const *two)
+{
+	fr_trunk_connection_t	const *a = talloc_get_type_abort_const(one, fr_trunk_connection_t);
+	fr_trunk_connection_t	const *b = talloc_get_type_abort_const(two, fr_trunk_connection_t);
+	uint64_t		a_count, b_count, a_cost, b_cost;
+
+	a_count = fr_trunk_request_count_by_connection(a, FR_TRUNK_REQUEST_STATE_ALL);
+	b_count = fr_trunk_request_count_by_connection(b, FR_TRUNK_REQUEST_STATE_ALL);
+
+	a_cost = (a_count + 1) * (uint64_t) a->pub.rtt_avg;
+	b_cost = (b_count + 1) * (uint64_t) b->pub.rtt_avg;
+
+	if (a_cost > b_cost) return +1;
+	if (a_cost < b_cost) return -1;
+
+	return STABLE_COMPARE(a_count, b_count);
+}
+
 /** Free a trunk, gracefully closing all connections.
  *
  */
@@ -4505,7 +4573,8 @@ fr_trunk_t *fr_trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
 
 	memcpy(&trunk->funcs, funcs, sizeof(trunk->funcs));
 	if (!trunk->funcs.connection_prioritise) {
-		trunk->funcs.connection_prioritise = _trunk_connection_order_by_shortest_queue;
+		trunk->funcs.connection_prioritise = conf->latency_aware ? _trunk_connection_order_by_latency :
+									   _trunk_connection_order_by_shortest_queue;
 	}
 	if (!trunk->funcs.request_prioritise) trunk->funcs.request_prioritise = fr_pointer_cmp;
 
@@ -246,6 +246,12 @@ typedef struct {
 	bool			backlog_on_failed_conn;	//!< Assign requests to the backlog when there are no
 							//!< available connections and the last connection event
 							//!< was a failure, instead of failing them immediately.
+
+	bool			latency_aware;		//!< Assign new requests to the connection with the
+							///< lowest expected completion time, based on its
+							///< response times, instead of the shortest queue.
+							///< Ignored if the API client provides its own
+							///< connection_prioritise function.
 } fr_trunk_conf_t;
 
 /** Public fields for the trunk
@@ -289,6 +295,21 @@ struct fr_trunk_pub_s {
 	uint64_t _CONST		req_alloc_new;		//!< How many requests we've allocated.
 
 	uint64_t _CONST		req_alloc_reused;	//!< How many requests were reused.
+
+	uint64_t _CONST		req_sent;		//!< How many requests have been sent.
+
+	uint64_t _CONST		req_mux_calls;		//!< How many times the request_mux callback
+							///< was called.  req_sent / req_mux_calls
+							///< gives the average number of requests
+							///< written per batch.
+
+	uint64_t _CONST		conn_scale_up;		//!< How many times the connection management
+							///< function opened or reactivated a connection
+							///< because utilisation was above target.
+
+	uint64_t _CONST		conn_scale_down;	//!< How many times the connection management
+							///< function closed or drained a connection
+							///< because utilisation was below target.
 	/** @} */
 
 	bool _CONST		triggers;		//!< do we run the triggers?
@@ -330,6 +351,10 @@ struct fr_trunk_connection_pub_s {
 	fr_connection_t		* _CONST conn;		//!< The underlying connection.
 
 	fr_trunk_t		* _CONST trunk;		//!< Trunk this connection belongs to.
+
+	fr_time_delta_t		_CONST rtt_avg;		//!< Moving average of the time between sending a
+							///< request and it completing.  Only tracked if
+							///< the trunk is latency_aware.
 };
 
 /** Config parser definitions to populate a fr_trunk_conf_t
@@ -424,6 +449,13 @@ typedef void (*fr_trunk_connection_notify_t)(fr_trunk_connection_t *tconn, fr_co
  *   This tracking structure will be used later in the trunk demux callback to match
  *   protocol requests with protocol responses.
  *
+ * Where the underlying transport allows it, the callback should pop as many
+ * requests as it can before writing, and write them with a single system call
+ * (sendmmsg, writev, or a pipelined command buffer).  Requests which arrive
+ * while a connection isn't writable accumulate in the pending queue, so batches
+ * grow naturally with load, and no additional latency is added when lightly loaded.
+ * See rlm_radius_udp and the redis pipeline code for examples.
+ *
  * If working at the socket level and a write on a file descriptor indicates
  * less data was written than was needed, the trunk API client should track the
  * amount of data written in the protocol request (preq), and should call
@@ -1677,6 +1677,10 @@ static void test_connection_levels_alternating_edges(void)
 	TEST_CASE("C0, R0");
 	TEST_CHECK(fr_trunk_connection_count_by_state(trunk, FR_TRUNK_CONN_ACTIVE) == 0);
 
+	TEST_CASE("Scaling decisions recorded");
+	TEST_CHECK(trunk->pub.conn_scale_up >= 1);
+	TEST_CHECK(trunk->pub.conn_scale_down >= 1);
+
 	TEST_CHECK(stats.completed == 3);
 	TEST_CHECK(stats.failed == 0);
 	TEST_CHECK(stats.cancelled == 0);
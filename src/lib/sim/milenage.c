@@ -29,14 +29,30 @@
 #define MILENAGE_MAC_A_SIZE	8
 #define MILENAGE_MAC_S_SIZE	8
 
-static inline int aes_128_encrypt_block(EVP_CIPHER_CTX *evp_ctx,
-					uint8_t const key[16], uint8_t const in[16], uint8_t out[16])
+/** Allocate an AES-128-ECB context, keyed with the subscriber key
+ *
+ * The key schedule is only computed once, and reused for all the blocks
+ * we encrypt for a given set of Milenage functions.
+ *
+ * @param[in] k		128-bit subscriber key.
+ * @return
+ *	- A new EVP context.  Must be freed with EVP_CIPHER_CTX_free.
+ *	- NULL on failure.
+ */
+static EVP_CIPHER_CTX *aes_128_ctx_alloc(uint8_t const k[MILENAGE_KI_SIZE])
 {
-	size_t len;
+	EVP_CIPHER_CTX *evp_ctx;
+
+	evp_ctx = EVP_CIPHER_CTX_new();
+	if (!evp_ctx) {
+		tls_strerror_printf("Failed allocating EVP context");
+		return NULL;
+	}
 
-	if (unlikely(EVP_EncryptInit_ex(evp_ctx, EVP_aes_128_ecb(), NULL, key, NULL) != 1)) {
+	if (unlikely(EVP_EncryptInit_ex(evp_ctx, EVP_aes_128_ecb(), NULL, k, NULL) != 1)) {
 		tls_strerror_printf("Failed initialising AES-128-ECB context");
-		return -1;
+		EVP_CIPHER_CTX_free(evp_ctx);
+		return NULL;
 	}
 
 	/*
@@ -50,184 +66,215 @@ static inline int aes_128_encrypt_block(EVP_CIPHER_CTX *evp_ctx,
 	 *	when decrypting.
 	 */
 	EVP_CIPHER_CTX_set_padding(evp_ctx, 0);
-	if (unlikely(EVP_EncryptUpdate(evp_ctx, out, (int *)&len, in, 16) != 1) ||
-	    unlikely(EVP_EncryptFinal_ex(evp_ctx, out + len, (int *)&len) != 1)) {
-		tls_strerror_printf("Failed encrypting data");
-		return -1;
-	}
 
-	return 0;
+	return evp_ctx;
 }
 
-/** milenage_f1 - Milenage f1 and f1* algorithms
+/** Encrypt one or more independent 16 byte blocks
  *
- * @param[in] opc	128-bit value derived from OP and K.
- * @param[in] k		128-bit subscriber key.
- * @param[in] rand	128-bit random challenge.
- * @param[in] sqn	48-bit sequence number.
- * @param[in] amf	16-bit authentication management field.
- * @param[out] mac_a	Buffer for MAC-A = 64-bit network authentication code, or NULL
- * @param[out] mac_s	Buffer for MAC-S = 64-bit resync authentication code, or NULL
+ * ECB mode blocks don't depend on each other, so passing them to OpenSSL
+ * in a single call lets AES-NI (and similar) implementations pipeline them.
+ *
+ * @param[in] evp_ctx	Keyed AES-128-ECB context.
+ * @param[in] in	num * 16 bytes of plaintext.
+ * @param[out] out	num * 16 bytes of ciphertext.  May be the same as in.
+ * @param[in] num	Number of blocks.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-static int milenage_f1(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
-		       uint8_t mac_s[MILENAGE_MAC_S_SIZE],
-		       uint8_t const opc[MILENAGE_OPC_SIZE],
-		       uint8_t const k[MILENAGE_KI_SIZE],
-		       uint8_t const rand[MILENAGE_RAND_SIZE],
-		       uint8_t const sqn[MILENAGE_SQN_SIZE],
-		       uint8_t const amf[MILENAGE_AMF_SIZE])
+static inline int aes_128_encrypt_blocks(EVP_CIPHER_CTX *evp_ctx, uint8_t const *in, uint8_t *out, size_t num)
 {
-	uint8_t		tmp1[16], tmp2[16], tmp3[16];
-	int		i;
-	EVP_CIPHER_CTX	*evp_ctx;
+	int len;
 
-	/* tmp1 = TEMP = E_K(RAND XOR OP_C) */
-	for (i = 0; i < 16; i++) tmp1[i] = rand[i] ^ opc[i];
-
-	evp_ctx = EVP_CIPHER_CTX_new();
-	if (!evp_ctx) {
-		tls_strerror_printf("Failed allocating EVP context");
+	if (unlikely(EVP_EncryptUpdate(evp_ctx, out, &len, in, num * 16) != 1) || unlikely((size_t)len != (num * 16))) {
+		tls_strerror_printf("Failed encrypting data");
 		return -1;
 	}
 
- 	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp1) < 0) {
- 	error:
-		EVP_CIPHER_CTX_free(evp_ctx);
-		return -1;
- 	}
-
-	/* tmp2 = IN1 = SQN || AMF || SQN || AMF */
-	memcpy(tmp2, sqn, 6);
-	memcpy(tmp2 + 6, amf, 2);
-	memcpy(tmp2 + 8, tmp2, 8);
-
-	/* OUT1 = E_K(TEMP XOR rot(IN1 XOR OP_C, r1) XOR c1) XOR OP_C */
-
-	/*
-	 *  rotate (tmp2 XOR OP_C) by r1 (= 0x40 = 8 bytes)
-	 */
-	for (i = 0; i < 16; i++) tmp3[(i + 8) % 16] = tmp2[i] ^ opc[i];
-
-	/*
-	 *  XOR with TEMP = E_K(RAND XOR OP_C)
-	 */
-	for (i = 0; i < 16; i++) tmp3[i] ^= tmp1[i];
-	/* XOR with c1 (= ..00, i.e., NOP) */
-
-	/*
-	 *	f1 || f1* = E_K(tmp3) XOR OP_c
-	 */
- 	if (aes_128_encrypt_block(evp_ctx, k, tmp3, tmp1) < 0) goto error; /* Reuses existing key */
-
-	for (i = 0; i < 16; i++) tmp1[i] ^= opc[i];
-
-	if (mac_a) memcpy(mac_a, tmp1, 8);	/* f1 */
-	if (mac_s) memcpy(mac_s, tmp1 + 8, 8);	/* f1* */
-
-	EVP_CIPHER_CTX_free(evp_ctx);
-
 	return 0;
 }
 
-/** milenage_f2345 - Milenage f2, f3, f4, f5, f5* algorithms
+/** milenage_f12345 - Milenage f1, f1*, f2, f3, f4, f5 and f5* algorithms
  *
+ * All the functions share the same intermediate value TEMP, and their final
+ * encryptions are independent of each other.  We compute TEMP once, then
+ * encrypt the inputs to every requested function in a single batch.
+ *
+ * @param[out] mac_a		Buffer for MAC-A = 64-bit network authentication code (f1), or NULL
+ * @param[out] mac_s		Buffer for MAC-S = 64-bit resync authentication code (f1*), or NULL
  * @param[out] res		Buffer for RES = 64-bit signed response (f2), or NULL
- * @param[out] ck		Buffer for CK = 128-bit confidentiality key (f3), or NULL
  * @param[out] ik		Buffer for IK = 128-bit integrity key (f4), or NULL
+ * @param[out] ck		Buffer for CK = 128-bit confidentiality key (f3), or NULL
  * @param[out] ak		Buffer for AK = 48-bit anonymity key (f5), or NULL
  * @param[out] ak_resync	Buffer for AK = 48-bit anonymity key (f5*), or NULL
  * @param[in] opc		128-bit value derived from OP and K.
- * @param[in] k			128-bit subscriber key
- * @param[in] rand		128-bit random challenge
+ * @param[in] k			128-bit subscriber key.
+ * @param[in] rand		128-bit random challenge.
+ * @param[in] sqn		48-bit sequence number.  Only required for f1 and f1*.
+ * @param[in] amf		16-bit authentication management field.  Only required for f1 and f1*.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-static int milenage_f2345(uint8_t res[MILENAGE_RES_SIZE],
-			  uint8_t ik[MILENAGE_IK_SIZE],
-			  uint8_t ck[MILENAGE_CK_SIZE],
-			  uint8_t ak[MILENAGE_AK_SIZE],
-			  uint8_t ak_resync[MILENAGE_AK_SIZE],
-			  uint8_t const opc[MILENAGE_OPC_SIZE],
-			  uint8_t const k[MILENAGE_KI_SIZE],
-			  uint8_t const rand[MILENAGE_RAND_SIZE])
+static int milenage_f12345(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
+			   uint8_t mac_s[MILENAGE_MAC_S_SIZE],
+			   uint8_t res[MILENAGE_RES_SIZE],
+			   uint8_t ik[MILENAGE_IK_SIZE],
+			   uint8_t ck[MILENAGE_CK_SIZE],
+			   uint8_t ak[MILENAGE_AK_SIZE],
+			   uint8_t ak_resync[MILENAGE_AK_SIZE],
+			   uint8_t const opc[MILENAGE_OPC_SIZE],
+			   uint8_t const k[MILENAGE_KI_SIZE],
+			   uint8_t const rand[MILENAGE_RAND_SIZE],
+			   uint8_t const sqn[MILENAGE_SQN_SIZE],
+			   uint8_t const amf[MILENAGE_AMF_SIZE])
 {
-	uint8_t			tmp1[16], tmp2[16], tmp3[16];
-	int			i;
-	EVP_CIPHER_CTX		*evp_ctx;
-
-	/* tmp2 = TEMP = E_K(RAND XOR OP_C) */
-	for (i = 0; i < 16; i++) tmp1[i] = rand[i] ^ opc[i];
+	uint8_t		temp[16], in1[16];
+	uint8_t		blocks[5][16];
+	uint8_t		*f1 = NULL, *f25 = NULL, *f3 = NULL, *f4 = NULL, *f5s = NULL;
+	size_t		num = 0;
+	int		i;
+	EVP_CIPHER_CTX	*evp_ctx;
 
-	evp_ctx = EVP_CIPHER_CTX_new();
-	if (!evp_ctx) {
-		tls_strerror_printf("Failed allocating EVP context");
-		return -1;
-	}
+	evp_ctx = aes_128_ctx_alloc(k);
+	if (!evp_ctx) return -1;
 
-	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp2) < 0) {
+	/* temp = TEMP = E_K(RAND XOR OP_C) */
+	for (i = 0; i < 16; i++) temp[i] = rand[i] ^ opc[i];
+	if (aes_128_encrypt_blocks(evp_ctx, temp, temp, 1) < 0) {
 	error:
 		EVP_CIPHER_CTX_free(evp_ctx);
 		return -1;
 	}
 
-	/* OUT2 = E_K(rot(TEMP XOR OP_C, r2) XOR c2) XOR OP_C */
-	/* OUT3 = E_K(rot(TEMP XOR OP_C, r3) XOR c3) XOR OP_C */
-	/* OUT4 = E_K(rot(TEMP XOR OP_C, r4) XOR c4) XOR OP_C */
-	/* OUT5 = E_K(rot(TEMP XOR OP_C, r5) XOR c5) XOR OP_C */
+	/* OUT1 = E_K(TEMP XOR rot(IN1 XOR OP_C, r1) XOR c1) XOR OP_C */
+	if (mac_a || mac_s) {
+		f1 = blocks[num++];
+
+		/* in1 = IN1 = SQN || AMF || SQN || AMF */
+		memcpy(in1, sqn, 6);
+		memcpy(in1 + 6, amf, 2);
+		memcpy(in1 + 8, in1, 8);
 
-	/* f2 and f5 */
-	/* rotate by r2 (= 0, i.e., NOP) */
-	for (i = 0; i < 16; i++) tmp1[i] = tmp2[i] ^ opc[i];
-	tmp1[15] ^= 1; /* XOR c2 (= ..01) */
-	/* f5 || f2 = E_K(tmp1) XOR OP_c */
+		/* rotate (IN1 XOR OP_C) by r1 (= 0x40 = 8 bytes) */
+		for (i = 0; i < 16; i++) f1[(i + 8) % 16] = in1[i] ^ opc[i];
 
-	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp3) < 0) goto error;
+		/* XOR with TEMP, then c1 (= ..00, i.e., NOP) */
+		for (i = 0; i < 16; i++) f1[i] ^= temp[i];
+	}
 
-	for (i = 0; i < 16; i++) tmp3[i] ^= opc[i];
-	if (res) memcpy(res, tmp3 + 8, 8); /* f2 */
-	if (ak) memcpy(ak, tmp3, 6); /* f5 */
+	/* OUT2 = E_K(rot(TEMP XOR OP_C, r2) XOR c2) XOR OP_C */
+	if (res || ak) {
+		f25 = blocks[num++];
 
-	/* f3 */
-	if (ck) {
-		/* rotate by r3 = 0x20 = 4 bytes */
-		for (i = 0; i < 16; i++) tmp1[(i + 12) % 16] = tmp2[i] ^ opc[i];
-		tmp1[15] ^= 2; /* XOR c3 (= ..02) */
+		/* rotate by r2 (= 0, i.e., NOP) */
+		for (i = 0; i < 16; i++) f25[i] = temp[i] ^ opc[i];
+		f25[15] ^= 1; /* XOR c2 (= ..01) */
+	}
 
-		if (aes_128_encrypt_block(evp_ctx, k, tmp1, ck) < 0) goto error;
+	/* OUT3 = E_K(rot(TEMP XOR OP_C, r3) XOR c3) XOR OP_C */
+	if (ck) {
+		f3 = blocks[num++];
 
-		for (i = 0; i < 16; i++) ck[i] ^= opc[i];
+		/* rotate by r3 = 0x20 = 4 bytes */
+		for (i = 0; i < 16; i++) f3[(i + 12) % 16] = temp[i] ^ opc[i];
+		f3[15] ^= 2; /* XOR c3 (= ..02) */
 	}
 
-	/* f4 */
+	/* OUT4 = E_K(rot(TEMP XOR OP_C, r4) XOR c4) XOR OP_C */
 	if (ik) {
-		/* rotate by r4 = 0x40 = 8 bytes */
-		for (i = 0; i < 16; i++) tmp1[(i + 8) % 16] = tmp2[i] ^ opc[i];
-		tmp1[15] ^= 4; /* XOR c4 (= ..04) */
-
-		if (aes_128_encrypt_block(evp_ctx, k, tmp1, ik) < 0) goto error;
+		f4 = blocks[num++];
 
-		for (i = 0; i < 16; i++) ik[i] ^= opc[i];
+		/* rotate by r4 = 0x40 = 8 bytes */
+		for (i = 0; i < 16; i++) f4[(i + 8) % 16] = temp[i] ^ opc[i];
+		f4[15] ^= 4; /* XOR c4 (= ..04) */
 	}
 
-	/* f5* */
+	/* OUT5 = E_K(rot(TEMP XOR OP_C, r5) XOR c5) XOR OP_C */
 	if (ak_resync) {
+		f5s = blocks[num++];
+
 		/* rotate by r5 = 0x60 = 12 bytes */
-		for (i = 0; i < 16; i++) tmp1[(i + 4) % 16] = tmp2[i] ^ opc[i];
-		tmp1[15] ^= 8; /* XOR c5 (= ..08) */
+		for (i = 0; i < 16; i++) f5s[(i + 4) % 16] = temp[i] ^ opc[i];
+		f5s[15] ^= 8; /* XOR c5 (= ..08) */
+	}
 
-		if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp1) < 0) goto error;
+	if (num && (aes_128_encrypt_blocks(evp_ctx, blocks[0], blocks[0], num) < 0)) goto error;
+	EVP_CIPHER_CTX_free(evp_ctx);
 
-		for (i = 0; i < 6; i++) ak_resync[i] = tmp1[i] ^ opc[i];
+	/*
+	 *	OUTn = E_K(...) XOR OP_c
+	 */
+	if (f1) {
+		for (i = 0; i < 16; i++) f1[i] ^= opc[i];
+		if (mac_a) memcpy(mac_a, f1, 8);	/* f1 */
+		if (mac_s) memcpy(mac_s, f1 + 8, 8);	/* f1* */
 	}
-	EVP_CIPHER_CTX_free(evp_ctx);
+
+	if (f25) {
+		for (i = 0; i < 16; i++) f25[i] ^= opc[i];
+		if (res) memcpy(res, f25 + 8, 8);	/* f2 */
+		if (ak) memcpy(ak, f25, 6);		/* f5 */
+	}
+
+	if (f3) for (i = 0; i < 16; i++) ck[i] = f3[i] ^ opc[i];
+	if (f4) for (i = 0; i < 16; i++) ik[i] = f4[i] ^ opc[i];
+	if (f5s) for (i = 0; i < 6; i++) ak_resync[i] = f5s[i] ^ opc[i];
 
 	return 0;
 }
 
+/** milenage_f1 - Milenage f1 and f1* algorithms
+ *
+ * @param[in] opc	128-bit value derived from OP and K.
+ * @param[in] k		128-bit subscriber key.
+ * @param[in] rand	128-bit random challenge.
+ * @param[in] sqn	48-bit sequence number.
+ * @param[in] amf	16-bit authentication management field.
+ * @param[out] mac_a	Buffer for MAC-A = 64-bit network authentication code, or NULL
+ * @param[out] mac_s	Buffer for MAC-S = 64-bit resync authentication code, or NULL
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static inline int milenage_f1(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
+			      uint8_t mac_s[MILENAGE_MAC_S_SIZE],
+			      uint8_t const opc[MILENAGE_OPC_SIZE],
+			      uint8_t const k[MILENAGE_KI_SIZE],
+			      uint8_t const rand[MILENAGE_RAND_SIZE],
+			      uint8_t const sqn[MILENAGE_SQN_SIZE],
+			      uint8_t const amf[MILENAGE_AMF_SIZE])
+{
+	return milenage_f12345(mac_a, mac_s, NULL, NULL, NULL, NULL, NULL, opc, k, rand, sqn, amf);
+}
+
+/** milenage_f2345 - Milenage f2, f3, f4, f5, f5* algorithms
+ *
+ * @param[out] res		Buffer for RES = 64-bit signed response (f2), or NULL
+ * @param[out] ck		Buffer for CK = 128-bit confidentiality key (f3), or NULL
+ * @param[out] ik		Buffer for IK = 128-bit integrity key (f4), or NULL
+ * @param[out] ak		Buffer for AK = 48-bit anonymity key (f5), or NULL
+ * @param[out] ak_resync	Buffer for AK = 48-bit anonymity key (f5*), or NULL
+ * @param[in] opc		128-bit value derived from OP and K.
+ * @param[in] k			128-bit subscriber key
+ * @param[in] rand		128-bit random challenge
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static inline int milenage_f2345(uint8_t res[MILENAGE_RES_SIZE],
+				 uint8_t ik[MILENAGE_IK_SIZE],
+				 uint8_t ck[MILENAGE_CK_SIZE],
+				 uint8_t ak[MILENAGE_AK_SIZE],
+				 uint8_t ak_resync[MILENAGE_AK_SIZE],
+				 uint8_t const opc[MILENAGE_OPC_SIZE],
+				 uint8_t const k[MILENAGE_KI_SIZE],
+				 uint8_t const rand[MILENAGE_RAND_SIZE])
+{
+	return milenage_f12345(NULL, NULL, res, ik, ck, ak, ak_resync, opc, k, rand, NULL, NULL);
+}
+
 /** Derive OPc from OP and Ki
  *
  * @param[out] opc	The derived Operator Code used as an input to other Milenage
@@ -247,12 +294,9 @@ int milenage_opc_generate(uint8_t opc[MILENAGE_OPC_SIZE],
 	EVP_CIPHER_CTX	*evp_ctx;
 	size_t		i;
 
-	evp_ctx = EVP_CIPHER_CTX_new();
-	if (!evp_ctx) {
-		tls_strerror_printf("Failed allocating EVP context");
-		return -1;
-	}
- 	ret = aes_128_encrypt_block(evp_ctx, ki, op, tmp);
+	evp_ctx = aes_128_ctx_alloc(ki);
+	if (!evp_ctx) return -1;
+ 	ret = aes_128_encrypt_blocks(evp_ctx, op, tmp, 1);
  	EVP_CIPHER_CTX_free(evp_ctx);
 	if (ret < 0) return ret;
 
@@ -293,9 +337,8 @@ int milenage_umts_generate(uint8_t autn[MILENAGE_AUTN_SIZE],
 	uint8_t		*p = autn;
 	size_t		i;
 
-	if ((milenage_f1(mac_a, NULL, opc, ki, rand,
-			 uint48_to_buff(sqn_buff, sqn), amf) < 0) ||
-	    (milenage_f2345(res, ik, ck, ak_buff, NULL, opc, ki, rand) < 0)) return -1;
+	if (milenage_f12345(mac_a, NULL, res, ik, ck, ak_buff, NULL, opc, ki, rand,
+			    uint48_to_buff(sqn_buff, sqn), amf) < 0) return -1;
 
 	/*
 	 *	AUTN = (SQN ^ AK) || AMF || MAC_A
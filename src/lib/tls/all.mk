@@ -8,6 +8,7 @@ SOURCES	:= \
 	base.c \
 	cache.c \
 	conf.c \
+	crl.c \
 	ctx.c \
 	log.c \
 	ocsp.c \
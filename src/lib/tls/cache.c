@@ -37,6 +37,243 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include "missing.h"
 #include "attrs.h"
 
+#include <freeradius-devel/util/hash.h>
+
+#include <pthread.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+/*
+ *	In-memory session cache
+ *
+ *	Sessions are stored as SSL_SESSION objects, so resumption
+ *	doesn't need to serialise or deserialise them, or call out
+ *	to a virtual server.
+ *
+ *	The cache is shared by all worker threads.  It's split into
+ *	shards, each with their own lock, so a thread only contends
+ *	with others resuming sessions that hash to the same shard.
+ *	The locks are only held for the duration of a hash lookup.
+ *
+ *	The cache holds its own copy of each session.  Callers are
+ *	given a copy of that, as OpenSSL modifies the session it's
+ *	resuming (ex_data, timeout, resumability), and those changes
+ *	must not be visible to other connections.
+ */
+#define TLS_SESSION_CACHE_SHARDS	(16)
+
+typedef struct fr_tls_session_cache_shard_s fr_tls_session_cache_shard_t;
+
+typedef struct {
+	uint8_t				id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	unsigned int			id_len;
+	SSL_SESSION			*sess;		//!< Our copy of the session.
+
+	fr_tls_session_cache_shard_t	*shard;		//!< Shard this entry belongs to.
+	fr_dlist_t			entry;		//!< Entry in the shard's insertion order list.
+} fr_tls_session_cache_entry_t;
+
+struct fr_tls_session_cache_shard_s {
+	pthread_mutex_t			mutex;		//!< Protects the hash table and list.
+	fr_hash_table_t			*ht;		//!< Entries, keyed by session ID.
+	fr_dlist_head_t			order;		//!< Entries in insertion order, oldest first.
+	uint32_t			max_entries;	//!< Maximum entries in this shard, 0 for no limit.
+};
+
+struct fr_tls_session_cache_s {
+	fr_tls_session_cache_shard_t	shard[TLS_SESSION_CACHE_SHARDS];
+};
+
+static uint32_t session_cache_entry_hash(void const *data)
+{
+	fr_tls_session_cache_entry_t const *entry = data;
+
+	return fr_hash(entry->id, entry->id_len);
+}
+
+static int session_cache_entry_cmp(void const *one, void const *two)
+{
+	fr_tls_session_cache_entry_t const *a = one, *b = two;
+
+	if (a->id_len != b->id_len) return (a->id_len > b->id_len) - (a->id_len < b->id_len);
+
+	return memcmp(a->id, b->id, a->id_len);
+}
+
+static int _session_cache_entry_free(fr_tls_session_cache_entry_t *entry)
+{
+	fr_dlist_remove(&entry->shard->order, entry);
+	SSL_SESSION_free(entry->sess);
+
+	return 0;
+}
+
+static void session_cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static int _session_cache_free(fr_tls_session_cache_t *cache)
+{
+	int i;
+
+	for (i = 0; i < TLS_SESSION_CACHE_SHARDS; i++) {
+		TALLOC_FREE(cache->shard[i].ht);
+		pthread_mutex_destroy(&cache->shard[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate an in-memory session cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of sessions to hold.  0 for no limit.
+ * @return
+ *	- The new cache.
+ *	- NULL on error.
+ */
+fr_tls_session_cache_t *fr_tls_session_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries)
+{
+	fr_tls_session_cache_t	*cache;
+	int			i;
+
+	cache = talloc_zero(ctx, fr_tls_session_cache_t);
+	if (!cache) return NULL;
+
+	for (i = 0; i < TLS_SESSION_CACHE_SHARDS; i++) {
+		fr_tls_session_cache_shard_t *shard = &cache->shard[i];
+
+		shard->ht = fr_hash_table_create(cache, session_cache_entry_hash,
+						 session_cache_entry_cmp, session_cache_entry_free);
+		if (!shard->ht) {
+			talloc_free(cache);
+			return NULL;
+		}
+		fr_dlist_init(&shard->order, fr_tls_session_cache_entry_t, entry);
+		pthread_mutex_init(&shard->mutex, NULL);
+
+		if (max_entries) {
+			shard->max_entries = max_entries / TLS_SESSION_CACHE_SHARDS;
+			if (!shard->max_entries) shard->max_entries = 1;
+		}
+	}
+	talloc_set_destructor(cache, _session_cache_free);
+
+	return cache;
+}
+
+static inline CC_HINT(always_inline)
+fr_tls_session_cache_shard_t *session_cache_shard(fr_tls_session_cache_t *cache, fr_tls_session_cache_entry_t *find,
+						  uint8_t const *key, size_t key_len)
+{
+	if (key_len > sizeof(find->id)) return NULL;
+
+	memcpy(find->id, key, key_len);
+	find->id_len = key_len;
+
+	/*
+	 *	Use the top bits for the shard, the hash table
+	 *	uses the bottom ones for its buckets.
+	 */
+	return &cache->shard[session_cache_entry_hash(find) >> 28];
+}
+
+/** Insert a copy of a session into the in-memory cache
+ *
+ * Replaces any existing entry with the same session ID.  If the shard
+ * is full, the oldest entry in it is evicted.
+ */
+static void session_cache_insert(fr_tls_session_cache_t *cache, SSL_SESSION *sess)
+{
+	fr_tls_session_cache_shard_t	*shard;
+	fr_tls_session_cache_entry_t	*entry, find;
+	uint8_t const			*key;
+	unsigned int			key_len;
+
+	key = SSL_SESSION_get_id(sess, &key_len);
+
+	shard = session_cache_shard(cache, &find, key, key_len);
+	if (!shard || !key_len) return;
+
+	pthread_mutex_lock(&shard->mutex);
+	fr_hash_table_delete(shard->ht, &find);
+
+	if (shard->max_entries && (fr_dlist_num_elements(&shard->order) >= shard->max_entries)) {
+		fr_hash_table_delete(shard->ht, fr_dlist_head(&shard->order));
+	}
+
+	entry = talloc_zero(shard->ht, fr_tls_session_cache_entry_t);
+	if (!entry) {
+	error:
+		pthread_mutex_unlock(&shard->mutex);
+		return;
+	}
+	memcpy(entry->id, key, key_len);
+	entry->id_len = key_len;
+	entry->shard = shard;
+
+	entry->sess = SSL_SESSION_dup(sess);
+	if (!entry->sess) {
+		talloc_free(entry);
+		goto error;
+	}
+	SSL_SESSION_set_ex_data(entry->sess, FR_TLS_EX_INDEX_TLS_SESSION, NULL);
+
+	fr_dlist_insert_tail(&shard->order, entry);
+	talloc_set_destructor(entry, _session_cache_entry_free);
+
+	if (!fr_hash_table_insert(shard->ht, entry)) talloc_free(entry);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Find a session in the in-memory cache
+ *
+ * Expired sessions are removed, and not returned.
+ *
+ * @return
+ *	- A copy of the cached session, which the caller must free.
+ *	- NULL if no valid session was found.
+ */
+static SSL_SESSION *session_cache_find(fr_tls_session_cache_t *cache, uint8_t const *key, size_t key_len)
+{
+	fr_tls_session_cache_shard_t	*shard;
+	fr_tls_session_cache_entry_t	*entry, find;
+	SSL_SESSION			*sess = NULL;
+
+	shard = session_cache_shard(cache, &find, key, key_len);
+	if (!shard) return NULL;
+
+	pthread_mutex_lock(&shard->mutex);
+	entry = fr_hash_table_find_by_data(shard->ht, &find);
+	if (entry) {
+		if ((SSL_SESSION_get_time(entry->sess) + SSL_SESSION_get_timeout(entry->sess)) < time(NULL)) {
+			fr_hash_table_delete(shard->ht, entry);
+		} else {
+			sess = SSL_SESSION_dup(entry->sess);
+		}
+	}
+	pthread_mutex_unlock(&shard->mutex);
+
+	return sess;
+}
+
+/** Remove a session from the in-memory cache
+ *
+ */
+static void session_cache_remove(fr_tls_session_cache_t *cache, uint8_t const *key, size_t key_len)
+{
+	fr_tls_session_cache_shard_t	*shard;
+	fr_tls_session_cache_entry_t	find;
+
+	shard = session_cache_shard(cache, &find, key, key_len);
+	if (!shard) return;
+
+	pthread_mutex_lock(&shard->mutex);
+	fr_hash_table_delete(shard->ht, &find);
+	pthread_mutex_unlock(&shard->mutex);
+}
+#endif
+
 /** Add attributes identifying the TLS session to be acted upon, and the action to be performed
  *
  * Adds the following attributes to the request:
@@ -178,6 +415,7 @@ inline static ssize_t fr_tls_cache_id(uint8_t const **out, SSL_SESSION *sess)
  */
 static int fr_tls_cache_serialize(SSL *ssl, SSL_SESSION *sess)
 {
+	fr_tls_conf_t		*conf;
 	request_t			*request;
 	fr_tls_session_t		*tls_session;
 	size_t			len, rcode;
@@ -187,6 +425,7 @@ static int fr_tls_cache_serialize(SSL *ssl, SSL_SESSION *sess)
 	uint8_t	const		*key;
 	size_t			key_len;
 
+	conf = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
 	request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
 	tls_session = talloc_get_type_abort(SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION), fr_tls_session_t);
 
@@ -204,6 +443,28 @@ static int fr_tls_cache_serialize(SSL *ssl, SSL_SESSION *sess)
 		return 0;
 	}
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	/*
+	 *	Hold a reference to the session, so it can be
+	 *	written to the in-memory cache later.
+	 */
+	if (conf->session_cache_mem) {
+		fr_assert(!tls_session->session_pending);
+
+		tls_session->session_id = talloc_memdup(tls_session, key, key_len);
+		if (!tls_session->session_id) return 0;
+
+		SSL_SESSION_up_ref(sess);
+		tls_session->session_pending = sess;
+
+		/*
+		 *	Only serialise if we're writing through
+		 *	to an external cache.
+		 */
+		if (!conf->session_cache.store) return 0;
+	}
+#endif
+
 	/* find out what length data we need */
 	len = i2d_SSL_SESSION(sess, NULL);
 	if (len < 1) {
@@ -232,10 +493,12 @@ static int fr_tls_cache_serialize(SSL *ssl, SSL_SESSION *sess)
 	 *	Store the session blob and session id for writing
 	 *	later, once all the authentication phases have completed.
 	 */
-	tls_session->session_id = talloc_memdup(tls_session, key, key_len);
 	if (!tls_session->session_id) {
-		talloc_free(data);
-		return 0;
+		tls_session->session_id = talloc_memdup(tls_session, key, key_len);
+		if (!tls_session->session_id) {
+			talloc_free(data);
+			return 0;
+		}
 	}
 	tls_session->session_blob = data;
 
@@ -269,11 +532,23 @@ int fr_tls_cache_write(request_t *request, fr_tls_session_t *tls_session)
 
 	conf = SSL_get_ex_data(tls_session->ssl, FR_TLS_EX_INDEX_CONF);
 
-	if (!tls_session->session_blob || !tls_session->session_id) {
+	if (!tls_session->session_id || (!tls_session->session_blob && !tls_session->session_pending)) {
 		RDEBUG2("No session data available to cache");
 		return 1;
 	}
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (tls_session->session_pending) {
+		session_cache_insert(conf->session_cache_mem, tls_session->session_pending);
+		SSL_SESSION_free(tls_session->session_pending);
+		tls_session->session_pending = NULL;
+
+		RDEBUG2("Stored session in memory cache");
+
+		if (!tls_session->session_blob) return 0;
+	}
+#endif
+
 	if (fr_tls_cache_session_id_to_vp(request, tls_session->session_id,
 				       talloc_array_length(tls_session->session_id)) < 0) {
 		RWDEBUG("Failed adding session key to the request");
@@ -344,13 +619,31 @@ static SSL_SESSION *fr_tls_cache_read(SSL *ssl,
 	request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
 	conf = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
 
+	*copy = 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (conf->session_cache_mem) {
+		sess = session_cache_find(conf->session_cache_mem, key, key_len);
+		if (sess) {
+			RDEBUG3("Found session in memory cache");
+			goto resume;
+		}
+
+		/*
+		 *	No external cache to fall back to
+		 */
+		if (!conf->session_cache.load) {
+			RWDEBUG("No cached session found");
+			return NULL;
+		}
+	}
+#endif
+
 	if (fr_tls_cache_session_id_to_vp(request, key, key_len) < 0) {
 		RWDEBUG("Failed adding session key to the request");
 		return NULL;
 	}
 
-	*copy = 0;
-
 	/*
 	 *	Call the virtual server to read the session
 	 */
@@ -381,6 +674,20 @@ static SSL_SESSION *fr_tls_cache_read(SSL *ssl,
 	}
 	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", vp->vp_length);
 
+	/*
+	 *	Ensure that the session data can't be used by anyone else.
+	 */
+	fr_pair_delete_by_da(&request->state_pairs, attr_tls_session_data);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	/*
+	 *	Subsequent resumptions on any thread can be
+	 *	served from memory.
+	 */
+	if (conf->session_cache_mem) session_cache_insert(conf->session_cache_mem, sess);
+
+resume:
+#endif
 	/*
 	 *	OpenSSL's API is very inconsistent.
 	 *
@@ -406,13 +713,11 @@ static SSL_SESSION *fr_tls_cache_read(SSL *ssl,
 	if (fr_tls_validate_client_cert_chain(ssl) != 1) {
 		RWDEBUG("Validation failed, forcefully expiring resumed session");
 		SSL_SESSION_set_timeout(sess, 0);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+		if (conf->session_cache_mem) session_cache_remove(conf->session_cache_mem, key, key_len);
+#endif
 	}
 
-	/*
-	 *	Ensure that the session data can't be used by anyone else.
-	 */
-	fr_pair_delete_by_da(&request->state_pairs, attr_tls_session_data);
-
 	return sess;
 }
 
@@ -449,6 +754,10 @@ static void fr_tls_cache_delete(SSL_CTX *ctx, SSL_SESSION *sess)
 		return;
 	}
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (conf->session_cache_mem) session_cache_remove(conf->session_cache_mem, key, (size_t)key_len);
+#endif
+
 	if (fr_tls_cache_session_id_to_vp(request, key, (size_t)key_len) < 0) {
 		RWDEBUG("Failed adding session key to the request");
 		goto error;
@@ -71,6 +71,8 @@ static CONF_PARSER cache_config[] = {
 			 .dflt = "%{EAP-Type}%{Virtual-Server}", .quote = T_DOUBLE_QUOTED_STRING },
 	{ FR_CONF_OFFSET("lifetime", FR_TYPE_UINT32, fr_tls_conf_t, session_cache_lifetime), .dflt = "86400" },
 	{ FR_CONF_OFFSET("verify", FR_TYPE_BOOL, fr_tls_conf_t, session_cache_verify), .dflt = "no" },
+	{ FR_CONF_OFFSET("memory", FR_TYPE_BOOL, fr_tls_conf_t, session_cache_memory), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, fr_tls_conf_t, session_cache_max_entries), .dflt = "8192" },
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	{ FR_CONF_OFFSET("require_extended_master_secret", FR_TYPE_BOOL, fr_tls_conf_t, session_cache_require_extms), .dflt = "yes" },
@@ -78,7 +80,6 @@ static CONF_PARSER cache_config[] = {
 #endif
 
 	{ FR_CONF_DEPRECATED("enable", FR_TYPE_BOOL, fr_tls_conf_t, NULL) },
-	{ FR_CONF_DEPRECATED("max_entries", FR_TYPE_UINT32, fr_tls_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("persist_dir", FR_TYPE_STRING, fr_tls_conf_t, NULL) },
 
 	CONF_PARSER_TERMINATOR
@@ -87,6 +88,8 @@ static CONF_PARSER cache_config[] = {
 static CONF_PARSER verify_config[] = {
 	{ FR_CONF_OFFSET("tmpdir", FR_TYPE_STRING, fr_tls_conf_t, verify_tmp_dir) },
 	{ FR_CONF_OFFSET("client", FR_TYPE_STRING, fr_tls_conf_t, verify_client_cert_cmd) },
+	{ FR_CONF_OFFSET("cache_lifetime", FR_TYPE_UINT32, fr_tls_conf_t, verify_cache_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("cache_max_entries", FR_TYPE_UINT32, fr_tls_conf_t, verify_cache_max_entries), .dflt = "8192" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -102,6 +105,10 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cache_memory", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, cache_memory), .dflt = "no" },
+	{ FR_CONF_OFFSET("cache_max_entries", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_max_entries), .dflt = "8192" },
+	{ FR_CONF_OFFSET("cache_max_age", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_max_age), .dflt = "3600" },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
@@ -148,6 +155,9 @@ CONF_PARSER fr_tls_server_config[] = {
 	{ FR_CONF_DEPRECATED("check_all_crl", FR_TYPE_BOOL, fr_tls_conf_t, NULL) },
 #endif
 	{ FR_CONF_OFFSET("allow_expired_crl", FR_TYPE_BOOL, fr_tls_conf_t, allow_expired_crl) },
+	{ FR_CONF_OFFSET("crl_file", FR_TYPE_FILE_INPUT | FR_TYPE_MULTI, fr_tls_conf_t, crl_files) },
+	{ FR_CONF_OFFSET("crl_delta_file", FR_TYPE_FILE_INPUT | FR_TYPE_MULTI, fr_tls_conf_t, crl_delta_files) },
+	{ FR_CONF_OFFSET("crl_reload_interval", FR_TYPE_UINT32, fr_tls_conf_t, crl_reload_interval), .dflt = "0" },
 	{ FR_CONF_OFFSET("check_cert_cn", FR_TYPE_STRING, fr_tls_conf_t, check_cert_cn) },
 	{ FR_CONF_OFFSET("cipher_list", FR_TYPE_STRING, fr_tls_conf_t, cipher_list) },
 	{ FR_CONF_OFFSET("cipher_server_preference", FR_TYPE_BOOL, fr_tls_conf_t, cipher_server_preference), .dflt = "yes" },
@@ -157,6 +167,10 @@ CONF_PARSER fr_tls_server_config[] = {
 	{ FR_CONF_OFFSET("check_cert_issuer", FR_TYPE_STRING, fr_tls_conf_t, check_cert_issuer) },
 	{ FR_CONF_OFFSET("require_client_cert", FR_TYPE_BOOL, fr_tls_conf_t, require_client_cert) },
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, fr_tls_conf_t, async), .dflt = "no" },
+#endif
+
 #ifndef OPENSSL_NO_ECDH
 	{ FR_CONF_OFFSET("ecdh_curve", FR_TYPE_STRING, fr_tls_conf_t, ecdh_curve), .dflt = "prime256v1" },
 #endif
@@ -357,6 +371,29 @@ static X509_STORE *conf_ocsp_revocation_store(fr_tls_conf_t *conf)
 }
 #endif
 
+/** Return the number of SSL_CTX to create
+ *
+ * Before OpenSSL 1.1.0, sharing a context between threads caused heavy
+ * lock contention, so we created more contexts than threads.
+ *
+ * Later versions use atomics and read/write locks internally, and
+ * contexts are never modified after they're created, so a single
+ * context is shared by all threads.  This means certificate chains,
+ * and the CA store, are only loaded once per TLS configuration.
+ * SSL objects hold a reference to their context, so it outlives any
+ * sessions using it.
+ */
+static inline CC_HINT(always_inline) uint32_t conf_ctx_count(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	return 1;
+#else
+	uint32_t count = fr_tls_max_threads * 2; /* Even one context per thread will lead to contention */
+
+	return count ? count : 1;
+#endif
+}
+
 /*
  *	Free TLS client/server config
  *	Should not be called outside this code, as a callback is
@@ -432,8 +469,7 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf_cert_admin_password(conf) < 0) goto error;
 #endif
 
-	conf->ctx_count = fr_tls_max_threads * 2; /* Reduce contention */
-	if (!conf->ctx_count) conf->ctx_count = 1;
+	conf->ctx_count = conf_ctx_count();
 
 	/*
 	 *	Initialize TLS
@@ -458,11 +494,27 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf->ocsp.enable) {
 		conf->ocsp.store = conf_ocsp_revocation_store(conf);
 		if (conf->ocsp.store == NULL) goto error;
+
+		if (conf->ocsp.cache_memory) {
+			conf->ocsp.cache_mem = fr_tls_ocsp_cache_alloc(conf, conf->ocsp.cache_max_entries);
+			if (!conf->ocsp.cache_mem) {
+				ERROR("Failed allocating in-memory OCSP cache");
+				goto error;
+			}
+		}
 	}
 
 	if (conf->staple.enable) {
 		conf->staple.store = conf_ocsp_revocation_store(conf);
 		if (conf->staple.store == NULL) goto error;
+
+		if (conf->staple.cache_memory) {
+			conf->staple.cache_mem = fr_tls_ocsp_cache_alloc(conf, conf->staple.cache_max_entries);
+			if (!conf->staple.cache_mem) {
+				ERROR("Failed allocating in-memory OCSP staple cache");
+				goto error;
+			}
+		}
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 
@@ -491,6 +543,53 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 		if (fr_tls_cache_compile(&conf->session_cache, server_cs) < 0) goto error;
 	}
 
+	if (conf->session_cache_memory) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+		conf->session_cache_mem = fr_tls_session_cache_alloc(conf, conf->session_cache_max_entries);
+		if (!conf->session_cache_mem) {
+			ERROR("Failed allocating in-memory session cache");
+			goto error;
+		}
+#else
+		ERROR("In-memory session caching requires OpenSSL >= 1.1.1");
+		goto error;
+#endif
+	}
+
+	if (conf->verify_cache_lifetime) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		conf->verify_cache = fr_tls_verify_cache_alloc(conf, conf->verify_cache_lifetime,
+							       conf->verify_cache_max_entries);
+		if (!conf->verify_cache) {
+			ERROR("Failed allocating certificate verification cache");
+			goto error;
+		}
+#else
+		ERROR("Caching certificate verification results requires OpenSSL >= 1.1.0");
+		goto error;
+#endif
+	}
+
+	if (conf->crl_files) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		/*
+		 *	All the contexts load the same CAs, so
+		 *	any of their stores can verify the CRLs.
+		 */
+		conf->crl = fr_tls_crl_alloc(conf, conf, SSL_CTX_get_cert_store(conf->ctx[0]));
+		if (!conf->crl) {
+			ERROR("Failed loading CRLs");
+			goto error;
+		}
+#else
+		ERROR("Indexing CRLs requires OpenSSL >= 1.1.0");
+		goto error;
+#endif
+	} else if (conf->crl_delta_files) {
+		ERROR("crl_delta_file requires crl_file to be set");
+		goto error;
+	}
+
 	if (conf->ocsp.cache_server) {
 		CONF_SECTION *server_cs;
 
@@ -553,8 +652,7 @@ fr_tls_conf_t *fr_tls_conf_parse_client(CONF_SECTION *cs)
 	/*
 	 *	Initialize TLS
 	 */
-	conf->ctx_count = fr_tls_max_threads * 2; /* Even one context per thread will lead to contention */
-	if (!conf->ctx_count) conf->ctx_count = 1;
+	conf->ctx_count = conf_ctx_count();
 
 #ifdef __APPLE__
 	if (conf_cert_admin_password(conf) < 0) goto error;
@@ -0,0 +1,585 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/crl.c
+ * @brief Index the serial numbers in CRLs, and reload them in the background
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls - "
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include "base.h"
+#include "missing.h"
+
+#include <openssl/x509v3.h>
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/*
+ *	Revocation index
+ *
+ *	CRLs added to an X509_STORE are kept as a list of objects,
+ *	and replacing them means rebuilding the store.  With CRLs
+ *	containing millions of entries, loading them is slow, and
+ *	having the store search and sort them holds its lock for a
+ *	long time.
+ *
+ *	Instead, we parse the CRLs ourselves, check their signatures
+ *	against the CAs in the store, and keep only the serial
+ *	numbers, in a hash table per issuer.  The CRLs are then freed.
+ *
+ *	Delta CRLs are indexed separately.  The deltas are usually
+ *	small and change often, so when only they've changed, only
+ *	they're reloaded.  A delta entry with the "removeFromCRL"
+ *	reason overrides the entry in the base CRL.
+ *
+ *	Reloading is done by a separate thread, which builds a new
+ *	index, and then swaps it in.  Lookups only hold a read lock
+ *	for the duration of the hash lookup.
+ */
+#define CRL_SERIAL_MAX		(24)	//!< RFC 5280 limits serials to 20 octets.
+
+typedef struct {
+	uint8_t			len;			//!< Length of the serial, 0 if the slot is empty.
+	bool			remove;			//!< Entry has the "removeFromCRL" reason.
+	uint8_t			serial[CRL_SERIAL_MAX];
+} crl_serial_t;
+
+typedef struct {
+	X509_NAME		*issuer;		//!< Issuer of the CRL(s).
+	time_t			next_update;		//!< Earliest nextUpdate of the CRL(s).  0 if none.
+
+	crl_serial_t		*slots;			//!< Open addressed hash table of serials.
+	size_t			num_slots;		//!< Always a power of 2.
+	size_t			num;			//!< Number of used slots.
+} crl_issuer_t;
+
+typedef struct {
+	crl_issuer_t		**issuers;		//!< One per issuer, usually only a few.
+	size_t			entries;		//!< Total number of serials, for logging.
+} crl_index_t;
+
+struct fr_tls_crl_s {
+	pthread_rwlock_t	lock;			//!< Protects base and delta.
+	crl_index_t		*base;			//!< Serials from the CRLs.
+	crl_index_t		*delta;			//!< Serials from the delta CRLs.
+
+	char const		**files;		//!< CRL files.
+	char const		**delta_files;		//!< Delta CRL files.
+	time_t			files_mtime;		//!< Most recent mtime of the CRL files.
+	time_t			delta_files_mtime;	//!< Most recent mtime of the delta CRL files.
+
+	X509_STORE		*store;			//!< To find the CA certificates the CRLs are signed with.
+	bool			allow_expired;		//!< Don't error out if a CRL has expired.
+
+	uint32_t		interval;		//!< How often to check the files for changes.
+	pthread_t		thread;			//!< Reloads the CRLs.
+	pthread_mutex_t		mutex;			//!< For cond.
+	pthread_cond_t		cond;			//!< Signalled to stop the thread.
+	bool			running;		//!< Whether the thread was started.
+	bool			stop;			//!< Tells the thread to exit.
+};
+
+static inline CC_HINT(always_inline) size_t crl_serial_hash(uint8_t const *serial, size_t len)
+{
+	return fr_hash(serial, len);
+}
+
+static crl_serial_t *crl_issuer_find(crl_issuer_t const *ci, uint8_t const *serial, size_t len)
+{
+	size_t i, mask = ci->num_slots - 1;
+
+	for (i = crl_serial_hash(serial, len) & mask; ci->slots[i].len; i = (i + 1) & mask) {
+		if ((ci->slots[i].len == len) && (memcmp(ci->slots[i].serial, serial, len) == 0)) return &ci->slots[i];
+	}
+
+	return NULL;
+}
+
+static int crl_issuer_grow(crl_issuer_t *ci)
+{
+	crl_serial_t	*old = ci->slots;
+	size_t		old_num = ci->num_slots, i;
+
+	ci->num_slots = old_num ? (old_num * 2) : 1024;
+	ci->slots = talloc_zero_array(ci, crl_serial_t, ci->num_slots);
+	if (!ci->slots) {
+		ci->slots = old;
+		ci->num_slots = old_num;
+		return -1;
+	}
+
+	for (i = 0; i < old_num; i++) {
+		size_t j, mask = ci->num_slots - 1;
+
+		if (!old[i].len) continue;
+
+		for (j = crl_serial_hash(old[i].serial, old[i].len) & mask; ci->slots[j].len; j = (j + 1) & mask);
+		ci->slots[j] = old[i];
+	}
+	talloc_free(old);
+
+	return 0;
+}
+
+static int crl_issuer_insert(crl_issuer_t *ci, uint8_t const *serial, size_t len, bool remove)
+{
+	size_t		i, mask;
+
+	/*
+	 *	Keep the table at most half full, so
+	 *	the probe sequences stay short.
+	 */
+	if (((ci->num + 1) * 2 > ci->num_slots) && (crl_issuer_grow(ci) < 0)) return -1;
+
+	mask = ci->num_slots - 1;
+	for (i = crl_serial_hash(serial, len) & mask; ci->slots[i].len; i = (i + 1) & mask) {
+		if ((ci->slots[i].len == len) && (memcmp(ci->slots[i].serial, serial, len) == 0)) {
+			ci->slots[i].remove = remove;
+			return 0;
+		}
+	}
+
+	ci->slots[i].len = len;
+	ci->slots[i].remove = remove;
+	memcpy(ci->slots[i].serial, serial, len);
+	ci->num++;
+
+	return 1;
+}
+
+static int _crl_issuer_free(crl_issuer_t *ci)
+{
+	X509_NAME_free(ci->issuer);
+
+	return 0;
+}
+
+static crl_issuer_t *crl_index_issuer(crl_index_t const *index, X509_NAME *issuer)
+{
+	size_t i;
+
+	if (!index) return NULL;
+
+	for (i = 0; i < talloc_array_length(index->issuers); i++) {
+		if (X509_NAME_cmp(index->issuers[i]->issuer, issuer) == 0) return index->issuers[i];
+	}
+
+	return NULL;
+}
+
+/** Convert an ASN1_TIME to a time_t
+ *
+ */
+static int crl_time(time_t *out, ASN1_TIME const *asn1)
+{
+	int days, secs;
+
+	if (!ASN1_TIME_diff(&days, &secs, NULL, asn1)) return -1;
+
+	*out = time(NULL) + ((time_t)days * 86400) + secs;
+
+	return 0;
+}
+
+/** Check a CRL was signed by a CA in the store
+ *
+ */
+static int crl_verify(X509_STORE *store, X509_CRL *x509_crl, char const *file)
+{
+	X509_STORE_CTX	*store_ctx;
+	X509_OBJECT	*obj;
+	int		ret = -1;
+
+	store_ctx = X509_STORE_CTX_new();
+	if (!store_ctx || (X509_STORE_CTX_init(store_ctx, store, NULL, NULL) != 1)) {
+		fr_tls_log_error(NULL, "Failed initialising store to verify CRL");
+		goto finish;
+	}
+
+	obj = X509_STORE_CTX_get_obj_by_subject(store_ctx, X509_LU_X509, X509_CRL_get_issuer(x509_crl));
+	if (!obj) {
+		ERROR("Failed verifying CRL in \"%s\": Issuer certificate not found", file);
+		goto finish;
+	}
+
+	if (X509_CRL_verify(x509_crl, X509_get0_pubkey(X509_OBJECT_get0_X509(obj))) != 1) {
+		fr_tls_log_error(NULL, "Failed verifying signature of CRL in \"%s\"", file);
+	} else {
+		ret = 0;
+	}
+	X509_OBJECT_free(obj);
+
+finish:
+	X509_STORE_CTX_free(store_ctx);
+
+	return ret;
+}
+
+/** Add the serials from a CRL to an index
+ *
+ */
+static int crl_index_add(crl_index_t *index, X509_CRL *x509_crl, bool delta)
+{
+	STACK_OF(X509_REVOKED)	*revoked;
+	crl_issuer_t		*ci;
+	ASN1_TIME const		*next_update;
+	int			i;
+
+	ci = crl_index_issuer(index, X509_CRL_get_issuer(x509_crl));
+	if (!ci) {
+		size_t		num = talloc_array_length(index->issuers);
+		crl_issuer_t	**issuers;
+
+		issuers = talloc_realloc(index, index->issuers, crl_issuer_t *, num + 1);
+		if (!issuers) return -1;
+		index->issuers = issuers;
+
+		MEM(ci = talloc_zero(index, crl_issuer_t));
+		ci->issuer = X509_NAME_dup(X509_CRL_get_issuer(x509_crl));
+		if (!ci->issuer || (crl_issuer_grow(ci) < 0)) {
+			X509_NAME_free(ci->issuer);
+			talloc_free(ci);
+			index->issuers = talloc_realloc(index, index->issuers, crl_issuer_t *, num);
+			return -1;
+		}
+		talloc_set_destructor(ci, _crl_issuer_free);
+		index->issuers[num] = ci;
+	}
+
+	next_update = X509_CRL_get0_nextUpdate(x509_crl);
+	if (next_update) {
+		time_t when;
+
+		if ((crl_time(&when, next_update) == 0) && (!ci->next_update || (when < ci->next_update))) {
+			ci->next_update = when;
+		}
+	}
+
+	revoked = X509_CRL_get_REVOKED(x509_crl);
+	for (i = 0; i < sk_X509_REVOKED_num(revoked); i++) {
+		X509_REVOKED		*rev = sk_X509_REVOKED_value(revoked, i);
+		ASN1_INTEGER const	*serial = X509_REVOKED_get0_serialNumber(rev);
+		bool			remove = false;
+		int			ret;
+
+		if ((size_t)ASN1_STRING_length(serial) > CRL_SERIAL_MAX) {
+			WARN("Ignoring revoked serial longer than %u bytes", CRL_SERIAL_MAX);
+			continue;
+		}
+
+		if (delta) {
+			ASN1_ENUMERATED *reason;
+
+			reason = X509_REVOKED_get_ext_d2i(rev, NID_crl_reason, NULL, NULL);
+			if (reason) {
+				remove = (ASN1_ENUMERATED_get(reason) == CRL_REASON_REMOVE_FROM_CRL);
+				ASN1_ENUMERATED_free(reason);
+			}
+		}
+
+		ret = crl_issuer_insert(ci, ASN1_STRING_get0_data(serial), ASN1_STRING_length(serial), remove);
+		if (ret < 0) return -1;
+		index->entries += ret;
+	}
+
+	return 0;
+}
+
+/** Load the CRLs in a file into an index
+ *
+ * Files may be DER, or contain one or more PEM encoded CRLs.
+ */
+static int crl_index_load_file(crl_index_t *index, X509_STORE *store, char const *file, bool delta)
+{
+	BIO		*bio;
+	X509_CRL	*x509_crl;
+	int		loaded = 0;
+
+	bio = BIO_new_file(file, "r");
+	if (!bio) {
+		fr_tls_log_error(NULL, "Failed opening CRL file \"%s\"", file);
+		return -1;
+	}
+
+	while ((x509_crl = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL))) {
+	add:
+		if ((crl_verify(store, x509_crl, file) < 0) || (crl_index_add(index, x509_crl, delta) < 0)) {
+			X509_CRL_free(x509_crl);
+			BIO_free(bio);
+			return -1;
+		}
+		X509_CRL_free(x509_crl);
+		loaded++;
+	}
+
+	if (!loaded) {
+		(void)BIO_reset(bio);
+
+		x509_crl = d2i_X509_CRL_bio(bio, NULL);
+		if (x509_crl) goto add;
+
+		fr_tls_log_error(NULL, "Failed reading CRL from \"%s\"", file);
+		BIO_free(bio);
+		return -1;
+	}
+	ERR_clear_error();	/* PEM_read signals EOF with an error */
+	BIO_free(bio);
+
+	return 0;
+}
+
+static crl_index_t *crl_index_load(TALLOC_CTX *ctx, X509_STORE *store, char const **files, bool delta)
+{
+	crl_index_t	*index;
+	size_t		i;
+
+	MEM(index = talloc_zero(ctx, crl_index_t));
+
+	for (i = 0; i < talloc_array_length(files); i++) {
+		if (crl_index_load_file(index, store, files[i], delta) < 0) {
+			talloc_free(index);
+			return NULL;
+		}
+	}
+
+	return index;
+}
+
+/** Return the most recent mtime of a set of files
+ *
+ */
+static time_t crl_files_mtime(char const **files)
+{
+	size_t		i;
+	time_t		mtime = 0;
+	struct stat	buf;
+
+	for (i = 0; i < talloc_array_length(files); i++) {
+		if (stat(files[i], &buf) < 0) continue;
+		if (buf.st_mtime > mtime) mtime = buf.st_mtime;
+	}
+
+	return mtime;
+}
+
+/** Reload the CRLs and delta CRLs if they've changed
+ *
+ * The new indexes are built without holding the lock, so lookups
+ * continue using the old ones until they're swapped in.
+ */
+static void crl_reload(fr_tls_crl_t *crl)
+{
+	time_t		files_mtime, delta_files_mtime;
+	crl_index_t	*base = NULL, *delta = NULL, *old_base = NULL, *old_delta;
+
+	files_mtime = crl_files_mtime(crl->files);
+	delta_files_mtime = crl_files_mtime(crl->delta_files);
+
+	if (files_mtime != crl->files_mtime) {
+		base = crl_index_load(crl, crl->store, crl->files, false);
+		if (!base) {
+			ERROR("Failed reloading CRLs, continuing with the previous ones");
+			return;
+		}
+	} else if (delta_files_mtime == crl->delta_files_mtime) {
+		return;
+	}
+
+	/*
+	 *	Deltas are relative to the base, so are
+	 *	always reloaded along with it.
+	 */
+	delta = crl_index_load(crl, crl->store, crl->delta_files, true);
+	if (!delta) {
+		ERROR("Failed reloading delta CRLs, continuing with the previous ones");
+		talloc_free(base);
+		return;
+	}
+
+	pthread_rwlock_wrlock(&crl->lock);
+	if (base) {
+		old_base = crl->base;
+		crl->base = base;
+	}
+	old_delta = crl->delta;
+	crl->delta = delta;
+	pthread_rwlock_unlock(&crl->lock);
+
+	if (base) {
+		crl->files_mtime = files_mtime;
+		INFO("Reloaded CRLs, %zu revoked serials", base->entries);
+	}
+	crl->delta_files_mtime = delta_files_mtime;
+	if (talloc_array_length(crl->delta_files)) INFO("Reloaded delta CRLs, %zu serials", delta->entries);
+
+	talloc_free(old_base);
+	talloc_free(old_delta);
+}
+
+static void *crl_reload_thread(void *arg)
+{
+	fr_tls_crl_t	*crl = arg;
+	struct timespec	when;
+
+	pthread_mutex_lock(&crl->mutex);
+	while (!crl->stop) {
+		clock_gettime(CLOCK_REALTIME, &when);
+		when.tv_sec += crl->interval;
+
+		if ((pthread_cond_timedwait(&crl->cond, &crl->mutex, &when) == 0) || crl->stop) continue;
+
+		pthread_mutex_unlock(&crl->mutex);
+		crl_reload(crl);
+		pthread_mutex_lock(&crl->mutex);
+	}
+	pthread_mutex_unlock(&crl->mutex);
+
+	return NULL;
+}
+
+static int _crl_free(fr_tls_crl_t *crl)
+{
+	if (crl->running) {
+		pthread_mutex_lock(&crl->mutex);
+		crl->stop = true;
+		pthread_cond_signal(&crl->cond);
+		pthread_mutex_unlock(&crl->mutex);
+
+		pthread_join(crl->thread, NULL);
+	}
+
+	pthread_cond_destroy(&crl->cond);
+	pthread_mutex_destroy(&crl->mutex);
+	pthread_rwlock_destroy(&crl->lock);
+	X509_STORE_free(crl->store);
+
+	return 0;
+}
+
+/** Load the CRLs for a TLS configuration, and start the thread to reload them
+ *
+ * @param[in] ctx	to allocate the index in.
+ * @param[in] conf	containing the CRL files and reload interval.
+ * @param[in] store	containing the CAs the CRLs are signed by.
+ * @return
+ *	- The new revocation index.
+ *	- NULL on error.
+ */
+fr_tls_crl_t *fr_tls_crl_alloc(TALLOC_CTX *ctx, fr_tls_conf_t const *conf, X509_STORE *store)
+{
+	fr_tls_crl_t	*crl;
+
+	MEM(crl = talloc_zero(ctx, fr_tls_crl_t));
+	crl->files = conf->crl_files;
+	crl->delta_files = conf->crl_delta_files;
+	crl->interval = conf->crl_reload_interval;
+	crl->allow_expired = conf->allow_expired_crl;
+
+	X509_STORE_up_ref(store);
+	crl->store = store;
+
+	pthread_rwlock_init(&crl->lock, NULL);
+	pthread_mutex_init(&crl->mutex, NULL);
+	pthread_cond_init(&crl->cond, NULL);
+	talloc_set_destructor(crl, _crl_free);
+
+	crl->files_mtime = crl_files_mtime(crl->files);
+	crl->delta_files_mtime = crl_files_mtime(crl->delta_files);
+
+	crl->base = crl_index_load(crl, store, crl->files, false);
+	crl->delta = crl_index_load(crl, store, crl->delta_files, true);
+	if (!crl->base || !crl->delta) {
+		talloc_free(crl);
+		return NULL;
+	}
+	DEBUG2("Loaded CRLs, %zu revoked serials, %zu delta serials", crl->base->entries, crl->delta->entries);
+
+	if (crl->interval) {
+		if (pthread_create(&crl->thread, NULL, crl_reload_thread, crl) != 0) {
+			ERROR("Failed creating CRL reload thread: %s", fr_syserror(errno));
+			talloc_free(crl);
+			return NULL;
+		}
+		crl->running = true;
+	}
+
+	return crl;
+}
+
+/** Check whether a certificate has been revoked
+ *
+ * Only certificates issued by a CA with a CRL in the index are checked.
+ *
+ * @param[in] crl	revocation index.
+ * @param[in] cert	to check.
+ * @return
+ *	- X509_V_OK if the certificate hasn't been revoked.
+ *	- X509_V_ERR_CERT_REVOKED if it has.
+ *	- X509_V_ERR_CRL_HAS_EXPIRED if the issuer's CRL has expired,
+ *	  and expired CRLs aren't allowed.
+ */
+int fr_tls_crl_check(fr_tls_crl_t *crl, X509 *cert)
+{
+	ASN1_INTEGER const	*serial = X509_get0_serialNumber(cert);
+	X509_NAME		*issuer = X509_get_issuer_name(cert);
+	crl_issuer_t		*ci;
+	crl_serial_t		*found;
+	int			ret = X509_V_OK;
+
+	if ((size_t)ASN1_STRING_length(serial) > CRL_SERIAL_MAX) return X509_V_OK;
+
+	pthread_rwlock_rdlock(&crl->lock);
+
+	ci = crl_index_issuer(crl->delta, issuer);
+	found = ci ? crl_issuer_find(ci, ASN1_STRING_get0_data(serial), ASN1_STRING_length(serial)) : NULL;
+	if (found) {
+		if (!found->remove) ret = X509_V_ERR_CERT_REVOKED;
+		goto finish;
+	}
+
+	ci = crl_index_issuer(crl->base, issuer);
+	if (!ci) goto finish;
+
+	if (!crl->allow_expired && ci->next_update && (ci->next_update < time(NULL))) {
+		ret = X509_V_ERR_CRL_HAS_EXPIRED;
+		goto finish;
+	}
+
+	if (crl_issuer_find(ci, ASN1_STRING_get0_data(serial), ASN1_STRING_length(serial))) {
+		ret = X509_V_ERR_CERT_REVOKED;
+	}
+
+finish:
+	pthread_rwlock_unlock(&crl->lock);
+
+	return ret;
+}
+#endif
+#endif /* WITH_TLS */
@@ -445,6 +445,15 @@ SSL_CTX *fr_tls_ctx_alloc(fr_tls_conf_t const *conf, bool client)
 			mode |= SSL_MODE_AUTO_RETRY;
 		}
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		/*
+		 *	Run handshakes in ASYNC_JOBs, so an async
+		 *	capable engine can pause them whilst it
+		 *	performs private key operations.
+		 */
+		if (conf->async) mode |= SSL_MODE_ASYNC;
+#endif
+
 		if (mode) SSL_CTX_set_mode(ctx, mode);
 	}
 
@@ -790,6 +799,17 @@ post_ca:
 	verify_mode |= SSL_VERIFY_CLIENT_ONCE;
 	SSL_CTX_set_verify(ctx, verify_mode, fr_tls_validate_cert_cb);
 
+	/*
+	 *	Skip building and checking chains we've recently
+	 *	verified.  The per-certificate checks in
+	 *	fr_tls_validate_cert_cb are still run.
+	 */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (!client && conf->verify_cache_lifetime) {
+		SSL_CTX_set_cert_verify_callback(ctx, fr_tls_validate_cert_chain_cb, NULL);
+	}
+#endif
+
 	if (conf->verify_depth) {
 		SSL_CTX_set_verify_depth(ctx, conf->verify_depth);
 	}
@@ -864,7 +884,7 @@ post_ca:
 	/*
 	 *	Setup session caching
 	 */
-	fr_tls_cache_init(ctx, conf->session_cache_server ? true : false, conf->session_cache_lifetime);
+	fr_tls_cache_init(ctx, (conf->session_cache_server || conf->session_cache_mem), conf->session_cache_lifetime);
 
 	return ctx;
 }
@@ -326,6 +326,9 @@ int fr_tls_log_io_error(request_t *request, fr_tls_session_t *session, int ret,
 	case SSL_ERROR_WANT_WRITE:
 	case SSL_ERROR_WANT_X509_LOOKUP:
 	case SSL_ERROR_ZERO_RETURN:
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	case SSL_ERROR_WANT_ASYNC:
+#endif
 		break;
 
 	/*
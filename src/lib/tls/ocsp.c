@@ -34,11 +34,14 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/util/debug.h>
 
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/hash.h>
 
 #include <freeradius-devel/unlang/compile.h>
 
 #include <openssl/ocsp.h>
 
+#include <pthread.h>
+
 #include "attrs.h"
 #include "base.h"
 #include "missing.h"
@@ -57,6 +60,250 @@ typedef enum {
  */
 #define OCSP_MAX_VALIDITY_PERIOD (5 * 60)
 
+/** How long before a cached response expires we start trying to refresh it
+ *
+ */
+#define OCSP_CACHE_REFRESH (60)
+
+/** How long to wait before another request retries a failed refresh
+ *
+ */
+#define OCSP_CACHE_REFRESH_RETRY (10)
+
+/*
+ *	In-memory OCSP response cache
+ *
+ *	Responses are keyed by the DER encoding of the OCSP_CERTID,
+ *	i.e. the issuer name and key hashes, and the serial number
+ *	of the certificate being checked.  Only definitive answers
+ *	(good or revoked) are cached, and entries expire at the
+ *	response's nextUpdate, capped at cache_max_age.
+ *
+ *	Once an entry is within OCSP_CACHE_REFRESH seconds of
+ *	expiring, the first request to see it queries the responder
+ *	again, while concurrent requests carry on using the cached
+ *	response.  If that refresh fails, another request will try
+ *	again after OCSP_CACHE_REFRESH_RETRY seconds, until the entry
+ *	expires.  This means that, under load, the responder is only
+ *	queried once per certificate per validity period, and
+ *	requests don't stall when the cached response goes stale.
+ */
+typedef struct {
+	uint8_t			*key;		//!< DER encoded OCSP_CERTID.
+	size_t			key_len;
+
+	ocsp_status_t		status;		//!< OCSP_STATUS_OK or OCSP_STATUS_FAILED (revoked).
+	uint8_t			*resp;		//!< DER encoded OCSP_RESPONSE, for stapling.
+	size_t			resp_len;
+
+	time_t			expires;	//!< When the entry should no longer be used.
+	time_t			refresh;	//!< When we should next try to refresh the entry.
+
+	fr_tls_ocsp_cache_t	*cache;		//!< Cache this entry belongs to.
+	fr_dlist_t		entry;		//!< Entry in the insertion order list.
+} fr_tls_ocsp_cache_entry_t;
+
+struct fr_tls_ocsp_cache_s {
+	pthread_mutex_t		mutex;		//!< Protects the hash table and list.
+	fr_hash_table_t		*ht;		//!< Entries, keyed by cert ID.
+	fr_dlist_head_t		order;		//!< Entries in insertion order, oldest first.
+	uint32_t		max_entries;	//!< Maximum entries in the cache, 0 for no limit.
+};
+
+static uint32_t ocsp_cache_entry_hash(void const *data)
+{
+	fr_tls_ocsp_cache_entry_t const *entry = data;
+
+	return fr_hash(entry->key, entry->key_len);
+}
+
+static int ocsp_cache_entry_cmp(void const *one, void const *two)
+{
+	fr_tls_ocsp_cache_entry_t const *a = one, *b = two;
+
+	if (a->key_len != b->key_len) return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static int _ocsp_cache_entry_free(fr_tls_ocsp_cache_entry_t *entry)
+{
+	fr_dlist_remove(&entry->cache->order, entry);
+
+	return 0;
+}
+
+static void ocsp_cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static int _ocsp_cache_free(fr_tls_ocsp_cache_t *cache)
+{
+	TALLOC_FREE(cache->ht);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate an in-memory OCSP response cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of responses to hold.  0 for no limit.
+ * @return
+ *	- The new cache.
+ *	- NULL on error.
+ */
+fr_tls_ocsp_cache_t *fr_tls_ocsp_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries)
+{
+	fr_tls_ocsp_cache_t *cache;
+
+	cache = talloc_zero(ctx, fr_tls_ocsp_cache_t);
+	if (!cache) return NULL;
+
+	cache->ht = fr_hash_table_create(cache, ocsp_cache_entry_hash, ocsp_cache_entry_cmp, ocsp_cache_entry_free);
+	if (!cache->ht) {
+		talloc_free(cache);
+		return NULL;
+	}
+	fr_dlist_init(&cache->order, fr_tls_ocsp_cache_entry_t, entry);
+	pthread_mutex_init(&cache->mutex, NULL);
+	cache->max_entries = max_entries;
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	return cache;
+}
+
+/** Serialise a cert ID, for use as a cache key
+ *
+ * @return
+ *	- The length of the key.
+ *	- 0 on error.
+ */
+static size_t ocsp_cache_key(uint8_t **out, OCSP_CERTID *certid)
+{
+	int len;
+
+	*out = NULL;
+	len = i2d_OCSP_CERTID(certid, out);
+	if (len <= 0) return 0;
+
+	return (size_t)len;
+}
+
+/** Look up a cached response
+ *
+ * @param[out] resp	The cached OCSP response.  Must be freed by the caller.
+ * @param[in] request	The current request.
+ * @param[in] cache	to search in.
+ * @param[in] certid	of the certificate being checked.
+ * @return
+ *	- OCSP_STATUS_OK or OCSP_STATUS_FAILED if a usable response was found.
+ *	- OCSP_STATUS_SKIPPED if there's no cached response, or this request
+ *	  should refresh it.
+ */
+static ocsp_status_t ocsp_cache_find(OCSP_RESPONSE **resp, request_t *request,
+				     fr_tls_ocsp_cache_t *cache, OCSP_CERTID *certid)
+{
+	fr_tls_ocsp_cache_entry_t	*entry, find = { .key = NULL };
+	ocsp_status_t			status = OCSP_STATUS_SKIPPED;
+	time_t				now = time(NULL);
+
+	*resp = NULL;
+
+	find.key_len = ocsp_cache_key(&find.key, certid);
+	if (!find.key_len) return OCSP_STATUS_SKIPPED;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (!entry) {
+		RDEBUG2("No cached OCSP response found");
+		goto done;
+	}
+
+	if (entry->expires <= now) {
+		RDEBUG2("Cached OCSP response has expired");
+		fr_hash_table_delete(cache->ht, entry);
+		goto done;
+	}
+
+	if (entry->refresh <= now) {
+		RDEBUG2("Cached OCSP response expires in %u seconds, refreshing", (unsigned int)(entry->expires - now));
+		entry->refresh = now + OCSP_CACHE_REFRESH_RETRY;
+		goto done;
+	}
+
+	if (entry->resp) {
+		uint8_t const *p = entry->resp;
+
+		*resp = d2i_OCSP_RESPONSE(NULL, &p, entry->resp_len);
+	}
+	status = entry->status;
+
+	RDEBUG2("Using cached OCSP response, expires in %u seconds", (unsigned int)(entry->expires - now));
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+	OPENSSL_free(find.key);
+
+	return status;
+}
+
+/** Add a response to the cache
+ *
+ * Replaces any existing entry for the same cert ID.  If the cache is full,
+ * the oldest entry is evicted.
+ */
+static void ocsp_cache_insert(request_t *request, fr_tls_ocsp_conf_t *conf, OCSP_CERTID *certid,
+			      ocsp_status_t status, OCSP_RESPONSE *resp, time_t expires)
+{
+	fr_tls_ocsp_cache_t		*cache = conf->cache_mem;
+	fr_tls_ocsp_cache_entry_t	*entry;
+	uint8_t				*key = NULL, *p;
+	size_t				key_len;
+	int				len;
+	time_t				now = time(NULL);
+
+	if (conf->cache_max_age && (expires > (now + conf->cache_max_age))) expires = now + conf->cache_max_age;
+	if (expires <= now) return;
+
+	key_len = ocsp_cache_key(&key, certid);
+	if (!key_len) return;
+
+	len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (len <= 0) {
+		OPENSSL_free(key);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	if (cache->max_entries && (fr_dlist_num_elements(&cache->order) >= cache->max_entries)) {
+		fr_hash_table_delete(cache->ht, fr_dlist_head(&cache->order));
+	}
+
+	MEM(entry = talloc_zero(cache->ht, fr_tls_ocsp_cache_entry_t));
+	MEM(entry->key = talloc_memdup(entry, key, key_len));
+	entry->key_len = key_len;
+	OPENSSL_free(key);
+
+	fr_hash_table_delete(cache->ht, entry);
+
+	MEM(entry->resp = p = talloc_array(entry, uint8_t, len));
+	entry->resp_len = i2d_OCSP_RESPONSE(resp, &p);
+	entry->status = status;
+	entry->expires = expires;
+	entry->refresh = expires - OCSP_CACHE_REFRESH;
+	entry->cache = cache;
+
+	fr_dlist_insert_tail(&cache->order, entry);
+	talloc_set_destructor(entry, _ocsp_cache_entry_free);
+
+	if (!fr_hash_table_insert(cache->ht, entry)) talloc_free(entry);
+	pthread_mutex_unlock(&cache->mutex);
+
+	RDEBUG2("Cached OCSP response for %u seconds", (unsigned int)(expires - now));
+}
+
 /** Extract components of OCSP responser URL from a certificate
  *
  * @param[in] cert to extract URL from.
@@ -350,6 +597,7 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 	int		reason;
 	OCSP_REQ_CTX	*ctx;
 	int		rc;
+	time_t		expires = 0;
 
 	fr_time_t	start;
 	fr_pair_t	*vp;
@@ -441,6 +689,18 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 	OCSP_request_add0_id(req, certid);
 	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
 
+	/*
+	 *	See if another request has already asked about
+	 *	this certificate.
+	 */
+	if (conf->cache_mem) {
+		ocsp_status = ocsp_cache_find(&resp, request, conf->cache_mem, certid);
+		if (ocsp_status == OCSP_STATUS_FAILED) REDEBUG("Cert status: revoked");
+		if (ocsp_status != OCSP_STATUS_SKIPPED) goto finish;
+
+		ocsp_status = OCSP_STATUS_FAILED;
+	}
+
 	/*
 	 *	Send OCSP Request and get OCSP Response
 	 */
@@ -613,7 +873,6 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 	 */
 	if (next_update) {
 		fr_time_t	now;
-		time_t		next;
 
 		/*
 		 *	Sometimes we already know what 'now' is depending
@@ -621,16 +880,16 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 		 */
 		now = fr_time();
 
-		if (fr_tls_utils_asn1time_to_epoch(&next, next_update) < 0) {
+		if (fr_tls_utils_asn1time_to_epoch(&expires, next_update) < 0) {
 			RPEDEBUG("Failed parsing next_update time");
 			ocsp_status = OCSP_STATUS_SKIPPED;
 			goto finish;
 		}
-		if (fr_time_to_sec(now) < next){
+		if (fr_time_to_sec(now) < expires){
 			RDEBUG2("Adding OCSP TTL attribute");
 
 			MEM(pair_update_request(&vp, attr_tls_ocsp_next_update) >= 0);
-			vp->vp_uint32 = next - fr_time_to_sec(now);
+			vp->vp_uint32 = expires - fr_time_to_sec(now);
 			RINDENT();
 			RDEBUG2("&%pP", vp);
 			REXDENT();
@@ -666,6 +925,16 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 		break;
 	}
 
+	/*
+	 *	Responses without a nextUpdate are cached for
+	 *	cache_max_age.  Unknown statuses aren't cached, as
+	 *	the responder may know about the cert soon.
+	 */
+	if (conf->cache_mem && ((status == V_OCSP_CERTSTATUS_GOOD) || (status == V_OCSP_CERTSTATUS_REVOKED))) {
+		ocsp_cache_insert(request, conf, certid, ocsp_status, resp,
+				  next_update ? expires : time(NULL) + conf->cache_max_age);
+	}
+
 finish:
 	switch (ocsp_status) {
 	case OCSP_STATUS_OK:
@@ -34,6 +34,8 @@
 #include <freeradius-devel/util/hex.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/pair_legacy.h>
+#include <freeradius-devel/util/thread_local.h>
+#include <freeradius-devel/unlang/base.h>
 
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
@@ -1320,6 +1322,12 @@ static void fr_tls_session_alert_send(request_t *request, fr_tls_session_t *sess
  * Advance the TLS handshake by feeding OpenSSL data from dirty_in,
  * and reading data from OpenSSL into dirty_out.
  *
+ * If an async engine paused the handshake whilst it performs a crypto
+ * operation, this returns success with no data in dirty_out, and
+ * #fr_tls_session_async_pending will return true.  The caller should
+ * wait for the operation to complete with #fr_tls_session_async_wait,
+ * then call this function again.
+ *
  * @param request The current request.
  * @param session The current TLS session.
  * @return
@@ -1400,6 +1408,12 @@ int fr_tls_session_handshake(request_t *request, fr_tls_session_t *session)
 	 */
 	if (fr_tls_log_io_error(request, session, ret, "Failed in SSL_read") < 0) goto error;
 
+	if (fr_tls_session_async_pending(session)) {
+		RDEBUG2("Handshake paused waiting for async crypto operation");
+		ret = 0;
+		goto finish;
+	}
+
 	/*
 	 *	This only occurs once per session, where calling
 	 *	SSL_read updates the state of the SSL session, setting
@@ -1543,6 +1557,201 @@ finish:
 	return ret;
 }
 
+/** Whether the handshake is paused, waiting for an async crypto operation to complete
+ *
+ * @param session The current TLS session.
+ * @return
+ *	- true if an async job is in progress.
+ *	- false otherwise.
+ */
+bool fr_tls_session_async_pending(fr_tls_session_t *session)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	return (SSL_waiting_for_async(session->ssl) == 1);
+#else
+	return false;
+#endif
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void _tls_session_async_done(UNUSED module_ctx_t const *mctx, request_t *request,
+				    UNUSED void *rctx, UNUSED int fd)
+{
+	unlang_interpret_mark_resumable(request);
+}
+#endif
+
+/** Wait for an async crypto operation to complete
+ *
+ * Registers the async job's file descriptors with the request's event
+ * list.  The request is marked resumable when the engine signals any
+ * of them.  The caller should then yield.
+ *
+ * @param request The current request.
+ * @param session The current TLS session.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_tls_session_async_wait(request_t *request, fr_tls_session_t *session)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	OSSL_ASYNC_FD	*fds;
+	size_t		num_fds = 0, i;
+
+	if ((SSL_get_all_async_fds(session->ssl, NULL, &num_fds) != 1) || (num_fds == 0)) {
+		REDEBUG("Async crypto operation has no file descriptors to wait on");
+		return -1;
+	}
+
+	MEM(fds = talloc_array(request, OSSL_ASYNC_FD, num_fds));
+	if (SSL_get_all_async_fds(session->ssl, fds, &num_fds) != 1) {
+		REDEBUG("Failed retrieving async file descriptors");
+	error:
+		talloc_free(fds);
+		return -1;
+	}
+
+	for (i = 0; i < num_fds; i++) {
+		if (unlang_module_fd_add(request, _tls_session_async_done, NULL, _tls_session_async_done,
+					 session, fds[i]) < 0) {
+			REDEBUG("Failed adding async file descriptor %d to event loop", fds[i]);
+			goto error;
+		}
+	}
+	talloc_free(fds);
+
+	return 0;
+#else
+	REDEBUG("Async crypto operations require OpenSSL >= 1.1.0");
+	return -1;
+#endif
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/*
+ *	Per-thread pool of SSL objects
+ *
+ *	SSL_new() allocates and initialises a surprising amount of
+ *	state, so instead of freeing the SSL objects of server
+ *	sessions, we reset them with SSL_clear(), and hand them out
+ *	again for the next session using the same SSL_CTX.
+ *
+ *	Everything specific to the old session, i.e. the SSL_SESSION,
+ *	BIOs and ex_data, is removed before the object goes back in
+ *	the pool.  Everything else is set again by
+ *	fr_tls_session_init_server().
+ */
+#define TLS_SSL_POOL_MAX (32)
+
+typedef struct {
+	SSL		*ssl[TLS_SSL_POOL_MAX];		//!< Free SSL objects, oldest first.
+	unsigned int	num;				//!< Number of SSL objects in the pool.
+} tls_ssl_pool_t;
+
+static _Thread_local tls_ssl_pool_t *tls_ssl_pool; /* macro */
+
+/** Free any pooled SSL objects when the thread is joined
+ *
+ */
+static void _tls_ssl_pool_free_on_exit(void *arg)
+{
+	tls_ssl_pool_t *pool = talloc_get_type_abort(arg, tls_ssl_pool_t);
+
+	while (pool->num) SSL_free(pool->ssl[--pool->num]);
+	talloc_free(pool);
+}
+
+/** Return the SSL object pool for this thread, creating it if necessary
+ *
+ */
+static inline tls_ssl_pool_t *tls_ssl_pool_get(void)
+{
+	tls_ssl_pool_t *pool;
+
+	if (likely(tls_ssl_pool != NULL)) return tls_ssl_pool;
+
+	MEM(pool = talloc_zero(NULL, tls_ssl_pool_t));
+	fr_thread_local_set_destructor(tls_ssl_pool, _tls_ssl_pool_free_on_exit, pool);
+
+	return pool;
+}
+#endif
+
+/** Get an SSL object for a context, from the pool if possible
+ *
+ */
+static SSL *tls_ssl_alloc(SSL_CTX *ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	tls_ssl_pool_t	*pool = tls_ssl_pool_get();
+	unsigned int	i;
+
+	/*
+	 *	Search from the tail, the most recently
+	 *	released objects are likely to be warm.
+	 */
+	for (i = pool->num; i > 0; i--) {
+		SSL *ssl = pool->ssl[i - 1];
+
+		if (SSL_get_SSL_CTX(ssl) != ctx) continue;
+
+		memmove(&pool->ssl[i - 1], &pool->ssl[i], sizeof(pool->ssl[0]) * (pool->num - i));
+		pool->num--;
+
+		return ssl;
+	}
+#endif
+
+	return SSL_new(ctx);
+}
+
+/** Reset an SSL object, and return it to the pool
+ *
+ * If the pool is full, the oldest object in it is freed.
+ */
+static void tls_ssl_release(SSL *ssl)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	tls_ssl_pool_t	*pool;
+	int		i;
+
+	/*
+	 *	Can't reset an SSL object which is in the
+	 *	middle of an async crypto operation.
+	 */
+	if (SSL_waiting_for_async(ssl)) {
+		SSL_free(ssl);
+		return;
+	}
+
+	/*
+	 *	SSL_clear() keeps the session if the connection
+	 *	was shut down cleanly.  It must never be offered
+	 *	to another peer.
+	 */
+	SSL_set_session(ssl, NULL);
+	SSL_set_bio(ssl, NULL, NULL);
+	SSL_set_msg_callback_arg(ssl, NULL);
+	for (i = FR_TLS_EX_INDEX_EAP_SESSION; i <= FR_TLS_EX_INDEX_TALLOC; i++) SSL_set_ex_data(ssl, i, NULL);
+
+	if (SSL_clear(ssl) != 1) {
+		SSL_free(ssl);
+		return;
+	}
+	SSL_set_quiet_shutdown(ssl, SSL_CTX_get_quiet_shutdown(SSL_get_SSL_CTX(ssl)));
+
+	pool = tls_ssl_pool_get();
+	if (pool->num >= TLS_SSL_POOL_MAX) {
+		SSL_free(pool->ssl[0]);
+		memmove(&pool->ssl[0], &pool->ssl[1], sizeof(pool->ssl[0]) * (--pool->num));
+	}
+	pool->ssl[pool->num++] = ssl;
+#else
+	SSL_free(ssl);
+#endif
+}
+
 /** Free a TLS session and any associated OpenSSL data
  *
  * @param session to free.
@@ -1550,10 +1759,19 @@ finish:
  */
 static int _fr_tls_session_free(fr_tls_session_t *session)
 {
+	if (session->session_pending) {
+		SSL_SESSION_free(session->session_pending);
+		session->session_pending = NULL;
+	}
+
 	if (session->ssl) {
 		SSL_set_quiet_shutdown(session->ssl, 1);
 		SSL_shutdown(session->ssl);
-		SSL_free(session->ssl);
+		if (session->ssl_recycle) {
+			tls_ssl_release(session->ssl);
+		} else {
+			SSL_free(session->ssl);
+		}
 		session->ssl = NULL;
 	}
 
@@ -1675,7 +1893,7 @@ fr_tls_session_t *fr_tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *con
 	ssl_ctx = conf->ctx[(conf->ctx_count == 1) ? 0 : conf->ctx_next++ % conf->ctx_count];	/* mutex not needed */
 	fr_assert(ssl_ctx);
 
-	new_tls = SSL_new(ssl_ctx);
+	new_tls = tls_ssl_alloc(ssl_ctx);
 	if (new_tls == NULL) {
 		fr_tls_log_error(request, "Error creating new TLS session");
 		return NULL;
@@ -1690,6 +1908,7 @@ fr_tls_session_t *fr_tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *con
 	session_init(session);
 	session->ctx = ssl_ctx;
 	session->ssl = new_tls;
+	session->ssl_recycle = true;
 	talloc_set_destructor(session, _fr_tls_session_free);
 
 	fr_tls_session_request_bind(request, session->ssl);
@@ -1711,6 +1930,11 @@ fr_tls_session_t *fr_tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *con
 	 *	This means that all SSL IO is done to/from memory,
 	 *	and we can update those BIOs from the packets we've
 	 *	received.
+	 *
+	 *	It also means kernel TLS (SSL_OP_ENABLE_KTLS) can't be
+	 *	used.  OpenSSL only hands keys to the kernel when the
+	 *	SSL is attached to a socket BIO, and the records here
+	 *	are carried inside EAP packets, not over a socket.
 	 */
 	MEM(session->into_ssl = BIO_new(BIO_s_mem()));
 	MEM(session->from_ssl = BIO_new(BIO_s_mem()));
@@ -1772,6 +1996,12 @@ fr_tls_session_t *fr_tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *con
 	if (vp) {
 		RDEBUG2("Loading TLS session certificate \"%pV\"", &vp->data);
 
+		/*
+		 *	SSL_clear() doesn't remove certificates
+		 *	loaded into the SSL object.
+		 */
+		session->ssl_recycle = false;
+
 		if (SSL_use_certificate_file(session->ssl, vp->vp_strvalue, SSL_FILETYPE_PEM) != 1) {
 			fr_tls_log_error(request, "Failed loading TLS session certificate \"%s\"",
 				      vp->vp_strvalue);
@@ -1846,7 +2076,9 @@ fr_tls_session_t *fr_tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *con
 		session->mtu = vp->vp_uint32;
 	}
 
-	if (conf->session_cache_server) session->allow_session_resumption = true; /* otherwise it's false */
+	if (conf->session_cache_server || conf->session_cache_mem) {
+		session->allow_session_resumption = true; /* otherwise it's false */
+	}
 
 	fr_tls_session_request_unbind(session->ssl);
 
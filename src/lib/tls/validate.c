@@ -31,6 +31,7 @@
 #include <freeradius-devel/server/exec.h>
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
@@ -39,6 +40,307 @@
 #include "base.h"
 #include "missing.h"
 
+#include <pthread.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/*
+ *	Certificate verification cache
+ *
+ *	Verifying a chain means building it from the store, checking
+ *	each signature, and searching the CRLs for each certificate.
+ *	When the same supplicants reconnect, that's repeated for
+ *	every handshake, with the same result.
+ *
+ *	Entries are keyed by a hash of the peer's certificate, and
+ *	the untrusted certificates it sent with it, and hold the
+ *	chain OpenSSL built.  The CAs and CRLs are loaded when the
+ *	TLS configuration is parsed, and the cache belongs to that
+ *	configuration, so entries can't outlive the store which
+ *	verified them.
+ *
+ *	Only successful verifications are cached, so failures are
+ *	always logged in full.  Entries expire after the configured
+ *	lifetime, or when the first certificate in the chain expires,
+ *	whichever is sooner.
+ */
+typedef struct {
+	uint8_t			key[SHA256_DIGEST_LENGTH];
+	STACK_OF(X509)		*chain;		//!< Verified chain, leaf first.
+	time_t			expires;	//!< When the entry should no longer be used.
+
+	fr_tls_verify_cache_t	*cache;		//!< Cache this entry belongs to.
+	fr_dlist_t		entry;		//!< Entry in the insertion order list.
+} fr_tls_verify_cache_entry_t;
+
+struct fr_tls_verify_cache_s {
+	pthread_mutex_t		mutex;		//!< Protects the hash table and list.
+	fr_hash_table_t		*ht;		//!< Entries, keyed by chain hash.
+	fr_dlist_head_t		order;		//!< Entries in insertion order, oldest first.
+	uint32_t		lifetime;	//!< Maximum lifetime of an entry.
+	uint32_t		max_entries;	//!< Maximum entries, 0 for no limit.
+};
+
+static uint32_t verify_cache_entry_hash(void const *data)
+{
+	fr_tls_verify_cache_entry_t const *entry = data;
+
+	/*
+	 *	The key is already a SHA256 hash.
+	 */
+	return fr_hash(entry->key, sizeof(uint32_t));
+}
+
+static int verify_cache_entry_cmp(void const *one, void const *two)
+{
+	fr_tls_verify_cache_entry_t const *a = one, *b = two;
+
+	return memcmp(a->key, b->key, sizeof(a->key));
+}
+
+static int _verify_cache_entry_free(fr_tls_verify_cache_entry_t *entry)
+{
+	fr_dlist_remove(&entry->cache->order, entry);
+	sk_X509_pop_free(entry->chain, X509_free);
+
+	return 0;
+}
+
+static void verify_cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static int _verify_cache_free(fr_tls_verify_cache_t *cache)
+{
+	TALLOC_FREE(cache->ht);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a certificate verification cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] lifetime		Maximum time, in seconds, a result is cached for.
+ * @param[in] max_entries	Maximum number of chains to hold.  0 for no limit.
+ * @return
+ *	- The new cache.
+ *	- NULL on error.
+ */
+fr_tls_verify_cache_t *fr_tls_verify_cache_alloc(TALLOC_CTX *ctx, uint32_t lifetime, uint32_t max_entries)
+{
+	fr_tls_verify_cache_t	*cache;
+
+	cache = talloc_zero(ctx, fr_tls_verify_cache_t);
+	if (!cache) return NULL;
+
+	cache->ht = fr_hash_table_create(cache, verify_cache_entry_hash,
+					 verify_cache_entry_cmp, verify_cache_entry_free);
+	if (!cache->ht) {
+		talloc_free(cache);
+		return NULL;
+	}
+	fr_dlist_init(&cache->order, fr_tls_verify_cache_entry_t, entry);
+	pthread_mutex_init(&cache->mutex, NULL);
+	cache->lifetime = lifetime;
+	cache->max_entries = max_entries;
+	talloc_set_destructor(cache, _verify_cache_free);
+
+	return cache;
+}
+
+/** Hash the peer's certificate, and the untrusted certificates sent with it
+ *
+ */
+static int verify_cache_key(uint8_t key[static SHA256_DIGEST_LENGTH], X509_STORE_CTX *x509_ctx)
+{
+	EVP_MD_CTX	*md_ctx;
+	STACK_OF(X509)	*untrusted;
+	uint8_t		digest[EVP_MAX_MD_SIZE];
+	unsigned int	len;
+	int		i, ret = -1;
+
+	md_ctx = EVP_MD_CTX_new();
+	if (!md_ctx) return -1;
+
+	if (EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) != 1) goto finish;
+
+	if ((X509_digest(X509_STORE_CTX_get0_cert(x509_ctx), EVP_sha256(), digest, &len) != 1) ||
+	    (EVP_DigestUpdate(md_ctx, digest, len) != 1)) goto finish;
+
+	untrusted = X509_STORE_CTX_get0_untrusted(x509_ctx);
+	for (i = 0; i < sk_X509_num(untrusted); i++) {
+		if ((X509_digest(sk_X509_value(untrusted, i), EVP_sha256(), digest, &len) != 1) ||
+		    (EVP_DigestUpdate(md_ctx, digest, len) != 1)) goto finish;
+	}
+
+	len = SHA256_DIGEST_LENGTH;
+	if (EVP_DigestFinal_ex(md_ctx, key, &len) == 1) ret = 0;
+
+finish:
+	EVP_MD_CTX_free(md_ctx);
+
+	return ret;
+}
+
+/** Find a verified chain in the cache
+ *
+ * Expired entries are removed, and not returned.
+ *
+ * @return
+ *	- The cached chain, with a reference added for the caller.
+ *	- NULL if no valid entry was found.
+ */
+static STACK_OF(X509) *verify_cache_find(fr_tls_verify_cache_t *cache, uint8_t const key[static SHA256_DIGEST_LENGTH])
+{
+	fr_tls_verify_cache_entry_t	*entry, find;
+	STACK_OF(X509)			*chain = NULL;
+
+	memcpy(find.key, key, sizeof(find.key));
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (entry) {
+		if (entry->expires <= time(NULL)) {
+			fr_hash_table_delete(cache->ht, entry);
+		} else {
+			chain = X509_chain_up_ref(entry->chain);
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return chain;
+}
+
+/** Insert a verified chain into the cache
+ *
+ * Replaces any existing entry with the same key.  If the cache is full,
+ * the oldest entry is evicted.
+ */
+static void verify_cache_insert(fr_tls_verify_cache_t *cache, uint8_t const key[static SHA256_DIGEST_LENGTH],
+				STACK_OF(X509) *chain)
+{
+	fr_tls_verify_cache_entry_t	*entry, find;
+	time_t				now = time(NULL), expires;
+	int				i;
+
+	expires = now + cache->lifetime;
+
+	/*
+	 *	Don't cache the chain past the point where
+	 *	one of its certificates expires.
+	 */
+	for (i = 0; i < sk_X509_num(chain); i++) {
+		int	days, secs;
+		time_t	not_after;
+
+		if (!ASN1_TIME_diff(&days, &secs, NULL, X509_get0_notAfter(sk_X509_value(chain, i)))) return;
+
+		not_after = now + ((time_t)days * 86400) + secs;
+		if (not_after <= now) return;
+		if (not_after < expires) expires = not_after;
+	}
+
+	memcpy(find.key, key, sizeof(find.key));
+
+	pthread_mutex_lock(&cache->mutex);
+	fr_hash_table_delete(cache->ht, &find);
+
+	if (cache->max_entries && (fr_dlist_num_elements(&cache->order) >= cache->max_entries)) {
+		fr_hash_table_delete(cache->ht, fr_dlist_head(&cache->order));
+	}
+
+	entry = talloc_zero(cache->ht, fr_tls_verify_cache_entry_t);
+	if (!entry) {
+	error:
+		pthread_mutex_unlock(&cache->mutex);
+		return;
+	}
+	memcpy(entry->key, key, sizeof(entry->key));
+	entry->expires = expires;
+	entry->cache = cache;
+
+	entry->chain = X509_chain_up_ref(chain);
+	if (!entry->chain) {
+		talloc_free(entry);
+		goto error;
+	}
+
+	fr_dlist_insert_tail(&cache->order, entry);
+	talloc_set_destructor(entry, _verify_cache_entry_free);
+
+	if (!fr_hash_table_insert(cache->ht, entry)) talloc_free(entry);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Verify a certificate chain, using the result of a previous verification if we have one
+ *
+ * Installed with SSL_CTX_set_cert_verify_callback, so it replaces OpenSSL's
+ * call to X509_verify_cert.
+ *
+ * If the chain was verified recently, the chain built by that verification
+ * is reused, and #fr_tls_validate_cert_cb is called for each certificate in
+ * it, the same way X509_verify_cert would.  That means the session-state
+ * attributes, the issuer and CN checks, the external verification command,
+ * and OCSP, are all still done for every handshake.  Only building the chain
+ * and checking its signatures, and CRLs, are skipped.
+ *
+ * @param[in] x509_ctx	containing the certs to verify.
+ * @param[in] arg	unused.
+ * @return
+ *	- 1 if the chain is valid.
+ *	- 0 if the chain is not valid.
+ */
+int fr_tls_validate_cert_chain_cb(X509_STORE_CTX *x509_ctx, UNUSED void *arg)
+{
+	SSL		*ssl;
+	fr_tls_conf_t	*conf;
+	request_t	*request;
+	STACK_OF(X509)	*chain;
+	uint8_t		key[SHA256_DIGEST_LENGTH];
+	int		i, ret;
+
+	ssl = X509_STORE_CTX_get_ex_data(x509_ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+	conf = talloc_get_type_abort(SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF), fr_tls_conf_t);
+	request = talloc_get_type_abort(SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST), request_t);
+
+	if (!conf->verify_cache || (verify_cache_key(key, x509_ctx) < 0)) return X509_verify_cert(x509_ctx);
+
+	chain = verify_cache_find(conf->verify_cache, key);
+	if (!chain) {
+		ret = X509_verify_cert(x509_ctx);
+		if (ret == 1) verify_cache_insert(conf->verify_cache, key, X509_STORE_CTX_get0_chain(x509_ctx));
+		return ret;
+	}
+
+	RDEBUG2("Certificate chain was verified recently, skipping chain verification");
+
+	/*
+	 *	The store ctx owns the chain from here on.
+	 */
+	X509_STORE_CTX_set0_verified_chain(x509_ctx, chain);
+
+	/*
+	 *	Call the verify callback root first, the same
+	 *	order X509_verify_cert would.
+	 */
+	for (i = sk_X509_num(chain) - 1; i >= 0; i--) {
+		X509_STORE_CTX_set_error_depth(x509_ctx, i);
+		X509_STORE_CTX_set_current_cert(x509_ctx, sk_X509_value(chain, i));
+		X509_STORE_CTX_set_error(x509_ctx, X509_V_OK);
+
+		if (!fr_tls_validate_cert_cb(1, x509_ctx)) {
+			if (X509_STORE_CTX_get_error(x509_ctx) == X509_V_OK) {
+				X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
+			}
+			return 0;
+		}
+	}
+
+	return 1;
+}
+#endif
+
 /** Validates a certificate using custom logic
  *
  * Before trusting a certificate, we make sure that the certificate is
@@ -196,6 +498,21 @@ int fr_tls_validate_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 		X509_STORE_CTX_set_error(x509_ctx, 0);
 	}
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	/*
+	 *	Check the certificate against our own index of
+	 *	the CRLs, which OpenSSL doesn't know about.
+	 */
+	if (my_ok && conf->crl) {
+		err = fr_tls_crl_check(conf->crl, cert);
+		if ((err == X509_V_ERR_CRL_HAS_EXPIRED) && conf->allow_expired_crl) err = X509_V_OK;
+		if (err != X509_V_OK) {
+			X509_STORE_CTX_set_error(x509_ctx, err);
+			my_ok = 0;
+		}
+	}
+#endif
+
 	if (!my_ok) {
 		char const *p = X509_verify_cert_error_string(err);
 		RERROR("TLS error: %s (%i)", p, err);
@@ -340,6 +657,18 @@ int fr_tls_validate_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 		 *	return code.
 		 */
 		issuer_cert = X509_STORE_CTX_get0_current_issuer(x509_ctx);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		/*
+		 *	The current issuer isn't set if the chain came
+		 *	from the verify cache, but it's the next cert
+		 *	in the chain.
+		 */
+		if (!issuer_cert) {
+			STACK_OF(X509) *our_chain = X509_STORE_CTX_get0_chain(x509_ctx);
+
+			if (sk_X509_num(our_chain) > 1) issuer_cert = sk_X509_value(our_chain, 1);
+		}
+#endif
 		my_ok = fr_tls_ocsp_check(request, ssl, conf->ocsp.store, issuer_cert, cert, &(conf->ocsp), false);
 	}
 #endif
@@ -1740,8 +1740,17 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ct
 		 *	conditions.
 		 */
 		switch (single->type) {
-		case UNLANG_TYPE_ELSIF:
 		case UNLANG_TYPE_IF:
+			/*
+			 *	A new "if" starts a new chain, so
+			 *	an "if" or "elsif" that was always
+			 *	taken in a previous chain doesn't
+			 *	mean we skip this chain's "else".
+			 */
+			skip_else = NULL;
+			FALL_THROUGH;
+
+		case UNLANG_TYPE_ELSIF:
 			was_if = true;
 			{
 				unlang_group_t		*f;
@@ -1868,6 +1877,107 @@ static unlang_t *compile_group(unlang_t *parent, unlang_compile_t *unlang_ctx, C
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs);
 
+static uint32_t case_hash(void const *data)
+{
+	unlang_case_t const *a = data;
+
+	return fr_value_box_hash_update(tmpl_value(a->vpt), 0);
+}
+
+static int case_cmp(void const *one, void const *two)
+{
+	unlang_case_t const *a = one;
+	unlang_case_t const *b = two;
+
+	return fr_value_box_cmp(tmpl_value(a->vpt), tmpl_value(b->vpt));
+}
+
+/** Whether cond_eval() would compare two strings as numbers
+ *
+ */
+static bool case_is_number(char const *p)
+{
+	if (*p == '\0') return false;
+
+	if (*p == '-') p++;
+
+	while (isdigit((int) *p)) p++;
+
+	return (*p == '\0');
+}
+
+/** Index literal "case" statements by value
+ *
+ * If we're switching over an attribute, and every "case" is a
+ * literal of the same data type, then the matching "case" can be
+ * found with one hash lookup, instead of comparing each "case" in
+ * turn.  Otherwise we leave gext->cases as NULL, and unlang_switch()
+ * does the comparisons.
+ *
+ * This is only done for data types where "==" is an exact
+ * comparison of the values.
+ */
+static void compile_switch_cases(unlang_switch_t *gext)
+{
+	unlang_group_t		*g = unlang_switch_to_group(gext);
+	unlang_t		*this, *default_case = NULL;
+	fr_dict_attr_t const	*da;
+	fr_hash_table_t		*cases;
+
+	if (!tmpl_is_attr(gext->vpt) || (gext->vpt->cast != FR_TYPE_INVALID)) return;
+
+	da = tmpl_da(gext->vpt);
+	switch (da->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_UINT64:
+	case FR_TYPE_INT32:
+	case FR_TYPE_SIZE:
+		break;
+
+	default:
+		return;
+	}
+
+	for (this = g->children; this; this = this->next) {
+		unlang_case_t *case_gext = unlang_group_to_case(unlang_generic_to_group(this));
+
+		if (!case_gext->vpt) {
+			if (!default_case) default_case = this;
+			continue;
+		}
+
+		if (!tmpl_is_data(case_gext->vpt) || (tmpl_value_type(case_gext->vpt) != da->type)) return;
+
+		/*
+		 *	Strings which are both numbers are compared
+		 *	as numbers, so "01" matches "1".
+		 */
+		if ((da->type == FR_TYPE_STRING) && case_is_number(tmpl_value(case_gext->vpt)->vb_strvalue)) return;
+	}
+
+	cases = fr_hash_table_create(gext, case_hash, case_cmp, NULL);
+	if (!cases) return;
+
+	/*
+	 *	If there are duplicate cases, the first one wins,
+	 *	just as it does when comparing them in turn.
+	 */
+	for (this = g->children; this; this = this->next) {
+		unlang_case_t *case_gext = unlang_group_to_case(unlang_generic_to_group(this));
+
+		if (!case_gext->vpt) continue;
+
+		(void) fr_hash_table_insert(cases, case_gext);
+	}
+
+	gext->cases = cases;
+	gext->default_case = default_case;
+}
+
 static unlang_t *compile_switch(UNUSED unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
 {
 	CONF_ITEM		*ci;
@@ -2020,6 +2130,8 @@ static unlang_t *compile_switch(UNUSED unlang_t *parent, unlang_compile_t *unlan
 		g->num_children++;
 	}
 
+	compile_switch_cases(gext);
+
 	compile_action_defaults(c, unlang_ctx);
 
 	return c;
@@ -2169,6 +2281,84 @@ static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CO
 	return c;
 }
 
+/** Check whether the body of a foreach loop may modify the list it iterates over
+ *
+ * This is conservative.  Anything which can run arbitrary code against
+ * the request (modules, calls, subrequests) is assumed to modify every
+ * list.
+ *
+ * @param[in] c		First instruction of the body.
+ * @param[in] vpt	the foreach loop iterates over.
+ * @return
+ *	- true if the list may be modified.
+ *	- false if the list is only ever read.
+ */
+static bool compile_foreach_body_mutates(unlang_t *c, tmpl_t const *vpt)
+{
+	unlang_group_t	*g;
+
+	for (; c != NULL; c = c->next) {
+		switch (c->type) {
+		case UNLANG_TYPE_MAP:
+		case UNLANG_TYPE_UPDATE:
+		case UNLANG_TYPE_FILTER:
+		{
+			unlang_map_t	*gext;
+			map_t		*map;
+
+			g = unlang_generic_to_group(c);
+			gext = unlang_group_to_map(g);
+			for (map = gext->map; map != NULL; map = map->next) {
+				if (!tmpl_is_attr(map->lhs) && !tmpl_is_attr_unresolved(map->lhs) &&
+				    !tmpl_is_list(map->lhs)) return true;
+
+				/*
+				 *	Request qualifiers may refer to
+				 *	the same request in different ways,
+				 *	so only the list is compared.
+				 */
+				if (tmpl_list(map->lhs) == tmpl_list(vpt)) return true;
+			}
+		}
+			break;
+
+		case UNLANG_TYPE_MODULE:
+		case UNLANG_TYPE_FUNCTION:
+		case UNLANG_TYPE_CALL:
+		case UNLANG_TYPE_SUBREQUEST:
+		case UNLANG_TYPE_PARALLEL:
+		case UNLANG_TYPE_XLAT:
+		case UNLANG_TYPE_TMPL:
+		case UNLANG_TYPE_NULL:
+		case UNLANG_TYPE_MAX:
+			return true;
+
+		case UNLANG_TYPE_CALLER:
+		case UNLANG_TYPE_CASE:
+		case UNLANG_TYPE_FOREACH:
+		case UNLANG_TYPE_ELSE:
+		case UNLANG_TYPE_ELSIF:
+		case UNLANG_TYPE_GROUP:
+		case UNLANG_TYPE_IF:
+		case UNLANG_TYPE_LOAD_BALANCE:
+		case UNLANG_TYPE_POLICY:
+		case UNLANG_TYPE_SWITCH:
+		case UNLANG_TYPE_REDUNDANT:
+		case UNLANG_TYPE_REDUNDANT_LOAD_BALANCE:
+			g = unlang_generic_to_group(c);
+			if (compile_foreach_body_mutates(g->children, vpt)) return true;
+			break;
+
+		case UNLANG_TYPE_BREAK:
+		case UNLANG_TYPE_DETACH:
+		case UNLANG_TYPE_RETURN:
+			break;
+		}
+	}
+
+	return false;
+}
+
 static unlang_t *compile_foreach(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
 {
 	fr_token_t		type;
@@ -2271,6 +2461,7 @@ static unlang_t *compile_foreach(unlang_t *parent, unlang_compile_t *unlang_ctx,
 	g = unlang_generic_to_group(c);
 	gext = unlang_group_to_foreach(g);
 	gext->vpt = vpt;
+	gext->copy = compile_foreach_body_mutates(g->children, vpt);
 
 	return c;
 }
@@ -2329,6 +2520,14 @@ static unlang_t *compile_detach(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		return NULL;
 	}
 
+	/*
+	 *	Only subrequests which contain a 'detach' need a child
+	 *	which can outlive the parent.  The others get a child
+	 *	which is bound to the parent, and is much cheaper to
+	 *	allocate.
+	 */
+	unlang_group_to_subrequest(unlang_generic_to_group(subrequest))->detachable = true;
+
 	/*
 	 *	This really overloads the functionality of
 	 *	cf_item_next().
@@ -2440,6 +2639,13 @@ static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlan
 		 *	them up.
 		 */
 		if (!fr_cond_walk(cond, pass2_cond_callback, cs)) return NULL;
+
+		/*
+		 *	Now that everything is resolved, evaluate
+		 *	cheap checks before expensive ones.
+		 */
+		fr_cond_reorder(cond);
+
 		c = compile_section(parent, unlang_ctx, cs, ext);
 	}
 	if (!c) return NULL;
@@ -2686,6 +2892,15 @@ static unlang_t *compile_load_balance_subsection(unlang_t *parent, unlang_compil
 		}
 	}
 
+	/*
+	 *	Plain "load-balance" tracks how long each child
+	 *	takes, so that it can prefer the faster ones.
+	 */
+	if (ext->type == UNLANG_TYPE_LOAD_BALANCE) {
+		gext = unlang_group_to_load_balance(g);
+		MEM(gext->stats = talloc_zero_array(gext, unlang_load_balance_child_t, g->num_children));
+	}
+
 	return c;
 }
 
@@ -2722,6 +2937,7 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 
 	bool				clone = true;
 	bool				detach = false;
+	unsigned long			max_active = 0;
 
 	static unlang_ext_t const 	parallel_ext = {
 						.type = UNLANG_TYPE_PARALLEL,
@@ -2745,6 +2961,15 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 		} else if (strcmp(name2, "detach") == 0) {
 			detach = true;
 
+		} else if (isdigit((int) *name2)) {
+			char *end;
+
+			max_active = strtoul(name2, &end, 10);
+			if (*end || !max_active || (max_active > INT_MAX)) {
+				cf_log_err(cs, "Invalid number of children '%s'", name2);
+				return NULL;
+			}
+
 		} else {
 			cf_log_err(cs, "Invalid argument '%s'", name2);
 			return NULL;
@@ -2767,6 +2992,7 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 	gext = unlang_group_to_parallel(g);
 	gext->clone = clone;
 	gext->detach = detach;
+	gext->max_active = max_active;
 
 	return c;
 }
@@ -50,8 +50,10 @@ typedef struct {
 	request_t		*request;			//!< The current request.
 	fr_cursor_t		cursor;				//!< Used to track our place in the list
 								///< we're iterating over.
-	fr_pair_list_t 		vps;				//!< List containing the attribute(s) we're
-								///< iterating over.
+	tmpl_cursor_ctx_t	cc;				//!< Used when iterating over the request's
+								///< list directly.
+	fr_pair_list_t 		vps;				//!< List containing copies of the attribute(s)
+								///< we're iterating over.
 	fr_pair_t		*variable;			//!< Attribute we update the value of.
 	int			depth;				//!< Level of nesting of this foreach loop.
 #ifndef NDEBUG
@@ -71,6 +73,7 @@ static ssize_t unlang_foreach_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t ou
 static int _free_unlang_frame_state_foreach(unlang_frame_state_foreach_t *state)
 {
 	request_data_get(state->request, FOREACH_REQUEST_DATA, state->depth);
+	tmpl_cursor_clear(&state->cc);
 
 	return 0;
 }
@@ -169,25 +172,38 @@ static unlang_action_t unlang_foreach(rlm_rcode_t *p_result, request_t *request)
 	MEM(frame->state = foreach = talloc_zero(stack, unlang_frame_state_foreach_t));
 	fr_pair_list_init(&foreach->vps);
 
+	foreach->request = request;
+	foreach->depth = foreach_depth;
+#ifndef NDEBUG
+	foreach->indent = request->log.unlang_indent;
+#endif
+
+	if (gext->copy) {
+		/*
+		 *	Copy the VPs from the original request, this ensures deterministic
+		 *	behaviour if someone decides to add or remove VPs in the set we're
+		 *	iterating over.
+		 */
+		if (tmpl_copy_pairs(frame->state, &vps, request, gext->vpt) < 0) {	/* nothing to loop over */
+			*p_result = RLM_MODULE_NOOP;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+
+		fr_assert(vps != NULL);
+
+		foreach->vps = vps;
+		fr_cursor_talloc_init(&foreach->cursor, &foreach->vps, fr_pair_t);
+
 	/*
-	 *	Copy the VPs from the original request, this ensures deterministic
-	 *	behaviour if someone decides to add or remove VPs in the set we're
-	 *	iterating over.
+	 *	The body can't modify the list, so walk over the
+	 *	original pairs instead of copying them.
 	 */
-	if (tmpl_copy_pairs(frame->state, &vps, request, gext->vpt) < 0) {	/* nothing to loop over */
+	} else if (!tmpl_cursor_init(NULL, NULL, &foreach->cc, &foreach->cursor, request, gext->vpt)) {
+		tmpl_cursor_clear(&foreach->cc);
 		*p_result = RLM_MODULE_NOOP;
 		return UNLANG_ACTION_CALCULATE_RESULT;
 	}
 
-	fr_assert(vps != NULL);
-
-	foreach->request = request;
-	foreach->depth = foreach_depth;
-	foreach->vps = vps;
-	fr_cursor_talloc_init(&foreach->cursor, &foreach->vps, fr_pair_t);
-#ifndef NDEBUG
-	foreach->indent = request->log.unlang_indent;
-#endif
 	talloc_set_destructor(foreach, _free_unlang_frame_state_foreach);
 
 	frame->process = unlang_foreach_next;
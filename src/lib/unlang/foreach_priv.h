@@ -32,6 +32,8 @@ extern "C" {
 typedef struct {
 	unlang_group_t	group;
 	tmpl_t		*vpt;
+	bool		copy;		//!< The body may modify the list being iterated over,
+					///< so iterate over a copy of the matching pairs.
 } unlang_foreach_t;
 
 /** Cast a group structure to the foreach keyword extension
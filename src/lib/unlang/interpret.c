@@ -1049,6 +1049,23 @@ void *unlang_interpret_stack_alloc(TALLOC_CTX *ctx)
 	return stack;
 }
 
+/** Reset a stack so that it can be used by another request
+ *
+ * Any frame state which is left over is freed, which also empties
+ * the stack's pool, so the stack can be reused without allocating
+ * a new one.
+ *
+ * @param[in] ctx	The stack to reset.
+ */
+void unlang_interpret_stack_reset(void *ctx)
+{
+	unlang_stack_t *stack = talloc_get_type_abort(ctx, unlang_stack_t);
+
+	talloc_free_children(stack);
+	memset(stack, 0, sizeof(*stack));
+	stack->result = RLM_MODULE_UNKNOWN;
+}
+
 /** Send a signal (usually stop) to a request
  *
  * This is typically called via an "async" action, i.e. an action
@@ -114,6 +114,8 @@ rlm_rcode_t	unlang_interpret_synchronous(request_t *request, CONF_SECTION *cs, r
 
 void		*unlang_interpret_stack_alloc(TALLOC_CTX *ctx);
 
+void		unlang_interpret_stack_reset(void *ctx) CC_HINT(nonnull);
+
 void		unlang_interpret_mark_resumable(request_t *request);
 
 bool		unlang_interpret_is_resumable(request_t *request);
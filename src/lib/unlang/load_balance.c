@@ -31,6 +31,176 @@
 
 #define unlang_redundant_load_balance unlang_load_balance
 
+/*
+ *	Latency samples are weighted 1/8 when they're lower than the
+ *	current average.  Higher samples replace the average
+ *	outright ("peak EWMA"), so a child which slows down is
+ *	avoided immediately, and only slowly trusted again.
+ *
+ *	A child which hasn't been used for a while has its latency
+ *	halved every LB_LATENCY_DECAY, so that it's eventually
+ *	probed again.
+ */
+#define LB_LATENCY_EWMA_SHIFT	(3)
+#define LB_LATENCY_DECAY	(fr_time_delta_from_sec(10))
+
+/** Return the cost of sending a request to a child
+ *
+ */
+static inline uint64_t load_balance_cost(unlang_load_balance_child_t *stats, fr_time_t now)
+{
+	uint64_t	latency, last, age;
+
+	latency = atomic_load_explicit(&stats->latency, memory_order_relaxed);
+	last = atomic_load_explicit(&stats->last, memory_order_relaxed);
+
+	if (((uint64_t) now) > last) {
+		age = (((uint64_t) now) - last) / LB_LATENCY_DECAY;
+		latency = (age >= 64) ? 0 : (latency >> age);
+	}
+
+	return (latency + 1) * (atomic_load_explicit(&stats->active, memory_order_relaxed) + 1);
+}
+
+/** Update the latency of a child, and mark it as no longer being used by this request
+ *
+ */
+static void load_balance_stats_done(unlang_frame_state_redundant_t *redundant)
+{
+	unlang_load_balance_child_t	*stats = redundant->stats;
+	fr_time_t			now;
+	uint64_t			sample, latency;
+
+	if (!stats) return;
+	redundant->stats = NULL;
+
+	atomic_fetch_sub_explicit(&stats->active, 1, memory_order_relaxed);
+
+	now = fr_time();
+	sample = (now > redundant->start) ? (uint64_t) (now - redundant->start) : 0;
+
+	/*
+	 *	Racing updates from other threads may be lost.  That's
+	 *	fine, it's an average.
+	 */
+	latency = atomic_load_explicit(&stats->latency, memory_order_relaxed);
+	if (sample > latency) {
+		latency = sample;
+	} else {
+		latency -= (latency >> LB_LATENCY_EWMA_SHIFT);
+		latency += (sample >> LB_LATENCY_EWMA_SHIFT);
+	}
+	atomic_store_explicit(&stats->latency, latency, memory_order_relaxed);
+	atomic_store_explicit(&stats->last, (uint64_t) now, memory_order_relaxed);
+}
+
+/** The request was stopped or freed while running the child
+ *
+ */
+static int _load_balance_state_free(unlang_frame_state_redundant_t *redundant)
+{
+	if (redundant->stats) atomic_fetch_sub_explicit(&redundant->stats->active, 1, memory_order_relaxed);
+
+	return 0;
+}
+
+/** Choose a child using the "power of two choices"
+ *
+ * Pick two different children at random, and use the one which is
+ * cheaper.  The cost is its recent latency, scaled by how many
+ * requests are currently using it.  Children which have never been
+ * used only cost how busy they are, so they're tried early.
+ *
+ * This is much better than picking at random when the children have
+ * different latencies, but doesn't herd every request onto the one
+ * child which looks best.
+ */
+static void load_balance_choose(request_t *request, unlang_group_t *g, unlang_load_balance_t *gext,
+				unlang_frame_state_redundant_t *redundant)
+{
+	uint32_t	a, b, count;
+	fr_time_t	now = fr_time();
+
+	a = fr_rand() % g->num_children;
+	b = fr_rand() % (g->num_children - 1);
+	if (b >= a) b++;
+
+	if (load_balance_cost(&gext->stats[b], now) < load_balance_cost(&gext->stats[a], now)) a = b;
+
+	RDEBUG3("load-balance chose child %d", (int) a);
+
+	for (redundant->found = g->children, count = 0;
+	     count < a;
+	     redundant->found = redundant->found->next, count++);
+
+	redundant->stats = &gext->stats[a];
+	redundant->start = now;
+	atomic_fetch_add_explicit(&redundant->stats->active, 1, memory_order_relaxed);
+	talloc_set_destructor(redundant, _load_balance_state_free);
+}
+
+/** Rank of a child for a given key
+ *
+ * The high bits are a hash of the key and the child's position,
+ * the low bits are the position, so no two children have the
+ * same rank.
+ */
+static inline uint64_t load_balance_rank(uint32_t hash, uint32_t i)
+{
+	return (((uint64_t) fr_hash_update(&i, sizeof(i), hash)) << 32) | i;
+}
+
+/** Choose the next child for a keyed load-balance
+ *
+ * This is rendezvous (highest random weight) hashing.  Every child
+ * gets a rank from the key, and the children are tried in order of
+ * rank, highest first.  Requests with the same key therefore always
+ * go to the same child.  If that child fails, its keys are spread
+ * across all of the others, instead of all of them moving to the
+ * next child in the list.
+ *
+ * @param[in] g		the load-balance section.
+ * @param[in] redundant	state, holding the hash of the key, and the
+ *			rank of the last child we chose.
+ * @return
+ *	- the child with the highest rank below the last one.
+ *	- NULL if every child has been chosen.
+ */
+static unlang_t *load_balance_keyed_next(unlang_group_t *g, unlang_frame_state_redundant_t *redundant)
+{
+	unlang_t	*child, *found = NULL;
+	uint64_t	rank, best = 0;
+	uint32_t	i;
+
+	for (child = g->children, i = 0; child != NULL; child = child->next, i++) {
+		rank = load_balance_rank(redundant->hash, i);
+		if ((rank >= redundant->rank) || (found && (rank <= best))) continue;
+
+		found = child;
+		best = rank;
+	}
+
+	if (found) redundant->rank = best;
+
+	return found;
+}
+
+/** Record how long the chosen child took to run
+ *
+ */
+static unlang_action_t unlang_load_balance_resume(UNUSED rlm_rcode_t *p_result, request_t *request)
+{
+	unlang_stack_t			*stack = request->stack;
+	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_frame_state_redundant_t	*redundant = talloc_get_type_abort(frame->state,
+									   unlang_frame_state_redundant_t);
+
+	load_balance_stats_done(redundant);
+
+	/* DON'T change p_result, as it is taken from the child */
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
 static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t *request)
 {
 	unlang_stack_t			*stack = request->stack;
@@ -94,6 +264,19 @@ static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t
 		return UNLANG_ACTION_STOP_PROCESSING;
 	}
 
+	/*
+	 *	Keyed sections try the children in order of rank.
+	 *	Once they've all been tried, point back at the first
+	 *	one, so that the check above stops us.
+	 */
+	if (redundant->keyed) {
+		redundant->child = load_balance_keyed_next(g, redundant);
+		if (!redundant->child) redundant->child = redundant->found;
+
+		repeatable_set(frame);
+		return UNLANG_ACTION_PUSHED_CHILD;
+	}
+
 	/*
 	 *	Now that we've pushed this child, make the next call
 	 *	use the next child, wrapping around to the beginning.
@@ -137,7 +320,7 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 	redundant = talloc_get_type_abort(frame->state, unlang_frame_state_redundant_t);
 
 	if (gext && gext->vpt) {
-		uint32_t hash, start;
+		uint32_t start;
 		ssize_t slen;
 		char const *p = NULL;
 		char buffer[1024];
@@ -187,41 +370,36 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 				goto randomly_choose;
 			}
 
-			hash = fr_hash(p, slen);
+			redundant->keyed = true;
+			redundant->hash = fr_hash(p, slen);
+			redundant->rank = UINT64_MAX;
+			redundant->found = load_balance_keyed_next(g, redundant);
 
-			start = hash % g->num_children;;
+			RDEBUG3("load-balance chose child %d", (int) (redundant->rank & UINT32_MAX));
+			goto push;
 		}
 
 		RDEBUG3("load-balance starting at child %d", (int) start);
 
-		count = 0;
-		for (redundant->child = redundant->found = g->children;
-		     redundant->child != NULL;
-		     redundant->child = redundant->child->next) {
-			count++;
-			if (count == start) {
-				redundant->found = redundant->child;
-				break;
-			}
-		}
+		for (redundant->found = g->children, count = 0;
+		     count < start;
+		     redundant->found = redundant->found->next, count++);
+
+	} else if (gext->stats && (g->num_children > 1)) {
+	power_of_two:
+		load_balance_choose(request, g, gext, redundant);
 
 	} else {
 	randomly_choose:
+		if (gext->stats && (g->num_children > 1)) goto power_of_two;
+
 		count = 0;
 
 		/*
 		 *	Choose a child at random.
 		 *
-		 *	@todo - leverage the "power of 2", as per
-		 *      lib/io/network.c.  This is good enough for
-		 *      most purposes.  However, in order to do this,
-		 *      we need to track active callers across
-		 *      *either* multiple modules in one thread, *or*
-		 *      across multiple threads.
-		 *
-		 *	We don't have thread-specific instance data
-		 *	for this load-balance section.  So for now,
-		 *	just pick a random child.
+		 *	"redundant-load-balance" can run more than one
+		 *	child, so we don't track latency for it.
 		 */
 		for (redundant->child = redundant->found = g->children;
 		     redundant->child != NULL;
@@ -234,15 +412,22 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 		}
 	}
 
+push:
 	/*
 	 *	Plain "load-balance".  Just do one child.
 	 */
 	if (instruction->type == UNLANG_TYPE_LOAD_BALANCE) {
 		if (unlang_interpret_push(request, redundant->found,
 					  frame->result, UNLANG_NEXT_STOP, UNLANG_SUB_FRAME) < 0) {
+			load_balance_stats_done(redundant);
 			*p_result = RLM_MODULE_FAIL;
 			return UNLANG_ACTION_STOP_PROCESSING;
 		}
+
+		if (redundant->stats) {
+			frame->process = unlang_load_balance_resume;
+			repeatable_set(frame);
+		}
 		return UNLANG_ACTION_PUSHED_CHILD;
 	}
 
@@ -29,17 +29,41 @@ extern "C" {
 #include "unlang_priv.h"
 #include <freeradius-devel/server/tmpl.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Latency tracking for one child of a "load-balance" section
+ *
+ * The compiled tree is shared by all threads, so these are atomics.
+ */
 typedef struct {
-	unlang_group_t	group;
-	tmpl_t		*vpt;
+	atomic_uint_fast64_t	latency;	//!< peak-EWMA of how long the child takes to run.
+	atomic_uint_fast64_t	last;		//!< when latency was last updated.
+	atomic_uint_fast32_t	active;		//!< requests currently running the child.
+} unlang_load_balance_child_t;
+
+typedef struct {
+	unlang_group_t			group;
+	tmpl_t				*vpt;
+	unlang_load_balance_child_t	*stats;		//!< one per child, for plain "load-balance".
 } unlang_load_balance_t;
 
 /** State of a redundant operation
  *
  */
 typedef struct {
-	unlang_t 		*child;
-	unlang_t		*found;
+	unlang_t 			*child;
+	unlang_t			*found;
+
+	unlang_load_balance_child_t	*stats;		//!< of the child we chose, if we're tracking it.
+	fr_time_t			start;		//!< when we started running the child.
+
+	bool				keyed;		//!< Children are ranked by a hash of the key.
+	uint32_t			hash;		//!< of the key.
+	uint64_t			rank;		//!< of the child which was last chosen.
 } unlang_frame_state_redundant_t;
 
 /** Cast a group structure to the load_balance keyword extension
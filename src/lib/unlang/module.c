@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/request_data.h>
 #include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/probe.h>
 
 #include "module_priv.h"
 #include "subrequest_priv.h"
@@ -661,6 +662,7 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	rlm_rcode_t			rcode = RLM_MODULE_NOOP;
 	int				stack_depth = stack->depth;
 	unlang_action_t			ua;
+	fr_time_t			now, end;
 
 	fr_assert(state->resume != NULL);
 
@@ -670,6 +672,10 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	caller = request->module;
 	request->module = mc->instance->name;
 
+	now = fr_time();
+	state->waited += now - state->yielded;
+	state->thread->waiting_total += now - state->yielded;
+
 	safe_lock(mc->instance);
 	ua = state->resume(&rcode,
 			   &(module_ctx_t){
@@ -678,6 +684,9 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 			   }, request, state->rctx);
 	safe_unlock(mc->instance);
 
+	end = fr_time();
+	state->thread->running_total += end - now;
+
 	request->rcode = rcode;
 	request->module = caller;
 
@@ -701,6 +710,7 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 		fr_table_str_by_value(mod_rcode_table, rcode, "<invalid>"));
 
 	if (ua == UNLANG_ACTION_YIELD) {
+		state->yielded = end;
 		if (stack_depth < stack->depth) return UNLANG_ACTION_PUSHED_CHILD;
 		fr_assert(stack_depth == stack->depth);
 		*p_result = rcode;
@@ -708,6 +718,10 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	}
 
 	state->thread->active_callers--;
+	fr_time_elapsed_update(&state->thread->elapsed, state->started, end);
+	FR_PROBE3(module_exit, request->number, mc->instance->name, rcode);
+	RDEBUG3("%s took %pV (%pV waiting)", mc->instance->name,
+		fr_box_time_delta(end - state->started), fr_box_time_delta(state->waited));
 
 	/*
 	 *	The module is done.  But, running it pushed one or
@@ -784,6 +798,7 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request)
 	char const 			*caller;
 	rlm_rcode_t			rcode = RLM_MODULE_NOOP;
 	unlang_action_t			ua;
+	fr_time_t			end;
 
 #ifndef NDEBUG
 	int unlang_indent		= request->log.unlang_indent;
@@ -822,6 +837,9 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request)
 
 	caller = request->module;
 	request->module = mc->instance->name;
+	state->started = fr_time();
+	state->waited = 0;
+	FR_PROBE2(module_enter, request->number, mc->instance->name);
 	safe_lock(mc->instance);	/* Noop unless instance->mutex set */
 	ua = mc->method(&rcode,
 			&(module_ctx_t){
@@ -832,6 +850,9 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request)
 	safe_unlock(mc->instance);
 	request->module = caller;
 
+	end = fr_time();
+	state->thread->running_total += end - state->started;
+
 	/*
 	 *	It is now marked as "stop" when it wasn't before, we
 	 *	must have been blocked.
@@ -853,12 +874,17 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request)
 
 	if (ua == UNLANG_ACTION_YIELD) {
 		state->thread->active_callers++;
+		state->yielded = end;
 		if (stack_depth < stack->depth) return UNLANG_ACTION_PUSHED_CHILD;
 		fr_assert(stack_depth == stack->depth);
 		frame->process = unlang_module_resume;
 		return UNLANG_ACTION_YIELD;
 	}
 
+	fr_time_elapsed_update(&state->thread->elapsed, state->started, end);
+	FR_PROBE3(module_exit, request->number, mc->instance->name, rcode);
+	RDEBUG3("%s took %pV", mc->instance->name, fr_box_time_delta(end - state->started));
+
 done:
 	fr_assert(unlang_indent == request->log.unlang_indent);
 	fr_assert(rcode >= RLM_MODULE_REJECT);
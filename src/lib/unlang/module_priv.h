@@ -63,6 +63,14 @@ typedef struct {
 	unlang_module_resume_t		resume;			//!< resumption handler
 	unlang_module_signal_t		signal;			//!< for signal handlers
 	/** @} */
+
+	/** @name Statistics
+	 * @{
+ 	 */
+	fr_time_t			started;		//!< When the module was first called.
+	fr_time_t			yielded;		//!< When the module last yielded.
+	fr_time_delta_t			waited;			//!< Total time spent yielded.
+	/** @} */
 } unlang_frame_state_module_t;
 
 static inline unlang_module_t *unlang_generic_to_module(unlang_t *p)
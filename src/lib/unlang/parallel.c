@@ -73,7 +73,8 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 
 	int			i, priority;
 	rlm_rcode_t		result;
-	unlang_parallel_child_state_t child_state = CHILD_DONE; /* hope that we're done */
+	unlang_parallel_child_state_t child_state;
+	bool			waiting;
 	request_t			*child;
 
 	/*
@@ -86,6 +87,10 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 		state->result = RLM_MODULE_NOOP;
 	}
 
+again:
+	child_state = CHILD_DONE;	/* hope that we're done */
+	waiting = false;
+
 	/*
 	 *	Loop over all the children.
 	 *
@@ -98,6 +103,19 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 			 *	Create the child and then run it.
 			 */
 		case CHILD_INIT:
+			/*
+			 *	Too many children are already
+			 *	active.  This one waits until one of
+			 *	them finishes.  The active children
+			 *	must have yielded, so we'll be resumed.
+			 */
+			if (state->max_active && (state->num_active >= state->max_active)) {
+				RDEBUG3("parallel child %d is waiting", i);
+				child_state = CHILD_YIELDED;
+				waiting = true;
+				continue;
+			}
+
 			RDEBUG3("parallel child %d is INIT", i);
 			fr_assert(state->children[i].instruction != NULL);
 			child = unlang_io_subrequest_alloc(request,
@@ -169,6 +187,7 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 
 			state->children[i].child = child;
 			state->children[i].state = CHILD_RUNNABLE;
+			state->num_active++;
 
 			FALL_THROUGH;
 
@@ -217,6 +236,7 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 			state->children[i].state = CHILD_DONE;
 			TALLOC_FREE(state->children[i].child);
 			state->children[i].instruction = NULL;
+			state->num_active--;
 
 			/*
 			 *	return is "stop processing the
@@ -233,6 +253,7 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 				i = state->num_children;
 				priority = 0;
 				child_state = CHILD_DONE;
+				waiting = false;
 			}
 
 			/*
@@ -288,6 +309,7 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 			state->children[i].state = CHILD_DONE;
 			state->children[i].child = NULL;		// someone else freed this somewhere
 			state->children[i].instruction = NULL;
+			state->num_active--;
 			FALL_THROUGH;
 
 			/*
@@ -302,6 +324,13 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 		}
 	}
 
+	/*
+	 *	A child finished after we skipped over one which was
+	 *	waiting to start.  Go back and start it, as there may
+	 *	be no active children left to resume us.
+	 */
+	if (waiting && (state->num_active < state->max_active)) goto again;
+
 	/*
 	 *	Yield if necessary.
 	 */
@@ -419,6 +448,7 @@ static unlang_action_t unlang_parallel(rlm_rcode_t *p_result, request_t *request
 	state->priority = -1;				/* as-yet unset */
 	state->detach = gext->detach;
 	state->clone = gext->clone;
+	state->max_active = gext->max_active;
 	state->num_children = g->num_children;
 
 	/*
@@ -57,6 +57,8 @@ typedef struct {
 	int			priority;
 
 	int			num_children;		//!< How many children are executing.
+	int			num_active;		//!< How many children have been started, and not finished.
+	int			max_active;		//!< How many children can be active at once.  0 for no limit.
 
 	bool			detach;			//!< are we creating the child detached
 	bool			clone;			//!< are the children cloned
@@ -68,6 +70,7 @@ typedef struct {
 	unlang_group_t		group;
 	bool			detach;			//!< are we creating the child detached
 	bool			clone;
+	int			max_active;		//!< How many children can be active at once.  0 for no limit.
 } unlang_parallel_t;
 
 /** Cast a group structure to the parallel keyword extension
@@ -240,7 +240,8 @@ static unlang_action_t unlang_subrequest_state_init(rlm_rcode_t *p_result, reque
 	}
 
 	gext = unlang_group_to_subrequest(g);
-	child = state->child = unlang_io_subrequest_alloc(request, gext->dict, UNLANG_DETACHABLE);
+	child = state->child = unlang_io_subrequest_alloc(request, gext->dict,
+							  gext->detachable ? UNLANG_DETACHABLE : UNLANG_NORMAL_CHILD);
 	if (!child) {
 	fail:
 		rcode = RLM_MODULE_FAIL;
@@ -342,7 +343,7 @@ static unlang_action_t unlang_subrequest_state_init(rlm_rcode_t *p_result, reque
 	 */
 	state->p_result = NULL;
 	state->free_child = true;
-	state->detachable = true;
+	state->detachable = gext->detachable;
 
 	/*
 	 *	Store/restore session information in the subrequest
@@ -42,6 +42,9 @@ typedef struct {
 	fr_dict_attr_t const	*attr_packet_type;	//!< Packet-type attribute in the subrequest protocol.
 	fr_dict_enum_t const	*type_enum;		//!< Static enumeration value for attr_packet_type
 							///< if the packet-type is static.
+
+	bool			detachable;		//!< The section contains a 'detach' keyword, so the
+							///< child must be able to outlive the parent.
 } unlang_subrequest_t;
 
 /** Cast a group structure to the subrequest keyword extension
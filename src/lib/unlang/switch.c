@@ -84,6 +84,42 @@ static unlang_action_t unlang_switch(UNUSED rlm_rcode_t *p_result, request_t *re
 		goto do_null_case;
 	}
 
+	/*
+	 *	All of the cases are literals, so look up the
+	 *	value directly.  If the attribute has more than one
+	 *	instance, then any of them can match, and we have to
+	 *	find the first matching case, so fall back to
+	 *	comparing each case in turn.
+	 */
+	if (switch_gext->cases) {
+		fr_pair_t		*vp;
+		fr_cursor_t		cursor;
+		tmpl_cursor_ctx_t	cc;
+		int			err;
+		unlang_case_t		my_case;
+		tmpl_t			my_vpt;
+		bool			multiple;
+
+		vp = tmpl_cursor_init(&err, request, &cc, &cursor, request, switch_gext->vpt);
+		multiple = vp && fr_cursor_next(&cursor);
+		if (vp && !multiple) {
+			memset(&my_vpt, 0, sizeof(my_vpt));
+			tmpl_init_shallow(&my_vpt, TMPL_TYPE_DATA, T_BARE_WORD, "", 0);
+			fr_value_box_copy_shallow(NULL, &my_vpt.data.literal, &vp->data);
+
+			memset(&my_case, 0, sizeof(my_case));
+			my_case.vpt = &my_vpt;
+
+			found = fr_hash_table_find_by_data(switch_gext->cases, &my_case);
+		}
+		tmpl_cursor_clear(&cc);
+
+		if (!multiple) {
+			if (!found) found = switch_gext->default_case;
+			goto do_null_case;
+		}
+	}
+
 	/*
 	 *	Expand the template if necessary, so that it
 	 *	is evaluated once instead of for each 'case'
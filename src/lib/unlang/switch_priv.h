@@ -27,10 +27,15 @@ extern "C" {
 #endif
 
 #include <freeradius-devel/server/tmpl.h>
+#include <freeradius-devel/util/hash.h>
 
 typedef struct {
 	unlang_group_t	group;
 	tmpl_t		*vpt;
+
+	fr_hash_table_t	*cases;		//!< Literal "case" statements, indexed by value.
+					///< NULL if each "case" has to be compared in turn.
+	unlang_t	*default_case;	//!< The "default" case, if "cases" is set.
 } unlang_switch_t;
 
 /** Cast a group structure to the switch keyword extension
@@ -3340,7 +3340,14 @@ int xlat_init(void)
 	xlat_register_legacy(NULL, "trigger", trigger_xlat, NULL, NULL, 0, 0);	/* On behalf of trigger.c */
 	XLAT_REGISTER(xlat);
 
-
+	/*
+	 *	None of these are marked as "pure", and their results
+	 *	aren't cached.  Most take an attribute as their input,
+	 *	so there's nothing to fold when the server starts.
+	 *	Caching the other calls would mean hashing and
+	 *	comparing the argument list on every call, which costs
+	 *	as much as hashing or case-folding the input itself.
+	 */
 	xlat_register(NULL, "base64", xlat_func_base64_encode, false);
 	xlat_register(NULL, "base64decode", xlat_func_base64_decode, false);
 	xlat_register(NULL, "bin", xlat_func_bin, false);
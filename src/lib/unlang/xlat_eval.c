@@ -1457,8 +1457,9 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, request_t *request, xlat
 			   xlat_escape_legacy_t escape, void const *escape_ctx)
 {
 	int i, j, list;
-	size_t total;
-	char **array, *answer;
+	size_t total, *lens;
+	char const **array;
+	char *answer;
 	xlat_exp_t const *node;
 
 	*out = NULL;
@@ -1497,11 +1498,27 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, request_t *request, xlat
 		list++;
 	}
 
-	array = talloc_array(ctx, char *, list);
+	array = talloc_array(ctx, char const *, list);
 	if (!array) return -1;
 
+	lens = talloc_array(array, size_t, list);
+	if (!lens) {
+		talloc_free(array);
+		return -1;
+	}
+
 	for (node = head, i = 0; node != NULL; node = node->next, i++) {
-		array[i] = xlat_sync_eval(array, request, node, escape, escape_ctx, 0); /* may be NULL */
+		/*
+		 *	Literals are never escaped, so copy them
+		 *	straight from the tree, instead of making
+		 *	a temporary copy of each one.
+		 */
+		if (node->type == XLAT_LITERAL) {
+			array[i] = node->fmt;
+		} else {
+			array[i] = xlat_sync_eval(array, request, node, escape, escape_ctx, 0); /* may be NULL */
+		}
+		lens[i] = array[i] ? strlen(array[i]) : 0;
 
 		/*
 		 *	Nasty temporary hack
@@ -1520,7 +1537,7 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, request_t *request, xlat
 	j = i;
 
 	total = 0;
-	for (i = 0; i < j; i++) if (array[i]) total += strlen(array[i]); /* FIXME: calculate strlen once */
+	for (i = 0; i < j; i++) total += lens[i];
 
 	if (!total) {
 		talloc_free(array);
@@ -1532,13 +1549,10 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, request_t *request, xlat
 
 	total = 0;
 	for (i = 0; i < j; i++) {
-		size_t len;
+		if (!lens[i]) continue;
 
-		if (array[i]) {
-			len = strlen(array[i]);
-			memcpy(answer + total, array[i], len);
-			total += len;
-		}
+		memcpy(answer + total, array[i], lens[i]);
+		total += lens[i];
 	}
 	answer[total] = '\0';
 	talloc_free(array);	/* and child entries */
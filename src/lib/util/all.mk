@@ -1,9 +1,14 @@
 SUBMAKEFILES := \
+	bench_util.mk \
 	dbuff_tests.mk \
+	event_tests.mk \
+	hash_tests.mk \
 	heap_tests.mk \
 	libfreeradius-util.mk \
+	oahash_tests.mk \
 	pair_tests.mk \
 	pair_legacy_tests.mk \
 	sbuff_tests.mk \
+	slab_tests.mk \
 	strerror_tests.mk
 
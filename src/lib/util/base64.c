@@ -203,14 +203,40 @@ size_t fr_base64_encode(char *out, size_t outlen, uint8_t const *in, size_t inle
 		return -1;
 	}
 
-	while (inlen) {
+	/*
+	 *	Complete 24bit quanta, without any of the
+	 *	padding checks.
+	 */
+	while (inlen >= 3) {
+		uint32_t quantum = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+
+		p[0] = fr_base64_str[(quantum >> 18) & 0x3f];
+		p[1] = fr_base64_str[(quantum >> 12) & 0x3f];
+		p[2] = fr_base64_str[(quantum >> 6) & 0x3f];
+		p[3] = fr_base64_str[quantum & 0x3f];
+
+		p += 4;
+		in += 3;
+		inlen -= 3;
+	}
+
+	switch (inlen) {
+	case 2:
 		*p++ = fr_base64_str[(in[0] >> 2) & 0x3f];
-		*p++ = fr_base64_str[((in[0] << 4) + (--inlen ? in[1] >> 4 : 0)) & 0x3f];
-		*p++ = (inlen ? fr_base64_str[((in[1] << 2) + (--inlen ? in[2] >> 6 : 0)) & 0x3f] : '=');
-		*p++ = inlen ? fr_base64_str[in[2] & 0x3f] : '=';
+		*p++ = fr_base64_str[((in[0] << 4) | (in[1] >> 4)) & 0x3f];
+		*p++ = fr_base64_str[(in[1] << 2) & 0x3f];
+		*p++ = '=';
+		break;
 
-		if (inlen) inlen--;
-		if (inlen) in += 3;
+	case 1:
+		*p++ = fr_base64_str[(in[0] >> 2) & 0x3f];
+		*p++ = fr_base64_str[(in[0] << 4) & 0x3f];
+		*p++ = '=';
+		*p++ = '=';
+		break;
+
+	default:
+		break;
 	}
 
 	p[0] = '\0';
@@ -229,7 +255,7 @@ size_t fr_base64_encode(char *out, size_t outlen, uint8_t const *in, size_t inle
  */
 bool fr_is_base64(char c)
 {
-	return fr_base64_sextet[us(c)] >= 0;
+	return (int8_t)fr_base64_sextet[us(c)] >= 0;
 }
 
 /* Decode base64 encoded input array.
@@ -266,7 +292,15 @@ ssize_t fr_base64_decode(uint8_t *out, size_t outlen, char const *in, size_t inl
 	 *	Process complete 24bit quanta
 	 */
 	while ((end - p) >= 4) {
-		if (!fr_is_base64(p[0]) || !fr_is_base64(p[1]) || !fr_is_base64(p[2]) || !fr_is_base64(p[3])) break;
+		int8_t		a = fr_base64_sextet[us(p[0])], b = fr_base64_sextet[us(p[1])];
+		int8_t		c = fr_base64_sextet[us(p[2])], d = fr_base64_sextet[us(p[3])];
+		uint32_t	quantum;
+
+		/*
+		 *	Non-alphabet chars are -1, so one check
+		 *	covers all four.
+		 */
+		if ((a | b | c | d) < 0) break;
 
 		/*
 		 *	Check we have enough bytes to write out
@@ -278,10 +312,12 @@ ssize_t fr_base64_decode(uint8_t *out, size_t outlen, char const *in, size_t inl
 			return p - end;
 		}
 
-		*out_p++ = ((fr_base64_sextet[us(p[0])] << 2) | (fr_base64_sextet[us(p[1])] >> 4));
-		*out_p++ = ((fr_base64_sextet[us(p[1])] << 4) & 0xf0) | (fr_base64_sextet[us(p[2])] >> 2);
-		*out_p++ = ((fr_base64_sextet[us(p[2])] << 6) & 0xc0) | fr_base64_sextet[us(p[3])];
+		quantum = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | (uint32_t)d;
+		out_p[0] = quantum >> 16;
+		out_p[1] = quantum >> 8;
+		out_p[2] = quantum;
 
+		out_p += 3;
 		p += 4;	/* 32bit input -> 24bit output */
 	}
 
@@ -0,0 +1,113 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Simple micro-benchmark framework
+ *
+ * Like acutest.h, this is only meant to be included by test and
+ * benchmark programs.
+ *
+ * Each benchmark is a function which performs a given number of
+ * operations.  It is run once to warm up the caches and the branch
+ * predictors, then timed over several runs.  The per-operation time
+ * is reported as the median of the runs, along with the min, max and
+ * mean, so that noisy results are easy to spot.
+ *
+ * @file src/lib/util/bench.h
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(bench_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef FR_BENCH_RUNS
+#  define FR_BENCH_RUNS	(11)
+#endif
+
+/** A function to benchmark
+ *
+ * @param[in] uctx	passed to fr_bench_run().
+ * @param[in] ops	number of operations to perform.
+ * @return a value derived from the work done, so that the compiler
+ *	can't optimise the work away.
+ */
+typedef uint64_t (*fr_bench_func_t)(void *uctx, uint64_t ops);
+
+/** Only run benchmarks whose names contain this string
+ *
+ */
+static char const *fr_bench_filter = NULL;
+
+/** Stops the compiler from discarding the results of benchmarks
+ *
+ */
+static volatile uint64_t fr_bench_sink;
+
+static int _fr_bench_cmp(void const *one, void const *two)
+{
+	fr_time_delta_t const *a = one, *b = two;
+
+	return (*a > *b) - (*a < *b);
+}
+
+/** Time a function, and print the results
+ *
+ * @param[in] name	of the benchmark.
+ * @param[in] func	to run.
+ * @param[in] uctx	to pass to func.
+ * @param[in] ops	how many operations func should do per run.
+ */
+static inline void fr_bench_run(char const *name, fr_bench_func_t func, void *uctx, uint64_t ops)
+{
+	fr_time_delta_t	runs[FR_BENCH_RUNS];
+	fr_time_delta_t	total = 0;
+	fr_time_t	start;
+	size_t		i;
+
+	if (fr_bench_filter && !strstr(name, fr_bench_filter)) return;
+
+	fr_bench_sink += func(uctx, ops);
+
+	for (i = 0; i < FR_BENCH_RUNS; i++) {
+		start = fr_time();
+		fr_bench_sink += func(uctx, ops);
+		runs[i] = fr_time() - start;
+		total += runs[i];
+	}
+
+	qsort(runs, FR_BENCH_RUNS, sizeof(runs[0]), _fr_bench_cmp);
+
+	printf("%-32s %10.1f ns/op  (min %.1f, max %.1f, mean %.1f, %u runs of %" PRIu64 ")\n",
+	       name,
+	       (double) runs[FR_BENCH_RUNS / 2] / ops,
+	       (double) runs[0] / ops,
+	       (double) runs[FR_BENCH_RUNS - 1] / ops,
+	       (double) total / FR_BENCH_RUNS / ops,
+	       FR_BENCH_RUNS, ops);
+}
+
+#ifdef __cplusplus
+}
+#endif
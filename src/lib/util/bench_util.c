@@ -0,0 +1,312 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Micro-benchmarks for the util data structures
+ *
+ * Run as "bench_util [name]".  If a name is given, only benchmarks
+ * whose names contain it are run.
+ *
+ * @file src/lib/util/bench_util.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/base64.h>
+#include <freeradius-devel/util/bench.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/hex.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/rbtree.h>
+#include <freeradius-devel/util/sbuff.h>
+#include <freeradius-devel/util/trie.h>
+#include <freeradius-devel/util/value.h>
+
+#define BENCH_ELEMENTS	(65536)	//!< Must be a power of 2.
+#define BENCH_OPS	(1000000)
+
+typedef struct {
+	uint32_t	key;
+	int32_t		heap;		//!< for the heap.
+} bench_thing;
+
+static bench_thing	*things;
+
+static uint32_t thing_hash(void const *data)
+{
+	bench_thing const *a = data;
+
+	return fr_hash(&a->key, sizeof(a->key));
+}
+
+static int thing_cmp(void const *one, void const *two)
+{
+	bench_thing const *a = one, *b = two;
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+static int8_t thing_heap_cmp(void const *one, void const *two)
+{
+	bench_thing const *a = one, *b = two;
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+/*
+ *	Walk through the elements in an order which defeats the
+ *	prefetcher, the same way a real lookup would.
+ */
+#define NEXT_THING(_i) (&things[((_i) * 7919) & (BENCH_ELEMENTS - 1)])
+
+static uint64_t bench_hash_table_find(void *uctx, uint64_t ops)
+{
+	fr_hash_table_t	*ht = uctx;
+	uint64_t	i, found = 0;
+
+	for (i = 0; i < ops; i++) if (fr_hash_table_find_by_data(ht, NEXT_THING(i))) found++;
+
+	return found;
+}
+
+static uint64_t bench_rbtree_find(void *uctx, uint64_t ops)
+{
+	rbtree_t	*tree = uctx;
+	uint64_t	i, found = 0;
+
+	for (i = 0; i < ops; i++) if (rbtree_finddata(tree, NEXT_THING(i))) found++;
+
+	return found;
+}
+
+/*
+ *	Each operation is one insert, and one pop.
+ */
+static uint64_t bench_heap_insert_pop(void *uctx, uint64_t ops)
+{
+	fr_heap_t	*hp = uctx;
+	uint64_t	i, j, found = 0;
+
+	for (i = 0; i < ops; i += BENCH_ELEMENTS) {
+		for (j = 0; (j < BENCH_ELEMENTS) && ((i + j) < ops); j++) fr_heap_insert(hp, &things[j]);
+		while (fr_heap_pop(hp)) found++;
+	}
+
+	return found;
+}
+
+static uint64_t bench_trie_lookup(void *uctx, uint64_t ops)
+{
+	fr_trie_t	*ft = uctx;
+	uint64_t	i, found = 0;
+
+	for (i = 0; i < ops; i++) if (fr_trie_lookup(ft, &NEXT_THING(i)->key, 32)) found++;
+
+	return found;
+}
+
+static uint64_t bench_value_box_cast_uint32(UNUSED void *uctx, uint64_t ops)
+{
+	fr_value_box_t	src, dst;
+	uint64_t	i, total = 0;
+
+	fr_value_box_strdup_shallow(&src, NULL, "1234567", false);
+
+	for (i = 0; i < ops; i++) {
+		if (fr_value_box_cast(NULL, &dst, FR_TYPE_UINT32, NULL, &src) < 0) return 0;
+		total += dst.vb_uint32;
+	}
+
+	return total;
+}
+
+static uint64_t bench_value_box_cast_ipv4(UNUSED void *uctx, uint64_t ops)
+{
+	fr_value_box_t	src, dst;
+	uint64_t	i, total = 0;
+
+	fr_value_box_strdup_shallow(&src, NULL, "192.0.2.1", false);
+
+	for (i = 0; i < ops; i++) {
+		if (fr_value_box_cast(NULL, &dst, FR_TYPE_IPV4_ADDR, NULL, &src) < 0) return 0;
+		total += dst.vb_ip.addr.v4.s_addr;
+	}
+
+	return total;
+}
+
+static uint64_t bench_sbuff_out_uint32(UNUSED void *uctx, uint64_t ops)
+{
+	static char const	in[] = "1234567";
+	uint64_t		i, total = 0;
+	uint32_t		out;
+
+	for (i = 0; i < ops; i++) {
+		fr_sbuff_t sbuff = FR_SBUFF_IN(in, sizeof(in) - 1);
+
+		if (fr_sbuff_out(NULL, &out, &sbuff) <= 0) return 0;
+		total += out;
+	}
+
+	return total;
+}
+
+/*
+ *	A line in a users file.  An operation is scanning it to the
+ *	end of the line.
+ */
+static uint64_t bench_sbuff_adv_until(UNUSED void *uctx, uint64_t ops)
+{
+	static char const	in[] = "Framed-IP-Address := 192.0.2.1, Reply-Message = \"Hello there %{User-Name}\"\n";
+	uint64_t		i, total = 0;
+
+	for (i = 0; i < ops; i++) {
+		fr_sbuff_t sbuff = FR_SBUFF_IN(in, sizeof(in) - 1);
+
+		total += fr_sbuff_adv_until(&sbuff, SIZE_MAX, &FR_SBUFF_TERM("\n"), '\\');
+	}
+
+	return total;
+}
+
+/*
+ *	Attribute values are usually short, so an operation is one
+ *	encode or decode of 64 bytes.
+ */
+#define BENCH_BLOB	(64)
+
+static uint64_t bench_base64_encode(UNUSED void *uctx, uint64_t ops)
+{
+	uint8_t		in[BENCH_BLOB];
+	char		out[FR_BASE64_ENC_LENGTH(BENCH_BLOB) + 1];
+	uint64_t	i, total = 0;
+
+	for (i = 0; i < sizeof(in); i++) in[i] = i;
+
+	for (i = 0; i < ops; i++) total += fr_base64_encode(out, sizeof(out), in, sizeof(in));
+
+	return total;
+}
+
+static uint64_t bench_base64_decode(UNUSED void *uctx, uint64_t ops)
+{
+	uint8_t		bin[BENCH_BLOB], out[BENCH_BLOB];
+	char		in[FR_BASE64_ENC_LENGTH(BENCH_BLOB) + 1];
+	size_t		len;
+	uint64_t	i, total = 0;
+
+	for (i = 0; i < sizeof(bin); i++) bin[i] = i;
+	len = fr_base64_encode(in, sizeof(in), bin, sizeof(bin));
+
+	for (i = 0; i < ops; i++) {
+		if (fr_base64_decode(out, sizeof(out), in, len) < 0) return 0;
+		total += out[i & (BENCH_BLOB - 1)];
+	}
+
+	return total;
+}
+
+static uint64_t bench_bin2hex(UNUSED void *uctx, uint64_t ops)
+{
+	uint8_t		in[BENCH_BLOB];
+	char		out[(BENCH_BLOB * 2) + 1];
+	uint64_t	i, total = 0;
+
+	for (i = 0; i < sizeof(in); i++) in[i] = i;
+
+	for (i = 0; i < ops; i++) {
+		ssize_t slen;
+
+		slen = fr_bin2hex(&FR_SBUFF_OUT(out, sizeof(out)), &FR_DBUFF_TMP(in, sizeof(in)), SIZE_MAX);
+		if (slen <= 0) return 0;
+		total += slen;
+	}
+
+	return total;
+}
+
+static uint64_t bench_hex2bin(UNUSED void *uctx, uint64_t ops)
+{
+	uint8_t		bin[BENCH_BLOB], out[BENCH_BLOB];
+	char		in[(BENCH_BLOB * 2) + 1];
+	uint64_t	i, total = 0;
+
+	for (i = 0; i < sizeof(bin); i++) bin[i] = i;
+	if (fr_bin2hex(&FR_SBUFF_OUT(in, sizeof(in)), &FR_DBUFF_TMP(bin, sizeof(bin)), SIZE_MAX) <= 0) return 0;
+
+	for (i = 0; i < ops; i++) {
+		ssize_t slen;
+
+		slen = fr_hex2bin(NULL, &FR_DBUFF_TMP(out, sizeof(out)),
+				  &FR_SBUFF_IN(in, sizeof(in) - 1), true);
+		if (slen <= 0) return 0;
+		total += slen;
+	}
+
+	return total;
+}
+
+int main(int argc, char *argv[])
+{
+	TALLOC_CTX	*ctx;
+	fr_hash_table_t	*ht;
+	rbtree_t	*tree;
+	fr_heap_t	*hp;
+	fr_trie_t	*ft;
+	size_t		i;
+
+	if (argc > 1) fr_bench_filter = argv[1];
+
+	fr_time_start();
+
+	ctx = talloc_new(NULL);
+
+	things = talloc_zero_array(ctx, bench_thing, BENCH_ELEMENTS);
+	for (i = 0; i < BENCH_ELEMENTS; i++) things[i].key = fr_rand();
+
+	ht = fr_hash_table_create(ctx, thing_hash, thing_cmp, NULL);
+	tree = rbtree_alloc(ctx, thing_cmp, NULL, RBTREE_FLAG_NONE);
+	hp = fr_heap_alloc(ctx, thing_heap_cmp, bench_thing, heap);
+	ft = fr_trie_alloc(ctx);
+	if (!ht || !tree || !hp || !ft) {
+		fprintf(stderr, "bench_util: Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < BENCH_ELEMENTS; i++) {
+		fr_hash_table_insert(ht, &things[i]);
+		rbtree_insert(tree, &things[i]);
+		fr_trie_insert(ft, &things[i].key, 32, &things[i]);
+	}
+
+	fr_bench_run("fr_hash_table_find_by_data", bench_hash_table_find, ht, BENCH_OPS);
+	fr_bench_run("rbtree_finddata", bench_rbtree_find, tree, BENCH_OPS);
+	fr_bench_run("fr_heap_insert+pop", bench_heap_insert_pop, hp, BENCH_OPS);
+	fr_bench_run("fr_trie_lookup", bench_trie_lookup, ft, BENCH_OPS);
+	fr_bench_run("fr_value_box_cast(uint32)", bench_value_box_cast_uint32, NULL, BENCH_OPS);
+	fr_bench_run("fr_value_box_cast(ipv4addr)", bench_value_box_cast_ipv4, NULL, BENCH_OPS);
+	fr_bench_run("fr_sbuff_out(uint32)", bench_sbuff_out_uint32, NULL, BENCH_OPS);
+	fr_bench_run("fr_sbuff_adv_until", bench_sbuff_adv_until, NULL, BENCH_OPS);
+	fr_bench_run("fr_base64_encode", bench_base64_encode, NULL, BENCH_OPS);
+	fr_bench_run("fr_base64_decode", bench_base64_decode, NULL, BENCH_OPS);
+	fr_bench_run("fr_bin2hex", bench_bin2hex, NULL, BENCH_OPS);
+	fr_bench_run("fr_hex2bin", bench_hex2bin, NULL, BENCH_OPS);
+
+	talloc_free(ctx);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,657 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** B+tree implementation
+ *
+ * @file src/lib/util/btree.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/btree.h>
+#include <freeradius-devel/util/debug.h>
+
+/*
+ *	All of the elements are stored in the leaves, in sorted
+ *	order.  The leaves are linked together, so iteration is a
+ *	walk over flat arrays.
+ *
+ *	Each inner node holds up to BTREE_MAX keys, and one more
+ *	child than it has keys.  key[i] is the smallest element in
+ *	the subtree under child[i + 1].  The keys are pointers to
+ *	elements in the leaves, so there is nothing to allocate or
+ *	copy.  When an element is deleted or replaced, any key
+ *	which points to it is updated.
+ *
+ *	Compared to an rbtree, there is one allocation for every
+ *	BTREE_MAX / 2 to BTREE_MAX elements, rather than one per
+ *	element, and a lookup touches log(n) / log(BTREE_MAX / 2)
+ *	nodes rather than log2(n).
+ *
+ *	Full nodes are split on the way down when inserting, so an
+ *	allocation failure never leaves the tree half modified.
+ *	Splitting a full inner node moves one key up to the parent,
+ *	so inner nodes can have one fewer key than leaves.
+ */
+#define BTREE_MAX		(32)
+#define BTREE_LEAF_MIN		(BTREE_MAX / 2)
+#define BTREE_INNER_MIN		((BTREE_MAX - 1) / 2)
+#define BTREE_MIN(_node)	((_node)->leaf ? BTREE_LEAF_MIN : BTREE_INNER_MIN)
+
+typedef struct {
+	uint16_t		num;		//!< number of elements in a leaf, or keys in an inner node.
+	bool			leaf;		//!< whether this is a leaf.
+} fr_btree_node_t;
+
+struct fr_btree_leaf_s {
+	fr_btree_node_t		node;
+	fr_btree_leaf_t		*prev;		//!< previous leaf, in order.
+	fr_btree_leaf_t		*next;		//!< next leaf, in order.
+	void			*data[BTREE_MAX];
+};
+
+typedef struct {
+	fr_btree_node_t		node;
+	void			*key[BTREE_MAX];
+	fr_btree_node_t		*child[BTREE_MAX + 1];
+} fr_btree_inner_t;
+
+struct fr_btree_s {
+	fr_btree_node_t		*root;
+	fr_btree_leaf_t		*first;		//!< leftmost leaf.
+	uint32_t		num_elements;
+	rb_comparator_t		compare;
+	rb_free_t		free;
+	bool			replace;
+	bool			being_freed;	//!< Prevent double frees in talloc_destructor.
+	char const		*type;		//!< Talloc type to check elements against.
+};
+
+#define LEAF(_node)	((fr_btree_leaf_t *) (_node))
+#define INNER(_node)	((fr_btree_inner_t *) (_node))
+
+static int _btree_free(fr_btree_t *tree)
+{
+	fr_btree_leaf_t	*leaf;
+	int		i;
+
+	if (tree->being_freed) return -1;
+	tree->being_freed = true;
+
+	if (tree->free) {
+		for (leaf = tree->first; leaf; leaf = leaf->next) {
+			for (i = 0; i < leaf->node.num; i++) tree->free(leaf->data[i]);
+		}
+	}
+
+	return 0;
+}
+
+/** Create a new B+tree
+ *
+ * @param[in] ctx	to allocate the tree in.
+ * @param[in] compare	Comparator used to compare elements.
+ * @param[in] type	Talloc type of elements, or NULL.
+ * @param[in] node_free	Optional function used to free data if elements are
+ *			deleted or replaced.
+ * @param[in] flags	To modify tree behaviour.
+ * @return
+ *	- A new B+tree on success.
+ *	- NULL on failure.
+ */
+fr_btree_t *_fr_btree_alloc(TALLOC_CTX *ctx, rb_comparator_t compare,
+			    char const *type, rb_free_t node_free, int flags)
+{
+	fr_btree_t	*tree;
+	fr_btree_leaf_t	*leaf;
+
+	tree = talloc_zero(ctx, fr_btree_t);
+	if (!tree) return NULL;
+
+	leaf = talloc_zero(tree, fr_btree_leaf_t);
+	if (!leaf) {
+		talloc_free(tree);
+		return NULL;
+	}
+	leaf->node.leaf = true;
+
+	tree->root = &leaf->node;
+	tree->first = leaf;
+	tree->compare = compare;
+	tree->free = node_free;
+	tree->type = type;
+	tree->replace = ((flags & FR_BTREE_FLAG_REPLACE) != 0);
+	talloc_set_destructor(tree, _btree_free);
+
+	return tree;
+}
+
+/** Find the first element in a leaf which is >= data
+ *
+ */
+static inline int btree_leaf_search(fr_btree_t *tree, fr_btree_leaf_t *leaf, void const *data, bool *found)
+{
+	int lo = 0, hi = leaf->node.num;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = tree->compare(data, leaf->data[mid]);
+
+		if (cmp == 0) {
+			*found = true;
+			return mid;
+		}
+
+		if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	*found = false;
+	return lo;
+}
+
+/** Find the child of an inner node which would contain data
+ *
+ */
+static inline int btree_inner_search(fr_btree_t *tree, fr_btree_inner_t *inner, void const *data)
+{
+	int lo = 0, hi = inner->node.num;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (tree->compare(data, inner->key[mid]) < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return lo;
+}
+
+static inline void *btree_leftmost(fr_btree_node_t *node)
+{
+	while (!node->leaf) node = INNER(node)->child[0];
+
+	return LEAF(node)->data[0];
+}
+
+/** Find the leaf which would contain data
+ *
+ */
+static inline fr_btree_leaf_t *btree_find_leaf(fr_btree_t *tree, void const *data)
+{
+	fr_btree_node_t *node = tree->root;
+
+	while (!node->leaf) node = INNER(node)->child[btree_inner_search(tree, INNER(node), data)];
+
+	return LEAF(node);
+}
+
+/** Find an element in the tree
+ *
+ * @param[in] tree	to search in.
+ * @param[in] data	to compare against.
+ * @return
+ *	- NULL if no matching element was found.
+ *	- the matching element.
+ */
+void *fr_btree_finddata(fr_btree_t *tree, void const *data)
+{
+	fr_btree_leaf_t	*leaf;
+	bool		found;
+	int		i;
+
+	leaf = btree_find_leaf(tree, data);
+	i = btree_leaf_search(tree, leaf, data, &found);
+	if (!found) return NULL;
+
+	return leaf->data[i];
+}
+
+/** Split a full node in two
+ *
+ * @return
+ *	- NULL on error.
+ *	- the new right hand node, and the smallest element in it.
+ */
+static fr_btree_node_t *btree_split(fr_btree_t *tree, fr_btree_node_t *node, void **key)
+{
+	int half = node->num / 2;
+
+	if (node->leaf) {
+		fr_btree_leaf_t *leaf = LEAF(node), *right;
+
+		right = talloc_zero(tree, fr_btree_leaf_t);
+		if (!right) return NULL;
+
+		right->node.leaf = true;
+		right->node.num = node->num - half;
+		memcpy(right->data, leaf->data + half, sizeof(right->data[0]) * right->node.num);
+		node->num = half;
+
+		right->prev = leaf;
+		right->next = leaf->next;
+		if (leaf->next) leaf->next->prev = right;
+		leaf->next = right;
+
+		*key = right->data[0];
+		return &right->node;
+
+	} else {
+		fr_btree_inner_t *inner = INNER(node), *right;
+
+		/*
+		 *	The middle key moves up to the parent.
+		 */
+		right = talloc_zero(tree, fr_btree_inner_t);
+		if (!right) return NULL;
+
+		right->node.num = node->num - half - 1;
+		memcpy(right->key, inner->key + half + 1, sizeof(right->key[0]) * right->node.num);
+		memcpy(right->child, inner->child + half + 1, sizeof(right->child[0]) * (right->node.num + 1));
+		node->num = half;
+
+		*key = inner->key[half];
+		return &right->node;
+	}
+}
+
+/** Insert an element into the tree
+ *
+ * @param[in] tree	to insert into.
+ * @param[in] data	to insert.
+ * @return
+ *	- true on success.
+ *	- false if a matching element already exists, and the tree isn't
+ *	  a replace tree, or we ran out of memory.
+ */
+bool fr_btree_insert(fr_btree_t *tree, void const *data)
+{
+	fr_btree_node_t	*node, *split;
+	fr_btree_leaf_t	*leaf;
+	void		*key, *old, **sep = NULL;
+	bool		found;
+	int		i;
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (tree->type) (void)_talloc_get_type_abort(data, tree->type, __location__);
+#endif
+
+	/*
+	 *	The root is full, so the tree grows by one level.
+	 */
+	if (tree->root->num == BTREE_MAX) {
+		fr_btree_inner_t *root;
+
+		root = talloc_zero(tree, fr_btree_inner_t);
+		if (!root) return false;
+
+		split = btree_split(tree, tree->root, &key);
+		if (!split) {
+			talloc_free(root);
+			return false;
+		}
+
+		root->node.num = 1;
+		root->key[0] = key;
+		root->child[0] = tree->root;
+		root->child[1] = split;
+		tree->root = &root->node;
+	}
+
+	for (node = tree->root; !node->leaf; node = INNER(node)->child[i]) {
+		fr_btree_inner_t *inner = INNER(node);
+
+		i = btree_inner_search(tree, inner, data);
+
+		/*
+		 *	Split full children before we descend, so
+		 *	that there's always room for a new key.
+		 */
+		if (inner->child[i]->num == BTREE_MAX) {
+			split = btree_split(tree, inner->child[i], &key);
+			if (!split) return false;
+
+			memmove(inner->key + i + 1, inner->key + i, sizeof(inner->key[0]) * (node->num - i));
+			memmove(inner->child + i + 2, inner->child + i + 1, sizeof(inner->child[0]) * (node->num - i));
+			inner->key[i] = key;
+			inner->child[i + 1] = split;
+			node->num++;
+
+			if (tree->compare(data, key) >= 0) i++;
+		}
+
+		/*
+		 *	The deepest key we go to the right of may be
+		 *	the element we're replacing.
+		 */
+		if (i > 0) sep = &inner->key[i - 1];
+	}
+
+	leaf = LEAF(node);
+	i = btree_leaf_search(tree, leaf, data, &found);
+	if (found) {
+		if (!tree->replace) return false;
+
+		old = leaf->data[i];
+		memcpy(&leaf->data[i], &data, sizeof(leaf->data[i]));
+		if ((i == 0) && sep) {
+			fr_assert(*sep == old);
+			*sep = leaf->data[0];
+		}
+
+		if (tree->free) tree->free(old);
+		return true;
+	}
+
+	memmove(leaf->data + i + 1, leaf->data + i, sizeof(leaf->data[0]) * (node->num - i));
+	memcpy(&leaf->data[i], &data, sizeof(leaf->data[i]));
+	node->num++;
+	tree->num_elements++;
+
+	return true;
+}
+
+/** Fix a child which has too few entries, by borrowing from, or merging with, a sibling
+ *
+ */
+static void btree_rebalance(fr_btree_inner_t *parent, int i)
+{
+	fr_btree_node_t *node = parent->child[i];
+	fr_btree_node_t *left = (i > 0) ? parent->child[i - 1] : NULL;
+	fr_btree_node_t *right = (i < parent->node.num) ? parent->child[i + 1] : NULL;
+
+	if (node->leaf) {
+		fr_btree_leaf_t *leaf = LEAF(node);
+
+		if (left && (left->num > BTREE_LEAF_MIN)) {
+			memmove(leaf->data + 1, leaf->data, sizeof(leaf->data[0]) * node->num);
+			leaf->data[0] = LEAF(left)->data[--left->num];
+			node->num++;
+			parent->key[i - 1] = leaf->data[0];
+			return;
+		}
+
+		if (right && (right->num > BTREE_LEAF_MIN)) {
+			leaf->data[node->num++] = LEAF(right)->data[0];
+			memmove(LEAF(right)->data, LEAF(right)->data + 1, sizeof(leaf->data[0]) * --right->num);
+			parent->key[i] = LEAF(right)->data[0];
+			return;
+		}
+
+		/*
+		 *	Merge the right hand leaf of the pair into
+		 *	the left hand one.
+		 */
+		if (left) {
+			right = node;
+			node = left;
+			i--;
+		}
+
+		memcpy(LEAF(node)->data + node->num, LEAF(right)->data, sizeof(leaf->data[0]) * right->num);
+		node->num += right->num;
+
+		LEAF(node)->next = LEAF(right)->next;
+		if (LEAF(right)->next) LEAF(right)->next->prev = LEAF(node);
+
+	} else {
+		fr_btree_inner_t *inner = INNER(node);
+
+		if (left && (left->num > BTREE_INNER_MIN)) {
+			memmove(inner->key + 1, inner->key, sizeof(inner->key[0]) * node->num);
+			memmove(inner->child + 1, inner->child, sizeof(inner->child[0]) * (node->num + 1));
+			inner->key[0] = parent->key[i - 1];
+			inner->child[0] = INNER(left)->child[left->num];
+			node->num++;
+
+			parent->key[i - 1] = INNER(left)->key[--left->num];
+			return;
+		}
+
+		if (right && (right->num > BTREE_INNER_MIN)) {
+			inner->key[node->num] = parent->key[i];
+			inner->child[node->num + 1] = INNER(right)->child[0];
+			node->num++;
+
+			parent->key[i] = INNER(right)->key[0];
+			right->num--;
+			memmove(INNER(right)->key, INNER(right)->key + 1, sizeof(inner->key[0]) * right->num);
+			memmove(INNER(right)->child, INNER(right)->child + 1, sizeof(inner->child[0]) * (right->num + 1));
+			return;
+		}
+
+		if (left) {
+			right = node;
+			node = left;
+			i--;
+		}
+
+		/*
+		 *	The key between the two nodes moves down.
+		 */
+		INNER(node)->key[node->num] = parent->key[i];
+		memcpy(INNER(node)->key + node->num + 1, INNER(right)->key, sizeof(inner->key[0]) * right->num);
+		memcpy(INNER(node)->child + node->num + 1, INNER(right)->child,
+		       sizeof(inner->child[0]) * (right->num + 1));
+		node->num += right->num + 1;
+	}
+
+	/*
+	 *	"right" is now empty, and is child[i + 1].  Remove it,
+	 *	and the key which points to it.
+	 */
+	memmove(parent->key + i, parent->key + i + 1, sizeof(parent->key[0]) * (parent->node.num - i - 1));
+	memmove(parent->child + i + 1, parent->child + i + 2, sizeof(parent->child[0]) * (parent->node.num - i - 1));
+	parent->node.num--;
+
+	talloc_free(right);
+}
+
+static void *btree_delete(fr_btree_t *tree, fr_btree_node_t *node, void const *data)
+{
+	void	*deleted;
+	int	i;
+
+	if (node->leaf) {
+		fr_btree_leaf_t	*leaf = LEAF(node);
+		bool		found;
+
+		i = btree_leaf_search(tree, leaf, data, &found);
+		if (!found) return NULL;
+
+		deleted = leaf->data[i];
+		node->num--;
+		memmove(leaf->data + i, leaf->data + i + 1, sizeof(leaf->data[0]) * (node->num - i));
+
+		return deleted;
+	}
+
+	i = btree_inner_search(tree, INNER(node), data);
+
+	deleted = btree_delete(tree, INNER(node)->child[i], data);
+	if (!deleted) return NULL;
+
+	/*
+	 *	We deleted the smallest element of the child, which
+	 *	is used as our key.
+	 */
+	if ((i > 0) && (INNER(node)->key[i - 1] == deleted)) {
+		INNER(node)->key[i - 1] = btree_leftmost(INNER(node)->child[i]);
+	}
+
+	if (INNER(node)->child[i]->num < BTREE_MIN(INNER(node)->child[i])) btree_rebalance(INNER(node), i);
+
+	return deleted;
+}
+
+/** Delete an element from the tree
+ *
+ * @param[in] tree	to delete from.
+ * @param[in] data	to compare against.
+ * @return
+ *	- true if a matching element was found and deleted.
+ *	- false if no matching element was found.
+ */
+bool fr_btree_deletebydata(fr_btree_t *tree, void const *data)
+{
+	void *deleted;
+
+	deleted = btree_delete(tree, tree->root, data);
+	if (!deleted) return false;
+
+	tree->num_elements--;
+
+	/*
+	 *	The root has a single child, so the tree shrinks by
+	 *	one level.
+	 */
+	if (!tree->root->leaf && (tree->root->num == 0)) {
+		fr_btree_node_t *old = tree->root;
+
+		tree->root = INNER(old)->child[0];
+		talloc_free(old);
+	}
+
+	if (tree->free) tree->free(deleted);
+
+	return true;
+}
+
+/** Return the number of elements in the tree
+ *
+ */
+uint32_t fr_btree_num_elements(fr_btree_t *tree)
+{
+	return tree->num_elements;
+}
+
+/** Initialise an iterator, and return the first element in the tree
+ *
+ * @param[in] tree	to iterate over.
+ * @param[out] iter	to initialise.
+ * @return
+ *	- The first element in the tree.
+ *	- NULL if the tree is empty.
+ */
+void *fr_btree_iter_init(fr_btree_t *tree, fr_btree_iter_t *iter)
+{
+	iter->leaf = tree->first;
+	iter->idx = -1;
+
+	return fr_btree_iter_next(iter);
+}
+
+/** Initialise an iterator, and return the first element which is >= data
+ *
+ * @param[in] tree	to iterate over.
+ * @param[out] iter	to initialise.
+ * @param[in] data	to compare against.
+ * @return
+ *	- The first element which is >= data.
+ *	- NULL if there is no such element.
+ */
+void *fr_btree_iter_init_at(fr_btree_t *tree, fr_btree_iter_t *iter, void const *data)
+{
+	bool found;
+
+	iter->leaf = btree_find_leaf(tree, data);
+	iter->idx = btree_leaf_search(tree, iter->leaf, data, &found) - 1;
+
+	return fr_btree_iter_next(iter);
+}
+
+/** Return the next element in the tree
+ *
+ * @param[in] iter	which has been initialised.
+ * @return
+ *	- The next element.
+ *	- NULL if there are no more elements.
+ */
+void *fr_btree_iter_next(fr_btree_iter_t *iter)
+{
+	while (iter->leaf) {
+		if (++iter->idx < iter->leaf->node.num) return iter->leaf->data[iter->idx];
+
+		iter->leaf = iter->leaf->next;
+		iter->idx = -1;
+	}
+
+	return NULL;
+}
+
+/** Walk the tree in order
+ *
+ * @param[in] tree	to walk.
+ * @param[in] callback	to call for each element.
+ * @param[in] uctx	to pass to the callback.
+ * @return
+ *	- 0 if all callbacks returned 0.
+ *	- the first non-zero value returned by a callback.
+ */
+int fr_btree_walk(fr_btree_t *tree, rb_walker_t callback, void *uctx)
+{
+	fr_btree_leaf_t	*leaf;
+	int		i, ret;
+
+	for (leaf = tree->first; leaf; leaf = leaf->next) {
+		for (i = 0; i < leaf->node.num; i++) {
+			ret = callback(leaf->data[i], uctx);
+			if (ret != 0) return ret;
+		}
+	}
+
+	return 0;
+}
+
+/** Return an array of all of the elements in the tree, in order
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] out	where to write the array.
+ * @param[in] tree	to flatten.
+ * @return the number of elements in the array.
+ */
+uint32_t fr_btree_flatten(TALLOC_CTX *ctx, void **out[], fr_btree_t *tree)
+{
+	fr_btree_leaf_t	*leaf;
+	void		**list;
+	uint32_t	num = 0;
+
+	if (!tree->num_elements) {
+		*out = NULL;
+		return 0;
+	}
+
+	list = talloc_array(ctx, void *, tree->num_elements);
+	if (!list) {
+		*out = NULL;
+		return 0;
+	}
+
+	for (leaf = tree->first; leaf; leaf = leaf->next) {
+		memcpy(list + num, leaf->data, sizeof(list[0]) * leaf->node.num);
+		num += leaf->node.num;
+	}
+
+	*out = list;
+	return num;
+}
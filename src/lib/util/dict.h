@@ -80,6 +80,10 @@ typedef struct {
 								///< See .is_unknown to determine if it is
 								///< ephemeral.
 
+	unsigned int		is_cached : 1;			//!< This unknown attribute is shared, and owned
+								///< by a thread's unknown attribute cache.
+								///< It must not be freed or modified.
+
 	unsigned int		internal : 1;			//!< Internal attribute, should not be received
 								///< in protocol packets, should not be encoded.
 	unsigned int		array : 1; 			//!< Pack multiples into 1 attr.
@@ -321,6 +325,10 @@ fr_dict_attr_t const	*fr_dict_unknown_add(fr_dict_t *dict, fr_dict_attr_t const
 
 void			fr_dict_unknown_free(fr_dict_attr_t const **da);
 
+int			fr_dict_unknown_cache_init(uint32_t max);
+
+fr_dict_attr_t const	*fr_dict_unknown_acopy(TALLOC_CTX *ctx, fr_dict_attr_t const *da);
+
 fr_dict_attr_t		*fr_dict_unknown_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da);
 
 fr_dict_attr_t		*fr_dict_unknown_vendor_afrom_num(TALLOC_CTX *ctx,
@@ -584,6 +592,10 @@ int			fr_dict_global_ctx_dir_set(char const *dict_dir);
 
 void			fr_dict_global_read_only(void);
 
+void			fr_dict_global_lazy_vendors(bool enable);
+
+void			fr_dict_global_lazy_vendors_freeze(void);
+
 char const		*fr_dict_global_dir(void);
 
 fr_dict_t		*fr_dict_unconst(fr_dict_t const *dict);
@@ -75,6 +75,10 @@ struct fr_dict {
 	fr_hash_table_t		*vendors_by_name;	//!< Lookup vendor by name.
 	fr_hash_table_t		*vendors_by_num;	//!< Lookup vendor by PEN.
 
+	fr_hash_table_t		*vendors_lazy_by_name;	//!< Vendor dictionaries which haven't been loaded yet.
+							///< NULL if there are none.
+	fr_hash_table_t		*vendors_lazy_by_num;	//!< As above, but by PEN.
+
 	fr_hash_table_t		*attributes_combo;	//!< Lookup variants of polymorphic attributes.
 
 	fr_dict_attr_t		*root;			//!< Root attribute of this dictionary.
@@ -102,6 +106,8 @@ struct fr_dict {
 
 struct fr_dict_gctx_s {
 	bool			read_only;
+	bool			lazy_vendors;		//!< Defer loading vendor dictionaries until
+							///< one of their attributes is referenced.
 	char			*dict_dir_default;	//!< The default location for loading dictionaries if one
 							///< wasn't provided.
 
@@ -123,6 +129,17 @@ struct fr_dict_gctx_s {
 	fr_dict_t		*internal;
 };
 
+/** A vendor dictionary file which was found, but whose loading has been deferred
+ *
+ */
+typedef struct {
+	fr_dict_vendor_t	vendor;			//!< Name and PEN of the vendor the file defines.
+							///< Must be first, so the vendor hash and comparison
+							///< functions can be used on this struct.
+	char			*dir;			//!< Directory of the file which $INCLUDEd this one.
+	char			*filename;		//!< As written in the $INCLUDE.
+} dict_vendor_lazy_t;
+
 extern fr_dict_gctx_t *dict_gctx;
 
 extern fr_table_num_ordered_t const	date_precision_table[];
@@ -154,6 +171,13 @@ int			dict_protocol_add(fr_dict_t *dict);
 
 int			dict_vendor_add(fr_dict_t *dict, char const *name, unsigned int num);
 
+int			dict_vendor_lazy_add(fr_dict_t *dict, char const *name, unsigned int num,
+					     char const *dir, char const *filename);
+
+bool			dict_vendor_lazy_load(fr_dict_t const *dict, char const *name, unsigned int num);
+
+int			dict_vendor_lazy_read(fr_dict_t *dict, char const *dir, char const *filename);
+
 int			dict_attr_add_to_namespace(fr_dict_t *dict,
 						   fr_dict_attr_t const *parent, fr_dict_attr_t *da) CC_HINT(nonnull);
 
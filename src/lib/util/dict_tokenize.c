@@ -1527,6 +1527,14 @@ static int dict_read_process_vendor(fr_dict_t *dict, char **argv, int argc)
 		type = length = 1;
 	}
 
+	/*
+	 *	If another file defining this vendor was deferred,
+	 *	load it now, so that definitions are applied in
+	 *	the same order as if nothing was deferred.
+	 */
+	(void)dict_vendor_lazy_load(dict, argv[0], 0);
+	(void)dict_vendor_lazy_load(dict, NULL, value);
+
 	/* Create a new VENDOR entry for the list */
 	if (dict_vendor_add(dict, argv[0], value) < 0) return -1;
 
@@ -1545,6 +1553,93 @@ static int dict_read_process_vendor(fr_dict_t *dict, char **argv, int argc)
 	return 0;
 }
 
+/** Check whether a vendor dictionary can be loaded later, and if so record it
+ *
+ * Only files which define exactly one vendor, and place all of their
+ * definitions inside a single BEGIN-VENDOR block for that vendor, can be
+ * deferred.  Anything else may change the dictionary in ways which can't
+ * be found by looking up a vendor, and is loaded immediately.
+ *
+ * @param[in] dict	the file is being loaded into.
+ * @param[in] dir_name	of the including file.
+ * @param[in] filename	as written in the $INCLUDE.
+ * @param[in] fn	full path of the file.
+ * @return
+ *	- true if the file was deferred.
+ *	- false if the file should be loaded now.
+ */
+static bool dict_vendor_lazy_prescan(fr_dict_t *dict, char const *dir_name, char const *filename, char const *fn)
+{
+	FILE		*fp;
+	char		buf[256];
+	char		*p;
+	char		*argv[MAX_ARGV];
+	int		argc;
+	char		name[FR_DICT_VENDOR_MAX_NAME_LEN];
+	unsigned int	pen = 0;
+	bool		seen_vendor = false, seen_block = false, in_block = false;
+	bool		ret = false;
+
+	fp = fopen(fn, "r");
+	if (!fp) return false;	/* The normal path produces the error */
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		p = strchr(buf, '#');
+		if (p) *p = '\0';
+
+		argc = fr_dict_str_to_argv(buf, argv, MAX_ARGV);
+		if (argc == 0) continue;
+
+		if (strcasecmp(argv[0], "VENDOR") == 0) {
+			if (seen_vendor || (argc < 3) || (strlen(argv[1]) >= sizeof(name)) ||
+			    !dict_read_sscanf_i(&pen, argv[2])) goto done;
+
+			strlcpy(name, argv[1], sizeof(name));
+			seen_vendor = true;
+			continue;
+		}
+
+		if (strcasecmp(argv[0], "BEGIN-VENDOR") == 0) {
+			if (!seen_vendor || seen_block || (argc != 2) || (strcasecmp(argv[1], name) != 0)) goto done;
+
+			seen_block = in_block = true;
+			continue;
+		}
+
+		if (strcasecmp(argv[0], "END-VENDOR") == 0) {
+			if (!in_block) goto done;
+
+			in_block = false;
+			continue;
+		}
+
+		/*
+		 *	Definitions outside of the vendor block,
+		 *	$INCLUDEs, or protocol changes all mean the
+		 *	file isn't self contained.
+		 */
+		if (!in_block || (argv[0][0] == '$') ||
+		    (strcasecmp(argv[0], "PROTOCOL") == 0) ||
+		    (strcasecmp(argv[0], "BEGIN-PROTOCOL") == 0) ||
+		    (strcasecmp(argv[0], "END-PROTOCOL") == 0)) goto done;
+	}
+
+	if (!seen_block || in_block) goto done;
+
+	/*
+	 *	Vendors which are already known may have had
+	 *	attributes added from other files.
+	 */
+	if (fr_hash_table_find_by_data(dict->vendors_by_name, &(fr_dict_vendor_t){ .name = name }) ||
+	    fr_hash_table_find_by_data(dict->vendors_by_num, &(fr_dict_vendor_t){ .pen = pen })) goto done;
+
+	ret = (dict_vendor_lazy_add(dict, name, pen, dir_name, filename) == 0);
+
+done:
+	fclose(fp);
+	return ret;
+}
+
 static int dict_finalise(dict_tokenize_ctx_t *ctx)
 {
 	if (dict_fixup_apply(&ctx->fixup) < 0) return -1;
@@ -1640,6 +1735,14 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 
 	ctx->stack[ctx->stack_depth].filename = fn;
 
+	/*
+	 *	Vendor dictionaries included at the top level of a
+	 *	protocol may be loaded when they're first referenced.
+	 */
+	if (src_file && ctx->dict->gctx->lazy_vendors && ctx->dict->root &&
+	    (CURRENT_FRAME(ctx)->da == ctx->dict->root) &&
+	    dict_vendor_lazy_prescan(ctx->dict, dir_name, filename, fn)) return 0;
+
 	if ((fp = fopen(fn, "r")) == NULL) {
 		if (!src_file) {
 			fr_strerror_printf_push("Couldn't open dictionary %s: %s", fr_syserror(errno), fn);
@@ -2306,6 +2409,20 @@ static int dict_from_file(fr_dict_t *dict,
 	return dict_finalise(&ctx);
 }
 
+/** Load a vendor dictionary which was deferred by #dict_vendor_lazy_prescan
+ *
+ * @param[in] dict	to load the vendor into.
+ * @param[in] dir	of the file which $INCLUDEd the vendor dictionary.
+ * @param[in] filename	of the vendor dictionary.
+ * @return
+ *	- 0 on success.
+ *	- <0 on failure.
+ */
+int dict_vendor_lazy_read(fr_dict_t *dict, char const *dir, char const *filename)
+{
+	return dict_from_file(dict, dir, filename, NULL, 0);
+}
+
 /** (Re-)Initialize the special internal dictionary
  *
  * This dictionary has additional programatically generated attributes added to it,
@@ -23,6 +23,43 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/thread_local.h>
+
+#include <pthread.h>
+
+/** Per-thread cache of unknown attributes
+ *
+ * Unknown attributes are normally owned by the pair which uses them,
+ * and are copied each time the pair is created, copied or moved.  For
+ * packets which carry attributes we have no dictionary entry for, that
+ * means a chain of allocations per attribute, per request.
+ *
+ * Threads which process requests can instead keep one shared definition
+ * of each unknown attribute they've seen.  Shared definitions are marked
+ * with flags.is_cached, are immutable, and are never freed.  That means
+ * pairs can be passed between threads (or outlive the thread) without
+ * caring who created their unknown attribute.
+ */
+typedef struct dict_unknown_cache_s dict_unknown_cache_t;
+struct dict_unknown_cache_s {
+	fr_hash_table_t		*ht;		//!< Unknown attributes, by parent, number and type.
+	uint32_t		max;		//!< Maximum number of entries.  Once full, unknown
+						///< attributes are copied as normal.
+	dict_unknown_cache_t	*next;		//!< Next cache which is no longer used by a thread.
+};
+
+static _Thread_local dict_unknown_cache_t *dict_unknown_cache;
+
+/*
+ *	Entries in the cache may still be referenced after the thread
+ *	which created them exits, so caches are never freed.  They're
+ *	instead handed to the next thread which needs one.
+ */
+static dict_unknown_cache_t	*dict_unknown_cache_unused;
+static pthread_mutex_t		dict_unknown_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define DICT_UNKNOWN_CACHE_MAX	(4096)
 
 /** Converts an unknown to a known by adding it to the internal dictionaries.
  *
@@ -153,8 +190,8 @@ void fr_dict_unknown_free(fr_dict_attr_t const **da)
 
 	if (!da || !*da) return;
 
-	/* Don't free real DAs */
-	if (!(*da)->flags.is_unknown) {
+	/* Don't free real DAs, or shared ones */
+	if (!(*da)->flags.is_unknown || (*da)->flags.is_cached) {
 		return;
 	}
 
@@ -164,6 +201,176 @@ void fr_dict_unknown_free(fr_dict_attr_t const **da)
 	*tmp = NULL;
 }
 
+static uint32_t dict_unknown_cache_hash(void const *data)
+{
+	fr_dict_attr_t const	*da = data;
+	uint32_t		hash;
+
+	hash = fr_hash(&da->parent, sizeof(da->parent));
+	hash = fr_hash_update(&da->attr, sizeof(da->attr), hash);
+	return fr_hash_update(&da->type, sizeof(da->type), hash);
+}
+
+static int dict_unknown_cache_cmp(void const *one, void const *two)
+{
+	fr_dict_attr_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->parent > b->parent) - (a->parent < b->parent);
+	if (ret != 0) return ret;
+
+	ret = (a->attr > b->attr) - (a->attr < b->attr);
+	if (ret != 0) return ret;
+
+	ret = (a->type > b->type) - (a->type < b->type);
+	if (ret != 0) return ret;
+
+	ret = (a->flags.is_raw > b->flags.is_raw) - (a->flags.is_raw < b->flags.is_raw);
+	if (ret != 0) return ret;
+
+	ret = (a->flags.type_size > b->flags.type_size) - (a->flags.type_size < b->flags.type_size);
+	if (ret != 0) return ret;
+
+	ret = (a->flags.length > b->flags.length) - (a->flags.length < b->flags.length);
+	if (ret != 0) return ret;
+
+	return strcmp(a->name, b->name);
+}
+
+/** Hand the cache to the next thread that needs one
+ *
+ */
+static void _dict_unknown_cache_release(void *arg)
+{
+	dict_unknown_cache_t *cache = arg;
+
+	if (dict_unknown_cache == cache) dict_unknown_cache = NULL;
+
+	pthread_mutex_lock(&dict_unknown_cache_mutex);
+	cache->next = dict_unknown_cache_unused;
+	dict_unknown_cache_unused = cache;
+	pthread_mutex_unlock(&dict_unknown_cache_mutex);
+}
+
+/** Set up the unknown attribute cache for this thread
+ *
+ * @param[in] max	number of unknown attributes to cache.
+ *			If 0, the default is used.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_dict_unknown_cache_init(uint32_t max)
+{
+	dict_unknown_cache_t *cache;
+
+	if (dict_unknown_cache) return 0;
+
+	pthread_mutex_lock(&dict_unknown_cache_mutex);
+	cache = dict_unknown_cache_unused;
+	if (cache) dict_unknown_cache_unused = cache->next;
+	pthread_mutex_unlock(&dict_unknown_cache_mutex);
+
+	if (!cache) {
+		cache = talloc_zero(NULL, dict_unknown_cache_t);
+		if (!cache) return -1;
+
+		cache->ht = fr_hash_table_create(cache, dict_unknown_cache_hash, dict_unknown_cache_cmp, NULL);
+		if (!cache->ht) {
+			talloc_free(cache);
+			return -1;
+		}
+	}
+	cache->next = NULL;
+	cache->max = max ? max : DICT_UNKNOWN_CACHE_MAX;
+
+	fr_thread_local_set_destructor(dict_unknown_cache, _dict_unknown_cache_release, cache);
+
+	return 0;
+}
+
+/** Find, or add, the shared copy of an unknown attribute
+ *
+ * @param[in] cache	to search.
+ * @param[in] da	unknown attribute to find.
+ * @return
+ *	- The shared copy.
+ *	- NULL if the cache is full, or we ran out of memory.
+ */
+static fr_dict_attr_t const *dict_unknown_cache_find(dict_unknown_cache_t *cache, fr_dict_attr_t const *da)
+{
+	fr_dict_attr_t const	*parent = da->parent;
+	fr_dict_attr_t const	*found;
+	fr_dict_attr_t		*n;
+	fr_dict_attr_flags_t	flags = da->flags;
+
+	if (da->flags.is_cached) return da;
+
+	/*
+	 *	Unknown parents are shared, too, so that all
+	 *	entries end up keyed by a parent which never
+	 *	goes away.
+	 */
+	if (parent->flags.is_unknown) {
+		parent = dict_unknown_cache_find(cache, parent);
+		if (!parent) return NULL;
+	}
+
+	found = fr_hash_table_find_by_data(cache->ht, &(fr_dict_attr_t){
+						.parent = parent,
+						.attr = da->attr,
+						.type = da->type,
+						.flags = da->flags,
+						.name = da->name
+					   });
+	if (found) return found;
+
+	if ((uint32_t)fr_hash_table_num_elements(cache->ht) >= cache->max) return NULL;
+
+	n = dict_attr_alloc_null(cache);
+	if (!n) return NULL;
+
+	flags.is_cached = 1;
+	if (dict_attr_init(&n, parent, da->name, da->attr, da->type, &flags) < 0) {
+	error:
+		talloc_free(n);
+		return NULL;
+	}
+	dict_attr_ext_copy_all(&n, da);
+	DA_VERIFY(n);
+
+	if (!fr_hash_table_insert(cache->ht, n)) goto error;
+
+	return n;
+}
+
+/** Get an unknown attribute which can be used by a pair
+ *
+ * If this thread has an unknown attribute cache, the shared copy of the
+ * unknown attribute is returned.  It must not be freed.  Otherwise a
+ * copy of the complete unknown hierarchy is allocated in ctx, as with
+ * #fr_dict_unknown_afrom_da.
+ *
+ * @param[in] ctx	to allocate the copy in, if one is needed.
+ * @param[in] da	unknown attribute to copy.
+ * @return
+ *	- An unknown attribute equivalent to da.
+ *	- NULL on error.
+ */
+fr_dict_attr_t const *fr_dict_unknown_acopy(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
+{
+	fr_dict_attr_t const *shared;
+
+	if (da->flags.is_cached) return da;
+
+	if (dict_unknown_cache) {
+		shared = dict_unknown_cache_find(dict_unknown_cache, da);
+		if (shared) return shared;
+	}
+
+	return fr_dict_unknown_afrom_da(ctx, da);
+}
+
 /** Copy a known or unknown attribute to produce an unknown attribute with the specified name
  *
  * Will copy the complete hierarchy down to the first known attribute.
@@ -180,6 +387,7 @@ fr_dict_attr_t *fr_dict_unknown_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *
 	 *	no longer relevant.
 	 */
 	flags.is_unknown = 1;
+	flags.is_cached = 0;
 	flags.array = 0;
 	flags.has_value = 0;
 	flags.length = 0;	/* unknown length */
@@ -194,9 +402,10 @@ fr_dict_attr_t *fr_dict_unknown_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *
 	 *	We want to have parent / child relationships, AND to
 	 *	copy all unknown parents, AND to free the unknown
 	 *	parents when this 'da' is freed.  We therefore talloc
-	 *	the parent from the 'da'.
+	 *	the parent from the 'da'.  Shared parents are never
+	 *	freed, so they don't need copying.
 	 */
-	if (da->parent->flags.is_unknown) {
+	if (da->parent->flags.is_unknown && !da->parent->flags.is_cached) {
 		parent = fr_dict_unknown_afrom_da(n, da->parent);
 		if (!parent) {
 			talloc_free(n);
@@ -356,6 +565,7 @@ fr_dict_attr_t	*fr_dict_unknown_attr_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t co
 	 *	no longer relevant.
 	 */
 	flags.is_unknown = 1;
+	flags.is_cached = 0;
 	flags.array = 0;
 	flags.has_value = 0;
 	flags.length = 0;	/* unknown length */
@@ -370,9 +580,10 @@ fr_dict_attr_t	*fr_dict_unknown_attr_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t co
 	 *	We want to have parent / child relationships, AND to
 	 *	copy all unknown parents, AND to free the unknown
 	 *	parents when this 'da' is freed.  We therefore talloc
-	 *	the parent from the 'da'.
+	 *	the parent from the 'da'.  Shared parents are never
+	 *	freed, so they don't need copying.
 	 */
-	if (da->parent->flags.is_unknown) {
+	if (da->parent->flags.is_unknown && !da->parent->flags.is_cached) {
 		parent = fr_dict_unknown_afrom_da(n, da->parent);
 		if (!parent) {
 			talloc_free(n);
@@ -150,9 +150,15 @@ static uint32_t dict_hash_name(char const *name, size_t len)
 
 	char const *p = name, *q = name + len;
 
+	/*
+	 *	Dictionary names are ASCII, so fold the case inline.
+	 *	This is called for every name which is added or
+	 *	looked up, and the locale aware ctype functions go
+	 *	through the locale tables for every character.
+	 */
 	while (p < q) {
 		int c = *(unsigned char const *)p;
-		if (isalpha(c)) c = tolower(c);
+		if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
 
 		hash *= FNV_MAGIC_PRIME;
 		hash ^= (uint32_t)(c & 0xff);
@@ -886,6 +892,107 @@ int dict_vendor_add(fr_dict_t *dict, char const *name, unsigned int num)
 	return 0;
 }
 
+/** Record a vendor dictionary file, to be loaded when the vendor is first referenced
+ *
+ * @param[in] dict		the file would have been loaded into.
+ * @param[in] name		of the vendor the file defines.
+ * @param[in] num		Vendor's Private Enterprise Number.
+ * @param[in] dir		of the file which $INCLUDEd the vendor dictionary.
+ * @param[in] filename		of the vendor dictionary, as written in the $INCLUDE.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the vendor is already pending, or we ran out of memory.  The file
+ *	  should be loaded immediately.
+ */
+int dict_vendor_lazy_add(fr_dict_t *dict, char const *name, unsigned int num,
+			 char const *dir, char const *filename)
+{
+	dict_vendor_lazy_t	*lazy;
+
+	if (!dict->vendors_lazy_by_name) {
+		dict->vendors_lazy_by_name = fr_hash_table_create(dict, dict_vendor_name_hash,
+								  dict_vendor_name_cmp, NULL);
+		if (!dict->vendors_lazy_by_name) return -1;
+
+		/*
+		 *	Parented from the name table, so that freeing
+		 *	it frees everything to do with lazy loading.
+		 */
+		dict->vendors_lazy_by_num = fr_hash_table_create(dict->vendors_lazy_by_name, dict_vendor_pen_hash,
+								 dict_vendor_pen_cmp, NULL);
+		if (!dict->vendors_lazy_by_num) {
+			TALLOC_FREE(dict->vendors_lazy_by_name);
+			return -1;
+		}
+	}
+
+	if (fr_hash_table_find_by_data(dict->vendors_lazy_by_name, &(fr_dict_vendor_t){ .name = name }) ||
+	    fr_hash_table_find_by_data(dict->vendors_lazy_by_num, &(fr_dict_vendor_t){ .pen = num })) return -1;
+
+	lazy = talloc_zero(dict->vendors_lazy_by_name, dict_vendor_lazy_t);
+	if (!lazy) return -1;
+
+	lazy->vendor.name = talloc_typed_strdup(lazy, name);
+	lazy->vendor.pen = num;
+	lazy->dir = talloc_typed_strdup(lazy, dir);
+	lazy->filename = talloc_typed_strdup(lazy, filename);
+	if (!lazy->vendor.name || !lazy->dir || !lazy->filename) {
+	error:
+		talloc_free(lazy);
+		return -1;
+	}
+
+	if (!fr_hash_table_insert(dict->vendors_lazy_by_name, lazy)) goto error;
+	if (!fr_hash_table_insert(dict->vendors_lazy_by_num, lazy)) {
+		fr_hash_table_yank(dict->vendors_lazy_by_name, lazy);
+		goto error;
+	}
+
+	return 0;
+}
+
+/** Load a deferred vendor dictionary
+ *
+ * Called when a lookup by vendor name or PEN misses.  The pending entry is
+ * removed before the file is read, so lookups made by the parser whilst the
+ * file is loading don't recurse.
+ *
+ * Dictionaries may only be modified whilst the server is single threaded,
+ * so this does nothing once #fr_dict_global_lazy_vendors_freeze has been
+ * called, or the dictionary has been marked read only.
+ *
+ * @param[in] dict		to load the vendor into.
+ * @param[in] name		of the vendor.  If NULL, num is used.
+ * @param[in] num		Vendor's Private Enterprise Number.
+ * @return
+ *	- true if a vendor dictionary was loaded, and the lookup should be retried.
+ *	- false if there was nothing to load, or loading failed.
+ */
+bool dict_vendor_lazy_load(fr_dict_t const *dict, char const *name, unsigned int num)
+{
+	dict_vendor_lazy_t	*lazy;
+	fr_dict_t		*mutable;
+	int			ret;
+
+	if (likely(!dict || !dict->vendors_lazy_by_name) || dict->read_only) return false;
+
+	if (name) {
+		lazy = fr_hash_table_find_by_data(dict->vendors_lazy_by_name, &(fr_dict_vendor_t){ .name = name });
+	} else {
+		lazy = fr_hash_table_find_by_data(dict->vendors_lazy_by_num, &(fr_dict_vendor_t){ .pen = num });
+	}
+	if (!lazy) return false;
+
+	fr_hash_table_yank(dict->vendors_lazy_by_name, lazy);
+	fr_hash_table_yank(dict->vendors_lazy_by_num, lazy);
+
+	memcpy(&mutable, &dict, sizeof(mutable));
+	ret = dict_vendor_lazy_read(mutable, lazy->dir, lazy->filename);
+	talloc_free(lazy);
+
+	return (ret == 0);
+}
+
 /** See if a #fr_dict_attr_t can have children
  *
  *  The check for children is complicated by the need for "int" types
@@ -2173,7 +2280,12 @@ fr_dict_vendor_t const *fr_dict_vendor_by_name(fr_dict_t const *dict, char const
 	if (!name) return 0;
 
 	found = fr_hash_table_find_by_data(dict->vendors_by_name, &(fr_dict_vendor_t) { .name = name });
-	if (!found) return 0;
+	if (!found) {
+		if (!dict_vendor_lazy_load(dict, name, 0)) return 0;
+
+		found = fr_hash_table_find_by_data(dict->vendors_by_name, &(fr_dict_vendor_t) { .name = name });
+		if (!found) return 0;
+	}
 
 	return found;
 }
@@ -2189,9 +2301,16 @@ fr_dict_vendor_t const *fr_dict_vendor_by_name(fr_dict_t const *dict, char const
  */
 fr_dict_vendor_t const *fr_dict_vendor_by_num(fr_dict_t const *dict, uint32_t vendor_pen)
 {
+	fr_dict_vendor_t	*found;
+
 	INTERNAL_IF_NULL(dict, NULL);
 
-	return fr_hash_table_find_by_data(dict->vendors_by_num, &(fr_dict_vendor_t) { .pen = vendor_pen });
+	found = fr_hash_table_find_by_data(dict->vendors_by_num, &(fr_dict_vendor_t) { .pen = vendor_pen });
+	if (!found && dict_vendor_lazy_load(dict, NULL, vendor_pen)) {
+		found = fr_hash_table_find_by_data(dict->vendors_by_num, &(fr_dict_vendor_t) { .pen = vendor_pen });
+	}
+
+	return found;
 }
 
 /** Return vendor attribute for the specified dictionary and pen
@@ -2579,6 +2698,9 @@ ssize_t fr_dict_attr_by_name_substr(fr_dict_attr_err_t *err, fr_dict_attr_t cons
 	}
 
 	da = fr_hash_table_find_by_data(namespace, &(fr_dict_attr_t){ .name = buffer });
+	if (!da && (parent->type == FR_TYPE_VSA) && dict_vendor_lazy_load(parent->dict, buffer, 0)) {
+		da = fr_hash_table_find_by_data(namespace, &(fr_dict_attr_t){ .name = buffer });
+	}
 	if (!da) {
 		if (err) *err = FR_DICT_ATTR_NOTFOUND;
 		fr_strerror_printf("Attribute '%s' not found in namespace '%s'", buffer, parent->name);
@@ -2607,6 +2729,9 @@ fr_dict_attr_t *dict_attr_by_name(fr_dict_attr_err_t *err, fr_dict_attr_t const
 	}
 
 	da = fr_hash_table_find_by_data(namespace, &(fr_dict_attr_t) { .name = name });
+	if (!da && (parent->type == FR_TYPE_VSA) && dict_vendor_lazy_load(parent->dict, name, 0)) {
+		da = fr_hash_table_find_by_data(namespace, &(fr_dict_attr_t) { .name = name });
+	}
 	if (!da) {
 		if (err) *err = FR_DICT_ATTR_NOTFOUND;
 		fr_strerror_printf("Attribute '%s' not found in namespace '%s'", name, parent->name);
@@ -2684,11 +2809,10 @@ fr_dict_attr_t const *fr_dict_attr_child_by_da(fr_dict_attr_t const *parent, fr_
 	if (!children) return NULL;
 
 	/*
-	 *	Child arrays may be trimmed back to save memory.
-	 *	Check that so we don't SEGV.
+	 *	Child arrays are always UINT8_MAX + 1 entries, see
+	 *	dict_attr_child_add(), so there's no need to check
+	 *	the index against talloc_array_length().
 	 */
-	if ((child->attr & 0xff) > talloc_array_length(children)) return NULL;
-
 	bin = children[child->attr & 0xff];
 	for (;;) {
 		if (!bin) return NULL;
@@ -2717,17 +2841,15 @@ inline fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsi
 	if (ref) parent = ref;
 
 	children = dict_attr_children(parent);
-	if (!children) return NULL;
+	if (!children) goto lazy;
 
 	/*
-	 *	Child arrays may be trimmed back to save memory.
-	 *	Check that so we don't SEGV.
+	 *	Child arrays are always UINT8_MAX + 1 entries, see
+	 *	dict_attr_child_add(), so there's no need to check
+	 *	the index against talloc_array_length().
 	 */
-	if ((attr & 0xff) > talloc_array_length(children)) return NULL;
-
 	bin = children[attr & 0xff];
-	for (;;) {
-		if (!bin) return NULL;
+	while (bin) {
 		if (bin->attr == attr) {
 			fr_dict_attr_t *out;
 
@@ -2738,6 +2860,15 @@ inline fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsi
 		bin = bin->next;
 	}
 
+lazy:
+	/*
+	 *	Children of a VSA are vendors, which may not
+	 *	have been loaded yet.
+	 */
+	if ((parent->type == FR_TYPE_VSA) && dict_vendor_lazy_load(parent->dict, NULL, attr)) {
+		return dict_attr_child_by_num(parent, attr);
+	}
+
 	return NULL;
 }
 
@@ -3414,6 +3545,12 @@ void fr_dict_global_read_only(void)
 
 	if (!dict_gctx) return;
 
+	/*
+	 *	Nothing more can be loaded, so the
+	 *	pending vendors are never loaded.
+	 */
+	fr_dict_global_lazy_vendors_freeze();
+
 	/*
 	 *	Set everything to read only
 	 */
@@ -3434,6 +3571,48 @@ void fr_dict_global_read_only(void)
 	dict_gctx->read_only = true;
 }
 
+/** Defer loading vendor dictionaries until they're referenced
+ *
+ * When enabled, vendor dictionary files $INCLUDEd by a protocol dictionary
+ * are only scanned for the vendor's name and PEN.  The file is loaded the
+ * first time the vendor is looked up, by name (when compiling the
+ * configuration), or by PEN (when decoding a VSA).
+ *
+ * Must be called before the protocol dictionaries are loaded.
+ *
+ * @param[in] enable	lazy loading of vendor dictionaries.
+ */
+void fr_dict_global_lazy_vendors(bool enable)
+{
+	if (!dict_gctx) return;
+
+	dict_gctx->lazy_vendors = enable;
+}
+
+/** Stop loading vendor dictionaries on demand
+ *
+ * Loading a dictionary modifies it, which isn't safe once other threads
+ * may be performing lookups.  This should be called before any threads
+ * are started.  Vendors which haven't been loaded by then are treated as
+ * unknown.
+ */
+void fr_dict_global_lazy_vendors_freeze(void)
+{
+	fr_hash_iter_t	iter;
+	fr_dict_t	*dict;
+
+	if (!dict_gctx) return;
+
+	dict_gctx->lazy_vendors = false;
+
+	for (dict = fr_hash_table_iter_init(dict_gctx->protocol_by_num, &iter);
+	     dict;
+	     dict = fr_hash_table_iter_next(dict_gctx->protocol_by_num, &iter)) {
+		TALLOC_FREE(dict->vendors_lazy_by_name);	/* Frees the num table too */
+		dict->vendors_lazy_by_num = NULL;
+	}
+}
+
 /** Coerce to non-const
  *
  */
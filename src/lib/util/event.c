@@ -106,6 +106,10 @@ struct fr_event_timer {
 	int32_t			heap_id;	       	//!< Where to store opaque heap data.
 	fr_dlist_t		entry;			//!< in linked list of event timers
 
+	fr_dlist_t		wheel_entry;		//!< in a slot of the timer wheel.
+	int8_t			wheel_level;		//!< level of the timer wheel, or -1 if not in the wheel.
+	uint8_t			wheel_slot;		//!< slot in that level.
+
 #ifndef NDEBUG
 	char const		*file;			//!< Source file this event was last updated in.
 	int			line;			//!< Line this event was last updated on.
@@ -337,11 +341,54 @@ typedef struct {
 } fr_event_user_t;
 
 
+/*
+ *	Timers are kept in a hierarchical timing wheel until they're
+ *	about to fire, and only then are they moved to the heap.
+ *
+ *	Most timers (request timeouts, retransmissions) are deleted
+ *	before they fire.  Insertion into and deletion from the wheel
+ *	are O(1), so those timers never pay for the O(log n) heap
+ *	operations.  The heap only holds the timers which are due
+ *	now, and the timers which are too far in the future for the
+ *	wheel.
+ *
+ *	Each level has a resolution of one slot of the level below.
+ *
+ *	  level 0: 256 slots of 1ms		(256ms)
+ *	  level 1:  64 slots of 256ms		(~16s)
+ *	  level 2:  64 slots of ~16s		(~17m)
+ *
+ *	When the wheel moves into a new slot of a higher level,
+ *	the timers in that slot are re-inserted into the lower
+ *	levels.
+ */
+#define WHEEL_TICK		(NSEC / 1000)		//!< 1ms
+#define WHEEL_LEVELS		(3)
+#define WHEEL_L0_BITS		(8)
+#define WHEEL_LN_BITS		(6)
+#define WHEEL_L0_SLOTS		(1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SLOTS		(1 << WHEEL_LN_BITS)
+#define WHEEL_SHIFT(_level)	((_level) == 0 ? 0 : WHEEL_L0_BITS + (((_level) - 1) * WHEEL_LN_BITS))
+#define WHEEL_SLOTS(_level)	((_level) == 0 ? WHEEL_L0_SLOTS : WHEEL_LN_SLOTS)
+#define WHEEL_SPAN(_level)	((int64_t) 1 << (WHEEL_SHIFT(_level) + (((_level) == 0) ? WHEEL_L0_BITS : WHEEL_LN_BITS)))
+
+typedef struct {
+	fr_dlist_head_t		slot[WHEEL_L0_SLOTS];	//!< timers, one list per slot.
+	uint64_t		map[WHEEL_L0_SLOTS / 64]; //!< which slots have timers.
+} fr_event_wheel_level_t;
+
+typedef struct {
+	int64_t			tick;			//!< all ticks before this one have been moved to the heap.
+	uint32_t		num_elements;		//!< number of timers in the wheel.
+	fr_event_wheel_level_t	level[WHEEL_LEVELS];
+} fr_event_wheel_t;
+
 /** Stores all information relating to an event list
  *
  */
 struct fr_event_list {
 	fr_heap_t		*times;			//!< of timer events to be executed.
+	fr_event_wheel_t	wheel;			//!< timer events which aren't due yet.
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 #ifdef LOCAL_PID
 	fr_heap_t		*pids;			//!< PIDs to wait for
@@ -441,7 +488,7 @@ int fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_heap_num_elements(el->times);
+	return fr_heap_num_elements(el->times) + el->wheel.num_elements;
 }
 
 /** Return the kq associated with an event list.
@@ -464,6 +511,12 @@ int fr_event_list_kq(fr_event_list_t *el)
  * If the event list is not currently dispatching events, we return the
  * current system time.
  *
+ * This is the loop granularity clock.  It costs nothing while events
+ * are being dispatched, and should be used by callbacks which only
+ * need to know roughly what time it is, e.g. for statistics, or for
+ * deciding whether something has timed out.  Callers which need
+ * precise time, e.g. for fr_time_tracking_t, should call fr_time().
+ *
  * @param[in]	el to get time from.
  * @return the current time according to the event list.
  */
@@ -1164,6 +1217,216 @@ int fr_event_fd_unarmour(fr_event_list_t *el, int fd, fr_event_filter_t filter,
 }
 #endif
 
+/** Find the first slot with timers, starting at a given slot
+ *
+ * @return
+ *	- -1 if there are no timers in the level.
+ *	- the number of slots after start.
+ */
+static int event_wheel_map_next(uint64_t const *map, int num_slots, int start)
+{
+	int i, k;
+
+	for (k = 0; k < num_slots; ) {
+		uint64_t word;
+
+		i = (start + k) & (num_slots - 1);
+		word = map[i / 64] >> (i % 64);
+		if (word) return k + __builtin_ctzll(word);
+
+		k += 64 - (i % 64);
+	}
+
+	return -1;
+}
+
+static inline void event_wheel_slot_add(fr_event_wheel_t *wheel, fr_event_timer_t *ev, int level, int slot)
+{
+	fr_event_wheel_level_t *lvl = &wheel->level[level];
+
+	fr_dlist_insert_tail(&lvl->slot[slot], ev);
+	lvl->map[slot / 64] |= ((uint64_t) 1) << (slot % 64);
+
+	ev->wheel_level = level;
+	ev->wheel_slot = slot;
+	wheel->num_elements++;
+}
+
+/** Remove a timer from the wheel
+ *
+ */
+static inline void event_wheel_remove(fr_event_wheel_t *wheel, fr_event_timer_t *ev)
+{
+	fr_event_wheel_level_t *lvl = &wheel->level[ev->wheel_level];
+
+	(void) fr_dlist_remove(&lvl->slot[ev->wheel_slot], ev);
+	if (fr_dlist_empty(&lvl->slot[ev->wheel_slot])) {
+		lvl->map[ev->wheel_slot / 64] &= ~(((uint64_t) 1) << (ev->wheel_slot % 64));
+	}
+
+	ev->wheel_level = -1;
+	wheel->num_elements--;
+}
+
+/** Insert a timer into the wheel, or into the heap if it's due, or too far away
+ *
+ */
+static int event_timer_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	int64_t			tick, delta;
+	int			level;
+
+	/*
+	 *	The wheel is empty, so we can move it to the current
+	 *	time.  This also deals with time sources which are
+	 *	changed after the event list is created.
+	 */
+	if (!wheel->num_elements) wheel->tick = el->time() / WHEEL_TICK;
+
+	tick = ev->when / WHEEL_TICK;
+	delta = tick - wheel->tick;
+
+	if ((ev->when < 0) || (delta < 0) || (delta >= WHEEL_SPAN(WHEEL_LEVELS - 1))) {
+		return fr_heap_insert(el->times, ev);
+	}
+
+	for (level = 0; level < (WHEEL_LEVELS - 1); level++) {
+		if (delta < WHEEL_SPAN(level)) break;
+	}
+
+	event_wheel_slot_add(wheel, ev, level, (tick >> WHEEL_SHIFT(level)) & (WHEEL_SLOTS(level) - 1));
+
+	return 0;
+}
+
+/** Re-insert the timers from one slot of a higher level into the lower levels
+ *
+ */
+static void event_wheel_cascade(fr_event_list_t *el, int level)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	fr_event_wheel_level_t	*lvl = &wheel->level[level];
+	int			slot;
+	fr_event_timer_t	*ev;
+
+	slot = (wheel->tick >> WHEEL_SHIFT(level)) & (WHEEL_SLOTS(level) - 1);
+
+	while ((ev = fr_dlist_head(&lvl->slot[slot])) != NULL) {
+		event_wheel_remove(wheel, ev);
+
+		if (unlikely(event_timer_insert(el, ev) < 0)) {
+			fr_assert_msg(0, "failed inserting timer event: %s", fr_strerror());
+		}
+	}
+}
+
+/** Move all of the timers which are due before "now" from the wheel to the heap
+ *
+ */
+static void event_wheel_advance(fr_event_list_t *el, fr_time_t now)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	fr_event_wheel_level_t	*lvl0 = &wheel->level[0];
+	int64_t			target = now / WHEEL_TICK;
+
+	while (wheel->num_elements && (wheel->tick <= target)) {
+		int			level, slot;
+		fr_event_timer_t	*ev;
+
+		slot = wheel->tick & (WHEEL_L0_SLOTS - 1);
+
+		/*
+		 *	Nothing this tick.  If there's nothing else
+		 *	in level 0, skip to the next slot in level 1.
+		 */
+		if (fr_dlist_empty(&lvl0->slot[slot])) {
+			int next;
+
+			next = event_wheel_map_next(lvl0->map, WHEEL_L0_SLOTS, slot);
+			if (next < 0) next = WHEEL_L0_SLOTS - slot;
+			if (next > (WHEEL_L0_SLOTS - slot)) next = WHEEL_L0_SLOTS - slot;
+			if ((wheel->tick + next) > (target + 1)) next = (target + 1) - wheel->tick;
+
+			wheel->tick += next;
+
+		} else {
+			while ((ev = fr_dlist_head(&lvl0->slot[slot])) != NULL) {
+				event_wheel_remove(wheel, ev);
+
+				if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+					fr_assert_msg(0, "failed inserting heap event: %s", fr_strerror());
+				}
+			}
+
+			wheel->tick++;
+		}
+
+		/*
+		 *	We've moved into a new slot of level 1, and
+		 *	maybe of level 2.  Bring their timers down.
+		 */
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if (wheel->tick & ((((int64_t) 1) << WHEEL_SHIFT(level)) - 1)) break;
+
+			event_wheel_cascade(el, level);
+		}
+	}
+
+	if (!wheel->num_elements && (wheel->tick <= target)) wheel->tick = target + 1;
+}
+
+/** Return the earliest time at which a timer in the wheel might be due
+ *
+ * @return
+ *	- 0 if there are no timers in the wheel.
+ *	- when the wheel next has to be advanced.
+ */
+static fr_time_t event_wheel_next(fr_event_wheel_t const *wheel)
+{
+	int	level;
+	int64_t	first = 0;
+
+	if (!wheel->num_elements) return 0;
+
+	/*
+	 *	A higher level may have a slot which is due before
+	 *	the timers in the levels below it, which means that
+	 *	we have to check all of them.
+	 */
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		int	shift = WHEEL_SHIFT(level);
+		int64_t	base = (wheel->tick >> shift) + (level > 0);
+		int64_t	tick;
+		int	next;
+
+		/*
+		 *	Level 0 starts at the current tick.  The
+		 *	current slot of the other levels has already
+		 *	been cascaded down, so any timers there are
+		 *	one full rotation away.
+		 */
+		next = event_wheel_map_next(wheel->level[level].map, WHEEL_SLOTS(level),
+					    base & (WHEEL_SLOTS(level) - 1));
+		if (next < 0) continue;
+
+		tick = (base + next) << shift;
+		if (!first || (tick < first)) first = tick;
+	}
+
+	return first * WHEEL_TICK;
+}
+
+/** Return the earliest timer event in the heap, after moving any due timers from the wheel
+ *
+ */
+static inline fr_event_timer_t *event_timer_peek(fr_event_list_t *el, fr_time_t now)
+{
+	if (el->wheel.num_elements) event_wheel_advance(el, now);
+
+	return fr_heap_peek(el->times);
+}
+
 /** Remove an event from the event loop
  *
  * @param[in] ev	to free.
@@ -1178,6 +1441,8 @@ static int _event_timer_free(fr_event_timer_t *ev)
 
 	if (fr_dlist_entry_in_list(&ev->entry)) {
 		(void) fr_dlist_remove(&el->ev_to_add, ev);
+	} else if (ev->wheel_level >= 0) {
+		event_wheel_remove(&el->wheel, ev);
 	} else {
 		int	ret = fr_heap_extract(el->times, ev);
 
@@ -1265,6 +1530,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 
 		talloc_set_destructor(ev, _event_timer_free);
 		ev->heap_id = -1;
+		ev->wheel_level = -1;
 
 	} else {
 		memcpy(&ev, ev_p, sizeof(ev));	/* Not const to us */
@@ -1289,7 +1555,10 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	will no longer be in the event loop, so check
 		 *	if it's in the heap before extracting it.
 		 */
-		if (!fr_dlist_entry_in_list(&ev->entry)) {
+		if (ev->wheel_level >= 0) {
+			event_wheel_remove(&el->wheel, ev);
+
+		} else if (!fr_dlist_entry_in_list(&ev->entry)) {
 			int ret;
 
 			ret = fr_heap_extract(el->times, ev);
@@ -1326,7 +1595,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	multiple times.
 		 */
 		if (!fr_dlist_entry_in_list(&ev->entry)) fr_dlist_insert_head(&el->ev_to_add, ev);
-	} else if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+	} else if (unlikely(event_timer_insert(el, ev) < 0)) {
 		fr_strerror_const_push("Failed inserting event");
 		talloc_set_destructor(ev, NULL);
 		*ev_p = NULL;
@@ -1682,14 +1951,9 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 
 	if (unlikely(!el)) return 0;
 
-	if (fr_heap_num_elements(el->times) == 0) {
-		*when = 0;
-		return 0;
-	}
-
-	ev = fr_heap_peek(el->times);
+	ev = event_timer_peek(el, *when);
 	if (!ev) {
-		*when = 0;
+		*when = event_wheel_next(&el->wheel);
 		return 0;
 	}
 
@@ -1697,7 +1961,9 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 	 *	See if it's time to do this one.
 	 */
 	if (ev->when > *when) {
-		*when = ev->when;
+		fr_time_t next = event_wheel_next(&el->wheel);
+
+		*when = (next && (next < ev->when)) ? next : ev->when;
 		return 0;
 	}
 
@@ -1727,7 +1993,7 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
  */
 int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 {
-	fr_time_t		when, *wake;
+	fr_time_t		when, next, *wake;
 	struct timespec		ts_when, *ts_wake;
 	fr_event_pre_t		*pre;
 	int			num_fd_events;
@@ -1762,13 +2028,16 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	events are in the past.  Or, we wait for a future
 	 *	timer event.
 	 */
-	ev = fr_heap_peek(el->times);
-	if (ev) {
-		if (ev->when <= el->now) {
+	ev = event_timer_peek(el, el->now);
+	next = event_wheel_next(&el->wheel);
+	if (ev && (!next || (ev->when < next))) next = ev->when;
+
+	if (ev || next) {
+		if (next <= el->now) {
 			timer_event_ready = true;
 
 		} else if (wait) {
-			when = ev->when - el->now;
+			when = next - el->now;
 
 		} /* else we're not waiting, leave "when == 0" */
 
@@ -2141,7 +2410,7 @@ service:
 	 *	Run all of the timer events.  Note that these can add
 	 *	new timers!
 	 */
-	if (fr_heap_num_elements(el->times) > 0) {
+	if ((fr_heap_num_elements(el->times) > 0) || (el->wheel.num_elements > 0)) {
 		do {
 			when = el->now;
 		} while (fr_event_timer_run(el, &when) == 1);
@@ -2163,7 +2432,7 @@ service:
 	 */
 	while ((ev = fr_dlist_head(&el->ev_to_add)) != NULL) {
 		(void)fr_dlist_remove(&el->ev_to_add, ev);
-		if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+		if (unlikely(event_timer_insert(el, ev) < 0)) {
 			talloc_free(ev);
 			fr_assert_msg(0, "failed inserting heap event: %s", fr_strerror());	/* Die in debug builds */
 		}
@@ -2234,9 +2503,16 @@ CC_HINT(flatten) int fr_event_loop(fr_event_list_t *el)
 static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
+	int			i, j;
 
 	while ((ev = fr_heap_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
 
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS(i); j++) {
+			while ((ev = fr_dlist_head(&el->wheel.level[i].slot[j])) != NULL) fr_event_timer_delete(&ev);
+		}
+	}
+
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
@@ -2275,6 +2551,16 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 
+	{
+		int i, j;
+
+		for (i = 0; i < WHEEL_LEVELS; i++) {
+			for (j = 0; j < WHEEL_SLOTS(i); j++) {
+				fr_dlist_talloc_init(&el->wheel.level[i].slot[j], fr_event_timer_t, wheel_entry);
+			}
+		}
+	}
+
 	el->fds = rbtree_talloc_alloc(el, fr_event_fd_cmp, fr_event_fd_t, NULL, 0);
 	if (!el->fds) {
 		fr_strerror_const("Failed allocating FD tree");
@@ -2332,7 +2618,7 @@ void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t fun
  */
 bool fr_event_list_empty(fr_event_list_t *el)
 {
-	return !fr_heap_num_elements(el->times) && !rbtree_num_elements(el->fds);
+	return !fr_heap_num_elements(el->times) && !el->wheel.num_elements && !rbtree_num_elements(el->fds);
 }
 
 #ifdef WITH_EVENT_DEBUG
@@ -2380,6 +2666,35 @@ static int event_timer_print_location(void *node, UNUSED void *uctx)
 	return 0;
 }
 
+/** Iterate over the timers in the heap, and then over the timers in the wheel
+ *
+ */
+static fr_event_timer_t *event_report_iter_next(fr_event_list_t *el, fr_heap_iter_t *iter,
+						fr_event_timer_t const *ev, int *level, int *slot)
+{
+	fr_event_timer_t *next;
+
+	if (ev->wheel_level < 0) {
+		next = fr_heap_iter_next(el->times, iter);
+		if (next) return next;
+
+	} else {
+		next = fr_dlist_next(&el->wheel.level[*level].slot[*slot], ev);
+		if (next) return next;
+
+		(*slot)++;
+	}
+
+	for (; *level < WHEEL_LEVELS; (*level)++, *slot = 0) {
+		for (; *slot < WHEEL_SLOTS(*level); (*slot)++) {
+			next = fr_dlist_head(&el->wheel.level[*level].slot[*slot]);
+			if (next) return next;
+		}
+	}
+
+	return NULL;
+}
+
 /** Print out information about the number of events in the event loop
  *
  */
@@ -2388,6 +2703,7 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 	fr_heap_iter_t		iter;
 	fr_event_timer_t const	*ev;
 	size_t			i;
+	int			j, k;
 
 	size_t			array[NUM_ELEMENTS(decades)] = { 0 };
 	rbtree_t		*locations[NUM_ELEMENTS(decades)];
@@ -2411,9 +2727,9 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 	 *	Show which events are due, when they're due,
 	 *	and where they were allocated
 	 */
-	for (ev = fr_heap_iter_init(el->times, &iter);
+	for (ev = fr_heap_iter_init(el->times, &iter), j = 0, k = 0;
 	     ev != NULL;
-	     ev = fr_heap_iter_next(el->times, &iter)) {
+	     ev = event_report_iter_next(el, &iter, ev, &j, &k)) {
 		fr_time_delta_t diff = ev->when - now;
 
 		for (i = 0; i < NUM_ELEMENTS(decades); i++) {
@@ -2470,14 +2786,15 @@ void fr_event_timer_dump(fr_event_list_t *el)
 	fr_heap_iter_t		iter;
 	fr_event_timer_t 	*ev;
 	fr_time_t		now;
+	int			j, k;
 
 	now = el->time();
 
 	EVENT_DEBUG("Time is now %"PRId64"", now);
 
-	for (ev = fr_heap_iter_init(el->times, &iter);
+	for (ev = fr_heap_iter_init(el->times, &iter), j = 0, k = 0;
 	     ev;
-	     ev = fr_heap_iter_next(el->times, &iter)) {
+	     ev = event_report_iter_next(el, &iter, ev, &j, &k)) {
 		(void)talloc_get_type_abort(ev, fr_event_timer_t);
 		EVENT_DEBUG("%s[%u]: %p time=%" PRId64 " (%c), callback=%p",
 			    ev->file, ev->line, ev, ev->when, now > ev->when ? '<' : '>', ev->callback);
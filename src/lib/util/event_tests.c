@@ -0,0 +1,220 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/rand.h>
+
+#include "event.c"
+
+/*
+ *	event.c stops itself from using the real time, but the
+ *	benchmarks need it.
+ */
+#undef fr_time
+
+/*
+ *	A fake time source, so that we can move time forward
+ *	without sleeping.
+ */
+static fr_time_t test_now;
+
+static fr_time_t test_time(void)
+{
+	return test_now;
+}
+
+typedef struct {
+	fr_event_timer_t const	*ev;
+	fr_time_t		when;
+	bool			fired;
+} event_thing;
+
+static int		num_fired;
+static fr_time_t	last_fired;
+static bool		out_of_order;
+
+static void thing_fire(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	event_thing *thing = uctx;
+
+	if ((thing->when > now) || (thing->when < last_fired)) out_of_order = true;
+
+	last_fired = thing->when;
+	thing->fired = true;
+	num_fired++;
+}
+
+#define EVENT_TEST_SIZE (65536)
+
+/*
+ *	Spread the timers over all of the levels of the wheel, and
+ *	into the heap.  Delete some of them, and check that the rest
+ *	fire in order, and not before they're due.
+ */
+static void event_timer_test(void)
+{
+	fr_event_list_t	*el;
+	event_thing	*array;
+	uint32_t	i;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	test_now = fr_time_from_sec(1000);
+	num_fired = 0;
+	last_fired = 0;
+	out_of_order = false;
+
+	array = calloc(EVENT_TEST_SIZE, sizeof(event_thing));
+	for (i = 0; i < EVENT_TEST_SIZE; i++) {
+		fr_time_delta_t delta;
+
+		switch (i & 0x03) {
+		case 0:
+			delta = fr_rand() % fr_time_delta_from_msec(256);
+			break;
+
+		case 1:
+			delta = fr_rand() % fr_time_delta_from_sec(16);
+			break;
+
+		case 2:
+			delta = ((uint64_t) fr_rand() * 1000) % fr_time_delta_from_sec(1000);
+			break;
+
+		default:
+			delta = ((uint64_t) fr_rand() * 1000) % fr_time_delta_from_sec(4000);
+			break;
+		}
+
+		array[i].when = test_now + delta;
+		TEST_CHECK(fr_event_timer_at(NULL, el, &array[i].ev, array[i].when, thing_fire, &array[i]) == 0);
+	}
+	TEST_CHECK(fr_event_list_num_timers(el) == EVENT_TEST_SIZE);
+
+	TEST_CASE("deletions");
+	for (i = 0; i < EVENT_TEST_SIZE; i += 3) {
+		TEST_CHECK(fr_event_timer_delete(&array[i].ev) == 0);
+	}
+	TEST_CHECK(fr_event_list_num_timers(el) == (EVENT_TEST_SIZE - ((EVENT_TEST_SIZE + 2) / 3)));
+
+	TEST_CASE("expiry");
+	while (fr_event_list_num_timers(el) > 0) {
+		fr_time_t when = test_now;
+
+		if (fr_event_timer_run(el, &when)) continue;
+
+		TEST_CHECK(when > test_now);
+		TEST_MSG("next event at %" PRId64 " is not after now %" PRId64, when, test_now);
+		if (when <= test_now) break;
+
+		/*
+		 *	Don't always jump straight to the next event,
+		 *	so that the wheel is advanced in odd steps.
+		 */
+		if (fr_rand() & 0x01) {
+			test_now = when;
+		} else {
+			test_now += (when - test_now) / 2 + 1;
+		}
+	}
+
+	TEST_CHECK(!out_of_order);
+	TEST_CHECK(num_fired == (EVENT_TEST_SIZE - ((EVENT_TEST_SIZE + 2) / 3)));
+	for (i = 0; i < EVENT_TEST_SIZE; i++) {
+		TEST_CHECK(array[i].fired == ((i % 3) != 0));
+		TEST_MSG("timer %u in wrong state", i);
+	}
+
+	talloc_free(el);
+	free(array);
+}
+
+/*
+ *	Simulate request timeouts: a window of outstanding timers
+ *	which are armed, and then almost always cancelled before
+ *	they fire.  Compare the event list against a plain heap.
+ */
+#define EVENT_CHURN_WINDOW	(200000)
+#define EVENT_CHURN_LOOPS	(4000000)
+
+static void event_timer_churn(void)
+{
+	fr_event_list_t		*el;
+	fr_heap_t		*hp;
+	fr_event_timer_t	*evs;
+	event_thing		*array;
+	uint32_t		i;
+	fr_time_t		start, wheel_time, heap_time;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	hp = fr_heap_alloc(NULL, fr_event_timer_cmp, fr_event_timer_t, heap_id);
+	TEST_CHECK(hp != NULL);
+
+	array = calloc(EVENT_CHURN_WINDOW, sizeof(event_thing));
+	evs = calloc(EVENT_CHURN_WINDOW, sizeof(fr_event_timer_t));
+
+	fr_time_start();
+
+	test_now = fr_time_from_sec(1000);
+	start = fr_time();
+	for (i = 0; i < EVENT_CHURN_LOOPS; i++) {
+		event_thing *thing = &array[i % EVENT_CHURN_WINDOW];
+
+		if (thing->ev && (fr_event_timer_delete(&thing->ev) < 0)) {
+			TEST_CHECK(0);
+			break;
+		}
+
+		thing->when = test_now + fr_time_delta_from_sec(30) + (i & 0xffff);
+		if (fr_event_timer_at(NULL, el, &thing->ev, thing->when, thing_fire, thing) < 0) {
+			TEST_CHECK(0);
+			break;
+		}
+
+		if ((i & 0xff) == 0) test_now += fr_time_delta_from_msec(1);
+	}
+	wheel_time = fr_time() - start;
+	TEST_CHECK(fr_event_list_num_timers(el) == EVENT_CHURN_WINDOW);
+
+	test_now = fr_time_from_sec(1000);
+	start = fr_time();
+	for (i = 0; i < EVENT_CHURN_LOOPS; i++) {
+		fr_event_timer_t *ev = &evs[i % EVENT_CHURN_WINDOW];
+
+		if ((i >= EVENT_CHURN_WINDOW) && (fr_heap_extract(hp, ev) < 0)) {
+			TEST_CHECK(0);
+			break;
+		}
+
+		ev->when = test_now + fr_time_delta_from_sec(30) + (i & 0xffff);
+		if (fr_heap_insert(hp, ev) < 0) {
+			TEST_CHECK(0);
+			break;
+		}
+
+		if ((i & 0xff) == 0) test_now += fr_time_delta_from_msec(1);
+	}
+	heap_time = fr_time() - start;
+	TEST_CHECK(fr_heap_num_elements(hp) == EVENT_CHURN_WINDOW);
+
+	TEST_MSG("wheel %.3fs, heap %.3fs",
+		 (double) wheel_time / NSEC, (double) heap_time / NSEC);
+	printf("\nwheel %.3fs, heap %.3fs\n",
+	       (double) wheel_time / NSEC, (double) heap_time / NSEC);
+
+	talloc_free(hp);
+	free(evs);
+	talloc_free(el);
+	free(array);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "event_timer_test",		event_timer_test	},
+	{ "event_timer_churn",		event_timer_churn	},
+	{ NULL }
+};
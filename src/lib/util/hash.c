@@ -766,42 +766,137 @@ int fr_hash_table_info(fr_hash_table_t *ht)
 #define FNV_MAGIC_PRIME (0x01000193)
 
 /*
- *	A fast hash function.  For details, see:
+ *	fr_hash() and fr_hash_update() hash 8 or 16 bytes at a time,
+ *	and mix with a 64x64->128 bit multiply.  This is the same
+ *	construction as wyhash, which is public domain:
  *
- *	http://www.isthe.com/chongo/tech/comp/fnv/
+ *	https://github.com/wangyi-fudan/wyhash
  *
- *	Which also includes public domain source.  We've re-written
- *	it here for our purposes.
+ *	For the key sizes we hash (addresses, packet headers,
+ *	attribute values), a handful of multiplies are faster than
+ *	setting up SIMD registers, and the code is portable.
+ *
+ *	The input is always read as little endian, so that the
+ *	hashes are the same on all platforms.
  */
-uint32_t fr_hash(void const *data, size_t size)
+#define HASH_P0 (0xa0761d6478bd642fULL)
+#define HASH_P1 (0xe7037ed1a0b428dbULL)
+#define HASH_P2 (0x8ebc6af09c88c6e3ULL)
+#define HASH_P3 (0x589965cc75374cc3ULL)
+
+static inline CC_HINT(always_inline) void hash_mum(uint64_t *a, uint64_t *b)
 {
-	uint8_t const *p = data;
-	uint8_t const *q = p + size;
-	uint32_t      hash = FNV_MAGIC_INIT;
+#ifdef HAVE_128BIT_INTEGERS
+	uint128_t r = (uint128_t) *a * *b;
+
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
 
-	/*
-	 *	FNV-1 hash each octet in the buffer
-	 */
-	while (p != q) {
-		/*
-		 *	XOR the 8-bit quantity into the bottom of
-		 *	the hash.
-		 */
-		hash ^= (uint32_t) (*p++);
+static inline CC_HINT(always_inline) uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+	hash_mum(&a, &b);
 
-		/*
-		 *	Multiple by 32-bit magic FNV prime, mod 2^32
-		 */
-		hash *= FNV_MAGIC_PRIME;
-#if 0
-		/*
-		 *	Potential optimization.
-		 */
-		hash += (hash<<1) + (hash<<4) + (hash<<7) + (hash<<8) + (hash<<24);
+	return a ^ b;
+}
+
+static inline CC_HINT(always_inline) uint64_t hash_read64(uint8_t const *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#ifdef WORDS_BIGENDIAN
+	v = ((v & 0x00000000000000ffULL) << 56) | ((v & 0x000000000000ff00ULL) << 40) |
+	    ((v & 0x0000000000ff0000ULL) << 24) | ((v & 0x00000000ff000000ULL) << 8) |
+	    ((v & 0x000000ff00000000ULL) >> 8) | ((v & 0x0000ff0000000000ULL) >> 24) |
+	    ((v & 0x00ff000000000000ULL) >> 40) | ((v & 0xff00000000000000ULL) >> 56);
 #endif
-    }
+	return v;
+}
 
-    return hash;
+static inline CC_HINT(always_inline) uint64_t hash_read32(uint8_t const *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+#ifdef WORDS_BIGENDIAN
+	v = ((v & 0x000000ff) << 24) | ((v & 0x0000ff00) << 8) | ((v & 0x00ff0000) >> 8) | ((v & 0xff000000) >> 24);
+#endif
+	return v;
+}
+
+static inline CC_HINT(always_inline) uint32_t hash_block(uint8_t const *p, size_t len, uint64_t seed)
+{
+	uint64_t a, b;
+
+	seed ^= hash_mix(seed ^ HASH_P0, HASH_P1);
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (hash_read32(p) << 32) | hash_read32(p + ((len >> 3) << 2));
+			b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - ((len >> 3) << 2));
+
+		} else if (len > 0) {
+			a = (((uint64_t) p[0]) << 16) | (((uint64_t) p[len >> 1]) << 8) | p[len - 1];
+			b = 0;
+
+		} else {
+			a = b = 0;
+		}
+
+	} else {
+		size_t i = len;
+
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+
+			do {
+				seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+				see1 = hash_mix(hash_read64(p + 16) ^ HASH_P2, hash_read64(p + 24) ^ see1);
+				see2 = hash_mix(hash_read64(p + 32) ^ HASH_P3, hash_read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+
+			seed ^= see1 ^ see2;
+		}
+
+		while (i > 16) {
+			seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+
+		a = hash_read64(p + i - 16);
+		b = hash_read64(p + i - 8);
+	}
+
+	a ^= HASH_P1;
+	b ^= seed;
+	hash_mum(&a, &b);
+
+	a = hash_mix(a ^ HASH_P0 ^ len, b ^ HASH_P1);
+
+	return (uint32_t) (a ^ (a >> 32));
+}
+
+/*
+ *	A fast hash function.  Don't use for cryptography, just for
+ *	hashing internal data.
+ */
+uint32_t fr_hash(void const *data, size_t size)
+{
+	return hash_block(data, size, FNV_MAGIC_INIT);
 }
 
 /*
@@ -809,18 +904,9 @@ uint32_t fr_hash(void const *data, size_t size)
  */
 uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash)
 {
-	uint8_t const *p = data;
-	uint8_t const *q;
-
 	if (size == 0) return hash;	/* Avoid ubsan issues with access NULL pointer */
 
- 	q = p + size;
-	while (p < q) {
-		hash *= FNV_MAGIC_PRIME;
-		hash ^= (uint32_t) (*p++);
-	}
-
-	return hash;
+	return hash_block(data, size, hash);
 }
 
 /*
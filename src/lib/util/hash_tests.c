@@ -0,0 +1,200 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/oahash.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/time.h>
+
+#include "hash.c"
+
+/*
+ *	The old byte at a time FNV-1a hash, for comparison.
+ */
+static uint32_t fnv_hash(void const *data, size_t size)
+{
+	uint8_t const	*p = data, *q = p + size;
+	uint32_t	hash = FNV_MAGIC_INIT;
+
+	while (p != q) {
+		hash ^= (uint32_t) (*p++);
+		hash *= FNV_MAGIC_PRIME;
+	}
+
+	return hash;
+}
+
+#define HASH_TEST_BUCKETS (1024)
+
+/*
+ *	Keys which differ by one bit, at every length, should spread
+ *	evenly over the buckets.
+ */
+static void hash_test(void)
+{
+	uint8_t		buffer[256];
+	uint32_t	buckets[HASH_TEST_BUCKETS];
+	size_t		len;
+	uint32_t	i, max;
+
+	memset(buffer, 0, sizeof(buffer));
+
+	TEST_CASE("repeatable");
+	for (len = 0; len < sizeof(buffer); len++) {
+		buffer[len] = fr_rand();
+
+		TEST_CHECK(fr_hash(buffer, len) == fr_hash(buffer, len));
+		TEST_CHECK(fr_hash_update(buffer, len, 0x1234) == fr_hash_update(buffer, len, 0x1234));
+	}
+	TEST_CHECK(fr_hash_update(buffer, 0, 0x1234) == 0x1234);
+
+	TEST_CASE("distribution");
+	for (len = 1; len <= 64; len++) {
+		memset(buckets, 0, sizeof(buckets));
+		memset(buffer, 0, sizeof(buffer));
+
+		for (i = 0; i < (HASH_TEST_BUCKETS * 16); i++) {
+			memcpy(buffer, &i, (len < sizeof(i)) ? len : sizeof(i));
+			if (len > sizeof(i)) buffer[len - 1] = i >> 8;
+
+			buckets[fr_hash(buffer, len) & (HASH_TEST_BUCKETS - 1)]++;
+		}
+
+		/*
+		 *	16 entries per bucket on average.  A bucket with
+		 *	more than 4 times that is badly skewed.
+		 */
+		max = 0;
+		for (i = 0; i < HASH_TEST_BUCKETS; i++) if (buckets[i] > max) max = buckets[i];
+
+		if (len < 2) continue;	/* 256 possible keys */
+
+		TEST_CHECK(max <= 64);
+		TEST_MSG("length %zu has a bucket with %u entries", len, max);
+	}
+}
+
+#define HASH_BENCH_LOOPS (4000000)
+
+static void hash_bench(void)
+{
+	static size_t const	lengths[] = { 2, 16, 64, 256 };
+	uint8_t			buffer[256];
+	size_t			i;
+	uint32_t		j, total = 0;
+	fr_time_t		start, new_time, fnv_time;
+
+	fr_time_start();
+
+	for (i = 0; i < sizeof(buffer); i++) buffer[i] = fr_rand();
+
+	for (i = 0; i < NUM_ELEMENTS(lengths); i++) {
+		start = fr_time();
+		for (j = 0; j < HASH_BENCH_LOOPS; j++) {
+			buffer[0] = j;
+			total += fr_hash(buffer, lengths[i]);
+		}
+		new_time = fr_time() - start;
+
+		start = fr_time();
+		for (j = 0; j < HASH_BENCH_LOOPS; j++) {
+			buffer[0] = j;
+			total += fnv_hash(buffer, lengths[i]);
+		}
+		fnv_time = fr_time() - start;
+
+		TEST_MSG("%zu bytes: fr_hash %.3fs, fnv %.3fs",
+			 lengths[i], (double) new_time / NSEC, (double) fnv_time / NSEC);
+		printf("\n%zu bytes: fr_hash %.3fs, fnv %.3fs",
+		       lengths[i], (double) new_time / NSEC, (double) fnv_time / NSEC);
+	}
+	printf("\n");
+
+	TEST_CHECK(total != 0);	/* so the loops aren't optimised away */
+}
+
+typedef struct {
+	uint32_t	key;
+	uint32_t	value;
+} hash_thing;
+
+static uint32_t thing_hash(void const *data)
+{
+	hash_thing const *a = data;
+
+	return fr_hash(&a->key, sizeof(a->key));
+}
+
+static int thing_cmp(void const *one, void const *two)
+{
+	hash_thing const *a = one, *b = two;
+
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+#define HASH_TABLE_SIZE		(65536)
+#define HASH_TABLE_LOOPS	(4000000)
+
+/*
+ *	Compare lookups in the chained table against the flat open
+ *	addressing table.
+ */
+static void hash_table_bench(void)
+{
+	fr_hash_table_t	*ht;
+	fr_oahash_t	*oh;
+	hash_thing	*array;
+	uint32_t	i, found;
+	fr_time_t	start, ht_time, oh_time;
+
+	fr_time_start();
+
+	ht = fr_hash_table_create(NULL, thing_hash, thing_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	oh = fr_oahash_alloc(NULL, thing_hash, thing_cmp, 0);
+	TEST_CHECK(oh != NULL);
+
+	array = calloc(HASH_TABLE_SIZE, sizeof(hash_thing));
+	for (i = 0; i < HASH_TABLE_SIZE; i++) {
+		array[i].key = fr_rand();
+		array[i].value = i;
+
+		if (!fr_hash_table_insert(ht, &array[i])) {
+			array[i].key = 0;
+			continue;
+		}
+		TEST_CHECK(fr_oahash_insert(oh, &array[i]));
+	}
+	TEST_CHECK((uint32_t) fr_hash_table_num_elements(ht) == fr_oahash_num_elements(oh));
+
+	found = 0;
+	start = fr_time();
+	for (i = 0; i < HASH_TABLE_LOOPS; i++) {
+		if (fr_hash_table_find_by_data(ht, &array[(i * 7919) & (HASH_TABLE_SIZE - 1)])) found++;
+	}
+	ht_time = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < HASH_TABLE_LOOPS; i++) {
+		if (fr_oahash_find(oh, &array[(i * 7919) & (HASH_TABLE_SIZE - 1)])) found--;
+	}
+	oh_time = fr_time() - start;
+
+	TEST_CHECK(found == 0);
+	TEST_MSG("hash table %.3fs, oahash %.3fs",
+		 (double) ht_time / NSEC, (double) oh_time / NSEC);
+	printf("\nhash table %.3fs, oahash %.3fs\n",
+	       (double) ht_time / NSEC, (double) oh_time / NSEC);
+
+	talloc_free(ht);
+	talloc_free(oh);
+	free(array);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "hash_test",			hash_test		},
+	{ "hash_bench",			hash_bench		},
+	{ "hash_table_bench",		hash_table_bench	},
+	{ NULL }
+};
@@ -41,6 +41,7 @@ struct fr_heap_s {
 	size_t		offset;			//!< Offset of heap index in element structure.
 
 	int32_t		num_elements;		//!< Number of nodes used.
+	unsigned int	shift;			//!< log2 of the number of children each node has.
 
 	char const	*type;			//!< Type of elements.
 	fr_heap_cmp_t	cmp;			//!< Comparator function.
@@ -49,23 +50,40 @@ struct fr_heap_s {
 };
 
 /*
- *	First node in a heap is element 0. Children of i are 2i+1 and
- *	2i+2.  These macros wrap the logic, so the code is more
- *	descriptive.
+ *	First node in a heap is element 0.  For a binary heap, the
+ *	children of i are 2i+1 and 2i+2.  For a d-ary heap, they are
+ *	di+1 through di+d.  These macros wrap the logic, so the code
+ *	is more descriptive.
+ *
+ *	A 4-ary heap is half the height of a binary heap, and the
+ *	four children of a node are adjacent in memory, so sifting
+ *	down touches fewer cache lines.  It does more comparisons per
+ *	level, so it's only a win for large heaps.
  */
-#define HEAP_PARENT(_x)	(((_x) - 1 ) / 2)
-#define HEAP_LEFT(_x)	(2 * (_x) + 1)
-/* #define HEAP_RIGHT(_x) (2 * (_x) + 2 ) */
+#define HEAP_PARENT(_hp, _x)	(((_x) - 1) >> (_hp)->shift)
+#define HEAP_LEFT(_hp, _x)	(((_x) << (_hp)->shift) + 1)
+#define HEAP_RIGHT(_hp, _x)	(((_x) + 1) << (_hp)->shift)
 #define	HEAP_SWAP(_a, _b) { void *_tmp = _a; _a = _b; _b = _tmp; }
 
 static void fr_heap_bubble(fr_heap_t *hp, int32_t child);
 
-fr_heap_t *_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *type, size_t offset)
+fr_heap_t *_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *type, size_t offset, unsigned int arity)
 {
 	fr_heap_t *fh;
 
 	if (!cmp) return NULL;
 
+	switch (arity) {
+	case 2:
+	case 4:
+	case 8:
+		break;
+
+	default:
+		fr_strerror_printf("Heap arity must be 2, 4, or 8, not %u", arity);
+		return NULL;
+	}
+
 	fh = talloc_zero(ctx, fr_heap_t);
 	if (!fh) return NULL;
 
@@ -79,6 +97,7 @@ fr_heap_t *_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *type,
 	fh->type = type;
 	fh->cmp = cmp;
 	fh->offset = offset;
+	fh->shift = (arity == 2) ? 1 : (arity == 4) ? 2 : 3;
 
 	return fh;
 }
@@ -96,6 +115,74 @@ static inline CC_HINT(always_inline) CC_HINT(nonnull) void index_set(fr_heap_t *
 #define OFFSET_SET(_heap, _idx) index_set(_heap, _heap->p[_idx], _idx);
 #define OFFSET_RESET(_heap, _idx) index_set(_heap, _heap->p[_idx], -1);
 
+/** Check that an element isn't already in the heap, and is of the right type
+ *
+ */
+static inline CC_HINT(always_inline) int heap_insert_check(fr_heap_t *hp, void *data)
+{
+	int32_t child;
+
+	/*
+	 *	On insert, the heap_id MUST be either:
+	 *
+	 *	-1 = the node was added / removed from the heap
+	 *	     and the heap code set the ID to -1
+	 *	0  = the node was just allocated via an "alloc_zero"
+	 *	     function
+	 */
+	child = index_get(hp, data);
+	if ((child > 0) || ((child == 0) && (hp->num_elements > 0) && (data == hp->p[0]))) {
+		fr_strerror_const("Node is already in the heap");
+		return -1;
+	}
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (hp->type) (void)_talloc_get_type_abort(data, hp->type, __location__);
+#endif
+
+	return 0;
+}
+
+/** Make sure the heap has room for at least num elements
+ *
+ */
+static int heap_reserve(fr_heap_t *hp, size_t num)
+{
+	void	**n;
+	size_t	n_size;
+
+	if (num <= hp->size) return 0;
+
+	/*
+	 *	heap_id is a 32-bit signed integer.  If the heap will
+	 *	grow to contain more than 2B elements, disallow
+	 *	integer overflow.  Tho TBH, that should really never
+	 *	happen.
+	 */
+	if (num > INT32_MAX) {
+		fr_strerror_const("Heap is full");
+		return -1;
+	}
+
+	/*
+	 *	Double it's size until the elements fit.
+	 */
+	n_size = hp->size;
+	while (n_size < num) n_size *= 2;
+	if (n_size > INT32_MAX) n_size = INT32_MAX;
+
+	n = talloc_realloc(hp, hp->p, void *, n_size);
+	if (!n) {
+		fr_strerror_printf("Failed expanding heap to %zu elements (%zu bytes)",
+				   n_size, (n_size * sizeof(void *)));
+		return -1;
+	}
+	hp->size = n_size;
+	hp->p = n;
+
+	return 0;
+}
+
 /** Insert a new element into the heap
  *
  * Insert element in heap. Normally, p != NULL, we insert p in a
@@ -119,62 +206,109 @@ int fr_heap_insert(fr_heap_t *hp, void *data)
 {
 	int32_t child;
 
-	/*
-	 *	On insert, the heap_id MUST be either:
-	 *
-	 *	-1 = the node was added / removed from the heap
-	 *	     and the heap code set the ID to -1
-	 *	0  = the node was just allocated via an "alloc_zero"
-	 *	     function
-	 */
-	child = index_get(hp, data);
-	if ((child > 0) || ((child == 0) && (hp->num_elements > 0) && (data == hp->p[0]))) {
-		fr_strerror_const("Node is already in the heap");
-		return -1;
-	}
+	if (heap_insert_check(hp, data) < 0) return -1;
 
 	child = hp->num_elements;
 
-#ifndef TALLOC_GET_TYPE_ABORT_NOOP
-	if (hp->type) (void)_talloc_get_type_abort(data, hp->type, __location__);
-#endif
-
 	/*
 	 *	Heap is full.  Double it's size.
 	 */
-	if ((size_t)child == hp->size) {
-		void	**n;
-		size_t	n_size = hp->size * 2;
+	if (((size_t)child == hp->size) && (heap_reserve(hp, hp->size + 1) < 0)) return -1;
+
+	hp->p[child] = data;
+	hp->num_elements++;
+
+ 	fr_heap_bubble(hp, child);
+
+	return 0;
+}
+
+/** Move an element down the heap until it's smaller than all of its children
+ *
+ */
+static void fr_heap_sift(fr_heap_t *hp, int32_t parent)
+{
+	int32_t	max = hp->num_elements - 1;
+	void	*data = hp->p[parent];
+
+	for (;;) {
+		int32_t child = HEAP_LEFT(hp, parent);
+		int32_t last = HEAP_RIGHT(hp, parent);
+		int32_t i;
+
+		if (child > max) break;
+		if (last > max) last = max;
+
+		for (i = child + 1; i <= last; i++) {
+			if (hp->cmp(hp->p[i], hp->p[child]) < 0) child = i;
+		}
 
 		/*
-		 *	heap_id is a 32-bit signed integer.  If the heap will
-		 *	grow to contain more than 2B elements, disallow
-		 *	integer overflow.  Tho TBH, that should really never
-		 *	happen.
+		 *	Our element is smaller than all of the
+		 *	children.  We're done.
 		 */
-		if (n_size > INT32_MAX) {
-			if (hp->size == INT32_MAX) {
-				fr_strerror_const("Heap is full");
-				return -1;
-			} else {
-				n_size = INT32_MAX;
-			}
-		}
+		if (hp->cmp(hp->p[child], data) >= 0) break;
 
-		n = talloc_realloc(hp, hp->p, void *, n_size);
-		if (!n) {
-			fr_strerror_printf("Failed expanding heap to %zu elements (%zu bytes)",
-					   n_size, (n_size * sizeof(void *)));
-			return -1;
-		}
-		hp->size = n_size;
-		hp->p = n;
+		hp->p[parent] = hp->p[child];
+		OFFSET_SET(hp, parent);
+		parent = child;
 	}
 
-	hp->p[child] = data;
-	hp->num_elements++;
+	hp->p[parent] = data;
+	OFFSET_SET(hp, parent);
+}
 
- 	fr_heap_bubble(hp, child);
+/** Insert many elements into the heap
+ *
+ * The heap grows at most once.  If there are at least as many new
+ * elements as existing ones, the whole heap is rebuilt bottom up,
+ * which is O(n), instead of doing O(log n) work for each new element.
+ *
+ * None of the elements are inserted if any of them are already
+ * in the heap.
+ *
+ * @param[in] hp	The heap to insert elements into.
+ * @param[in] data	Array of elements to insert.
+ * @param[in] num	Number of elements in the array.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (heap full or malloc error).
+ */
+int fr_heap_insert_batch(fr_heap_t *hp, void **data, uint32_t num)
+{
+	int32_t		start = hp->num_elements;
+	uint32_t	i;
+
+	if (num == 0) return 0;
+	if (num == 1) return fr_heap_insert(hp, data[0]);
+
+	for (i = 0; i < num; i++) {
+		if (heap_insert_check(hp, data[i]) < 0) return -1;
+	}
+
+	if (heap_reserve(hp, (size_t)start + num) < 0) return -1;
+
+	memcpy(hp->p + start, data, sizeof(hp->p[0]) * num);
+	hp->num_elements += num;
+
+	/*
+	 *	A few new elements.  Bubble each of them up.
+	 */
+	if (num < (uint32_t)start) {
+		int32_t child;
+
+		for (child = start; child < hp->num_elements; child++) fr_heap_bubble(hp, child);
+		return 0;
+	}
+
+	/*
+	 *	Lots of new elements.  Rebuild the heap, starting
+	 *	from the parent of the last element.  Elements which
+	 *	are leaves don't move, but do need their indexes set.
+	 */
+	for (i = HEAP_PARENT(hp, hp->num_elements - 1) + 1; i < (uint32_t)hp->num_elements; i++) OFFSET_SET(hp, i);
+
+	for (i = HEAP_PARENT(hp, hp->num_elements - 1) + 1; i > 0; i--) fr_heap_sift(hp, i - 1);
 
 	return 0;
 }
@@ -185,7 +319,7 @@ static void fr_heap_bubble(fr_heap_t *hp, int32_t child)
 	 *	Bubble up the element.
 	 */
 	while (child > 0) {
-		int32_t parent = HEAP_PARENT(child);
+		int32_t parent = HEAP_PARENT(hp, child);
 
 		/*
 		 *	Parent is smaller than the child.  We're done.
@@ -244,19 +378,22 @@ int fr_heap_extract(fr_heap_t *hp, void *data)
 	max = hp->num_elements - 1;
 
 	OFFSET_RESET(hp, parent);
-	child = HEAP_LEFT(parent);
+	child = HEAP_LEFT(hp, parent);
 	while (child <= max) {
+		int32_t i, last = HEAP_RIGHT(hp, parent);
+
 		/*
-		 *	Maybe take the right child.
+		 *	Take the smallest child.
 		 */
-		if ((child != max) &&
-		    (hp->cmp(hp->p[child + 1], hp->p[child]) < 0)) {
-			child = child + 1;
+		if (last > max) last = max;
+		for (i = child + 1; i <= last; i++) {
+			if (hp->cmp(hp->p[i], hp->p[child]) < 0) child = i;
 		}
+
 		hp->p[parent] = hp->p[child];
 		OFFSET_SET(hp, parent);
 		parent = child;
-		child = HEAP_LEFT(child);
+		child = HEAP_LEFT(hp, child);
 	}
 	hp->num_elements--;
 
@@ -65,7 +65,7 @@ typedef struct fr_heap_s fr_heap_t;
  * @param[in] _field		to store heap indexes in.
  */
 #define fr_heap_alloc(_ctx, _cmp, _type, _field) \
-	_fr_heap_alloc(_ctx, _cmp, NULL, (size_t)offsetof(_type, _field))
+	_fr_heap_alloc(_ctx, _cmp, NULL, (size_t)offsetof(_type, _field), 2)
 
 /** Creates a heap that verifies elements are of a specific talloc type
  *
@@ -78,11 +78,41 @@ typedef struct fr_heap_s fr_heap_t;
  *	- NULL on error.
  */
 #define fr_heap_talloc_alloc(_ctx, _cmp, _talloc_type, _field) \
-	_fr_heap_alloc(_ctx, _cmp, #_talloc_type, (size_t)offsetof(_talloc_type, _field))
+	_fr_heap_alloc(_ctx, _cmp, #_talloc_type, (size_t)offsetof(_talloc_type, _field), 2)
 
-fr_heap_t	*_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *talloc_type, size_t offset);
+/** Creates a d-ary heap that can be used with non-talloced elements
+ *
+ * Wider heaps are shallower, and are better for large heaps
+ * where elements are popped more often than they're inserted.
+ *
+ * @param[in] _ctx		Talloc ctx to allocate heap in.
+ * @param[in] _cmp		Comparator used to compare elements.
+ * @param[in] _type		Of elements.
+ * @param[in] _field		to store heap indexes in.
+ * @param[in] _arity		Number of children each node has.  One of 2, 4, or 8.
+ */
+#define fr_heap_dary_alloc(_ctx, _cmp, _type, _field, _arity) \
+	_fr_heap_alloc(_ctx, _cmp, NULL, (size_t)offsetof(_type, _field), _arity)
+
+/** Creates a d-ary heap that verifies elements are of a specific talloc type
+ *
+ * @param[in] _ctx		Talloc ctx to allocate heap in.
+ * @param[in] _cmp		Comparator used to compare elements.
+ * @param[in] _talloc_type	of elements.
+ * @param[in] _field		to store heap indexes in.
+ * @param[in] _arity		Number of children each node has.  One of 2, 4, or 8.
+ * @return
+ *	- A new heap.
+ *	- NULL on error.
+ */
+#define fr_heap_dary_talloc_alloc(_ctx, _cmp, _talloc_type, _field, _arity) \
+	_fr_heap_alloc(_ctx, _cmp, #_talloc_type, (size_t)offsetof(_talloc_type, _field), _arity)
+
+fr_heap_t	*_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *talloc_type, size_t offset,
+				unsigned int arity);
 
 int		fr_heap_insert(fr_heap_t *hp, void *data) CC_HINT(nonnull);
+int		fr_heap_insert_batch(fr_heap_t *hp, void **data, uint32_t num) CC_HINT(nonnull);
 int		fr_heap_extract(fr_heap_t *hp, void *data) CC_HINT(nonnull(1));
 void		*fr_heap_pop(fr_heap_t *hp) CC_HINT(nonnull);
 void		*fr_heap_peek(fr_heap_t *hp);
@@ -216,6 +216,69 @@ static void heap_cycle(void)
 	free(remaining);
 }
 
+/*
+ *	Batch insertion, for binary and wider heaps.  The first batch
+ *	heapifies, the second is small enough to be bubbled up.
+ */
+static void heap_test_batch(void)
+{
+	static unsigned int const arity[] = { 2, 4, 8 };
+	size_t		a;
+
+	for (a = 0; a < NUM_ELEMENTS(arity); a++) {
+		fr_heap_t	*hp;
+		int		i, ret, prev;
+		heap_thing	*array;
+		void		**batch;
+
+		hp = fr_heap_dary_alloc(NULL, heap_cmp, heap_thing, heap, arity[a]);
+		TEST_CHECK(hp != NULL);
+
+		array = calloc(HEAP_TEST_SIZE, sizeof(heap_thing));
+		batch = calloc(HEAP_TEST_SIZE, sizeof(void *));
+
+		for (i = 0; i < HEAP_TEST_SIZE; i++) {
+			array[i].data = rand() % 65537;
+			batch[i] = &array[i];
+		}
+
+		TEST_CASE("insertions");
+		TEST_CHECK((ret = fr_heap_insert_batch(hp, batch, HEAP_TEST_SIZE - 100)) == 0);
+		TEST_MSG("batch insert failed, returned %i - %s", ret, fr_strerror());
+
+		TEST_CHECK((ret = fr_heap_insert_batch(hp, batch + HEAP_TEST_SIZE - 100, 100)) == 0);
+		TEST_MSG("batch insert failed, returned %i - %s", ret, fr_strerror());
+
+		TEST_CHECK(fr_heap_num_elements(hp) == HEAP_TEST_SIZE);
+
+		TEST_CASE("duplicates");
+		TEST_CHECK(fr_heap_insert_batch(hp, batch, 2) < 0);
+		TEST_CHECK(fr_heap_num_elements(hp) == HEAP_TEST_SIZE);
+
+		TEST_CASE("deletions");
+		for (i = 0; i < HEAP_TEST_SIZE; i += 3) {
+			TEST_CHECK(fr_heap_extract(hp, &array[i]) >= 0);
+			TEST_MSG("element %i removal failed", i);
+		}
+
+		TEST_CASE("order");
+		prev = -1;
+		for (i = fr_heap_num_elements(hp); i > 0; i--) {
+			heap_thing *t = fr_heap_pop(hp);
+
+			TEST_CHECK((t != NULL) && (t->data >= prev) && (t->heap == -1));
+			TEST_MSG("arity %u: element popped out of order", arity[a]);
+			if (!t) break;
+			prev = t->data;
+		}
+		TEST_CHECK(fr_heap_num_elements(hp) == 0);
+
+		talloc_free(hp);
+		free(array);
+		free(batch);
+	}
+}
+
 TEST_LIST = {
 	/*
 	 *	Basic tests
@@ -224,6 +287,7 @@ TEST_LIST = {
 	{ "heap_test_skip_2",		heap_test_skip_2	},
 	{ "heap_test_skip_10",		heap_test_skip_10	},
 	{ "heap_cycle",			heap_cycle		},
+	{ "heap_test_batch",		heap_test_batch		},
 	{ NULL }
 };
 
@@ -26,6 +26,19 @@ RCSID("$Id$")
 
 static char const hextab[] = "0123456789abcdef";
 
+/*
+ *	Value of each hexit plus one, so that zero means "not a hexit".
+ *	Cheaper than searching hextab for every character.
+ */
+static uint8_t const hexval[UINT8_MAX + 1] = {
+	['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+	['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+#define IS_HEXIT(_c) (hexval[(uint8_t)(_c)] != 0)
+
 /** Convert hex strings to binary data
  *
  * @param[out] err		If non-null contains any parse errors.
@@ -45,11 +58,41 @@ ssize_t fr_hex2bin(fr_sbuff_parse_error_t *err, fr_dbuff_t *out, fr_sbuff_t *in,
 	fr_dbuff_t	our_out = FR_DBUFF_NO_ADVANCE(out);
 
 	while (fr_sbuff_extend_lowat(NULL, &our_in, 2) >= 2) {
-		char *c1, *c2 = NULL;
+		uint8_t const	*p = (uint8_t const *)fr_sbuff_current(&our_in);
+		uint8_t		*q;
+		size_t		i, n;
+
+		/*
+		 *	Convert as much as is already buffered, and
+		 *	fits in the output, directly.
+		 */
+		n = fr_sbuff_remaining(&our_in) >> 1;
+		if (our_out.is_const) {
+			n = 0;
+		} else if (n > fr_dbuff_remaining(&our_out)) {
+			n = fr_dbuff_remaining(&our_out);
+		}
+
+		q = fr_dbuff_current(&our_out);
+		for (i = 0; i < n; i++) {
+			uint8_t hi = hexval[p[i * 2]], lo = hexval[p[(i * 2) + 1]];
+
+			if (!hi || !lo) break;
 
-		if(!(c1 = memchr(hextab, tolower((int) *fr_sbuff_current(&our_in)), sizeof(hextab))) ||
-		   !(c2 = memchr(hextab, tolower((int) *(fr_sbuff_current(&our_in) + 1)), sizeof(hextab)))) {
-			if (!c2 && no_trailing) {
+			q[i] = ((hi - 1) << 4) | (lo - 1);
+		}
+		fr_sbuff_advance(&our_in, i * 2);
+		fr_dbuff_advance(&our_out, i);
+		total += i;
+		if ((n > 0) && (i == n)) continue;
+
+		/*
+		 *	Stopped on a non-hexit, or out of space.
+		 */
+		if (fr_sbuff_remaining(&our_in) < 2) continue;
+
+		if (!IS_HEXIT(*fr_sbuff_current(&our_in)) || !IS_HEXIT(*(fr_sbuff_current(&our_in) + 1))) {
+			if (no_trailing) {
 			got_trailing:
 		   		if (err) *err = FR_SBUFF_PARSE_ERROR_TRAILING;
 		   		return 0;
@@ -57,14 +100,14 @@ ssize_t fr_hex2bin(fr_sbuff_parse_error_t *err, fr_dbuff_t *out, fr_sbuff_t *in,
 			goto done;
 		}
 
-		FR_DBUFF_IN_BYTES_RETURN(&our_out, ((c1 - hextab) << 4) + (c2 - hextab));
+		FR_DBUFF_IN_BYTES_RETURN(&our_out, ((hexval[(uint8_t)*fr_sbuff_current(&our_in)] - 1) << 4) |
+				         (hexval[(uint8_t)*(fr_sbuff_current(&our_in) + 1)] - 1));
 
 		fr_sbuff_advance(&our_in, 2);
 		total++;
 	};
 
-	if (no_trailing && (fr_sbuff_remaining(&our_in) > 0) &&
-	    memchr(hextab, tolower((int) *our_in.p), sizeof(hextab))) goto got_trailing;
+	if (no_trailing && (fr_sbuff_remaining(&our_in) > 0) && IS_HEXIT(*our_in.p)) goto got_trailing;
 
 done:
 	fr_sbuff_set(in, &our_in);
@@ -91,6 +134,31 @@ ssize_t fr_bin2hex(fr_sbuff_t *out, fr_dbuff_t *in, size_t len)
 {
 	size_t	total = 0;
 
+	/*
+	 *	Convert as much as is already buffered, and fits in
+	 *	the output, directly.  The loop below deals with
+	 *	extending the buffers, and running out of space.
+	 */
+	if (!out->is_const) {
+		uint8_t const	*p = fr_dbuff_current(in);
+		char		*q = fr_sbuff_current(out);
+		size_t		i, n;
+
+		n = fr_dbuff_remaining(in);
+		if (n > len) n = len;
+		if (n > (fr_sbuff_remaining(out) >> 1)) n = fr_sbuff_remaining(out) >> 1;
+
+		for (i = 0; i < n; i++) {
+			q[i * 2] = hextab[p[i] >> 4];
+			q[(i * 2) + 1] = hextab[p[i] & 0x0f];
+		}
+		q[n * 2] = '\0';
+
+		fr_sbuff_advance(out, n * 2);
+		fr_dbuff_advance(in, n);
+		total = n;
+	}
+
 	while ((fr_dbuff_extend_lowat(NULL, in, 2) > 0) && (total < len)) {
 		FR_SBUFF_IN_CHAR_RETURN(out, hextab[((*in->p) >> 4) & 0x0f], hextab[*in->p & 0x0f]);
 
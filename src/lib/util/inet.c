@@ -444,6 +444,67 @@ static int ip_prefix_addr_from_str(struct in_addr *out, char const *str)
 	return p - str;
 }
 
+/** Parse a dotted quad, with an optional prefix length
+ *
+ * This is the common case, and doesn't need the temporary buffers, copies,
+ * or resolution of #fr_inet_pton4.  Only the canonical form is accepted,
+ * i.e. four decimal octets with no leading zeros.  Anything else, including
+ * errors, is left to the generic code.
+ *
+ * @param[out] out	Where to write the ip address value.
+ * @param[in] p		start of the string.
+ * @param[in] end	of the string.
+ * @param[in] mask_bits	If true, set address bits to zero.
+ * @return
+ *	- true if the address was parsed.
+ *	- false if the generic code should be used.
+ */
+static inline CC_HINT(always_inline) bool inet_pton4_fast(fr_ipaddr_t *out, char const *p, char const *end,
+							  bool mask_bits)
+{
+	uint32_t	addr = 0;
+	unsigned int	prefix = 32;
+	int		i;
+
+	for (i = 0; i < 4; i++) {
+		char const	*start;
+		unsigned int	octet = 0;
+
+		if (i > 0) {
+			if ((p == end) || (*p != '.')) return false;
+			p++;
+		}
+
+		start = p;
+		while ((p < end) && ((p - start) < 3) && ((unsigned int)(*p - '0') <= 9)) {
+			octet = (octet * 10) + (*p++ - '0');
+		}
+		if ((p == start) || (octet > 255) || ((*start == '0') && ((p - start) > 1))) return false;
+
+		addr = (addr << 8) | octet;
+	}
+
+	if ((p < end) && (*p == '/')) {
+		char const *start = ++p;
+
+		prefix = 0;
+		while ((p < end) && ((p - start) < 2) && ((unsigned int)(*p - '0') <= 9)) {
+			prefix = (prefix * 10) + (*p++ - '0');
+		}
+		if ((p == start) || (prefix > 32)) return false;
+	}
+
+	if (p != end) return false;
+
+	out->af = AF_INET;
+	out->prefix = prefix;
+	out->addr.v4.s_addr = htonl(addr);
+
+	if (mask_bits && (prefix < 32)) out->addr.v4 = fr_inaddr_mask(&out->addr.v4, prefix);
+
+	return true;
+}
+
 /** Parse an IPv4 address or IPv4 prefix in presentation format (and others)
  *
  * @param[out] out	Where to write the ip address value.
@@ -476,6 +537,8 @@ int fr_inet_pton4(fr_ipaddr_t *out, char const *value, ssize_t inlen, bool resol
 	 */
 	memset(out, 0, sizeof(*out));
 
+	if (inet_pton4_fast(out, value, value + ((inlen < 0) ? strlen(value) : (size_t)inlen), mask_bits)) return 0;
+
 	end = value + inlen;
 	while (isspace((int) *value) && (value < end)) value++;
 	if (value == end) {
@@ -583,6 +646,109 @@ int fr_inet_pton4(fr_ipaddr_t *out, char const *value, ssize_t inlen, bool resol
 	return 0;
 }
 
+/** Parse IPv6 hexits, with an optional prefix length
+ *
+ * Like #inet_pton4_fast, this is the common case.  Addresses with an
+ * embedded IPv4 address, or a scope, are left to the generic code.
+ *
+ * @note out must already be zeroed, as the words "::" stands for aren't written.
+ *
+ * @param[out] out	Where to write the ip address value.
+ * @param[in] p		start of the string.
+ * @param[in] end	of the string.
+ * @param[in] mask	If true, set address bits to zero.
+ * @return
+ *	- true if the address was parsed.
+ *	- false if the generic code should be used.
+ */
+static inline CC_HINT(always_inline) bool inet_pton6_fast(fr_ipaddr_t *out, char const *p, char const *end,
+							  bool mask)
+{
+	uint16_t	words[8];
+	int		num = 0, gap = -1, i;
+	unsigned int	prefix = 128;
+
+	if (((end - p) >= 2) && (p[0] == ':') && (p[1] == ':')) {
+		gap = 0;
+		p += 2;
+	}
+
+	while ((p < end) && (*p != '/')) {
+		char const	*start = p;
+		unsigned int	word = 0;
+
+		if (num == 8) return false;
+
+		while ((p < end) && ((p - start) < 4)) {
+			unsigned int hexit = (unsigned int)(*p - '0');
+
+			if (hexit > 9) {
+				hexit = (unsigned int)((*p | 0x20) - 'a');
+				if (hexit > 5) break;
+				hexit += 10;
+			}
+			word = (word << 4) | hexit;
+			p++;
+		}
+		if (p == start) return false;
+
+		words[num++] = word;
+
+		if ((p == end) || (*p == '/')) break;
+		if (*p++ != ':') return false;		/* Embedded IPv4, scope, or garbage */
+
+		if ((p < end) && (*p == ':')) {
+			if (gap >= 0) return false;
+			gap = num;
+			p++;
+		} else if ((p == end) || (*p == '/')) {
+			return false;			/* Trailing ':' */
+		}
+	}
+
+	if ((gap < 0) ? (num != 8) : (num == 8)) return false;
+
+	if ((p < end) && (*p == '/')) {
+		char const *start = ++p;
+
+		prefix = 0;
+		while ((p < end) && ((p - start) < 3) && ((unsigned int)(*p - '0') <= 9)) {
+			prefix = (prefix * 10) + (*p++ - '0');
+		}
+		if ((p == start) || (prefix > 128)) return false;
+	}
+
+	if (p != end) return false;
+
+	out->af = AF_INET6;
+	out->prefix = prefix;
+
+	/*
+	 *	Words before the "::" go at the start of the
+	 *	address, and the ones after it at the end.
+	 */
+	if (gap < 0) gap = num;
+	for (i = 0; i < gap; i++) {
+		out->addr.v6.s6_addr[i * 2] = words[i] >> 8;
+		out->addr.v6.s6_addr[(i * 2) + 1] = words[i] & 0xff;
+	}
+	for (i = gap; i < num; i++) {
+		int j = 8 - (num - i);
+
+		out->addr.v6.s6_addr[j * 2] = words[i] >> 8;
+		out->addr.v6.s6_addr[(j * 2) + 1] = words[i] & 0xff;
+	}
+
+	if (mask && (prefix < 128)) {
+		struct in6_addr addr;
+
+		addr = fr_in6addr_mask(&out->addr.v6, prefix);
+		memcpy(out->addr.v6.s6_addr, addr.s6_addr, sizeof(out->addr.v6.s6_addr));
+	}
+
+	return true;
+}
+
 /** Parse an IPv6 address or IPv6 prefix in presentation format (and others)
  *
  * @param[out] out	Where to write the ip address value.
@@ -613,6 +779,8 @@ int fr_inet_pton6(fr_ipaddr_t *out, char const *value, ssize_t inlen, bool resol
 	 */
 	memset(out, 0, sizeof(*out));
 
+	if (inet_pton6_fast(out, value, value + ((inlen < 0) ? strlen(value) : (size_t)inlen), mask)) return 0;
+
 	end = value + inlen;
 	while (isspace((int) *value) && (value < end)) value++;
 	if (value == end) {
@@ -949,6 +1117,90 @@ do_port:
 	return 0;
 }
 
+/** Print an IPv4 address in dotted quad notation
+ *
+ * @param[out] p	Where to write the address, must have space
+ *			for INET_ADDRSTRLEN bytes.
+ * @param[in] addr	in host byte order.
+ * @return the end of the address (which is not \0 terminated).
+ */
+static inline CC_HINT(always_inline) char *inet_ntop4_fast(char *p, uint32_t addr)
+{
+	int i;
+
+	for (i = 24; i >= 0; i -= 8) {
+		unsigned int octet = (addr >> i) & 0xff;
+
+		if (octet >= 100) {
+			*p++ = '0' + (octet / 100);
+			*p++ = '0' + ((octet / 10) % 10);
+		} else if (octet >= 10) {
+			*p++ = '0' + (octet / 10);
+		}
+		*p++ = '0' + (octet % 10);
+		if (i > 0) *p++ = '.';
+	}
+
+	return p;
+}
+
+/** Print an IPv6 address
+ *
+ * The output is the same as inet_ntop(), i.e. the longest run of two or
+ * more zero words is replaced with "::", and IPv4 mapped and IPv4
+ * compatible addresses have the IPv4 part printed as a dotted quad.
+ *
+ * @param[out] p	Where to write the address, must have space
+ *			for INET6_ADDRSTRLEN bytes.
+ * @param[in] addr	to print.
+ * @return the end of the address (which is not \0 terminated).
+ */
+static char *inet_ntop6_fast(char *p, uint8_t const addr[static 16])
+{
+	static char const	hextab[] = "0123456789abcdef";
+	unsigned int		words[8];
+	int			best_base = -1, best_len = 0, cur_base = -1, i;
+
+	for (i = 0; i < 8; i++) {
+		words[i] = (addr[i * 2] << 8) | addr[(i * 2) + 1];
+
+		if (words[i] != 0) {
+			cur_base = -1;
+			continue;
+		}
+
+		if (cur_base < 0) cur_base = i;
+		if ((i - cur_base + 1) > best_len) {
+			best_base = cur_base;
+			best_len = i - cur_base + 1;
+		}
+	}
+	if (best_len < 2) best_base = -1;
+
+	for (i = 0; i < 8; i++) {
+		unsigned int	word = words[i];
+		int		shift;
+
+		if ((best_base >= 0) && (i >= best_base) && (i < (best_base + best_len))) {
+			if (i == best_base) *p++ = ':';
+			continue;
+		}
+
+		if (i != 0) *p++ = ':';
+
+		if ((i == 6) && (best_base == 0) && ((best_len == 6) || ((best_len == 5) && (words[5] == 0xffff)))) {
+			return inet_ntop4_fast(p, (words[6] << 16) | words[7]);
+		}
+
+		for (shift = 12; (shift > 0) && !(word >> shift); shift -= 4);
+		for (; shift >= 0; shift -= 4) *p++ = hextab[(word >> shift) & 0x0f];
+	}
+
+	if ((best_base >= 0) && ((best_base + best_len) == 8)) *p++ = ':';
+
+	return p;
+}
+
 /** Print the address portion of a #fr_ipaddr_t
  *
  * @note Includes the textual scope_id name (eth0, en0 etc...) if supported.
@@ -968,15 +1220,22 @@ char *fr_inet_ntop(char out[static FR_IPADDR_STRLEN], size_t outlen, fr_ipaddr_t
 
 	out[0] = '\0';
 
-	if (inet_ntop(addr->af, &addr->addr, out, outlen) == NULL) {
-		fr_strerror_printf("%s", fr_syserror(errno));
-		return NULL;
+	if ((addr->af == AF_INET) && (outlen >= INET_ADDRSTRLEN)) {
+		p = inet_ntop4_fast(out, ntohl(addr->addr.v4.s_addr));
+		*p = '\0';
+	} else if ((addr->af == AF_INET6) && (outlen >= INET6_ADDRSTRLEN)) {
+		p = inet_ntop6_fast(out, addr->addr.v6.s6_addr);
+		*p = '\0';
+	} else {
+		if (inet_ntop(addr->af, &addr->addr, out, outlen) == NULL) {
+			fr_strerror_printf("%s", fr_syserror(errno));
+			return NULL;
+		}
+		p = out + strlen(out);
 	}
 
 	if ((addr->af == AF_INET) || (addr->scope_id == 0)) return out;
 
-	p = out + strlen(out);
-
 #ifdef WITH_IFINDEX_NAME_RESOLUTION
 	{
 		char buffer[IFNAMSIZ];
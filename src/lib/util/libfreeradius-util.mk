@@ -7,6 +7,7 @@ TARGET		:= libfreeradius-util.a
 
 SOURCES		:= \
 		   base64.c \
+		   btree.c \
 		   cap.c \
 		   cursor.c \
 		   dbuff.c \
@@ -36,11 +37,13 @@ SOURCES		:= \
 		   inet.c \
 		   isaac.c \
 		   log.c \
+		   lpm.c \
 		   md4.c \
 		   md5.c \
 		   misc.c \
 		   missing.c \
 		   net.c \
+		   oahash.c \
 		   packet.c \
 		   pair.c \
 		   pair_legacy.c \
@@ -56,6 +59,7 @@ SOURCES		:= \
 		   retry.c \
 		   sbuff.c \
 		   sha1.c \
+		   slab.c \
 		   snprintf.c \
 		   socket.c \
 		   strerror.c \
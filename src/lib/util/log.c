@@ -35,7 +35,14 @@ RCSID("$Id$")
 #ifdef HAVE_FEATURES_H
 #  include <features.h>
 #endif
+#include <pthread.h>
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 #include <stdio.h>
+#include <sys/uio.h>
 #ifdef HAVE_SYSLOG_H
 #  include <syslog.h>
 #endif
@@ -239,6 +246,245 @@ TALLOC_CTX *fr_log_pool_init(void)
 	return pool;
 }
 
+/** Maximum number of lines the writer thread passes to a single writev()
+ *
+ */
+#define LOG_ASYNC_BATCH		(64)
+
+/** Longest time the writer thread sleeps for when there's nothing to write
+ *
+ */
+#define LOG_ASYNC_MAX_SLEEP	(10 * 1000 * 1000)
+
+typedef enum {
+	LOG_RING_OPEN = 0,			//!< Thread is still running, and may log.
+	LOG_RING_CLOSED,			//!< Thread has exited.  Writer frees the ring when empty.
+	LOG_RING_ORPHANED			//!< Writer has stopped.  Thread frees the ring on exit.
+} fr_log_ring_state_t;
+
+typedef struct fr_log_ring_s fr_log_ring_t;
+
+/** Single producer, single consumer ring of formatted log lines
+ *
+ * Each thread which logs gets its own ring, so the only thing
+ * shared between producer and consumer are the head and tail
+ * indexes.
+ */
+struct fr_log_ring_s {
+	fr_log_async_t		*async;		//!< Writer this ring belongs to.
+	fr_log_ring_t		*next;		//!< Next ring in the writer's list.
+
+	atomic_uint_fast32_t	head;		//!< Next slot the producer writes to.
+	atomic_uint_fast32_t	tail;		//!< Next slot the writer reads from.
+	atomic_int		state;		//!< One of #fr_log_ring_state_t.
+
+	uint32_t		mask;		//!< Number of slots - 1.
+	struct iovec		*lines;		//!< Formatted lines, malloced by the producer,
+						///< freed by the writer.
+};
+
+/** Writer thread state for an asynchronous log destination
+ *
+ */
+struct fr_log_async_s {
+	fr_log_t const		*log;		//!< Destination we're writing to.
+
+	pthread_t		thread;		//!< Writer thread.
+	pthread_mutex_t		mutex;		//!< Protects the list of rings.
+	fr_log_ring_t		*rings;		//!< One per thread which has logged.
+
+	uint32_t		size;		//!< Number of slots in each ring.
+	bool			block;		//!< Wait for space instead of dropping lines.
+
+	atomic_bool		stop;		//!< Tell the writer to drain and exit.
+	atomic_uint_fast64_t	dropped;	//!< Lines dropped because a ring was full.
+};
+
+static _Thread_local fr_log_ring_t *fr_log_ring;
+
+/** Free a ring, and any lines still in it
+ *
+ */
+static void log_ring_free(fr_log_ring_t *ring)
+{
+	uint32_t i;
+
+	for (i = atomic_load(&ring->tail); i != atomic_load(&ring->head); i++) free(ring->lines[i & ring->mask].iov_base);
+	free(ring->lines);
+	free(ring);
+}
+
+/** Mark the ring as closed when the thread that owns it exits
+ *
+ * Whichever of the thread and the writer gets there last frees the ring.
+ */
+static void _fr_log_ring_close(void *arg)
+{
+	fr_log_ring_t *ring = arg;
+
+	if (fr_log_ring == ring) fr_log_ring = NULL;
+
+	if (atomic_exchange(&ring->state, LOG_RING_CLOSED) == LOG_RING_ORPHANED) log_ring_free(ring);
+}
+
+/** Allocate a ring for the current thread, and hand it to the writer
+ *
+ * The rings are allocated with malloc, not talloc, as they're freed
+ * by whichever thread stops using them last.
+ */
+static fr_log_ring_t *log_ring_alloc(fr_log_async_t *async)
+{
+	fr_log_ring_t *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) return NULL;
+
+	ring->lines = calloc(async->size, sizeof(ring->lines[0]));
+	if (!ring->lines) {
+		free(ring);
+		return NULL;
+	}
+	ring->async = async;
+	ring->mask = async->size - 1;
+
+	pthread_mutex_lock(&async->mutex);
+	ring->next = async->rings;
+	async->rings = ring;
+	pthread_mutex_unlock(&async->mutex);
+
+	fr_thread_local_set_destructor(fr_log_ring, _fr_log_ring_close, ring);
+
+	return ring;
+}
+
+/** Queue a formatted line for the writer thread
+ *
+ * @param[in] async	writer to queue the line for.
+ * @param[in] line	to queue.  Copied.
+ * @param[in] len	of the line.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the line was dropped.
+ */
+static int log_async_push(fr_log_async_t *async, char const *line, size_t len)
+{
+	fr_log_ring_t	*ring = fr_log_ring;
+	uint32_t	head;
+	char		*copy;
+
+	if (unlikely(!ring || (ring->async != async))) {
+		ring = log_ring_alloc(async);
+		if (!ring) goto drop;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	while ((head - atomic_load_explicit(&ring->tail, memory_order_acquire)) > ring->mask) {
+		if (!async->block) goto drop;
+
+		usleep(100);
+	}
+
+	copy = malloc(len);
+	if (!copy) {
+	drop:
+		atomic_fetch_add_explicit(&async->dropped, 1, memory_order_relaxed);
+		return -1;
+	}
+	memcpy(copy, line, len);
+
+	ring->lines[head & ring->mask] = (struct iovec){ .iov_base = copy, .iov_len = len };
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	return 0;
+}
+
+/** Write out everything currently queued in a ring
+ *
+ * @return the number of lines written.
+ */
+static uint32_t log_ring_drain(fr_log_async_t *async, fr_log_ring_t *ring)
+{
+	struct iovec	iov[LOG_ASYNC_BATCH];
+	uint32_t	head, tail, i, n, total = 0;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	while (tail != head) {
+		n = head - tail;
+		if (n > LOG_ASYNC_BATCH) n = LOG_ASYNC_BATCH;
+
+		for (i = 0; i < n; i++) iov[i] = ring->lines[(tail + i) & ring->mask];
+
+		/*
+		 *	Same as the synchronous path, there's
+		 *	nowhere to report write errors to.
+		 */
+		if (writev(async->log->fd, iov, n) < 0) { /* nothing */ }
+
+		for (i = 0; i < n; i++) free(iov[i].iov_base);
+
+		tail += n;
+		total += n;
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+
+	return total;
+}
+
+/** Write out queued lines until we're told to stop
+ *
+ */
+static void *log_async_thread(void *arg)
+{
+	fr_log_async_t	*async = arg;
+	long		delay = 0;
+
+	for (;;) {
+		fr_log_ring_t	**ring_p, *ring;
+		uint32_t	wrote = 0;
+		bool		stop = atomic_load(&async->stop);
+
+		pthread_mutex_lock(&async->mutex);
+		ring_p = &async->rings;
+		while ((ring = *ring_p)) {
+			wrote += log_ring_drain(async, ring);
+
+			/*
+			 *	The thread exited after logging
+			 *	its last line, which we've now
+			 *	written.  Free the ring.
+			 */
+			if ((atomic_load(&ring->state) == LOG_RING_CLOSED) &&
+			    (atomic_load(&ring->tail) == atomic_load(&ring->head))) {
+				*ring_p = ring->next;
+				log_ring_free(ring);
+				continue;
+			}
+			ring_p = &ring->next;
+		}
+		pthread_mutex_unlock(&async->mutex);
+
+		if (wrote) {
+			delay = 0;
+			continue;
+		}
+
+		if (stop) break;
+
+		/*
+		 *	Nothing to write.  Back off, but not for
+		 *	so long that lines sit in the rings for
+		 *	ages after a quiet period.
+		 */
+		delay = delay ? delay * 2 : 100000;
+		if (delay > LOG_ASYNC_MAX_SLEEP) delay = LOG_ASYNC_MAX_SLEEP;
+		nanosleep(&(struct timespec){ .tv_nsec = delay }, NULL);
+	}
+
+	return NULL;
+}
+
 /** Send a server log message to its destination
  *
  * @param[in] log	destination.
@@ -481,6 +727,11 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 				 	 colourise ? VTC_RESET : "");
 
 		len = talloc_array_length(buffer) - 1;
+		if (log->async) {
+			ret = log_async_push(log->async, buffer, len);
+			break;
+		}
+
 		wrote = write(log->fd, buffer, len);
 		if (wrote < len) ret = -1;
 	}
@@ -974,3 +1225,123 @@ int fr_log_init(fr_log_t *log, bool daemonize)
 
 	return 0;
 }
+
+/** Write log messages from a dedicated thread
+ *
+ * Threads calling #fr_vlog format the message as usual, then queue
+ * it on a ring private to that thread.  A writer thread collects
+ * the lines, and writes them out in batches.  Threads which log
+ * no longer block on the log file, or each other.
+ *
+ * Only applies to file descriptor destinations, i.e. files, stdout
+ * and stderr.  Lines from different threads may be written out of
+ * order relative to each other, but lines from one thread never are.
+ *
+ * @note Must be called before any other threads are started.
+ *
+ * @param[in] log	destination to write asynchronously.
+ * @param[in] size	Maximum number of lines each thread may have queued.
+ *			Rounded up to a power of 2.
+ * @param[in] block	If true, threads wait for space when their ring
+ *			is full.  If false, the line is dropped, and counted.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_log_async_start(fr_log_t *log, uint32_t size, bool block)
+{
+	fr_log_async_t *async;
+
+	if (log->async) return 0;
+
+	switch (log->dst) {
+	case L_DST_FILES:
+	case L_DST_STDOUT:
+	case L_DST_STDERR:
+		break;
+
+	default:
+		return 0;
+	}
+
+	if ((size < 2) || (size > (1 << 24))) {
+		fr_strerror_printf("Log queue size must be between 2 and %u", 1 << 24);
+		return -1;
+	}
+
+	size--;
+	size |= size >> 1;
+	size |= size >> 2;
+	size |= size >> 4;
+	size |= size >> 8;
+	size |= size >> 16;
+	size++;
+
+	async = calloc(1, sizeof(*async));
+	if (!async) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	async->log = log;
+	async->size = size;
+	async->block = block;
+	pthread_mutex_init(&async->mutex, NULL);
+
+	if (pthread_create(&async->thread, NULL, log_async_thread, async) != 0) {
+		fr_strerror_printf("Failed creating log thread: %s", fr_syserror(errno));
+		pthread_mutex_destroy(&async->mutex);
+		free(async);
+		return -1;
+	}
+	log->async = async;
+
+	return 0;
+}
+
+/** Write out any queued log messages, and stop the writer thread
+ *
+ * Subsequent messages are written synchronously.
+ *
+ * @note Must be called after all other threads which log have exited.
+ *
+ * @param[in] log	to stop writing asynchronously.
+ */
+void fr_log_async_stop(fr_log_t *log)
+{
+	fr_log_async_t	*async = log->async;
+	fr_log_ring_t	*ring, *next;
+	uint64_t	dropped;
+
+	if (!async) return;
+
+	atomic_store(&async->stop, true);
+	pthread_join(async->thread, NULL);
+	log->async = NULL;
+
+	/*
+	 *	Rings belonging to threads which are still
+	 *	running are freed when those threads exit.
+	 */
+	for (ring = async->rings; ring; ring = next) {
+		next = ring->next;
+
+		if (atomic_exchange(&ring->state, LOG_RING_ORPHANED) == LOG_RING_CLOSED) log_ring_free(ring);
+	}
+
+	dropped = atomic_load(&async->dropped);
+	pthread_mutex_destroy(&async->mutex);
+	free(async);
+
+	if (dropped) fr_log(log, L_WARN, __FILE__, __LINE__,
+			    "Dropped %" PRIu64 " log message(s) as the log queue was full", dropped);
+}
+
+/** Return how many messages have been dropped because a log queue was full
+ *
+ */
+uint64_t fr_log_async_dropped(fr_log_t const *log)
+{
+	if (!log->async) return 0;
+
+	return atomic_load(&log->async->dropped);
+}
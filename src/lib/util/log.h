@@ -90,6 +90,8 @@ typedef enum {
 	L_TIMESTAMP_OFF				//!< Never log timestamps.
 } fr_log_timestamp_t;
 
+typedef struct fr_log_async_s fr_log_async_t;
+
 typedef struct {
 	fr_log_dst_t		dst;		//!< Log destination.
 
@@ -110,6 +112,8 @@ typedef struct {
 	void			*cookie;	//!< for fopencookie()
 
 	ssize_t			(*cookie_write)(void *, char const *, size_t);	//!< write function
+
+	fr_log_async_t		*async;		//!< Writer thread, if messages are written asynchronously.
 } fr_log_t;
 
 typedef struct {
@@ -133,6 +137,12 @@ static inline bool fr_rate_limit_enabled(void)
 
 int	fr_log_init(fr_log_t *log, bool daemonize);
 
+int	fr_log_async_start(fr_log_t *log, uint32_t size, bool block);
+
+void	fr_log_async_stop(fr_log_t *log);
+
+uint64_t fr_log_async_dropped(fr_log_t const *log);
+
 TALLOC_CTX	*fr_log_pool_init(void);
 
 int	fr_vlog(fr_log_t const *log, fr_log_type_t lvl, char const *file, int line, char const *fmt, va_list ap)
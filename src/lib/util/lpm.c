@@ -0,0 +1,229 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Fixed stride IPv4 longest prefix match tables
+ *
+ * @file src/lib/util/lpm.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/lpm.h>
+#include <freeradius-devel/util/strerror.h>
+
+/*
+ *	A DIR-16-8-8 table.  The first table is indexed by the top 16
+ *	bits of the address, and each of the tables below it by the
+ *	next 8 bits.  A lookup is at most three array reads, no matter
+ *	how many prefixes there are.
+ *
+ *	Each entry is either an index into the array of values, or
+ *	the index of a table for the next 8 bits.  Prefixes are
+ *	expanded to cover every entry they match, and each entry
+ *	remembers the length of the prefix it came from, so a longer
+ *	prefix always wins over a shorter one, whatever order they
+ *	were inserted in.
+ *
+ *	The first table is 320KB.  Each prefix longer than /16 adds
+ *	up to two tables of 1.25KB.
+ */
+#define LPM_TABLE_FLAG		(0x80000000)
+#define LPM_LEVELS		(3)
+
+typedef struct {
+	uint32_t		*entry;		//!< value index, or table index | LPM_TABLE_FLAG.  0 is empty.
+	uint8_t			*len;		//!< prefix length which set the entry.
+} fr_lpm_table_t;
+
+struct fr_lpm_s {
+	fr_lpm_table_t		*table;		//!< table[0] is the first level.
+	uint32_t		num_tables;
+
+	void			**value;	//!< value[0] is unused.
+	uint32_t		num_values;
+};
+
+static int const lpm_bits[LPM_LEVELS] = { 16, 8, 8 };
+static int const lpm_start[LPM_LEVELS] = { 0, 16, 24 };
+
+static int lpm_table_alloc(fr_lpm_t *lpm, int level, uint32_t fill, uint8_t len)
+{
+	fr_lpm_table_t	*table;
+	uint32_t	i, size = ((uint32_t) 1) << lpm_bits[level];
+
+	if ((lpm->num_tables & (lpm->num_tables - 1)) == 0) {
+		table = talloc_realloc(lpm, lpm->table, fr_lpm_table_t, lpm->num_tables ? lpm->num_tables * 2 : 1);
+		if (!table) return -1;
+		lpm->table = table;
+	}
+
+	table = &lpm->table[lpm->num_tables];
+	table->entry = talloc_array(lpm, uint32_t, size);
+	table->len = talloc_array(lpm, uint8_t, size);
+	if (!table->entry || !table->len) {
+		talloc_free(table->entry);
+		talloc_free(table->len);
+		return -1;
+	}
+
+	for (i = 0; i < size; i++) table->entry[i] = fill;
+	memset(table->len, len, size);
+
+	return lpm->num_tables++;
+}
+
+static void lpm_set(fr_lpm_t *lpm, int level, uint32_t t, uint32_t i, uint8_t len, uint32_t value)
+{
+	fr_lpm_table_t	*table = &lpm->table[t];
+
+	if (table->entry[i] & LPM_TABLE_FLAG) {
+		uint32_t j, size = ((uint32_t) 1) << lpm_bits[level + 1];
+
+		for (j = 0; j < size; j++) lpm_set(lpm, level + 1, table->entry[i] & ~LPM_TABLE_FLAG, j, len, value);
+		return;
+	}
+
+	if (table->len[i] > len) return;
+
+	table->entry[i] = value;
+	table->len[i] = len;
+}
+
+/** Allocate a new longest prefix match table
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @return
+ *	- NULL on error.
+ *	- The new table.
+ */
+fr_lpm_t *fr_lpm_alloc(TALLOC_CTX *ctx)
+{
+	fr_lpm_t *lpm;
+
+	lpm = talloc_zero(ctx, fr_lpm_t);
+	if (!lpm) return NULL;
+
+	if (lpm_table_alloc(lpm, 0, 0, 0) < 0) {
+		talloc_free(lpm);
+		return NULL;
+	}
+
+	return lpm;
+}
+
+/** Insert a prefix into the table
+ *
+ * The data for a prefix which is already in the table is replaced.
+ *
+ * @param[in] lpm	to insert into.
+ * @param[in] ipaddr	IPv4 prefix to insert.
+ * @param[in] data	to return for addresses which match the prefix.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_lpm_insert(fr_lpm_t *lpm, fr_ipaddr_t const *ipaddr, void const *data)
+{
+	uint32_t	addr, value, t = 0;
+	uint8_t		len = ipaddr->prefix;
+	int		level;
+	void		**values;
+
+	if ((ipaddr->af != AF_INET) || (len > 32)) {
+		fr_strerror_const("Only IPv4 prefixes can be inserted");
+		return -1;
+	}
+
+	if (lpm->num_values == (LPM_TABLE_FLAG - 1)) {
+		fr_strerror_const("Too many prefixes");
+		return -1;
+	}
+
+	values = talloc_realloc(lpm, lpm->value, void *, lpm->num_values + 2);
+	if (!values) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	lpm->value = values;
+	value = ++lpm->num_values;
+	memcpy(&lpm->value[value], &data, sizeof(lpm->value[value]));
+
+	addr = ntohl(ipaddr->addr.v4.s_addr);
+	if (len < 32) addr &= ~(((uint32_t) 0xffffffff) >> len);
+
+	for (level = 0; level < LPM_LEVELS; level++) {
+		int		end = lpm_start[level] + lpm_bits[level];
+		uint32_t	i = (addr >> (32 - end)) & ((((uint32_t) 1) << lpm_bits[level]) - 1);
+		int		next;
+
+		/*
+		 *	The prefix ends in this table.  Set all of
+		 *	the entries it covers.
+		 */
+		if (len <= end) {
+			uint32_t j, span = ((uint32_t) 1) << (end - len);
+
+			for (j = 0; j < span; j++) lpm_set(lpm, level, t, i + j, len, value);
+			return 0;
+		}
+
+		if (lpm->table[t].entry[i] & LPM_TABLE_FLAG) {
+			t = lpm->table[t].entry[i] & ~LPM_TABLE_FLAG;
+			continue;
+		}
+
+		/*
+		 *	Push the shorter prefix which covers this
+		 *	entry down into the new table.
+		 */
+		next = lpm_table_alloc(lpm, level + 1, lpm->table[t].entry[i], lpm->table[t].len[i]);
+		if (next < 0) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+
+		lpm->table[t].entry[i] = ((uint32_t) next) | LPM_TABLE_FLAG;
+		t = next;
+	}
+
+	return 0;
+}
+
+/** Find the data for the longest prefix which matches an address
+ *
+ * @param[in] lpm	to search.
+ * @param[in] ipaddr	IPv4 address to look up.
+ * @return
+ *	- NULL if no prefix matches.
+ *	- the data for the longest matching prefix.
+ */
+void *fr_lpm_lookup(fr_lpm_t const *lpm, fr_ipaddr_t const *ipaddr)
+{
+	uint32_t addr, entry;
+
+	if (ipaddr->af != AF_INET) return NULL;
+
+	addr = ntohl(ipaddr->addr.v4.s_addr);
+
+	entry = lpm->table[0].entry[addr >> 16];
+	if (entry & LPM_TABLE_FLAG) {
+		entry = lpm->table[entry & ~LPM_TABLE_FLAG].entry[(addr >> 8) & 0xff];
+		if (entry & LPM_TABLE_FLAG) entry = lpm->table[entry & ~LPM_TABLE_FLAG].entry[addr & 0xff];
+	}
+
+	return lpm->value[entry];
+}
@@ -0,0 +1,47 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for fixed stride IPv4 longest prefix match tables
+ *
+ * @file src/lib/util/lpm.h
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(lpm_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/inet.h>
+
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_lpm_s fr_lpm_t;
+
+fr_lpm_t	*fr_lpm_alloc(TALLOC_CTX *ctx);
+
+int		fr_lpm_insert(fr_lpm_t *lpm, fr_ipaddr_t const *ipaddr, void const *data) CC_HINT(nonnull);
+
+void		*fr_lpm_lookup(fr_lpm_t const *lpm, fr_ipaddr_t const *ipaddr) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -251,6 +251,13 @@ static void fr_md5_local_transform(uint32_t state[static 4], uint8_t const block
 {
 	uint32_t a, b, c, d, in[MD5_BLOCK_LENGTH / 4];
 
+	/*
+	 *	MD5 words are little endian, so on little endian
+	 *	systems the block can be copied as-is.
+	 */
+#ifndef WORDS_BIGENDIAN
+	memcpy(in, block, sizeof(in));
+#else
 	for (a = 0; a < MD5_BLOCK_LENGTH / 4; a++) {
 		in[a] = (uint32_t)(
 		    (uint32_t)(block[a * 4 + 0]) |
@@ -258,6 +265,7 @@ static void fr_md5_local_transform(uint32_t state[static 4], uint8_t const block
 		    (uint32_t)(block[a * 4 + 2]) << 16 |
 		    (uint32_t)(block[a * 4 + 3]) << 24);
 	}
+#endif
 
 	a = state[0];
 	b = state[1];
@@ -0,0 +1,278 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables
+ *
+ * @file src/lib/util/oahash.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/oahash.h>
+#include <freeradius-devel/util/debug.h>
+
+/*
+ *	The table is a flat array of slots, using linear probing
+ *	with "robin hood" insertion.  An element which is close to
+ *	its home slot gives way to one which is further away, so
+ *	probe sequences stay short even at high load.
+ *
+ *	Each slot holds the full hash of its element, so most
+ *	mismatches are rejected without calling the comparison
+ *	function, or touching the element itself.
+ *
+ *	Deletion shifts the following elements back by one slot,
+ *	so there are no tombstones, and lookups never degrade as
+ *	elements come and go.
+ */
+typedef struct {
+	void		*data;			//!< the element, NULL if the slot is empty.
+	uint32_t	hash;			//!< full hash of the element.
+	uint32_t	dist;			//!< distance from the home slot, plus one.  0 if empty.
+} fr_oahash_slot_t;
+
+struct fr_oahash_s {
+	uint32_t		mask;		//!< number of slots - 1.  Always a power of 2.
+	uint32_t		num_elements;	//!< number of elements in the table.
+	uint32_t		max_elements;	//!< grow the table when we reach this.
+
+	fr_oahash_hash_t	hash;		//!< hash an element.
+	fr_oahash_cmp_t		cmp;		//!< compare two elements.
+
+	fr_oahash_slot_t	*slots;		//!< the slots.
+};
+
+#define OAHASH_MIN_SIZE (16)
+
+/*
+ *	Grow when the table is 7/8 full.  Robin hood probing keeps
+ *	the average probe length small even at that load.
+ */
+#define OAHASH_MAX_ELEMENTS(_size) ((_size) - ((_size) >> 3))
+
+/** Allocate a new open addressing hash table
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] hash	function to hash elements.
+ * @param[in] cmp	function to compare elements.
+ * @param[in] size	initial number of slots.  Rounded up to a power of 2.
+ * @return
+ *	- NULL on error.
+ *	- The new table.
+ */
+fr_oahash_t *fr_oahash_alloc(TALLOC_CTX *ctx, fr_oahash_hash_t hash, fr_oahash_cmp_t cmp, uint32_t size)
+{
+	fr_oahash_t *oh;
+
+	if (!hash || !cmp) return NULL;
+
+	if (size < OAHASH_MIN_SIZE) size = OAHASH_MIN_SIZE;
+	if (size > (1 << 30)) return NULL;
+
+	size--;
+	size |= size >> 1;
+	size |= size >> 2;
+	size |= size >> 4;
+	size |= size >> 8;
+	size |= size >> 16;
+	size++;
+
+	oh = talloc_zero(ctx, fr_oahash_t);
+	if (!oh) return NULL;
+
+	oh->slots = talloc_zero_array(oh, fr_oahash_slot_t, size);
+	if (!oh->slots) {
+		talloc_free(oh);
+		return NULL;
+	}
+
+	oh->mask = size - 1;
+	oh->max_elements = OAHASH_MAX_ELEMENTS(size);
+	oh->hash = hash;
+	oh->cmp = cmp;
+
+	return oh;
+}
+
+/** Put an element into the table, without checking for duplicates
+ *
+ */
+static inline CC_HINT(always_inline) void oahash_place(fr_oahash_slot_t *slots, uint32_t mask, fr_oahash_slot_t entry)
+{
+	uint32_t i;
+
+	entry.dist = 1;
+
+	for (i = entry.hash & mask; ; i = (i + 1) & mask) {
+		fr_oahash_slot_t tmp;
+
+		if (!slots[i].dist) {
+			slots[i] = entry;
+			return;
+		}
+
+		/*
+		 *	Take from the rich, and give to the poor.
+		 */
+		if (slots[i].dist < entry.dist) {
+			tmp = slots[i];
+			slots[i] = entry;
+			entry = tmp;
+		}
+
+		entry.dist++;
+	}
+}
+
+static int oahash_grow(fr_oahash_t *oh)
+{
+	fr_oahash_slot_t	*slots;
+	uint32_t		i, size, mask;
+
+	size = (oh->mask + 1) * 2;
+	if (size > (1 << 30)) return -1;
+
+	slots = talloc_zero_array(oh, fr_oahash_slot_t, size);
+	if (!slots) return -1;
+
+	mask = size - 1;
+	for (i = 0; i <= oh->mask; i++) {
+		if (!oh->slots[i].dist) continue;
+
+		oahash_place(slots, mask, oh->slots[i]);
+	}
+
+	talloc_free(oh->slots);
+	oh->slots = slots;
+	oh->mask = mask;
+	oh->max_elements = OAHASH_MAX_ELEMENTS(size);
+
+	return 0;
+}
+
+/** Find the slot which contains a matching element
+ *
+ * @return
+ *	- -1 if there is no matching element.
+ *	- the index of the slot.
+ */
+static int64_t oahash_slot_find(fr_oahash_t const *oh, void const *data)
+{
+	uint32_t hash, i, dist;
+
+	hash = oh->hash(data);
+
+	for (i = hash & oh->mask, dist = 1; ; i = (i + 1) & oh->mask, dist++) {
+		fr_oahash_slot_t const *slot = &oh->slots[i];
+
+		/*
+		 *	If we've gone further than the element in
+		 *	this slot did, then the element we're looking
+		 *	for would have displaced it.  It's not here.
+		 */
+		if (slot->dist < dist) return -1;
+
+		if ((slot->hash == hash) && (oh->cmp(data, slot->data) == 0)) return i;
+	}
+}
+
+/** Find an element in the table
+ *
+ * @param[in] oh	to search in.
+ * @param[in] data	to compare against.
+ * @return
+ *	- NULL if no matching element was found.
+ *	- the matching element.
+ */
+void *fr_oahash_find(fr_oahash_t const *oh, void const *data)
+{
+	int64_t i;
+
+	i = oahash_slot_find(oh, data);
+	if (i < 0) return NULL;
+
+	return oh->slots[i].data;
+}
+
+/** Insert an element into the table
+ *
+ * @param[in] oh	to insert into.
+ * @param[in] data	to insert.
+ * @return
+ *	- true on success.
+ *	- false if a matching element already exists, or we ran out of memory.
+ */
+bool fr_oahash_insert(fr_oahash_t *oh, void const *data)
+{
+	fr_oahash_slot_t entry;
+
+	if (oahash_slot_find(oh, data) >= 0) return false;
+
+	if ((oh->num_elements >= oh->max_elements) && (oahash_grow(oh) < 0)) return false;
+
+	memcpy(&entry.data, &data, sizeof(entry.data));
+	entry.hash = oh->hash(data);
+
+	oahash_place(oh->slots, oh->mask, entry);
+	oh->num_elements++;
+
+	return true;
+}
+
+/** Remove an element from the table
+ *
+ * @param[in] oh	to remove from.
+ * @param[in] data	to compare against.
+ * @return
+ *	- NULL if no matching element was found.
+ *	- the element which was removed.
+ */
+void *fr_oahash_remove(fr_oahash_t *oh, void const *data)
+{
+	int64_t		found;
+	uint32_t	i, j;
+	void		*old;
+
+	found = oahash_slot_find(oh, data);
+	if (found < 0) return NULL;
+
+	i = (uint32_t) found;
+	old = oh->slots[i].data;
+
+	/*
+	 *	Shift the following elements back by one, until we
+	 *	find an empty slot, or an element which is already
+	 *	in its home slot.
+	 */
+	for (j = (i + 1) & oh->mask; oh->slots[j].dist > 1; i = j, j = (j + 1) & oh->mask) {
+		oh->slots[i] = oh->slots[j];
+		oh->slots[i].dist--;
+	}
+
+	oh->slots[i] = (fr_oahash_slot_t) { .data = NULL };
+	oh->num_elements--;
+
+	return old;
+}
+
+/** Return the number of elements in the table
+ *
+ */
+uint32_t fr_oahash_num_elements(fr_oahash_t const *oh)
+{
+	return oh->num_elements;
+}
@@ -0,0 +1,65 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for open addressing hash tables
+ *
+ * @file src/lib/util/oahash.h
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(oahash_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_oahash_s fr_oahash_t;
+
+/** Return the hash of an element
+ *
+ * Elements which compare equal MUST have the same hash.
+ */
+typedef uint32_t (*fr_oahash_hash_t)(void const *data);
+
+/** Compare two elements
+ *
+ * @return
+ *	- 0 if the two elements are identical.
+ *	- !0 otherwise.
+ */
+typedef int (*fr_oahash_cmp_t)(void const *one, void const *two);
+
+fr_oahash_t	*fr_oahash_alloc(TALLOC_CTX *ctx, fr_oahash_hash_t hash, fr_oahash_cmp_t cmp, uint32_t size);
+
+void		*fr_oahash_find(fr_oahash_t const *oh, void const *data) CC_HINT(nonnull);
+
+bool		fr_oahash_insert(fr_oahash_t *oh, void const *data) CC_HINT(nonnull);
+
+void		*fr_oahash_remove(fr_oahash_t *oh, void const *data) CC_HINT(nonnull);
+
+uint32_t	fr_oahash_num_elements(fr_oahash_t const *oh) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,190 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/rbtree.h>
+#include <freeradius-devel/util/time.h>
+
+#include "oahash.c"
+
+typedef struct {
+	uint8_t		code;
+	uint8_t		id;
+	uint16_t	port;
+} oahash_thing;
+
+static uint32_t thing_hash(void const *data)
+{
+	oahash_thing const *a = data;
+
+	return fr_hash(a, sizeof(*a));
+}
+
+static int thing_cmp(void const *one, void const *two)
+{
+	oahash_thing const *a = one, *b = two;
+
+	if (a->code != b->code) return (a->code > b->code) - (a->code < b->code);
+	if (a->id != b->id) return (a->id > b->id) - (a->id < b->id);
+
+	return (a->port > b->port) - (a->port < b->port);
+}
+
+#define OAHASH_TEST_SIZE (65536)
+
+static void oahash_test(void)
+{
+	fr_oahash_t	*oh;
+	oahash_thing	*array;
+	uint32_t	i;
+
+	oh = fr_oahash_alloc(NULL, thing_hash, thing_cmp, 0);
+	TEST_CHECK(oh != NULL);
+
+	array = calloc(OAHASH_TEST_SIZE, sizeof(oahash_thing));
+	for (i = 0; i < OAHASH_TEST_SIZE; i++) {
+		array[i].code = i & 0x03;
+		array[i].id = (i >> 2) & 0xff;
+		array[i].port = i >> 10;
+	}
+
+	TEST_CASE("insertions");
+	for (i = 0; i < OAHASH_TEST_SIZE; i++) {
+		TEST_CHECK(fr_oahash_insert(oh, &array[i]));
+		TEST_MSG("insert of element %u failed", i);
+	}
+	TEST_CHECK(fr_oahash_num_elements(oh) == OAHASH_TEST_SIZE);
+
+	TEST_CASE("duplicates");
+	for (i = 0; i < OAHASH_TEST_SIZE; i += 7) {
+		oahash_thing dup = array[i];
+
+		TEST_CHECK(!fr_oahash_insert(oh, &dup));
+		TEST_MSG("duplicate of element %u was inserted", i);
+
+		TEST_CHECK(fr_oahash_find(oh, &dup) == &array[i]);
+		TEST_MSG("element %u was not found", i);
+	}
+
+	TEST_CASE("deletions");
+	for (i = 0; i < OAHASH_TEST_SIZE; i += 2) {
+		TEST_CHECK(fr_oahash_remove(oh, &array[i]) == &array[i]);
+		TEST_MSG("removal of element %u failed", i);
+	}
+	TEST_CHECK(fr_oahash_num_elements(oh) == OAHASH_TEST_SIZE / 2);
+
+	/*
+	 *	Everything left over must still be reachable, i.e.
+	 *	the backward shift didn't break any probe sequences.
+	 */
+	for (i = 0; i < OAHASH_TEST_SIZE; i++) {
+		void *found = fr_oahash_find(oh, &array[i]);
+
+		if (i & 0x01) {
+			TEST_CHECK(found == &array[i]);
+		} else {
+			TEST_CHECK(found == NULL);
+		}
+		TEST_MSG("element %u in wrong state after deletions", i);
+	}
+
+	for (i = 1; i < OAHASH_TEST_SIZE; i += 2) {
+		TEST_CHECK(fr_oahash_remove(oh, &array[i]) == &array[i]);
+	}
+	TEST_CHECK(fr_oahash_num_elements(oh) == 0);
+	TEST_CHECK(fr_oahash_remove(oh, &array[0]) == NULL);
+
+	talloc_free(oh);
+	free(array);
+}
+
+/*
+ *	Simulate the dedup table: a window of outstanding packets
+ *	which is constantly inserted into, and deleted from.
+ *	Compare the open addressing table against an rbtree.
+ */
+#define OAHASH_CHURN_WINDOW	(4096)
+#define OAHASH_CHURN_LOOPS	(4000000)
+
+static void oahash_churn(void)
+{
+	fr_oahash_t	*oh;
+	rbtree_t	*tree;
+	oahash_thing	*array;
+	uint32_t	i;
+	fr_time_t	start, oahash_time, rbtree_time;
+
+	fr_time_start();
+
+	oh = fr_oahash_alloc(NULL, thing_hash, thing_cmp, 0);
+	TEST_CHECK(oh != NULL);
+
+	tree = rbtree_alloc(NULL, thing_cmp, NULL, RBTREE_FLAG_NONE);
+	TEST_CHECK(tree != NULL);
+
+	array = calloc(OAHASH_TEST_SIZE, sizeof(oahash_thing));
+	for (i = 0; i < OAHASH_TEST_SIZE; i++) {
+		array[i].code = fr_rand() & 0x03;
+		array[i].id = i & 0xff;
+		array[i].port = i >> 8;
+	}
+
+	start = fr_time();
+	for (i = 0; i < OAHASH_CHURN_LOOPS; i++) {
+		oahash_thing *in = &array[i & (OAHASH_TEST_SIZE - 1)];
+
+		if (i >= OAHASH_CHURN_WINDOW) {
+			oahash_thing *out = &array[(i - OAHASH_CHURN_WINDOW) & (OAHASH_TEST_SIZE - 1)];
+
+			if (!fr_oahash_remove(oh, out)) {
+				TEST_CHECK(0);
+				break;
+			}
+		}
+
+		if (!fr_oahash_find(oh, in) && !fr_oahash_insert(oh, in)) {
+			TEST_CHECK(0);
+			break;
+		}
+	}
+	oahash_time = fr_time() - start;
+	TEST_CHECK(fr_oahash_num_elements(oh) == OAHASH_CHURN_WINDOW);
+
+	start = fr_time();
+	for (i = 0; i < OAHASH_CHURN_LOOPS; i++) {
+		oahash_thing *in = &array[i & (OAHASH_TEST_SIZE - 1)];
+
+		if (i >= OAHASH_CHURN_WINDOW) {
+			oahash_thing *out = &array[(i - OAHASH_CHURN_WINDOW) & (OAHASH_TEST_SIZE - 1)];
+
+			if (!rbtree_deletebydata(tree, out)) {
+				TEST_CHECK(0);
+				break;
+			}
+		}
+
+		if (!rbtree_finddata(tree, in) && !rbtree_insert(tree, in)) {
+			TEST_CHECK(0);
+			break;
+		}
+	}
+	rbtree_time = fr_time() - start;
+	TEST_CHECK(rbtree_num_elements(tree) == OAHASH_CHURN_WINDOW);
+
+	TEST_MSG("oahash %.3fs, rbtree %.3fs",
+		 (double) oahash_time / NSEC, (double) rbtree_time / NSEC);
+	printf("\noahash %.3fs, rbtree %.3fs\n",
+	       (double) oahash_time / NSEC, (double) rbtree_time / NSEC);
+
+	talloc_free(oh);
+	talloc_free(tree);
+	free(array);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "oahash_test",		oahash_test		},
+	{ "oahash_churn",		oahash_churn		},
+	{ NULL }
+};
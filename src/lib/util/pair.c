@@ -29,7 +29,9 @@ RCSID("$Id$")
 #include <freeradius-devel/util/print.h>
 #include <freeradius-devel/util/proto.h>
 #include <freeradius-devel/util/regex.h>
+#include <freeradius-devel/util/slab.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/thread_local.h>
 
 #include <ctype.h>
 
@@ -70,6 +72,68 @@ static int _fr_pair_free(fr_pair_t *vp)
 	return 0;
 }
 
+/*
+ *	Pairs are allocated and freed constantly, and having per-thread
+ *	slab means we can reuse the memory of freed pairs without going
+ *	back to malloc.  Threads which process requests set this up with
+ *	fr_pair_slab_init().  Other threads allocate pairs as normal.
+ */
+static _Thread_local fr_slab_t *fr_pair_slab;
+
+#define FR_PAIR_SLAB_MAX_FREE (4096)
+
+/*
+ *	Most string and octets values are short (User-Name,
+ *	Called-Station-Id, etc.), and their buffers are allocated in
+ *	the pair.  Pairs from the slab have room for one such buffer,
+ *	so it's carved out of the same chunk as the pair, instead of
+ *	being a separate malloc.
+ */
+#define FR_PAIR_SLAB_VALUE_SIZE (32)
+
+/** Free a fr_pair_t which came from a slab, or put it back in the slab
+ *
+ */
+static int _fr_pair_slab_free(fr_pair_t *vp)
+{
+	(void) _fr_pair_free(vp);
+
+	if (fr_pair_slab && fr_slab_release(fr_pair_slab, vp)) return -1;
+
+	return 0;
+}
+
+/** Free any pairs in the slab when the thread exits
+ *
+ */
+static void _fr_pair_slab_free_on_exit(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Set up the pair slab for this thread
+ *
+ * @param[in] max_free	the number of freed pairs to keep for reuse.
+ *			If 0, the default is used.
+ * @return
+ *	- The statistics for this threads pair slab.
+ *	- NULL on error.
+ */
+fr_slab_stats_t const *fr_pair_slab_init(uint32_t max_free)
+{
+	fr_slab_t *slab;
+
+	if (fr_pair_slab) return fr_slab_stats(fr_pair_slab);
+
+	slab = fr_slab_talloc_pooled_alloc(NULL, fr_pair_t, max_free ? max_free : FR_PAIR_SLAB_MAX_FREE,
+					   1, FR_PAIR_SLAB_VALUE_SIZE);
+	if (!slab) return NULL;
+
+	fr_thread_local_set_destructor(fr_pair_slab, _fr_pair_slab_free_on_exit, slab);
+
+	return fr_slab_stats(slab);
+}
+
 /** Allocate a new pair list on the heap
  *
  * @param[in] ctx	to allocate the pair list in.
@@ -106,7 +170,7 @@ fr_pair_t *fr_pair_alloc_null(TALLOC_CTX *ctx)
 {
 	fr_pair_t *vp;
 
-	vp = talloc_zero(ctx, fr_pair_t);
+	vp = fr_pair_slab ? fr_slab_reserve(fr_pair_slab, ctx) : talloc_zero(ctx, fr_pair_t);
 	if (!vp) {
 		fr_strerror_const("Out of memory");
 		return NULL;
@@ -115,7 +179,7 @@ fr_pair_t *fr_pair_alloc_null(TALLOC_CTX *ctx)
 	vp->op = T_OP_EQ;
 	vp->type = VT_NONE;
 
-	talloc_set_destructor(vp, _fr_pair_free);
+	talloc_set_destructor(vp, fr_pair_slab ? _fr_pair_slab_free : _fr_pair_free);
 
 	return vp;
 }
@@ -143,12 +207,16 @@ fr_pair_t *fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 
 	/*
 	 *	If we get passed an unknown da, we need to ensure that
-	 *	it's parented by "vp".
+	 *	it's parented by "vp", or is shared.
 	 */
 	if (da->flags.is_unknown) {
 		fr_dict_attr_t const *unknown;
 
-		unknown = fr_dict_unknown_afrom_da(vp, da);
+		unknown = fr_dict_unknown_acopy(vp, da);
+		if (!unknown) {
+			talloc_free(vp);
+			return NULL;
+		}
 		da = unknown;
 	}
 
@@ -230,15 +298,9 @@ fr_pair_t *fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp)
 	n->type = vp->type;
 
 	/*
-	 *	Copy the unknown attribute hierarchy
+	 *	fr_pair_afrom_da() has already copied (or shared) the
+	 *	unknown attribute hierarchy.
 	 */
-	if (n->da->flags.is_unknown) {
-		n->da = fr_dict_unknown_afrom_da(n, n->da);
-		if (!n->da) {
-			talloc_free(n);
-			return NULL;
-		}
-	}
 
 
 	/*
@@ -288,12 +350,14 @@ void fr_pair_steal(TALLOC_CTX *ctx, fr_pair_t *vp)
 	 *
 	 *	Since we have no introspection into OTHER VPs using
 	 *	the same DA, we can't have multiple VPs use the same
-	 *	DA.  So we might as well tie it to this VP.
+	 *	DA.  So we might as well tie it to this VP.  The
+	 *	exception is shared DAs from the unknown attribute
+	 *	cache, which are never freed.
 	 */
-	if (vp->da->flags.is_unknown) {
-		fr_dict_attr_t *da;
+	if (vp->da->flags.is_unknown && !vp->da->flags.is_cached) {
+		fr_dict_attr_t const *da;
 
-		da = fr_dict_unknown_afrom_da(vp, vp->da);
+		da = fr_dict_unknown_acopy(vp, vp->da);
 
 		fr_dict_unknown_free(&vp->da);
 
@@ -408,6 +472,14 @@ void *fr_pair_iter_next_by_ancestor(void **prev, void *to_eval, void *uctx)
 }
 
 /** Find the pair with the matching DAs
+ *
+ * @note This is a linear search, and there is deliberately no index.
+ *	A list is just a pointer to its first pair, and pairs are
+ *	linked, unlinked and re-ordered through their "next" pointers
+ *	all over the server.  There is nowhere to hang an index, and
+ *	no single place where it could be invalidated.  The search
+ *	touches only "da" and "next", which share a cache line, so
+ *	even a 100 attribute list is scanned quickly.
  *
  * @hidecallergraph
  */
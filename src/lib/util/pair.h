@@ -26,6 +26,7 @@ RCSIDH(pair_h, "$Id$")
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/cursor.h>
+#include <freeradius-devel/util/slab.h>
 #include <freeradius-devel/util/value.h>
 #include <freeradius-devel/util/token.h>
 
@@ -72,6 +73,13 @@ typedef enum value_type {
 
 typedef struct value_pair_s fr_pair_t;
 
+/*
+ *	The list is still a pointer to the first pair, with the pairs
+ *	linked through "next".  USE_DOUBLE_LIST is the future layout,
+ *	and doesn't build yet.  Until the switch, don't append to long
+ *	lists with fr_pair_add() in a loop, as it walks the whole list
+ *	each time.  Use a cursor instead, which remembers the tail.
+ */
 #ifdef USE_DOUBLE_LIST
 typedef struct {
         fr_dlist_head_t head;
@@ -185,6 +193,8 @@ void		fr_pair_list_verify(char const *file, int line, TALLOC_CTX const *expected
 #define	fr_pair_list_single_value(_list, _vp) (_list = &_vp)
 
 /* Allocation and management */
+fr_slab_stats_t const *fr_pair_slab_init(uint32_t max_free);
+
 fr_pair_t	*fr_pair_alloc_null(TALLOC_CTX *ctx);
 
 fr_pair_list_t	*fr_pair_list_alloc(TALLOC_CTX *ctx);
@@ -22,6 +22,7 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/pair.h>
 #include <freeradius-devel/util/pair_legacy.h>
@@ -637,6 +638,53 @@ int fr_pair_list_afrom_file(TALLOC_CTX *ctx, fr_dict_t const *dict, fr_pair_list
 }
 
 
+/*
+ *	Below this many attributes in the "to" list, scanning it is
+ *	cheaper than building an index.
+ */
+#define PAIR_LIST_MOVE_INDEX_MIN	(8)
+
+static uint32_t pair_da_hash(void const *data)
+{
+	fr_pair_t const *vp = data;
+
+	return fr_hash(&vp->da, sizeof(vp->da));
+}
+
+static int pair_da_cmp(void const *one, void const *two)
+{
+	fr_pair_t const *a = one, *b = two;
+
+	return (a->da > b->da) - (a->da < b->da);
+}
+
+/** Index the first pair with each da in a list
+ *
+ * @return
+ *	- The index.
+ *	- NULL if the list is too short to be worth indexing.
+ */
+static fr_hash_table_t *pair_list_index_first(fr_pair_list_t const *list)
+{
+	fr_hash_table_t	*ht;
+	fr_pair_t	*vp;
+	int		count = 0;
+
+	for (vp = *list; vp && (count < PAIR_LIST_MOVE_INDEX_MIN); vp = vp->next) count++;
+	if (count < PAIR_LIST_MOVE_INDEX_MIN) return NULL;
+
+	ht = fr_hash_table_create(NULL, pair_da_hash, pair_da_cmp, NULL);
+	if (!ht) return NULL;
+
+	/*
+	 *	Inserting a duplicate fails, which leaves the
+	 *	first pair with that da in the index.
+	 */
+	for (vp = *list; vp; vp = vp->next) (void) fr_hash_table_insert(ht, vp);
+
+	return ht;
+}
+
 /** Move pairs from source list to destination list respecting operator
  *
  * @note This function does some additional magic that's probably not needed
@@ -655,9 +703,18 @@ void fr_pair_list_move(fr_pair_list_t *to, fr_pair_list_t *from)
 	fr_pair_t *i, *found;
 	fr_pair_t *head_new, **tail_new;
 	fr_pair_t **tail_from;
+	fr_hash_table_t *index = NULL;
 
 	if (!to || !from || !*from) return;
 
+	/*
+	 *	Lookups only ever want the first pair with a given
+	 *	da.  That pair is edited in place, and never removed,
+	 *	so for larger lists we can find it with an index,
+	 *	instead of scanning the list each time.
+	 */
+	if ((*from)->next) index = pair_list_index_first(to);
+
 	/*
 	 *	We're editing the "to" list while we're adding new
 	 *	attributes to it.  We don't want the new attributes to
@@ -706,7 +763,7 @@ void fr_pair_list_move(fr_pair_list_t *to, fr_pair_list_t *from)
 		 *	it doesn't already exist.
 		 */
 		case T_OP_EQ:
-			found = fr_pair_find_by_da(to, i->da);
+			found = index ? fr_hash_table_find_by_data(index, i) : fr_pair_find_by_da(to, i->da);
 			if (!found) goto do_add;
 
 			tail_from = &(i->next);
@@ -717,7 +774,7 @@ void fr_pair_list_move(fr_pair_list_t *to, fr_pair_list_t *from)
 		 *	of the same vendor/attr which already exists.
 		 */
 		case T_OP_SET:
-			found = fr_pair_find_by_da(to, i->da);
+			found = index ? fr_hash_table_find_by_data(index, i) : fr_pair_find_by_da(to, i->da);
 			if (!found) goto do_add;
 
 			switch (found->vp_type) {
@@ -767,6 +824,8 @@ void fr_pair_list_move(fr_pair_list_t *to, fr_pair_list_t *from)
 		}
 	} /* loop over the "from" list. */
 
+	talloc_free(index);
+
 	/*
 	 *	Take the "new" list, and append it to the "to" list.
 	 */
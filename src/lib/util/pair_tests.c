@@ -44,6 +44,7 @@ static void pair_tests_init(void);
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/pair_legacy.h>
 #include <freeradius-devel/util/talloc.h>
 
 #include <freeradius-devel/radius/radius.h>
@@ -293,6 +294,40 @@ static void test_fr_pair_to_unknown(void)
 	TEST_CHECK(vp && vp->da->flags.is_unknown == true);
 }
 
+static void test_fr_dict_unknown_cache(void)
+{
+	fr_dict_attr_t	*unknown;
+	fr_pair_t	*vp1, *vp2, *copy;
+
+	TEST_CASE("Set up the unknown attribute cache with fr_dict_unknown_cache_init()");
+	TEST_CHECK(fr_dict_unknown_cache_init(0) == 0);
+
+	TEST_CASE("Allocate an unknown attribute");
+	TEST_CHECK((unknown = fr_dict_unknown_attr_afrom_num(autofree, fr_dict_root(dict_test), 250)) != NULL);
+
+	TEST_CASE("Allocate two pairs from the same unknown attribute");
+	TEST_CHECK((vp1 = fr_pair_afrom_da(autofree, unknown)) != NULL);
+	TEST_CHECK((vp2 = fr_pair_afrom_da(autofree, unknown)) != NULL);
+
+	TEST_CASE("Checking the pairs share one cached definition");
+	TEST_CHECK(vp1 && vp2 && (vp1->da == vp2->da));
+	TEST_CHECK(vp1 && vp1->da->flags.is_unknown && vp1->da->flags.is_cached);
+	TEST_CHECK(vp1 && (vp1->da != unknown));
+
+	TEST_CASE("Checking fr_pair_copy() doesn't copy the cached definition");
+	TEST_CHECK((copy = fr_pair_copy(autofree, vp1)) != NULL);
+	TEST_CHECK(copy && vp1 && (copy->da == vp1->da));
+
+	TEST_CASE("Freeing the original unknown attribute leaves the pairs usable");
+	talloc_free(unknown);
+	VP_VERIFY(vp1);
+	VP_VERIFY(copy);
+
+	talloc_free(vp1);
+	talloc_free(vp2);
+	talloc_free(copy);
+}
+
 static void test_fr_cursor_iter_by_da_init(void)
 {
 	fr_pair_t   *vp, *needle;
@@ -548,6 +583,63 @@ static void test_fr_pair_list_copy(void)
 	fr_pair_list_free(&local_pairs);
 }
 
+static void test_fr_pair_list_move(void)
+{
+	fr_pair_t	*to, *from, *vp;
+	fr_cursor_t	cursor;
+	size_t		i, count = 0;
+
+	fr_pair_list_init(&to);
+	fr_pair_list_init(&from);
+
+	/*
+	 *	Enough pairs that the "to" list is indexed.
+	 */
+	for (i = 0; i < 7; i++) {
+		MEM(vp = fr_pair_afrom_da(autofree, attr_test_integer));
+		vp->vp_uint32 = i;
+		fr_pair_add(&to, vp);
+	}
+	MEM(vp = fr_pair_afrom_da(autofree, attr_test_string));
+	fr_pair_value_strdup(vp, "old");
+	fr_pair_add(&to, vp);
+
+	MEM(vp = fr_pair_afrom_da(autofree, attr_test_string));
+	fr_pair_value_strdup(vp, "new");
+	vp->op = T_OP_SET;
+	fr_pair_add(&from, vp);
+
+	MEM(vp = fr_pair_afrom_da(autofree, attr_test_integer));
+	vp->vp_uint32 = 99;
+	vp->op = T_OP_EQ;
+	fr_pair_add(&from, vp);
+
+	MEM(vp = fr_pair_afrom_da(autofree, attr_test_octets));
+	vp->op = T_OP_ADD;
+	fr_pair_add(&from, vp);
+
+	TEST_CASE("Move pairs from 'from' to 'to' using fr_pair_list_move()");
+	fr_pair_list_move(&to, &from);
+
+	TEST_CASE("Expected ':=' to replace the existing value");
+	TEST_CHECK((vp = fr_pair_find_by_da(&to, attr_test_string)) != NULL);
+	TEST_CHECK(vp && (strcmp(vp->vp_strvalue, "new") == 0));
+
+	TEST_CASE("Expected '=' not to add a pair which exists");
+	for (vp = fr_cursor_iter_by_da_init(&cursor, &to, attr_test_integer);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) count++;
+	TEST_CHECK(count == 7);
+	TEST_CHECK((vp = fr_pair_find_by_da(&from, attr_test_integer)) != NULL);
+	TEST_CHECK(vp && (vp->vp_uint32 == 99));
+
+	TEST_CASE("Expected '+=' to add the pair");
+	TEST_CHECK(fr_pair_find_by_da(&to, attr_test_octets) != NULL);
+
+	fr_pair_list_free(&to);
+	fr_pair_list_free(&from);
+}
+
 static void test_fr_pair_list_copy_by_da(void)
 {
 	fr_cursor_t    cursor;
@@ -1235,6 +1327,7 @@ TEST_LIST = {
 	{ "fr_cursor_iter_by_da_init",            test_fr_cursor_iter_by_da_init },
 	{ "fr_cursor_iter_by_ancestor_init",      test_fr_cursor_iter_by_ancestor_init },
 	{ "fr_pair_to_unknown",                   test_fr_pair_to_unknown },
+	{ "fr_dict_unknown_cache",                test_fr_dict_unknown_cache },
 	{ "fr_pair_find_by_da",                   test_fr_pair_find_by_da },
 	{ "fr_pair_find_by_num",                  test_fr_pair_find_by_num },
 	{ "fr_pair_find_by_child_num",            test_fr_pair_find_by_child_num },
@@ -1251,6 +1344,7 @@ TEST_LIST = {
 
 	/* Lists */
 	{ "fr_pair_list_copy",                    test_fr_pair_list_copy },
+	{ "fr_pair_list_move",                    test_fr_pair_list_move },
 	{ "fr_pair_list_copy_by_da",              test_fr_pair_list_copy_by_da },
 	{ "fr_pair_list_copy_by_ancestor",        test_fr_pair_list_copy_by_ancestor },
 	{ "fr_pair_list_sort",                    test_fr_pair_list_sort },
@@ -0,0 +1,59 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Statically defined tracepoints (USDT)
+ *
+ * When <sys/sdt.h> is available (systemtap-sdt-dev on Linux), each
+ * probe compiles to a single nop, plus a note in the ELF file which
+ * tools such as bpftrace, perf and systemtap use to find it.  All
+ * probes are in the "freeradius" provider, e.g.
+ *
+ @verbatim
+   bpftrace -e 'usdt:/usr/lib/libfreeradius-server.so:freeradius:module_enter { ... }'
+ @endverbatim
+ *
+ * Otherwise the probes compile to nothing.
+ *
+ * @file src/lib/util/probe.h
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(probe_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#endif
+
+#ifdef HAVE_SYS_SDT_H
+#  define FR_PROBE(_name)				DTRACE_PROBE(freeradius, _name)
+#  define FR_PROBE1(_name, _a)				DTRACE_PROBE1(freeradius, _name, _a)
+#  define FR_PROBE2(_name, _a, _b)			DTRACE_PROBE2(freeradius, _name, _a, _b)
+#  define FR_PROBE3(_name, _a, _b, _c)			DTRACE_PROBE3(freeradius, _name, _a, _b, _c)
+#else
+#  define FR_PROBE(_name)
+#  define FR_PROBE1(_name, _a)
+#  define FR_PROBE2(_name, _a, _b)
+#  define FR_PROBE3(_name, _a, _b, _c)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
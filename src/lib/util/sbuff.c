@@ -414,10 +414,10 @@ static inline CC_HINT(always_inline) void fr_sbuff_terminal_idx_init(size_t *nee
 {
 	size_t i, len, max = 0;
 
-	if (!term) return;
-
 	memset(idx, 0, UINT8_MAX + 1);
 
+	if (!term) return;
+
 	for (i = 0; i < term->len; i++) {
 		len = term->elem[i].len;
 		if (len > max) max = len;
@@ -428,6 +428,56 @@ static inline CC_HINT(always_inline) void fr_sbuff_terminal_idx_init(size_t *nee
 	if (i > 0) *needle_len = max;
 }
 
+/** Skip over characters which can't start a terminal sequence, or be an escape
+ *
+ * The scanning loops would otherwise do a terminal search, and several
+ * branches, for every byte.  Most bytes in most input don't start a
+ * terminal, so we check four at a time, with a single branch, and only
+ * go byte by byte when one of them might match.
+ *
+ * @param[in] p			Where to start.
+ * @param[in] end		Of the data to skip over.
+ * @param[in] idx		Fastpath index, populated by
+ *				fr_sbuff_terminal_idx_init.
+ * @param[in] escape_chr	Also stop at this character.
+ * @return where the byte by byte search should continue.
+ */
+static inline CC_HINT(always_inline) char const *fr_sbuff_terminal_skip(char const *p, char const *end,
+									uint8_t const idx[static UINT8_MAX + 1],
+									char escape_chr)
+{
+	while ((end - p) >= 4) {
+		if (idx[(uint8_t)p[0]] | idx[(uint8_t)p[1]] | idx[(uint8_t)p[2]] | idx[(uint8_t)p[3]]) break;
+		if ((p[0] == escape_chr) || (p[1] == escape_chr) || (p[2] == escape_chr) || (p[3] == escape_chr)) break;
+		p += 4;
+	}
+
+	return p;
+}
+
+/** Skip over characters in the allowed set which can't start a terminal sequence
+ *
+ * @param[in] p			Where to start.
+ * @param[in] end		Of the data to skip over.
+ * @param[in] allowed		character set.
+ * @param[in] idx		Fastpath index, populated by
+ *				fr_sbuff_terminal_idx_init.
+ * @return where the byte by byte search should continue.
+ */
+static inline CC_HINT(always_inline) char const *fr_sbuff_allowed_skip(char const *p, char const *end,
+								       bool const allowed[static UINT8_MAX + 1],
+								       uint8_t const idx[static UINT8_MAX + 1])
+{
+	while ((end - p) >= 4) {
+		if (!(allowed[(uint8_t)p[0]] & allowed[(uint8_t)p[1]] &
+		      allowed[(uint8_t)p[2]] & allowed[(uint8_t)p[3]])) break;
+		if (idx[(uint8_t)p[0]] | idx[(uint8_t)p[1]] | idx[(uint8_t)p[2]] | idx[(uint8_t)p[3]]) break;
+		p += 4;
+	}
+
+	return p;
+}
+
 /** Efficient terminal string search
  *
  * Caller should ensure that a buffer extension of needle_len bytes has been requested
@@ -691,18 +741,22 @@ size_t fr_sbuff_out_bstrncpy_allowed(fr_sbuff_t *out, fr_sbuff_t *in, size_t len
 				     bool const allowed[static UINT8_MAX + 1])
 {
 	fr_sbuff_t 	our_in = FR_SBUFF_COPY(in);
+	uint8_t		idx[UINT8_MAX + 1];		/* No terminals */
 
 	CHECK_SBUFF_INIT(in);
 
+	memset(idx, 0, sizeof(idx));
+
 	while (fr_sbuff_used_total(&our_in) < len) {
-		char	*p;
-		char	*end;
+		char const	*p;
+		char		*end;
 
 		if (!fr_sbuff_extend(&our_in)) break;
 
 		p = fr_sbuff_current(&our_in);
 		end = CONSTRAINED_END(&our_in, len, fr_sbuff_used_total(&our_in));
 
+		p = fr_sbuff_allowed_skip(p, end, allowed, idx);
 		while ((p < end) && allowed[(uint8_t)*p]) p++;
 
 		FILL_OR_GOTO_DONE(out, &our_in, p - our_in.p);
@@ -753,8 +807,8 @@ size_t fr_sbuff_out_bstrncpy_until(fr_sbuff_t *out, fr_sbuff_t *in, size_t len,
 	fr_sbuff_terminal_idx_init(&needle_len, idx, tt);
 
 	while (fr_sbuff_used_total(&our_in) < len) {
-		char	*p;
-		char	*end;
+		char const	*p;
+		char		*end;
 
 		if (fr_sbuff_extend_lowat(NULL, in, needle_len) == 0) break;
 
@@ -762,9 +816,18 @@ size_t fr_sbuff_out_bstrncpy_until(fr_sbuff_t *out, fr_sbuff_t *in, size_t len,
 		end = CONSTRAINED_END(&our_in, len, fr_sbuff_used_total(&our_in));
 
 		if (escape_chr == '\0') {
-			while ((p < end) && !fr_sbuff_terminal_search(in, p, idx, tt, needle_len)) p++;
+			while (p < end) {
+				p = fr_sbuff_terminal_skip(p, end, idx, escape_chr);
+				if ((p == end) || fr_sbuff_terminal_search(in, p, idx, tt, needle_len)) break;
+				p++;
+			}
 		} else {
 			while (p < end) {
+				if (!do_escape) {
+					p = fr_sbuff_terminal_skip(p, end, idx, escape_chr);
+					if (p == end) break;
+				}
+
 				if (do_escape) {
 					do_escape = false;
 				} else if (*p == escape_chr) {
@@ -1627,7 +1690,7 @@ size_t fr_sbuff_adv_past_allowed(fr_sbuff_t *sbuff, size_t len, bool
 
 	CHECK_SBUFF_INIT(sbuff);
 
-	if (tt) fr_sbuff_terminal_idx_init(&needle_len, idx, tt);
+	fr_sbuff_terminal_idx_init(&needle_len, idx, tt);
 
 	while (total < len) {
 		char *end;
@@ -1635,7 +1698,7 @@ size_t fr_sbuff_adv_past_allowed(fr_sbuff_t *sbuff, size_t len, bool
 		if (!fr_sbuff_extend(sbuff)) break;
 
 		end = CONSTRAINED_END(sbuff, len, total);
-		p = sbuff->p;
+		p = fr_sbuff_allowed_skip(sbuff->p, end, allowed, idx);
 		while ((p < end) && allowed[(uint8_t)*p] &&
 		       ((needle_len == 0) || !fr_sbuff_terminal_search(sbuff, p, idx, tt, needle_len))) p++;
 
@@ -1681,9 +1744,18 @@ size_t fr_sbuff_adv_until(fr_sbuff_t *sbuff, size_t len, fr_sbuff_term_t const *
 		p = sbuff->p;
 
 		if (escape_chr == '\0') {
-			while ((p < end) && !fr_sbuff_terminal_search(sbuff, p, idx, tt, needle_len)) p++;
+			while (p < end) {
+				p = fr_sbuff_terminal_skip(p, end, idx, escape_chr);
+				if ((p == end) || fr_sbuff_terminal_search(sbuff, p, idx, tt, needle_len)) break;
+				p++;
+			}
 		} else {
 			while (p < end) {
+				if (!do_escape) {
+					p = fr_sbuff_terminal_skip(p, end, idx, escape_chr);
+					if (p == end) break;
+				}
+
 				if (do_escape) {
 					do_escape = false;
 				} else if (*p == escape_chr) {
@@ -1722,6 +1794,13 @@ char *fr_sbuff_adv_to_chr_utf8(fr_sbuff_t *sbuff, size_t len, char const *chr)
 
 	CHECK_SBUFF_INIT(sbuff);
 
+	/*
+	 *	An ASCII character can't be part of a multibyte
+	 *	sequence, so memchr() finds the same one, and is
+	 *	much faster.
+	 */
+	if ((clen == 1) && !((uint8_t)chr[0] & 0x80)) return fr_sbuff_adv_to_chr(sbuff, len, chr[0]);
+
 	/*
 	 *	Needle bigger than haystack
 	 */
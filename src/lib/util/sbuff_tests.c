@@ -1119,6 +1119,27 @@ static void test_adv_past_allowed(void)
 	fr_sbuff_init(&sbuff, in_ns, sizeof(in_ns));
 	TEST_CHECK_LEN(fr_sbuff_adv_past_allowed(&sbuff, 2, (bool[UINT8_MAX + 1]){ [' '] = true }, NULL), 0);
 	TEST_CHECK_STRCMP(sbuff.p, "i am a test string");
+
+	TEST_CASE("Check for disallowed chars and terminals at every offset");
+	{
+		char	buff[32];
+		size_t	i;
+
+		for (i = 0; i < 16; i++) {
+			memset(buff, ' ', sizeof(buff));
+			buff[i] = 'x';
+			buff[sizeof(buff) - 1] = '\0';
+
+			fr_sbuff_init(&sbuff, buff, sizeof(buff));
+			TEST_CHECK_LEN(fr_sbuff_adv_past_allowed(&sbuff, SIZE_MAX,
+								 (bool[UINT8_MAX + 1]){ [' '] = true }, NULL), i);
+
+			fr_sbuff_init(&sbuff, buff, sizeof(buff));
+			TEST_CHECK_LEN(fr_sbuff_adv_past_allowed(&sbuff, SIZE_MAX,
+								 (bool[UINT8_MAX + 1]){ [' '] = true, ['x'] = true },
+								 &FR_SBUFF_TERM("x")), i);
+		}
+	}
 }
 
 static void test_adv_until(void)
@@ -1155,6 +1176,33 @@ static void test_adv_until(void)
 	fr_sbuff_init(&sbuff, in, sizeof(in));
 	TEST_CHECK_LEN(fr_sbuff_adv_until(&sbuff, 5, &FR_SBUFF_TERM("|"), '\0'), 5);
 	TEST_CHECK(sbuff.p == (sbuff.start + 5));
+
+	TEST_CASE("Check for token at every offset, and escapes in every position");
+	{
+		char	buff[32];
+		size_t	i;
+
+		for (i = 0; i < 16; i++) {
+			memset(buff, 'a', sizeof(buff));
+			buff[i] = '|';
+			buff[sizeof(buff) - 1] = '\0';
+
+			fr_sbuff_init(&sbuff, buff, sizeof(buff));
+			TEST_CHECK_LEN(fr_sbuff_adv_until(&sbuff, SIZE_MAX, &FR_SBUFF_TERM("|"), '\0'), i);
+
+			fr_sbuff_init(&sbuff, buff, sizeof(buff));
+			TEST_CHECK_LEN(fr_sbuff_adv_until(&sbuff, 10, &FR_SBUFF_TERM("|"), '\0'), i < 10 ? i : 10);
+
+			/*
+			 *	The first terminal is escaped, so we stop at
+			 *	the second one.
+			 */
+			buff[i + 1] = '|';
+			if (i > 0) buff[i - 1] = '\\';
+			fr_sbuff_init(&sbuff, buff, sizeof(buff));
+			TEST_CHECK_LEN(fr_sbuff_adv_until(&sbuff, SIZE_MAX, &FR_SBUFF_TERM("|"), '\\'), i > 0 ? i + 1 : 0);
+		}
+	}
 }
 
 static void test_adv_to_utf8(void)
@@ -0,0 +1,181 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Caches of freed talloc chunks of a fixed size
+ *
+ * @file src/lib/util/slab.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/slab.h>
+#include <freeradius-devel/util/talloc.h>
+
+/*
+ *	Chunks handed out by the slab are ordinary talloc chunks.
+ *	They can be parented, stolen, have children and destructors,
+ *	and are freed with talloc_free().
+ *
+ *	The chunk's destructor calls fr_slab_release().  If the slab
+ *	has room, the chunk's children are freed, the chunk is moved
+ *	to the NULL ctx, and the destructor returns -1, so talloc
+ *	doesn't free it.  The next fr_slab_reserve() then gets the
+ *	chunk back without going to malloc.
+ *
+ *	Chunks are always allocated in the NULL ctx, and then stolen
+ *	into the caller's ctx.  That way they're never carved out of
+ *	a talloc pool, which would keep the whole pool alive for as
+ *	long as the chunk was in the slab.
+ *
+ *	Chunks can also be talloc pools, with room for a few small
+ *	children.  When the chunk goes back into the slab, all of its
+ *	children are freed, which empties the pool for the next user.
+ *
+ *	A slab isn't thread safe.  Each thread should have its own.
+ *	A chunk can be released into a different slab from the one
+ *	it was reserved from, so long as they're for the same type.
+ */
+struct fr_slab_s {
+	char const	*type;			//!< talloc name of the chunks.
+	size_t		size;			//!< size of the chunks.
+
+	unsigned int	num_children;		//!< children to make room for in each chunk.
+	size_t		children_size;		//!< total size of those children.
+
+	bool		freeing;		//!< the slab is being freed, don't take chunks back.
+
+	void		**free;			//!< chunks ready for reuse.
+	fr_slab_stats_t	stats;			//!< usage of this slab.
+};
+
+static int _slab_free(fr_slab_t *slab)
+{
+	slab->freeing = true;
+
+	while (slab->stats.num_free > 0) talloc_free(slab->free[--slab->stats.num_free]);
+
+	return 0;
+}
+
+/** Allocate a new slab
+ *
+ * @param[in] ctx	to allocate the slab in.
+ * @param[in] size	of the chunks.
+ * @param[in] type	talloc name of the chunks.  Must be a string literal.
+ * @param[in] max_free	maximum number of freed chunks to keep.
+ * @param[in] num_children	number of children to make room for in each chunk.
+ *				0 if the chunks aren't pools.
+ * @param[in] children_size	total size of those children.
+ * @return
+ *	- NULL on error.
+ *	- The new slab.
+ */
+fr_slab_t *_fr_slab_alloc(TALLOC_CTX *ctx, size_t size, char const *type, uint32_t max_free,
+			  unsigned int num_children, size_t children_size)
+{
+	fr_slab_t *slab;
+
+	if (!size || !max_free) return NULL;
+
+	slab = talloc_zero(ctx, fr_slab_t);
+	if (!slab) return NULL;
+
+	slab->free = talloc_array(slab, void *, max_free);
+	if (!slab->free) {
+		talloc_free(slab);
+		return NULL;
+	}
+
+	slab->type = type;
+	slab->size = size;
+	if (num_children && children_size) {
+		slab->num_children = num_children;
+		slab->children_size = children_size;
+	}
+	slab->stats.max_free = max_free;
+	talloc_set_destructor(slab, _slab_free);
+
+	return slab;
+}
+
+/** Get a zeroed chunk from the slab
+ *
+ * @param[in] slab	to take the chunk from.
+ * @param[in] ctx	to parent the chunk to.  May be NULL.
+ * @return
+ *	- NULL on error.
+ *	- A zeroed chunk.
+ */
+void *fr_slab_reserve(fr_slab_t *slab, TALLOC_CTX *ctx)
+{
+	void *chunk;
+
+	if (slab->stats.num_free > 0) {
+		chunk = slab->free[--slab->stats.num_free];
+		memset(chunk, 0, slab->size);
+		slab->stats.reused++;
+	} else {
+#ifdef HAVE_TALLOC_ZERO_POOLED_OBJECT
+		chunk = slab->num_children ?
+			_talloc_zero_pooled_object(NULL, slab->size, slab->type,
+						   slab->num_children, slab->children_size) :
+			talloc_zero_size(NULL, slab->size);
+#else
+		chunk = talloc_zero_size(NULL, slab->size);
+#endif
+		if (!chunk) return NULL;
+
+		talloc_set_name_const(chunk, slab->type);
+		slab->stats.alloced++;
+	}
+
+	if (ctx) (void) talloc_steal(ctx, chunk);
+
+	return chunk;
+}
+
+/** Take a chunk back, from its destructor
+ *
+ * @param[in] slab	to put the chunk into.
+ * @param[in] chunk	being freed.
+ * @return
+ *	- true if the slab kept the chunk.  The destructor should return -1.
+ *	- false if the chunk should be freed.
+ */
+bool fr_slab_release(fr_slab_t *slab, void *chunk)
+{
+	if (slab->freeing || (slab->stats.num_free >= slab->stats.max_free)) return false;
+
+	/*
+	 *	Moving the chunk out of its parent tells talloc that
+	 *	we've dealt with it, if the parent is being freed.
+	 */
+	talloc_free_children(chunk);
+	(void) talloc_steal(NULL, chunk);
+
+	slab->free[slab->stats.num_free++] = chunk;
+
+	return true;
+}
+
+/** Return the usage of a slab
+ *
+ */
+fr_slab_stats_t const *fr_slab_stats(fr_slab_t const *slab)
+{
+	return &slab->stats;
+}
@@ -0,0 +1,89 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Caches of freed talloc chunks of a fixed size
+ *
+ * @file src/lib/util/slab.h
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(slab_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_slab_s fr_slab_t;
+
+/** Usage of a slab
+ *
+ */
+typedef struct {
+	uint32_t	num_free;		//!< chunks ready for reuse.
+	uint32_t	max_free;		//!< maximum number of chunks to keep.
+	uint64_t	alloced;		//!< chunks allocated with malloc.
+	uint64_t	reused;			//!< chunks taken from the free list.
+} fr_slab_stats_t;
+
+/** Create a slab for chunks of a specific talloc type
+ *
+ * @param[in] _ctx		to allocate the slab in.
+ * @param[in] _type		of chunks.
+ * @param[in] _max_free		maximum number of freed chunks to keep.
+ * @return
+ *	- A new slab.
+ *	- NULL on error.
+ */
+#define fr_slab_talloc_alloc(_ctx, _type, _max_free) \
+	_fr_slab_alloc(_ctx, sizeof(_type), #_type, _max_free, 0, 0)
+
+/** Create a slab for chunks which have room for some children
+ *
+ * Each chunk is a talloc pool, so small children of the chunk
+ * are allocated inside it, instead of with malloc.
+ *
+ * @param[in] _ctx		to allocate the slab in.
+ * @param[in] _type		of chunks.
+ * @param[in] _max_free		maximum number of freed chunks to keep.
+ * @param[in] _num_children	number of children to make room for.
+ * @param[in] _children_size	total size of the children.
+ * @return
+ *	- A new slab.
+ *	- NULL on error.
+ */
+#define fr_slab_talloc_pooled_alloc(_ctx, _type, _max_free, _num_children, _children_size) \
+	_fr_slab_alloc(_ctx, sizeof(_type), #_type, _max_free, _num_children, _children_size)
+
+fr_slab_t		*_fr_slab_alloc(TALLOC_CTX *ctx, size_t size, char const *type, uint32_t max_free,
+					unsigned int num_children, size_t children_size);
+
+void			*fr_slab_reserve(fr_slab_t *slab, TALLOC_CTX *ctx) CC_HINT(nonnull(1));
+
+bool			fr_slab_release(fr_slab_t *slab, void *chunk) CC_HINT(nonnull);
+
+fr_slab_stats_t const	*fr_slab_stats(fr_slab_t const *slab) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
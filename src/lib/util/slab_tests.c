@@ -0,0 +1,103 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include "slab.c"
+
+typedef struct {
+	int		value;
+	char		*name;
+} slab_thing;
+
+static fr_slab_t *thing_slab;
+
+static int _slab_thing_free(slab_thing *thing)
+{
+	if (thing_slab && fr_slab_release(thing_slab, thing)) return -1;
+
+	return 0;
+}
+
+static slab_thing *slab_thing_alloc(TALLOC_CTX *ctx)
+{
+	slab_thing *thing;
+
+	thing = fr_slab_reserve(thing_slab, ctx);
+	if (!thing) return NULL;
+
+	talloc_set_destructor(thing, _slab_thing_free);
+
+	return thing;
+}
+
+#define SLAB_TEST_SIZE (64)
+
+static void slab_test_reuse(void)
+{
+	TALLOC_CTX		*parent;
+	slab_thing		*things[SLAB_TEST_SIZE];
+	fr_slab_stats_t const	*stats;
+	int			i;
+
+	thing_slab = fr_slab_talloc_alloc(NULL, slab_thing, SLAB_TEST_SIZE / 2);
+	TEST_CHECK(thing_slab != NULL);
+	stats = fr_slab_stats(thing_slab);
+
+	parent = talloc_new(NULL);
+
+	TEST_CASE("reserve");
+	for (i = 0; i < SLAB_TEST_SIZE; i++) {
+		things[i] = slab_thing_alloc(parent);
+		TEST_CHECK(things[i] != NULL);
+		TEST_CHECK(talloc_parent(things[i]) == parent);
+
+		things[i]->value = i;
+		things[i]->name = talloc_strdup(things[i], "child");
+	}
+	TEST_CHECK(stats->alloced == SLAB_TEST_SIZE);
+	TEST_CHECK(stats->num_free == 0);
+
+	/*
+	 *	Freeing the parent puts half of the things back into
+	 *	the slab, and frees the rest.
+	 */
+	TEST_CASE("release");
+	talloc_free(parent);
+	TEST_CHECK(stats->num_free == SLAB_TEST_SIZE / 2);
+	TEST_MSG("expected %u free, got %u", SLAB_TEST_SIZE / 2, stats->num_free);
+
+	TEST_CASE("reuse");
+	parent = talloc_new(NULL);
+	for (i = 0; i < SLAB_TEST_SIZE / 2; i++) {
+		slab_thing *thing = slab_thing_alloc(parent);
+
+		TEST_CHECK(thing != NULL);
+		TEST_CHECK(talloc_get_type(thing, slab_thing) == thing);
+		TEST_CHECK((thing->value == 0) && (thing->name == NULL));
+		TEST_MSG("reused thing wasn't zeroed");
+		TEST_CHECK(talloc_total_blocks(thing) == 1);
+		TEST_MSG("reused thing still has children");
+	}
+	TEST_CHECK(stats->reused == SLAB_TEST_SIZE / 2);
+	TEST_CHECK(stats->num_free == 0);
+
+	/*
+	 *	Freeing a thing directly keeps it.
+	 */
+	things[0] = slab_thing_alloc(parent);
+	TEST_CHECK(talloc_free(things[0]) == -1);
+	TEST_CHECK(stats->num_free == 1);
+	TEST_CHECK(talloc_parent(things[0]) == NULL);
+
+	talloc_free(parent);
+
+	/*
+	 *	Freeing the slab frees all of the things in it.
+	 */
+	TEST_CASE("free");
+	TEST_CHECK(talloc_free(thing_slab) == 0);
+	thing_slab = NULL;
+}
+
+TEST_LIST = {
+	{ "slab_test_reuse",	slab_test_reuse },
+	{ NULL }
+};
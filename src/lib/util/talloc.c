@@ -31,6 +31,7 @@ RCSID("$Id$")
 
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 /** Retrieve the current talloc NULL ctx
  *
@@ -209,6 +210,119 @@ TALLOC_CTX *talloc_aligned_array(TALLOC_CTX *ctx, void **start, size_t alignment
 	return array;
 }
 
+#define HUGE_PAGE_SIZE	(2 * 1024 * 1024)	//!< The default on x86_64 and aarch64.
+
+static bool talloc_huge_pages;
+
+/** Enable or disable huge pages for #talloc_huge_page_array
+ *
+ * Should be called once, before any threads are started.
+ *
+ * @param[in] enable	Whether large arrays should be backed by huge pages.
+ */
+void talloc_huge_pages_set(bool enable)
+{
+	talloc_huge_pages = enable;
+}
+
+typedef struct {
+	void		*addr;		//!< Start of the mapping.
+	size_t		len;		//!< Length of the mapping.
+} talloc_mapping_t;
+
+static int _talloc_mapping_free(talloc_mapping_t *map)
+{
+	(void) munmap(map->addr, map->len);
+
+	return 0;
+}
+
+/** Return an array backed by huge pages, if they're enabled and available
+ *
+ * Explicit huge pages (MAP_HUGETLB) are tried first.  Those need pages
+ * to have been reserved by the administrator, so if that fails, we map
+ * a huge page aligned region, and ask for transparent huge pages with
+ * madvise().  If the array is too small to fill a huge page, or mapping
+ * fails, an ordinary talloc array is allocated instead.
+ *
+ * The array is not zeroed, and must not be freed or reallocated directly.
+ * Free the returned chunk instead.
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] start	of the array.
+ * @param[in] size	How big to make the array.
+ * @return
+ *	- A talloc chunk on success.
+ *	- NULL on failure.
+ */
+TALLOC_CTX *talloc_huge_page_array(TALLOC_CTX *ctx, void **start, size_t size)
+{
+	talloc_mapping_t	*map;
+	uint8_t			*array;
+	size_t			len, page_size;
+	uintptr_t		aligned;
+
+	if (!talloc_huge_pages || (size < HUGE_PAGE_SIZE)) {
+	no_map:
+		array = talloc_array(ctx, uint8_t, size);
+		if (!array) {
+			fr_strerror_const("Out of memory");
+			return NULL;
+		}
+		*start = array;
+		return array;
+	}
+
+	map = talloc_zero(ctx, talloc_mapping_t);
+	if (!map) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	len = ROUND_UP(size, HUGE_PAGE_SIZE);
+
+#ifdef MAP_HUGETLB
+	map->addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (map->addr != MAP_FAILED) {
+		map->len = len;
+		goto done;
+	}
+#endif
+
+	/*
+	 *	Over-map, so that we can trim the region down to one
+	 *	which starts on a huge page boundary.  The kernel can
+	 *	only use huge pages for aligned parts of a mapping.
+	 */
+	page_size = (size_t)getpagesize();
+	map->addr = mmap(NULL, len + HUGE_PAGE_SIZE - page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map->addr == MAP_FAILED) {
+		talloc_free(map);
+		goto no_map;
+	}
+
+	aligned = ROUND_UP((uintptr_t)map->addr, HUGE_PAGE_SIZE);
+	if (aligned > (uintptr_t)map->addr) (void) munmap(map->addr, aligned - (uintptr_t)map->addr);
+	if ((uintptr_t)map->addr + HUGE_PAGE_SIZE - page_size > aligned) {
+		(void) munmap((void *)(aligned + len), ((uintptr_t)map->addr + HUGE_PAGE_SIZE - page_size) - aligned);
+	}
+	map->addr = (void *)aligned;
+	map->len = len;
+
+#ifdef MADV_HUGEPAGE
+	(void) madvise(map->addr, map->len, MADV_HUGEPAGE);
+#endif
+
+#ifdef MAP_HUGETLB
+done:
+#endif
+	talloc_set_destructor(map, _talloc_mapping_free);
+	*start = map->addr;
+
+	return map;
+}
+
 /** Return a page aligned talloc memory pool
  *
  * Because we can't intercept talloc's malloc() calls, we need to do some tricks
@@ -123,6 +123,9 @@ void		talloc_disarm_destructor(fr_talloc_destructor_t *d);
 TALLOC_CTX	*talloc_page_aligned_pool(TALLOC_CTX *ctx, void **start, void **end, size_t size);
 TALLOC_CTX	*talloc_aligned_array(TALLOC_CTX *ctx, void **start, size_t alignment, size_t size);
 
+void		talloc_huge_pages_set(bool enable);
+TALLOC_CTX	*talloc_huge_page_array(TALLOC_CTX *ctx, void **start, size_t size);
+
 /*
  *	Add variant that zeroes out newly allocated memory
  */
@@ -191,6 +191,35 @@ fr_time_t fr_time(void)
 #endif
 }
 
+/** Return a coarse relative time since the server our_epoch
+ *
+ *  This is cheaper than fr_time(), but it is only accurate to the
+ *  resolution of the kernel's clock tick, which is typically
+ *  1ms to 4ms.  It uses the same epoch as fr_time().
+ *
+ *  The coarse clock lags the precise one, so a value from
+ *  fr_time_coarse() may be earlier than a value which was
+ *  previously returned by fr_time().  It should only be used
+ *  for timestamps which are compared to other coarse timestamps,
+ *  or where millisecond errors don't matter.  Never mix the two
+ *  for fr_time_tracking_t, which asserts that time only moves
+ *  forwards.
+ *
+ * @returns fr_time_t time in nanoseconds since the server our_epoch.
+ *
+ * @hidecallergraph
+ */
+fr_time_t fr_time_coarse(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+	struct timespec ts;
+	(void) clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return fr_time_delta_from_timespec(&ts) - our_epoch;
+#else
+	return fr_time();
+#endif
+}
+
 /** Nanoseconds since the Unix Epoch the last time we synced internal time with wallclock time
  *
  */
@@ -93,6 +93,9 @@ int fr_time_sync(void);
 /** @hidecallergraph */
 fr_time_t fr_time(void);
 
+/** @hidecallergraph */
+fr_time_t fr_time_coarse(void);
+
 /*
  *	Need cast because of difference in sign
  */
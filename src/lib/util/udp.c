@@ -28,6 +28,10 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/udp.h>
 
+#ifdef __linux__
+#  include <linux/filter.h>
+#endif
+
 #define FR_DEBUG_STRERROR_PRINTF if (fr_debug_lvl) fr_strerror_printf
 
 /** Send a packet via a UDP socket.
@@ -213,3 +217,401 @@ done:
 
 	return slen;
 }
+
+/** One datagram in a batch
+ *
+ */
+typedef struct {
+	struct iovec		iov;			//!< Where the datagram is written.
+	struct sockaddr_storage	src;			//!< Source address of the datagram.
+	struct sockaddr_storage	dst;			//!< Destination address of the datagram.
+	socklen_t		sizeof_dst;		//!< Length of the destination address.
+	uint8_t			cbuf[256];		//!< Control messages, i.e. IP_PKTINFO.
+} udp_batch_entry_t;
+
+struct udp_batch_s {
+	unsigned int		num;			//!< Maximum number of datagrams to read at once.
+	unsigned int		count;			//!< How many datagrams we read on the last call.
+	unsigned int		next;			//!< The next datagram to return to the caller.
+	size_t			max_packet_size;	//!< Maximum size of a datagram.
+
+	fr_time_t		when;			//!< When the batch was read.
+
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr		*msgvec;		//!< Passed to recvmmsg().
+#endif
+	udp_batch_entry_t	*entry;			//!< Per-datagram addresses and buffers.
+};
+
+/** Allocate a structure for reading multiple datagrams in one system call
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] num		maximum number of datagrams to read at once.
+ * @param[in] max_packet_size	the maximum size of any one datagram.
+ * @return
+ *	- NULL on error.
+ *	- the batch on success.
+ */
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size)
+{
+	udp_batch_t	*batch;
+	uint8_t		*buffer;
+	unsigned int	i;
+
+	if (!num) num = 1;
+
+	batch = talloc_zero(ctx, udp_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_const("Out of memory");
+		talloc_free(batch);
+		return NULL;
+	}
+
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+
+	batch->entry = talloc_zero_array(batch, udp_batch_entry_t, num);
+	if (!batch->entry) goto oom;
+
+	buffer = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!buffer) goto oom;
+
+#ifdef HAVE_RECVMMSG
+	batch->msgvec = talloc_zero_array(batch, struct mmsghdr, num);
+	if (!batch->msgvec) goto oom;
+#endif
+
+	for (i = 0; i < num; i++) {
+		batch->entry[i].iov.iov_base = buffer + (i * max_packet_size);
+		batch->entry[i].iov.iov_len = max_packet_size;
+
+#ifdef HAVE_RECVMMSG
+		batch->msgvec[i].msg_hdr.msg_iov = &batch->entry[i].iov;
+		batch->msgvec[i].msg_hdr.msg_iovlen = 1;
+#endif
+	}
+
+	return batch;
+}
+
+/** Return how many datagrams are waiting in a batch
+ *
+ * @param[in] batch	to check.
+ * @return
+ *	- for reading, the number of datagrams which udp_batch_recv() will
+ *	  return without calling the kernel.
+ *	- for writing, the number of datagrams queued by udp_batch_queue()
+ *	  which have not yet been sent.
+ */
+unsigned int udp_batch_pending(udp_batch_t const *batch)
+{
+	return batch->count - batch->next;
+}
+
+#ifdef HAVE_RECVMMSG
+/** Read as many datagrams as possible from a socket
+ *
+ * @param[in] batch	to read datagrams into.
+ * @param[in] sockfd	we're reading from.
+ * @return
+ *	- >= 0 the number of datagrams read.
+ *	- < 0 on error, errno is set.
+ */
+static int udp_batch_fill(udp_batch_t *batch, int sockfd)
+{
+	struct sockaddr_storage	si;
+	socklen_t		sizeof_si = sizeof(si);
+	unsigned int		i;
+	int			num;
+
+	batch->count = batch->next = 0;
+
+	/*
+	 *	recvmsg() doesn't provide the destination port, so
+	 *	we get it (once) from the bound socket.
+	 */
+	if (getsockname(sockfd, (struct sockaddr *)&si, &sizeof_si) < 0) return -1;
+
+	/*
+	 *	The kernel updates these fields in place, so they
+	 *	have to be reset before every call.
+	 */
+	for (i = 0; i < batch->num; i++) {
+		struct msghdr *msgh = &batch->msgvec[i].msg_hdr;
+
+		batch->entry[i].iov.iov_len = batch->max_packet_size;
+
+		msgh->msg_name = &batch->entry[i].src;
+		msgh->msg_namelen = sizeof(batch->entry[i].src);
+		msgh->msg_control = batch->entry[i].cbuf;
+		msgh->msg_controllen = sizeof(batch->entry[i].cbuf);
+		msgh->msg_flags = 0;
+	}
+
+	num = recvmmsg(sockfd, batch->msgvec, batch->num, MSG_DONTWAIT, NULL);
+	if (num <= 0) return num;
+
+	batch->when = fr_time();
+
+	for (i = 0; i < (unsigned int) num; i++) {
+		udp_batch_entry_t *entry = &batch->entry[i];
+
+		memcpy(&entry->dst, &si, sizeof_si);
+		entry->sizeof_dst = sizeof_si;
+	}
+
+	batch->count = num;
+
+	return num;
+}
+#endif
+
+/** Read a UDP packet, using a batch of datagrams read by a single system call
+ *
+ * Datagrams are read from the kernel num at a time, and are then
+ * returned one by one, until the batch is empty.  Connected sockets,
+ * or platforms without recvmmsg(), read one datagram at a time.
+ *
+ * @param[in] batch		to read datagrams into.
+ * @param[in] sockfd		we're reading from.
+ * @param[in] flags		for things
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 if there was no data.
+ *	- < 0 on failure.
+ */
+ssize_t udp_batch_recv(udp_batch_t *batch, int sockfd, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+#ifdef HAVE_RECVMMSG
+	udp_batch_entry_t	*entry;
+	struct msghdr		*msgh;
+	ssize_t			slen;
+
+	if ((flags & (UDP_FLAGS_CONNECTED | UDP_FLAGS_PEEK)) != 0) {
+		return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+	}
+
+redo:
+	if (batch->next >= batch->count) {
+		int num;
+
+		num = udp_batch_fill(batch, sockfd);
+		if (num < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+			fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (num == 0) return 0;
+	}
+
+	entry = &batch->entry[batch->next];
+	msgh = &batch->msgvec[batch->next].msg_hdr;
+	slen = batch->msgvec[batch->next].msg_len;
+	batch->next++;
+
+	*socket_out = (fr_socket_t){
+		.fd = sockfd,
+		.proto = IPPROTO_UDP
+	};
+
+	recvfromto_cmsg(msgh, &socket_out->inet.ifindex,
+			(struct sockaddr *)&entry->dst, &entry->sizeof_dst, when);
+
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+				    &entry->src, msgh->msg_namelen) < 0) {
+		FR_DEBUG_STRERROR_PRINTF("Failed converting src sockaddr to ipaddr");
+		goto redo;
+	}
+
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+				    &entry->dst, entry->sizeof_dst) < 0) {
+		FR_DEBUG_STRERROR_PRINTF("Failed converting dst sockaddr to ipaddr");
+		goto redo;
+	}
+
+	/*
+	 *	The OS would discard any data after "data_len"
+	 *	bytes, so we do the same.
+	 */
+	if ((size_t) slen > data_len) slen = data_len;
+	memcpy(data, entry->iov.iov_base, slen);
+
+	if (when && !*when) *when = batch->when;
+
+	return slen;
+#else
+	return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+#endif
+}
+
+/** Queue a UDP packet to be sent with the rest of a batch
+ *
+ * The packet is copied, so the caller can re-use the data buffer
+ * immediately.  If the batch is full, it is sent before the new
+ * packet is queued.  Connected sockets, packets larger than the
+ * batch's maximum packet size, and platforms without sendmmsg()
+ * send the packet immediately.
+ *
+ * @param[in] batch	to add the packet to.
+ * @param[in] socket	we're writing to.
+ * @param[in] flags	to pass to send(), or sendto()
+ * @param[in] data	to data to send
+ * @param[in] data_len	length of data to send
+ * @return
+ *	- data_len on success.
+ *	- -1 on failure.  errno is EWOULDBLOCK if the batch was full, and
+ *	  could not be sent.  It should be sent later by calling
+ *	  udp_batch_send().
+ */
+ssize_t udp_batch_queue(udp_batch_t *batch, fr_socket_t const *socket, int flags, void *data, size_t data_len)
+{
+#ifdef HAVE_SENDMMSG
+	udp_batch_entry_t	*entry;
+	struct msghdr		*msgh;
+	socklen_t		sizeof_src;
+
+	if (unlikely(socket->proto != IPPROTO_UDP)) {
+		fr_strerror_printf("Invalid proto type %u", socket->proto);
+		return -1;
+	}
+
+	if (((flags & UDP_FLAGS_CONNECTED) != 0) || (data_len > batch->max_packet_size)) {
+		if (udp_send(socket, flags, data, data_len) < 0) return -1;
+		return data_len;
+	}
+
+	if ((batch->count == batch->num) && (udp_batch_send(batch, socket->fd) < 0)) return -1;
+
+	entry = &batch->entry[batch->count];
+	msgh = &batch->msgvec[batch->count].msg_hdr;
+
+	if (fr_ipaddr_to_sockaddr(&entry->dst, &entry->sizeof_dst,
+				  &socket->inet.dst_ipaddr, socket->inet.dst_port) < 0) return -1;
+	if (fr_ipaddr_to_sockaddr(&entry->src, &sizeof_src,
+				  &socket->inet.src_ipaddr, socket->inet.src_port) < 0) return -1;
+
+	memcpy(entry->iov.iov_base, data, data_len);
+	entry->iov.iov_len = data_len;
+
+	msgh->msg_name = &entry->dst;
+	msgh->msg_namelen = entry->sizeof_dst;
+	msgh->msg_flags = 0;
+	sendfromto_cmsg(msgh, entry->cbuf, sizeof(entry->cbuf), socket->inet.ifindex,
+			(struct sockaddr *)&entry->src, sizeof_src);
+
+	batch->count++;
+
+	return data_len;
+#else
+	if (udp_send(socket, flags, data, data_len) < 0) return -1;
+
+	return data_len;
+#endif
+}
+
+/** Send all of the packets queued in a batch
+ *
+ * Packets which the kernel refuses with an error other than
+ * EWOULDBLOCK are discarded.  When the socket would block, the
+ * remaining packets are left in the batch, to be sent on the next
+ * call.
+ *
+ * @param[in] batch	of packets to send.
+ * @param[in] sockfd	we're writing to.
+ * @return
+ *	- 0 on success, the batch is empty.
+ *	- -1 on failure, errno is EWOULDBLOCK, and the batch still contains
+ *	  unsent packets.
+ */
+int udp_batch_send(udp_batch_t *batch, int sockfd)
+{
+#ifdef HAVE_SENDMMSG
+	while (batch->next < batch->count) {
+		int sent;
+
+		sent = sendmmsg(sockfd, &batch->msgvec[batch->next], batch->count - batch->next, 0);
+		if (sent < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+				errno = EWOULDBLOCK;
+				return -1;
+			}
+
+			if (errno == EINTR) continue;
+
+			/*
+			 *	The first packet failed.  Discard it,
+			 *	and try the rest.
+			 */
+			fr_strerror_printf("udp_batch_send failed: %s", fr_syserror(errno));
+			batch->next++;
+			continue;
+		}
+
+		batch->next += sent;
+	}
+#endif
+
+	batch->count = batch->next = 0;
+
+	return 0;
+}
+
+/** Distribute packets across a SO_REUSEPORT group by source IP address
+ *
+ * By default, the kernel picks a socket from the group by hashing
+ * the full 4-tuple.  That keeps retransmits from one client port on
+ * the same socket, but a client which uses many source ports is spread
+ * across all of them.  This program instead selects the socket using
+ * the source IP address only, so each client is handled by one socket.
+ *
+ * The program is attached to the whole group, and should be attached
+ * once, after the first socket in the group has been bound.  Socket N
+ * in the group is the N'th one which was bound.
+ *
+ * @param[in] sockfd	the first socket in the group.
+ * @param[in] af	address family of the socket.
+ * @param[in] num	number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, or if the platform doesn't support this.
+ */
+int udp_reuseport_hash_src(int sockfd, int af, uint32_t num)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_fprog	fprog;
+	struct sock_filter	code[] = {
+		/*
+		 *	A = the source address, or for IPv6, the last 32 bits of it.
+		 */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + ((af == AF_INET6) ? 20 : 12)),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num),
+		BPF_STMT(BPF_RET | BPF_A, 0)
+	};
+
+	if (!num) {
+		fr_strerror_const("Invalid number of sockets");
+		return -1;
+	}
+
+	fprog.len = NUM_ELEMENTS(code);
+	fprog.filter = code;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+#else
+	fr_strerror_const("SO_ATTACH_REUSEPORT_CBPF is not supported on this platform");
+	return -1;
+#endif
+}
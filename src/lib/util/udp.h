@@ -33,6 +33,8 @@ extern "C" {
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/udpfromto.h>
 
+#include <talloc.h>
+
 #define UDP_FLAGS_NONE		(0)
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
@@ -46,6 +48,24 @@ ssize_t udp_recv_peek(int sockfd, void *data, size_t data_len, int flags, fr_ipa
 ssize_t udp_recv(int sockfd, int flags,
 		 fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
 
+/** Datagrams read from a socket in one system call, and returned one at a time
+ *
+ */
+typedef struct udp_batch_s udp_batch_t;
+
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size);
+
+unsigned int udp_batch_pending(udp_batch_t const *batch);
+
+ssize_t udp_batch_recv(udp_batch_t *batch, int sockfd, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
+
+ssize_t udp_batch_queue(udp_batch_t *batch, fr_socket_t const *socket, int flags, void *data, size_t data_len);
+
+int udp_batch_send(udp_batch_t *batch, int sockfd);
+
+int udp_reuseport_hash_src(int sockfd, int af, uint32_t num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -56,6 +56,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/net.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/thread_local.h>
 
 #include <assert.h>
 #include <ctype.h>
@@ -99,6 +100,77 @@ static_assert(SIZEOF_MEMBER(fr_value_box_t, vb_float64) == 8,
 	      "vb_float64 has unexpected length");
 
 
+/*
+ *	Per-thread slab of boxes, set up with fr_value_box_slab_init().
+ *	See fr_pair_slab_init() for why.
+ */
+static _Thread_local fr_slab_t *fr_value_box_slab;
+
+#define FR_VALUE_BOX_SLAB_MAX_FREE (1024)
+
+/** Put a box which came from a slab back into the slab
+ *
+ */
+static int _fr_value_box_slab_free(fr_value_box_t *vb)
+{
+	if (fr_value_box_slab && fr_slab_release(fr_value_box_slab, vb)) return -1;
+
+	return 0;
+}
+
+/** Free any boxes in the slab when the thread exits
+ *
+ */
+static void _fr_value_box_slab_free_on_exit(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Set up the value box slab for this thread
+ *
+ * @param[in] max_free	the number of freed boxes to keep for reuse.
+ *			If 0, the default is used.
+ * @return
+ *	- The statistics for this threads value box slab.
+ *	- NULL on error.
+ */
+fr_slab_stats_t const *fr_value_box_slab_init(uint32_t max_free)
+{
+	fr_slab_t *slab;
+
+	if (fr_value_box_slab) return fr_slab_stats(fr_value_box_slab);
+
+	slab = fr_slab_talloc_alloc(NULL, fr_value_box_t, max_free ? max_free : FR_VALUE_BOX_SLAB_MAX_FREE);
+	if (!slab) return NULL;
+
+	fr_thread_local_set_destructor(fr_value_box_slab, _fr_value_box_slab_free_on_exit, slab);
+
+	return fr_slab_stats(slab);
+}
+
+/** Allocate the memory for a box
+ *
+ * @note Use #fr_value_box_alloc instead.
+ *
+ * @param[in] ctx	to allocate the box in.
+ * @return
+ *	- An uninitialised box.
+ *	- NULL on error.
+ */
+fr_value_box_t *_fr_value_box_alloc(TALLOC_CTX *ctx)
+{
+	fr_value_box_t *vb;
+
+	if (!fr_value_box_slab) return talloc(ctx, fr_value_box_t);
+
+	vb = fr_slab_reserve(fr_value_box_slab, ctx);
+	if (unlikely(!vb)) return NULL;
+
+	talloc_set_destructor(vb, _fr_value_box_slab_free);
+
+	return vb;
+}
+
 /** Map data types to names representing those types
  */
 fr_table_num_ordered_t const fr_value_box_type_table[] = {
@@ -2823,6 +2895,99 @@ static inline int fr_value_box_cast_to_integer(TALLOC_CTX *ctx, fr_value_box_t *
 	return 0;
 }
 
+/** Parse a plain decimal integer string
+ *
+ * Most integers we parse come from databases, files, and other servers,
+ * and are only digits.  Those don't need to be copied, and passed
+ * through strtoull() and the range checks in
+ * #fr_value_box_from_integer_str.
+ *
+ * Anything else, such as hex, whitespace, or values which are out of
+ * range, is left to #fr_value_box_from_integer_str, which produces the
+ * appropriate error.
+ *
+ * @param[out] dst		where to write the integer.
+ * @param[in] dst_type		of integer.
+ * @param[in] in		string to parse.
+ * @param[in] len		of the string.
+ * @return
+ *	- true if the value was parsed.
+ *	- false if the caller should use the generic code.
+ */
+static inline CC_HINT(always_inline) bool fr_value_box_from_integer_str_fast(fr_value_box_t *dst, fr_type_t dst_type,
+									     char const *in, size_t len)
+{
+	char const	*p = in, *end = in + len;
+	bool		negative = false;
+	uint64_t	value = 0;
+	int64_t		svalue;
+
+	/*
+	 *	18 digits can't overflow an int64_t.
+	 */
+	if ((len == 0) || (len > 18)) return false;
+
+	if (*p == '-') {
+		negative = true;
+		if (++p == end) return false;
+	}
+
+	while (p < end) {
+		unsigned int digit = (uint8_t)*p++ - '0';
+
+		if (digit > 9) return false;
+		value = (value * 10) + digit;
+	}
+
+	svalue = negative ? -(int64_t)value : (int64_t)value;
+
+	switch (dst_type) {
+	case FR_TYPE_UINT8:
+		if (negative || (value > UINT8_MAX)) return false;
+		dst->vb_uint8 = (uint8_t)value;
+		break;
+
+	case FR_TYPE_UINT16:
+		if (negative || (value > UINT16_MAX)) return false;
+		dst->vb_uint16 = (uint16_t)value;
+		break;
+
+	case FR_TYPE_UINT32:
+		if (negative || (value > UINT32_MAX)) return false;
+		dst->vb_uint32 = (uint32_t)value;
+		break;
+
+	case FR_TYPE_UINT64:
+		if (negative) return false;
+		dst->vb_uint64 = value;
+		break;
+
+	case FR_TYPE_INT8:
+		if ((svalue < INT8_MIN) || (svalue > INT8_MAX)) return false;
+		dst->vb_int8 = (int8_t)svalue;
+		break;
+
+	case FR_TYPE_INT16:
+		if ((svalue < INT16_MIN) || (svalue > INT16_MAX)) return false;
+		dst->vb_int16 = (int16_t)svalue;
+		break;
+
+	case FR_TYPE_INT32:
+		if ((svalue < INT32_MIN) || (svalue > INT32_MAX)) return false;
+		dst->vb_int32 = (int32_t)svalue;
+		break;
+
+	case FR_TYPE_INT64:
+		dst->vb_int64 = svalue;
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
 /** Convert one type of fr_value_box_t to another
  *
  * This should be the canonical function used to convert between INTERNAL data formats.
@@ -3041,6 +3206,62 @@ int fr_value_box_cast_in_place(TALLOC_CTX *ctx, fr_value_box_t *vb,
 	return 0;
 }
 
+/** Convert an array of fr_value_box_t to the same type
+ *
+ * This is for callers converting many values at once, such as the
+ * columns of a set of SQL rows.  Whether plain decimal integer strings
+ * can be parsed directly is decided once for the whole array, instead
+ * of once per value.  Everything else goes through #fr_value_box_cast.
+ *
+ * @note If any cast fails, the boxes which were already cast are cleared.
+ *
+ * @param ctx		to allocate buffers in (usually the same as dst)
+ * @param dst		Array of num boxes to write the results to.
+ * @param dst_type	to cast to.
+ * @param dst_enumv	Aliases for values contained within the fr_value_box_t.
+ * @param src		Array of num boxes to cast.
+ * @param num		number of boxes in src and dst.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_cast_array(TALLOC_CTX *ctx, fr_value_box_t dst[],
+			    fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+			    fr_value_box_t const src[], size_t num)
+{
+	size_t	i;
+	bool	fast;
+
+	switch (dst_type) {
+	case FR_TYPE_INTEGER_EXCEPT_BOOL:
+		fast = !dst_enumv;
+		break;
+
+	default:
+		fast = false;
+		break;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (fast && (src[i].type == FR_TYPE_STRING)) {
+			fr_value_box_init(&dst[i], dst_type, NULL, src[i].tainted);
+			if (fr_value_box_from_integer_str_fast(&dst[i], dst_type,
+							       src[i].vb_strvalue, src[i].vb_length)) {
+				dst[i].vb_length = dict_attr_sizes[dst_type][1];
+				continue;
+			}
+		}
+
+		if (fr_value_box_cast(ctx, &dst[i], dst_type, dst_enumv, &src[i]) < 0) {
+			fr_strerror_printf_push("Failed casting value %zu", i);
+			while (i-- > 0) fr_value_box_clear(&dst[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /** Assign a #fr_value_box_t value from an #fr_ipaddr_t
  *
  * Automatically determines the type of the value box from the ipaddr address family
@@ -4355,6 +4576,11 @@ parse:
 		return -1;
 	}
 
+	/*
+	 *	Plain decimal integers don't need the temporary buffer.
+	 */
+	if (fr_value_box_from_integer_str_fast(dst, *dst_type, in, len)) goto finish;
+
 	/*
 	 *	It's a fixed size src->dst_type, copy to a temporary buffer and
 	 *	\0 terminate if insize >= 0.
@@ -42,6 +42,7 @@ typedef struct value_box_s fr_value_box_t;
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/util/inet.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/slab.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/token.h>
@@ -370,6 +371,10 @@ static inline CC_HINT(always_inline) void fr_value_box_init_null(fr_value_box_t
 	fr_value_box_init(vb, FR_TYPE_INVALID, NULL, false);
 }
 
+fr_slab_stats_t const *fr_value_box_slab_init(uint32_t max_free);
+
+fr_value_box_t	*_fr_value_box_alloc(TALLOC_CTX *ctx);
+
 /** Allocate a value box of a specific type
  *
  * Allocates memory for the box, and sets the length of the value
@@ -388,7 +393,7 @@ static inline CC_HINT(always_inline) fr_value_box_t *fr_value_box_alloc(TALLOC_C
 {
 	fr_value_box_t *vb;
 
-	vb = talloc(ctx, fr_value_box_t);
+	vb = _fr_value_box_alloc(ctx);
 	if (unlikely(!vb)) return NULL;
 
 	fr_value_box_init(vb, type, enumv, tainted);
@@ -612,6 +617,10 @@ int		fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
 int		fr_value_box_cast_in_place(TALLOC_CTX *ctx, fr_value_box_t *vb,
 					   fr_type_t dst_type, fr_dict_attr_t const *dst_enumv);
 
+int		fr_value_box_cast_array(TALLOC_CTX *ctx, fr_value_box_t dst[],
+					fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+					fr_value_box_t const src[], size_t num) CC_HINT(nonnull(2, 5));
+
 int		fr_value_box_ipaddr(fr_value_box_t *dst, fr_dict_attr_t const *enumv,
 					 fr_ipaddr_t const *ipaddr, bool tainted);
 
@@ -91,6 +91,8 @@ typedef struct {
 	socklen_t	salen;
 
 	fr_event_timer_t const	*ev_timeout;
+	fr_time_t	ev_timeout_when;	//!< when ev_timeout was armed to fire.
+	fr_time_t	timeout_at;		//!< when the session actually times out.
 	fr_event_timer_t const	*ev_packet;
 	fr_time_t	last_recv;
 	fr_time_t	next_recv;
@@ -954,8 +956,6 @@ static void bfd_set_timeout(bfd_state_t *session, fr_time_t when)
 {
 	fr_time_t now = when;
 
-	fr_event_timer_delete(&session->ev_timeout);
-
 	now += fr_time_delta_from_usec(session->detection_time);
 
 	if (session->detect_multi >= 2) {
@@ -968,10 +968,23 @@ static void bfd_set_timeout(bfd_state_t *session, fr_time_t when)
 		session->next_recv += fr_time_delta_from_usec(delay);
 	}
 
+	session->timeout_at = now;
+
+	/*
+	 *	Every packet we receive pushes the timeout further
+	 *	out.  Rather than deleting and re-inserting the timer
+	 *	for every packet, leave it where it is.  When it
+	 *	fires, it re-arms itself for the new timeout.
+	 */
+	if (session->ev_timeout && (session->ev_timeout_when <= now)) return;
+
+	fr_event_timer_delete(&session->ev_timeout);
+
 	if (fr_event_timer_at(session, session->el, &session->ev_timeout,
 			      now, bfd_detection_timeout, session) < 0) {
 		fr_assert("Failed to insert event" == NULL);
 	}
+	session->ev_timeout_when = now;
 }
 
 
@@ -1089,6 +1102,19 @@ static void bfd_detection_timeout(UNUSED fr_event_list_t *eel, fr_time_t now, vo
 {
 	bfd_state_t *session = ctx;
 
+	/*
+	 *	We received packets since the timer was armed, so
+	 *	the session hasn't timed out yet.
+	 */
+	if (now < session->timeout_at) {
+		if (fr_event_timer_at(session, session->el, &session->ev_timeout,
+				      session->timeout_at, bfd_detection_timeout, session) < 0) {
+			fr_assert("Failed to insert event" == NULL);
+		}
+		session->ev_timeout_when = session->timeout_at;
+		return;
+	}
+
 	DEBUG("BFD %d Timeout state %s ****** ", session->number,
 	      bfd_state[session->session_state]);
 
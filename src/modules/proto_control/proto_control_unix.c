@@ -1152,6 +1152,15 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 		inst->gid = -1;
 	}
 
+	/*
+	 *	Each server process binds its own socket, as the
+	 *	path is unlinked before it's bound.
+	 */
+	if (main_config->processes > 1) {
+		inst->filename = talloc_typed_asprintf(inst, "%s.%u", inst->filename, main_config->process_index);
+		if (!inst->filename) return -1;
+	}
+
 	if (!inst->mode_name) {
 		inst->read_only = true;
 	} else {
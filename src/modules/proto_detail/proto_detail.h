@@ -126,6 +126,10 @@ struct proto_detail_work_thread_s {
 	bool				paused;			//!< Is reading paused?
 
 	int				count;			//!< number of packets we read from this file.
+	uint32_t			done;			//!< number of packets which were processed successfully.
+	uint32_t			failed;			//!< number of packets which were given up on.
+	uint32_t			retransmits;		//!< number of retransmissions.
+	fr_time_t			start;			//!< when we opened the file.
 
 	size_t				leftover;
 	uint8_t				*leftover_buffer;
@@ -257,8 +257,10 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 
 		/*
 		 *	Remember the read offset, and whether we got EOF.
+		 *	We've just seeked to the old read offset, so
+		 *	there's no need to ask the kernel where we are.
 		 */
-		thread->read_offset = lseek(thread->fd, 0, SEEK_CUR);
+		thread->read_offset += data_size;
 
 		/*
 		 *	Only set EOF if there's no more data in the buffer to manage.
@@ -298,8 +300,11 @@ redo:
 	p = buffer + thread->last_search;
 	while (p < end) {
 		if (p[0] != '\n') {
-			p++;
-			continue;
+			p = memchr(p, '\n', end - p);
+			if (!p) {
+				p = end;
+				break;
+			}
 		}
 		if ((p + 1) == end) {
 			/*
@@ -463,8 +468,11 @@ redo:
 
 	while (p < record_end) {
 		if (*p != '\0') {
-			p++;
-			continue;
+			p = memchr(p, '\0', record_end - p);
+			if (!p) {
+				p = record_end;
+				break;
+			}
 		}
 
 		p++;
@@ -548,6 +556,7 @@ static void work_retransmit(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, vo
 
 	DEBUG("%s - retransmitting packet %d", thread->name, track->id);
 	track->retry.count++;
+	thread->retransmits++;
 
 	fr_dlist_insert_tail(&thread->list, track);
 
@@ -613,6 +622,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 				      track->retry.next, work_retransmit, track) < 0) {
 			ERROR("%s - Failed inserting retransmission timeout", thread->name);
 		fail:
+			thread->failed++;
 			if (inst->track_progress && (track->done_offset > 0)) goto mark_done;
 			goto free_track;
 		}
@@ -624,17 +634,20 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 		return 1;
 
-	} else if (inst->track_progress && (track->done_offset > 0)) {
-	mark_done:
-		/*
-		 *	Seek to the entry, mark it as done, and then seek to
-		 *	the point in the file where we were reading from.
-		 */
-		(void) lseek(thread->fd, track->done_offset, SEEK_SET);
-		if (write(thread->fd, "Done", 4) < 0) {
-			ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
+	} else {
+		thread->done++;
+
+		if (inst->track_progress && (track->done_offset > 0)) {
+		mark_done:
+			/*
+			 *	Mark the entry as done.  pwrite() doesn't
+			 *	touch the file offset, so there's no need to
+			 *	seek back to where we were reading from.
+			 */
+			if (pwrite(thread->fd, "Done", 4, track->done_offset) < 0) {
+				ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
+			}
 		}
-		(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
 	}
 
 free_track:
@@ -718,6 +731,7 @@ static int mod_open(fr_listen_t *li)
 	fr_assert(thread->name == NULL);
 	fr_assert(thread->filename_work != NULL);
 	thread->name = talloc_typed_asprintf(thread, "detail_work from filename %s", thread->filename_work);
+	thread->start = fr_time();
 
 	return 0;
 }
@@ -738,6 +752,14 @@ static int mod_close_internal(proto_detail_work_thread_t *thread)
 
 	DEBUG("Closing and deleting detail worker file %s", thread->name);
 
+	if (thread->count > 0) {
+		fr_time_delta_t delta = fr_time() - thread->start;
+
+		DEBUG("%s - read %d packets, %u done, %u failed, %u retransmissions, in %.3fs (%.1f packets/s)",
+		      thread->name, thread->count, thread->done, thread->failed, thread->retransmits,
+		      (double) delta / NSEC, delta ? ((double) thread->count * NSEC) / delta : 0.0);
+	}
+
 #ifdef NOTE_REVOKE
 	fr_event_fd_delete(thread->el, thread->fd, FR_EVENT_FILTER_VNODE);
 #endif
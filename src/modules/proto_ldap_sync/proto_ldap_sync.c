@@ -123,6 +123,8 @@ static CONF_PARSER ldap_sync_search_config[] = {
 
 	{ FR_CONF_OFFSET("allow_refresh", FR_TYPE_BOOL, sync_config_t, allow_refresh), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cookie_interval", FR_TYPE_UINT32, sync_config_t, cookie_interval), .dflt = "100" },
+
 	CONF_PARSER_TERMINATOR
 };
 
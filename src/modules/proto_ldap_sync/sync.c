@@ -44,6 +44,8 @@ struct sync_state_s {
 	int				msgid;			//!< The unique identifier for this sync session.
 
 	uint8_t				*cookie;		//!< Opaque cookie, used to resume synchronisation.
+	bool				cookie_pending;		//!< We have a new cookie which hasn't been stored yet.
+	uint32_t			entries_since_cookie;	//!< Entries processed since we last stored a cookie.
 
 	sync_phases_t			phase;
 };
@@ -139,6 +141,23 @@ static int sync_new_cookie(bool *new_cookie, sync_state_t *sync, BerElement *ber
 	return 0;
 }
 
+/** Pass the current cookie to the cookie callback
+ *
+ * @param[in] sync	the cookie belongs to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sync_cookie_store(sync_state_t *sync)
+{
+	sync->cookie_pending = false;
+	sync->entries_since_cookie = 0;
+
+	if (!sync->config->cookie) return 0;
+
+	return sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
+}
+
 /** Handle a LDAP_RES_SEARCH_ENTRY (SearchResultEntry) or LDAP_RES_SEARCH_REFRENCE (SearchResultReference) response
  *
  * Upon receipt of a search request containing the syncControl the server provides the initial
@@ -314,8 +333,22 @@ static int sync_search_entry_or_reference(sync_state_t *sync, LDAPMessage *msg,
 		}
 	}
 
-	if ((ret == 0) && new_cookie && sync->config->cookie) {
-		ret = sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
+	/*
+	 *  Servers may send a new cookie with every entry.  Storing
+	 *  each one means a cookie-store request per entry, which
+	 *  doubles the work during a large refresh.  Only store the
+	 *  cookie every cookie_interval entries.  Any cookie we skip
+	 *  is stored with the next syncInfo or searchResultDone
+	 *  message.  If we restart before then the server re-sends
+	 *  the changes since the last stored cookie, which is safe.
+	 */
+	if (ret == 0) {
+		if (new_cookie) sync->cookie_pending = true;
+		sync->entries_since_cookie++;
+
+		if (sync->cookie_pending && (sync->entries_since_cookie >= sync->config->cookie_interval)) {
+			ret = sync_cookie_store(sync);
+		}
 	}
 	ber_free(ber, 1);
 
@@ -561,9 +594,7 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 
 	}
 
-	if (new_cookie && sync->config->cookie) {
-		ret = sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
-	}
+	if (new_cookie || sync->cookie_pending) ret = sync_cookie_store(sync);
 
 	if (ber) ber_free(ber, 1);
 	if (oid) ldap_memfree(oid);
@@ -696,9 +727,7 @@ static int sync_search_result(sync_state_t *sync, LDAPMessage *msg, LDAPControl
 		if (ret != 0) goto error;
 	}
 
-	if (new_cookie && sync->config->cookie) {
-		ret = sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
-	}
+	if (new_cookie || sync->cookie_pending) ret = sync_cookie_store(sync);
 	if (msg) ldap_memfree(msg);
 
 	sync->phase = SYNC_PHASE_DONE;
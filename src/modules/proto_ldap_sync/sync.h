@@ -145,6 +145,9 @@ struct sync_config_s {
 								//!< refreshes.
 	bool				allow_refresh;		//!< If false, we synthesize the cookie value
 								//!< when no cookie is available.
+	uint32_t			cookie_interval;	//!< Only store cookies received with individual
+								//!< entries once this many entries have been processed.
+								//!< 0 or 1 stores every cookie.
 
 	/*
 	 *	LDAP attribute to RADIUS map
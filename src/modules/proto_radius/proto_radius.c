@@ -43,6 +43,8 @@ static CONF_PARSER const limit_config[] = {
 	{ FR_CONF_OFFSET("max_connections", FR_TYPE_UINT32, proto_radius_t, io.max_connections), .dflt = "1024" } ,
 	{ FR_CONF_OFFSET("max_clients", FR_TYPE_UINT32, proto_radius_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", FR_TYPE_UINT32, proto_radius_t, io.max_pending_packets), .dflt = "256" } ,
+	{ FR_CONF_OFFSET("max_pending_clients", FR_TYPE_UINT32, proto_radius_t, io.max_pending_clients), .dflt = "32" } ,
+	{ FR_CONF_OFFSET("max_packets_per_second", FR_TYPE_UINT32, proto_radius_t, io.max_packets_per_second), .dflt = "0" } ,
 
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
@@ -83,6 +85,12 @@ static CONF_PARSER const proto_radius_config[] = {
 	 */
 	{ FR_CONF_OFFSET("tunnel_password_zeros", FR_TYPE_BOOL, proto_radius_t, tunnel_password_zeros) } ,
 
+	/*
+	 *	Reply to Status-Server without running "recv
+	 *	Status-Server".
+	 */
+	{ FR_CONF_OFFSET("fast_status_server", FR_TYPE_BOOL, proto_radius_t, fast_status_server), .dflt = "no" } ,
+
 	{ FR_CONF_POINTER("limit", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	{ FR_CONF_POINTER("priority", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) priority_config },
 
@@ -219,6 +227,11 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	 *	Note that we don't set a limit on max_attributes here.
 	 *	That MUST be set and checked in the underlying
 	 *	transport, via a call to fr_radius_ok().
+	 *
+	 *	Everything is decoded up front.  Pairs are read
+	 *	directly through vp->data by tmpls, xlats, maps and
+	 *	modules, so there's no single place where a "lazy"
+	 *	pair could be decoded on first use.
 	 */
 	fr_cursor_init(&cursor, &request->request_pairs);
 	if (fr_radius_decode(request->packet, request->packet->data, request->packet->data_len,
@@ -480,6 +493,61 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+/** Reply to Status-Server in the network thread
+ *
+ *  Load balancers and home server checks send Status-Server very
+ *  often, and the reply is always the same.  So we build it here,
+ *  without allocating a request or running the virtual server.
+ *
+ *  If all of the workers are shedding load, we don't reply, so that
+ *  whoever is checking stops sending us packets.
+ */
+static ssize_t mod_fast_reply(void const *instance, RADCLIENT const *client,
+			      uint8_t *reply, size_t reply_len,
+			      uint8_t *buffer, size_t buflen, bool overloaded)
+{
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	uint8_t const		*attr, *end;
+
+	if (!inst->fast_status_server || (buffer[0] != FR_CODE_STATUS_SERVER)) return 0;
+
+	if (reply_len < (RADIUS_HEADER_LENGTH + 2 + RADIUS_MESSAGE_AUTHENTICATOR_LENGTH)) return 0;
+
+	/*
+	 *	Status-Server MUST have a Message-Authenticator.  If
+	 *	it doesn't, or it's wrong, let the normal path discard
+	 *	the packet, and complain about it.  The app_io has
+	 *	already checked that the attributes are well formed.
+	 */
+	end = buffer + buflen;
+	for (attr = buffer + RADIUS_HEADER_LENGTH; attr < end; attr += attr[1]) {
+		if (attr[1] < 2) return 0;
+		if (attr[0] == FR_MESSAGE_AUTHENTICATOR) break;
+	}
+	if (attr >= end) return 0;
+
+	if (fr_radius_verify(buffer, NULL, (uint8_t const *) client->secret,
+			     talloc_array_length(client->secret) - 1) < 0) return 0;
+
+	if (overloaded) {
+		DEBUG2("proto_radius - Not replying to Status-Server from client %s - all workers are overloaded",
+		       client->shortname);
+		return -1;
+	}
+
+	reply[0] = FR_CODE_ACCESS_ACCEPT;
+	reply[1] = buffer[1];
+	reply[2] = 0;
+	reply[3] = RADIUS_HEADER_LENGTH + 2 + RADIUS_MESSAGE_AUTHENTICATOR_LENGTH;
+	reply[RADIUS_HEADER_LENGTH] = FR_MESSAGE_AUTHENTICATOR;
+	reply[RADIUS_HEADER_LENGTH + 1] = 2 + RADIUS_MESSAGE_AUTHENTICATOR_LENGTH;
+
+	if (fr_radius_sign(reply, buffer, (uint8_t const *) client->secret,
+			   talloc_array_length(client->secret) - 1) < 0) return 0;
+
+	return reply[3];
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -635,5 +703,6 @@ fr_app_t proto_radius = {
 	.decode			= mod_decode,
 	.encode			= mod_encode,
 	.entry_point_set	= mod_entry_point_set,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.fast_reply		= mod_fast_reply
 };
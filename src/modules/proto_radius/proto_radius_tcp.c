@@ -101,6 +101,16 @@ static const CONF_PARSER tcp_listen_config[] = {
 };
 
 
+/** Whether the buffer contains at least one complete RADIUS packet
+ *
+ */
+static inline bool radius_tcp_complete(uint8_t const *buffer, size_t buffer_len)
+{
+	if (buffer_len < RADIUS_HEADER_LENGTH) return false;
+
+	return (buffer_len >= (size_t) ((buffer[2] << 8) | buffer[3]));
+}
+
 static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
 	proto_radius_tcp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_tcp_t);
@@ -109,11 +119,30 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 	size_t				packet_len, in_buffer;
 	decode_fail_t			reason;
 
+	li->read_pending = false;
+
+	/*
+	 *	A previous read may have pulled in more than one
+	 *	packet.  If there's already a complete packet in the
+	 *	buffer, then don't call read() at all.
+	 */
+	if (radius_tcp_complete(buffer, *leftover)) {
+		data_size = 0;
+		goto check;
+	}
+
 	/*
-	 *      Read data into the buffer.
+	 *      Read as much data as we can into the buffer.
 	 */
 	data_size = read(thread->sockfd, buffer + *leftover, buffer_len - *leftover);
 	if (data_size < 0) {
+		/*
+		 *	We were called to finish a partial packet
+		 *	which was left over from a previous read, but
+		 *	the rest of it hasn't arrived yet.
+		 */
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return 0;
+
 		PDEBUG2("proto_radius_tcp got read error %zd", data_size);
 		return data_size;
 	}
@@ -132,6 +161,7 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 		return -1;
 	}
 
+check:
 	/*
 	 *	We MUST always start with a known RADIUS packet.
 	 */
@@ -168,10 +198,12 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 	/*
 	 *	We've read more than one packet.  Tell the caller that
 	 *	there's more data available, and return only one packet.
+	 *	If the data contains another complete packet, the
+	 *	caller should come back for it without waiting for
+	 *	the socket to become readable.
 	 */
-	if (in_buffer > packet_len) {
-		*leftover = in_buffer - packet_len;
-	}
+	*leftover = in_buffer - packet_len;
+	li->read_pending = radius_tcp_complete(buffer + packet_len, *leftover);
 
 	/*
 	 *      If it's not a RADIUS packet, ignore it.
@@ -375,6 +407,23 @@ static int mod_compare(void const *instance, UNUSED void *thread_instance, UNUSE
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(void const *instance, UNUSED void *thread_instance, UNUSED RADCLIENT *client,
+			 void const *packet)
+{
+	uint32_t hash;
+	proto_radius_tcp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_tcp_t);
+
+	uint8_t const *a = packet;
+
+	/*
+	 *	Hash the same fields as mod_compare().
+	 */
+	hash = fr_hash(a, 2);
+	if (inst->dedup_authenticator) hash = fr_hash_update(a + 4, RADIUS_AUTH_VECTOR_LENGTH, hash);
+
+	return hash;
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -595,6 +644,7 @@ fr_app_io_t proto_radius_tcp = {
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
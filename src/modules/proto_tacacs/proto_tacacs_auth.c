@@ -467,9 +467,11 @@ static virtual_server_compile_t compile_list[] = {
 	COMPILE_TERMINATOR
 };
 
-static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
+static int mod_instantiate(void *instance, CONF_SECTION *process_app_cs)
 {
 	proto_tacacs_auth_t	*inst = instance;
+	CONF_SECTION		*server_cs = cf_item_to_section(cf_parent(cf_parent(process_app_cs)));
+	char			*name;
 
 	/*
 	 *	Usually we use the 'State' attribute. But, in this
@@ -481,6 +483,17 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 	inst->state_tree = fr_state_tree_init(inst, attr_tacacs_state, main_config->spawn_workers, inst->max_session,
 					      inst->session_timeout, inst->state_server_id);
 
+	/*
+	 *	"stats state <server>.auth" shows how much memory
+	 *	the sessions are holding.  Failing to register only
+	 *	loses the statistics.
+	 */
+	name = talloc_asprintf(NULL, "%s.auth", cf_section_name2(server_cs));
+	if (fr_state_tree_cmd_register(inst->state_tree, name) < 0) {
+		PWARN("Failed registering radmin commands for session-state of %s", name);
+	}
+	talloc_free(name);
+
 	return 0;
 }
 
@@ -108,18 +108,53 @@ static const char *packet_name[] = {
 	[FR_TAC_PLUS_ACCT] = "Accounting",
 };
 
+/** Whether the buffer contains at least one complete TACACS+ packet
+ *
+ * Invalid packets count as complete, so that mod_read() rejects them.
+ */
+static inline bool tacacs_tcp_complete(uint8_t const *buffer, size_t buffer_len)
+{
+	ssize_t slen;
+
+	if (!buffer_len) return false;
+
+	slen = fr_tacacs_length(buffer, buffer_len);
+	if (slen < 0) return true;
+
+	return (buffer_len >= (size_t) slen);
+}
+
 static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, UNUSED fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
 	// proto_tacacs_tcp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_tacacs_tcp_t);
 	proto_tacacs_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_tacacs_tcp_thread_t);
-	ssize_t				data_size;
+	ssize_t				data_size, slen;
 	size_t				packet_len, in_buffer;
 
+	li->read_pending = false;
+
 	/*
-	 *      Read data into the buffer.
+	 *	A previous read may have pulled in more than one
+	 *	packet.  If there's already a complete packet in the
+	 *	buffer, then don't call read() at all.
+	 */
+	if (tacacs_tcp_complete(buffer, *leftover)) {
+		data_size = 0;
+		goto check;
+	}
+
+	/*
+	 *      Read as much data as we can into the buffer.
 	 */
 	data_size = read(thread->sockfd, buffer + *leftover, buffer_len - *leftover);
 	if (data_size < 0) {
+		/*
+		 *	We were called to finish a partial packet
+		 *	which was left over from a previous read, but
+		 *	the rest of it hasn't arrived yet.
+		 */
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return 0;
+
 		PDEBUG2("proto_tacacs_tcp got read error %zd", data_size);
 		return data_size;
 	}
@@ -138,13 +173,20 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, UNUSED fr_tim
 		return -1;
 	}
 
+check:
 	in_buffer = *leftover + data_size;
 
 	/*
 	 *	We don't have a complete TACACS+ packet.  Tell the
 	 *	caller that we need to read more.
 	 */
-	packet_len = fr_tacacs_length(buffer, in_buffer);
+	slen = fr_tacacs_length(buffer, in_buffer);
+	if (slen < 0) {
+		PERROR("proto_tacacs_tcp got invalid packet");
+		return -1;
+	}
+	packet_len = slen;
+
 	if (in_buffer < packet_len) {
 		*leftover = in_buffer;
 		return 0;
@@ -153,10 +195,12 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, UNUSED fr_tim
 	/*
 	 *	We've read more than one packet.  Tell the caller that
 	 *	there's more data available, and return only one packet.
+	 *	If the data contains another complete packet, the
+	 *	caller should come back for it without waiting for
+	 *	the socket to become readable.
 	 */
-	if (in_buffer > packet_len) {
-		*leftover = in_buffer - packet_len;
-	}
+	*leftover = in_buffer - packet_len;
+	li->read_pending = tacacs_tcp_complete(buffer + packet_len, *leftover);
 
 	*recv_time_p = fr_time();
 	thread->stats.total_requests++;
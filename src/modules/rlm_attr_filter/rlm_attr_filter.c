@@ -31,12 +31,49 @@ RCSID("$Id$")
 #include	<freeradius-devel/server/module.h>
 #include	<freeradius-devel/util/debug.h>
 #include	<freeradius-devel/server/users_file.h>
+#include	<freeradius-devel/util/hash.h>
 
 #include	<sys/stat.h>
 
 #include	<ctype.h>
 #include	<fcntl.h>
 
+/*
+ *	Filters are compiled when the file is read.
+ *
+ *	Each entry gets a hash table of its rules, keyed by the
+ *	attribute they apply to.  Filtering a list is then one pass
+ *	over its attributes, with a single lookup for each, instead
+ *	of comparing every attribute with every rule.
+ *
+ *	Rules with a literal value have their check pair built here
+ *	too, so only rules with expansions or attribute references
+ *	need to be evaluated at run time.
+ */
+typedef struct attr_filter_rule_s attr_filter_rule_t;
+
+struct attr_filter_rule_s {
+	map_t const		*map;		//!< The rule, as read from the file.
+	fr_pair_t		*vp;		//!< The check pair, if the value is static.
+	attr_filter_rule_t	*next;		//!< Next rule for the same attribute.
+};
+
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< Attribute the rules apply to.
+	attr_filter_rule_t	*head;		//!< Rules, in the order they appear in the file.
+	attr_filter_rule_t	**tail;
+} attr_filter_da_t;
+
+typedef struct {
+	PAIR_LIST const		*pl;		//!< Entry this was compiled from.
+	bool			is_default;	//!< Entry is "DEFAULT", and matches any key.
+
+	fr_hash_table_t		*rules;		//!< attr_filter_da_t, keyed by attribute.
+	attr_filter_rule_t	*set;		//!< ':=' rules, which are added to the output.
+	attr_filter_rule_t	*control;	//!< Fall-Through and Relax-Filter.
+	bool			vsa_any;	//!< 'Vendor-Specific =* ANY', which allows any VSA.
+} attr_filter_entry_t;
+
 /*
  *	Define a structure with the module configuration, so it can
  *	be used as the instance handle.
@@ -46,6 +83,7 @@ typedef struct {
 	tmpl_t	*key;
 	bool		relaxed;
 	PAIR_LIST	*attrs;
+	attr_filter_entry_t	*entries;	//!< One per entry in attrs, in the same order.
 } rlm_attr_filter_t;
 
 static const CONF_PARSER module_config[] = {
@@ -101,6 +139,166 @@ static void check_pair(request_t *request, fr_pair_t *check_item, fr_pair_t *rep
 	return;
 }
 
+static uint32_t attr_filter_da_hash(void const *data)
+{
+	attr_filter_da_t const *a = data;
+
+	return fr_hash(&a->da, sizeof(a->da));
+}
+
+static int attr_filter_da_cmp(void const *one, void const *two)
+{
+	attr_filter_da_t const *a = one, *b = two;
+
+	return (a->da > b->da) - (a->da < b->da);
+}
+
+/** Build the check pair for a rule with a literal value
+ *
+ * This is what map_to_vp() does for TMPL_TYPE_DATA, but without needing a request.
+ */
+static int attr_filter_rule_static(TALLOC_CTX *ctx, fr_pair_t **out, map_t const *map)
+{
+	fr_dict_attr_t const	*da = tmpl_da(map->lhs);
+	fr_pair_t		*vp;
+
+	MEM(vp = fr_pair_afrom_da(ctx, da));
+	vp->op = map->op;
+
+	if ((map->op != T_OP_CMP_TRUE) && (map->op != T_OP_CMP_FALSE)) {
+		if (da->type == tmpl_value_type(map->rhs)) {
+			if (fr_value_box_copy(vp, &vp->data, tmpl_value(map->rhs)) < 0) goto error;
+		} else if (fr_value_box_cast(vp, &vp->data, da->type, da, tmpl_value(map->rhs)) < 0) {
+		error:
+			talloc_free(vp);
+			return -1;
+		}
+	}
+
+	*out = vp;
+	return 0;
+}
+
+/** Get the check pair for a rule
+ *
+ * @param[in] ctx	to allocate dynamic pairs in.
+ * @param[out] out	the check pair.  Only needs to be freed if it differs from rule->vp.
+ * @param[in] request	to use for expansions.
+ * @param[in] rule	to get the check pair for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int attr_filter_rule_vp(TALLOC_CTX *ctx, fr_pair_t **out, request_t *request, attr_filter_rule_t const *rule)
+{
+	fr_pair_list_t vps;
+
+	if (rule->vp) {
+		*out = rule->vp;
+		return 0;
+	}
+
+	fr_pair_list_init(&vps);
+	if (map_to_vp(ctx, &vps, request, rule->map, NULL) < 0) return -1;
+
+	/*
+	 *	!* produces no pairs, it only needs the operator.
+	 */
+	if (!vps) {
+		if (rule->map->op != T_OP_CMP_FALSE) return -1;
+
+		MEM(vps = fr_pair_afrom_da(ctx, tmpl_da(rule->map->lhs)));
+		vps->op = T_OP_CMP_FALSE;
+	}
+
+	*out = vps;
+	return 0;
+}
+
+static attr_filter_rule_t *attr_filter_rule_alloc(TALLOC_CTX *ctx, map_t const *map)
+{
+	attr_filter_rule_t *rule;
+
+	MEM(rule = talloc_zero(ctx, attr_filter_rule_t));
+	rule->map = map;
+
+	if (!tmpl_is_data(map->rhs) && (map->op != T_OP_CMP_TRUE) && (map->op != T_OP_CMP_FALSE)) return rule;
+
+	if (attr_filter_rule_static(rule, &rule->vp, map) < 0) {
+		fr_strerror_printf_push("Failed parsing value for %s", map->lhs->name);
+		talloc_free(rule);
+		return NULL;
+	}
+
+	return rule;
+}
+
+/** Compile an entry into a table of rules, keyed by attribute
+ *
+ */
+static int attr_filter_compile(TALLOC_CTX *ctx, attr_filter_entry_t *entry, PAIR_LIST const *pl)
+{
+	fr_cursor_t		cursor;
+	map_t			*map;
+	attr_filter_rule_t	**set_tail = &entry->set, **control_tail = &entry->control;
+
+	entry->pl = pl;
+	entry->is_default = (strcmp(pl->name, "DEFAULT") == 0);
+
+	entry->rules = fr_hash_table_create(ctx, attr_filter_da_hash, attr_filter_da_cmp, NULL);
+	if (!entry->rules) return -1;
+
+	for (map = fr_cursor_init(&cursor, &pl->reply);
+	     map;
+	     map = fr_cursor_next(&cursor)) {
+		fr_dict_attr_t const	*da = tmpl_da(map->lhs);
+		attr_filter_rule_t	*rule;
+		attr_filter_da_t	*rules, find;
+
+		rule = attr_filter_rule_alloc(ctx, map);
+		if (!rule) return -1;
+
+		/*
+		 *	These control the entry, they aren't
+		 *	compared with the input list.
+		 */
+		if ((da == attr_fall_through) || (da == attr_relax_filter)) {
+			*control_tail = rule;
+			control_tail = &rule->next;
+			continue;
+		}
+
+		/*
+		 *	If it is a SET operator, it's added to the
+		 *	output list without checking it.
+		 */
+		if (map->op == T_OP_SET) {
+			*set_tail = rule;
+			set_tail = &rule->next;
+			continue;
+		}
+
+		/*
+		 *	Vendor-Specific is special, and matches any
+		 *	VSA if the comparison is always true.
+		 */
+		if ((da == attr_vendor_specific) && (map->op == T_OP_CMP_TRUE)) entry->vsa_any = true;
+
+		find.da = da;
+		rules = fr_hash_table_find_by_data(entry->rules, &find);
+		if (!rules) {
+			MEM(rules = talloc_zero(entry->rules, attr_filter_da_t));
+			rules->da = da;
+			rules->tail = &rules->head;
+			if (!fr_hash_table_insert(entry->rules, rules)) return -1;
+		}
+		*rules->tail = rule;
+		rules->tail = &rule->next;
+	}
+
+	return 0;
+}
+
 static int attr_filter_getfile(TALLOC_CTX *ctx, rlm_attr_filter_t *inst, char const *filename, PAIR_LIST **pair_list)
 {
 	fr_cursor_t cursor;
@@ -108,6 +306,7 @@ static int attr_filter_getfile(TALLOC_CTX *ctx, rlm_attr_filter_t *inst, char co
 	PAIR_LIST *attrs = NULL;
 	PAIR_LIST *entry;
 	map_t *map;
+	size_t num = 0;
 
 	rcode = pairlist_read(ctx, dict_radius, filename, &attrs, 1);
 	if (rcode < 0) {
@@ -149,6 +348,19 @@ static int attr_filter_getfile(TALLOC_CTX *ctx, rlm_attr_filter_t *inst, char co
 				     filename, entry->lineno, da->name, entry->name);
 			}
 		}
+		num++;
+	}
+
+	/*
+	 *	Compile the entries, so they don't have to be
+	 *	searched for each attribute at run time.
+	 */
+	MEM(inst->entries = talloc_zero_array(ctx, attr_filter_entry_t, num));
+	for (entry = attrs, num = 0; entry != NULL; entry = entry->next, num++) {
+		if (attr_filter_compile(inst->entries, &inst->entries[num], entry) < 0) {
+			PERROR("%s[%d] Failed compiling entry \"%s\"", filename, entry->lineno, entry->name);
+			return -1;
+		}
 	}
 
 	*pair_list = attrs;
@@ -185,7 +397,7 @@ static unlang_action_t CC_HINT(nonnull(1,2)) attr_filter_common(rlm_rcode_t *p_r
 	rlm_attr_filter_t const *inst = talloc_get_type_abort_const(instance, rlm_attr_filter_t);
 	fr_cursor_t	out;
 	fr_pair_list_t	output;
-	PAIR_LIST	*pl;
+	size_t		i;
 	int		found = 0;
 	int		pass, fail = 0;
 	char const	*keyname = NULL;
@@ -214,96 +426,77 @@ static unlang_action_t CC_HINT(nonnull(1,2)) attr_filter_common(rlm_rcode_t *p_r
 	/*
 	 *      Find the attr_filter profile entry for the entry.
 	 */
-	for (pl = inst->attrs; pl; pl = pl->next) {
-		int fall_through = 0;
-		int relax_filter = inst->relaxed;
-		map_t *map;
-		fr_pair_t *check_item, *input_item;
-		fr_pair_list_t check_list;
-		fr_cursor_t check, cursor;
+	for (i = 0; i < talloc_array_length(inst->entries); i++) {
+		attr_filter_entry_t const	*entry = &inst->entries[i];
+		int				fall_through = 0;
+		int				relax_filter = inst->relaxed;
+		attr_filter_rule_t const	*rule;
+		fr_pair_t			*check_item, *input_item;
+		fr_cursor_t			cursor;
 
 		/*
 		 *  If the current entry is NOT a default,
 		 *  AND the realm does NOT match the current entry,
 		 *  then skip to the next entry.
 		 */
-		if ((strcmp(pl->name, "DEFAULT") != 0) &&
-		    (strcmp(keyname, pl->name) != 0))  {
-			continue;
-		}
+		if (!entry->is_default && (strcmp(keyname, entry->pl->name) != 0)) continue;
 
-		RDEBUG2("Matched entry %s at line %d", pl->name, pl->lineno);
+		RDEBUG2("Matched entry %s at line %d", entry->pl->name, entry->pl->lineno);
 		found = 1;
 
-		fr_pair_list_init(&check_list);
-		fr_cursor_init(&check, &check_list);
-
-		for (map = fr_cursor_init(&cursor, &pl->reply);
-		     map;
-		     map = fr_cursor_next(&cursor)) {
-			if (map_to_vp(packet, &check_item, request, map, NULL) < 0) {
-				RPWARN("Failed parsing map %s for check item, skipping it", map->lhs->name);
+		for (rule = entry->control; rule; rule = rule->next) {
+			if (attr_filter_rule_vp(request, &check_item, request, rule) < 0) {
+				RPWARN("Failed parsing map %s for check item, skipping it", rule->map->lhs->name);
 				continue;
 			}
 
-		     	if (check_item->da == attr_fall_through) {
-				if (check_item->vp_uint32 == 1) {
-					fall_through = 1;
-					fr_pair_list_free(&check_item);
-					continue;
-				}
-		     	} else if (check_item->da == attr_relax_filter) {
-				relax_filter = check_item->vp_uint32;
-		     	}
+			if (check_item->da == attr_fall_through) {
+				fall_through = check_item->vp_bool;
+			} else {
+				relax_filter = check_item->vp_bool;
+			}
+			if (check_item != rule->vp) talloc_free(check_item);
+		}
 
-			/*
-			 *    If it is a SET operator, add the attribute to
-			 *    the output list without checking it.
-			 */
-			if (check_item->op == T_OP_SET ) {
-				fr_cursor_append(&out, check_item);
+		/*
+		 *    SET operators add the attribute to the
+		 *    output list without checking it.
+		 */
+		for (rule = entry->set; rule; rule = rule->next) {
+			if (attr_filter_rule_vp(packet, &check_item, request, rule) < 0) {
+				RPWARN("Failed parsing map %s for check item, skipping it", rule->map->lhs->name);
 				continue;
 			}
 
-			/*
-			 *	Append the realized VP to the check list.
-			 */
-			fr_cursor_append(&check, check_item);
+			if (check_item == rule->vp) MEM(check_item = fr_pair_copy(packet, rule->vp));
+			fr_cursor_append(&out, check_item);
 		}
 
 		/*
 		 *	Iterate through the input items, comparing
-		 *	each item to every rule, then moving it to the
-		 *	output list only if it matches all rules
-		 *	for that attribute.  IE, Idle-Timeout is moved
-		 *	only if it matches all rules that describe an
+		 *	each item to the rules for its attribute, then
+		 *	moving it to the output list only if it matches
+		 *	all of them.  IE, Idle-Timeout is moved only if
+		 *	it matches all rules that describe an
 		 *	Idle-Timeout.
 		 */
-		for (input_item = fr_cursor_init(&cursor, list);
-		     input_item;
-		     input_item = fr_cursor_next(&cursor)) {
+		input_item = fr_cursor_init(&cursor, list);
+		while (input_item) {
+			attr_filter_da_t	*rules;
+
 			pass = fail = 0; /* reset the pass,fail vars for each reply item */
 
-			/*
-			 *  Reset the check_item pointer to beginning of the list
-			 */
-			for (check_item = fr_cursor_head(&check);
-			     check_item;
-			     check_item = fr_cursor_next(&check)) {
-				/*
-				 *  Vendor-Specific is special, and matches any VSA if the
-				 *  comparison is always true.
-				 */
-				if ((check_item->da == attr_vendor_specific) &&
-				    (fr_dict_vendor_num_by_da(input_item->da) != 0) &&
-				    (check_item->op == T_OP_CMP_TRUE)) {
-					pass++;
+			if (entry->vsa_any && (fr_dict_vendor_num_by_da(input_item->da) != 0)) pass++;
+
+			rules = fr_hash_table_find_by_data(entry->rules, &(attr_filter_da_t){ .da = input_item->da });
+			for (rule = rules ? rules->head : NULL; rule; rule = rule->next) {
+				if (attr_filter_rule_vp(request, &check_item, request, rule) < 0) {
+					RPWARN("Failed parsing map %s for check item, skipping it", rule->map->lhs->name);
 					continue;
 				}
 
-				if (input_item->da == check_item->da) {
-					check_pair(request, check_item, input_item, &pass, &fail);
-				}
+				check_pair(request, check_item, input_item, &pass, &fail);
+				if (check_item != rule->vp) talloc_free(check_item);
 			}
 
 			RDEBUG3("Attribute \"%s\" allowed by %i rules, disallowed by %i rules",
@@ -318,10 +511,14 @@ static unlang_action_t CC_HINT(nonnull(1,2)) attr_filter_common(rlm_rcode_t *p_r
 				if (!pass) {
 					RDEBUG3("Attribute \"%s\" allowed by relaxed mode", input_item->da->name);
 				}
-				vp = fr_cursor_remove(&check);
+				vp = fr_cursor_remove(&cursor);
 				fr_assert(vp != NULL);
 				fr_cursor_append(&out, vp);
+				input_item = fr_cursor_current(&cursor);
+				continue;
 			}
+
+			input_item = fr_cursor_next(&cursor);
 		}
 
 		/* If we shouldn't fall through, break */
@@ -153,6 +153,12 @@ static void cache_entry_free(rlm_cache_entry_t *c)
 	talloc_free(c);
 }
 
+/** Flag stored with entries serialized by #cache_serialize_binary
+ *
+ * Entries without it were written in the text format.
+ */
+#define CACHE_MEMCACHED_FLAG_BINARY	(0x01)
+
 /** Locate a cache entry in memcached
  *
  * @copydetails cache_entry_find_t
@@ -182,10 +188,14 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
 
 	c = talloc_zero(NULL, rlm_cache_entry_t);
-	ret = cache_deserialize(c, request->dict, from_store, len);
+	if (flags & CACHE_MEMCACHED_FLAG_BINARY) {
+		ret = cache_deserialize_binary(c, request->dict, (uint8_t const *)from_store, len);
+	} else {
+		RDEBUG2("%s", from_store);
+		ret = cache_deserialize(c, request->dict, from_store, len);
+	}
 	free(from_store);
 	if (ret < 0) {
 		RPERROR("Invalid entry");
@@ -204,7 +214,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, UNUSED void *instance,
 					 request_t *request, void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_memcached_handle_t *mandle = handle;
@@ -212,20 +222,22 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	memcached_return_t ret;
 
 	TALLOC_CTX *pool;
-	char *to_store;
+	uint8_t *to_store;
+	size_t len;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
+	if (cache_serialize_binary(pool, &to_store, &len, c) < 0) {
+		RPERROR("Failed serializing entry");
 		talloc_free(pool);
 
 		return CACHE_ERROR;
 	}
 
 	ret = memcached_set(mandle->handle, (char const *)c->key, c->key_len,
-		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, c->expires, 0);
+		            (char const *)to_store, len, c->expires + fr_unix_time_from_sec(config->stale),
+			    CACHE_MEMCACHED_FLAG_BINARY);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
@@ -21,18 +21,78 @@
  *
  * @copyright 2014 The FreeRADIUS server project
  */
+#include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/debug.h>
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/*
+ *	Entries are spread over multiple trees by a hash of their
+ *	key, each with its own lock.  Workers only contend when
+ *	they're operating on keys in the same shard.
+ */
+#define CACHE_SHARDS (16)
 
 typedef struct {
 	rbtree_t		*cache;		//!< Tree for looking up cache keys.
 	fr_heap_t		*heap;		//!< For managing entry expiry.
 
 	pthread_mutex_t		mutex;		//!< Protect the tree from multiple readers/writers.
+} rlm_cache_rbtree_shard_t;
+
+/*
+ *	Snapshot file format.  All integers are in network byte order.
+ *
+ *	header:	uint32 magic, uint8 version
+ *	entry:	uint8 protocol length, protocol, uint16 key length, key,
+ *		uint32 length, entry serialized with cache_serialize_binary()
+ */
+#define CACHE_SNAPSHOT_MAGIC	(0x46524342)	/* "FRCB" */
+#define CACHE_SNAPSHOT_VERSION	(1)
+
+typedef struct {
+	rlm_cache_rbtree_shard_t shard[CACHE_SHARDS];	//!< Trees, selected by key hash.
+
+	atomic_uint_fast32_t	num_entries;	//!< Across all shards.
+
+	char const		*snapshot;		//!< File to save the entries to, and restore them from.
+	fr_time_delta_t		snapshot_interval;	//!< How often to save the entries.  0 for only on exit.
+
+	pthread_t		snapshot_thread;	//!< Saves the entries every snapshot_interval.
+	pthread_mutex_t		snapshot_mutex;	//!< Protects snapshot_stop.
+	pthread_cond_t		snapshot_cond;	//!< Signalled to stop the snapshot thread.
+	bool			snapshot_stop;	//!< Tells the snapshot thread to exit.
+	bool			snapshot_running;	//!< Whether the snapshot thread was started.
 } rlm_cache_rbtree_t;
 
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("snapshot", FR_TYPE_FILE_OUTPUT, rlm_cache_rbtree_t, snapshot) },
+	{ FR_CONF_OFFSET("snapshot_interval", FR_TYPE_TIME_DELTA, rlm_cache_rbtree_t, snapshot_interval), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Tracks which shard the current request has locked
+ *
+ * The shard can't be chosen, and locked, until we know the key, so
+ * this is done on the first find, insert or expire.  rlm_cache only
+ * operates on one key between acquire and release.
+ */
+typedef struct {
+	rlm_cache_rbtree_shard_t *shard;	//!< The shard we have locked, or NULL.
+} rlm_cache_rbtree_handle_t;
+
 typedef struct {
 	rlm_cache_entry_t	fields;		//!< Entry data.
 	int32_t			heap_id;	//!< Offset used for heap.
@@ -79,19 +139,312 @@ static int _cache_entry_free(void *data, UNUSED void *uctx)
 	return 2;
 }
 
+typedef struct {
+	fr_dbuff_t		dbuff;		//!< Entries are serialized into.
+	fr_unix_time_t		now;		//!< Entries which expired before this aren't saved.
+	uint32_t		count;		//!< How many entries were saved.
+} cache_snapshot_ctx_t;
+
+/** Append one entry to a snapshot
+ *
+ * Entries which can't be serialized are skipped, they'll just be
+ * looked up again after the restart.
+ */
+static int _cache_snapshot_entry(void *data, void *uctx)
+{
+	rlm_cache_entry_t	*c = data;
+	cache_snapshot_ctx_t	*sctx = uctx;
+	fr_dict_t const		*dict = fr_dict_internal();
+	char const		*proto;
+	map_t			*map;
+	uint8_t			*entry;
+	size_t			entry_len, proto_len;
+	fr_dbuff_marker_t	m;
+
+	if (c->expires < sctx->now) return 0;
+
+	if (cache_serialize_binary(NULL, &entry, &entry_len, c) < 0) return 0;
+
+	/*
+	 *	Any attribute which isn't internal tells us which
+	 *	protocol dictionary the entry was created from.
+	 */
+	for (map = c->maps; map; map = map->next) {
+		fr_dict_t const *map_dict = fr_dict_by_da(tmpl_da(map->lhs));
+
+		if (map_dict != fr_dict_internal()) {
+			dict = map_dict;
+			break;
+		}
+	}
+	proto = fr_dict_root(dict)->name;
+	proto_len = strlen(proto);
+
+	/*
+	 *	Don't leave a partial entry behind if we run out
+	 *	of memory.
+	 */
+	fr_dbuff_marker(&m, &sctx->dbuff);
+	if ((proto_len > UINT8_MAX) || (c->key_len > UINT16_MAX) ||
+	    (fr_dbuff_in(&sctx->dbuff, (uint8_t)proto_len) <= 0) ||
+	    (fr_dbuff_in_memcpy(&sctx->dbuff, (uint8_t const *)proto, proto_len) <= 0) ||
+	    (fr_dbuff_in(&sctx->dbuff, (uint16_t)c->key_len) <= 0) ||
+	    (fr_dbuff_in_memcpy(&sctx->dbuff, c->key, c->key_len) <= 0) ||
+	    (fr_dbuff_in(&sctx->dbuff, (uint32_t)entry_len) <= 0) ||
+	    (fr_dbuff_in_memcpy(&sctx->dbuff, entry, entry_len) <= 0)) {
+		fr_dbuff_set(&sctx->dbuff, &m);
+	} else {
+		sctx->count++;
+	}
+	fr_dbuff_marker_release(&m);
+	talloc_free(entry);
+
+	return 0;
+}
+
+/** Save all of the unexpired entries to the snapshot file
+ *
+ * Each shard is serialized to memory whilst it's locked, and the file
+ * is written once all of them are done.  The file is written under
+ * a temporary name, and renamed, so a crash whilst saving doesn't
+ * leave a truncated snapshot behind.
+ */
+static void cache_snapshot_save(rlm_cache_rbtree_t *driver)
+{
+	cache_snapshot_ctx_t	sctx = { .now = fr_time_to_unix_time(fr_time()) };
+	fr_dbuff_uctx_talloc_t	tctx;
+	char			*tmp;
+	uint8_t const		*p, *end;
+	int			fd, i;
+
+	if (!fr_dbuff_init_talloc(NULL, &sctx.dbuff, &tctx, 4096, SIZE_MAX)) return;
+
+	if ((fr_dbuff_in(&sctx.dbuff, (uint32_t)CACHE_SNAPSHOT_MAGIC) <= 0) ||
+	    (fr_dbuff_in(&sctx.dbuff, (uint8_t)CACHE_SNAPSHOT_VERSION) <= 0)) {
+		talloc_free(fr_dbuff_buff(&sctx.dbuff));
+		return;
+	}
+
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		rlm_cache_rbtree_shard_t *shard = &driver->shard[i];
+
+		if (!shard->cache) continue;
+
+		pthread_mutex_lock(&shard->mutex);
+		(void) rbtree_walk(shard->cache, RBTREE_IN_ORDER, _cache_snapshot_entry, &sctx);
+		pthread_mutex_unlock(&shard->mutex);
+	}
+
+	MEM(tmp = talloc_typed_asprintf(NULL, "%s.tmp", driver->snapshot));
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		ERROR("Failed opening cache snapshot \"%s\": %s", tmp, fr_syserror(errno));
+		goto done;
+	}
+
+	p = fr_dbuff_start(&sctx.dbuff);
+	end = fr_dbuff_current(&sctx.dbuff);
+	while (p < end) {
+		ssize_t slen;
+
+		slen = write(fd, p, end - p);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+
+			ERROR("Failed writing cache snapshot \"%s\": %s", tmp, fr_syserror(errno));
+			close(fd);
+			unlink(tmp);
+			goto done;
+		}
+		p += slen;
+	}
+	close(fd);
+
+	if (rename(tmp, driver->snapshot) < 0) {
+		ERROR("Failed renaming cache snapshot \"%s\" to \"%s\": %s",
+		      tmp, driver->snapshot, fr_syserror(errno));
+		unlink(tmp);
+		goto done;
+	}
+
+	DEBUG2("Saved %u cache entries to \"%s\"", sctx.count, driver->snapshot);
+
+done:
+	talloc_free(tmp);
+	talloc_free(fr_dbuff_buff(&sctx.dbuff));
+}
+
+/** Load the entries saved by #cache_snapshot_save
+ *
+ * Entries keep their original expiry time, so they're only served
+ * for the remainder of their TTL.  Any which have expired whilst the
+ * server was down are discarded.  Problems with the snapshot aren't
+ * fatal, the cache just starts out empty.
+ */
+static void cache_snapshot_restore(rlm_cache_rbtree_t *driver)
+{
+	fr_unix_time_t		now = fr_time_to_unix_time(fr_time());
+	struct stat		st;
+	uint8_t			*buff;
+	uint32_t		magic, count = 0;
+	uint8_t			version;
+	ssize_t			slen;
+	int			fd;
+	fr_dbuff_t		dbuff;
+
+	fd = open(driver->snapshot, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) WARN("Failed opening cache snapshot \"%s\": %s",
+					  driver->snapshot, fr_syserror(errno));
+		return;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < 5)) {
+		close(fd);
+		WARN("Ignoring invalid cache snapshot \"%s\"", driver->snapshot);
+		return;
+	}
+
+	MEM(buff = talloc_array(NULL, uint8_t, st.st_size));
+	slen = read(fd, buff, st.st_size);
+	close(fd);
+	if (slen != st.st_size) {
+		WARN("Failed reading cache snapshot \"%s\"", driver->snapshot);
+		talloc_free(buff);
+		return;
+	}
+
+	dbuff = FR_DBUFF_TMP(buff, (size_t)slen);
+	if ((fr_dbuff_out(&magic, &dbuff) <= 0) || (magic != CACHE_SNAPSHOT_MAGIC) ||
+	    (fr_dbuff_out(&version, &dbuff) <= 0) || (version != CACHE_SNAPSHOT_VERSION)) {
+		WARN("Ignoring cache snapshot \"%s\" with unknown format", driver->snapshot);
+		talloc_free(buff);
+		return;
+	}
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		rlm_cache_rbtree_entry_t	*entry;
+		rlm_cache_rbtree_shard_t	*shard;
+		fr_dict_t const			*dict;
+		uint8_t				proto_len;
+		uint16_t			key_len;
+		uint32_t			entry_len;
+		char				proto[UINT8_MAX + 1];
+		uint8_t const			*key;
+
+		if ((fr_dbuff_out(&proto_len, &dbuff) <= 0) ||
+		    (fr_dbuff_out_memcpy((uint8_t *)proto, &dbuff, proto_len) != proto_len)) {
+		truncated:
+			WARN("Cache snapshot \"%s\" is truncated", driver->snapshot);
+			break;
+		}
+		proto[proto_len] = '\0';
+
+		if (fr_dbuff_out(&key_len, &dbuff) <= 0) goto truncated;
+		if (fr_dbuff_remaining(&dbuff) < key_len) goto truncated;
+		key = fr_dbuff_current(&dbuff);
+		fr_dbuff_advance(&dbuff, key_len);
+
+		if (fr_dbuff_out(&entry_len, &dbuff) <= 0) goto truncated;
+		if (fr_dbuff_remaining(&dbuff) < entry_len) goto truncated;
+
+		/*
+		 *	The protocol may no longer be loaded, or the
+		 *	dictionaries may have changed.  Either way,
+		 *	skip the entry.
+		 */
+		dict = fr_dict_by_protocol_name(proto);
+		if (!dict) {
+		skip:
+			fr_dbuff_advance(&dbuff, entry_len);
+			continue;
+		}
+
+		MEM(entry = talloc_zero(NULL, rlm_cache_rbtree_entry_t));
+		entry->heap_id = -1;
+		MEM(entry->fields.key = talloc_memdup(entry, key, key_len));
+		entry->fields.key_len = key_len;
+
+		if ((cache_deserialize_binary(&entry->fields, dict, fr_dbuff_current(&dbuff), entry_len) < 0) ||
+		    (entry->fields.expires < now)) {
+			talloc_free(entry);
+			goto skip;
+		}
+		fr_dbuff_advance(&dbuff, entry_len);
+
+		shard = &driver->shard[fr_hash(key, key_len) & (CACHE_SHARDS - 1)];
+		if (!rbtree_insert(shard->cache, entry)) {
+			talloc_free(entry);
+			continue;
+		}
+		if (fr_heap_insert(shard->heap, entry) < 0) {
+			rbtree_deletebydata(shard->cache, entry);
+			talloc_free(entry);
+			continue;
+		}
+		atomic_fetch_add(&driver->num_entries, 1);
+		count++;
+	}
+	talloc_free(buff);
+
+	INFO("Restored %u cache entries from \"%s\"", count, driver->snapshot);
+}
+
+/** Save the entries every snapshot_interval, until told to stop
+ *
+ */
+static void *cache_snapshot_thread(void *arg)
+{
+	rlm_cache_rbtree_t	*driver = talloc_get_type_abort(arg, rlm_cache_rbtree_t);
+
+	pthread_mutex_lock(&driver->snapshot_mutex);
+	while (!driver->snapshot_stop) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += fr_time_delta_to_sec(driver->snapshot_interval);
+
+		if (pthread_cond_timedwait(&driver->snapshot_cond, &driver->snapshot_mutex, &ts) != ETIMEDOUT) continue;
+
+		pthread_mutex_unlock(&driver->snapshot_mutex);
+		cache_snapshot_save(driver);
+		pthread_mutex_lock(&driver->snapshot_mutex);
+	}
+	pthread_mutex_unlock(&driver->snapshot_mutex);
+
+	return NULL;
+}
+
 /** Cleanup a cache_rbtree instance
  *
  */
 static int mod_detach(void *instance)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
-
-	if (driver->cache) {
-		rbtree_walk(driver->cache, RBTREE_DELETE_ORDER, _cache_entry_free, NULL);
-		talloc_free(driver->cache);
+	rlm_cache_rbtree_t	*driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	int			i;
+
+	if (driver->snapshot_running) {
+		pthread_mutex_lock(&driver->snapshot_mutex);
+		driver->snapshot_stop = true;
+		pthread_cond_signal(&driver->snapshot_cond);
+		pthread_mutex_unlock(&driver->snapshot_mutex);
+
+		pthread_join(driver->snapshot_thread, NULL);
+		pthread_cond_destroy(&driver->snapshot_cond);
+		pthread_mutex_destroy(&driver->snapshot_mutex);
 	}
 
-	pthread_mutex_destroy(&driver->mutex);
+	if (driver->snapshot) cache_snapshot_save(driver);
+
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		rlm_cache_rbtree_shard_t *shard = &driver->shard[i];
+
+		if (!shard->cache) continue;
+
+		rbtree_walk(shard->cache, RBTREE_DELETE_ORDER, _cache_entry_free, NULL);
+		talloc_free(shard->cache);
+		pthread_mutex_destroy(&shard->mutex);
+	}
 
 	return 0;
 }
@@ -106,33 +459,71 @@ static int mod_detach(void *instance)
  *	- 0 on success.
  *	- -1 on failure.
  */
-static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_t	*driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	int			i;
+
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		rlm_cache_rbtree_shard_t *shard = &driver->shard[i];
+
+		/*
+		 *	The heap of entries to expire.
+		 */
+		shard->heap = fr_heap_talloc_alloc(driver, cache_heap_cmp, rlm_cache_rbtree_entry_t, heap_id);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
 
-	/*
-	 *	The cache.
-	 */
-	driver->cache = rbtree_talloc_alloc(NULL, cache_entry_cmp, rlm_cache_rbtree_entry_t, NULL, 0);
-	if (!driver->cache) {
-		ERROR("Failed to create cache");
-		return -1;
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		/*
+		 *	The cache.  Set last, as mod_detach uses
+		 *	it to tell whether the mutex needs to be
+		 *	destroyed.
+		 */
+		shard->cache = rbtree_talloc_alloc(NULL, cache_entry_cmp, rlm_cache_rbtree_entry_t, NULL, 0);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+			pthread_mutex_destroy(&shard->mutex);
+			return -1;
+		}
+		talloc_link_ctx(driver, shard->cache);
 	}
-	talloc_link_ctx(driver, driver->cache);
+
+	if (!driver->snapshot) return 0;
 
 	/*
-	 *	The heap of entries to expire.
+	 *	Each server process has its own cache, so each
+	 *	needs its own snapshot.
 	 */
-	driver->heap = fr_heap_talloc_alloc(driver, cache_heap_cmp, rlm_cache_rbtree_entry_t, heap_id);
-	if (!driver->heap) {
-		ERROR("Failed to create heap for the cache");
+	if (main_config->processes > 1) {
+		driver->snapshot = talloc_typed_asprintf(driver, "%s.%u", driver->snapshot, main_config->process_index);
+		if (!driver->snapshot) return -1;
+	}
+
+	cache_snapshot_restore(driver);
+
+	if (!driver->snapshot_interval) return 0;
+
+	if (fr_time_delta_to_sec(driver->snapshot_interval) < 1) {
+		cf_log_err(conf, "snapshot_interval must be at least 1 second");
 		return -1;
 	}
 
-	if (pthread_mutex_init(&driver->mutex, NULL) < 0) {
-		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+	pthread_mutex_init(&driver->snapshot_mutex, NULL);
+	pthread_cond_init(&driver->snapshot_cond, NULL);
+	if (fr_schedule_pthread_create(&driver->snapshot_thread, cache_snapshot_thread, driver) < 0) {
+		PERROR("Failed creating cache snapshot thread");
+		pthread_cond_destroy(&driver->snapshot_cond);
+		pthread_mutex_destroy(&driver->snapshot_mutex);
 		return -1;
 	}
+	driver->snapshot_running = true;
 
 	return 0;
 }
@@ -158,36 +549,63 @@ static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *con
 	return (rlm_cache_entry_t *)c;
 }
 
-/** Locate a cache entry
+/** Lock the shard responsible for a key
  *
- * @note handle not used except for sanity checks.
+ * @param[in] driver	instance.
+ * @param[in] handle	for the current request.
+ * @param[in] key	we're about to operate on.
+ * @param[in] key_len	Length of the key.
+ * @return the shard, locked.
+ */
+static rlm_cache_rbtree_shard_t *cache_shard_lock(rlm_cache_rbtree_t *driver, rlm_cache_rbtree_handle_t *handle,
+						  uint8_t const *key, size_t key_len)
+{
+	rlm_cache_rbtree_shard_t *shard = &driver->shard[fr_hash(key, key_len) & (CACHE_SHARDS - 1)];
+
+	if (handle->shard == shard) return shard;
+
+	/*
+	 *	Shouldn't happen, as rlm_cache uses a single key
+	 *	per acquire.  But don't deadlock if it does.
+	 */
+	if (!fr_cond_assert(!handle->shard)) pthread_mutex_unlock(&handle->shard->mutex);
+
+	pthread_mutex_lock(&shard->mutex);
+	handle->shard = shard;
+
+	return shard;
+}
+
+/** Locate a cache entry
  *
  * @copydetails cache_entry_find_t
  */
 static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
-				       UNUSED rlm_cache_config_t const *config, void *instance,
-				       request_t *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+				       rlm_cache_config_t const *config, void *instance,
+				       request_t *request, void *handle, uint8_t const *key, size_t key_len)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_t		*driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t	*shard;
+	rlm_cache_entry_t		*c;
 
-	rlm_cache_entry_t *c;
-
-	fr_assert(driver->cache);
+	shard = cache_shard_lock(driver, handle, key, key_len);
 
 	/*
-	 *	Clear out old entries
+	 *	Clear out old entries, which are too old to
+	 *	even be served stale.
 	 */
-	c = fr_heap_peek(driver->heap);
-	if (c && (c->expires < fr_time_to_unix_time(request->packet->timestamp))) {
-		fr_heap_extract(driver->heap, c);
-		rbtree_deletebydata(driver->cache, c);
+	c = fr_heap_peek(shard->heap);
+	if (c && ((c->expires + fr_unix_time_from_sec(config->stale)) < fr_time_to_unix_time(request->packet->timestamp))) {
+		fr_heap_extract(shard->heap, c);
+		rbtree_deletebydata(shard->cache, c);
 		talloc_free(c);
+		atomic_fetch_sub(&driver->num_entries, 1);
 	}
 
 	/*
 	 *	Is there an entry for this key?
 	 */
-	c = rbtree_finddata(driver->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	c = rbtree_finddata(shard->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
 	if (!c) {
 		*out = NULL;
 		return CACHE_MISS;
@@ -198,33 +616,33 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 }
 
 /** Free an entry and remove it from the data store
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_expire_t
  */
 static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
-					 request_t *request, UNUSED void *handle,
+					 request_t *request, void *handle,
 					 uint8_t const *key, size_t key_len)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
-	rlm_cache_entry_t *c;
+	rlm_cache_rbtree_t		*driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t	*shard;
+	rlm_cache_entry_t		*c;
 
 	if (!request) return CACHE_ERROR;
 
-	c = rbtree_finddata(driver->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	shard = cache_shard_lock(driver, handle, key, key_len);
+
+	c = rbtree_finddata(shard->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
 	if (!c) return CACHE_MISS;
 
-	fr_heap_extract(driver->heap, c);
-	rbtree_deletebydata(driver->cache, c);
+	fr_heap_extract(shard->heap, c);
+	rbtree_deletebydata(shard->cache, c);
 	talloc_free(c);
+	atomic_fetch_sub(&driver->num_entries, 1);
 
 	return CACHE_OK;
 }
 
 /** Insert a new entry into the data store
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_insert_t
  */
@@ -232,64 +650,68 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
 					 request_t *request, void *handle,
 					 rlm_cache_entry_t const *c)
 {
-	cache_status_t status;
+	cache_status_t			status;
 
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
-	rlm_cache_entry_t *my_c;
-
-	fr_assert(handle == request);
+	rlm_cache_rbtree_t		*driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t	*shard;
+	rlm_cache_entry_t		*my_c;
 
 	if (!request) return CACHE_ERROR;
 
 	memcpy(&my_c, &c, sizeof(my_c));
 
+	shard = cache_shard_lock(driver, handle, c->key, c->key_len);
+
 	/*
 	 *	Allow overwriting
 	 */
-	if (!rbtree_insert(driver->cache, my_c)) {
+	if (!rbtree_insert(shard->cache, my_c)) {
 		status = cache_entry_expire(config, instance, request, handle, c->key, c->key_len);
 		if ((status != CACHE_OK) && !fr_cond_assert(0)) return CACHE_ERROR;
 
-		if (!rbtree_insert(driver->cache, my_c)) {
+		if (!rbtree_insert(shard->cache, my_c)) {
 			RERROR("Failed adding entry");
 
 			return CACHE_ERROR;
 		}
 	}
 
-	if (fr_heap_insert(driver->heap, my_c) < 0) {
-		rbtree_deletebydata(driver->cache, my_c);
+	if (fr_heap_insert(shard->heap, my_c) < 0) {
+		rbtree_deletebydata(shard->cache, my_c);
 		RERROR("Failed adding entry to expiry heap");
 
 		return CACHE_ERROR;
 	}
+	atomic_fetch_add(&driver->num_entries, 1);
 
 	return CACHE_OK;
 }
 
 /** Update the TTL of an entry
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_set_ttl_t
  */
 static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
-					  request_t *request, UNUSED void *handle,
+					  request_t *request, void *handle,
 					  rlm_cache_entry_t *c)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_t		*driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t	*shard;
 
 #ifdef NDEBUG
 	if (!request) return CACHE_ERROR;
 #endif
 
-	if (!fr_cond_assert(fr_heap_extract(driver->heap, c) == 0)) {
+	shard = cache_shard_lock(driver, handle, c->key, c->key_len);
+
+	if (!fr_cond_assert(fr_heap_extract(shard->heap, c) == 0)) {
 		RERROR("Entry not in heap");
 		return CACHE_ERROR;
 	}
 
-	if (fr_heap_insert(driver->heap, c) < 0) {
-		rbtree_deletebydata(driver->cache, c);	/* make sure we don't leak entries... */
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		rbtree_deletebydata(shard->cache, c);	/* make sure we don't leak entries... */
+		atomic_fetch_sub(&driver->num_entries, 1);
 		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
 		return CACHE_ERROR;
 	}
@@ -297,8 +719,6 @@ static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *confi
 }
 
 /** Return the number of entries in the cache
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_count_t
  */
@@ -309,43 +729,39 @@ static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void
 
 	if (!request) return CACHE_ERROR;
 
-	return rbtree_num_elements(driver->cache);
+	return atomic_load(&driver->num_entries);
 }
 
-/** Lock the rbtree
- *
- * @note handle not used except for sanity checks.
+/** Allocate a handle to track which shard we lock
  *
  * @copydetails cache_acquire_t
  */
-static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
 			 request_t *request)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
-
-	pthread_mutex_lock(&driver->mutex);
+	rlm_cache_rbtree_handle_t *h;
 
-	*handle = request;		/* handle is unused, this is just for sanity checking */
-
-	RDEBUG3("Mutex acquired");
+	MEM(h = talloc_zero(request, rlm_cache_rbtree_handle_t));
+	*handle = h;
 
 	return 0;
 }
 
-/** Release an entry unlocking any mutexes
- *
- * @note handle not used except for sanity checks.
+/** Unlock the shard we locked (if any), and free the handle
  *
  * @copydetails cache_release_t
  */
-static void cache_release(UNUSED rlm_cache_config_t const *config, void *instance, request_t *request,
-			  UNUSED rlm_cache_handle_t *handle)
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  rlm_cache_handle_t *handle)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_handle_t *h = talloc_get_type_abort(handle, rlm_cache_rbtree_handle_t);
 
-	pthread_mutex_unlock(&driver->mutex);
+	if (h->shard) {
+		pthread_mutex_unlock(&h->shard->mutex);
+		RDEBUG3("Mutex released");
+	}
 
-	RDEBUG3("Mutex released");
+	talloc_free(h);
 }
 
 extern rlm_cache_driver_t rlm_cache_rbtree;
@@ -355,6 +771,7 @@ rlm_cache_driver_t rlm_cache_rbtree = {
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
 	.inst_size	= sizeof(rlm_cache_rbtree_t),
+	.config		= driver_config,
 	.alloc		= cache_entry_alloc,
 
 	.find		= cache_entry_find,
@@ -29,21 +29,24 @@
 #include "../../rlm_cache.h"
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
-static CONF_PARSER driver_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
-
 typedef struct {
 	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
 						//!< Must be first field in this struct.
 
+	bool			read_replicas;	//!< Send lookups to replicas.
+
 	tmpl_t		*created_attr;	//!< LHS of the Cache-Created map.
 	tmpl_t		*expires_attr;	//!< LHS of the Cache-Expires map.
 
 	fr_redis_cluster_t	*cluster;
 } rlm_cache_redis_t;
 
+static CONF_PARSER driver_config[] = {
+	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("read_replicas", FR_TYPE_BOOL, rlm_cache_redis_t, read_replicas), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
 static fr_dict_t const *dict_freeradius;
 
 extern fr_dict_autoload_t rlm_cache_redis_dict[];
@@ -144,7 +147,8 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 #endif
 	rlm_cache_entry_t		*c;
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, key, key_len, false);
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, key, key_len,
+						 driver->read_replicas);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
 		/*
@@ -256,7 +260,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
 					 request_t *request, UNUSED void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_redis_t	*driver = instance;
@@ -387,12 +391,16 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		 *	Set the expiry time and close out the transaction.
 		 */
 		if (c->expires > 0) {
+			/*
+			 *	Keep the entry around for long enough
+			 *	that it can be served stale.
+			 */
+			uint64_t expires = fr_unix_time_to_sec(c->expires) + config->stale;
+
 			RDEBUG3("EXPIREAT \"%pV\" %" PRIu64,
-				fr_box_strvalue_len((char const *)c->key, c->key_len),
-				fr_unix_time_to_sec(c->expires));
+				fr_box_strvalue_len((char const *)c->key, c->key_len), expires);
 			if (redisAppendCommand(conn->handle, "EXPIREAT %b %" PRIu64, c->key,
-					       c->key_len,
-					       fr_unix_time_to_sec(c->expires)) != REDIS_OK) goto append_error;
+					       c->key_len, expires) != REDIS_OK) goto append_error;
 			pipelined++;
 			RDEBUG3("EXEC");
 			if (redisAppendCommand(conn->handle, "EXEC") != REDIS_OK) goto append_error;
@@ -40,6 +40,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("driver", FR_TYPE_STRING, rlm_cache_config_t, driver_name), .dflt = "rlm_cache_rbtree" },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_cache_config_t, key) },
 	{ FR_CONF_OFFSET("ttl", FR_TYPE_UINT32, rlm_cache_config_t, ttl), .dflt = "500" },
+	{ FR_CONF_OFFSET("stale", FR_TYPE_UINT32, rlm_cache_config_t, stale), .dflt = "0" },
 	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_cache_config_t, max_entries), .dflt = "0" },
 
 	/* Should be a type which matches time_t, @fixme before 2038 */
@@ -62,6 +63,7 @@ static fr_dict_attr_t const *attr_cache_allow_merge;
 static fr_dict_attr_t const *attr_cache_allow_insert;
 static fr_dict_attr_t const *attr_cache_ttl;
 static fr_dict_attr_t const *attr_cache_entry_hits;
+static fr_dict_attr_t const *attr_cache_stale;
 
 extern fr_dict_attr_autoload_t rlm_cache_dict_attr[];
 fr_dict_attr_autoload_t rlm_cache_dict_attr[] = {
@@ -71,6 +73,7 @@ fr_dict_attr_autoload_t rlm_cache_dict_attr[] = {
 	{ .out = &attr_cache_allow_insert, .name = "Cache-Allow-Insert", .type = FR_TYPE_BOOL, .dict = &dict_freeradius },
 	{ .out = &attr_cache_ttl, .name = "Cache-TTL", .type = FR_TYPE_INT32, .dict = &dict_freeradius },
 	{ .out = &attr_cache_entry_hits, .name = "Cache-Entry-Hits", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ .out = &attr_cache_stale, .name = "Cache-Stale", .type = FR_TYPE_BOOL, .dict = &dict_freeradius },
 	{ NULL }
 };
 
@@ -192,7 +195,17 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
 		RLM_MODULE_OK;
 }
 
+static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
+				     rlm_cache_t const *inst, request_t *request,
+				     rlm_cache_handle_t **handle, rlm_cache_entry_t *c);
+
 /** Find a cached entry.
+ *
+ * If the entry has expired, but is still within the "stale" window, it's
+ * returned as a hit.  The first request to see the stale entry has
+ * &request.Cache-Stale added, and the entry's expiry is pushed out by
+ * #CACHE_STALE_REFRESH seconds, so that concurrent requests keep using
+ * the stale entry while that one request refreshes it.
  *
  * @return
  *	- #RLM_MODULE_OK on cache hit.
@@ -206,6 +219,7 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 	cache_status_t ret;
 
 	rlm_cache_entry_t *c;
+	fr_unix_time_t now;
 
 	*out = NULL;
 
@@ -232,11 +246,41 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 		break;
 	}
 
+	/*
+	 *	It expired, but we're allowed to serve stale entries.
+	 *	Hand it back, and let the caller know it needs
+	 *	refreshing.
+	 */
+	now = fr_time_to_unix_time(request->packet->timestamp);
+	if ((c->expires < now) && (c->created >= fr_unix_time_from_sec(inst->config.epoch)) &&
+	    ((c->expires + fr_unix_time_from_sec(inst->config.stale)) >= now)) {
+		rlm_rcode_t	tmp;
+		fr_pair_t	*vp;
+
+		RDEBUG2("Found stale entry for \"%pV\", requesting refresh",
+			fr_box_strvalue_len((char const *)key, key_len));
+
+		c->expires = now + fr_unix_time_from_sec(CACHE_STALE_REFRESH);
+		cache_set_ttl(&tmp, inst, request, handle, c);
+		if (tmp == RLM_MODULE_FAIL) {
+			cache_free(inst, &c);
+			RETURN_MODULE_FAIL;
+		}
+
+		MEM(pair_update_request(&vp, attr_cache_stale) >= 0);
+		vp->vp_bool = true;
+
+		c->hits++;
+		*out = c;
+
+		RETURN_MODULE_OK;
+	}
+
 	/*
 	 *	Yes, but it expired, OR the "forget all" epoch has
 	 *	passed.  Delete it, and pretend it doesn't exist.
 	 */
-	if ((c->expires < fr_time_to_unix_time(request->packet->timestamp)) ||
+	if ((c->expires < now) ||
 	    (c->created < fr_unix_time_from_sec(inst->config.epoch))) {
 		RDEBUG2("Found entry for \"%pV\", but it expired %pV seconds ago.  Removing it",
 			fr_box_strvalue_len((char const *)key, key_len),
@@ -361,6 +405,7 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 			case FR_CACHE_STATUS_ONLY:
 			case FR_CACHE_MERGE_NEW:
 			case FR_CACHE_ENTRY_HITS:
+			case FR_CACHE_STALE:
 				RDEBUG2("Skipping %s", vp->da->name);
 				continue;
 
@@ -53,11 +53,17 @@ typedef struct {
 	char const		*driver_name;		//!< Driver name.
 	tmpl_t		*key;			//!< What to expand to get the value of the key.
 	uint32_t		ttl;			//!< How long an entry is valid for.
+	uint32_t		stale;			//!< How long an expired entry may still be served for.
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
 } rlm_cache_config_t;
 
+/** How long a stale entry is given to be refreshed, before another request is asked to refresh it
+ *
+ */
+#define CACHE_STALE_REFRESH	5
+
 /*
  *	Define a structure for our module configuration.
  *
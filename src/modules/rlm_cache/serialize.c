@@ -177,3 +177,195 @@ int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssi
 
 	return 0;
 }
+
+/** Version of the binary serialization format
+ *
+ * Bump this if the layout below changes.  Entries with a different
+ * version are rejected, and treated by the caller as invalid.
+ */
+#define CACHE_SERIALIZE_VERSION	(1)
+
+/** Dictionary an attribute was encoded from
+ *
+ */
+enum {
+	CACHE_SERIALIZE_DICT_PROTO = 0,		//!< The dictionary of the request.
+	CACHE_SERIALIZE_DICT_INTERNAL		//!< The internal dictionary.
+};
+
+/** Serialize a cache entry in a compact binary format
+ *
+ * All integers are in network byte order.
+ *
+ @verbatim
+   header:	uint8 version, int64 created, int64 expires
+   map:		uint8 request, uint8 list, uint8 op, uint8 dict, uint8 depth,
+		uint32 attr[depth], uint32 value length, value
+ @endverbatim
+ *
+ * Neither the attribute names nor the values are printed, so the
+ * entry can be decoded without tokenizing anything.
+ *
+ * @param[in] ctx	to alloc the buffer in.
+ * @param[out] out	Where to write the serialized entry.
+ * @param[out] outlen	Length of the serialized entry.
+ * @param[in] c		Cache entry to serialize.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, size_t *outlen, rlm_cache_entry_t const *c)
+{
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	map_t			*map;
+
+	if (!fr_dbuff_init_talloc(ctx, &dbuff, &tctx, 256, SIZE_MAX)) return -1;
+
+	if ((fr_dbuff_in(&dbuff, (uint8_t)CACHE_SERIALIZE_VERSION) <= 0) ||
+	    (fr_dbuff_in(&dbuff, (int64_t)c->created) <= 0) ||
+	    (fr_dbuff_in(&dbuff, (int64_t)c->expires) <= 0)) {
+	oom:
+		fr_strerror_const("Out of memory");
+	error:
+		talloc_free(fr_dbuff_buff(&dbuff));
+		return -1;
+	}
+
+	for (map = c->maps; map; map = map->next) {
+		fr_dict_attr_t const	*da = tmpl_da(map->lhs);
+		fr_dict_attr_t const	*p;
+		fr_dbuff_marker_t	len_m;
+		uint32_t		attr[FR_DICT_MAX_TLV_STACK];
+		unsigned int		i;
+		ssize_t			slen;
+
+		if (da->flags.is_unknown || (da->depth > NUM_ELEMENTS(attr))) {
+			fr_strerror_printf("Can't serialize attribute \"%s\"", da->name);
+			goto error;
+		}
+
+		for (p = da, i = da->depth; i > 0; p = p->parent, i--) attr[i - 1] = p->attr;
+
+		if ((fr_dbuff_in(&dbuff, (uint8_t)tmpl_request(map->lhs)) <= 0) ||
+		    (fr_dbuff_in(&dbuff, (uint8_t)tmpl_list(map->lhs)) <= 0) ||
+		    (fr_dbuff_in(&dbuff, (uint8_t)map->op) <= 0) ||
+		    (fr_dbuff_in(&dbuff, (uint8_t)((fr_dict_by_da(da) == fr_dict_internal()) ?
+						   CACHE_SERIALIZE_DICT_INTERNAL : CACHE_SERIALIZE_DICT_PROTO)) <= 0) ||
+		    (fr_dbuff_in(&dbuff, (uint8_t)da->depth) <= 0)) goto oom;
+
+		for (i = 0; i < da->depth; i++) if (fr_dbuff_in(&dbuff, attr[i]) <= 0) goto oom;
+
+		/*
+		 *	Leave space for the length, and fill it
+		 *	in once we know how long the value is.
+		 */
+		fr_dbuff_marker(&len_m, &dbuff);
+		if (fr_dbuff_in(&dbuff, (uint32_t)0) <= 0) goto oom;
+
+		slen = fr_value_box_to_network(&dbuff, tmpl_value(map->rhs));
+		if (slen < 0) {
+			fr_dbuff_marker_release(&len_m);
+			fr_strerror_printf_push("Failed serializing value of \"%s\"", da->name);
+			goto error;
+		}
+
+		fr_dbuff_in(&len_m, (uint32_t)slen);
+		fr_dbuff_marker_release(&len_m);
+	}
+
+	*out = fr_dbuff_buff(&dbuff);
+	*outlen = fr_dbuff_used(&dbuff);
+
+	return 0;
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param[in] c		Cache entry to populate (should already be allocated)
+ * @param[in] dict	to use for protocol attributes.
+ * @param[in] in	Entry produced by #cache_serialize_binary.
+ * @param[in] inlen	Length of the entry.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen)
+{
+	fr_dbuff_t	dbuff = FR_DBUFF_TMP(in, inlen);
+	map_t		**last = &c->maps;
+	uint8_t		version;
+	int64_t		created, expires;
+
+	if ((fr_dbuff_out(&version, &dbuff) <= 0) || (version != CACHE_SERIALIZE_VERSION)) {
+		fr_strerror_const("Unknown serialization version");
+		return -1;
+	}
+
+	if ((fr_dbuff_out(&created, &dbuff) <= 0) || (fr_dbuff_out(&expires, &dbuff) <= 0)) {
+	truncated:
+		fr_strerror_const("Serialized entry is truncated");
+		return -1;
+	}
+	c->created = created;
+	c->expires = expires;
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		uint8_t			request_ref, list, op, dict_type, depth, i;
+		uint32_t		num, len;
+		fr_dict_attr_t const	*da;
+		map_t			*map;
+		char			buffer[256];
+
+		if ((fr_dbuff_out(&request_ref, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&list, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&op, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&dict_type, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&depth, &dbuff) <= 0)) goto truncated;
+
+		da = fr_dict_root((dict_type == CACHE_SERIALIZE_DICT_INTERNAL) ? fr_dict_internal() : dict);
+		for (i = 0; i < depth; i++) {
+			if (fr_dbuff_out(&num, &dbuff) <= 0) goto truncated;
+
+			da = fr_dict_attr_child_by_num(da, num);
+			if (!da) {
+				fr_strerror_printf("Unknown attribute number %u in serialized entry", num);
+				return -1;
+			}
+		}
+
+		if (fr_dbuff_out(&len, &dbuff) <= 0) goto truncated;
+		if (len > fr_dbuff_remaining(&dbuff)) goto truncated;
+
+		MEM(map = talloc_zero(c, map_t));
+		map->op = op;
+
+		MEM(map->lhs = tmpl_alloc(map, TMPL_TYPE_ATTR, T_BARE_WORD, NULL, 0));
+		tmpl_attr_set_leaf_da(map->lhs, da);
+		tmpl_attr_set_leaf_num(map->lhs, NUM_ANY);
+		tmpl_attr_set_request(map->lhs, request_ref);
+		tmpl_attr_set_list(map->lhs, list);
+
+		tmpl_print(&FR_SBUFF_OUT(buffer, sizeof(buffer)), map->lhs, TMPL_ATTR_REF_PREFIX_NO, NULL);
+		tmpl_set_name(map->lhs, T_BARE_WORD, buffer, -1);
+
+		MEM(map->rhs = tmpl_alloc(map, TMPL_TYPE_DATA, T_BARE_WORD, NULL, -1));
+		if (fr_value_box_from_network(map->rhs, tmpl_value(map->rhs), da->type, da,
+					      fr_dbuff_current(&dbuff), len, true) < 0) {
+			fr_strerror_printf_push("Failed deserializing value of \"%s\"", da->name);
+			talloc_free(map);
+			return -1;
+		}
+		fr_dbuff_advance(&dbuff, len);
+
+		tmpl_set_name_printf(map->rhs, (da->type == FR_TYPE_STRING) ? T_SINGLE_QUOTED_STRING : T_BARE_WORD,
+				     "%pV", tmpl_value(map->rhs));
+
+		MAP_VERIFY(map);
+
+		*last = map;
+		last = &(*last)->next;
+	}
+
+	return 0;
+}
@@ -29,6 +29,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/tls/base.h>
 
@@ -91,8 +92,33 @@ typedef struct {
 
 	EVP_MD_CTX		*evp_md_ctx;			//!< Pre-allocated evp_md_ctx for sign and verify.
 	uint8_t			*digest_buff;			//!< Pre-allocated digest buffer.
+
+	fr_offload_thread_t	*offload;			//!< NULL if offload is disabled.
 } rlm_cipher_rsa_thread_inst_t;
 
+/** A private key operation, run in an offload thread
+ *
+ * Everything the operation needs is allocated by the worker, so
+ * the offload thread doesn't need to allocate memory.
+ */
+typedef struct {
+	EVP_PKEY_CTX		*evp_pkey_ctx;			//!< Copy of the worker's evp_pkey_ctx.
+	int			(*op)(EVP_PKEY_CTX *ctx,
+				      unsigned char *out, size_t *outlen,
+				      unsigned char const *in, size_t inlen);	//!< EVP_PKEY_sign or EVP_PKEY_decrypt.
+	char const		*action;			//!< What we were doing, for error messages.
+	fr_type_t		type;				//!< Type of box to return the output in.
+
+	uint8_t			*in;				//!< Digest or ciphertext.
+	size_t			in_len;
+
+	uint8_t			*out;				//!< Signature or plaintext.
+	size_t			out_len;
+
+	unsigned long		error;				//!< First OpenSSL error, if op failed.
+	bool			failed;
+} cipher_rsa_job_t;
+
 /** Configuration for the OAEP padding method
  *
  */
@@ -130,6 +156,9 @@ typedef struct {
 	char const		*xlat_name;			//!< Name of xlat we registered.
 	cipher_type_t		type;				//!< Type of encryption to use.
 
+	fr_offload_conf_t	offload_conf;			//!< Threads to run private key operations in.
+	fr_offload_t		*offload;			//!< NULL if offload is disabled.
+
 	/** Supported cipher types
 	 *
 	 */
@@ -174,6 +203,7 @@ static const CONF_PARSER rsa_config[] = {
  */
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("type", FR_TYPE_VOID | FR_TYPE_NOT_EMPTY, rlm_cipher_t, type), .func = cipher_type_parse, .dflt = "rsa" },
+	{ FR_CONF_OFFSET("offload", FR_TYPE_SUBSECTION, rlm_cipher_t, offload_conf), .subcs = (void const *) fr_offload_config },
 	{ FR_CONF_OFFSET("rsa", FR_TYPE_SUBSECTION, rlm_cipher_t, rsa),
 			 .subcs_size = sizeof(cipher_rsa_t), .subcs_type = "cipher_rsa_t", .subcs = (void const *) rsa_config },
 
@@ -453,6 +483,106 @@ static int cipher_rsa_certificate_file_load(TALLOC_CTX *ctx, void *out, UNUSED v
 	return 0;
 }
 
+static int _evp_pkey_ctx_free(EVP_PKEY_CTX *evp_pkey_ctx);
+
+/** Run a private key operation in an offload thread
+ *
+ */
+static void cipher_rsa_job_run(void *uctx)
+{
+	cipher_rsa_job_t	*job = uctx;
+
+	if (job->op(job->evp_pkey_ctx, job->out, &job->out_len, job->in, job->in_len) <= 0) {
+		job->failed = true;
+		job->error = ERR_get_error();
+	}
+
+	/*
+	 *	The error queue is per-thread, so it
+	 *	would otherwise build up in the offload
+	 *	thread.
+	 */
+	ERR_clear_error();
+}
+
+/** Return the result of an offloaded private key operation
+ *
+ */
+static xlat_action_t cipher_rsa_job_resume(TALLOC_CTX *ctx, fr_cursor_t *out,
+					   request_t *request, UNUSED void const *xlat_inst,
+					   UNUSED void *xlat_thread_inst, UNUSED fr_value_box_t **in, void *rctx)
+{
+	cipher_rsa_job_t	*job = talloc_get_type_abort(rctx, cipher_rsa_job_t);
+	fr_value_box_t		*vb;
+
+	if (job->failed) {
+		char buffer[256];
+
+		ERR_error_string_n(job->error, buffer, sizeof(buffer));
+		REDEBUG("Failed %s: %s", job->action, buffer);
+		return XLAT_ACTION_FAIL;
+	}
+
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	if (job->type == FR_TYPE_STRING) {
+		RHEXDUMP3(job->out, job->out_len, "Plaintext (%zu bytes)", job->out_len);
+		MEM(fr_value_box_bstrndup(vb, vb, NULL, (char const *)job->out, job->out_len, true) == 0);
+	} else {
+		MEM(fr_value_box_memdup(vb, vb, NULL, job->out, job->out_len, false) == 0);
+	}
+	fr_cursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
+}
+
+/** Queue a private key operation for the offload threads
+ *
+ * The worker's evp_pkey_ctx can't be shared with the offload thread,
+ * as the worker may use it for another request in the meantime, so
+ * the operation gets a copy.
+ */
+static xlat_action_t cipher_rsa_job_yield(TALLOC_CTX *ctx, fr_cursor_t *out,
+					  request_t *request, void const *xlat_inst, void *xlat_thread_inst,
+					  fr_value_box_t **in, fr_offload_thread_t *ot,
+					  EVP_PKEY_CTX *evp_pkey_ctx, int (*op)(EVP_PKEY_CTX *ctx,
+										unsigned char *out, size_t *outlen,
+										unsigned char const *in, size_t inlen),
+					  char const *action, fr_type_t type, uint8_t const *data, size_t data_len)
+{
+	cipher_rsa_job_t	*job;
+
+	/*
+	 *	Parented by NULL, as it's freed by the
+	 *	offload code once we've resumed.
+	 */
+	MEM(job = talloc_zero(NULL, cipher_rsa_job_t));
+	job->evp_pkey_ctx = EVP_PKEY_CTX_dup(evp_pkey_ctx);
+	if (!job->evp_pkey_ctx) {
+		fr_tls_log_error(request, "Failed copying EVP_PKEY_CTX");
+		talloc_free(job);
+		return XLAT_ACTION_FAIL;
+	}
+	talloc_set_type(job->evp_pkey_ctx, EVP_PKEY_CTX);
+	job->evp_pkey_ctx = talloc_steal(job, job->evp_pkey_ctx);
+	talloc_set_destructor(job->evp_pkey_ctx, _evp_pkey_ctx_free);
+
+	job->op = op;
+	job->action = action;
+	job->type = type;
+	MEM(job->in = talloc_memdup(job, data, data_len));
+	job->in_len = data_len;
+
+	/*
+	 *	The output of a private key operation is
+	 *	never larger than the key.
+	 */
+	job->out_len = EVP_PKEY_size(EVP_PKEY_CTX_get0_pkey(evp_pkey_ctx));
+	MEM(job->out = talloc_array(job, uint8_t, job->out_len));
+
+	return fr_offload_xlat_yield(ctx, out, request, xlat_inst, xlat_thread_inst, in,
+				     ot, cipher_rsa_job_run, cipher_rsa_job_resume, job);
+}
+
 /** Encrypt input data
  *
  * Arguments are @verbatim(<plaintext>...)@endverbatim
@@ -580,8 +710,14 @@ static xlat_action_t cipher_rsa_sign_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
 	fr_assert((size_t)digest_len == talloc_array_length(xt->digest_buff));
 
 	/*
-	 *	Then sign the digest
+	 *	Then sign the digest, in an offload
+	 *	thread if we have one.
 	 */
+	if (xt->offload) return cipher_rsa_job_yield(ctx, out, request, xlat_inst, xlat_thread_inst, in,
+						     xt->offload, xt->evp_sign_ctx, EVP_PKEY_sign,
+						     "signing message digest", FR_TYPE_OCTETS,
+						     xt->digest_buff, (size_t)digest_len);
+
 	if (EVP_PKEY_sign(xt->evp_sign_ctx, NULL, &sig_len, xt->digest_buff, (size_t)digest_len) <= 0) {
 		fr_tls_log_error(request, "Failed getting length of digest");
 		return XLAT_ACTION_FAIL;
@@ -613,7 +749,7 @@ static xlat_action_t cipher_rsa_sign_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
  * @ingroup xlat_functions
  */
 static xlat_action_t cipher_rsa_decrypt_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
-					     request_t *request, UNUSED void const *xlat_inst, void *xlat_thread_inst,
+					     request_t *request, void const *xlat_inst, void *xlat_thread_inst,
 					     fr_value_box_t **in)
 {
 	rlm_cipher_rsa_thread_inst_t	*xt = talloc_get_type_abort(*((void **)xlat_thread_inst),
@@ -643,6 +779,11 @@ static xlat_action_t cipher_rsa_decrypt_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
 	 *	Decrypt the ciphertext
 	 */
 	RHEXDUMP3(ciphertext, ciphertext_len, "Ciphertext (%zu bytes)", ciphertext_len);
+	if (xt->offload) return cipher_rsa_job_yield(ctx, out, request, xlat_inst, xlat_thread_inst, in,
+						     xt->offload, xt->evp_decrypt_ctx, EVP_PKEY_decrypt,
+						     "decrypting ciphertext", FR_TYPE_STRING,
+						     ciphertext, ciphertext_len);
+
 	if (EVP_PKEY_decrypt(xt->evp_decrypt_ctx, NULL, &plaintext_len, ciphertext, ciphertext_len) <= 0) {
 		fr_tls_log_error(request, "Failed getting length of cleartext");
 		return XLAT_ACTION_FAIL;
@@ -1076,8 +1217,21 @@ static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance,
 
 	switch (inst->type) {
 	case RLM_CIPHER_TYPE_RSA:
+	{
+		rlm_cipher_rsa_thread_inst_t *ti = thread;
+
 		talloc_set_type(thread, rlm_cipher_rsa_thread_inst_t);
-		return cipher_rsa_thread_instantiate(conf, instance, el, thread);
+		if (cipher_rsa_thread_instantiate(conf, instance, el, thread) < 0) return -1;
+
+		if (!inst->offload) return 0;
+
+		ti->offload = fr_offload_thread_alloc(ti, inst->offload, el);
+		if (!ti->offload) {
+			PERROR("Failed setting up offload");
+			return -1;
+		}
+		return 0;
+	}
 
 	case RLM_CIPHER_TYPE_INVALID:
 		fr_assert(0);
@@ -1199,6 +1353,27 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/** Start the threads private key operations are offloaded to
+ *
+ */
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_cipher_t	*inst = talloc_get_type_abort(instance, rlm_cipher_t);
+
+	if (!inst->offload_conf.threads) return 0;
+
+	FR_INTEGER_BOUND_CHECK("offload.threads", inst->offload_conf.threads, <=, 128);
+	FR_INTEGER_BOUND_CHECK("offload.max_queued", inst->offload_conf.max_queued, >=, 1);
+
+	inst->offload = fr_offload_alloc(inst, &inst->offload_conf);
+	if (!inst->offload) {
+		cf_log_perr(conf, "Failed starting offload threads");
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  *	The module name should be the only globally exported symbol.
  *	That is, everything else should be 'static'.
@@ -1217,5 +1392,6 @@ module_t rlm_cipher = {
 	.thread_inst_size	= sizeof(rlm_cipher_rsa_thread_inst_t),
 	.config			= module_config,
 	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
 	.thread_instantiate	= mod_thread_instantiate,
 };
@@ -364,6 +364,67 @@ lcb_error_t couchbase_get_key(lcb_t instance, const void *cookie, const char *ke
 	return error;
 }
 
+/** Retrieve multiple documents by key from Couchbase
+ *
+ * Setup a Couchbase get request for each key, and wait for all of the results.
+ * The requests are all scheduled before we enter the event loop, so libcouchbase
+ * sends them to the servers together, rather than waiting for each response in turn.
+ *
+ * @param  instance Couchbase connection instance.
+ * @param  cookies  Array of num cookies.  The document for keys[i] is written to cookies[i].
+ * @param  keys     Array of num document keys to fetch.
+ * @param  num      Number of documents to fetch.
+ * @return          Couchbase error object.
+ */
+lcb_error_t couchbase_get_keys(lcb_t instance, cookie_t *cookies, char const **keys, size_t num)
+{
+	lcb_error_t error = LCB_SUCCESS;     /* couchbase command return */
+	lcb_get_cmd_t cmd;                   /* get command struct */
+	const lcb_get_cmd_t *commands[1];    /* get commands array */
+	size_t i, scheduled;                 /* counters */
+
+	/* init commands */
+	commands[0] = &cmd;
+
+	for (scheduled = 0; scheduled < num; scheduled++) {
+		cookie_t *c = &cookies[scheduled];
+
+		memset(&cmd, 0, sizeof(cmd));
+
+		/* populate command struct */
+		cmd.v.v0.key = keys[scheduled];
+		cmd.v.v0.nkey = strlen(cmd.v.v0.key);
+
+		/* clear cookie */
+		memset(c, 0, sizeof(cookie_t));
+
+		/* init tokener error */
+		c->jerr = json_tokener_success;
+
+		/* create token */
+		c->jtok = json_tokener_new();
+
+		/* debugging */
+		DEBUG3("fetching document %s", keys[scheduled]);
+
+		/* schedule the get, the command is copied so cmd can be reused */
+		if ((error = lcb_get(instance, c, 1, commands)) != LCB_SUCCESS) {
+			json_tokener_free(c->jtok);
+			c->jtok = NULL;
+			break;
+		}
+	}
+
+	/* enter event loop for everything we scheduled */
+	if (scheduled) lcb_wait(instance);
+
+	/* free tokens */
+	for (i = 0; i < scheduled; i++) json_tokener_free(cookies[i].jtok);
+
+	/* return error */
+	return error;
+}
+
 /** Query a Couchbase design document view
  *
  * Setup and execute a Couchbase view request and wait for the result.
@@ -47,6 +47,10 @@ typedef struct {
 	enum json_tokener_error	jerr;   //!< Error values produced by the json-c library.
 } cookie_t;
 
+/** Maximum number of documents to fetch in one batch
+ */
+#define COUCHBASE_MAX_MULTI_GET 32
+
 /** Union of constant and non-constant pointers
  *
  * This is used to squelch compiler warnings about casting when passing data
@@ -103,5 +107,8 @@ lcb_error_t couchbase_set_key(lcb_t instance, const char *key, const char *docum
 /* pull document from couchbase by key */
 lcb_error_t couchbase_get_key(lcb_t instance, const void *cookie, const char *key);
 
+/* pull multiple documents from couchbase by key, in one batch */
+lcb_error_t couchbase_get_keys(lcb_t instance, cookie_t *cookies, char const **keys, size_t num);
+
 /* query a couchbase view via http */
 lcb_error_t couchbase_query_view(lcb_t instance, const void *cookie, const char *path, const char *post);
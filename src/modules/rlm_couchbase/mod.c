@@ -708,7 +708,12 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
 int mod_load_client_documents(rlm_couchbase_t *inst, CONF_SECTION *tmpl, CONF_SECTION *map)
 {
 	rlm_couchbase_handle_t *handle = NULL; /* connection pool handle */
-	char vpath[256], vid[MAX_KEY_SIZE], vkey[MAX_KEY_SIZE];  /* view path and fields */
+	char vpath[256];                                         /* view path */
+	char vid[COUCHBASE_MAX_MULTI_GET][MAX_KEY_SIZE];         /* view ids for the current batch */
+	char vkey[COUCHBASE_MAX_MULTI_GET][MAX_KEY_SIZE];        /* view keys for the current batch */
+	char const *keys[COUCHBASE_MAX_MULTI_GET];               /* document keys to fetch */
+	cookie_t docs[COUCHBASE_MAX_MULTI_GET] = { { 0 } };      /* documents fetched */
+	size_t nrows, num = 0, i;                                /* row and batch counters */
 	char error[512];                                         /* view error return */
 	int idx = 0;                                             /* row array index counter */
 	int retval = 0;                                          /* return value */
@@ -800,107 +805,128 @@ int mod_load_client_documents(rlm_couchbase_t *inst, CONF_SECTION *tmpl, CONF_SE
 		goto free_and_return;
 	}
 
-	/* loop across all row elements */
-	for (idx = 0; (size_t)idx < (size_t)json_object_array_length(jrows); idx++) {
-		/* fetch current index */
-		json = json_object_array_get_idx(jrows, idx);
-
-		/* get view id */
-		if (json_object_object_get_ex(json, "id", &j_value)) {
-			/* clear view id */
-			memset(vid, 0, sizeof(vid));
-			/* copy and check length */
-			if (strlcpy(vid, json_object_get_string(j_value), sizeof(vid)) >= sizeof(vid)) {
-				ERROR("id from row longer than MAX_KEY_SIZE (%d)",
-				      MAX_KEY_SIZE);
+	/* loop across all row elements, fetching documents in batches */
+	nrows = json_object_array_length(jrows);
+	for (idx = 0; (size_t)idx < nrows; ) {
+		/* collect the ids and keys for the next batch of rows */
+		for (num = 0; (num < COUCHBASE_MAX_MULTI_GET) && ((size_t)idx < nrows); idx++) {
+			/* fetch current index */
+			json = json_object_array_get_idx(jrows, idx);
+
+			/* get view id */
+			if (json_object_object_get_ex(json, "id", &j_value)) {
+				/* clear view id */
+				memset(vid[num], 0, sizeof(vid[num]));
+				/* copy and check length */
+				if (strlcpy(vid[num], json_object_get_string(j_value), sizeof(vid[num])) >= sizeof(vid[num])) {
+					ERROR("id from row longer than MAX_KEY_SIZE (%d)",
+					      MAX_KEY_SIZE);
+					continue;
+				}
+			} else {
+				WARN("failed to fetch id from row - skipping");
 				continue;
 			}
-		} else {
-			WARN("failed to fetch id from row - skipping");
-			continue;
-		}
 
-		/* get view key */
-		if (json_object_object_get_ex(json, "key", &j_value)) {
-			/* clear view key */
-			memset(vkey, 0, sizeof(vkey));
-			/* copy and check length */
-			if (strlcpy(vkey, json_object_get_string(j_value), sizeof(vkey)) >= sizeof(vkey)) {
-				ERROR("key from row longer than MAX_KEY_SIZE (%d)",
-				      MAX_KEY_SIZE);
+			/* get view key */
+			if (json_object_object_get_ex(json, "key", &j_value)) {
+				/* clear view key */
+				memset(vkey[num], 0, sizeof(vkey[num]));
+				/* copy and check length */
+				if (strlcpy(vkey[num], json_object_get_string(j_value), sizeof(vkey[num])) >= sizeof(vkey[num])) {
+					ERROR("key from row longer than MAX_KEY_SIZE (%d)",
+					      MAX_KEY_SIZE);
+					continue;
+				}
+			} else {
+				WARN("failed to fetch key from row - skipping");
 				continue;
 			}
-		} else {
-			WARN("failed to fetch key from row - skipping");
-			continue;
+
+			keys[num] = vid[num];
+			num++;
 		}
 
-		/* fetch document */
-		cb_error = couchbase_get_key(cb_inst, cookie, vid);
+		if (!num) break;
 
-		/* check error and object */
-		if (cb_error != LCB_SUCCESS || cookie->jerr != json_tokener_success || !cookie->jobj) {
+		/* fetch all the documents in the batch at once */
+		cb_error = couchbase_get_keys(cb_inst, docs, keys, num);
+		if (cb_error != LCB_SUCCESS) {
 			/* log error */
-			ERROR("failed to execute get request or parse return");
+			ERROR("failed to execute get request");
 			/* set return */
 			retval = -1;
 			/* return */
 			goto free_and_return;
 		}
 
-		/* debugging */
-		DEBUG3("cookie->jobj == %s", json_object_to_json_string(cookie->jobj));
-
-		/* allocate conf list */
-		client = tmpl ? cf_section_dup(NULL, NULL, tmpl, "client", vkey, true) :
-				cf_section_alloc(NULL, NULL, "client", vkey);
+		for (i = 0; i < num; i++) {
+			/* check object */
+			if (docs[i].jerr != json_tokener_success || !docs[i].jobj) {
+				/* log error */
+				ERROR("failed to parse document '%s'", vid[i]);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		if (client_map_section(client, map, _get_client_value, cookie->jobj) < 0) {
-			/* free config setion */
-			talloc_free(client);
-			/* set return */
-			retval = -1;
-			/* return */
-			goto free_and_return;
-		}
+			/* debugging */
+			DEBUG3("docs[%zu].jobj == %s", i, json_object_to_json_string(docs[i].jobj));
+
+			/* allocate conf list */
+			client = tmpl ? cf_section_dup(NULL, NULL, tmpl, "client", vkey[i], true) :
+					cf_section_alloc(NULL, NULL, "client", vkey[i]);
+
+			if (client_map_section(client, map, _get_client_value, docs[i].jobj) < 0) {
+				/* free config setion */
+				talloc_free(client);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		/*
-		 * @todo These should be parented from something.
-		 */
-		c = client_afrom_cs(NULL, client, false);
-		if (!c) {
-			ERROR("failed to allocate client");
-			/* free config setion */
-			talloc_free(client);
-			/* set return */
-			retval = -1;
-			/* return */
-			goto free_and_return;
-		}
+			/*
+			 * @todo These should be parented from something.
+			 */
+			c = client_afrom_cs(NULL, client, false);
+			if (!c) {
+				ERROR("failed to allocate client");
+				/* free config setion */
+				talloc_free(client);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		/*
-		 * Client parents the CONF_SECTION which defined it.
-		 */
-		talloc_steal(c, client);
+			/*
+			 * Client parents the CONF_SECTION which defined it.
+			 */
+			talloc_steal(c, client);
+
+			/* attempt to add client */
+			if (!client_add(NULL, c)) {
+				ERROR("failed to add client '%s' from '%s', possible duplicate?", vkey[i], vid[i]);
+				/* free client */
+				client_free(c);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		/* attempt to add client */
-		if (!client_add(NULL, c)) {
-			ERROR("failed to add client '%s' from '%s', possible duplicate?", vkey, vid);
-			/* free client */
-			client_free(c);
-			/* set return */
-			retval = -1;
-			/* return */
-			goto free_and_return;
+			/* debugging */
+			DEBUG("client '%s' added", c->longname);
 		}
 
-		/* debugging */
-		DEBUG("client '%s' added", c->longname);
-
-		/* free json object */
-		if (cookie->jobj) {
-			json_object_put(cookie->jobj);
-			cookie->jobj = NULL;
+		/* free json objects */
+		for (i = 0; i < num; i++) {
+			if (docs[i].jobj) {
+				json_object_put(docs[i].jobj);
+				docs[i].jobj = NULL;
+			}
 		}
 	}
 
@@ -917,6 +943,11 @@ int mod_load_client_documents(rlm_couchbase_t *inst, CONF_SECTION *tmpl, CONF_SE
 		cookie->jobj = NULL;
 	}
 
+	/* free json objects from the last batch */
+	for (i = 0; i < COUCHBASE_MAX_MULTI_GET; i++) {
+		if (docs[i].jobj) json_object_put(docs[i].jobj);
+	}
+
 	/* release handle */
 	if (handle) fr_pool_connection_release(inst->pool, NULL, handle);
 
@@ -67,6 +67,11 @@ typedef struct {
 	map_t	*map;		//!< if there is an "update" section in the configuration.
 } rlm_csv_t;
 
+/*
+ *	The field strings point into a copy of the line, which is
+ *	allocated in the same chunk as the entry.  Large files would
+ *	otherwise need one allocation per field.
+ */
 typedef struct rlm_csv_entry_s rlm_csv_entry_t;
 struct rlm_csv_entry_s {
 	rlm_csv_entry_t *next;
@@ -267,13 +272,17 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 {
 	rlm_csv_entry_t *e;
 	int i;
-	char *p, *q;
+	char *p, *q, *line;
+	size_t len = strlen(buffer);
 
 	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
-						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
+						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0])) + len + 1));
 	talloc_set_type(e, rlm_csv_entry_t);
 
-	for (p = buffer, i = 0; p != NULL; p = q, i++) {
+	line = (char *)&e->data[inst->used_fields];
+	memcpy(line, buffer, len + 1);
+
+	for (p = line, i = 0; p != NULL; p = q, i++) {
 		if (!buf2entry(inst, p, &q)) {
 			cf_log_err(conf, "Malformed entry in file %s line %d", inst->filename, lineno);
 			return false;
@@ -358,7 +367,7 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 			fr_value_box_clear(&box);
 		}
 
-		MEM(e->data[inst->field_offsets[i]] = talloc_typed_strdup(e, p));
+		e->data[inst->field_offsets[i]] = p;
 	}
 
 	if (i < inst->num_fields) {
@@ -877,8 +886,8 @@ static int csv_map_getvalue(TALLOC_CTX *ctx, fr_pair_list_t *out, request_t *req
 	vp = fr_pair_afrom_da(ctx, da);
 	fr_assert(vp);
 
-	if (fr_pair_value_from_str(vp, str, talloc_array_length(str) - 1, '\0', true) < 0) {
-		RPWDEBUG("Failed parsing value \"%pV\" for attribute %s", fr_box_strvalue_buffer(str),
+	if (fr_pair_value_from_str(vp, str, strlen(str), '\0', true) < 0) {
+		RPWDEBUG("Failed parsing value \"%pV\" for attribute %s", fr_box_strvalue(str),
 			tmpl_da(map->lhs)->name);
 		talloc_free(vp);
 
@@ -1,2 +0,0 @@
-TARGET		:= rlm_detail.a
-SOURCES		:= rlm_detail.c
@@ -43,8 +43,24 @@ RCSID("$Id$")
 #  include <grp.h>
 #endif
 
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
 #define DIRLEN	8192		//!< Maximum path length.
 
+typedef enum {
+	DETAIL_COMPRESS_NONE = 0,			//!< Plain text.
+	DETAIL_COMPRESS_ZSTD,				//!< One zstd frame per write.
+} detail_compress_t;
+
+static fr_table_num_sorted_t const detail_compress_table[] = {
+	{ L("no"),	DETAIL_COMPRESS_NONE	},
+	{ L("none"),	DETAIL_COMPRESS_NONE	},
+	{ L("zstd"),	DETAIL_COMPRESS_ZSTD	}
+};
+static size_t detail_compress_table_len = NUM_ELEMENTS(detail_compress_table);
+
 /** Instance configuration for rlm_detail
  *
  * Holds the configuration and preparsed data for a instance of rlm_detail.
@@ -67,8 +83,42 @@ typedef struct {
 	exfile_t    	*ef;		//!< Log file handler
 
 	fr_hash_table_t *ht;		//!< Holds suppressed attributes.
+
+	size_t		buffer_size;	//!< How much to buffer per thread, per file.
+	fr_time_delta_t	flush_interval;	//!< How long entries may sit in the buffer.
+
+	char const	*compression_str; //!< Compression to use for new data.
+	detail_compress_t compression;	//!< Parsed version of compression_str.
+	int		compression_level; //!< Passed to the compressor.
 } rlm_detail_t;
 
+/** Detail entries waiting to be written to one file
+ *
+ */
+typedef struct {
+	char const		*path;		//!< File the data is for.
+	uint8_t			*data;		//!< Detail entries.
+	size_t			used;		//!< How much of the buffer has data in it.
+} detail_buffer_t;
+
+/** Per-thread instance data
+ *
+ * As with rlm_linelog, entries are appended to a per-file buffer,
+ * which is written out when it fills, or when the flush timer fires.
+ * When compressing, each write is one self-contained frame.
+ */
+typedef struct {
+	rlm_detail_t const	*inst;		//!< Instance of detail.
+	fr_event_list_t		*el;		//!< This thread's event list.
+	rbtree_t		*buffers;	//!< detail_buffer_t, by filename.
+	fr_event_timer_t const	*ev;		//!< When to flush the buffers.
+
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx		*cctx;		//!< Re-used for every frame.
+	uint8_t			*compressed;	//!< Output buffer for the compressor.
+#endif
+} rlm_detail_thread_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_REQUIRED | FR_TYPE_XLAT, rlm_detail_t, filename), .dflt = "%A/%{Packet-Src-IP-Address}/detail" },
 	{ FR_CONF_OFFSET("header", FR_TYPE_TMPL | FR_TYPE_XLAT | FR_TYPE_NON_BLOCKING, rlm_detail_t, header),
@@ -78,6 +128,10 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", FR_TYPE_BOOL, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", FR_TYPE_BOOL, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffer_size", FR_TYPE_SIZE, rlm_detail_t, buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("flush_interval", FR_TYPE_TIME_DELTA, rlm_detail_t, flush_interval), .dflt = "1" },
+	{ FR_CONF_OFFSET("compression", FR_TYPE_STRING, rlm_detail_t, compression_str), .dflt = "none" },
+	{ FR_CONF_OFFSET("compression_level", FR_TYPE_INT32, rlm_detail_t, compression_level), .dflt = "3" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -147,6 +201,29 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		inst->escape_func = rad_filename_make_safe;
 	}
 
+	inst->compression = fr_table_value_by_str(detail_compress_table, inst->compression_str, -1);
+	switch ((int)inst->compression) {
+	case DETAIL_COMPRESS_NONE:
+		break;
+
+	case DETAIL_COMPRESS_ZSTD:
+#ifndef HAVE_ZSTD
+		cf_log_err(conf, "zstd compression is not available, rebuild with libzstd");
+		return -1;
+#else
+		if ((inst->compression_level < ZSTD_minCLevel()) || (inst->compression_level > ZSTD_maxCLevel())) {
+			cf_log_err(conf, "'compression_level' must be between %d and %d",
+				   ZSTD_minCLevel(), ZSTD_maxCLevel());
+			return -1;
+		}
+		break;
+#endif
+
+	default:
+		cf_log_err(conf, "Invalid compression \"%s\"", inst->compression_str);
+		return -1;
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, inst->locking, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err(conf, "Failed creating log file context");
@@ -209,24 +286,41 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/*
+ *	Print one attribute, in the same format as fr_pair_fprint().
+ */
+static ssize_t detail_pair_print(fr_sbuff_t *out, fr_pair_t const *vp)
+{
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '\t');
+	FR_SBUFF_RETURN(fr_pair_print, &our_out, NULL, vp);
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '\n');
+
+	return fr_sbuff_set(out, &our_out);
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
-static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, fr_pair_t const *stacked)
+static ssize_t detail_pair_print_stacked(TALLOC_CTX *ctx, fr_sbuff_t *out, fr_pair_t const *stacked)
 {
-	fr_pair_t *vp;
+	fr_pair_t	*vp;
+	ssize_t		slen;
 
 	vp = talloc(ctx, fr_pair_t);
-	if (!vp) return;
+	if (!vp) return -1;
 
 	memcpy(vp, stacked, sizeof(*vp));
 	vp->op = T_OP_EQ;
-	fr_pair_fprint(out, NULL, vp);
+	slen = detail_pair_print(out, vp);
 	talloc_free(vp);
+
+	return slen;
 }
 
 
-/** Write a single detail entry to file pointer
+/** Write a single detail entry to a buffer
  *
  * @param[in] out Where to write entry.
  * @param[in] inst Instance of rlm_detail.
@@ -234,7 +328,7 @@ static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, fr_pair_t const *s
  * @param[in] packet associated with the request (request, reply...).
  * @param[in] compat Write out entry in compatibility mode.
  */
-static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
+static int detail_write(fr_sbuff_t *out, rlm_detail_t const *inst, request_t *request,
 			fr_radius_packet_t *packet, fr_pair_list_t *list, bool compat)
 {
 	fr_pair_t *vp;
@@ -251,8 +345,15 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	}
 
 #define WRITE(fmt, ...) do {\
-	if (fprintf(out, fmt, ## __VA_ARGS__) < 0) {\
-		RERROR("Failed writing to detail file: %s", fr_syserror(errno));\
+	if (fr_sbuff_in_sprintf(out, fmt, ## __VA_ARGS__) < 0) {\
+		RERROR("Failed writing detail entry: Out of memory");\
+		return -1;\
+	}\
+} while(0)
+
+#define WRITE_PAIR(_func, ...) do {\
+	if (_func(__VA_ARGS__) < 0) {\
+		RERROR("Failed writing detail entry: Out of memory");\
 		return -1;\
 	}\
 } while(0)
@@ -307,8 +408,8 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 			break;
 		}
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		WRITE_PAIR(detail_pair_print_stacked, request, out, &src_vp);
+		WRITE_PAIR(detail_pair_print_stacked, request, out, &dst_vp);
 
 		src_vp.da = attr_packet_src_port;
 		fr_value_box_shallow(&src_vp.data, packet->socket.inet.src_port, true);
@@ -316,8 +417,8 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 		dst_vp.da = attr_packet_dst_port;
 		fr_value_box_shallow(&dst_vp.data, packet->socket.inet.dst_port, true);
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		WRITE_PAIR(detail_pair_print_stacked, request, out, &src_vp);
+		WRITE_PAIR(detail_pair_print_stacked, request, out, &dst_vp);
 	}
 
 	{
@@ -326,7 +427,8 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 		for (vp = fr_cursor_init(&cursor, list);
 		     vp;
 		     vp = fr_cursor_next(&cursor)) {
-			fr_token_t op;
+			fr_token_t	op;
+			ssize_t		slen;
 
 			if (inst->ht && fr_hash_table_find_by_data(inst->ht, vp->da)) continue;
 
@@ -340,8 +442,12 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 			 */
 			op = vp->op;
 			vp->op = T_OP_EQ;
-			fr_pair_fprint(out, NULL, vp);
+			slen = detail_pair_print(out, vp);
 			vp->op = op;
+			if (slen < 0) {
+				RERROR("Failed writing detail entry: Out of memory");
+				return -1;
+			}
 		}
 	}
 
@@ -358,83 +464,269 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	return 0;
 }
 
-/*
- *	Do detail, compatible with old accounting
+/** Write data to a detail file, holding the exfile lock for the duration
+ *
+ * If compression is enabled, the data is written as one frame.  Frames
+ * are self-contained, so entries from different threads, and different
+ * flushes, can be appended to the same file in any order.
+ *
+ * @param[in] t		Thread instance of detail.
+ * @param[in] request	The current request.  May be NULL.
+ * @param[in] path	of the file to write to.
+ * @param[in] data	to write.
+ * @param[in] data_len	length of data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
  */
-static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
-						  fr_radius_packet_t *packet, fr_pair_list_t *list,
-						  bool compat)
+static int detail_file_write(rlm_detail_thread_t *t, request_t *request, char const *path,
+			     uint8_t const *data, size_t data_len)
 {
-	int		outfd, dupfd;
-	char		buffer[DIRLEN];
-
-	FILE		*outfp;
+	rlm_detail_t const	*inst = t->inst;
+	int			fd;
+	ssize_t			slen;
 
 #ifdef HAVE_GRP_H
 	gid_t		gid;
 	char		*endptr;
 #endif
 
-	rlm_detail_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_detail_t);
+#ifdef HAVE_ZSTD
+	if (inst->compression == DETAIL_COMPRESS_ZSTD) {
+		size_t	bound = ZSTD_compressBound(data_len);
+		size_t	ret;
 
-	/*
-	 *	Generate the path for the detail file.  Use the same
-	 *	format, but truncate at the last /.  Then feed it
-	 *	through xlat_eval() to expand the variables.
-	 */
-	if (xlat_eval(buffer, sizeof(buffer), request, inst->filename, inst->escape_func, NULL) < 0) {
-		RETURN_MODULE_FAIL;
-	}
+		if (!t->compressed || (talloc_array_length(t->compressed) < bound)) {
+			talloc_free(t->compressed);
+			MEM(t->compressed = talloc_array(t, uint8_t, bound));
+		}
 
-	RDEBUG2("%s expands to %s", inst->filename, buffer);
+		ret = ZSTD_compressCCtx(t->cctx, t->compressed, bound, data, data_len, inst->compression_level);
+		if (ZSTD_isError(ret)) {
+			ROPTIONAL(RERROR, ERROR, "Failed compressing detail entries: %s", ZSTD_getErrorName(ret));
+			return -1;
+		}
 
-	outfd = exfile_open(inst->ef, request, buffer, inst->perm);
-	if (outfd < 0) {
-		RPERROR("Couldn't open file %s", buffer);
-		/* coverity[missing_unlock] */
-		RETURN_MODULE_FAIL;
+		data = t->compressed;
+		data_len = ret;
+	}
+#endif
+
+	fd = exfile_open(inst->ef, request, path, inst->perm);
+	if (fd < 0) {
+		ROPTIONAL(RPERROR, PERROR, "Couldn't open file %s", path);
+		return -1;
 	}
 
 	if (inst->group != NULL) {
 		gid = strtol(inst->group, &endptr, 10);
 		if (*endptr != '\0') {
-			if (rad_getgid(request, &gid, inst->group) < 0) {
-				RDEBUG2("Unable to find system group '%s'", inst->group);
+			if (rad_getgid(t, &gid, inst->group) < 0) {
+				ROPTIONAL(RDEBUG2, DEBUG2, "Unable to find system group '%s'", inst->group);
 				goto skip_group;
 			}
 		}
 
-		if (chown(buffer, -1, gid) == -1) {
-			RDEBUG2("Unable to change system group of '%s'", buffer);
+		if (chown(path, -1, gid) == -1) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Unable to change system group of '%s'", path);
 		}
 	}
 
 skip_group:
-	outfp = NULL;
-	dupfd = dup(outfd);
-	if (dupfd < 0) {
-		RERROR("Failed to dup() file descriptor for detail file");
-		goto fail;
+	while (data_len > 0) {
+		slen = write(fd, data, data_len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+
+			ROPTIONAL(RERROR, ERROR, "Failed writing to detail file %s: %s", path, fr_syserror(errno));
+			exfile_close(inst->ef, request, fd);
+			return -1;
+		}
+
+		data += slen;
+		data_len -= slen;
+	}
+
+	exfile_close(inst->ef, request, fd);
+
+	return 0;
+}
+
+/** Write out everything in a buffer
+ *
+ */
+static int detail_buffer_flush(rlm_detail_thread_t *t, request_t *request, detail_buffer_t *buf)
+{
+	int ret;
+
+	if (!buf->used) return 0;
+
+	ret = detail_file_write(t, request, buf->path, buf->data, buf->used);
+	buf->used = 0;
+
+	return ret;
+}
+
+static int _detail_buffer_flush(void *data, void *uctx)
+{
+	rlm_detail_thread_t	*t = talloc_get_type_abort(uctx, rlm_detail_thread_t);
+
+	(void) detail_buffer_flush(t, NULL, data);
+
+	return 0;
+}
+
+static void detail_flush_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_detail_thread_t	*t = talloc_get_type_abort(uctx, rlm_detail_thread_t);
+
+	(void) rbtree_walk(t->buffers, RBTREE_IN_ORDER, _detail_buffer_flush, t);
+}
+
+/** Add a detail entry to the buffer for a file
+ *
+ * Data is written immediately if it won't fit in the buffer.
+ */
+static int detail_buffer_write(rlm_detail_thread_t *t, request_t *request, char const *path,
+			       uint8_t const *data, size_t data_len)
+{
+	rlm_detail_t const	*inst = t->inst;
+	detail_buffer_t		*buf;
+
+	buf = rbtree_finddata(t->buffers, &(detail_buffer_t){ .path = path });
+	if (!buf) {
+		MEM(buf = talloc_zero(t->buffers, detail_buffer_t));
+		MEM(buf->path = talloc_strdup(buf, path));
+		MEM(buf->data = talloc_array(buf, uint8_t, inst->buffer_size));
+
+		if (!rbtree_insert(t->buffers, buf)) {
+			talloc_free(buf);
+			return detail_file_write(t, request, path, data, data_len);
+		}
+	}
+
+	if ((buf->used + data_len) > inst->buffer_size) {
+		if (detail_buffer_flush(t, request, buf) < 0) return -1;
+
+		if (data_len > inst->buffer_size) return detail_file_write(t, request, path, data, data_len);
+	}
+
+	memcpy(buf->data + buf->used, data, data_len);
+	buf->used += data_len;
+
+	if (!t->ev && (fr_event_timer_in(t, t->el, &t->ev, inst->flush_interval,
+					 detail_flush_timer, t) < 0)) {
+		RPWARN("Failed inserting flush timer, writing immediately");
+		return detail_buffer_flush(t, request, buf);
 	}
 
+	return 0;
+}
+
+static int detail_buffer_cmp(void const *one, void const *two)
+{
+	detail_buffer_t const *a = one, *b = two;
+
+	return strcmp(a->path, b->path);
+}
+
+#ifdef HAVE_ZSTD
+static int _detail_thread_free(rlm_detail_thread_t *t)
+{
+	if (t->cctx) ZSTD_freeCCtx(t->cctx);
+
+	return 0;
+}
+#endif
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_detail_t const	*inst = talloc_get_type_abort_const(instance, rlm_detail_t);
+	rlm_detail_thread_t	*t = thread;
+
+	(void) talloc_set_type(t, rlm_detail_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+
+#ifdef HAVE_ZSTD
+	if (inst->compression == DETAIL_COMPRESS_ZSTD) {
+		t->cctx = ZSTD_createCCtx();
+		if (!t->cctx) {
+			ERROR("Failed allocating compression context");
+			return -1;
+		}
+		talloc_set_destructor(t, _detail_thread_free);
+	}
+#endif
+
+	if (!inst->buffer_size) return 0;
+
+	MEM(t->buffers = rbtree_talloc_alloc(t, detail_buffer_cmp, detail_buffer_t, NULL, RBTREE_FLAG_NONE));
+
+	return 0;
+}
+
+/** Write out anything which is still buffered
+ *
+ */
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_detail_thread_t	*t = talloc_get_type_abort(thread, rlm_detail_thread_t);
+
+	if (t->ev) fr_event_timer_delete(&t->ev);
+	if (t->buffers) (void) rbtree_walk(t->buffers, RBTREE_IN_ORDER, _detail_buffer_flush, t);
+
+	return 0;
+}
+
+/*
+ *	Do detail, compatible with old accounting
+ */
+static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+						  fr_radius_packet_t *packet, fr_pair_list_t *list,
+						  bool compat)
+{
+	char			buffer[DIRLEN];
+	fr_sbuff_t		entry;
+	fr_sbuff_uctx_talloc_t	tctx;
+	int			ret;
+
+	rlm_detail_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_detail_t);
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+
 	/*
-	 *	Open the output fp for buffering.
+	 *	Generate the path for the detail file.  Use the same
+	 *	format, but truncate at the last /.  Then feed it
+	 *	through xlat_eval() to expand the variables.
 	 */
-	if ((outfp = fdopen(dupfd, "a")) == NULL) {
-		RERROR("Couldn't open file %s: %s", buffer, fr_syserror(errno));
+	if (xlat_eval(buffer, sizeof(buffer), request, inst->filename, inst->escape_func, NULL) < 0) {
+		RETURN_MODULE_FAIL;
+	}
+
+	RDEBUG2("%s expands to %s", inst->filename, buffer);
+
+	MEM(fr_sbuff_init_talloc(request, &entry, &tctx, 1024, SIZE_MAX));
+
+	if (detail_write(&entry, inst, request, packet, list, compat) < 0) {
 	fail:
-		if (outfp) fclose(outfp);
-		exfile_close(inst->ef, request, outfd);
+		talloc_free(entry.buff);
 		RETURN_MODULE_FAIL;
 	}
 
-	if (detail_write(outfp, inst, request, packet, list, compat) < 0) goto fail;
+	if (fr_sbuff_used(&entry) == 0) {
+		talloc_free(entry.buff);
+		RETURN_MODULE_OK;
+	}
 
-	/*
-	 *	Flush everything
-	 */
-	fclose(outfp);
-	exfile_close(inst->ef, request, outfd);
+	if (t->buffers) {
+		ret = detail_buffer_write(t, request, buffer, (uint8_t *)entry.buff, fr_sbuff_used(&entry));
+	} else {
+		ret = detail_file_write(t, request, buffer, (uint8_t *)entry.buff, fr_sbuff_used(&entry));
+	}
+	if (ret < 0) goto fail;
+
+	talloc_free(entry.buff);
 
 	/*
 	 *	And everything is fine.
@@ -473,8 +765,11 @@ module_t rlm_detail = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "detail",
 	.inst_size	= sizeof(rlm_detail_t),
+	.thread_inst_size	= sizeof(rlm_detail_thread_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_PREACCT]		= mod_accounting,
@@ -446,6 +446,17 @@ error:
 }
 
 
+static unlang_action_t mod_process(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request);
+
+/** Continue processing once an async crypto operation in the handshake has completed
+ *
+ */
+static unlang_action_t mod_process_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					  request_t *request, UNUSED void *rctx)
+{
+	return mod_process(p_result, mctx, request);
+}
+
 /*
  *	Do authentication, by letting EAP-TLS do most of the work.
  */
@@ -495,6 +506,13 @@ static unlang_action_t mod_process(rlm_rcode_t *p_result, module_ctx_t const *mc
 	case EAP_TLS_HANDLED:
 		RETURN_MODULE_HANDLED;
 
+	/*
+	 *	Handshake is waiting for an async crypto
+	 *	operation, come back when it's done.
+	 */
+	case EAP_TLS_YIELD:
+		return eap_tls_yield(p_result, request, eap_session, mod_process_resume);
+
 	/*
 	 *	Handshake is done, proceed with decoding tunneled
 	 *	data.
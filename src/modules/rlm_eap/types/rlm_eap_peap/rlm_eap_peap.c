@@ -122,6 +122,17 @@ static peap_tunnel_t *peap_alloc(TALLOC_CTX *ctx, rlm_eap_peap_t *inst)
 	return t;
 }
 
+static unlang_action_t mod_process(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request);
+
+/** Continue processing once an async crypto operation in the handshake has completed
+ *
+ */
+static unlang_action_t mod_process_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					  request_t *request, UNUSED void *rctx)
+{
+	return mod_process(p_result, mctx, request);
+}
+
 /*
  *	Do authentication, by letting EAP-TLS do most of the work.
  */
@@ -179,6 +190,13 @@ static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, modul
 		 */
 		RETURN_MODULE_HANDLED;
 
+	/*
+	 *	Handshake is waiting for an async crypto
+	 *	operation, come back when it's done.
+	 */
+	case EAP_TLS_YIELD:
+		return eap_tls_yield(p_result, request, eap_session, mod_process_resume);
+
 	/*
 	 *	Handshake is done, proceed with decoding tunneled
 	 *	data.
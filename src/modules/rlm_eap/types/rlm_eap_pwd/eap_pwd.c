@@ -246,24 +246,17 @@ fail:
 	return ret;
 }
 
-int compute_password_element (request_t *request, pwd_session_t *session, uint16_t grp_num,
-			      char const *password, int password_len,
-			      char const *id_server, int id_server_len,
-			      char const *id_peer, int id_peer_len,
-			      uint32_t *token, BN_CTX *bnctx)
+/** Set up the curve, and an empty password element, for a session
+ *
+ * @param[in] session	to set up.
+ * @param[in] grp_num	IANA registry number of the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int pwd_group_init(pwd_session_t *session, uint16_t grp_num)
 {
-	BIGNUM *x_candidate = NULL, *rnd = NULL, *y_sqrd = NULL, *qr = NULL, *qnr = NULL;
-	HMAC_CTX *ctx = NULL;
-	uint8_t pwe_digest[SHA256_DIGEST_LENGTH], *prfbuf = NULL, *xbuf = NULL, *pm1buf = NULL, ctr;
-	int nid, is_odd, primebitlen, primebytelen, ret = 0, found = 0, mask;
-	int save, i, rbits, qr_or_qnr, save_is_odd = 0, cmp;
-	unsigned int skip;
-
-	ctx = HMAC_CTX_new();
-	if (ctx == NULL) {
-		DEBUG("failed allocating HMAC context");
-		goto fail;
-	}
+	int nid;
 
 	switch (grp_num) { /* from IANA registry for IKE D-H groups */
 	case 19:
@@ -288,7 +281,7 @@ int compute_password_element (request_t *request, pwd_session_t *session, uint16
 
 	default:
 		DEBUG("unknown group %d", grp_num);
-		goto fail;
+		return -1;
 	}
 
 	session->pwe = NULL;
@@ -297,28 +290,58 @@ int compute_password_element (request_t *request, pwd_session_t *session, uint16
 
 	if ((session->group = EC_GROUP_new_by_curve_name(nid)) == NULL) {
 		DEBUG("unable to create EC_GROUP");
-		goto fail;
+		return -1;
 	}
 
-	if (((rnd = consttime_BN()) == NULL) ||
-	    ((session->pwe = EC_POINT_new(session->group)) == NULL) ||
+	if (((session->pwe = EC_POINT_new(session->group)) == NULL) ||
 	    ((session->order = consttime_BN()) == NULL) ||
-	    ((session->prime = consttime_BN()) == NULL) ||
-	    ((qr = consttime_BN()) == NULL) ||
-	    ((qnr = consttime_BN()) == NULL) ||
-	    ((x_candidate = consttime_BN()) == NULL) ||
-	    ((y_sqrd = consttime_BN()) == NULL)) {
+	    ((session->prime = consttime_BN()) == NULL)) {
 		DEBUG("unable to create bignums");
-		goto fail;
+		return -1;
 	}
 
 	if (!EC_GROUP_get_curve_GFp(session->group, session->prime, NULL, NULL, NULL)) {
 		DEBUG("unable to get prime for GFp curve");
-		goto fail;
+		return -1;
 	}
 
 	if (!EC_GROUP_get_order(session->group, session->order, NULL)) {
 		DEBUG("unable to get order for curve");
+		return -1;
+	}
+
+	session->group_num = grp_num;
+
+	return 0;
+}
+
+int compute_password_element (request_t *request, pwd_session_t *session, uint16_t grp_num,
+			      char const *password, int password_len,
+			      char const *id_server, int id_server_len,
+			      char const *id_peer, int id_peer_len,
+			      uint32_t *token, BN_CTX *bnctx)
+{
+	BIGNUM *x_candidate = NULL, *rnd = NULL, *y_sqrd = NULL, *qr = NULL, *qnr = NULL;
+	HMAC_CTX *ctx = NULL;
+	uint8_t pwe_digest[SHA256_DIGEST_LENGTH], *prfbuf = NULL, *xbuf = NULL, *pm1buf = NULL, ctr;
+	int is_odd, primebitlen, primebytelen, ret = 0, found = 0, mask;
+	int save, i, rbits, qr_or_qnr, save_is_odd = 0, cmp;
+	unsigned int skip;
+
+	ctx = HMAC_CTX_new();
+	if (ctx == NULL) {
+		DEBUG("failed allocating HMAC context");
+		goto fail;
+	}
+
+	if (pwd_group_init(session, grp_num) < 0) goto fail;
+
+	if (((rnd = consttime_BN()) == NULL) ||
+	    ((qr = consttime_BN()) == NULL) ||
+	    ((qnr = consttime_BN()) == NULL) ||
+	    ((x_candidate = consttime_BN()) == NULL) ||
+	    ((y_sqrd = consttime_BN()) == NULL)) {
+		DEBUG("unable to create bignums");
 		goto fail;
 	}
 
@@ -453,7 +476,6 @@ int compute_password_element (request_t *request, pwd_session_t *session, uint16
 		goto fail;
 	}
 
-	session->group_num = grp_num;
 	if (0) {
 		fail:		/* DON'T free session, it's in handler->opaque */
 		ret = -1;
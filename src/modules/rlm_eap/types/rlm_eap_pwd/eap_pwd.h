@@ -100,6 +100,7 @@ typedef struct {
     uint8_t	my_confirm[SHA256_DIGEST_LENGTH];
 } pwd_session_t;
 
+int pwd_group_init(pwd_session_t *sess, uint16_t grp_num);
 int compute_password_element(request_t *request, pwd_session_t *sess, uint16_t grp_num,
 			     char const *password, int password_len,
 			     char const *id_server, int id_server_len,
@@ -41,6 +41,34 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #include "eap_pwd.h"
 
+/** A password element, from a previous session with the same inputs
+ *
+ */
+typedef struct {
+	uint8_t		key[SHA256_DIGEST_LENGTH];	//!< HMAC of the inputs to the hunting and pecking loop.
+	uint8_t		*pwe;				//!< The element, as an uncompressed point.
+	size_t		pwe_len;			//!< Length of the element.
+	fr_time_t	expires;			//!< When the entry should no longer be used.
+	int32_t		heap_id;			//!< Position in the expiry heap.
+} pwd_cache_entry_t;
+
+/** Password elements, shared by all sessions
+ *
+ * The token is normally random for every session, which means the
+ * element is too.  When the cache is enabled every session started
+ * within the same cache_lifetime uses the same token, so sessions for
+ * the same user and password derive the same element.
+ */
+typedef struct {
+	rbtree_t	*tree;				//!< Entries, by key.
+	fr_heap_t	*heap;				//!< Entries, by expiry time.
+	uint8_t		secret[SHA256_DIGEST_LENGTH];	//!< Keys the cache entries, so they don't reveal
+							//!< anything about the password.
+	uint32_t	token;				//!< Shared by all sessions until token_expires.
+	fr_time_t	token_expires;			//!< When to pick a new token.
+	pthread_mutex_t	mutex;				//!< Protects everything above.
+} pwd_cache_t;
+
 typedef struct {
     BN_CTX *bnctx;
 
@@ -48,6 +76,9 @@ typedef struct {
     uint32_t	fragment_size;
     char const	*server_id;
     char const	*virtual_server;
+
+    fr_time_delta_t	cache_lifetime;			//!< How long to reuse password elements for.
+    pwd_cache_t		*cache;				//!< Or NULL if cache_lifetime is 0.
 } rlm_eap_pwd_t;
 
 #define MPPE_KEY_LEN    32
@@ -57,6 +88,7 @@ static CONF_PARSER submodule_config[] = {
 	{ FR_CONF_OFFSET("group", FR_TYPE_UINT32, rlm_eap_pwd_t, group), .dflt = "19" },
 	{ FR_CONF_OFFSET("fragment_size", FR_TYPE_UINT32, rlm_eap_pwd_t, fragment_size), .dflt = "1020" },
 	{ FR_CONF_OFFSET("server_id", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_eap_pwd_t, server_id) },
+	{ FR_CONF_OFFSET("cache_lifetime", FR_TYPE_TIME_DELTA, rlm_eap_pwd_t, cache_lifetime), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -84,6 +116,177 @@ fr_dict_attr_autoload_t rlm_eap_pwd_dict_attr[] = {
 	{ NULL }
 };
 
+static int pwd_cache_cmp(void const *one, void const *two)
+{
+	pwd_cache_entry_t const *a = one, *b = two;
+
+	return memcmp(a->key, b->key, sizeof(a->key));
+}
+
+static int8_t pwd_cache_heap_cmp(void const *one, void const *two)
+{
+	pwd_cache_entry_t const *a = one, *b = two;
+
+	return (a->expires > b->expires) - (a->expires < b->expires);
+}
+
+static void _pwd_cache_entry_free(void *data)
+{
+	pwd_cache_entry_t *entry = data;
+
+	memset(entry->pwe, 0, entry->pwe_len);
+	talloc_free(entry);
+}
+
+static int _pwd_cache_free(pwd_cache_t *cache)
+{
+	TALLOC_FREE(cache->tree);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Remove entries which have expired
+ *
+ * @note Must be called with the mutex held.
+ */
+static void pwd_cache_expire(pwd_cache_t *cache, fr_time_t now)
+{
+	pwd_cache_entry_t *entry;
+
+	while ((entry = fr_heap_peek(cache->heap)) && (entry->expires <= now)) {
+		fr_heap_extract(cache->heap, entry);
+		rbtree_deletebydata(cache->tree, entry);
+	}
+}
+
+/** Return the token to send in an EAP-pwd-ID/Request
+ *
+ */
+static uint32_t pwd_token(rlm_eap_pwd_t const *inst)
+{
+	pwd_cache_t	*cache = inst->cache;
+	fr_time_t	now;
+	uint32_t	token;
+
+	if (!cache) return fr_rand();
+
+	now = fr_time();
+
+	pthread_mutex_lock(&cache->mutex);
+	if (now >= cache->token_expires) {
+		cache->token = fr_rand();
+		cache->token_expires = now + inst->cache_lifetime;
+	}
+	token = cache->token;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return token;
+}
+
+/** Derive the key for a cache entry
+ *
+ * Covers everything which goes into the hunting and pecking loop.
+ */
+static void pwd_cache_key(uint8_t key[SHA256_DIGEST_LENGTH], pwd_cache_t const *cache, pwd_session_t const *session,
+			  char const *password, size_t password_len, char const *server_id)
+{
+	HMAC_CTX	*ctx;
+	unsigned int	len = SHA256_DIGEST_LENGTH;
+	uint8_t		sep = 0;
+
+	MEM(ctx = HMAC_CTX_new());
+	HMAC_Init_ex(ctx, cache->secret, sizeof(cache->secret), EVP_sha256(), NULL);
+	HMAC_Update(ctx, (uint8_t const *)&session->token, sizeof(session->token));
+	HMAC_Update(ctx, (uint8_t const *)&session->group_num, sizeof(session->group_num));
+	HMAC_Update(ctx, (uint8_t const *)server_id, strlen(server_id));
+	HMAC_Update(ctx, &sep, sizeof(sep));
+	HMAC_Update(ctx, (uint8_t const *)session->peer_id, session->peer_id_len);
+	HMAC_Update(ctx, &sep, sizeof(sep));
+	HMAC_Update(ctx, (uint8_t const *)password, password_len);
+	HMAC_Final(ctx, key, &len);
+	HMAC_CTX_free(ctx);
+}
+
+/** Get the password element for a session
+ *
+ * Uses a cached element if there is one, otherwise runs the hunting
+ * and pecking loop, and caches the result.
+ */
+static int pwd_password_element(request_t *request, rlm_eap_pwd_t const *inst, pwd_session_t *session,
+				char const *password, size_t password_len)
+{
+	pwd_cache_t		*cache = inst->cache;
+	pwd_cache_entry_t	find, *entry;
+	fr_time_t		now;
+	uint8_t			*buff;
+	size_t			len;
+	bool			found = false;
+
+	if (!cache) goto compute;
+
+	pwd_cache_key(find.key, cache, session, password, password_len, inst->server_id);
+
+	if (pwd_group_init(session, session->group_num) < 0) return -1;
+
+	now = fr_time();
+
+	pthread_mutex_lock(&cache->mutex);
+	pwd_cache_expire(cache, now);
+	entry = rbtree_finddata(cache->tree, &find);
+	if (entry) found = (EC_POINT_oct2point(session->group, session->pwe,
+					       entry->pwe, entry->pwe_len, inst->bnctx) == 1);
+	pthread_mutex_unlock(&cache->mutex);
+
+	if (found) {
+		RDEBUG2("Using cached password element");
+		return 0;
+	}
+
+	/*
+	 *	Start again, compute_password_element() sets
+	 *	up the group itself.
+	 */
+	EC_POINT_clear_free(session->pwe);
+	session->pwe = NULL;
+	EC_GROUP_free(session->group);
+	session->group = NULL;
+	BN_clear_free(session->order);
+	session->order = NULL;
+	BN_clear_free(session->prime);
+	session->prime = NULL;
+
+compute:
+	if (compute_password_element(request, session, session->group_num,
+				     password, password_len,
+				     inst->server_id, strlen(inst->server_id),
+				     session->peer_id, strlen(session->peer_id),
+				     &session->token, inst->bnctx) < 0) return -1;
+
+	if (!cache) return 0;
+
+	len = EC_POINT_point2oct(session->group, session->pwe, POINT_CONVERSION_UNCOMPRESSED, NULL, 0, inst->bnctx);
+	if (len == 0) return 0;
+
+	pthread_mutex_lock(&cache->mutex);
+	MEM(entry = talloc_zero(cache, pwd_cache_entry_t));
+	memcpy(entry->key, find.key, sizeof(entry->key));
+	MEM(buff = talloc_array(entry, uint8_t, len));
+	entry->pwe_len = EC_POINT_point2oct(session->group, session->pwe, POINT_CONVERSION_UNCOMPRESSED,
+					    buff, len, inst->bnctx);
+	entry->pwe = buff;
+	entry->expires = now + inst->cache_lifetime;
+
+	if ((entry->pwe_len == 0) || !rbtree_insert(cache->tree, entry)) {
+		_pwd_cache_entry_free(entry);
+	} else {
+		fr_heap_insert(cache->heap, entry);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return 0;
+}
+
 static int send_pwd_request(request_t *request, pwd_session_t *session, eap_round_t *eap_round)
 {
 	size_t		len;
@@ -329,11 +532,8 @@ static unlang_action_t mod_process(rlm_rcode_t *p_result, module_ctx_t const *mc
 			RETURN_MODULE_FAIL;
 		}
 
-		ret = compute_password_element(request, session, session->group_num,
-					       known_good->vp_strvalue, known_good->vp_length,
-					       inst->server_id, strlen(inst->server_id),
-					       session->peer_id, strlen(session->peer_id),
-					       &session->token, inst->bnctx);
+		ret = pwd_password_element(request, inst, session,
+					   known_good->vp_strvalue, known_good->vp_length);
 		if (ephemeral) talloc_list_free(&known_good);
 		if (ret < 0) {
 			REDEBUG("Failed to obtain password element");
@@ -532,7 +732,7 @@ static unlang_action_t mod_session_init(rlm_rcode_t *p_result, module_ctx_t cons
 	packet->group_num = htons(session->group_num);
 	packet->random_function = EAP_PWD_DEF_RAND_FUN;
 	packet->prf = EAP_PWD_DEF_PRF;
-	session->token = fr_rand();
+	session->token = pwd_token(inst);
 	memcpy(packet->token, (char *)&session->token, 4);
 	packet->prep = EAP_PWD_PREP_NONE;
 	memcpy(packet->identity, inst->server_id, session->out_len - sizeof(pwd_id_packet_t) );
@@ -583,6 +783,34 @@ static int mod_instantiate(void *instance, CONF_SECTION *cs)
 		return -1;
 	}
 
+	if (inst->cache_lifetime) {
+		pwd_cache_t *cache;
+
+		MEM(cache = talloc_zero(inst, pwd_cache_t));
+		MEM(cache->heap = fr_heap_talloc_alloc(cache, pwd_cache_heap_cmp, pwd_cache_entry_t, heap_id));
+		fr_rand_buffer(cache->secret, sizeof(cache->secret));
+
+		if (pthread_mutex_init(&cache->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		error:
+			talloc_free(cache);
+			return -1;
+		}
+
+		/*
+		 *	Set last, as the destructor uses it to tell
+		 *	whether the mutex needs to be destroyed.
+		 */
+		cache->tree = rbtree_talloc_alloc(cache, pwd_cache_cmp, pwd_cache_entry_t, _pwd_cache_entry_free, 0);
+		if (!cache->tree) {
+			pthread_mutex_destroy(&cache->mutex);
+			goto error;
+		}
+		talloc_set_destructor(cache, _pwd_cache_free);
+
+		inst->cache = cache;
+	}
+
 	return 0;
 }
 
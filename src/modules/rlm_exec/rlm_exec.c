@@ -46,10 +46,58 @@ typedef struct {
 	bool			shell_escape;
 	fr_time_delta_t		timeout;
 	bool			timeout_is_set;
+	bool			persistent;
+	uint32_t		processes;
 
 	tmpl_t	*tmpl;
 } rlm_exec_t;
 
+typedef struct rlm_exec_thread_s rlm_exec_thread_t;
+typedef struct rlm_exec_helper_s rlm_exec_helper_t;
+
+/** A request sent to, or waiting for, a persistent program
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< In the thread's queue of requests waiting for a helper.
+	request_t		*request;	//!< To resume when the helper replies.
+	rlm_exec_thread_t	*t;		//!< Thread which owns the queue and the helpers.
+	rlm_exec_helper_t	*helper;	//!< Which is processing this request.  NULL if queued.
+
+	char			*msg;		//!< Input pairs, as sent to the helper.
+	size_t			msg_len;	//!< Length of the message.
+
+	int			status;		//!< Code returned by the helper, or -1 on failure.
+	char			*reply;		//!< Output pairs, one per line.
+} rlm_exec_persistent_t;
+
+/** A long running program, used when "persistent = yes"
+ *
+ */
+struct rlm_exec_helper_s {
+	fr_dlist_t		entry;		//!< In the thread's list of helpers.
+	rlm_exec_thread_t	*t;		//!< Thread which owns the helper.
+
+	pid_t			pid;		//!< Of the helper.
+	int			to_child;	//!< Helper's stdin.
+	int			from_child;	//!< Helper's stdout.
+
+	bool			busy;		//!< Waiting for a reply.  Even if the request went away.
+	rlm_exec_persistent_t	*current;	//!< Request the reply is for.  NULL if it was cancelled.
+	fr_event_timer_t const	*ev;		//!< Timeout for the reply.
+
+	size_t			used;		//!< How much of the buffer holds the partial reply.
+	char			buffer[8192];	//!< Reply being read.
+};
+
+struct rlm_exec_thread_s {
+	rlm_exec_t const	*inst;		//!< Instance of rlm_exec.
+	fr_event_list_t		*el;		//!< This thread's event list.
+
+	fr_dlist_head_t		helpers;	//!< Persistent programs we've started.
+	fr_dlist_head_t		queue;		//!< Requests waiting for a free helper.
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("wait", FR_TYPE_BOOL, rlm_exec_t, wait), .dflt = "yes" },
 	{ FR_CONF_OFFSET("program", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_exec_t, program) },
@@ -57,6 +105,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("output_pairs", FR_TYPE_STRING, rlm_exec_t, output) },
 	{ FR_CONF_OFFSET("shell_escape", FR_TYPE_BOOL, rlm_exec_t, shell_escape), .dflt = "yes" },
 	{ FR_CONF_OFFSET_IS_SET("timeout", FR_TYPE_TIME_DELTA, rlm_exec_t, timeout) },
+	{ FR_CONF_OFFSET("persistent", FR_TYPE_BOOL, rlm_exec_t, persistent), .dflt = "no" },
+	{ FR_CONF_OFFSET("processes", FR_TYPE_UINT32, rlm_exec_t, processes), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -184,6 +234,30 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	/*
+	 *	Persistent programs are started without a request,
+	 *	and we always wait for their reply.
+	 */
+	if (inst->persistent) {
+		if (!inst->wait) {
+			cf_log_err(conf, "Cannot use persistent = yes if wait = no");
+			return -1;
+		}
+
+		if (!inst->program) {
+			cf_log_err(conf, "Cannot use persistent = yes without a program");
+			return -1;
+		}
+
+		if (strchr(inst->program, '%') != NULL) {
+			cf_log_err(conf, "Program cannot contain expansions if persistent = yes");
+			return -1;
+		}
+
+		FR_INTEGER_BOUND_CHECK("processes", inst->processes, >=, 1);
+		FR_INTEGER_BOUND_CHECK("processes", inst->processes, <=, 64);
+	}
+
 	if (inst->timeout_is_set || !inst->timeout) {
 		/*
 		 *	Pick the shorter one
@@ -387,6 +461,393 @@ static unlang_action_t mod_exec_wait_resume(rlm_rcode_t *p_result, module_ctx_t
 	RETURN_MODULE_RCODE(rlm_exec_status2rcode(request, m->box, status));
 }
 
+/** Remove a request from the queue, or detach it from its helper
+ *
+ * If the request was sent to a helper, the helper stays busy
+ * until the reply arrives, and the reply is discarded.
+ */
+static void exec_persistent_detach(rlm_exec_persistent_t *p)
+{
+	fr_dlist_remove(&p->t->queue, p);
+
+	if (p->helper) {
+		p->helper->current = NULL;
+		p->helper = NULL;
+	}
+}
+
+static int _exec_persistent_free(rlm_exec_persistent_t *p)
+{
+	exec_persistent_detach(p);
+
+	return 0;
+}
+
+/** Fail a request, and resume it
+ *
+ */
+static void exec_persistent_fail(rlm_exec_persistent_t *p)
+{
+	exec_persistent_detach(p);
+
+	p->status = -1;
+	unlang_interpret_mark_resumable(p->request);
+}
+
+/** Shut down a persistent program
+ *
+ */
+static int _exec_helper_free(rlm_exec_helper_t *helper)
+{
+	rlm_exec_thread_t	*t = helper->t;
+
+	fr_dlist_remove(&t->helpers, helper);
+
+	if (helper->current) exec_persistent_fail(helper->current);
+
+	if (helper->from_child >= 0) {
+		(void) fr_event_fd_delete(t->el, helper->from_child, FR_EVENT_FILTER_IO);
+		close(helper->from_child);
+	}
+	if (helper->to_child >= 0) close(helper->to_child);
+
+	/*
+	 *	Closing stdin should be enough, but the program may
+	 *	be stuck.  Let the event loop reap it.
+	 */
+	kill(helper->pid, SIGTERM);
+	(void) fr_event_pid_wait(t->el, t->el, NULL, helper->pid, NULL, NULL);
+
+	return 0;
+}
+
+static void exec_persistent_run(rlm_exec_thread_t *t);
+
+/** Give up on a helper, failing any request it is processing
+ *
+ */
+static void exec_helper_fail(rlm_exec_helper_t *helper, char const *msg)
+{
+	rlm_exec_thread_t	*t = helper->t;
+	rlm_exec_t const	*inst = t->inst;
+
+	ERROR("Persistent program PID %u %s - restarting it", helper->pid, msg);
+
+	talloc_free(helper);
+
+	/*
+	 *	Start a replacement, if anything is waiting.
+	 */
+	exec_persistent_run(t);
+}
+
+static void exec_helper_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_exec_helper_t	*helper = talloc_get_type_abort(uctx, rlm_exec_helper_t);
+
+	exec_helper_fail(helper, "is taking too much time");
+}
+
+static void exec_helper_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			      UNUSED int fd_errno, void *uctx)
+{
+	rlm_exec_helper_t	*helper = talloc_get_type_abort(uctx, rlm_exec_helper_t);
+
+	exec_helper_fail(helper, "exited");
+}
+
+/** Read a reply from a persistent program
+ *
+ * A reply is a line containing the return code, as with
+ * the exit status of a normal program.  Then zero or more
+ * lines of output pairs, then an empty line.
+ */
+static void exec_helper_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_exec_helper_t	*helper = talloc_get_type_abort(uctx, rlm_exec_helper_t);
+	rlm_exec_thread_t	*t = helper->t;
+	rlm_exec_persistent_t	*p;
+	ssize_t			slen;
+	char			*end, *eol;
+
+	slen = read(helper->from_child, helper->buffer + helper->used, sizeof(helper->buffer) - 1 - helper->used);
+	if (slen == 0) {
+		exec_helper_fail(helper, "exited");
+		return;
+	}
+	if (slen < 0) {
+		if ((errno == EINTR) || (errno == EAGAIN)) return;
+
+		exec_helper_fail(helper, "could not be read");
+		return;
+	}
+
+	if (!helper->busy) {
+		exec_helper_fail(helper, "wrote data when no request was outstanding");
+		return;
+	}
+
+	helper->used += slen;
+	helper->buffer[helper->used] = '\0';
+
+	end = strstr(helper->buffer, "\n\n");
+	if (!end) {
+		if (helper->used >= (sizeof(helper->buffer) - 1)) exec_helper_fail(helper, "sent too long a reply");
+		return;
+	}
+
+	/*
+	 *	Only one request is outstanding, so anything after
+	 *	the reply means we're out of step with the program.
+	 */
+	if ((end + 2) != (helper->buffer + helper->used)) {
+		exec_helper_fail(helper, "sent data after its reply");
+		return;
+	}
+	end[1] = '\0';
+
+	eol = strchr(helper->buffer, '\n');
+	if (((eol - helper->buffer) != 1) || !isdigit((uint8_t) helper->buffer[0])) {
+		exec_helper_fail(helper, "sent an invalid return code");
+		return;
+	}
+
+	p = helper->current;
+	if (p) {
+		p->status = helper->buffer[0] - '0';
+		p->reply = talloc_strdup(p, eol + 1);
+		p->helper = NULL;
+		unlang_interpret_mark_resumable(p->request);
+	}
+
+	helper->current = NULL;
+	helper->busy = false;
+	helper->used = 0;
+	fr_event_timer_delete(&helper->ev);
+
+	exec_persistent_run(t);
+}
+
+/** Start a new persistent program
+ *
+ */
+static rlm_exec_helper_t *exec_helper_alloc(rlm_exec_thread_t *t)
+{
+	rlm_exec_t const	*inst = t->inst;
+	rlm_exec_helper_t	*helper;
+
+	MEM(helper = talloc_zero(t, rlm_exec_helper_t));
+	helper->t = t;
+	helper->to_child = -1;
+	helper->from_child = -1;
+
+	helper->pid = radius_start_program(inst->program, NULL, true,
+					   &helper->to_child, &helper->from_child, NULL, false);
+	if (helper->pid < 0) {
+		PERROR("Failed starting persistent program");
+		talloc_free(helper);
+		return NULL;
+	}
+
+	fr_dlist_insert_tail(&t->helpers, helper);
+	talloc_set_destructor(helper, _exec_helper_free);
+
+	fr_nonblock(helper->to_child);
+	fr_nonblock(helper->from_child);
+
+	if (fr_event_fd_insert(helper, t->el, helper->from_child,
+			       exec_helper_read, NULL, exec_helper_error, helper) < 0) {
+		PERROR("Failed watching persistent program");
+		talloc_free(helper);
+		return NULL;
+	}
+
+	return helper;
+}
+
+/** Find an idle helper, starting a new one if we're allowed to
+ *
+ */
+static rlm_exec_helper_t *exec_helper_get(rlm_exec_thread_t *t)
+{
+	rlm_exec_helper_t	*helper = NULL;
+
+	while ((helper = fr_dlist_next(&t->helpers, helper))) {
+		if (!helper->busy) return helper;
+	}
+
+	if (fr_dlist_num_elements(&t->helpers) >= t->inst->processes) return NULL;
+
+	return exec_helper_alloc(t);
+}
+
+/** Send a request to an idle helper
+ *
+ * The message is small, and the helper has read everything
+ * we sent it before, so a short write means it's not working.
+ */
+static int exec_helper_send(rlm_exec_helper_t *helper, rlm_exec_persistent_t *p)
+{
+	rlm_exec_thread_t	*t = helper->t;
+
+	if (write(helper->to_child, p->msg, p->msg_len) != (ssize_t) p->msg_len) return -1;
+
+	if (fr_event_timer_in(helper, t->el, &helper->ev, t->inst->timeout, exec_helper_timeout, helper) < 0) return -1;
+
+	helper->busy = true;
+	helper->current = p;
+	p->helper = helper;
+
+	return 0;
+}
+
+/** Send queued requests to any idle helpers
+ *
+ */
+static void exec_persistent_run(rlm_exec_thread_t *t)
+{
+	rlm_exec_persistent_t	*p;
+	rlm_exec_helper_t	*helper;
+
+	while ((p = fr_dlist_head(&t->queue))) {
+		helper = exec_helper_get(t);
+		if (!helper) {
+			/*
+			 *	Wait for a running helper to finish.
+			 */
+			if (fr_dlist_num_elements(&t->helpers) > 0) return;
+
+			exec_persistent_fail(p);
+			continue;
+		}
+
+		fr_dlist_remove(&t->queue, p);
+
+		if (exec_helper_send(helper, p) < 0) {
+			exec_persistent_fail(p);
+			talloc_free(helper);
+		}
+	}
+}
+
+static unlang_action_t mod_exec_persistent_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+						  request_t *request, void *rctx)
+{
+	rlm_exec_persistent_t	*p = talloc_get_type_abort(rctx, rlm_exec_persistent_t);
+	rlm_exec_t const       	*inst = talloc_get_type_abort_const(mctx->instance, rlm_exec_t);
+
+	if (p->status < 0) {
+		REDEBUG("No reply from persistent program");
+		RETURN_MODULE_FAIL;
+	}
+
+	if (inst->output && p->reply) {
+		TALLOC_CTX	*ctx;
+		fr_pair_list_t	vps, *output_pairs;
+		char		*line, *next;
+
+		output_pairs = tmpl_list_head(request, inst->output_list);
+		fr_assert(output_pairs != NULL);
+
+		ctx = tmpl_list_ctx(request, inst->output_list);
+
+		fr_pair_list_init(&vps);
+		for (line = p->reply; *line; line = next) {
+			next = strchr(line, '\n');
+			if (next) {
+				*next++ = '\0';
+			} else {
+				next = line + strlen(line);
+			}
+
+			if (fr_pair_list_afrom_str(ctx, request->dict, line, &vps) == T_INVALID) {
+				RPERROR("Failed parsing output from persistent program");
+				fr_pair_list_free(&vps);
+				RETURN_MODULE_FAIL;
+			}
+		}
+
+		fr_pair_list_tainted(&vps);
+		fr_pair_list_move(output_pairs, &vps);
+	}
+
+	RETURN_MODULE_RCODE(rlm_exec_status2rcode(request, NULL, p->status));
+}
+
+static void mod_exec_persistent_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+				       void *rctx, fr_state_signal_t action)
+{
+	rlm_exec_persistent_t	*p = talloc_get_type_abort(rctx, rlm_exec_persistent_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	exec_persistent_detach(p);
+}
+
+/** Send the input pairs to a persistent program
+ *
+ * Each pair is written on its own line, followed by an empty line.
+ */
+static unlang_action_t mod_exec_persistent(rlm_rcode_t *p_result, rlm_exec_t const *inst, rlm_exec_thread_t *t,
+					   request_t *request, TALLOC_CTX *ctx)
+{
+	rlm_exec_persistent_t	*p;
+	rlm_exec_helper_t	*helper;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
+
+	MEM(p = talloc_zero(ctx, rlm_exec_persistent_t));
+	p->request = request;
+	p->t = t;
+	p->status = -1;
+
+	fr_sbuff_init_talloc(p, &sbuff, &tctx, 256, SIZE_MAX);
+
+	if (inst->input) {
+		fr_pair_list_t	*input_pairs;
+		fr_pair_t	*vp;
+		fr_cursor_t	cursor;
+
+		input_pairs = tmpl_list_head(request, inst->input_list);
+		if (!input_pairs) RETURN_MODULE_INVALID;
+
+		for (vp = fr_cursor_init(&cursor, input_pairs);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) {
+			if ((fr_pair_print(&sbuff, NULL, vp) < 0) || (fr_sbuff_in_char(&sbuff, '\n') < 0)) {
+			oom:
+				REDEBUG("Failed serialising input pairs");
+				RETURN_MODULE_FAIL;
+			}
+		}
+	}
+	if (fr_sbuff_in_char(&sbuff, '\n') < 0) goto oom;
+
+	p->msg = fr_sbuff_buff(&sbuff);
+	p->msg_len = fr_sbuff_used(&sbuff);
+
+	talloc_set_destructor(p, _exec_persistent_free);
+
+	helper = exec_helper_get(t);
+	if (helper) {
+		if (exec_helper_send(helper, p) < 0) {
+			REDEBUG("Failed sending request to persistent program");
+			talloc_free(helper);
+			RETURN_MODULE_FAIL;
+		}
+
+	} else if (fr_dlist_num_elements(&t->helpers) == 0) {
+		REDEBUG("Failed starting persistent program");
+		RETURN_MODULE_FAIL;
+
+	} else {
+		RDEBUG3("All persistent programs are busy, queueing request");
+		fr_dlist_insert_tail(&t->queue, p);
+	}
+
+	return unlang_module_yield(request, mod_exec_persistent_resume, mod_exec_persistent_signal, p);
+}
+
 /*
  *  Dispatch an async exec method
  */
@@ -408,6 +869,11 @@ static unlang_action_t CC_HINT(nonnull) mod_exec_dispatch(rlm_rcode_t *p_result,
 	 */
 	ctx = unlang_interpret_frame_talloc_ctx(request);
 
+	if (inst->persistent) {
+		return mod_exec_persistent(p_result, inst, talloc_get_type_abort(mctx->thread, rlm_exec_thread_t),
+					   request, ctx);
+	}
+
 	/*
 	 *	Do the asynchronous xlat expansion.
 	 */
@@ -442,6 +908,41 @@ static unlang_action_t CC_HINT(nonnull) mod_exec_dispatch(rlm_rcode_t *p_result,
 	return unlang_module_yield_to_tmpl(m, &m->box, &m->status, request, inst->tmpl, &env_pairs, mod_exec_wait_resume, NULL, m);
 }
 
+/** Start the persistent programs for this thread
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_exec_t		*inst = talloc_get_type_abort(instance, rlm_exec_t);
+	rlm_exec_thread_t	*t = talloc_get_type_abort(thread, rlm_exec_thread_t);
+	uint32_t		i;
+
+	t->inst = inst;
+	t->el = el;
+	fr_dlist_talloc_init(&t->helpers, rlm_exec_helper_t, entry);
+	fr_dlist_talloc_init(&t->queue, rlm_exec_persistent_t, entry);
+
+	if (!inst->persistent) return 0;
+
+	for (i = 0; i < inst->processes; i++) {
+		if (!exec_helper_alloc(t)) return -1;
+	}
+
+	return 0;
+}
+
+/** Stop the persistent programs for this thread
+ *
+ */
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_exec_thread_t	*t = talloc_get_type_abort(thread, rlm_exec_thread_t);
+
+	fr_dlist_talloc_free(&t->helpers);
+
+	return 0;
+}
 
 /*
  *	The module name should be the only globally exported symbol.
@@ -461,6 +962,12 @@ module_t rlm_exec = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+
+	.thread_inst_size	= sizeof(rlm_exec_thread_t),
+	.thread_inst_type	= "rlm_exec_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_exec_dispatch,
 		[MOD_AUTHORIZE]		= mod_exec_dispatch,
@@ -32,28 +32,52 @@ RCSID("$Id$")
 #include <ctype.h>
 #include <fcntl.h>
 
+/** The entries from one file
+ *
+ * DEFAULT entries are indexed by the value of their first "==" check
+ * item, where that's possible.  For a request, we only need to look at
+ * the DEFAULT entries in the buckets matching the values in the
+ * request, and the DEFAULT entries which couldn't be indexed.
+ */
+typedef struct {
+	rbtree_t		*users;		//!< Entries for named users, keyed by name.
+	PAIR_LIST		*defaults;	//!< DEFAULT entries which can't be indexed.
+	fr_hash_table_t		*index;		//!< DEFAULT entries, keyed by a check item.
+	fr_dict_attr_t const	**index_da;	//!< Attributes used as keys in the index.
+} rlm_files_data_t;
+
+/** A bucket in the DEFAULT index
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< Attribute of the check item.
+	fr_value_box_t const	*value;		//!< Value the attribute must have.
+	PAIR_LIST		*head;		//!< Matching DEFAULT entries, in file order.
+	PAIR_LIST		**tail;		//!< Where the next entry goes.
+} rlm_files_index_t;
+
 typedef struct {
 	tmpl_t *key;
 
 	char const *filename;
-	rbtree_t *common;
+	rlm_files_data_t *common;
 
 	/* autz */
 	char const *usersfile;
-	rbtree_t *users;
+	rlm_files_data_t *users;
 
 
 	/* authenticate */
 	char const *auth_usersfile;
-	rbtree_t *auth_users;
+	rlm_files_data_t *auth_users;
 
 	/* preacct */
 	char const *acct_usersfile;
-	rbtree_t *acct_users;
+	rlm_files_data_t *acct_users;
 
 	/* post-authenticate */
 	char const *postauth_usersfile;
-	rbtree_t *postauth_users;
+	rlm_files_data_t *postauth_users;
 } rlm_files_t;
 
 static fr_dict_t const *dict_freeradius;
@@ -67,10 +91,12 @@ fr_dict_autoload_t rlm_files_dict[] = {
 };
 
 static fr_dict_attr_t const *attr_fall_through;
+static fr_dict_attr_t const *attr_user_password;
 
 extern fr_dict_attr_autoload_t rlm_files_dict_attr[];
 fr_dict_attr_autoload_t rlm_files_dict_attr[] = {
 	{ .out = &attr_fall_through, .name = "Fall-Through", .type = FR_TYPE_BOOL, .dict = &dict_freeradius },
+	{ .out = &attr_user_password, .name = "User-Password", .type = FR_TYPE_STRING, .dict = &dict_radius },
 
 	{ NULL }
 };
@@ -92,16 +118,153 @@ static int pairlist_cmp(void const *a, void const *b)
 	return strcmp(((PAIR_LIST const *)a)->name, ((PAIR_LIST const *)b)->name);
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
+/** Hash a value the same way paircmp_pairs() compares it
+ *
+ * i.e. IP addresses without their prefix or scope.
+ */
+static uint32_t index_hash(void const *data)
+{
+	rlm_files_index_t const *idx = data;
+	fr_value_box_t const	*vb = idx->value;
+	uint32_t		hash;
+
+	hash = fr_hash(&idx->da, sizeof(idx->da));
+
+	switch (vb->type) {
+	case FR_TYPE_IPV4_ADDR:
+		return fr_hash_update(&vb->vb_ip.addr.v4, sizeof(vb->vb_ip.addr.v4), hash);
+
+	case FR_TYPE_IPV6_ADDR:
+		return fr_hash_update(&vb->vb_ip.addr.v6, sizeof(vb->vb_ip.addr.v6), hash);
+
+	default:
+		return fr_value_box_hash_update(vb, hash);
+	}
+}
+
+static int index_cmp(void const *one, void const *two)
+{
+	rlm_files_index_t const *a = one, *b = two;
+	fr_value_box_t const	*va = a->value, *vb = b->value;
+
+	if (a->da != b->da) return (a->da > b->da) - (a->da < b->da);
+	if (va->type != vb->type) return (va->type > vb->type) - (va->type < vb->type);
+
+	switch (va->type) {
+	case FR_TYPE_IPV4_ADDR:
+		return memcmp(&va->vb_ip.addr.v4, &vb->vb_ip.addr.v4, sizeof(va->vb_ip.addr.v4));
+
+	case FR_TYPE_IPV6_ADDR:
+		return memcmp(&va->vb_ip.addr.v6, &vb->vb_ip.addr.v6, sizeof(va->vb_ip.addr.v6));
+
+	case FR_TYPE_STRING:
+		return strcmp(va->vb_strvalue, vb->vb_strvalue);
+
+	default:
+		return fr_value_box_cmp(va, vb);
+	}
+}
+
+/** Find a check item which can be used to index a DEFAULT entry
+ *
+ * The check item has to be a plain "==" comparison of a protocol
+ * attribute against a fixed value, which paircmp() will compare
+ * against the request.  Anything else (special comparison functions,
+ * xlats, regexes, server attributes, User-Password hacks) has to be
+ * evaluated for every request.
+ */
+static map_t *index_map(PAIR_LIST const *entry)
+{
+	map_t *map;
+
+	for (map = entry->check; map; map = map->next) {
+		fr_dict_attr_t const *da;
+
+		if (map->op != T_OP_CMP_EQ) continue;
+		if (!tmpl_is_attr(map->lhs) || !tmpl_is_data(map->rhs)) continue;
+
+		da = tmpl_da(map->lhs);
+		if ((fr_dict_by_da(da) == dict_freeradius) || (da == attr_user_password)) continue;
+		if (paircmp_find(da)) continue;
+		if (tmpl_value(map->rhs)->type != da->type) continue;
+
+		switch (da->type) {
+		case FR_TYPE_STRING:
+		case FR_TYPE_OCTETS:
+		case FR_TYPE_UINT8:
+		case FR_TYPE_UINT16:
+		case FR_TYPE_UINT32:
+		case FR_TYPE_UINT64:
+		case FR_TYPE_INT32:
+		case FR_TYPE_IPV4_ADDR:
+		case FR_TYPE_IPV6_ADDR:
+			return map;
+
+		default:
+			continue;
+		}
+	}
+
+	return NULL;
+}
+
+/** Add a DEFAULT entry to the index, or to the list of entries which can't be indexed
+ *
+ */
+static int index_add(rlm_files_data_t *data, PAIR_LIST ***defaults_tail, PAIR_LIST *entry)
+{
+	map_t			*map;
+	rlm_files_index_t	*idx;
+	size_t			i, num;
+
+	map = index_map(entry);
+	if (!map) {
+		**defaults_tail = entry;
+		*defaults_tail = &entry->next;
+		return 0;
+	}
+
+	idx = fr_hash_table_find_by_data(data->index, &(rlm_files_index_t){
+							.da = tmpl_da(map->lhs),
+							.value = tmpl_value(map->rhs)
+						});
+	if (idx) {
+		*idx->tail = entry;
+		idx->tail = &entry->next;
+		return 0;
+	}
+
+	MEM(idx = talloc_zero(data, rlm_files_index_t));
+	idx->da = tmpl_da(map->lhs);
+	idx->value = tmpl_value(map->rhs);
+	idx->head = entry;
+	idx->tail = &entry->next;
+
+	if (!fr_hash_table_insert(data->index, idx)) {
+		talloc_free(idx);
+		return -1;
+	}
+
+	num = talloc_array_length(data->index_da);
+	for (i = 0; i < num; i++) if (data->index_da[i] == idx->da) return 0;
+
+	MEM(data->index_da = talloc_realloc(data, data->index_da, fr_dict_attr_t const *, num + 1));
+	data->index_da[num] = idx->da;
+
+	return 0;
+}
+
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, rlm_files_data_t **pdata)
 {
 	int rcode;
 	PAIR_LIST *users = NULL;
 	PAIR_LIST *entry, *next;
-	PAIR_LIST *user_list, *default_list, **default_tail;
+	PAIR_LIST *user_list, **defaults_tail;
+	rlm_files_data_t *data;
 	rbtree_t *tree;
 
 	if (!filename) {
-		*ptree = NULL;
+		*pdata = NULL;
 		return 0;
 	}
 
@@ -206,14 +369,16 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		entry = entry->next;
 	}
 
-	tree = rbtree_alloc(ctx, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
-	if (!tree) {
+	MEM(data = talloc_zero(ctx, rlm_files_data_t));
+	data->users = tree = rbtree_alloc(data, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
+	data->index = fr_hash_table_create(data, index_hash, index_cmp, NULL);
+	if (!tree || !data->index) {
 		pairlist_free(&users);
+		talloc_free(data);
 		return -1;
 	}
 
-	default_list = NULL;
-	default_tail = &default_list;
+	defaults_tail = &data->defaults;
 
 	/*
 	 *	We've read the entries in linearly, but putting them
@@ -239,32 +404,16 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		 */
 
 		/*
-		 *	DEFAULT entries get their own list.
+		 *	DEFAULT entries get indexed separately.
 		 */
 		if (strcmp(entry->name, "DEFAULT") == 0) {
-			if (!default_list) {
-				default_list = entry;
-
-				/*
-				 *	Insert the first DEFAULT into the tree.
-				 */
-				if (!rbtree_insert(tree, entry)) {
-				error:
-					pairlist_free(&entry);
-					pairlist_free(&next);
-					talloc_free(tree);
-					return -1;
-				}
-
-			} else {
-				/*
-				 *	Tack this entry onto the tail
-				 *	of the DEFAULT list.
-				 */
-				*default_tail = entry;
+			if (index_add(data, &defaults_tail, entry) < 0) {
+			error:
+				pairlist_free(&entry);
+				pairlist_free(&next);
+				talloc_free(data);
+				return -1;
 			}
-
-			default_tail = &entry->next;
 			continue;
 		}
 
@@ -293,7 +442,7 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		}
 	}
 
-	*ptree = tree;
+	*pdata = data;
 
 	return 0;
 }
@@ -323,31 +472,69 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
  *	Common code called by everything below.
  */
 static unlang_action_t file_common(rlm_rcode_t *p_result, rlm_files_t const *inst,
-				   request_t *request, char const *filename, rbtree_t *tree)
+				   request_t *request, char const *filename, rlm_files_data_t const *data)
 {
 	char const		*name;
-	PAIR_LIST const 	*user_pl, *default_pl;
+	PAIR_LIST const 	**pl_list;
+	size_t			i, j, pl_num = 0, pl_max;
 	bool			found = false;
 	PAIR_LIST		my_pl;
 	char			buffer[256];
+	fr_cursor_t		vp_cursor;
+	fr_pair_t		*vp;
 
 	if (tmpl_expand(&name, buffer, sizeof(buffer), request, inst->key, NULL, NULL) < 0) {
 		REDEBUG("Failed expanding key %s", inst->key->name);
 		RETURN_MODULE_FAIL;
 	}
 
-	if (!tree) RETURN_MODULE_NOOP;
+	if (!data) RETURN_MODULE_NOOP;
+
+	/*
+	 *	The candidate entries are the ones for the user, the
+	 *	DEFAULT entries which aren't indexed, and one bucket
+	 *	of indexed DEFAULT entries for each value of an
+	 *	indexed attribute in the request.
+	 */
+	pl_max = 2;
+	for (i = 0; i < talloc_array_length(data->index_da); i++) {
+		for (vp = fr_cursor_iter_by_da_init(&vp_cursor, &request->request_pairs, data->index_da[i]);
+		     vp;
+		     vp = fr_cursor_next(&vp_cursor)) pl_max++;
+	}
+	MEM(pl_list = talloc_array(request, PAIR_LIST const *, pl_max));
 
 	my_pl.name = name;
-	user_pl = rbtree_finddata(tree, &my_pl);
-	my_pl.name = "DEFAULT";
-	default_pl = rbtree_finddata(tree, &my_pl);
+	pl_list[pl_num] = rbtree_finddata(data->users, &my_pl);
+	if (pl_list[pl_num]) pl_num++;
+	pl_list[pl_num] = data->defaults;
+	if (pl_list[pl_num]) pl_num++;
+
+	for (i = 0; i < talloc_array_length(data->index_da); i++) {
+		for (vp = fr_cursor_iter_by_da_init(&vp_cursor, &request->request_pairs, data->index_da[i]);
+		     vp;
+		     vp = fr_cursor_next(&vp_cursor)) {
+			rlm_files_index_t const *idx;
+
+			idx = fr_hash_table_find_by_data(data->index, &(rlm_files_index_t){
+								.da = vp->da,
+								.value = &vp->data
+							 });
+			if (!idx) continue;
+
+			/*
+			 *	The request may contain the same
+			 *	value more than once.
+			 */
+			for (j = 0; j < pl_num; j++) if (pl_list[j] == idx->head) break;
+			if (j == pl_num) pl_list[pl_num++] = idx->head;
+		}
+	}
 
 	/*
 	 *	Find the entry for the user.
 	 */
-	while (user_pl || default_pl) {
-		fr_pair_t *vp;
+	while (pl_num > 0) {
 		map_t *map;
 		PAIR_LIST const *pl;
 		fr_pair_list_t list;
@@ -355,25 +542,15 @@ static unlang_action_t file_common(rlm_rcode_t *p_result, rlm_files_t const *ins
 		bool fall_through = false;
 
 		/*
-		 *	Figure out which entry to match on.
+		 *	Figure out which entry to match on.  Entries
+		 *	have to be checked in the order they appear in
+		 *	the file.
 		 */
+		for (i = 0, j = 1; j < pl_num; j++) if (pl_list[j]->order < pl_list[i]->order) i = j;
 
-		if (!default_pl && user_pl) {
-			pl = user_pl;
-			user_pl = user_pl->next;
-
-		} else if (!user_pl && default_pl) {
-			pl = default_pl;
-			default_pl = default_pl->next;
-
-		} else if (user_pl->order < default_pl->order) {
-			pl = user_pl;
-			user_pl = user_pl->next;
-
-		} else {
-			pl = default_pl;
-			default_pl = default_pl->next;
-		}
+		pl = pl_list[i];
+		pl_list[i] = pl->next;
+		if (!pl_list[i]) pl_list[i] = pl_list[--pl_num];
 
 		fr_pair_list_init(&list);
 		fr_cursor_init(&list_cursor, &list);
@@ -454,6 +631,7 @@ static unlang_action_t file_common(rlm_rcode_t *p_result, rlm_files_t const *ins
 		 */
 		if (!fall_through) break;
 	}
+	talloc_free(pl_list);
 
 	/*
 	 *	See if we succeeded.
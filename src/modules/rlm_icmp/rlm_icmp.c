@@ -35,6 +35,11 @@ RCSID("$Id$")
 #include <fcntl.h>
 #include <unistd.h>
 
+/*
+ *	Maximum number of echo requests sent with one call to sendmmsg().
+ */
+#define ICMP_MAX_BATCH		(64)
+
 /*
  *	Define a structure for our module configuration.
  */
@@ -44,11 +49,47 @@ typedef struct {
 	char const	*interface;
 	fr_time_delta_t	timeout;
 	fr_ipaddr_t	src_ipaddr;
+
+	fr_time_delta_t	cache_reachable;	//!< How long to remember that an IP replied.
+	fr_time_delta_t	cache_unreachable;	//!< How long to remember that an IP didn't reply.
 } rlm_icmp_t;
 
+typedef struct CC_HINT(__packed__) {
+	uint8_t		type;
+	uint8_t		code;
+	uint16_t	checksum;
+	uint16_t	ident;
+	uint16_t	sequence;
+	uint32_t	data;			//!< another 32-bits of randomness
+	uint32_t	counter;		//!< so that requests for the same IP are unique
+} icmp_header_t;
+
+typedef struct {
+	bool		replied;		//!< do we have a reply?
+	bool		queued;			//!< waiting to be sent.
+	bool		failed;			//!< we couldn't send the echo request.
+	fr_value_box_t	*ip;			//!< the IP we're pinging
+	uint32_t	counter;	       	//!< for pinging the same IP multiple times
+	request_t	*request;		//!< so it can be resumed when we get the echo reply
+
+	icmp_header_t	icmp;			//!< echo request to send.
+	struct sockaddr_storage	dst;		//!< where to send it.
+	socklen_t	salen;
+} rlm_icmp_echo_t;
+
+/** Result of a previous ping
+ *
+ */
+typedef struct {
+	fr_ipaddr_t	ipaddr;			//!< which was pinged.
+	bool		reachable;		//!< whether it replied.
+	fr_time_t	expires;		//!< when to ping it again.
+	fr_dlist_t	entry;			//!< in the list of entries with the same lifetime.
+} rlm_icmp_cache_t;
+
 typedef struct {
 	rlm_icmp_t	*inst;
-	rbtree_t	*tree;
+	fr_hash_table_t	*tracking;		//!< outstanding echoes, by counter.
 	int		fd;
 	fr_event_list_t *el;
 
@@ -59,14 +100,17 @@ typedef struct {
 	fr_type_t	ipaddr_type;
 	uint8_t		request_type;
 	uint8_t		reply_type;
-} rlm_icmp_thread_t;
 
-typedef struct {
-	bool		replied;		//!< do we have a reply?
-	fr_value_box_t	*ip;			//!< the IP we're pinging
-	uint32_t	counter;	       	//!< for pinging the same IP multiple times
-	request_t	*request;		//!< so it can be resumed when we get the echo reply
-} rlm_icmp_echo_t;
+	rlm_icmp_echo_t	*queued[ICMP_MAX_BATCH];	//!< echoes waiting to be sent.  NULL if cancelled.
+	unsigned int	num_queued;
+	struct mmsghdr	mmsgvec[ICMP_MAX_BATCH];
+	struct iovec	iov[ICMP_MAX_BATCH];
+	fr_event_timer_t const *flush_ev;	//!< sends the queued echoes.
+
+	fr_hash_table_t	*cache;			//!< previous results, by IP.  NULL if disabled.
+	fr_dlist_head_t	cache_reachable;	//!< in order of expiry.
+	fr_dlist_head_t	cache_unreachable;	//!< in order of expiry.
+} rlm_icmp_thread_t;
 
 /** Wrapper around the module thread stuct for individual xlats
  *
@@ -76,16 +120,6 @@ typedef struct {
 	rlm_icmp_thread_t	*t;		//!< rlm_icmp thread instance.
 } xlat_icmp_thread_inst_t;
 
-typedef struct CC_HINT(__packed__) {
-	uint8_t		type;
-	uint8_t		code;
-	uint16_t	checksum;
-	uint16_t	ident;
-	uint16_t	sequence;
-	uint32_t	data;			//!< another 32-bits of randomness
-	uint32_t	counter;		//!< so that requests for the same IP are unique
-} icmp_header_t;
-
 #define ICMP_ECHOREPLY		(0)
 #define ICMP_ECHOREQUEST	(8)
 
@@ -119,9 +153,162 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("interface", FR_TYPE_STRING, rlm_icmp_t, interface) },
 	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_icmp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_TIME_DELTA, rlm_icmp_t, timeout), .dflt = "1s" },
+	{ FR_CONF_OFFSET("cache_reachable", FR_TYPE_TIME_DELTA, rlm_icmp_t, cache_reachable), .dflt = "0" },
+	{ FR_CONF_OFFSET("cache_unreachable", FR_TYPE_TIME_DELTA, rlm_icmp_t, cache_unreachable), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
+static uint32_t cache_hash(void const *data)
+{
+	rlm_icmp_cache_t const *c = data;
+
+	if (c->ipaddr.af == AF_INET6) return fr_hash(&c->ipaddr.addr.v6, sizeof(c->ipaddr.addr.v6));
+
+	return fr_hash(&c->ipaddr.addr.v4, sizeof(c->ipaddr.addr.v4));
+}
+
+static int cache_cmp(void const *one, void const *two)
+{
+	rlm_icmp_cache_t const *a = one;
+	rlm_icmp_cache_t const *b = two;
+
+	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+}
+
+static void cache_entry_free(rlm_icmp_thread_t *t, rlm_icmp_cache_t *c)
+{
+	(void) fr_hash_table_delete(t->cache, c);
+	fr_dlist_remove(c->reachable ? &t->cache_reachable : &t->cache_unreachable, c);
+	talloc_free(c);
+}
+
+/** Remove expired entries
+ *
+ * All entries in a list have the same lifetime, so the lists are
+ * in order of expiry, and we only need to look at the heads.
+ */
+static void cache_expire(rlm_icmp_thread_t *t, fr_time_t now)
+{
+	rlm_icmp_cache_t *c;
+
+	while ((c = fr_dlist_head(&t->cache_reachable)) && (c->expires <= now)) cache_entry_free(t, c);
+	while ((c = fr_dlist_head(&t->cache_unreachable)) && (c->expires <= now)) cache_entry_free(t, c);
+}
+
+static rlm_icmp_cache_t *cache_find(rlm_icmp_thread_t *t, fr_ipaddr_t const *ipaddr)
+{
+	rlm_icmp_cache_t my_c;
+
+	cache_expire(t, fr_time());
+
+	my_c.ipaddr = *ipaddr;
+	return fr_hash_table_find_by_data(t->cache, &my_c);
+}
+
+static void cache_insert(rlm_icmp_thread_t *t, fr_ipaddr_t const *ipaddr, bool reachable)
+{
+	rlm_icmp_t const	*inst = t->inst;
+	fr_time_delta_t		lifetime = reachable ? inst->cache_reachable : inst->cache_unreachable;
+	rlm_icmp_cache_t	*c;
+
+	if (!lifetime) return;
+
+	c = cache_find(t, ipaddr);
+	if (c) cache_entry_free(t, c);
+
+	MEM(c = talloc_zero(t->cache, rlm_icmp_cache_t));
+	c->ipaddr = *ipaddr;
+	c->reachable = reachable;
+	c->expires = fr_time() + lifetime;
+
+	if (fr_hash_table_insert(t->cache, c) < 0) {
+		talloc_free(c);
+		return;
+	}
+	fr_dlist_insert_tail(reachable ? &t->cache_reachable : &t->cache_unreachable, c);
+}
+
+/** Stop tracking an echo
+ *
+ */
+static void echo_remove(rlm_icmp_thread_t *t, rlm_icmp_echo_t *echo)
+{
+	unsigned int i;
+
+	if (echo->queued) {
+		for (i = 0; i < t->num_queued; i++) {
+			if (t->queued[i] == echo) t->queued[i] = NULL;
+		}
+		echo->queued = false;
+	}
+
+	(void) fr_hash_table_delete(t->tracking, echo);
+}
+
+/** Send all of the queued echo requests
+ *
+ */
+static void echo_flush(rlm_icmp_thread_t *t)
+{
+	rlm_icmp_echo_t	*echo;
+	request_t	*request;
+	unsigned int	i, num = 0;
+	int		sent;
+
+	if (t->flush_ev) (void) fr_event_timer_delete(&t->flush_ev);
+
+	/*
+	 *	Skip over any which were cancelled.
+	 */
+	for (i = 0; i < t->num_queued; i++) {
+		echo = t->queued[i];
+		if (!echo) continue;
+
+		echo->queued = false;
+		t->queued[num] = echo;
+		t->iov[num] = (struct iovec) {
+			.iov_base = &echo->icmp,
+			.iov_len = sizeof(echo->icmp)
+		};
+		t->mmsgvec[num].msg_hdr = (struct msghdr) {
+			.msg_name = &echo->dst,
+			.msg_namelen = echo->salen,
+			.msg_iov = &t->iov[num],
+			.msg_iovlen = 1
+		};
+		num++;
+	}
+	t->num_queued = 0;
+
+	/*
+	 *	sendmmsg only returns an error if the first packet
+	 *	couldn't be sent, so fail that one, and carry on
+	 *	with the rest.
+	 */
+	for (i = 0; i < num; i += sent) {
+		sent = (t->fd < 0) ? -1 : sendmmsg(t->fd, &t->mmsgvec[i], num - i, 0);
+		if (sent > 0) continue;
+
+		echo = t->queued[i];
+		request = echo->request;
+		if (t->fd < 0) {
+			REDEBUG("Failed sending ICMP request to %pV: Socket was closed", echo->ip);
+		} else {
+			REDEBUG("Failed sending ICMP request to %pV: %s", echo->ip, fr_syserror(errno));
+		}
+
+		(void) fr_hash_table_delete(t->tracking, echo);
+		echo->failed = true;
+		unlang_interpret_mark_resumable(echo->request);
+		sent = 1;
+	}
+}
+
+static void _echo_flush_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	echo_flush(talloc_get_type_abort(uctx, rlm_icmp_thread_t));
+}
+
 static xlat_action_t xlat_icmp_resume(TALLOC_CTX *ctx, fr_cursor_t *out,
 				      UNUSED request_t *request,
 				      UNUSED void const *xlat_inst, void *xlat_thread_inst,
@@ -131,10 +318,18 @@ static xlat_action_t xlat_icmp_resume(TALLOC_CTX *ctx, fr_cursor_t *out,
 	xlat_icmp_thread_inst_t	*thread = talloc_get_type_abort(xlat_thread_inst, xlat_icmp_thread_inst_t);
 	fr_value_box_t	*vb;
 
+	echo_remove(thread->t, echo);
+
+	if (echo->failed) {
+		talloc_free(echo);
+		return XLAT_ACTION_FAIL;
+	}
+
+	if (thread->t->cache) cache_insert(thread->t, &echo->ip->vb_ip, echo->replied);
+
 	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_BOOL, NULL, false));
 	vb->vb_bool = echo->replied;
 
-	(void) rbtree_deletebydata(thread->t->tree, echo);
 	talloc_free(echo);
 
 	fr_cursor_insert(out, vb);
@@ -152,7 +347,7 @@ static void xlat_icmp_cancel(request_t *request, UNUSED void *xlat_inst, void *x
 
 	RDEBUG2("Cancelling ICMP request for %pV (counter=%d)", echo->ip, echo->counter);
 
-	(void) rbtree_deletebydata(thread->t->tree, echo);
+	echo_remove(thread->t, echo);
 	talloc_free(echo);
 }
 
@@ -169,16 +364,19 @@ static void _xlat_icmp_timeout(request_t *request,
 	unlang_interpret_mark_resumable(request);
 }
 
-/** Xlat to delay the request
+/** Xlat to ping an IP address
  *
  * Example (ping 192.0.2.1):
 @verbatim
 "%{icmp:192.0.2.1}"
 @endverbatim
+ *
+ * Echo requests are queued, and all of the requests made whilst
+ * processing a set of events are sent together, with one system call.
  *
  * @ingroup xlat_functions
  */
-static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
+static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, fr_cursor_t *out,
 			       request_t *request, void const *xlat_inst, void *xlat_thread_inst,
 			       fr_value_box_t **in)
 {
@@ -187,10 +385,8 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
 	xlat_icmp_thread_inst_t	*thread = talloc_get_type_abort(xlat_thread_inst, xlat_icmp_thread_inst_t);
 	rlm_icmp_echo_t		*echo;
 	icmp_header_t		icmp;
+	rlm_icmp_thread_t	*t = thread->t;
 	uint16_t		checksum;
-	ssize_t			rcode;
-	socklen_t      		salen;
-	struct sockaddr_storage	dst;
 
 	memcpy(&instance, xlat_inst, sizeof(instance));	/* Stupid const issues */
 
@@ -211,19 +407,45 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
+	/*
+	 *	We pinged this IP recently, so use the
+	 *	previous result.
+	 */
+	if (t->cache) {
+		rlm_icmp_cache_t *c;
+
+		c = cache_find(t, &(*in)->vb_ip);
+		if (c) {
+			fr_value_box_t *vb;
+
+			RDEBUG2("Using cached ICMP result for %pV (%s)", *in, c->reachable ? "reachable" : "unreachable");
+
+			MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_BOOL, NULL, false));
+			vb->vb_bool = c->reachable;
+			fr_cursor_insert(out, vb);
+
+			return XLAT_ACTION_DONE;
+		}
+	}
+
+	if (t->fd < 0) {
+		REDEBUG("Failed sending ICMP request to %pV: Socket was closed", *in);
+		return XLAT_ACTION_FAIL;
+	}
+
 	MEM(echo = talloc_zero(ctx, rlm_icmp_echo_t));
 	echo->ip = *in;
 	echo->request = request;
-	echo->counter = thread->t->counter++;
+	echo->counter = t->counter++;
 
 	/*
-	 *	Add the IP to the local tracking heap, so that the IO
+	 *	Add the IP to the local tracking table, so that the IO
 	 *	functions can find it.
 	 *
 	 *	This insert will never fail, because of the unique
 	 *	counter above.
 	 */
-	if (!rbtree_insert(thread->t->tree, echo)) {
+	if (fr_hash_table_insert(t->tracking, echo) < 0) {
 		RPEDEBUG("Failed inserting IP into tracking table");
 		talloc_free(echo);
 		return XLAT_ACTION_FAIL;
@@ -231,7 +453,7 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
 
 	if (unlang_xlat_event_timeout_add(request, _xlat_icmp_timeout, echo, fr_time() + inst->timeout) < 0) {
 		RPEDEBUG("Failed adding timeout");
-		(void) rbtree_deletebydata(thread->t->tree, echo);
+		(void) fr_hash_table_delete(t->tracking, echo);
 		talloc_free(echo);
 		return XLAT_ACTION_FAIL;
 	}
@@ -239,13 +461,13 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
 	RDEBUG("Sending ICMP request to %pV (counter=%d)", echo->ip, echo->counter);
 
 	icmp = (icmp_header_t) {
-		.type = thread->t->request_type,
-		.ident = thread->t->ident,
-		.data = thread->t->data,
+		.type = t->request_type,
+		.ident = t->ident,
+		.data = t->data,
 		.counter = echo->counter
 	};
 
-	(void) fr_ipaddr_to_sockaddr(&dst, &salen, &echo->ip->vb_ip, 0);
+	(void) fr_ipaddr_to_sockaddr(&echo->dst, &echo->salen, &echo->ip->vb_ip, 0);
 
 	/*
 	 *	Calculate the checksum
@@ -255,8 +477,8 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
 	/*
 	 *	Start off with the IPv6 pseudo-header checksum
 	 */
-	if (thread->t->ipaddr_type == FR_TYPE_IPV6_ADDR) {
-		checksum = fr_ip6_pesudo_header_checksum(&thread->t->inst->src_ipaddr.addr.v6, &echo->ip->vb_ip.addr.v6,
+	if (t->ipaddr_type == FR_TYPE_IPV6_ADDR) {
+		checksum = fr_ip6_pesudo_header_checksum(&t->inst->src_ipaddr.addr.v6, &echo->ip->vb_ip.addr.v6,
 							 sizeof(ip_header6_t) + sizeof(icmp), IPPROTO_ICMPV6);
 	}
 
@@ -264,25 +486,40 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
 	 *	Followed by checksumming the actual ICMP packet.
 	 */
 	icmp.checksum = htons(icmp_checksum((uint8_t *) &icmp, sizeof(icmp), checksum));
+	echo->icmp = icmp;
 
-	rcode = sendto(thread->t->fd, &icmp, sizeof(icmp), 0, (struct sockaddr *) &dst, salen);
-	if (rcode < 0) {
-		REDEBUG("Failed sending ICMP request to %pV: %s", echo->ip, fr_syserror(errno));
-		(void) rbtree_deletebydata(thread->t->tree, echo);
-		talloc_free(echo);
-		return XLAT_ACTION_FAIL;
-	}
+	/*
+	 *	Queue the echo request.  It's sent when the
+	 *	flush timer fires, which is once the worker has
+	 *	finished with the current set of events.
+	 *
+	 *	If the queue is full, send what's already
+	 *	there.  Those requests have all yielded, so
+	 *	they can be resumed if sending fails.
+	 */
+	if (t->num_queued == ICMP_MAX_BATCH) echo_flush(t);
 
-	if ((size_t) rcode < sizeof(icmp)) {
-		REDEBUG("Failed sending entire ICMP packet");
-		(void) rbtree_deletebydata(thread->t->tree, echo);
+	if (!t->flush_ev &&
+	    (fr_event_timer_in(t, t->el, &t->flush_ev, 0, _echo_flush_timer, t) < 0)) {
+		RPEDEBUG("Failed adding ICMP flush timer");
+		(void) fr_hash_table_delete(t->tracking, echo);
 		talloc_free(echo);
 		return XLAT_ACTION_FAIL;
 	}
 
+	echo->queued = true;
+	t->queued[t->num_queued++] = echo;
+
 	return unlang_xlat_yield(request, xlat_icmp_resume, xlat_icmp_cancel, echo);
 }
 
+static uint32_t echo_hash(void const *data)
+{
+	rlm_icmp_echo_t const *echo = data;
+
+	return fr_hash(&echo->counter, sizeof(echo->counter));
+}
+
 static int echo_cmp(void const *one, void const *two)
 {
 	rlm_icmp_echo_t const *a = one;
@@ -311,7 +548,7 @@ static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED
 	/*
 	 *	Ignore packets if we haven't sent any requests.
 	 */
-	if (rbtree_num_elements(t->tree) == 0) {
+	if (fr_hash_table_num_elements(t->tracking) == 0) {
 		return;
 	}
 
@@ -351,7 +588,7 @@ static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED
 	/*
 	 *	Ignore packets which aren't an echo reply, or which
 	 *	weren't for us.  This is done *before* looking packets
-	 *	up in the rbtree, as these checks ensure that the
+	 *	up in the tracking table, as these checks ensure that the
 	 *	packet is for this specific thread.
 	 */
 	if ((icmp->type != t->reply_type) ||
@@ -363,13 +600,13 @@ static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED
 	 *	Look up the packet by the fields which determine *our* ICMP packets.
 	 */
 	my_echo.counter = icmp->counter;
-	echo = rbtree_finddata(t->tree, &my_echo);
+	echo = fr_hash_table_find_by_data(t->tracking, &my_echo);
 	if (!echo) {
-		DEBUG("Can't find packet counter=%d in tree", icmp->counter);
+		DEBUG("Can't find packet counter=%d in tracking table", icmp->counter);
 		return;
 	}
 
-	(void) rbtree_deletebydata(t->tree, echo);
+	(void) fr_hash_table_delete(t->tracking, echo);
 
 	/*
 	 *	We have a reply!
@@ -429,10 +666,16 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 	rlm_icmp_thread_t *t = talloc_get_type_abort(thread, rlm_icmp_thread_t);
 	fr_ipaddr_t ipaddr, *src;
 
-	MEM(t->tree = rbtree_alloc(t, echo_cmp, NULL, RBTREE_FLAG_NONE));
+	MEM(t->tracking = fr_hash_table_create(t, echo_hash, echo_cmp, NULL));
 	t->inst = inst;
 	t->el = el;
 
+	if (inst->cache_reachable || inst->cache_unreachable) {
+		MEM(t->cache = fr_hash_table_create(t, cache_hash, cache_cmp, NULL));
+		fr_dlist_talloc_init(&t->cache_reachable, rlm_icmp_cache_t, entry);
+		fr_dlist_talloc_init(&t->cache_unreachable, rlm_icmp_cache_t, entry);
+	}
+
 	/*
 	 *      Since these fields are random numbers, we don't care
 	 *      about network / host byte order.  No one other than us
@@ -546,6 +789,8 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 
 	FR_TIME_DELTA_BOUND_CHECK("timeout", inst->timeout, >=, fr_time_delta_from_msec(100)); /* 1/10s minimum timeout */
 	FR_TIME_DELTA_BOUND_CHECK("timeout", inst->timeout, <=, fr_time_delta_from_sec(10));
+	FR_TIME_DELTA_BOUND_CHECK("cache_reachable", inst->cache_reachable, <=, fr_time_delta_from_sec(3600));
+	FR_TIME_DELTA_BOUND_CHECK("cache_unreachable", inst->cache_unreachable, <=, fr_time_delta_from_sec(3600));
 
 #ifdef __linux__
 #  ifndef HAVE_CAPABILITY_H
@@ -572,6 +817,8 @@ static int mod_thread_detach(fr_event_list_t *el, void *thread)
 {
 	rlm_icmp_thread_t *t = talloc_get_type_abort(thread, rlm_icmp_thread_t);
 
+	if (t->flush_ev) (void) fr_event_timer_delete(&t->flush_ev);
+
 	if (t->fd < 0) return 0;
 
 	(void) fr_event_fd_delete(el, t->fd, FR_EVENT_FILTER_IO);
@@ -83,10 +83,9 @@ typedef struct {
 	/*
 	 *	While "host" blocks can appear anywhere, their
 	 *	definitions are global.  We use these hashes for
-	 *	dedup, and for assigning IP addresses in the `recv`
-	 *	section.  We still need to have host hashes in the
-	 *	subsections, so that we can apply options from the
-	 *	bottom up.
+	 *	dedup, and for finding the host for a request.  The
+	 *	host is looked up once, and its options are applied
+	 *	when we reach the section which contains it.
 	 */
 	fr_hash_table_t		*hosts_by_ether;       	//!< by MAC address
 	fr_hash_table_t		*hosts_by_uid;		//!< by client identifier
@@ -192,8 +191,6 @@ struct rlm_isc_dhcp_info_s {
 	/*
 	 *	Only for things that have sections
 	 */
-	fr_hash_table_t		*hosts_by_ether;  //!< by MAC address
-	fr_hash_table_t		*hosts_by_uid;	//!< by client identifier
 	fr_pair_list_t		options;	//!< DHCP options
 	fr_trie_t		*subnets;
 	rlm_isc_dhcp_info_t	*child;
@@ -1382,7 +1379,7 @@ static int parse_host(rlm_isc_dhcp_tokenizer_t *state, rlm_isc_dhcp_info_t *info
 {
 	isc_host_ether_t *my_ether, *old_ether;
 	isc_host_uid_t *my_uid, *old_uid;
-	rlm_isc_dhcp_info_t *ether, *child, *parent;
+	rlm_isc_dhcp_info_t *ether, *child;
 	fr_pair_t *vp;
 
 	ether = NULL;
@@ -1466,58 +1463,14 @@ static int parse_host(rlm_isc_dhcp_tokenizer_t *state, rlm_isc_dhcp_info_t *info
 		}
 	}
 
-	/*
-	 *	The host doesn't have a parent, that's fine..
-	 *
-	 *	It typically should tho...
-	 */
-	if (!info->parent) return 2;
-
-	parent = info->parent;
-
-	/*
-	 *	Add the host to the *parents* hash table.  That way
-	 *	when we apply the parent, we can look up the host in
-	 *	its hash table.  And avoid the O(N) issue of having
-	 *	thousands of "host" entries in the parent->child list.
-	 */
-	if (!parent->hosts_by_ether) {
-		parent->hosts_by_ether = fr_hash_table_create(parent, host_ether_hash, host_ether_cmp, NULL);
-		if (!parent->hosts_by_ether) {
-			return -1;
-		}
-	}
-
-	if (fr_hash_table_insert(parent->hosts_by_ether, my_ether) < 0) {
-		fr_strerror_printf("Failed inserting 'host %s' into hash table",
-				   info->argv[0]->vb_strvalue);
-		return -1;
-	}
-
-	/*
-	 *	If we have a UID, insert into the UID hashes.
-	 */
-	if (my_uid) {
-		if (!parent->hosts_by_uid) {
-			parent->hosts_by_uid = fr_hash_table_create(parent, host_uid_hash, host_uid_cmp, NULL);
-			if (!parent->hosts_by_uid) {
-				return -1;
-			}
-		}
-
-
-		if (fr_hash_table_insert(parent->hosts_by_uid, my_uid) < 0) {
-			fr_strerror_printf("Failed inserting 'host %s' into hash table",
-					   info->argv[0]->vb_strvalue);
-			return -1;
-		}
-	}
-
 	IDEBUG("%.*s host %s { ... }", state->braces, spaces, info->argv[0]->vb_strvalue);
 
 	/*
-	 *	We've remembered the host in the parent hosts hash.
-	 *	There's no need to add it to the child list here.
+	 *	We've remembered the host in the global hashes, and
+	 *	it points to its parent.  That's all apply() needs,
+	 *	so we avoid the O(N) issue of having thousands of
+	 *	"host" entries in the parent->child list, and don't
+	 *	need a second set of hashes in the parent.
 	 */
 	return 2;
 }
@@ -1805,8 +1758,14 @@ static int apply_fixed_ip(rlm_isc_dhcp_t const *inst, request_t *request)
 
 /** Apply all rules *except* fixed IP
  *
+ * @param[in] inst	of the module.
+ * @param[in] request	to add options to.
+ * @param[in] head	section to apply.
+ * @param[in] host	for the request, from get_host(), or NULL.  Its
+ *			options are applied when we reach its parent.
  */
-static int apply(rlm_isc_dhcp_t const *inst, request_t *request, rlm_isc_dhcp_info_t *head)
+static int apply(rlm_isc_dhcp_t const *inst, request_t *request, rlm_isc_dhcp_info_t *head,
+		 rlm_isc_dhcp_info_t *host)
 {
 	int ret, child_ret;
 	rlm_isc_dhcp_info_t *info;
@@ -1818,21 +1777,15 @@ static int apply(rlm_isc_dhcp_t const *inst, request_t *request, rlm_isc_dhcp_in
 	/*
 	 *	First, apply any "host" options
 	 */
-	if (head->hosts_by_ether) {
-		rlm_isc_dhcp_info_t *host = NULL;
-
-		host = get_host(request, head->hosts_by_ether, head->hosts_by_uid);
-		if (!host) goto subnet;
-
+	if (host && (host->parent == head)) {
 		/*
 		 *	Apply any options in the "host" section.
 		 */
-		child_ret = apply(inst, request, host);
+		child_ret = apply(inst, request, host, NULL);
 		if (child_ret < 0) return child_ret;
 		if (child_ret == 1) ret = 1;
 	}
 
-subnet:
 	/*
 	 *	Look in the trie for matching subnets, and apply any
 	 *	subnets that match.
@@ -1841,7 +1794,7 @@ subnet:
 		info = fr_trie_lookup(head->subnets, &yiaddr->vp_ipv4addr, 32);
 		if (!info) goto recurse;
 
-		child_ret = apply(inst, request, info);
+		child_ret = apply(inst, request, info, host);
 		if (child_ret < 0) return child_ret;
 		if (child_ret == 1) ret = 1;
 	}
@@ -2247,7 +2200,7 @@ static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, mod
 	rlm_isc_dhcp_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_isc_dhcp_t);
 	int			ret;
 
-	ret = apply(inst, request, inst->head);
+	ret = apply(inst, request, inst->head, get_host(request, inst->hosts_by_ether, inst->hosts_by_uid));
 	if (ret < 0) RETURN_MODULE_FAIL;
 	if (ret == 0) RETURN_MODULE_NOOP;
 
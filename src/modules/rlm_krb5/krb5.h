@@ -32,6 +32,7 @@ USES_APPLE_DEPRECATED_API
 #ifdef KRB5_IS_THREAD_SAFE
 #  include <freeradius-devel/server/pool.h>
 #endif
+#include <freeradius-devel/server/offload.h>
 
 typedef struct {
 	krb5_context	context;
@@ -65,6 +66,9 @@ typedef struct {
 
 	krb5_context		context;	//!< The kerberos context (cloned once per request).
 
+	fr_offload_conf_t	offload_conf;	//!< How many threads to make blocking calls in.
+	fr_offload_t		*offload;	//!< NULL if offload is disabled.
+
 #ifndef HEIMDAL_KRB5
 	krb5_get_init_creds_opt		*gic_options;	//!< Options to pass to the get_initial_credentials
 							//!< function.
@@ -34,9 +34,33 @@ RCSID("$Id$")
 #include <freeradius-devel/util/debug.h>
 #include "krb5.h"
 
+/** Thread specific data for rlm_krb5
+ *
+ */
+typedef struct {
+	fr_offload_thread_t	*offload;	//!< NULL if offload is disabled.
+} rlm_krb5_thread_t;
+
+/** An authentication, run in an offload thread or the worker
+ *
+ * Everything the Kerberos calls need is here, so offload threads
+ * never touch the request.
+ */
+typedef struct {
+	rlm_krb5_t const	*inst;		//!< Instance data.
+	rlm_krb5_handle_t	*conn;		//!< Context to make the calls with.
+	krb5_principal		client;		//!< Parsed from the User-Name.
+	char			*password;	//!< Copy of the User-Password.
+#ifndef HEIMDAL_KRB5
+	krb5_creds		init_creds;	//!< TGT retrieved from the KDC.
+#endif
+	krb5_error_code		ret;		//!< Result of the calls.
+} rlm_krb5_job_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("keytab", FR_TYPE_STRING, rlm_krb5_t, keytabname) },
 	{ FR_CONF_OFFSET("service_principal", FR_TYPE_STRING, rlm_krb5_t, service_princ) },
+	{ FR_CONF_OFFSET("offload", FR_TYPE_SUBSECTION, rlm_krb5_t, offload_conf), .subcs = (void const *) fr_offload_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -62,6 +86,12 @@ static int mod_detach(void *instance)
 {
 	rlm_krb5_t *inst = instance;
 
+	/*
+	 *	Stop the offload threads before the
+	 *	options and connections they use go away.
+	 */
+	TALLOC_FREE(inst->offload);
+
 #ifndef HEIMDAL_KRB5
 	talloc_free(inst->vic_options);
 
@@ -231,7 +261,44 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 #else
 	inst->conn = krb5_mod_conn_create(inst, inst, 0);
 	if (!inst->conn) return -1;
+
+	if (inst->offload_conf.threads) {
+		WARN("libkrb5 is not threadsafe, ignoring offload.threads");
+		inst->offload_conf.threads = 0;
+	}
 #endif
+
+	/*
+	 *	Start the threads which make the blocking calls
+	 *	to the KDC.
+	 */
+	if (inst->offload_conf.threads) {
+		FR_INTEGER_BOUND_CHECK("offload.threads", inst->offload_conf.threads, <=, 128);
+		FR_INTEGER_BOUND_CHECK("offload.max_queued", inst->offload_conf.max_queued, >=, 1);
+
+		inst->offload = fr_offload_alloc(inst, &inst->offload_conf);
+		if (!inst->offload) {
+			PERROR("Failed starting offload threads");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_krb5_t const	*inst = talloc_get_type_abort_const(instance, rlm_krb5_t);
+	rlm_krb5_thread_t	*t = thread;
+
+	if (!inst->offload) return 0;
+
+	t->offload = fr_offload_thread_alloc(t, inst->offload, el);
+	if (!t->offload) {
+		PERROR("Failed setting up offload");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -314,62 +381,42 @@ static rlm_rcode_t krb5_process_error(rlm_krb5_t const *inst, request_t *request
 	}
 }
 
-#ifdef HEIMDAL_KRB5
-
-/*
- *	Validate user/pass (Heimdal)
+/** Free everything a job holds, and release its connection
+ *
+ * Jobs are always freed in the worker which created them, even if the
+ * request was cancelled, so the connection goes back to the right pool.
  */
-static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static int _krb5_job_free(rlm_krb5_job_t *job)
 {
-	rlm_krb5_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_krb5_t);
-	rlm_rcode_t		rcode;
-	krb5_error_code		ret;
-	rlm_krb5_handle_t	*conn;
-	krb5_principal		client = NULL;
-	fr_pair_t		*password;
-
-	password = fr_pair_find_by_da(&request->request_pairs, attr_user_password);
-
-	if (!password) {
-		REDEBUG("Attribute \"User-Password\" is required for authentication");
-		RETURN_MODULE_INVALID;
-	}
-
-	/*
-	 *	Make sure the supplied password isn't empty
-	 */
-	if (password->vp_length == 0) {
-		REDEBUG("User-Password must not be empty");
-		RETURN_MODULE_INVALID;
-	}
+	if (job->client) krb5_free_principal(job->conn->context, job->client);
+#ifndef HEIMDAL_KRB5
+	krb5_free_cred_contents(job->conn->context, &job->init_creds);
+#endif
 
-	/*
-	 *	Log the password
-	 */
-	if (RDEBUG_ENABLED3) {
-		RDEBUG("Login attempt with password \"%pV\"", &password->data);
-	} else {
-		RDEBUG2("Login attempt with password");
-	}
+#ifdef KRB5_IS_THREAD_SAFE
+	fr_pool_connection_release(job->inst->pool, NULL, job->conn);
+#endif
 
-#  ifdef KRB5_IS_THREAD_SAFE
-	conn = fr_pool_connection_get(inst->pool, request);
-	if (!conn) RETURN_MODULE_FAIL;
-#  else
-	conn = inst->conn;
-#  endif
+	return 0;
+}
 
-	rcode = krb5_parse_user(&client, inst, request, conn->context);
-	if (rcode != RLM_MODULE_OK) goto cleanup;
+#ifdef HEIMDAL_KRB5
+/** Validate user/pass (Heimdal)
+ *
+ * Called from an offload thread, or from the worker if offload is
+ * disabled.  Must not touch the request.
+ */
+static void krb5_auth_run(void *uctx)
+{
+	rlm_krb5_job_t		*job = talloc_get_type_abort(uctx, rlm_krb5_job_t);
+	rlm_krb5_handle_t	*conn = job->conn;
+	krb5_error_code		ret;
 
 	/*
 	 *	Verify the user, using the options we set in instantiate
 	 */
-	ret = krb5_verify_user_opt(conn->context, client, password->vp_strvalue, &conn->options);
-	if (ret) {
-		rcode = krb5_process_error(inst, request, conn, ret);
-		goto cleanup;
-	}
+	job->ret = krb5_verify_user_opt(conn->context, job->client, job->password, &conn->options);
+	if (job->ret) return;
 
 	/*
 	 *	krb5_verify_user_opt adds the credentials to the ccache
@@ -393,34 +440,54 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		}
 		krb5_cc_end_seq_get(conn->context, conn->ccache, &cursor);
 	}
+}
+#else  /* HEIMDAL_KRB5 */
+/** Validate userid/passwd (MIT)
+ *
+ * Called from an offload thread, or from the worker if offload is
+ * disabled.  Must not touch the request.
+ */
+static void krb5_auth_run(void *uctx)
+{
+	rlm_krb5_job_t		*job = talloc_get_type_abort(uctx, rlm_krb5_job_t);
+	rlm_krb5_t const	*inst = job->inst;
+	rlm_krb5_handle_t	*conn = job->conn;
 
-cleanup:
-	if (client) {
-		krb5_free_principal(conn->context, client);
-	}
+	/*
+	 * 	Retrieve the TGT from the TGS/KDC and check we can decrypt it.
+	 */
+	job->ret = krb5_get_init_creds_password(conn->context, &job->init_creds, job->client, job->password,
+						NULL, NULL, 0, NULL, inst->gic_options);
+	if (job->ret) return;
 
-#  ifdef KRB5_IS_THREAD_SAFE
-	fr_pool_connection_release(inst->pool, request, conn);
-#  endif
-	RETURN_MODULE_RCODE(rcode);
+	job->ret = krb5_verify_init_creds(conn->context, &job->init_creds, inst->server, conn->keytab,
+					  NULL, inst->vic_options);
 }
+#endif /* MIT_KRB5 */
 
-#else  /* HEIMDAL_KRB5 */
+/** Translate the result of the Kerberos calls
+ *
+ */
+static unlang_action_t krb5_auth_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					request_t *request, void *rctx)
+{
+	rlm_krb5_job_t		*job = talloc_get_type_abort(rctx, rlm_krb5_job_t);
+
+	if (job->ret) RETURN_MODULE_RCODE(krb5_process_error(job->inst, request, job->conn, job->ret));
+
+	RETURN_MODULE_OK;
+}
 
 /*
- *  Validate userid/passwd (MIT)
+ *	Validate user/pass
  */
 static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_krb5_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_krb5_t);
+	rlm_krb5_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_krb5_thread_t);
 	rlm_rcode_t		rcode;
-	krb5_error_code		ret;
-
 	rlm_krb5_handle_t	*conn;
-
-	krb5_principal		client = NULL;	/* actually a pointer value */
-	krb5_creds		init_creds;
-	char			*nonconst_password;		/* compiler warnings */
+	rlm_krb5_job_t		*job;
 	fr_pair_t		*password;
 
 	password = fr_pair_find_by_da(&request->request_pairs, attr_user_password);
@@ -447,53 +514,40 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Login attempt with password");
 	}
 
-#  ifdef KRB5_IS_THREAD_SAFE
+#ifdef KRB5_IS_THREAD_SAFE
 	conn = fr_pool_connection_get(inst->pool, request);
 	if (!conn) RETURN_MODULE_FAIL;
-#  else
+#else
 	conn = inst->conn;
-#  endif
+#endif
 
 	/*
-	 *	Zero out local storage
+	 *	The request's copy of the password may be
+	 *	freed before the job runs.
 	 */
-	memset(&init_creds, 0, sizeof(init_creds));
+	MEM(job = talloc_zero(NULL, rlm_krb5_job_t));
+	job->inst = inst;
+	job->conn = conn;
+	talloc_set_destructor(job, _krb5_job_free);
+	MEM(job->password = talloc_bstrndup(job, password->vp_strvalue, password->vp_length));
 
 	/*
 	 *	Check we have all the required VPs, and convert the username
 	 *	into a principal.
 	 */
-	rcode = krb5_parse_user(&client, inst, request, conn->context);
-	if (rcode != RLM_MODULE_OK) goto cleanup;
-
-	/*
-	 * 	Retrieve the TGT from the TGS/KDC and check we can decrypt it.
-	 */
-	memcpy(&nonconst_password, &password->vp_strvalue, sizeof(nonconst_password));
-	RDEBUG2("Retrieving and decrypting TGT");
-	ret = krb5_get_init_creds_password(conn->context, &init_creds, client, nonconst_password,
-					   NULL, NULL, 0, NULL, inst->gic_options);
-	if (ret) {
-		rcode = krb5_process_error(inst, request, conn, ret);
-		goto cleanup;
+	rcode = krb5_parse_user(&job->client, inst, request, conn->context);
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(job);
+		RETURN_MODULE_RCODE(rcode);
 	}
 
-	RDEBUG2("Attempting to authenticate against service principal");
-	ret = krb5_verify_init_creds(conn->context, &init_creds, inst->server, conn->keytab, NULL, inst->vic_options);
-	if (ret) rcode = krb5_process_error(inst, request, conn, ret);
-
-cleanup:
-	if (client) krb5_free_principal(conn->context, client);
-	krb5_free_cred_contents(conn->context, &init_creds);
+#ifndef HEIMDAL_KRB5
+	RDEBUG2("Retrieving and decrypting TGT, and authenticating against service principal");
+#endif
 
-#  ifdef KRB5_IS_THREAD_SAFE
-	fr_pool_connection_release(inst->pool, request, conn);
-#  endif
-	RETURN_MODULE_RCODE(rcode);
+	return fr_offload_yield(p_result, mctx, request, t->offload, krb5_auth_run, krb5_auth_resume, job);
 }
 
-#endif /* MIT_KRB5 */
-
 extern module_t rlm_krb5;
 module_t rlm_krb5 = {
 	.magic		= RLM_MODULE_INIT,
@@ -502,8 +556,11 @@ module_t rlm_krb5 = {
 	.type		= RLM_TYPE_THREAD_SAFE,
 #endif
 	.inst_size	= sizeof(rlm_krb5_t),
+	.thread_inst_size = sizeof(rlm_krb5_thread_t),
+	.thread_inst_type = "rlm_krb5_thread_t",
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate = mod_thread_instantiate,
 	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate
@@ -35,6 +35,8 @@ USES_APPLE_DEPRECATED_API
 
 #include "rlm_ldap.h"
 
+#define LDAP_CLIENT_PAGE_SIZE	(500)	//!< How many clients to retrieve per search request.
+
 /** Iterate over pairs in mapping section recording their values in an array
  *
  * This array is the list of attributes we retrieve from LDAP, and is NULL
@@ -97,7 +99,139 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
 	return 0;
 }
 
+/** Add the client described by an LDAP entry
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] conn the entry was retrieved with.
+ * @param[in] entry describing the client.
+ * @param[in] tmpl to use as the base for the new client.
+ * @param[in] map to load client attribute/LDAP attribute mappings from.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rlm_ldap_client_add(rlm_ldap_t const *inst, fr_ldap_connection_t *conn, LDAPMessage *entry,
+			       CONF_SECTION *tmpl, CONF_SECTION *map)
+{
+	ldap_client_data_t	data;
+
+	CONF_SECTION		*client;
+	CONF_PAIR		*cp;
+	RADCLIENT		*c;
+	char			*id, *dn;
+	int			ret = 0;
+
+	struct berval		**values;
+
+	id = dn = ldap_get_dn(conn->handle, entry);
+	if (!dn) {
+		int ldap_errno;
+
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ERROR("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		return -1;
+	}
+	fr_ldap_util_normalise_dn(dn, dn);
+
+	cp = cf_pair_find(map, "identifier");
+	if (cp) {
+		values = ldap_get_values_len(conn->handle, entry, cf_pair_value(cp));
+		if (values) id = fr_ldap_berval_to_string(NULL, values[0]);
+		ldap_value_free_len(values);
+	}
+
+	/*
+	 *	Iterate over mapping sections
+	 */
+	client = tmpl ? cf_section_dup(NULL, NULL, tmpl, "client", id, true) :
+			cf_section_alloc(NULL, NULL, "client", id);
+
+	data.conn = conn;
+	data.entry = entry;
+
+	if (client_map_section(client, map, _get_client_value, &data) < 0) {
+		talloc_free(client);
+		ret = -1;
+		goto finish;
+	}
+
+	/*
+	 *@todo these should be parented from something
+	 */
+	c = client_afrom_cs(NULL, client, NULL);
+	if (!c) {
+		talloc_free(client);
+		ret = -1;
+		goto finish;
+	}
+
+	/*
+	 *	Client parents the CONF_SECTION which defined it
+	 */
+	talloc_steal(c, client);
+
+	if (!client_add(NULL, c)) {
+		ERROR("Failed to add client \"%s\", possible duplicate?", dn);
+		ret = -1;
+		client_free(c);
+		goto finish;
+	}
+
+	DEBUG("Client \"%s\" added", dn);
+
+finish:
+	if (id != dn) talloc_free(id);
+	ldap_memfree(dn);
+
+	return ret;
+}
+
+/** Get the cookie for the next page of results
+ *
+ * @param[out] cookie	Where to write the cookie.  Must be freed with
+ *			ber_memfree(cookie->bv_val).  bv_len will be
+ *			0 if there are no more pages.
+ * @param[in] conn	the search was performed on.
+ * @param[in] result	of the search.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the server didn't return a paged results control.
+ */
+static int rlm_ldap_client_page_cookie(struct berval *cookie, fr_ldap_connection_t *conn, LDAPMessage *result)
+{
+	LDAPMessage	*msg;
+	LDAPControl	**ctrls = NULL, *ctrl;
+	ber_int_t	estimate;
+	int		ret = -1;
+
+	memset(cookie, 0, sizeof(*cookie));
+
+	for (msg = ldap_first_message(conn->handle, result);
+	     msg;
+	     msg = ldap_next_message(conn->handle, msg)) {
+		if (ldap_msgtype(msg) == LDAP_RES_SEARCH_RESULT) break;
+	}
+	if (!msg) return -1;
+
+	if ((ldap_parse_result(conn->handle, msg, NULL, NULL, NULL, NULL, &ctrls, 0) != LDAP_SUCCESS) ||
+	    !ctrls) return -1;
+
+	ctrl = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, ctrls, NULL);
+	if (ctrl && (ldap_parse_pageresponse_control(conn->handle, ctrl, &estimate, cookie) == LDAP_SUCCESS)) {
+		ret = 0;
+	}
+	ldap_controls_free(ctrls);
+
+	return ret;
+}
+
 /** Load clients from LDAP on server start
+ *
+ * The clients are retrieved #LDAP_CLIENT_PAGE_SIZE at a time using the
+ * simple paged results control, so directories with more clients than
+ * the server's size limit can be loaded.  Each page is added to the
+ * client list, and freed, before the next one is requested.
  *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] tmpl to use as the base for the new client.
@@ -114,14 +248,12 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 
 	char const	**attrs = NULL;
 
-	CONF_PAIR	*cp;
-	int		count = 0, idx = 0;
+	int		count = 0, idx = 0, pages = 0;
 
 	LDAPMessage	*result = NULL;
 	LDAPMessage	*entry;
-	char		*dn = NULL;
 
-	RADCLIENT	*c;
+	struct berval	cookie = { 0, NULL };
 
 	DEBUG("Loading dynamic clients");
 
@@ -145,129 +277,67 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 		return -1;
 	}
 
-	/*
-	 *	Perform all searches as the admin user.
-	 */
-	if (conn->rebound) {
-		status = fr_ldap_bind(NULL, &conn,
-				      conn->config->admin_identity, conn->config->admin_password,
-				      &(conn->config->admin_sasl),
-				      NULL,
-				      NULL, NULL);
-		if (status != LDAP_PROC_SUCCESS) {
-			ret = -1;
-			goto finish;
-		}
-
-		fr_assert(conn);
-
-		conn->rebound = false;
-	}
-
-	status = fr_ldap_search(&result, NULL, &conn, inst->clientobj_base_dn, inst->clientobj_scope,
-				inst->clientobj_filter, attrs, NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		INFO("No clients were found in the directory");
-		ret = 0;
-		goto finish;
-
-	default:
-		ret = -1;
-		goto finish;
-	}
-
-	fr_assert(conn);
-	entry = ldap_first_entry(conn->handle, result);
-	if (!entry) {
-		int ldap_errno;
-
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		ERROR("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
-
-		ret = -1;
-		goto finish;
-	}
-
+	count = 0;
 	do {
-		ldap_client_data_t	data;
-
-		CONF_SECTION		*client;
-		char			*id;
-
-		struct berval		**values;
-
-		id = dn = ldap_get_dn(conn->handle, entry);
-		if (!dn) {
-			int ldap_errno;
-
-			ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-			ERROR("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+		LDAPControl	*serverctrls[] = { NULL, NULL };
 
+		if (ldap_create_page_control(conn->handle, LDAP_CLIENT_PAGE_SIZE, cookie.bv_len ? &cookie : NULL,
+					     0, &serverctrls[0]) != LDAP_SUCCESS) {
+			ERROR("Failed creating paged results control");
+			ret = -1;
 			goto finish;
 		}
-		fr_ldap_util_normalise_dn(dn, dn);
-
-		cp = cf_pair_find(map, "identifier");
-		if (cp) {
-			values = ldap_get_values_len(conn->handle, entry, cf_pair_value(cp));
-			if (values) id = fr_ldap_berval_to_string(NULL, values[0]);
-			ldap_value_free_len(values);
-		}
-
-		/*
-		 *	Iterate over mapping sections
-		 */
-		client = tmpl ? cf_section_dup(NULL, NULL, tmpl, "client", id, true) :
-				cf_section_alloc(NULL, NULL, "client", id);
-
-		data.conn = conn;
-		data.entry = entry;
+		if (cookie.bv_val) ber_memfree(cookie.bv_val);
+		cookie.bv_val = NULL;
+		cookie.bv_len = 0;
+
+		status = fr_ldap_search(&result, NULL, &conn, inst->clientobj_base_dn, inst->clientobj_scope,
+					inst->clientobj_filter, attrs, serverctrls, NULL);
+		ldap_control_free(serverctrls[0]);
+		switch (status) {
+		case LDAP_PROC_SUCCESS:
+			break;
+
+		case LDAP_PROC_NO_RESULT:
+			if (pages == 0) INFO("No clients were found in the directory");
+			ret = 0;
+			goto finish;
 
-		if (client_map_section(client, map, _get_client_value, &data) < 0) {
-			talloc_free(client);
+		default:
 			ret = -1;
 			goto finish;
 		}
+		pages++;
 
-		/*
-		 *@todo these should be parented from something
-		 */
-		c = client_afrom_cs(NULL, client, NULL);
-		if (!c) {
-			talloc_free(client);
-			ret = -1;
-			goto finish;
+		fr_assert(conn);
+		for (entry = ldap_first_entry(conn->handle, result);
+		     entry;
+		     entry = ldap_next_entry(conn->handle, entry)) {
+			if (rlm_ldap_client_add(inst, conn, entry, tmpl, map) < 0) {
+				ret = -1;
+				goto finish;
+			}
+			count++;
 		}
 
 		/*
-		 *	Client parents the CONF_SECTION which defined it
+		 *	Servers which don't support paging return
+		 *	everything at once, without a control.
 		 */
-		talloc_steal(c, client);
+		if (rlm_ldap_client_page_cookie(&cookie, conn, result) < 0) cookie.bv_len = 0;
 
-		if (!client_add(NULL, c)) {
-			ERROR("Failed to add client \"%s\", possible duplicate?", dn);
-			ret = -1;
-			client_free(c);
-			goto finish;
-		}
-
-		DEBUG("Client \"%s\" added", dn);
+		ldap_msgfree(result);
+		result = NULL;
+	} while (cookie.bv_len > 0);
 
-		ldap_memfree(dn);
-		dn = NULL;
-	} while ((entry = ldap_next_entry(conn->handle, entry)));
+	DEBUG("Loaded %i client(s) in %i page(s)", count, pages);
 
 finish:
 	talloc_free(attrs);
-	if (dn) ldap_memfree(dn);
+	if (cookie.bv_val) ber_memfree(cookie.bv_val);
 	if (result) ldap_msgfree(result);
 
-	mod_conn_release(inst, NULL, conn);
+	ldap_mod_conn_release(inst, NULL, conn);
 
 	return ret;
 }
-
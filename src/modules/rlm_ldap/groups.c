@@ -36,6 +36,283 @@ USES_APPLE_DEPRECATED_API
 
 #include "rlm_ldap.h"
 
+/** A group DN, and the name it resolved to
+ *
+ */
+typedef struct {
+	char const	*dn;				//!< Normalised DN of the group object.
+	char const	*name;				//!< Value of the group's name attribute.
+	fr_time_t	expires;			//!< When the entry should no longer be used.
+	int32_t		heap_id;			//!< Position in the expiry heap.
+} ldap_group_name_t;
+
+/** Group names, shared by all threads using a module instance
+ *
+ */
+struct rlm_ldap_group_cache_s {
+	rbtree_t	*tree;				//!< Entries, by DN.
+	fr_heap_t	*heap;				//!< Entries, by expiry time.
+	pthread_mutex_t	mutex;				//!< Protects the tree and the heap.
+};
+
+/** DNs are case insensitive
+ *
+ */
+static int group_name_cmp(void const *one, void const *two)
+{
+	ldap_group_name_t const *a = one, *b = two;
+
+	return strcasecmp(a->dn, b->dn);
+}
+
+static int8_t group_name_heap_cmp(void const *one, void const *two)
+{
+	ldap_group_name_t const *a = one, *b = two;
+
+	return (a->expires > b->expires) - (a->expires < b->expires);
+}
+
+static void _group_name_free(void *data)
+{
+	talloc_free(data);
+}
+
+static int _group_cache_free(rlm_ldap_group_cache_t *cache)
+{
+	/*
+	 *	Free the entries before the mutex goes away.
+	 */
+	TALLOC_FREE(cache->tree);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Remove entries which have expired
+ *
+ * @note Must be called with the mutex held.
+ */
+static void group_cache_expire(rlm_ldap_group_cache_t *cache, fr_time_t now)
+{
+	ldap_group_name_t *entry;
+
+	while ((entry = fr_heap_peek(cache->heap)) && (entry->expires <= now)) {
+		fr_heap_extract(cache->heap, entry);
+		rbtree_deletebydata(cache->tree, entry);
+	}
+}
+
+/** Add a group DN and its name to the cache
+ *
+ * Any existing entry for the DN is replaced.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	of the group.  Will be normalised.
+ * @param[in] name	of the group.
+ * @param[in] name_len	Length of the name.
+ */
+static void group_cache_insert(rlm_ldap_t const *inst, char const *dn, char const *name, size_t name_len)
+{
+	rlm_ldap_group_cache_t	*cache = inst->group_cache;
+	ldap_group_name_t	*entry, *old;
+	fr_time_t		now = fr_time();
+	size_t			len = strlen(dn);
+	char			*p;
+
+	if (!cache) return;
+
+	pthread_mutex_lock(&cache->mutex);
+	group_cache_expire(cache, now);
+
+	MEM(entry = talloc_zero(cache, ldap_group_name_t));
+	MEM(p = talloc_array(entry, char, len + 1));
+	fr_ldap_util_normalise_dn(p, dn);
+	entry->dn = p;
+	entry->name = talloc_bstrndup(entry, name, name_len);
+	entry->expires = now + inst->group_cache_lifetime;
+
+	old = rbtree_finddata(cache->tree, entry);
+	if (old) {
+		fr_heap_extract(cache->heap, old);
+		rbtree_deletebydata(cache->tree, old);
+	}
+
+	if (!rbtree_insert(cache->tree, entry)) {
+		talloc_free(entry);
+	} else {
+		fr_heap_insert(cache->heap, entry);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Find the name of a group in the cache
+ *
+ * @param[in] ctx	to allocate the name in.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	of the group.
+ * @return
+ *	- The name of the group.
+ *	- NULL if the group isn't in the cache.
+ */
+static char *group_cache_find(TALLOC_CTX *ctx, rlm_ldap_t const *inst, char const *dn)
+{
+	rlm_ldap_group_cache_t	*cache = inst->group_cache;
+	ldap_group_name_t	find, *entry;
+	char			buffer[LDAP_MAX_DN_STR_LEN];
+	char			*name = NULL;
+
+	if (!cache || (strlen(dn) >= sizeof(buffer))) return NULL;
+
+	fr_ldap_util_normalise_dn(buffer, dn);
+	find.dn = buffer;
+
+	pthread_mutex_lock(&cache->mutex);
+	group_cache_expire(cache, fr_time());
+
+	entry = rbtree_finddata(cache->tree, &find);
+	if (entry) name = talloc_typed_strdup(ctx, entry->name);
+	pthread_mutex_unlock(&cache->mutex);
+
+	return name;
+}
+
+/** Load the names of all the group objects into the cache
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int group_cache_preload(rlm_ldap_t const *inst)
+{
+	int			ret = 0, ldap_errno;
+	unsigned int		count = 0;
+	fr_ldap_rcode_t		status;
+	fr_ldap_connection_t	*conn;
+	char const		*attrs[] = { inst->groupobj_name_attr, NULL };
+	LDAPMessage		*result = NULL, *entry;
+
+	if (!tmpl_is_unresolved(inst->groupobj_base_dn)) {
+		ERROR("Can't preload group names, 'group.base_dn' must not be an expansion");
+		return -1;
+	}
+
+	conn = mod_conn_get(inst, NULL);
+	if (!conn) return -1;
+
+	/*
+	 *	Perform the search as the admin user.
+	 */
+	if (conn->rebound) {
+		status = fr_ldap_bind(NULL, &conn,
+				      conn->config->admin_identity, conn->config->admin_password,
+				      &(conn->config->admin_sasl),
+				      0,
+				      NULL, NULL);
+		if (status != LDAP_PROC_SUCCESS) {
+			ret = -1;
+			goto finish;
+		}
+
+		fr_assert(conn);
+
+		conn->rebound = false;
+	}
+
+	status = fr_ldap_search(&result, NULL, &conn, inst->groupobj_base_dn->name, inst->groupobj_scope,
+				inst->groupobj_filter, attrs, NULL, NULL);
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_NO_RESULT:
+		INFO("No group objects were found in the directory");
+		goto finish;
+
+	default:
+		ret = -1;
+		goto finish;
+	}
+
+	for (entry = ldap_first_entry(conn->handle, result);
+	     entry;
+	     entry = ldap_next_entry(conn->handle, entry)) {
+		struct berval	**values;
+		char		*dn;
+
+		dn = ldap_get_dn(conn->handle, entry);
+		if (!dn) {
+			ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+			ERROR("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+			ret = -1;
+			goto finish;
+		}
+
+		values = ldap_get_values_len(conn->handle, entry, inst->groupobj_name_attr);
+		if (values) {
+			group_cache_insert(inst, dn, values[0]->bv_val, values[0]->bv_len);
+			ldap_value_free_len(values);
+			count++;
+		}
+		ldap_memfree(dn);
+	}
+
+	DEBUG("Loaded %u group name(s)", count);
+
+finish:
+	if (result) ldap_msgfree(result);
+
+	ldap_mod_conn_release(inst, NULL, conn);
+
+	return ret;
+}
+
+/** Allocate the group name cache, and optionally fill it
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst)
+{
+	rlm_ldap_group_cache_t *cache;
+
+	MEM(cache = talloc_zero(inst, rlm_ldap_group_cache_t));
+
+	cache->heap = fr_heap_talloc_alloc(cache, group_name_heap_cmp, ldap_group_name_t, heap_id);
+	if (!cache->heap) {
+	error:
+		talloc_free(cache);
+		return -1;
+	}
+
+	if (pthread_mutex_init(&cache->mutex, NULL) < 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Set last, as the destructor uses it to tell
+	 *	whether the mutex needs to be destroyed.
+	 */
+	cache->tree = rbtree_talloc_alloc(cache, group_name_cmp, ldap_group_name_t, _group_name_free, 0);
+	if (!cache->tree) {
+		pthread_mutex_destroy(&cache->mutex);
+		goto error;
+	}
+	talloc_set_destructor(cache, _group_cache_free);
+
+	inst->group_cache = cache;
+
+	if (inst->group_cache_preload && (group_cache_preload(inst) < 0)) {
+		WARN("Failed preloading group names, they will be resolved as they're used");
+	}
+
+	return 0;
+}
+
 /** Convert multiple group names into a DNs
  *
  * Given an array of group names, builds a filter matching all names, then retrieves all group objects
@@ -219,6 +496,12 @@ static unlang_action_t rlm_ldap_group_dn2name(rlm_rcode_t *p_result, rlm_ldap_t
 		RETURN_MODULE_INVALID;
 	}
 
+	*out = group_cache_find(request, inst, dn);
+	if (*out) {
+		RDEBUG2("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, *out);
+		RETURN_MODULE_OK;
+	}
+
 	RDEBUG2("Resolving group DN \"%s\" to group name", dn);
 
 	status = fr_ldap_search(&result, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
@@ -255,6 +538,8 @@ static unlang_action_t rlm_ldap_group_dn2name(rlm_rcode_t *p_result, rlm_ldap_t
 	*out = fr_ldap_berval_to_string(request, values[0]);
 	RDEBUG2("Group DN \"%s\" resolves to name \"%s\"", dn, *out);
 
+	group_cache_insert(inst, dn, values[0]->bv_val, values[0]->bv_len);
+
 finish:
 	if (result) ldap_msgfree(result);
 	if (values) ldap_value_free_len(values);
@@ -121,6 +121,8 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cache_attribute", FR_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", FR_TYPE_STRING, rlm_ldap_t, group_attribute) },
 	{ FR_CONF_OFFSET("allow_dangling_group_ref", FR_TYPE_BOOL, rlm_ldap_t, allow_dangling_group_refs), .dflt = "no" },
+	{ FR_CONF_OFFSET("name_cache_lifetime", FR_TYPE_TIME_DELTA, rlm_ldap_t, group_cache_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("name_cache_preload", FR_TYPE_BOOL, rlm_ldap_t, group_cache_preload), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -2039,6 +2041,12 @@ if (inst->handle_config.tls_min_version_str) {
 
 	fr_ldap_global_config(inst->ldap_debug, inst->tls_random_file);
 
+	/*
+	 *	Cache the names group DNs resolve to.
+	 */
+	if (inst->group_cache_lifetime && inst->groupobj_name_attr &&
+	    (rlm_ldap_group_cache_init(inst) < 0)) goto error;
+
 	return 0;
 
 error:
@@ -19,6 +19,8 @@
 
 typedef struct ldap_inst_s rlm_ldap_t;
 
+typedef struct rlm_ldap_group_cache_s rlm_ldap_group_cache_t;
+
 typedef struct {
 	tmpl_t	*mech;				//!< SASL mech(s) to try.
 	tmpl_t	*proxy;				//!< Identity to proxy.
@@ -112,6 +114,11 @@ struct ldap_inst_s {
 	bool		allow_dangling_group_refs;	//!< Don't error if we fail to resolve a group DN referenced
 														///< from a user object.
 
+	fr_time_delta_t	group_cache_lifetime;		//!< How long to remember the name a group DN resolved to.
+							//!< 0 disables the cache.
+	bool		group_cache_preload;		//!< Load the names of all group objects at startup.
+	rlm_ldap_group_cache_t *group_cache;		//!< Group names, by DN.  Shared by all threads.
+
 	/*
 	 *	Profiles
 	 */
@@ -174,6 +181,8 @@ void rlm_ldap_check_reply(rlm_ldap_t const *inst, request_t *request, fr_ldap_co
 /*
  *	groups.c - Group membership functions.
  */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst);
+
 unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
 					   request_t *request, fr_ldap_connection_t **pconn,
 					   LDAPMessage *entry, char const *attr);
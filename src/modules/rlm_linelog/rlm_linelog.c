@@ -72,6 +72,10 @@ typedef struct {
 	fr_ipaddr_t		src_ipaddr;		//!< Send requests from a given src_ipaddr.
 	uint16_t		port;			//!< Network port.
 	fr_time_delta_t		timeout;		//!< How long to wait for read/write operations.
+
+	size_t			buffer_size;		//!< Send once this much is queued.  0 disables queueing.
+	size_t			max_queued;		//!< Most each thread will queue if the server is slow.
+	fr_time_delta_t		flush_interval;		//!< How long data may sit in the queue.
 } linelog_net_t;
 
 /** linelog module instance
@@ -105,6 +109,9 @@ typedef struct {
 		exfile_t		*ef;			//!< Exclusive file access handle.
 		bool			escape;			//!< Do filename escaping, yes / no.
 		xlat_escape_legacy_t	escape_func;		//!< Escape function.
+		size_t			buffer_size;		//!< How much to buffer per thread, per file.
+		fr_time_delta_t		flush_interval;		//!< How long data may sit in the buffer.
+		bool			fsync;			//!< fsync() after each write.
 	} file;
 
 	struct {
@@ -122,12 +129,62 @@ typedef struct {
 	int			sockfd;			//!< File descriptor associated with socket
 } linelog_conn_t;
 
+/** Log lines waiting to be written to one file
+ *
+ */
+typedef struct {
+	char const		*path;			//!< File the data is for.
+	uint8_t			*data;			//!< Log lines.
+	size_t			used;			//!< How much of the buffer has data in it.
+} linelog_buffer_t;
+
+/** Log lines waiting to be sent to a TCP or UDP server
+ *
+ * Each call to the module adds one entry.  For UDP each entry is sent
+ * as one datagram, for TCP the entries are written as one stream.
+ */
+typedef struct {
+	linelog_net_t const	*net;			//!< Server we're sending to.
+	int			fd;			//!< Our socket, or -1 if we need to connect.
+	bool			blocked;		//!< Waiting for the socket to become writable.
+
+	uint8_t			*data;			//!< Queued log lines.
+	size_t			used;			//!< How much of data is in use.
+	size_t			sent;			//!< How much of data has been sent.
+
+	size_t			*entries;		//!< Offset of the end of each entry.
+	unsigned int		num_entries;		//!< How many entries are queued.
+	unsigned int		next_entry;		//!< First entry which hasn't been sent completely.
+
+	fr_rate_limit_t		full_rate_limit;	//!< For "queue full" warnings.
+} linelog_queue_t;
+
+/** Per-thread instance data
+ *
+ * Lines for files are appended to a buffer, and the buffer is written
+ * out when it fills, or when the flush timer fires.  The exfile lock
+ * is then taken once per batch instead of once per line.
+ *
+ * Lines for TCP and UDP servers can be queued the same way, and are
+ * sent from the event loop, so a slow server never blocks the worker.
+ */
+typedef struct {
+	rlm_linelog_t const	*inst;			//!< Instance of linelog.
+	fr_event_list_t		*el;			//!< This thread's event list.
+	rbtree_t		*buffers;		//!< linelog_buffer_t, by filename.
+	linelog_queue_t		*queue;			//!< Lines waiting to be sent to a server.
+	fr_event_timer_t const	*ev;			//!< When to flush the buffers.
+} rlm_linelog_thread_t;
+
 
 static const CONF_PARSER file_config[] = {
 	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_XLAT, rlm_linelog_t, file.name) },
 	{ FR_CONF_OFFSET("permissions", FR_TYPE_UINT32, rlm_linelog_t, file.permissions), .dflt = "0600" },
 	{ FR_CONF_OFFSET("group", FR_TYPE_STRING, rlm_linelog_t, file.group_str) },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_linelog_t, file.escape), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffer_size", FR_TYPE_SIZE, rlm_linelog_t, file.buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("flush_interval", FR_TYPE_TIME_DELTA, rlm_linelog_t, file.flush_interval), .dflt = "1" },
+	{ FR_CONF_OFFSET("fsync", FR_TYPE_BOOL, rlm_linelog_t, file.fsync), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -146,6 +203,9 @@ static const CONF_PARSER udp_config[] = {
 	{ FR_CONF_OFFSET("server", FR_TYPE_COMBO_IP_ADDR, linelog_net_t, dst_ipaddr) },
 	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, linelog_net_t, port) },
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_TIME_DELTA, linelog_net_t, timeout), .dflt = "1000" },
+	{ FR_CONF_OFFSET("buffer_size", FR_TYPE_SIZE, linelog_net_t, buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", FR_TYPE_SIZE, linelog_net_t, max_queued), .dflt = "1M" },
+	{ FR_CONF_OFFSET("flush_interval", FR_TYPE_TIME_DELTA, linelog_net_t, flush_interval), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -153,6 +213,9 @@ static const CONF_PARSER tcp_config[] = {
 	{ FR_CONF_OFFSET("server", FR_TYPE_COMBO_IP_ADDR, linelog_net_t, dst_ipaddr) },
 	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, linelog_net_t, port) },
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_TIME_DELTA, linelog_net_t, timeout), .dflt = "1000" },
+	{ FR_CONF_OFFSET("buffer_size", FR_TYPE_SIZE, linelog_net_t, buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", FR_TYPE_SIZE, linelog_net_t, max_queued), .dflt = "1M" },
+	{ FR_CONF_OFFSET("flush_interval", FR_TYPE_TIME_DELTA, linelog_net_t, flush_interval), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -269,6 +332,481 @@ static void *mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t ti
 	return conn;
 }
 
+/** Write data to a file, holding the exfile lock for the duration
+ *
+ * @param[in] inst	of linelog.
+ * @param[in] request	The current request.  May be NULL.
+ * @param[in] path	of the file to write to.
+ * @param[in] vector	data to write.
+ * @param[in] vector_len	number of elements in vector.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int linelog_file_write(rlm_linelog_t const *inst, request_t *request, char const *path,
+			      struct iovec *vector, int vector_len)
+{
+	int fd;
+
+	fd = exfile_open(inst->file.ef, request, path, inst->file.permissions);
+	if (fd < 0) {
+		ROPTIONAL(RERROR, ERROR, "Failed to open %s: %s", path, fr_syserror(errno));
+		return -1;
+	}
+
+	if (inst->file.group_str && (chown(path, -1, inst->file.group) == -1)) {
+		ROPTIONAL(RPWARN, PWARN, "Unable to change system group of \"%s\"", path);
+	}
+
+	if (writev(fd, vector, vector_len) < 0) {
+		ROPTIONAL(RERROR, ERROR, "Failed writing to \"%s\": %s", path, fr_syserror(errno));
+		exfile_close(inst->file.ef, request, fd);
+
+		/* Assert on the extra fatal errors */
+		fr_assert((errno != EINVAL) && (errno != EFAULT));
+
+		return -1;
+	}
+
+	if (inst->file.fsync && (fsync(fd) < 0)) {
+		ROPTIONAL(RERROR, ERROR, "Failed syncing \"%s\": %s", path, fr_syserror(errno));
+		exfile_close(inst->file.ef, request, fd);
+		return -1;
+	}
+
+	exfile_close(inst->file.ef, request, fd);
+
+	return 0;
+}
+
+/** Write out everything in a buffer
+ *
+ */
+static int linelog_buffer_flush(rlm_linelog_t const *inst, request_t *request, linelog_buffer_t *buf)
+{
+	int ret;
+
+	if (!buf->used) return 0;
+
+	ret = linelog_file_write(inst, request, buf->path,
+				 &(struct iovec){ .iov_base = buf->data, .iov_len = buf->used }, 1);
+	buf->used = 0;
+
+	return ret;
+}
+
+static int _linelog_buffer_flush(void *data, void *uctx)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(uctx, rlm_linelog_thread_t);
+
+	(void) linelog_buffer_flush(t->inst, NULL, data);
+
+	return 0;
+}
+
+static void linelog_flush_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(uctx, rlm_linelog_thread_t);
+
+	(void) rbtree_walk(t->buffers, RBTREE_IN_ORDER, _linelog_buffer_flush, t);
+}
+
+/** Add log lines to the buffer for a file
+ *
+ * Data is written immediately if it won't fit in the buffer.
+ */
+static int linelog_buffer_write(rlm_linelog_thread_t *t, request_t *request, char const *path,
+				struct iovec *vector, int vector_len)
+{
+	rlm_linelog_t const	*inst = t->inst;
+	linelog_buffer_t	*buf;
+	size_t			len = 0;
+	int			i;
+
+	for (i = 0; i < vector_len; i++) len += vector[i].iov_len;
+
+	buf = rbtree_finddata(t->buffers, &(linelog_buffer_t){ .path = path });
+	if (!buf) {
+		MEM(buf = talloc_zero(t->buffers, linelog_buffer_t));
+		MEM(buf->path = talloc_strdup(buf, path));
+		MEM(buf->data = talloc_array(buf, uint8_t, inst->file.buffer_size));
+
+		if (!rbtree_insert(t->buffers, buf)) {
+			talloc_free(buf);
+			return linelog_file_write(inst, request, path, vector, vector_len);
+		}
+	}
+
+	if ((buf->used + len) > inst->file.buffer_size) {
+		if (linelog_buffer_flush(inst, request, buf) < 0) return -1;
+
+		if (len > inst->file.buffer_size) return linelog_file_write(inst, request, path, vector, vector_len);
+	}
+
+	for (i = 0; i < vector_len; i++) {
+		memcpy(buf->data + buf->used, vector[i].iov_base, vector[i].iov_len);
+		buf->used += vector[i].iov_len;
+	}
+
+	if (!t->ev && (fr_event_timer_in(t, t->el, &t->ev, inst->file.flush_interval,
+					 linelog_flush_timer, t) < 0)) {
+		RPWARN("Failed inserting flush timer, writing immediately");
+		return linelog_buffer_flush(inst, request, buf);
+	}
+
+	return 0;
+}
+
+static int linelog_buffer_cmp(void const *one, void const *two)
+{
+	linelog_buffer_t const *a = one, *b = two;
+
+	return strcmp(a->path, b->path);
+}
+
+static void linelog_queue_writable(fr_event_list_t *el, int fd, int flags, void *uctx);
+static void linelog_queue_error(fr_event_list_t *el, int fd, int flags, int fd_errno, void *uctx);
+
+/** Close the socket for a queue
+ *
+ * The next flush opens a new one.  If the last entry was only partly
+ * sent, the rest of it is discarded, so the server never sees half
+ * a line prepended to the next one.
+ */
+static void linelog_queue_close(rlm_linelog_thread_t *t)
+{
+	linelog_queue_t	*q = t->queue;
+
+	if (q->fd < 0) return;
+
+	if (q->blocked) {
+		(void) fr_event_fd_delete(t->el, q->fd, FR_EVENT_FILTER_IO);
+		q->blocked = false;
+	}
+	close(q->fd);
+	q->fd = -1;
+
+	if ((q->next_entry < q->num_entries) && (q->sent > ((q->next_entry > 0) ? q->entries[q->next_entry - 1] : 0))) {
+		q->sent = q->entries[q->next_entry++];
+	}
+}
+
+/** Open a non-blocking socket to the server
+ *
+ * TCP connections complete in the background.  Until they do, writes
+ * fail with EWOULDBLOCK, and we wait for the socket to become writable.
+ */
+static int linelog_queue_connect(rlm_linelog_thread_t *t)
+{
+	rlm_linelog_t const	*inst = t->inst;
+	linelog_queue_t		*q = t->queue;
+
+	if (inst->log_dst == LINELOG_DST_TCP) {
+		q->fd = fr_socket_client_tcp(NULL, &q->net->dst_ipaddr, q->net->port, true);
+	} else {
+		q->fd = fr_socket_client_udp(NULL, NULL, &q->net->dst_ipaddr, q->net->port, true);
+	}
+	if (q->fd < 0) {
+		PERROR("%s - Failed connecting to %pV:%u", inst->name,
+		       fr_box_ipaddr(q->net->dst_ipaddr), q->net->port);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Send as much of the queue as the socket will take
+ *
+ * @return
+ *	- 0 if the queue is empty, or we're waiting for the socket to become writable.
+ *	- -1 on error.  The socket has been closed, and the queued data kept.
+ */
+static int linelog_queue_flush(rlm_linelog_thread_t *t)
+{
+	rlm_linelog_t const	*inst = t->inst;
+	linelog_queue_t		*q = t->queue;
+
+	if (q->next_entry == q->num_entries) goto done;
+
+	if ((q->fd < 0) && (linelog_queue_connect(t) < 0)) return -1;
+
+	while (q->next_entry < q->num_entries) {
+		if (inst->log_dst == LINELOG_DST_TCP) {
+			ssize_t		slen;
+
+			slen = write(q->fd, q->data + q->sent, q->used - q->sent);
+			if (slen < 0) goto error;
+
+			q->sent += slen;
+			while ((q->next_entry < q->num_entries) && (q->entries[q->next_entry] <= q->sent)) q->next_entry++;
+		} else {
+			struct mmsghdr	msgvec[64];
+			struct iovec	iov[NUM_ELEMENTS(msgvec)];
+			unsigned int	i, num;
+			size_t		start = q->sent;
+			int		sent;
+
+			/*
+			 *	One datagram per entry, as many as we can
+			 *	send in one system call.
+			 */
+			num = q->num_entries - q->next_entry;
+			if (num > NUM_ELEMENTS(msgvec)) num = NUM_ELEMENTS(msgvec);
+
+			memset(msgvec, 0, sizeof(msgvec[0]) * num);
+			for (i = 0; i < num; i++) {
+				size_t end = q->entries[q->next_entry + i];
+
+				iov[i].iov_base = q->data + start;
+				iov[i].iov_len = end - start;
+				msgvec[i].msg_hdr.msg_iov = &iov[i];
+				msgvec[i].msg_hdr.msg_iovlen = 1;
+				start = end;
+			}
+
+			sent = sendmmsg(q->fd, msgvec, num, 0);
+			if (sent < 0) {
+				if ((errno == EWOULDBLOCK) || (errno == EAGAIN) || (errno == EINTR)) goto error;
+
+				/*
+				 *	The first datagram was refused,
+				 *	e.g. ECONNREFUSED from an earlier
+				 *	ICMP error.  Discard it, and carry on.
+				 */
+				ERROR("%s - Failed sending to %pV:%u: %s", inst->name,
+				      fr_box_ipaddr(q->net->dst_ipaddr), q->net->port, fr_syserror(errno));
+				sent = 1;
+			}
+
+			q->next_entry += sent;
+			q->sent = q->entries[q->next_entry - 1];
+		}
+		continue;
+
+	error:
+		switch (errno) {
+		case EINTR:
+			continue;
+
+		/*
+		 *	The server is slow, or the connection
+		 *	hasn't completed.  Wait until we can
+		 *	write more.
+		 */
+		case EWOULDBLOCK:
+#if EWOULDBLOCK != EAGAIN
+		case EAGAIN:
+#endif
+		case ENOTCONN:
+		case EINPROGRESS:
+			if (q->blocked) return 0;
+
+			if (fr_event_fd_insert(q, t->el, q->fd, NULL,
+					       linelog_queue_writable, linelog_queue_error, t) < 0) {
+				PERROR("%s - Failed inserting write event", inst->name);
+				linelog_queue_close(t);
+				return -1;
+			}
+			q->blocked = true;
+			return 0;
+
+		default:
+			ERROR("%s - Failed writing to %pV:%u: %s", inst->name,
+			      fr_box_ipaddr(q->net->dst_ipaddr), q->net->port, fr_syserror(errno));
+			linelog_queue_close(t);
+			return -1;
+		}
+	}
+
+done:
+	if (q->blocked) {
+		(void) fr_event_fd_delete(t->el, q->fd, FR_EVENT_FILTER_IO);
+		q->blocked = false;
+	}
+	q->used = q->sent = 0;
+	q->num_entries = q->next_entry = 0;
+
+	return 0;
+}
+
+static void linelog_queue_timer(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Try sending the queue again after flush_interval
+ *
+ */
+static void linelog_queue_retry(rlm_linelog_thread_t *t)
+{
+	if (t->ev) return;
+
+	if (fr_event_timer_in(t, t->el, &t->ev, t->queue->net->flush_interval, linelog_queue_timer, t) < 0) {
+		PERROR("%s - Failed inserting flush timer", t->inst->name);
+	}
+}
+
+static void linelog_queue_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(uctx, rlm_linelog_thread_t);
+
+	/*
+	 *	If we couldn't connect, try again later.
+	 */
+	if (linelog_queue_flush(t) < 0) linelog_queue_retry(t);
+}
+
+static void linelog_queue_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(uctx, rlm_linelog_thread_t);
+
+	if (linelog_queue_flush(t) < 0) linelog_queue_retry(t);
+}
+
+static void linelog_queue_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				int fd_errno, void *uctx)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(uctx, rlm_linelog_thread_t);
+
+	ERROR("%s - Connection to %pV:%u failed: %s", t->inst->name,
+	      fr_box_ipaddr(t->queue->net->dst_ipaddr), t->queue->net->port, fr_syserror(fd_errno));
+	linelog_queue_close(t);
+	linelog_queue_retry(t);
+}
+
+/** Add log lines to the queue for a server
+ *
+ * The queue is sent once it holds buffer_size bytes, or when the flush
+ * timer fires.  If the server can't keep up, and the queue reaches
+ * max_queued bytes, new lines are discarded rather than blocking
+ * the worker.
+ */
+static int linelog_queue_write(rlm_linelog_thread_t *t, request_t *request,
+			       struct iovec *vector, int vector_len)
+{
+	linelog_queue_t		*q = t->queue;
+	size_t			len = 0;
+	int			i;
+
+	for (i = 0; i < vector_len; i++) len += vector[i].iov_len;
+
+	if ((q->used + len) > q->net->max_queued) {
+		unsigned int j;
+
+		/*
+		 *	Move the unsent data to the start of the buffer.
+		 */
+		if (q->sent) {
+			memmove(q->data, q->data + q->sent, q->used - q->sent);
+			for (j = q->next_entry; j < q->num_entries; j++) q->entries[j - q->next_entry] = q->entries[j] - q->sent;
+			q->used -= q->sent;
+			q->num_entries -= q->next_entry;
+			q->next_entry = 0;
+			q->sent = 0;
+		}
+
+		if ((q->used + len) > q->net->max_queued) {
+			RATE_LIMIT_LOCAL(&q->full_rate_limit, RWARN,
+					 "Queue for %pV:%u is full, discarding log line",
+					 fr_box_ipaddr(q->net->dst_ipaddr), q->net->port);
+			return -1;
+		}
+	}
+
+	if (q->num_entries == talloc_array_length(q->entries)) {
+		MEM(q->entries = talloc_realloc(q, q->entries, size_t, q->num_entries * 2));
+	}
+
+	for (i = 0; i < vector_len; i++) {
+		memcpy(q->data + q->used, vector[i].iov_base, vector[i].iov_len);
+		q->used += vector[i].iov_len;
+	}
+	q->entries[q->num_entries++] = q->used;
+
+	if (q->blocked) return 0;
+
+	if ((q->used - q->sent) >= q->net->buffer_size) {
+		if (linelog_queue_flush(t) < 0) linelog_queue_retry(t);
+		return 0;
+	}
+
+	if (!t->ev && (fr_event_timer_in(t, t->el, &t->ev, q->net->flush_interval,
+					 linelog_queue_timer, t) < 0)) {
+		RPWARN("Failed inserting flush timer, sending immediately");
+		(void) linelog_queue_flush(t);
+	}
+
+	return 0;
+}
+
+static int _linelog_queue_free(linelog_queue_t *q)
+{
+	if (q->fd >= 0) close(q->fd);
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_linelog_t const	*inst = talloc_get_type_abort_const(instance, rlm_linelog_t);
+	rlm_linelog_thread_t	*t = thread;
+
+	(void) talloc_set_type(t, rlm_linelog_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+
+	switch (inst->log_dst) {
+	case LINELOG_DST_FILE:
+		if (!inst->file.buffer_size) break;
+
+		MEM(t->buffers = rbtree_talloc_alloc(t, linelog_buffer_cmp, linelog_buffer_t, NULL, RBTREE_FLAG_NONE));
+		break;
+
+	case LINELOG_DST_TCP:
+	case LINELOG_DST_UDP:
+	{
+		linelog_net_t const	*net = (inst->log_dst == LINELOG_DST_TCP) ? &inst->tcp : &inst->udp;
+		linelog_queue_t		*q;
+
+		if (!net->buffer_size) break;
+
+		MEM(t->queue = q = talloc_zero(t, linelog_queue_t));
+		q->net = net;
+		q->fd = -1;
+		MEM(q->data = talloc_array(q, uint8_t, net->max_queued));
+		MEM(q->entries = talloc_array(q, size_t, 64));
+		talloc_set_destructor(q, _linelog_queue_free);
+
+		/*
+		 *	Failing to connect isn't fatal, we try
+		 *	again when there's something to send.
+		 */
+		(void) linelog_queue_connect(t);
+	}
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/** Write out anything which is still buffered
+ *
+ */
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(thread, rlm_linelog_thread_t);
+
+	if (t->ev) fr_event_timer_delete(&t->ev);
+	if (t->buffers) (void) rbtree_walk(t->buffers, RBTREE_IN_ORDER, _linelog_buffer_flush, t);
+	if (t->queue) {
+		(void) linelog_queue_flush(t);
+		linelog_queue_close(t);
+	}
+
+	return 0;
+}
+
 static int mod_detach(void *instance)
 {
 	rlm_linelog_t *inst = instance;
@@ -383,12 +921,28 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		break;
 
 	case LINELOG_DST_UDP:
+		if (inst->udp.buffer_size) {
+			if (inst->udp.max_queued < inst->udp.buffer_size) {
+				cf_log_err(conf, "'udp.max_queued' must be at least 'udp.buffer_size'");
+				return -1;
+			}
+			break;
+		}
+
 		inst->pool = module_connection_pool_init(cf_section_find(conf, "udp", NULL),
 							 inst, mod_conn_create, NULL, prefix, NULL, NULL);
 		if (!inst->pool) return -1;
 		break;
 
 	case LINELOG_DST_TCP:
+		if (inst->tcp.buffer_size) {
+			if (inst->tcp.max_queued < inst->tcp.buffer_size) {
+				cf_log_err(conf, "'tcp.max_queued' must be at least 'tcp.buffer_size'");
+				return -1;
+			}
+			break;
+		}
+
 		inst->pool = module_connection_pool_init(cf_section_find(conf, "tcp", NULL),
 							 inst, mod_conn_create, NULL, prefix, NULL, NULL);
 		if (!inst->pool) return -1;
@@ -449,6 +1003,7 @@ static size_t linelog_escape_func(UNUSED request_t *request,
 static unlang_action_t CC_HINT(nonnull) mod_do_linelog(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_linelog_t const		*inst = talloc_get_type_abort_const(mctx->instance, rlm_linelog_t);
+	rlm_linelog_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
 	linelog_conn_t			*conn;
 	fr_time_delta_t			timeout = 0;
 	char				buff[4096];
@@ -637,13 +1192,20 @@ build_vector:
 		goto finish;
 	}
 
+	/*
+	 *	Queue the data, and let the event loop send it
+	 */
+	if (t->queue) {
+		if (linelog_queue_write(t, request, vector_p, vector_len) < 0) rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
 	/*
 	 *	Reserve a handle, write out the data, close the handle
 	 */
 	switch (inst->log_dst) {
 	case LINELOG_DST_FILE:
 	{
-		int fd = -1;
 		char path[2048];
 
 		if (xlat_eval(path, sizeof(path), request, inst->file.name, inst->file.escape_func, NULL) < 0) {
@@ -662,28 +1224,11 @@ build_vector:
 			*p = '/';
 		}
 
-		fd = exfile_open(inst->file.ef, request, path, inst->file.permissions);
-		if (fd < 0) {
-			RERROR("Failed to open %s: %s", path, fr_syserror(errno));
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
-		}
-
-		if (inst->file.group_str && (chown(path, -1, inst->file.group) == -1)) {
-			RPWARN("Unable to change system group of \"%s\": %s", path, fr_strerror());
-		}
-
-		if (writev(fd, vector_p, vector_len) < 0) {
-			RERROR("Failed writing to \"%s\": %s", path, fr_syserror(errno));
-			exfile_close(inst->file.ef, request, fd);
-
-			/* Assert on the extra fatal errors */
-			fr_assert((errno != EINVAL) && (errno != EFAULT));
-
-			RETURN_MODULE_FAIL;
+		if (t->buffers) {
+			if (linelog_buffer_write(t, request, path, vector_p, vector_len) < 0) rcode = RLM_MODULE_FAIL;
+		} else {
+			if (linelog_file_write(inst, request, path, vector_p, vector_len) < 0) rcode = RLM_MODULE_FAIL;
 		}
-
-		exfile_close(inst->file.ef, request, fd);
 	}
 		break;
 
@@ -791,12 +1336,15 @@ finish:
  */
 extern module_t rlm_linelog;
 module_t rlm_linelog = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "linelog",
-	.inst_size	= sizeof(rlm_linelog_t),
-	.config		= module_config,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "linelog",
+	.inst_size		= sizeof(rlm_linelog_t),
+	.thread_inst_size	= sizeof(rlm_linelog_thread_t),
+	.config			= module_config,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_do_linelog,
 		[MOD_AUTHORIZE]		= mod_do_linelog,
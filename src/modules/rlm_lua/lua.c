@@ -299,7 +299,8 @@ static int fr_lua_unmarshall(fr_pair_t **out,
 /** Get an instance of an attribute
  *
  * @note Should only be present in the Lua environment as a closure.
- * @note Takes one upvalue - the fr_dict_attr_t to search for as light user data.
+ * @note Takes two upvalues - the fr_dict_attr_t to search for as light user data,
+ *	 and the #tmpl_pair_list_t to search in as an integer.
  * @note Is called as an __index metamethod, so takes the table (can be ignored)
  *	 and the field (an integer index value)
  *
@@ -314,6 +315,7 @@ static int _lua_pair_get(lua_State *L)
 
 	fr_cursor_t		cursor;
 	fr_dict_attr_t const	*da;
+	fr_pair_list_t		*list;
 	fr_pair_t		*vp = NULL;
 	int			index;
 
@@ -322,10 +324,10 @@ static int _lua_pair_get(lua_State *L)
 	da = lua_touserdata(L, lua_upvalueindex(1));
 	fr_assert(da);
 
-	/*
-	 *	@fixme Packet list should be light user data too at some point
-	 */
-	fr_cursor_iter_by_da_init(&cursor, &request->request_pairs, da);
+	list = tmpl_list_head(request, lua_tointeger(L, lua_upvalueindex(2)));
+	if (!list) return 0;
+
+	fr_cursor_iter_by_da_init(&cursor, list, da);
 
 	for (index = (int) lua_tointeger(L, -1); index >= 0; index--) {
 		vp = fr_cursor_next(&cursor);
@@ -340,7 +342,8 @@ static int _lua_pair_get(lua_State *L)
 /** Set an instance of an attribute
  *
  * @note Should only be present in the Lua environment as a closure.
- * @note Takes one upvalue - the fr_dict_attr_t to search for as light user data.
+ * @note Takes two upvalues - the fr_dict_attr_t to search for as light user data,
+ *	 and the #tmpl_pair_list_t to search in as an integer.
  * @note Is called as an __newindex metamethod, so takes the table (can be ignored),
  *	 the field (an integer index value) and the new value.
  *
@@ -355,6 +358,9 @@ static int _lua_pair_set(lua_State *L)
 	request_t			*request = fr_lua_util_get_request();
 	fr_cursor_t		cursor;
 	fr_dict_attr_t const	*da;
+	tmpl_pair_list_t	list_name;
+	fr_pair_list_t		*list;
+	TALLOC_CTX		*list_ctx;
 	fr_pair_t		*vp = NULL, *new;
 	lua_Integer		index;
 	bool			delete = false;
@@ -369,12 +375,18 @@ static int _lua_pair_set(lua_State *L)
 	da = lua_touserdata(L, lua_upvalueindex(1));
 	fr_assert(da);
 
+	list_name = lua_tointeger(L, lua_upvalueindex(2));
+	list = tmpl_list_head(request, list_name);
+	list_ctx = tmpl_list_ctx(request, list_name);
+	if (!list || !list_ctx) {
+		REDEBUG("List \"%s\" is not available",
+			fr_table_str_by_value(pair_list_table, list_name, "<INVALID>"));
+		return -1;
+	}
+
 	delete = lua_isnil(L, -1);
 
-	/*
-	 *	@fixme Packet list should be light user data too at some point
-	 */
-	fr_cursor_iter_by_da_init(&cursor, &request->request_pairs, da);
+	fr_cursor_iter_by_da_init(&cursor, list, da);
 
 	for (index = lua_tointeger(L, -2); index >= 0; index--) {
 		vp = fr_cursor_next(&cursor);
@@ -391,6 +403,7 @@ static int _lua_pair_set(lua_State *L)
 	}
 
 	if (fr_lua_unmarshall(&new, inst, request, L, da) < 0) return -1;
+	talloc_steal(list_ctx, new);
 
 	/*
 	 *	If there was already a VP at that index we replace it
@@ -440,7 +453,7 @@ static int _lua_pair_iterator_init(lua_State *L)
 
 	fr_cursor_t		*cursor;
 	fr_dict_attr_t const	*da;
-
+	fr_pair_list_t		*list;
 
 	/*
 	 *	This function should only be called as a closure.
@@ -451,12 +464,18 @@ static int _lua_pair_iterator_init(lua_State *L)
 	da = lua_touserdata(L, lua_upvalueindex(2));
 	fr_assert(da);
 
+	list = tmpl_list_head(request, lua_tointeger(L, lua_upvalueindex(1)));
+	if (!list) {
+		lua_pushnil(L);
+		return 1;
+	}
+
 	cursor = (fr_cursor_t*) lua_newuserdata(L, sizeof(fr_cursor_t));
 	if (!cursor) {
 		REDEBUG("Failed allocating user data to hold cursor");
 		return -1;
 	}
-	fr_cursor_iter_by_da_init(cursor, &request->request_pairs, da);	/* @FIXME: Shouldn't use list head */
+	fr_cursor_iter_by_da_init(cursor, list, da);
 
 	lua_pushcclosure(L, _lua_pair_iterator, 1);
 
@@ -498,15 +517,25 @@ static int _lua_list_iterator_init(lua_State *L)
 {
 	request_t			*request = fr_lua_util_get_request();
 	fr_cursor_t		*cursor;
+	fr_pair_list_t		*list;
+
+	list = tmpl_list_head(request, lua_tointeger(L, lua_upvalueindex(1)));
+	if (!list) {
+		lua_pushnil(L);
+		return 1;
+	}
 
+	/*
+	 *	The cursor is left on the stack as the closure's
+	 *	upvalue, so it lives as long as the iterator does.
+	 */
 	cursor = (fr_cursor_t*) lua_newuserdata(L, sizeof(fr_cursor_t));
 	if (!cursor) {
 		REDEBUG("Failed allocating user data to hold cursor");
 		return -1;
 	}
-	fr_cursor_init(cursor, &request->request_pairs);	/* @FIXME: Shouldn't use list head */
+	fr_cursor_init(cursor, list);
 
-	lua_pushlightuserdata(L, cursor);
 	lua_pushcclosure(L, _lua_list_iterator, 1);
 
 	return 1;
@@ -514,15 +543,23 @@ static int _lua_list_iterator_init(lua_State *L)
 
 /** Initialise and return a new accessor table
  *
+ * Called as the __index metamethod of a list table, the first time
+ * a script references an attribute in that list.  No pairs are
+ * converted here, the accessor's metamethods read and write the
+ * fr_pair_t in the list directly, when the script indexes it.
  *
+ * @note Takes one upvalue - the #tmpl_pair_list_t the accessor operates on.
  */
 static int _lua_pair_accessor_init(lua_State *L)
 {
 	request_t			*request = fr_lua_util_get_request();
+	lua_Integer		list_name;
 	char const		*attr;
 	fr_dict_attr_t const	*da;
 	fr_dict_attr_t		*up;
 
+	list_name = lua_tointeger(L, lua_upvalueindex(1));
+
 	attr = lua_tostring(L, -1);
 	if (!attr) {
 		REDEBUG("Failed retrieving field name \"%s\"", attr);
@@ -544,7 +581,7 @@ static int _lua_pair_accessor_init(lua_State *L)
 	 *	for v in request[User-Name].pairs() do
 	 */
 	lua_newtable(L);
-	lua_pushlightuserdata(L, request->request_pairs);
+	lua_pushinteger(L, list_name);
 	lua_pushlightuserdata(L, up);
 	lua_pushcclosure(L, _lua_pair_iterator_init, 2);
 	lua_setfield(L, -2, "pairs");
@@ -554,11 +591,13 @@ static int _lua_pair_accessor_init(lua_State *L)
 	 */
 	lua_newtable(L);
 	lua_pushlightuserdata(L, up);
-	lua_pushcclosure(L, _lua_pair_get, 1);
+	lua_pushinteger(L, list_name);
+	lua_pushcclosure(L, _lua_pair_get, 2);
 	lua_setfield(L, -2, "__index");
 
 	lua_pushlightuserdata(L, up);
-	lua_pushcclosure(L, _lua_pair_set, 1);
+	lua_pushinteger(L, list_name);
+	lua_pushcclosure(L, _lua_pair_set, 2);
 	lua_setfield(L, -2, "__newindex");
 
 	lua_setmetatable(L, -2);
@@ -703,37 +742,46 @@ static int fr_lua_get_field(lua_State *L, request_t *request, char const *field)
 	return 0;
 }
 
+/** Register a lazy accessor table for one of the request's lists
+ *
+ * Nothing is copied out of the list.  Attributes are looked up, and
+ * converted, only when the script indexes the table.
+ */
+static void _lua_fr_list_register(lua_State *L, char const *name, tmpl_pair_list_t list_name)
+{
+	/* fr = { <name> {} } */
+	lua_newtable(L);
+
+	lua_pushinteger(L, list_name);
+	lua_pushcclosure(L, _lua_list_iterator_init, 1);
+	lua_setfield(L, -2, "pairs");
+
+	lua_newtable(L);		/* Attribute list meta-table */
+	lua_pushinteger(L, list_name);
+	lua_pushcclosure(L, _lua_pair_accessor_init, 1);
+	lua_setfield(L, -2, "__index");
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -2, name);
+}
+
 static void _lua_fr_request_register(lua_State *L, request_t *request)
 {
 	/* fr = {} */
 	lua_getglobal(L, "fr");
 	luaL_checktype(L, -1, LUA_TTABLE);
 
-	/* fr = { request {} } */
-	lua_newtable(L);
-
-	if (request) {
-		fr_cursor_t 	cursor;
-
-		/* Attribute list table */
-		fr_pair_list_sort(&request->request_pairs, fr_pair_cmp_by_da);
-		fr_cursor_init(&cursor, &request->request_pairs);
-
-		/*
-		 *	Setup the environment
-		 */
-		lua_pushlightuserdata(L, &cursor);
-		lua_pushcclosure(L, _lua_list_iterator_init, 1);
-		lua_setfield(L, -2, "pairs");
-
-		lua_newtable(L);		/* Attribute list meta-table */
-		lua_pushinteger(L, PAIR_LIST_REQUEST);
-		lua_pushcclosure(L, _lua_pair_accessor_init, 1);
-		lua_setfield(L, -2, "__index");
-		lua_setmetatable(L, -2);
+	if (!request) {
+		/* fr = { request {} } */
+		lua_newtable(L);
+		lua_setfield(L, -2, "request");
+		return;
 	}
 
-	lua_setfield(L, -2, "request");
+	_lua_fr_list_register(L, "request", PAIR_LIST_REQUEST);
+	_lua_fr_list_register(L, "reply", PAIR_LIST_REPLY);
+	_lua_fr_list_register(L, "control", PAIR_LIST_CONTROL);
+	_lua_fr_list_register(L, "session_state", PAIR_LIST_STATE);
 }
 
 unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, char const *funcname)
@@ -0,0 +1,7 @@
+TARGETNAME	:= rlm_mem_ippool
+
+ifneq "$(TARGETNAME)" ""
+TARGET		:= $(TARGETNAME).a
+endif
+
+SOURCES		:= $(TARGETNAME).c
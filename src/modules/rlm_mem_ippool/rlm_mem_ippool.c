@@ -0,0 +1,705 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_mem_ippool.c
+ * @brief IPv4 allocation module with an in-memory backend.
+ *
+ * Each module instance manages a single contiguous range of IPv4
+ * addresses.  All lease state is held in memory:
+ *
+ * - A bitmap of free addresses, so that an allocation is a scan for
+ *   the first set bit, starting from where the last allocation left off.
+ * - An array of leases, indexed by the offset of the address from the
+ *   start of the range.
+ * - A heap of allocated leases, ordered by expiry time.  Expired leases
+ *   are returned to the free bitmap at the start of every operation.
+ * - A hash table of allocated leases, keyed by owner.
+ *
+ * Lease state is NOT persisted, and is not shared between servers.
+ * After a restart, all addresses are free.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/heap.h>
+
+#include <freeradius-devel/dhcpv4/dhcpv4.h>
+
+#include <pthread.h>
+
+/*
+ *	Bound the size of the range, so that a typo in the
+ *	configuration can't eat all of the memory on the system.
+ */
+#define MEM_IPPOOL_MAX_ADDRESSES	(1 << 24)
+
+typedef enum {
+	MEM_IPPOOL_RCODE_SUCCESS = 0,
+	MEM_IPPOOL_RCODE_NOT_FOUND = -1,
+	MEM_IPPOOL_RCODE_DEVICE_MISMATCH = -2,
+	MEM_IPPOOL_RCODE_POOL_EMPTY = -3
+} mem_ippool_rcode_t;
+
+typedef enum {
+	POOL_ACTION_ALLOCATE = 1,
+	POOL_ACTION_UPDATE = 2,
+	POOL_ACTION_RELEASE = 3,
+	POOL_ACTION_BULK_RELEASE = 4,
+} mem_ippool_action_t;
+
+/** A single lease
+ *
+ */
+typedef struct {
+	fr_time_t		expires;	//!< When the lease expires.  0 if the address is free.
+	int32_t			heap_id;	//!< For the expiry heap.
+	uint32_t		offset;		//!< of the address from the start of the range.
+	uint8_t			*owner;		//!< Lease owner identifier.
+	size_t			owner_len;	//!< Length of the owner identifier.
+} mem_ippool_lease_t;
+
+/** rlm_mem_ippool module instance
+ *
+ */
+typedef struct {
+	char const		*name;		//!< Instance name.
+
+	fr_ipaddr_t		range_start;	//!< First address in the pool.
+	fr_ipaddr_t		range_stop;	//!< Last address in the pool.
+
+	fr_time_delta_t		offer_time;	//!< How long we should reserve a lease for during
+						//!< the pre-allocation stage (typically responding
+						//!< to DHCP discover).
+	fr_time_delta_t		lease_time;	//!< How long an IP address should be allocated for.
+
+	tmpl_t			*owner;		//!< Unique Lease owner identifier.  Could be mac-address
+						//!< or a combination of User-Name and something
+						//!< unique to the device.
+
+	tmpl_t			*requested_address;		//!< Attribute to read the IP for renewal from.
+
+	tmpl_t			*allocated_address_attr;	//!< IP attribute and destination.
+
+	uint32_t		num_addresses;	//!< Number of addresses in the range.
+	uint32_t		num_free;	//!< Number of addresses which are free.
+	uint32_t		next;		//!< Word of the bitmap to start searching from.
+
+	uint64_t		*free;		//!< Bitmap of free addresses.  A set bit is a free address.
+	mem_ippool_lease_t	*leases;	//!< One per address in the range.
+	fr_heap_t		*expiry;	//!< Allocated leases, ordered by expiry time.
+	fr_hash_table_t		*owners;	//!< Allocated leases, keyed by owner.
+
+	pthread_mutex_t		mutex;		//!< Protects the lease state.
+} rlm_mem_ippool_t;
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("range_start", FR_TYPE_IPV4_ADDR | FR_TYPE_REQUIRED, rlm_mem_ippool_t, range_start) },
+	{ FR_CONF_OFFSET("range_stop", FR_TYPE_IPV4_ADDR | FR_TYPE_REQUIRED, rlm_mem_ippool_t, range_stop) },
+
+	{ FR_CONF_OFFSET("owner", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_mem_ippool_t, owner) },
+
+	{ FR_CONF_OFFSET("offer_time", FR_TYPE_TIME_DELTA, rlm_mem_ippool_t, offer_time) },
+	{ FR_CONF_OFFSET("lease_time", FR_TYPE_TIME_DELTA, rlm_mem_ippool_t, lease_time), .dflt = "3600" },
+
+	{ FR_CONF_OFFSET("requested_address", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_mem_ippool_t, requested_address), .dflt = "%{%{Requested-IP-Address}:-%{Client-IP-Address}}", .quote = T_DOUBLE_QUOTED_STRING },
+
+	{ FR_CONF_OFFSET("allocated_address_attr", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE | FR_TYPE_REQUIRED, rlm_mem_ippool_t, allocated_address_attr), .dflt = "&reply.Your-IP-Address", .quote = T_BARE_WORD },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t const *dict_freeradius;
+static fr_dict_t const *dict_radius;
+static fr_dict_t const *dict_dhcpv4;
+
+extern fr_dict_autoload_t rlm_mem_ippool_dict[];
+fr_dict_autoload_t rlm_mem_ippool_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ .out = &dict_dhcpv4, .proto = "dhcpv4" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_pool_action;
+static fr_dict_attr_t const *attr_acct_status_type;
+static fr_dict_attr_t const *attr_message_type;
+
+extern fr_dict_attr_autoload_t rlm_mem_ippool_dict_attr[];
+fr_dict_attr_autoload_t rlm_mem_ippool_dict_attr[] = {
+	{ .out = &attr_pool_action, .name = "IP-Pool.Action", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_message_type, .name = "Message-Type", .type = FR_TYPE_UINT8, .dict = &dict_dhcpv4 },
+	{ NULL }
+};
+
+static fr_value_box_t const	*enum_acct_status_type_start;
+static fr_value_box_t const	*enum_acct_status_type_interim_update;
+static fr_value_box_t const	*enum_acct_status_type_stop;
+static fr_value_box_t const	*enum_acct_status_type_on;
+static fr_value_box_t const	*enum_acct_status_type_off;
+
+extern fr_dict_enum_autoload_t rlm_mem_ippool_dict_enum[];
+fr_dict_enum_autoload_t rlm_mem_ippool_dict_enum[] = {
+	{ .out = &enum_acct_status_type_start, .name = "Start", .attr = &attr_acct_status_type },
+	{ .out = &enum_acct_status_type_interim_update, .name = "Interim-Update", .attr = &attr_acct_status_type },
+	{ .out = &enum_acct_status_type_stop, .name = "Stop", .attr = &attr_acct_status_type},
+	{ .out = &enum_acct_status_type_on, .name = "Accounting-On", .attr = &attr_acct_status_type },
+	{ .out = &enum_acct_status_type_off, .name = "Accounting-Off", .attr = &attr_acct_status_type},
+	{ NULL }
+};
+
+static int8_t lease_expiry_cmp(void const *one, void const *two)
+{
+	mem_ippool_lease_t const *a = one, *b = two;
+
+	return COMPARE_PREFER_SMALLER(a->expires, b->expires);
+}
+
+static uint32_t lease_owner_hash(void const *data)
+{
+	mem_ippool_lease_t const *lease = data;
+
+	return fr_hash(lease->owner, lease->owner_len);
+}
+
+static int lease_owner_cmp(void const *one, void const *two)
+{
+	mem_ippool_lease_t const *a = one, *b = two;
+
+	if (a->owner_len != b->owner_len) return (a->owner_len > b->owner_len) - (a->owner_len < b->owner_len);
+
+	return memcmp(a->owner, b->owner, a->owner_len);
+}
+
+/** Return a lease to the free bitmap
+ *
+ * The lease must already have been removed from the expiry heap.
+ */
+static void lease_free(rlm_mem_ippool_t *inst, mem_ippool_lease_t *lease)
+{
+	fr_hash_table_delete(inst->owners, lease);
+	TALLOC_FREE(lease->owner);
+	lease->owner_len = 0;
+	lease->expires = 0;
+
+	inst->free[lease->offset >> 6] |= ((uint64_t) 1) << (lease->offset & 0x3f);
+	inst->num_free++;
+}
+
+/** Return all expired leases to the free bitmap
+ *
+ * The heap is ordered by expiry time, so this only ever looks at
+ * leases which have expired, plus one which hasn't.
+ */
+static void lease_expire(rlm_mem_ippool_t *inst, fr_time_t now)
+{
+	mem_ippool_lease_t *lease;
+
+	while ((lease = fr_heap_peek(inst->expiry)) && (lease->expires <= now)) {
+		(void) fr_heap_extract(inst->expiry, lease);
+		lease_free(inst, lease);
+	}
+}
+
+/** Set the expiry time of an allocated lease
+ *
+ */
+static void lease_touch(rlm_mem_ippool_t *inst, mem_ippool_lease_t *lease, fr_time_t expires)
+{
+	(void) fr_heap_extract(inst->expiry, lease);
+	lease->expires = expires;
+	(void) fr_heap_insert(inst->expiry, lease);
+}
+
+/** Assign a free lease to an owner
+ *
+ */
+static int lease_claim(rlm_mem_ippool_t *inst, mem_ippool_lease_t *lease,
+		       uint8_t const *owner, size_t owner_len, fr_time_t expires)
+{
+	lease->owner = talloc_memdup(inst->leases, owner, owner_len);
+	if (!lease->owner) return -1;
+	lease->owner_len = owner_len;
+	lease->expires = expires;
+
+	if (!fr_hash_table_insert(inst->owners, lease)) {
+	error:
+		TALLOC_FREE(lease->owner);
+		lease->owner_len = 0;
+		lease->expires = 0;
+		return -1;
+	}
+
+	if (fr_heap_insert(inst->expiry, lease) < 0) {
+		fr_hash_table_delete(inst->owners, lease);
+		goto error;
+	}
+
+	inst->free[lease->offset >> 6] &= ~(((uint64_t) 1) << (lease->offset & 0x3f));
+	inst->num_free--;
+
+	return 0;
+}
+
+/** Find allocated lease for an owner
+ *
+ */
+static mem_ippool_lease_t *lease_find_by_owner(rlm_mem_ippool_t *inst, uint8_t const *owner, size_t owner_len)
+{
+	mem_ippool_lease_t my_lease;
+
+	memcpy(&my_lease.owner, &owner, sizeof(my_lease.owner));
+	my_lease.owner_len = owner_len;
+
+	return fr_hash_table_find_by_data(inst->owners, &my_lease);
+}
+
+/** Find the lease for an address
+ *
+ * @return
+ *	- NULL if the address isn't in the range.
+ *	- The lease.
+ */
+static mem_ippool_lease_t *lease_find_by_address(rlm_mem_ippool_t *inst, fr_ipaddr_t const *ip)
+{
+	uint32_t addr, start;
+
+	if (ip->af != AF_INET) return NULL;
+
+	addr = ntohl(ip->addr.v4.s_addr);
+	start = ntohl(inst->range_start.addr.v4.s_addr);
+
+	if ((addr < start) || ((addr - start) >= inst->num_addresses)) return NULL;
+
+	return &inst->leases[addr - start];
+}
+
+/** Allocate a lease, or return the existing lease for an owner
+ *
+ */
+static mem_ippool_rcode_t mem_ippool_allocate(mem_ippool_lease_t **out, rlm_mem_ippool_t *inst,
+					      uint8_t const *owner, size_t owner_len, fr_time_delta_t lease_time)
+{
+	mem_ippool_lease_t	*lease;
+	fr_time_t		now = fr_time();
+	uint32_t		words, i;
+
+	lease_expire(inst, now);
+
+	/*
+	 *	Check to see if the client already has a lease,
+	 *	and if it does return that.
+	 */
+	lease = lease_find_by_owner(inst, owner, owner_len);
+	if (lease) {
+		if (lease->expires < (now + lease_time)) lease_touch(inst, lease, now + lease_time);
+		*out = lease;
+		return MEM_IPPOOL_RCODE_SUCCESS;
+	}
+
+	if (!inst->num_free) return MEM_IPPOOL_RCODE_POOL_EMPTY;
+
+	/*
+	 *	Find the first free address, starting from where the
+	 *	last allocation left off.  This spreads allocations
+	 *	across the range, so recently released addresses
+	 *	aren't immediately handed out again.
+	 */
+	words = (inst->num_addresses + 63) >> 6;
+	for (i = 0; i < words; i++) {
+		uint32_t word = (inst->next + i) % words;
+
+		if (!inst->free[word]) continue;
+
+		lease = &inst->leases[(word << 6) + __builtin_ctzll(inst->free[word])];
+		if (lease_claim(inst, lease, owner, owner_len, now + lease_time) < 0) return MEM_IPPOOL_RCODE_POOL_EMPTY;
+
+		inst->next = word;
+		*out = lease;
+		return MEM_IPPOOL_RCODE_SUCCESS;
+	}
+
+	return MEM_IPPOOL_RCODE_POOL_EMPTY;
+}
+
+/** Extend the lease for an address
+ *
+ * If the address is free, it's allocated to the owner.  This allows
+ * clients to keep their addresses across a server restart.
+ */
+static mem_ippool_rcode_t mem_ippool_update(rlm_mem_ippool_t *inst, fr_ipaddr_t const *ip,
+					    uint8_t const *owner, size_t owner_len, fr_time_delta_t lease_time)
+{
+	mem_ippool_lease_t	*lease, *old;
+	fr_time_t		now = fr_time();
+
+	lease_expire(inst, now);
+
+	lease = lease_find_by_address(inst, ip);
+	if (!lease) return MEM_IPPOOL_RCODE_NOT_FOUND;
+
+	if (lease->expires) {
+		if ((lease->owner_len != owner_len) || (memcmp(lease->owner, owner, owner_len) != 0)) {
+			return MEM_IPPOOL_RCODE_DEVICE_MISMATCH;
+		}
+
+		lease_touch(inst, lease, now + lease_time);
+		return MEM_IPPOOL_RCODE_SUCCESS;
+	}
+
+	/*
+	 *	An owner can only have one lease.
+	 */
+	old = lease_find_by_owner(inst, owner, owner_len);
+	if (old) {
+		(void) fr_heap_extract(inst->expiry, old);
+		lease_free(inst, old);
+	}
+
+	if (lease_claim(inst, lease, owner, owner_len, now + lease_time) < 0) return MEM_IPPOOL_RCODE_NOT_FOUND;
+
+	return MEM_IPPOOL_RCODE_SUCCESS;
+}
+
+/** Release the lease for an address
+ *
+ */
+static mem_ippool_rcode_t mem_ippool_release(rlm_mem_ippool_t *inst, fr_ipaddr_t const *ip,
+					     uint8_t const *owner, size_t owner_len)
+{
+	mem_ippool_lease_t	*lease;
+
+	lease_expire(inst, fr_time());
+
+	lease = lease_find_by_address(inst, ip);
+	if (!lease || !lease->expires) return MEM_IPPOOL_RCODE_NOT_FOUND;
+
+	if ((lease->owner_len != owner_len) || (memcmp(lease->owner, owner, owner_len) != 0)) {
+		return MEM_IPPOOL_RCODE_DEVICE_MISMATCH;
+	}
+
+	(void) fr_heap_extract(inst->expiry, lease);
+	lease_free(inst, lease);
+
+	return MEM_IPPOOL_RCODE_SUCCESS;
+}
+
+/** Release all leases
+ *
+ */
+static void mem_ippool_bulk_release(rlm_mem_ippool_t *inst)
+{
+	mem_ippool_lease_t *lease;
+
+	while ((lease = fr_heap_pop(inst->expiry))) lease_free(inst, lease);
+}
+
+/** Write the address of a lease to the allocated_address_attr
+ *
+ */
+static int mem_ippool_reply(request_t *request, rlm_mem_ippool_t const *inst, fr_ipaddr_t const *ip)
+{
+	fr_pair_t	*vp;
+	fr_value_box_t	box;
+
+	if (tmpl_find_or_add_vp(&vp, request, inst->allocated_address_attr) < 0) {
+		REDEBUG("Error allocating attribute %s", inst->allocated_address_attr->name);
+		return -1;
+	}
+
+	fr_value_box_ipaddr(&box, NULL, ip, false);
+
+	fr_value_box_clear(&vp->data);
+	if (fr_value_box_cast(vp, &vp->data, vp->da->type, vp->da, &box) < 0) {
+		RPEDEBUG("Failed converting allocated address to %s", vp->da->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static unlang_action_t mod_action(rlm_rcode_t *p_result, rlm_mem_ippool_t const *const_inst,
+				  request_t *request, mem_ippool_action_t action)
+{
+	rlm_mem_ippool_t	*inst;
+	uint8_t			owner_buff[256];
+	uint8_t const		*owner;
+	size_t			owner_len;
+	ssize_t			slen;
+	fr_ipaddr_t		ip;
+	char			ip_buff[INET6_ADDRSTRLEN + 4];
+	char const		*ip_str;
+	mem_ippool_lease_t	*lease;
+	mem_ippool_rcode_t	ret;
+
+	memcpy(&inst, &const_inst, sizeof(inst));
+
+	slen = tmpl_expand((char const **)&owner,
+			   (char *)&owner_buff, sizeof(owner_buff),
+			   request, inst->owner, NULL, NULL);
+	if (slen < 0) {
+		REDEBUG("Failed expanding device (%s)", inst->owner->name);
+		RETURN_MODULE_FAIL;
+	}
+	owner_len = (size_t)slen;
+
+	switch (action) {
+	case POOL_ACTION_ALLOCATE:
+		pthread_mutex_lock(&inst->mutex);
+		ret = mem_ippool_allocate(&lease, inst, owner, owner_len, inst->offer_time);
+		if (ret == MEM_IPPOOL_RCODE_SUCCESS) {
+			ip = inst->range_start;
+			ip.addr.v4.s_addr = htonl(ntohl(ip.addr.v4.s_addr) + lease->offset);
+		}
+		pthread_mutex_unlock(&inst->mutex);
+
+		switch (ret) {
+		case MEM_IPPOOL_RCODE_SUCCESS:
+			if (mem_ippool_reply(request, inst, &ip) < 0) RETURN_MODULE_FAIL;
+
+			RDEBUG2("IP address lease allocated");
+			RETURN_MODULE_UPDATED;
+
+		case MEM_IPPOOL_RCODE_POOL_EMPTY:
+			RWDEBUG("Pool contains no free addresses");
+			RETURN_MODULE_NOTFOUND;
+
+		default:
+			RETURN_MODULE_FAIL;
+		}
+
+	case POOL_ACTION_UPDATE:
+	case POOL_ACTION_RELEASE:
+		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
+			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
+			RETURN_MODULE_FAIL;
+		}
+
+		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
+			RPEDEBUG("Failed parsing address");
+			RETURN_MODULE_FAIL;
+		}
+
+		pthread_mutex_lock(&inst->mutex);
+		if (action == POOL_ACTION_UPDATE) {
+			ret = mem_ippool_update(inst, &ip, owner, owner_len, inst->lease_time);
+		} else {
+			ret = mem_ippool_release(inst, &ip, owner, owner_len);
+		}
+		pthread_mutex_unlock(&inst->mutex);
+
+		switch (ret) {
+		case MEM_IPPOOL_RCODE_SUCCESS:
+			if (action == POOL_ACTION_RELEASE) {
+				RDEBUG2("IP address \"%s\" released", ip_str);
+				RETURN_MODULE_UPDATED;
+			}
+
+			RDEBUG2("Requested IP address' \"%s\" lease updated", ip_str);
+			if (mem_ippool_reply(request, inst, &ip) < 0) RETURN_MODULE_FAIL;
+			RETURN_MODULE_UPDATED;
+
+		case MEM_IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
+			RETURN_MODULE_NOTFOUND;
+
+		case MEM_IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
+			RETURN_MODULE_INVALID;
+
+		default:
+			RETURN_MODULE_FAIL;
+		}
+
+	case POOL_ACTION_BULK_RELEASE:
+		pthread_mutex_lock(&inst->mutex);
+		mem_ippool_bulk_release(inst);
+		pthread_mutex_unlock(&inst->mutex);
+
+		RDEBUG2("All leases released");
+		RETURN_MODULE_UPDATED;
+
+	default:
+		RWDEBUG("Ignoring invalid action %d", action);
+		RETURN_MODULE_NOOP;
+	}
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_mem_ippool_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_mem_ippool_t);
+	fr_pair_t		*vp;
+
+	/*
+	 *	IP-Pool.Action override
+	 */
+	vp = fr_pair_find_by_da(&request->control_pairs, attr_pool_action);
+	if (vp) return mod_action(p_result, inst, request, vp->vp_uint32);
+
+	/*
+	 *	Otherwise, guess the action by Acct-Status-Type
+	 */
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_acct_status_type);
+	if (!vp) {
+		RDEBUG2("Couldn't find &request.Acct-Status-Type or &control.IP-Pool.Action, doing nothing...");
+		RETURN_MODULE_NOOP;
+	}
+
+	if ((vp->vp_uint32 == enum_acct_status_type_start->vb_uint32) ||
+	    (vp->vp_uint32 == enum_acct_status_type_interim_update->vb_uint32)) {
+		return mod_action(p_result, inst, request, POOL_ACTION_UPDATE);
+
+	} else if (vp->vp_uint32 == enum_acct_status_type_stop->vb_uint32) {
+		return mod_action(p_result, inst, request, POOL_ACTION_RELEASE);
+
+	} else if ((vp->vp_uint32 == enum_acct_status_type_on->vb_uint32) ||
+		   (vp->vp_uint32 == enum_acct_status_type_off->vb_uint32)) {
+		return mod_action(p_result, inst, request, POOL_ACTION_BULK_RELEASE);
+
+	}
+
+	RETURN_MODULE_NOOP;
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_mem_ippool_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_mem_ippool_t);
+	fr_pair_t		*vp;
+	mem_ippool_action_t	action = POOL_ACTION_ALLOCATE;
+
+	/*
+	 *	Unless it's overridden the default action is to allocate
+	 *	when called in Post-Auth.
+	 */
+	vp = fr_pair_find_by_da(&request->control_pairs, attr_pool_action);
+	if (vp) {
+		action = vp->vp_uint32;
+
+	} else if (request->dict == dict_dhcpv4) {
+		vp = fr_pair_find_by_da(&request->control_pairs, attr_message_type);
+		if (vp && (vp->vp_uint8 == FR_DHCP_REQUEST)) action = POOL_ACTION_UPDATE;
+	}
+
+	return mod_action(p_result, inst, request, action);
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_request(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_mem_ippool_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_mem_ippool_t);
+	fr_pair_t		*vp;
+
+	/*
+	 *	Unless it's overridden the default action is to update
+	 *	when called by DHCP request
+	 */
+	vp = fr_pair_find_by_da(&request->control_pairs, attr_pool_action);
+	return mod_action(p_result, inst, request, vp ? vp->vp_uint32 : POOL_ACTION_UPDATE);
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_mem_ippool_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_mem_ippool_t);
+	fr_pair_t		*vp;
+
+	/*
+	 *	Unless it's overridden the default action is to release
+	 *	when called by DHCP release
+	 */
+	vp = fr_pair_find_by_da(&request->control_pairs, attr_pool_action);
+	return mod_action(p_result, inst, request, vp ? vp->vp_uint32 : POOL_ACTION_RELEASE);
+}
+
+static int _mem_ippool_free(rlm_mem_ippool_t *inst)
+{
+	pthread_mutex_destroy(&inst->mutex);
+
+	return 0;
+}
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_mem_ippool_t	*inst = instance;
+	uint32_t		start, stop, i;
+
+	fr_assert(tmpl_is_attr(inst->allocated_address_attr));
+
+	start = ntohl(inst->range_start.addr.v4.s_addr);
+	stop = ntohl(inst->range_stop.addr.v4.s_addr);
+
+	if (stop < start) {
+		cf_log_err(conf, "'range_stop' must be greater than or equal to 'range_start'");
+		return -1;
+	}
+
+	if ((stop - start) >= MEM_IPPOOL_MAX_ADDRESSES) {
+		cf_log_err(conf, "Range contains too many addresses.  It must contain at most %u addresses",
+			   MEM_IPPOOL_MAX_ADDRESSES);
+		return -1;
+	}
+
+	inst->num_addresses = (stop - start) + 1;
+	inst->num_free = inst->num_addresses;
+
+	/*
+	 *	If we don't have a separate time specifically for offers
+	 *	just use the lease time.
+	 */
+	if (!inst->offer_time) inst->offer_time = inst->lease_time;
+
+	MEM(inst->free = talloc_zero_array(inst, uint64_t, (inst->num_addresses + 63) >> 6));
+	for (i = 0; i < (inst->num_addresses >> 6); i++) inst->free[i] = UINT64_MAX;
+	if (inst->num_addresses & 0x3f) inst->free[i] = (((uint64_t) 1) << (inst->num_addresses & 0x3f)) - 1;
+
+	MEM(inst->leases = talloc_zero_array(inst, mem_ippool_lease_t, inst->num_addresses));
+	for (i = 0; i < inst->num_addresses; i++) inst->leases[i].offset = i;
+
+	MEM(inst->expiry = fr_heap_alloc(inst, lease_expiry_cmp, mem_ippool_lease_t, heap_id));
+	MEM(inst->owners = fr_hash_table_create(inst, lease_owner_hash, lease_owner_cmp, NULL));
+
+	pthread_mutex_init(&inst->mutex, NULL);
+	talloc_set_destructor(inst, _mem_ippool_free);
+
+	return 0;
+}
+
+extern module_t rlm_mem_ippool;
+module_t rlm_mem_ippool = {
+	.magic		= RLM_MODULE_INIT,
+	.name		= "mem_ippool",
+	.type		= RLM_TYPE_THREAD_SAFE,
+	.inst_size	= sizeof(rlm_mem_ippool_t),
+	.config		= module_config,
+	.instantiate	= mod_instantiate,
+	.methods = {
+		[MOD_ACCOUNTING]	= mod_accounting,
+		[MOD_AUTHORIZE]		= mod_post_auth,
+		[MOD_POST_AUTH]		= mod_post_auth,
+	},
+	.method_names = (module_method_names_t[]) {
+		{ .name1 = "recv",	.name2 = "Request",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Confirm",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Renew",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Rebind",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Release",	.method = mod_release },
+		MODULE_NAME_TERMINATOR
+	}
+};
@@ -91,6 +91,13 @@ static const CONF_PARSER winbind_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER ntlm_auth_helper_config[] = {
+	{ FR_CONF_OFFSET("program", FR_TYPE_STRING, rlm_mschap_t, helper_program) },
+	{ FR_CONF_OFFSET("username", FR_TYPE_TMPL, rlm_mschap_t, helper_username), .dflt = "%{mschap:User-Name}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("domain", FR_TYPE_TMPL, rlm_mschap_t, helper_domain) },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("normalise", FR_TYPE_BOOL, rlm_mschap_t, normify), .dflt = "yes" },
 
@@ -103,6 +110,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("with_ntdomain_hack", FR_TYPE_BOOL, rlm_mschap_t, with_ntdomain_hack), .dflt = "yes" },
 	{ FR_CONF_OFFSET("ntlm_auth", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_mschap_t, ntlm_auth) },
 	{ FR_CONF_OFFSET("ntlm_auth_timeout", FR_TYPE_TIME_DELTA, rlm_mschap_t, ntlm_auth_timeout) },
+	{ FR_CONF_POINTER("ntlm_auth_helper", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) ntlm_auth_helper_config },
 
 	{ FR_CONF_POINTER("passchange", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) passchange_config },
 	{ FR_CONF_OFFSET("allow_retry", FR_TYPE_BOOL, rlm_mschap_t, allow_retry), .dflt = "yes" },
@@ -673,6 +681,59 @@ static void *mod_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED fr_time_del
 }
 #endif
 
+/** A long running ntlm_auth process, speaking the ntlm-server-1 helper protocol
+ *
+ */
+typedef struct {
+	pid_t		pid;			//!< of the helper.
+	int		to_child;		//!< helper's stdin.
+	int		from_child;		//!< helper's stdout.
+} mschap_helper_t;
+
+/*
+ *	Shut down a pooled ntlm_auth helper
+ */
+static int _mod_helper_conn_free(mschap_helper_t *helper)
+{
+	if (helper->to_child >= 0) close(helper->to_child);
+	if (helper->from_child >= 0) close(helper->from_child);
+
+	/*
+	 *	Closing stdin is enough to make ntlm_auth exit, but
+	 *	it may be stuck talking to winbind.
+	 */
+	kill(helper->pid, SIGTERM);
+	waitpid(helper->pid, NULL, 0);
+
+	return 0;
+}
+
+/*
+ *	Start a new ntlm_auth helper for the connection pool
+ */
+static void *mod_helper_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED fr_time_delta_t timeout)
+{
+	mschap_helper_t		*helper;
+	rlm_mschap_t const	*inst = talloc_get_type_abort_const(instance, rlm_mschap_t);
+
+	MEM(helper = talloc_zero(ctx, mschap_helper_t));
+	helper->to_child = -1;
+	helper->from_child = -1;
+
+	helper->pid = radius_start_program(inst->helper_program, NULL, true,
+					   &helper->to_child, &helper->from_child, NULL, false);
+	if (helper->pid < 0) {
+		PERROR("Failed starting ntlm_auth helper");
+		talloc_free(helper);
+		return NULL;
+	}
+
+	fr_nonblock(helper->from_child);
+	talloc_set_destructor(helper, _mod_helper_conn_free);
+
+	return helper;
+}
+
 /*
  *	Add MPPE attributes to the reply.
  */
@@ -1061,6 +1122,207 @@ ntlm_auth_err:
 	return -1;
 }
 
+/*
+ *	Map ntlm-server-1 "Authentication-Error" values to the
+ *	MS-CHAP error codes used by do_mschap().
+ */
+static fr_table_num_sorted_t const mschap_helper_error_table[] = {
+	{ L("NT_STATUS_ACCOUNT_DISABLED"),	-691 },
+	{ L("NT_STATUS_ACCOUNT_LOCKED_OUT"),	-647 },
+	{ L("NT_STATUS_NO_LOGON_SERVERS"),	-2 },
+	{ L("NT_STATUS_PASSWORD_EXPIRED"),	-648 },
+	{ L("NT_STATUS_PASSWORD_MUST_CHANGE"),	-648 }
+};
+static size_t mschap_helper_error_table_len = NUM_ELEMENTS(mschap_helper_error_table);
+
+/** Read one ntlm-server-1 reply from a helper
+ *
+ * Replies are a series of "Key: value" lines, terminated by
+ * a line containing a single '.'.
+ *
+ * @param[in] helper	to read from.
+ * @param[in] timeout	how long to wait for the complete reply.
+ * @param[out] buf	where to write the reply.
+ * @param[in] buflen	length of buf.
+ * @return
+ *	- -1 on timeout or error.  The helper must not be reused.
+ *	- Length of the reply, excluding the terminator.
+ */
+static ssize_t mschap_helper_read(mschap_helper_t *helper, fr_time_delta_t timeout, char *buf, size_t buflen)
+{
+	size_t		done = 0;
+	fr_time_t	end = fr_time() + timeout;
+
+	while (true) {
+		fd_set		fds;
+		fr_time_delta_t	left;
+		ssize_t		slen;
+		int		ret;
+
+		if ((done >= 2) && (buf[done - 2] == '.') && (buf[done - 1] == '\n') &&
+		    ((done == 2) || (buf[done - 3] == '\n'))) {
+			done -= 2;
+			buf[done] = '\0';
+			return done;
+		}
+
+		if (done >= (buflen - 1)) {
+			fr_strerror_const("Reply from ntlm_auth helper is too long");
+			return -1;
+		}
+
+		left = end - fr_time();
+		if (left <= 0) {
+			fr_strerror_const("Timeout waiting for ntlm_auth helper");
+			return -1;
+		}
+
+		FD_ZERO(&fds);
+		FD_SET(helper->from_child, &fds);
+
+		ret = select(helper->from_child + 1, &fds, NULL, NULL, &fr_time_delta_to_timeval(left));
+		if (ret == 0) continue;
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			fr_strerror_printf("Failed waiting for ntlm_auth helper: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		slen = read(helper->from_child, buf + done, buflen - 1 - done);
+		if (slen == 0) {
+			fr_strerror_const("ntlm_auth helper exited");
+			return -1;
+		}
+		if (slen < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) continue;
+			fr_strerror_printf("Failed reading from ntlm_auth helper: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		done += slen;
+	}
+}
+
+/** Authenticate using a pooled ntlm_auth helper
+ *
+ * This gives the same results as running ntlm_auth with
+ * --request-nt-key, but without a fork and exec for every
+ * authentication.
+ *
+ * @return
+ *	- 0 on success, with nthashhash filled in.
+ *	- -1 or one of the MS-CHAP error codes on failure.
+ */
+static int CC_HINT(nonnull) do_auth_ntlm_helper(rlm_mschap_t const *inst, request_t *request,
+						uint8_t const *challenge, uint8_t const *response,
+						uint8_t nthashhash[static NT_DIGEST_LENGTH])
+{
+	mschap_helper_t	*helper;
+	char		*username = NULL, *domain = NULL;
+	char		buffer[1024];
+	fr_sbuff_t	sbuff = FR_SBUFF_OUT(buffer, sizeof(buffer));
+	char		*p, *q;
+	char const	*key = NULL, *error = NULL;
+	bool		authenticated = false;
+	ssize_t		slen;
+	int		ret = -1;
+
+	if (tmpl_aexpand(request, &username, request, inst->helper_username, NULL, NULL) < 0) {
+		REDEBUG("Unable to expand ntlm_auth_helper.username");
+		return -1;
+	}
+
+	if (inst->helper_domain &&
+	    (tmpl_aexpand(request, &domain, request, inst->helper_domain, NULL, NULL) < 0)) {
+		REDEBUG("Unable to expand ntlm_auth_helper.domain");
+		goto finish;
+	}
+
+	/*
+	 *	The protocol is line based, so anything with an
+	 *	embedded line break could inject extra keys.
+	 */
+	if (strpbrk(username, "\r\n") || (domain && strpbrk(domain, "\r\n"))) {
+		REDEBUG("Username or domain contains line breaks, refusing to send them to ntlm_auth");
+		goto finish;
+	}
+
+	if ((fr_sbuff_in_sprintf(&sbuff, "Username: %s\n", username) < 0) ||
+	    (domain && (fr_sbuff_in_sprintf(&sbuff, "NT-Domain: %s\n", domain) < 0)) ||
+	    (fr_sbuff_in_strcpy_literal(&sbuff, "LANMAN-Challenge: ") < 0) ||
+	    (fr_bin2hex(&sbuff, &FR_DBUFF_TMP(challenge, MSCHAP_CHALLENGE_LENGTH), SIZE_MAX) < 0) ||
+	    (fr_sbuff_in_strcpy_literal(&sbuff, "\nNT-Response: ") < 0) ||
+	    (fr_bin2hex(&sbuff, &FR_DBUFF_TMP(response, 24), SIZE_MAX) < 0) ||
+	    (fr_sbuff_in_strcpy_literal(&sbuff, "\nRequest-User-Session-Key: Yes\n.\n") < 0)) {
+		REDEBUG("Request for ntlm_auth helper is too long");
+		goto finish;
+	}
+
+	helper = fr_pool_connection_get(inst->helper_pool, request);
+	if (!helper) {
+		REDEBUG("Unable to get ntlm_auth helper from pool");
+		goto finish;
+	}
+
+	RDEBUG2("Sending authentication request user \"%s\" domain \"%s\" to ntlm_auth helper",
+		username, domain ? domain : "");
+
+	if (write_all(helper->to_child, buffer, fr_sbuff_used(&sbuff)) != (int) fr_sbuff_used(&sbuff)) {
+		REDEBUG("Failed writing to ntlm_auth helper: %s", fr_syserror(errno));
+		fr_pool_connection_close(inst->helper_pool, request, helper);
+		goto finish;
+	}
+
+	/*
+	 *	If we didn't get a complete reply, the helper is out
+	 *	of step with us, so throw it away.
+	 */
+	slen = mschap_helper_read(helper, inst->ntlm_auth_timeout, buffer, sizeof(buffer));
+	if (slen < 0) {
+		RPERROR("Failed getting reply from ntlm_auth helper");
+		fr_pool_connection_close(inst->helper_pool, request, helper);
+		goto finish;
+	}
+	fr_pool_connection_release(inst->helper_pool, request, helper);
+
+	for (p = buffer; p && *p; p = q) {
+		q = strchr(p, '\n');
+		if (q) *q++ = '\0';
+
+		if (strcmp(p, "Authenticated: Yes") == 0) {
+			authenticated = true;
+
+		} else if (strncmp(p, "User-Session-Key: ", 18) == 0) {
+			key = p + 18;
+
+		} else if (strncmp(p, "Authentication-Error: ", 22) == 0) {
+			error = p + 22;
+		}
+	}
+
+	if (!authenticated) {
+		if (!error) error = "unknown error";
+
+		REDEBUG("ntlm_auth helper says: %s", error);
+		ret = fr_table_value_by_str(mschap_helper_error_table, error, -1);
+		goto finish;
+	}
+
+	if (!key || (fr_hex2bin(NULL, &FR_DBUFF_TMP(nthashhash, NT_DIGEST_LENGTH),
+				&FR_SBUFF_IN(key, strlen(key)), false) != NT_DIGEST_LENGTH)) {
+		REDEBUG("Invalid output from ntlm_auth helper: missing or malformed User-Session-Key");
+		goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	talloc_free(username);
+	talloc_free(domain);
+
+	return ret;
+}
+
 /*
  *	Do the MS-CHAP stuff.
  *
@@ -1240,6 +1502,11 @@ static int CC_HINT(nonnull (1, 2, 4, 5, 6)) do_mschap(rlm_mschap_t const *inst,
 	 */
 		return do_auth_wbclient(inst, request, challenge, response, nthashhash);
 #endif
+	case AUTH_NTLMAUTH_HELPER:
+	/*
+	 *	Process auth via a pooled ntlm_auth helper
+	 */
+		return do_auth_ntlm_helper(inst, request, challenge, response, nthashhash);
 	default:
 		/* We should never reach this line */
 		RERROR("Internal error: Unknown mschap auth method (%d)", method);
@@ -2161,6 +2428,21 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		inst->method = AUTH_NTLMAUTH_EXEC;
 	}
 
+	/*
+	 *	...except for the helper, which does the same job
+	 *	without a fork and exec per authentication.
+	 */
+	if (inst->helper_program) {
+		inst->method = AUTH_NTLMAUTH_HELPER;
+
+		inst->helper_pool = module_connection_pool_init(conf, inst, mod_helper_conn_create,
+								NULL, NULL, NULL, NULL);
+		if (!inst->helper_pool) {
+			cf_log_err(conf, "Unable to initialise ntlm_auth helper pool");
+			return -1;
+		}
+	}
+
 	switch (inst->method) {
 	case AUTH_INTERNAL:
 		DEBUG("Using internal authentication");
@@ -2168,6 +2450,9 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	case AUTH_NTLMAUTH_EXEC:
 		DEBUG("Authenticating by calling 'ntlm_auth'");
 		break;
+	case AUTH_NTLMAUTH_HELPER:
+		DEBUG("Authenticating via pooled 'ntlm_auth' helpers");
+		break;
 #ifdef WITH_AUTH_WINBIND
 	case AUTH_WBCLIENT:
 		DEBUG("Authenticating directly to winbind");
@@ -2215,17 +2500,14 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 /*
  *	Tidy up instance
  */
-static int mod_detach(
-#ifndef WITH_AUTH_WINBIND
-		      UNUSED
-#endif
-		      void *instance)
+static int mod_detach(void *instance)
 {
-#ifdef WITH_AUTH_WINBIND
 	rlm_mschap_t *inst = instance;
 
+#ifdef WITH_AUTH_WINBIND
 	fr_pool_free(inst->wb_pool);
 #endif
+	fr_pool_free(inst->helper_pool);
 
 	return 0;
 }
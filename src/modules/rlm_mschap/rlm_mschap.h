@@ -4,16 +4,17 @@ RCSIDH(rlm_mschap_h, "$Id$")
 
 #include "config.h"
 
+#include <freeradius-devel/server/pool.h>
+
 #ifdef WITH_AUTH_WINBIND
 #  include <wbclient.h>
-
-#include <freeradius-devel/server/pool.h>
 #endif
 
 /* Method of authentication we are going to use */
 typedef enum {
 	AUTH_INTERNAL		= 0,
-	AUTH_NTLMAUTH_EXEC	= 1
+	AUTH_NTLMAUTH_EXEC	= 1,
+	AUTH_NTLMAUTH_HELPER	= 3
 #ifdef WITH_AUTH_WINBIND
 	,AUTH_WBCLIENT       	= 2
 #endif
@@ -72,6 +73,10 @@ typedef struct {
 	MSCHAP_AUTH_METHOD	method;
 	tmpl_t		*wb_username;
 	tmpl_t		*wb_domain;
+	char const		*helper_program;
+	tmpl_t			*helper_username;
+	tmpl_t			*helper_domain;
+	fr_pool_t		*helper_pool;
 #ifdef WITH_AUTH_WINBIND
 	fr_pool_t		*wb_pool;
 	bool			wb_retry_with_normalised_username;
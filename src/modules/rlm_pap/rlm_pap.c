@@ -31,6 +31,7 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/password.h>
 #include <freeradius-devel/tls/base.h>
+#include <freeradius-devel/unlang/base.h>
 
 #include <freeradius-devel/util/base64.h>
 #include <freeradius-devel/util/debug.h>
@@ -41,11 +42,16 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.password.h>
 
 #include <ctype.h>
+#include <pthread.h>
 
 #ifdef HAVE_OPENSSL_EVP_H
 #  include <openssl/evp.h>
 #endif
 
+typedef struct pap_offload_s pap_offload_t;
+typedef struct pap_offload_job_s pap_offload_job_t;
+typedef struct pap_cache_s pap_cache_t;
+
 /*
  *      Define a structure for our module configuration.
  *
@@ -57,12 +63,142 @@ typedef struct {
 	char const		*name;
 	fr_dict_enum_t		*auth_type;
 	bool			normify;
+
+	struct {
+		uint32_t		threads;	//!< Number of threads to run slow password checks in.
+		uint32_t		max_queued;	//!< Checks queued before we run them inline instead.
+	} offload;
+
+	pap_offload_t		*pool;		//!< Offload threads, NULL if offload is disabled.
+
+	struct {
+		bool			enable;		//!< Remember passwords which were verified.
+		fr_time_delta_t		lifetime;	//!< How long to remember them for.
+		uint32_t		max_entries;	//!< How many to remember.
+	} cache_config;
+
+	pap_cache_t		*cache;		//!< Verified credentials, NULL if the cache is disabled.
 } rlm_pap_t;
 
-typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, rlm_pap_t const *inst, request_t *request, fr_pair_t const *, fr_pair_t const *);
+typedef struct {
+	rlm_pap_t const		*inst;		//!< Instance data.
+	fr_event_list_t		*el;		//!< This thread's event list.
+
+	int			fd[2];		//!< Offload threads write to fd[1] when a check is done.
+	pap_offload_job_t	*done;		//!< Finished checks.  Protected by the pool mutex.
+	uint32_t		outstanding;	//!< Checks queued or running for this thread.
+} rlm_pap_thread_t;
+
+typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, rlm_pap_thread_t *t, request_t *request, fr_pair_t const *, fr_pair_t const *);
+
+/** Which slow check an offload job runs
+ *
+ */
+typedef enum {
+	PAP_OFFLOAD_CRYPT = 0,
+	PAP_OFFLOAD_PBKDF2
+} pap_offload_type_t;
+
+/** A slow password check
+ *
+ * These are run in the worker when offload is disabled, or in an offload
+ * thread.  Offload threads don't touch the request, so everything they
+ * need is copied into the job.
+ */
+struct pap_offload_job_s {
+	pap_offload_job_t	*next;		//!< In the pool queue, or the thread's done list.
+	rlm_pap_thread_t	*t;		//!< Thread which queued the job.
+	request_t		*request;	//!< NULL if the request was cancelled.
+	bool			finished;	//!< The request has been marked as resumable.
+
+	pap_offload_type_t	type;
+
+	uint8_t const		*password;	//!< Cleartext password, \0 terminated.
+	size_t			password_len;
+
+	char const		*crypt;		//!< "known good" crypt string.
+
+#ifdef HAVE_OPENSSL_EVP_H
+	EVP_MD const		*evp_md;	//!< PBKDF2 digest.
+	size_t			digest_len;
+	uint32_t		iterations;
+	uint8_t const		*salt;
+	size_t			salt_len;
+	uint8_t			hash[EVP_MAX_MD_SIZE];	//!< "known good" PBKDF2 hash.
+	uint8_t			digest[EVP_MAX_MD_SIZE];	//!< We calculated.
+#endif
+
+	bool			cacheable;	//!< cache_key and cache_password are set.
+	uint8_t			cache_key[SHA1_DIGEST_LENGTH];		//!< See #pap_cache_entry_t.
+	uint8_t			cache_password[SHA1_DIGEST_LENGTH];	//!< See #pap_cache_entry_t.
+
+	rlm_rcode_t		rcode;		//!< Result of the check.
+};
+
+/** A password which was verified by a slow check
+ *
+ * We don't store the password, or anything which would let the
+ * password be recovered from a memory dump.  Only keyed hashes.
+ */
+typedef struct {
+	uint8_t			key[SHA1_DIGEST_LENGTH];	//!< HMAC of the User-Name and "known good" password.
+	uint8_t			password[SHA1_DIGEST_LENGTH];	//!< HMAC of the cleartext password.
+	fr_time_t		expires;	//!< When we stop trusting the entry.
+	fr_dlist_t		entry;		//!< In the expiry list.
+} pap_cache_entry_t;
+
+/** Cache of verified credentials
+ *
+ * Shared by all workers, as devices usually end up on a different
+ * worker each time they authenticate.  Every entry has the same
+ * lifetime, so the oldest entry is always at the head of the list.
+ */
+struct pap_cache_s {
+	pthread_mutex_t		mutex;		//!< Protects the table and list.
+	fr_hash_table_t		*ht;		//!< Entries, by key.
+	fr_dlist_head_t		expiry;		//!< Entries, oldest first.
+
+	uint8_t			secret[32];	//!< Random key for the HMACs.
+	fr_time_delta_t		lifetime;
+	uint32_t		max_entries;
+};
+
+/** Threads for running slow password checks
+ *
+ * A single queue shared by every worker.  Workers yield the request
+ * whilst the check runs, and are woken up through the thread's pipe.
+ */
+struct pap_offload_s {
+	pthread_mutex_t		mutex;		//!< Protects the queue, and done lists.
+	pthread_cond_t		cond;		//!< Signalled when a job is queued.
+
+	pap_offload_job_t	*head;		//!< Next job to run.
+	pap_offload_job_t	**tail;		//!< Where to queue the next job.
+	uint32_t		queued;		//!< How many jobs are waiting.
+	uint32_t		max_queued;	//!< Maximum which can be waiting.
+	bool			stop;		//!< Tell the threads to exit.
+
+	pthread_t		*threads;	//!< Running jobs.
+	uint32_t		num_threads;	//!< Number of threads started.
+};
+
+static const CONF_PARSER offload_config[] = {
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, rlm_pap_t, offload.threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", FR_TYPE_UINT32, rlm_pap_t, offload.max_queued), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
+static const CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, rlm_pap_t, cache_config.enable), .dflt = "no" },
+	{ FR_CONF_OFFSET("lifetime", FR_TYPE_TIME_DELTA, rlm_pap_t, cache_config.lifetime), .dflt = "300" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_pap_t, cache_config.max_entries), .dflt = "16384" },
+	CONF_PARSER_TERMINATOR
+};
 
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("normalise", FR_TYPE_BOOL, rlm_pap_t, normify), .dflt = "yes" },
+	{ FR_CONF_POINTER("offload", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) offload_config },
+	{ FR_CONF_POINTER("cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -79,12 +215,14 @@ static fr_dict_attr_t const *attr_auth_type;
 static fr_dict_attr_t const *attr_root;
 
 static fr_dict_attr_t const *attr_user;
+static fr_dict_attr_t const *attr_user_name;
 
 static fr_dict_attr_autoload_t rlm_pap_dict_attr[] = {
 	{ .out = &attr_auth_type, .name = "Auth-Type", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
 	{ .out = &attr_root, .name = "Password", .type = FR_TYPE_TLV, .dict = &dict_freeradius },
 
 	{ .out = &attr_user, .name = "User-Password", .type = FR_TYPE_STRING, .dict = &dict_radius },
+	{ .out = &attr_user_name, .name = "User-Name", .type = FR_TYPE_STRING, .dict = &dict_radius },
 
 	{ NULL }
 };
@@ -148,12 +286,424 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	RETURN_MODULE_UPDATED;
 }
 
+static uint32_t pap_cache_entry_hash(void const *data)
+{
+	pap_cache_entry_t const *entry = data;
+	uint32_t		hash;
+
+	/*
+	 *	The key is already a keyed hash.
+	 */
+	memcpy(&hash, entry->key, sizeof(hash));
+
+	return hash;
+}
+
+static int pap_cache_entry_cmp(void const *one, void const *two)
+{
+	pap_cache_entry_t const *a = one, *b = two;
+
+	return memcmp(a->key, b->key, sizeof(a->key));
+}
+
+/** Calculate the cache key and password for a check
+ *
+ * The key covers the User-Name and everything in the "known good"
+ * password, so the entry is no longer used as soon as the stored
+ * password changes.
+ */
+static void pap_cache_job_init(pap_cache_t const *cache, request_t *request, pap_offload_job_t *job)
+{
+	fr_pair_t	*user_name;
+	fr_sha1_ctx	sha1_ctx;
+	uint8_t		digest[SHA1_DIGEST_LENGTH];
+	uint8_t		type = job->type;
+
+	user_name = fr_pair_find_by_da(&request->request_pairs, attr_user_name);
+	if (!user_name) return;
+
+	fr_sha1_init(&sha1_ctx);
+	fr_sha1_update(&sha1_ctx, (uint8_t const *)user_name->vp_strvalue, user_name->vp_length + 1);
+	fr_sha1_update(&sha1_ctx, &type, sizeof(type));
+
+	switch (job->type) {
+	case PAP_OFFLOAD_CRYPT:
+		fr_sha1_update(&sha1_ctx, (uint8_t const *)job->crypt, strlen(job->crypt));
+		break;
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case PAP_OFFLOAD_PBKDF2:
+	{
+		int nid = EVP_MD_type(job->evp_md);
+
+		fr_sha1_update(&sha1_ctx, (uint8_t const *)&nid, sizeof(nid));
+		fr_sha1_update(&sha1_ctx, (uint8_t const *)&job->iterations, sizeof(job->iterations));
+		fr_sha1_update(&sha1_ctx, job->salt, job->salt_len);
+		fr_sha1_update(&sha1_ctx, job->hash, job->digest_len);
+	}
+		break;
+#endif
+
+	default:
+		return;
+	}
+	fr_sha1_final(digest, &sha1_ctx);
+
+	fr_hmac_sha1(job->cache_key, digest, sizeof(digest), cache->secret, sizeof(cache->secret));
+	fr_hmac_sha1(job->cache_password, job->password, job->password_len, cache->secret, sizeof(cache->secret));
+	job->cacheable = true;
+}
+
+/** See if the password in a job was verified recently
+ *
+ * @return
+ *	- true if it was.
+ *	- false if the check needs to be run.
+ */
+static bool pap_cache_find(pap_cache_t *cache, pap_offload_job_t const *job)
+{
+	pap_cache_entry_t	find, *entry;
+	bool			found = false;
+	fr_time_t		now = fr_time();
+
+	memcpy(find.key, job->cache_key, sizeof(find.key));
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (entry && (entry->expires > now)) {
+		found = (fr_digest_cmp(entry->password, job->cache_password, sizeof(entry->password)) == 0);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return found;
+}
+
+/** Remember a password which was verified
+ *
+ */
+static void pap_cache_insert(pap_cache_t *cache, pap_offload_job_t const *job)
+{
+	pap_cache_entry_t	find, *entry;
+	fr_time_t		now = fr_time();
+
+	memcpy(find.key, job->cache_key, sizeof(find.key));
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/*
+	 *	Expire old entries, or make room for the new one.
+	 */
+	while ((entry = fr_dlist_head(&cache->expiry)) &&
+	       ((entry->expires <= now) || (fr_dlist_num_elements(&cache->expiry) >= cache->max_entries))) {
+		fr_dlist_remove(&cache->expiry, entry);
+		fr_hash_table_delete(cache->ht, entry);
+		talloc_free(entry);
+	}
+
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (entry) {
+		fr_dlist_remove(&cache->expiry, entry);
+	} else {
+		entry = talloc_zero(cache, pap_cache_entry_t);
+		if (!entry) goto done;
+
+		memcpy(entry->key, job->cache_key, sizeof(entry->key));
+		if (fr_hash_table_insert(cache->ht, entry) < 0) {
+			talloc_free(entry);
+			goto done;
+		}
+	}
+
+	memcpy(entry->password, job->cache_password, sizeof(entry->password));
+	entry->expires = now + cache->lifetime;
+	fr_dlist_insert_tail(&cache->expiry, entry);
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Run a slow password check
+ *
+ * Called from an offload thread, or from the worker if the check
+ * isn't being offloaded.  Must not touch the request.
+ */
+static void pap_offload_job_run(pap_offload_job_t *job)
+{
+	switch (job->type) {
+#ifdef HAVE_CRYPT
+	case PAP_OFFLOAD_CRYPT:
+		job->rcode = (fr_crypt_check((char const *)job->password, job->crypt) != 0) ?
+			     RLM_MODULE_REJECT : RLM_MODULE_OK;
+		return;
+#endif
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case PAP_OFFLOAD_PBKDF2:
+		if (PKCS5_PBKDF2_HMAC((char const *)job->password, (int)job->password_len,
+				      (unsigned char const *)job->salt, (int)job->salt_len,
+				      (int)job->iterations,
+				      job->evp_md,
+				      (int)job->digest_len, (unsigned char *)job->digest) == 0) {
+			job->rcode = RLM_MODULE_INVALID;
+			return;
+		}
+
+		job->rcode = (fr_digest_cmp(job->digest, job->hash, job->digest_len) != 0) ?
+			     RLM_MODULE_REJECT : RLM_MODULE_OK;
+		return;
+#endif
+
+	default:
+		job->rcode = RLM_MODULE_FAIL;
+		return;
+	}
+}
+
+/** Log the result of a slow password check
+ *
+ */
+static unlang_action_t pap_offload_job_result(rlm_rcode_t *p_result, request_t *request, pap_offload_job_t const *job)
+{
+	switch (job->type) {
+	case PAP_OFFLOAD_CRYPT:
+		if (job->rcode == RLM_MODULE_REJECT) REDEBUG("Crypt digest does not match \"known good\" digest");
+		break;
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case PAP_OFFLOAD_PBKDF2:
+		switch (job->rcode) {
+		case RLM_MODULE_INVALID:
+			REDEBUG("PBKDF2 digest failure");
+			break;
+
+		case RLM_MODULE_REJECT:
+			REDEBUG("PBKDF2 digest does not match \"known good\" digest");
+			REDEBUG3("Salt       : %pH", fr_box_octets(job->salt, job->salt_len));
+			REDEBUG3("Calculated : %pH", fr_box_octets(job->digest, job->digest_len));
+			REDEBUG3("Expected   : %pH", fr_box_octets(job->hash, job->digest_len));
+			break;
+
+		default:
+			break;
+		}
+		break;
+#endif
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(job->rcode);
+}
+
+/** Run slow password checks until we're told to stop
+ *
+ */
+static void *pap_offload_thread(void *arg)
+{
+	pap_offload_t		*pool = arg;
+	pap_offload_job_t	*job;
+	rlm_pap_thread_t	*t;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->head && !pool->stop) pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->stop) break;
+
+		job = pool->head;
+		pool->head = job->next;
+		if (!pool->head) pool->tail = &pool->head;
+		pool->queued--;
+		pthread_mutex_unlock(&pool->mutex);
+
+		pap_offload_job_run(job);
+
+		pthread_mutex_lock(&pool->mutex);
+		t = job->t;
+		job->next = t->done;
+		t->done = job;
+
+		/*
+		 *	If the pipe is full the worker
+		 *	already has a wakeup pending.
+		 */
+		if (write(t->fd[1], "", 1) < 0) { /* nothing */ }
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Resume requests whose checks have finished
+ *
+ */
+static void pap_offload_done(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(uctx, rlm_pap_thread_t);
+	pap_offload_t		*pool = t->inst->pool;
+	pap_offload_job_t	*job, *next;
+	char			buffer[64];
+
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	pthread_mutex_lock(&pool->mutex);
+	job = t->done;
+	t->done = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (; job; job = next) {
+		next = job->next;
+		t->outstanding--;
+
+		if (!job->request) {
+			talloc_free(job);
+			continue;
+		}
+
+		job->finished = true;
+		unlang_interpret_mark_resumable(job->request);
+	}
+}
+
+static unlang_action_t pap_auth_rcode(rlm_rcode_t *p_result, request_t *request, rlm_rcode_t rcode);
+
+/** Continue after a check has been run by an offload thread
+ *
+ */
+static unlang_action_t pap_offload_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					  request_t *request, void *rctx)
+{
+	pap_offload_job_t	*job = talloc_get_type_abort(rctx, pap_offload_job_t);
+	rlm_pap_thread_t	*t = job->t;
+	rlm_rcode_t		rcode;
+
+	RDEBUG3("Password check was offloaded");
+
+	pap_offload_job_result(&rcode, request, job);
+	if ((rcode == RLM_MODULE_OK) && job->cacheable) pap_cache_insert(t->inst->cache, job);
+	talloc_free(job);
+
+	return pap_auth_rcode(p_result, request, rcode);
+}
+
+/** Stop waiting for a check if the request is cancelled
+ *
+ * If the job is queued, or has finished, we free it.  Otherwise an
+ * offload thread is running it, and it's freed when it's done.
+ */
+static void pap_offload_signal(UNUSED module_ctx_t const *mctx, request_t *request, void *rctx,
+			       fr_state_signal_t action)
+{
+	pap_offload_job_t	*job = talloc_get_type_abort(rctx, pap_offload_job_t);
+	rlm_pap_thread_t	*t = job->t;
+	pap_offload_t		*pool = t->inst->pool;
+	pap_offload_job_t	**job_p;
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Cancelling password check");
+
+	pthread_mutex_lock(&pool->mutex);
+	for (job_p = &pool->head; *job_p; job_p = &(*job_p)->next) {
+		if (*job_p != job) continue;
+
+		*job_p = job->next;
+		if (!*job_p) pool->tail = job_p;
+		pool->queued--;
+		pthread_mutex_unlock(&pool->mutex);
+
+		t->outstanding--;
+		talloc_free(job);
+		return;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	/*
+	 *	Finished, and the resume function
+	 *	is never going to be called.
+	 */
+	if (job->finished) {
+		talloc_free(job);
+		return;
+	}
+
+	job->request = NULL;
+}
+
+/** Run a slow password check, in an offload thread if we can
+ *
+ * If the password was verified recently, and the cache is enabled, the
+ * check isn't run at all.  If offload is disabled, or too many checks are
+ * queued, the check is run inline.
+ *
+ * @param[out] p_result	Result of the check, if it was run inline.
+ * @param[in] t		Thread instance.
+ * @param[in] request	The current request.
+ * @param[in] job	to run.  Only valid until we return.
+ * @return
+ *	- UNLANG_ACTION_YIELD if the check was offloaded.
+ *	- UNLANG_ACTION_CALCULATE_RESULT if it was run inline.
+ */
+static unlang_action_t pap_offload_check(rlm_rcode_t *p_result, rlm_pap_thread_t *t, request_t *request,
+					 pap_offload_job_t *job)
+{
+	pap_offload_t		*pool = t->inst->pool;
+	pap_cache_t		*cache = t->inst->cache;
+	pap_offload_job_t	*copy;
+
+	if (cache) {
+		pap_cache_job_init(cache, request, job);
+		if (job->cacheable && pap_cache_find(cache, job)) {
+			RDEBUG2("Password matches recently verified credentials");
+			RETURN_MODULE_OK;
+		}
+	}
+
+	if (!pool || (pool->queued >= pool->max_queued)) {
+	run:
+		pap_offload_job_run(job);
+		if ((job->rcode == RLM_MODULE_OK) && job->cacheable) pap_cache_insert(cache, job);
+		return pap_offload_job_result(p_result, request, job);
+	}
+
+	/*
+	 *	The request's copies of the passwords may
+	 *	be freed before the check runs.
+	 */
+	MEM(copy = talloc(NULL, pap_offload_job_t));
+	*copy = *job;
+	copy->t = t;
+	copy->request = request;
+	MEM(copy->password = talloc_memdup(copy, job->password, job->password_len + 1));
+	if (job->crypt) MEM(copy->crypt = talloc_strdup(copy, job->crypt));
+#ifdef HAVE_OPENSSL_EVP_H
+	if (job->salt) MEM(copy->salt = talloc_memdup(copy, job->salt, job->salt_len));
+#endif
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->queued >= pool->max_queued) {
+		pthread_mutex_unlock(&pool->mutex);
+		talloc_free(copy);
+		goto run;
+	}
+	copy->next = NULL;
+	*pool->tail = copy;
+	pool->tail = &copy->next;
+	pool->queued++;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	t->outstanding++;
+
+	return unlang_module_yield(request, pap_offload_resume, pap_offload_signal, copy);
+}
+
 /*
  *	PAP authentication functions
  */
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED rlm_pap_thread_t *t, request_t *request,
 						       fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	if ((known_good->vp_length != password->vp_length) ||
@@ -168,19 +718,22 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
 
 #ifdef HAVE_CRYPT
 static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       rlm_pap_thread_t *t, request_t *request,
 						       fr_pair_t const *known_good, fr_pair_t const *password)
 {
-	if (fr_crypt_check(password->vp_strvalue, known_good->vp_strvalue) != 0) {
-		REDEBUG("Crypt digest does not match \"known good\" digest");
-		RETURN_MODULE_REJECT;
-	}
-	RETURN_MODULE_OK;
+	pap_offload_job_t	job = {
+					.type = PAP_OFFLOAD_CRYPT,
+					.password = password->vp_octets,
+					.password_len = password->vp_length,
+					.crypt = known_good->vp_strvalue
+				};
+
+	return pap_offload_check(p_result, t, request, &job);
 }
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_md5(rlm_rcode_t *p_result,
-						     UNUSED rlm_pap_t const *inst, request_t *request,
+						     UNUSED rlm_pap_thread_t *t, request_t *request,
 						     fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	uint8_t digest[MD5_DIGEST_LENGTH];
@@ -205,7 +758,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_md5(rlm_rcode_t *p_result,
 
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(rlm_rcode_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED rlm_pap_thread_t *t, request_t *request,
 						      fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	fr_md5_ctx_t	*md5_ctx;
@@ -237,7 +790,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(rlm_rcode_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED rlm_pap_thread_t *t, request_t *request,
 						      fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -264,7 +817,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED rlm_pap_thread_t *t, request_t *request,
 						       fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -296,7 +849,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(rlm_rcode_t *p_result,
 
 #ifdef HAVE_OPENSSL_EVP_H
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(rlm_rcode_t *p_result,
-						    	UNUSED rlm_pap_t const *inst, request_t *request,
+						    	UNUSED rlm_pap_thread_t *t, request_t *request,
 						    	fr_pair_t const *known_good, fr_pair_t const *password,
 						    	char const *name, EVP_MD const *md)
 {
@@ -324,7 +877,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst, request_t *request,
+							       UNUSED rlm_pap_thread_t *t, request_t *request,
 							       fr_pair_t const *known_good, fr_pair_t const *password,
 							       char const *name, EVP_MD const *md)
 {
@@ -363,10 +916,10 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(rlm_rcode_t *p_re
  */
 #define PAP_AUTH_EVP_MD(_func, _new_func, _name, _md) \
 static unlang_action_t CC_HINT(nonnull) _new_func(rlm_rcode_t *p_result, \
-					          rlm_pap_t const *inst, request_t *request, \
+					          rlm_pap_thread_t *t, request_t *request, \
 						  fr_pair_t const *known_good, fr_pair_t const *password) \
 { \
-	return _func(p_result, inst, request, known_good, password, _name, _md); \
+	return _func(p_result, t, request, known_good, password, _name, _md); \
 }
 
 PAP_AUTH_EVP_MD(pap_auth_evp_md, pap_auth_sha2_224, "SHA2-224", EVP_sha224())
@@ -392,6 +945,7 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
 /** Validates Crypt::PBKDF2 LDAP format strings
  *
  * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[in] t			Thread instance.
  * @param[in] request		The current request.
  * @param[in] str		Raw PBKDF2 string.
  * @param[in] len		Length of string.
@@ -406,7 +960,7 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
  *	- RLM_MODULE_REJECT
  *	- RLM_MODULE_OK
  */
-static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t *p_result,
+static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t *p_result, rlm_pap_thread_t *t,
 								     request_t *request, const uint8_t *str, size_t len,
 								     fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
 								     char scheme_sep, char iter_sep, char salt_sep,
@@ -426,7 +980,8 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 	uint8_t			*salt = NULL;
 	size_t			salt_len;
 	uint8_t			hash[EVP_MAX_MD_SIZE];
-	uint8_t			digest[EVP_MAX_MD_SIZE];
+	unlang_action_t		ua;
+	pap_offload_job_t	job;
 
 	RDEBUG2("Comparing with \"known-good\" PBKDF2-Password");
 
@@ -596,24 +1151,22 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 	/*
 	 *	Hash and compare
 	 */
-	if (PKCS5_PBKDF2_HMAC((char const *)password->vp_octets, (int)password->vp_length,
-			      (unsigned char const *)salt, (int)salt_len,
-			      (int)iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		REDEBUG("PBKDF2 digest failure");
-		goto finish;
-	}
+	job = (pap_offload_job_t) {
+		.type = PAP_OFFLOAD_PBKDF2,
+		.password = password->vp_octets,
+		.password_len = password->vp_length,
+		.evp_md = evp_md,
+		.digest_len = digest_len,
+		.iterations = iterations,
+		.salt = salt,
+		.salt_len = salt_len
+	};
+	memcpy(job.hash, hash, digest_len);
+
+	ua = pap_offload_check(p_result, t, request, &job);
+	talloc_free(salt);
 
-	if (fr_digest_cmp(digest, hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
-		REDEBUG3("Salt       : %pH", fr_box_octets(salt, salt_len));
-		REDEBUG3("Calculated : %pH", fr_box_octets(digest, digest_len));
-		REDEBUG3("Expected   : %pH", fr_box_octets(hash, slen));
-		rcode = RLM_MODULE_REJECT;
-	} else {
-		rcode = RLM_MODULE_OK;
-	}
+	return ua;
 
 finish:
 	talloc_free(salt);
@@ -622,7 +1175,7 @@ finish:
 }
 
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst,
+							       rlm_pap_thread_t *t,
 							       request_t *request,
 							       fr_pair_t const *known_good, fr_pair_t const *password)
 {
@@ -647,7 +1200,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 			q = memchr(p, '}', end - p);
 			p = q + 1;
 		}
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, t, request, p, end - p,
 					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
 					     ':', ':', ':', true, password);
 	}
@@ -659,7 +1212,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$PBKDF2$") && (memcmp(p, "$PBKDF2$", sizeof("$PBKDF2$") - 1) == 0)) {
 		p += sizeof("$PBKDF2$") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, t, request, p, end - p,
 					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
 					     ':', ':', '$', false, password);
 	}
@@ -673,7 +1226,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$pbkdf2-") && (memcmp(p, "$pbkdf2-", sizeof("$pbkdf2-") - 1) == 0)) {
 		p += sizeof("$pbkdf2-") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, t, request, p, end - p,
 					     pbkdf2_passlib_names, pbkdf2_passlib_names_len,
 					     '$', '$', '$', false, password);
 	}
@@ -685,7 +1238,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_nt(rlm_rcode_t *p_result,
-						    UNUSED rlm_pap_t const *inst, request_t *request,
+						    UNUSED rlm_pap_thread_t *t, request_t *request,
 						    fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	ssize_t len;
@@ -721,7 +1274,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_nt(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_lm(rlm_rcode_t *p_result,
-						    UNUSED rlm_pap_t const *inst, request_t *request,
+						    UNUSED rlm_pap_thread_t *t, request_t *request,
 						    fr_pair_t const *known_good, UNUSED fr_pair_t const *password)
 {
 	uint8_t	digest[MD4_DIGEST_LENGTH];
@@ -751,7 +1304,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_lm(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(rlm_rcode_t *p_result,
-							    UNUSED rlm_pap_t const *inst, request_t *request,
+							    UNUSED rlm_pap_thread_t *t, request_t *request,
 							    fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	uint8_t digest[128];
@@ -815,7 +1368,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(rlm_rcode_t *p_resul
  *
  */
 static unlang_action_t CC_HINT(nonnull) pap_auth_dummy(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, UNUSED request_t *request,
+						       UNUSED rlm_pap_thread_t *t, UNUSED request_t *request,
 						       UNUSED fr_pair_t const *known_good, UNUSED fr_pair_t const *password)
 {
 	RETURN_MODULE_FAIL;
@@ -865,17 +1418,40 @@ static const pap_auth_func_t auth_func_table[] = {
 #endif	/* HAVE_OPENSSL_EVP_H */
 };
 
+/** Log the final result of authentication
+ *
+ */
+static unlang_action_t pap_auth_rcode(rlm_rcode_t *p_result, request_t *request, rlm_rcode_t rcode)
+{
+	switch (rcode) {
+	case RLM_MODULE_REJECT:
+		REDEBUG("Password incorrect");
+		break;
+
+	case RLM_MODULE_OK:
+		RDEBUG2("User authenticated successfully");
+		break;
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
 /*
  *	Authenticate the user via one of any well-known password.
  */
 static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_pap_t const 	*inst = talloc_get_type_abort_const(mctx->instance, rlm_pap_t);
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
 	fr_pair_t		*known_good;
 	fr_pair_t		*password;
 	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
 	pap_auth_func_t		auth_func;
 	bool			ephemeral;
+	unlang_action_t		ua;
 
 	password = fr_pair_find_by_da(&request->request_pairs, attr_user);
 	if (!password) {
@@ -925,22 +1501,17 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	/*
 	 *	Authenticate, and return.
 	 */
-	auth_func(&rcode, inst, request, known_good, password);
+	ua = auth_func(&rcode, t, request, known_good, password);
 	if (ephemeral) talloc_list_free(&known_good);
-	switch (rcode) {
-	case RLM_MODULE_REJECT:
-		REDEBUG("Password incorrect");
-		break;
 
-	case RLM_MODULE_OK:
-		RDEBUG2("User authenticated successfully");
-		break;
-
-	default:
-		break;
-	}
+	/*
+	 *	The check is running in an offload
+	 *	thread, and we're called again when
+	 *	it's done.
+	 */
+	if (ua == UNLANG_ACTION_YIELD) return ua;
 
-	RETURN_MODULE_RCODE(rcode);
+	return pap_auth_rcode(p_result, request, rcode);
 }
 
 static int mod_bootstrap(void *instance, CONF_SECTION *conf)
@@ -958,9 +1529,108 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_pap_t const		*inst = talloc_get_type_abort_const(instance, rlm_pap_t);
+	rlm_pap_thread_t	*t = thread;
+
+	(void) talloc_set_type(t, rlm_pap_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+	t->fd[0] = t->fd[1] = -1;
+
+	if (!inst->pool) return 0;
+
+	if (pipe(t->fd) < 0) {
+		ERROR("Failed creating offload pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if ((fr_nonblock(t->fd[0]) < 0) || (fr_nonblock(t->fd[1]) < 0) ||
+	    (fr_event_fd_insert(t, el, t->fd[0], pap_offload_done, NULL, NULL, t) < 0)) {
+		PERROR("Failed listening on offload pipe");
+		close(t->fd[0]);
+		close(t->fd[1]);
+		t->fd[0] = t->fd[1] = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Wait for any jobs this thread still has running
+ *
+ * All the requests have been cancelled by now, so the jobs
+ * are only waiting to be freed.
+ */
+static int mod_thread_detach(fr_event_list_t *el, void *thread)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(thread, rlm_pap_thread_t);
+	pap_offload_t		*pool = t->inst->pool;
+	pap_offload_job_t	*job, *next;
+
+	if (t->fd[0] < 0) return 0;
+
+	(void) fr_event_fd_delete(el, t->fd[0], FR_EVENT_FILTER_IO);
+
+	while (t->outstanding > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		job = t->done;
+		t->done = NULL;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (!job) {
+			usleep(1000);
+			continue;
+		}
+
+		for (; job; job = next) {
+			next = job->next;
+			t->outstanding--;
+			talloc_free(job);
+		}
+	}
+
+	close(t->fd[0]);
+	close(t->fd[1]);
+
+	return 0;
+}
+
+/** Stop the offload threads
+ *
+ */
+static int _pap_offload_free(pap_offload_t *pool)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+static int _pap_cache_free(pap_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
 static int mod_instantiate(void *instance, UNUSED CONF_SECTION *cs)
 {
 	rlm_pap_t	*inst = talloc_get_type_abort(instance, rlm_pap_t);
+	pap_offload_t	*pool;
+	uint32_t	i;
+	int		ret;
 
 	inst->auth_type = fr_dict_enum_by_name(attr_auth_type, inst->name, -1);
 	if (!inst->auth_type) {
@@ -968,6 +1638,46 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *cs)
 		     inst->name);
 	}
 
+	if (inst->cache_config.enable) {
+		pap_cache_t *cache;
+
+		FR_INTEGER_BOUND_CHECK("cache.max_entries", inst->cache_config.max_entries, >=, 1);
+
+		MEM(cache = talloc_zero(inst, pap_cache_t));
+		MEM(cache->ht = fr_hash_table_create(cache, pap_cache_entry_hash, pap_cache_entry_cmp, NULL));
+		fr_dlist_talloc_init(&cache->expiry, pap_cache_entry_t, entry);
+		pthread_mutex_init(&cache->mutex, NULL);
+		fr_rand_buffer(cache->secret, sizeof(cache->secret));
+		cache->lifetime = inst->cache_config.lifetime;
+		cache->max_entries = inst->cache_config.max_entries;
+		talloc_set_destructor(cache, _pap_cache_free);
+		inst->cache = cache;
+	}
+
+	if (!inst->offload.threads) return 0;
+
+	FR_INTEGER_BOUND_CHECK("offload.threads", inst->offload.threads, <=, 128);
+	FR_INTEGER_BOUND_CHECK("offload.max_queued", inst->offload.max_queued, >=, 1);
+
+	MEM(pool = talloc_zero(inst, pap_offload_t));
+	MEM(pool->threads = talloc_array(pool, pthread_t, inst->offload.threads));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->tail = &pool->head;
+	pool->max_queued = inst->offload.max_queued;
+	talloc_set_destructor(pool, _pap_offload_free);
+
+	for (i = 0; i < inst->offload.threads; i++) {
+		ret = pthread_create(&pool->threads[i], NULL, pap_offload_thread, pool);
+		if (ret != 0) {
+			ERROR("Failed creating offload thread: %s", fr_syserror(ret));
+			talloc_free(pool);
+			return -1;
+		}
+		pool->num_threads++;
+	}
+	inst->pool = pool;
+
 	return 0;
 }
 
@@ -1041,11 +1751,14 @@ module_t rlm_pap = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "pap",
 	.inst_size	= sizeof(rlm_pap_t),
+	.thread_inst_size = sizeof(rlm_pap_thread_t),
 	.onload		= mod_load,
 	.unload		= mod_unload,
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate = mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize
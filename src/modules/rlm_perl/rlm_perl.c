@@ -69,6 +69,7 @@ typedef struct {
 	char const	*perl_flags;
 	PerlInterpreter	*perl;
 	bool		perl_parsed;
+	bool		tied_pairs;		//!< Tie %RAD_* to the request's lists instead of copying them.
 	pthread_key_t	*thread_key;
 
 #ifdef USE_ITHREADS
@@ -100,6 +101,8 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("perl_flags", FR_TYPE_STRING, rlm_perl_t, perl_flags) },
 
+	{ FR_CONF_OFFSET("tied_pairs", FR_TYPE_BOOL, rlm_perl_t, tied_pairs), .dflt = "no" },
+
 	{ FR_CONF_OFFSET("func_start_accounting", FR_TYPE_STRING, rlm_perl_t, func_start_accounting) },
 
 	{ FR_CONF_OFFSET("func_stop_accounting", FR_TYPE_STRING, rlm_perl_t, func_stop_accounting) },
@@ -338,6 +341,354 @@ static XS(XS_radiusd_xlat)
 	XSRETURN(1);
 }
 
+/*
+ *	Tied %RAD_* hashes
+ *
+ *	When tied_pairs is set, %RAD_REQUEST and friends are tied to
+ *	the radiusd::pairs class.  Nothing is copied into Perl before
+ *	the call, or back out of it afterwards.  Each hash operation
+ *	instead reads or writes the fr_pair_t in the request directly.
+ *
+ *	The tie object is a reference to the tmpl_pair_list_t of the
+ *	list the hash operates on.
+ */
+typedef struct {
+	char const	*hash_name;
+	char const	*list_name;
+} rlm_perl_tied_list_t;
+
+static rlm_perl_tied_list_t const rlm_perl_tied_lists[] = {
+	[PAIR_LIST_REQUEST]	= { "RAD_REQUEST", "request" },
+	[PAIR_LIST_REPLY]	= { "RAD_REPLY", "reply" },
+	[PAIR_LIST_CONTROL]	= { "RAD_CONFIG", "control" },
+	[PAIR_LIST_STATE]	= { "RAD_STATE", "session-state" }
+};
+
+static int pairadd_sv(TALLOC_CTX *ctx, request_t *request, fr_pair_list_t *vps, char *key, SV *sv, fr_token_t op,
+		      const char *hash_name, const char *list_name);
+
+/** Resolve the list a tie object refers to
+ *
+ * @return
+ *	- The list, and the context to allocate pairs in.
+ *	- NULL if we're not running on behalf of a request.
+ */
+static fr_pair_list_t *perl_tied_list(TALLOC_CTX **ctx, tmpl_pair_list_t *list_name, request_t *request, SV *self)
+{
+	fr_pair_list_t	*list;
+
+	if (!request || !SvROK(self)) return NULL;
+
+	*list_name = SvIV(SvRV(self));
+	if ((*list_name < PAIR_LIST_REQUEST) || (*list_name > PAIR_LIST_STATE)) return NULL;
+
+	list = tmpl_list_head(request, *list_name);
+	if (!list) return NULL;
+
+	if (ctx && !(*ctx = tmpl_list_ctx(request, *list_name))) return NULL;
+
+	return list;
+}
+
+/** Convert a single pair to an SV, using the same rules as the copying interface
+ *
+ */
+static SV *perl_vp_to_sv(fr_pair_t const *vp)
+{
+	SV *sv;
+
+	switch (vp->vp_type) {
+	case FR_TYPE_STRING:
+		sv = newSVpvn(vp->vp_strvalue, vp->vp_length);
+		break;
+
+	case FR_TYPE_OCTETS:
+		sv = newSVpvn((char const *)vp->vp_octets, vp->vp_length);
+		break;
+
+	default:
+	{
+		char	buffer[1024];
+		ssize_t	slen;
+
+		slen = fr_pair_print_value_quoted(&FR_SBUFF_OUT(buffer, sizeof(buffer)), vp, T_BARE_WORD);
+		if (slen < 0) return NULL;
+
+		sv = newSVpvn(buffer, (size_t)slen);
+	}
+		break;
+	}
+
+	if (sv) SvTAINT(sv);
+
+	return sv;
+}
+
+/** Build the value of a hash element from all instances of an attribute
+ *
+ * @return
+ *	- NULL if there are no instances of the attribute.
+ *	- A scalar for a single instance.
+ *	- An array reference for multiple instances.
+ */
+static SV *perl_tied_fetch(fr_pair_list_t *list, fr_dict_attr_t const *da)
+{
+	fr_cursor_t	cursor;
+	fr_pair_t	*vp;
+	SV		*first = NULL, *sv;
+	AV		*av = NULL;
+
+	for (vp = fr_cursor_iter_by_da_init(&cursor, list, da);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		sv = perl_vp_to_sv(vp);
+		if (!sv) continue;
+
+		if (!first) {
+			first = sv;
+			continue;
+		}
+
+		if (!av) {
+			av = newAV();
+			av_push(av, first);
+		}
+		av_push(av, sv);
+	}
+
+	if (av) return newRV_noinc((SV *)av);
+
+	return first;
+}
+
+/** Return the name of the next distinct attribute in the list
+ *
+ * Attributes are returned in the order of their first instance in
+ * the list, which is the order perl_store_vps would have stored
+ * them in, if the list were not sorted.
+ */
+static char const *perl_tied_next_name(fr_pair_list_t *list, fr_dict_attr_t const *prev)
+{
+	fr_cursor_t	cursor, seen;
+	fr_pair_t	*vp, *p;
+	bool		found = (prev == NULL);
+
+	for (vp = fr_cursor_init(&cursor, list);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (!found) {
+			if (vp->da == prev) found = true;
+			continue;
+		}
+		if (vp->da == prev) continue;
+
+		for (p = fr_cursor_init(&seen, list);
+		     p != vp;
+		     p = fr_cursor_next(&seen)) if (p->da == vp->da) break;
+
+		if (p == vp) return vp->da->name;
+	}
+
+	return NULL;
+}
+
+static XS(XS_radiusd_pairs_FETCH)
+{
+	dXSARGS;
+	request_t		*request = rlm_perl_request;
+	fr_pair_list_t		*list;
+	tmpl_pair_list_t	list_name;
+	fr_dict_attr_t const	*da;
+	SV			*sv;
+
+	if (items != 2) croak("Usage: radiusd::pairs::FETCH(self, key)");
+
+	list = perl_tied_list(NULL, &list_name, request, ST(0));
+	if (!list) XSRETURN_UNDEF;
+
+	da = fr_dict_attr_search_by_qualified_oid(NULL, request->dict, SvPV_nolen(ST(1)), true);
+	if (!da) XSRETURN_UNDEF;
+
+	sv = perl_tied_fetch(list, da);
+	if (!sv) XSRETURN_UNDEF;
+
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_radiusd_pairs_STORE)
+{
+	dXSARGS;
+	request_t		*request = rlm_perl_request;
+	TALLOC_CTX		*ctx;
+	fr_pair_list_t		*list;
+	tmpl_pair_list_t	list_name;
+	fr_dict_attr_t const	*da;
+	char			*key;
+	SV			*value;
+
+	if (items != 3) croak("Usage: radiusd::pairs::STORE(self, key, value)");
+
+	list = perl_tied_list(&ctx, &list_name, request, ST(0));
+	if (!list) XSRETURN_EMPTY;
+
+	key = SvPV_nolen(ST(1));
+	value = ST(2);
+
+	/*
+	 *	Assigning to an element replaces all instances
+	 *	of the attribute, as it would with the copying
+	 *	interface.
+	 */
+	da = fr_dict_attr_search_by_qualified_oid(NULL, request->dict, key, true);
+	if (da) fr_pair_delete_by_da(list, da);
+
+	if (SvROK(value) && (SvTYPE(SvRV(value)) == SVt_PVAV)) {
+		AV	*av = (AV *)SvRV(value);
+		I32	i, len = av_len(av);
+
+		for (i = 0; i <= len; i++) {
+			SV **av_sv = av_fetch(av, i, 0);
+
+			if (!av_sv) continue;
+			(void)pairadd_sv(ctx, request, list, key, *av_sv, T_OP_ADD,
+					 rlm_perl_tied_lists[list_name].hash_name,
+					 rlm_perl_tied_lists[list_name].list_name);
+		}
+	} else {
+		(void)pairadd_sv(ctx, request, list, key, value, T_OP_EQ,
+				 rlm_perl_tied_lists[list_name].hash_name,
+				 rlm_perl_tied_lists[list_name].list_name);
+	}
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_radiusd_pairs_DELETE)
+{
+	dXSARGS;
+	request_t		*request = rlm_perl_request;
+	fr_pair_list_t		*list;
+	tmpl_pair_list_t	list_name;
+	fr_dict_attr_t const	*da;
+	SV			*sv;
+
+	if (items != 2) croak("Usage: radiusd::pairs::DELETE(self, key)");
+
+	list = perl_tied_list(NULL, &list_name, request, ST(0));
+	if (!list) XSRETURN_UNDEF;
+
+	da = fr_dict_attr_search_by_qualified_oid(NULL, request->dict, SvPV_nolen(ST(1)), true);
+	if (!da) XSRETURN_UNDEF;
+
+	sv = perl_tied_fetch(list, da);
+	if (!sv) XSRETURN_UNDEF;
+
+	RDEBUG2("delete $%s{'%s'}", rlm_perl_tied_lists[list_name].hash_name, da->name);
+	fr_pair_delete_by_da(list, da);
+
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_radiusd_pairs_CLEAR)
+{
+	dXSARGS;
+	request_t		*request = rlm_perl_request;
+	fr_pair_list_t		*list;
+	tmpl_pair_list_t	list_name;
+
+	if (items != 1) croak("Usage: radiusd::pairs::CLEAR(self)");
+
+	list = perl_tied_list(NULL, &list_name, request, ST(0));
+	if (!list) XSRETURN_EMPTY;
+
+	RDEBUG2("%%%s = ()", rlm_perl_tied_lists[list_name].hash_name);
+	fr_pair_list_free(list);
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_radiusd_pairs_EXISTS)
+{
+	dXSARGS;
+	request_t		*request = rlm_perl_request;
+	fr_pair_list_t		*list;
+	tmpl_pair_list_t	list_name;
+	fr_dict_attr_t const	*da;
+
+	if (items != 2) croak("Usage: radiusd::pairs::EXISTS(self, key)");
+
+	list = perl_tied_list(NULL, &list_name, request, ST(0));
+	if (!list) XSRETURN_NO;
+
+	da = fr_dict_attr_search_by_qualified_oid(NULL, request->dict, SvPV_nolen(ST(1)), true);
+	if (!da || !fr_pair_find_by_da(list, da)) XSRETURN_NO;
+
+	XSRETURN_YES;
+}
+
+static XS(XS_radiusd_pairs_FIRSTKEY)
+{
+	dXSARGS;
+	request_t		*request = rlm_perl_request;
+	fr_pair_list_t		*list;
+	tmpl_pair_list_t	list_name;
+	char const		*name;
+
+	if (items != 1) croak("Usage: radiusd::pairs::FIRSTKEY(self)");
+
+	list = perl_tied_list(NULL, &list_name, request, ST(0));
+	if (!list) XSRETURN_UNDEF;
+
+	name = perl_tied_next_name(list, NULL);
+	if (!name) XSRETURN_UNDEF;
+
+	XST_mPV(0, name);
+	XSRETURN(1);
+}
+
+static XS(XS_radiusd_pairs_NEXTKEY)
+{
+	dXSARGS;
+	request_t		*request = rlm_perl_request;
+	fr_pair_list_t		*list;
+	tmpl_pair_list_t	list_name;
+	fr_dict_attr_t const	*da;
+	char const		*name;
+
+	if (items != 2) croak("Usage: radiusd::pairs::NEXTKEY(self, lastkey)");
+
+	list = perl_tied_list(NULL, &list_name, request, ST(0));
+	if (!list) XSRETURN_UNDEF;
+
+	da = fr_dict_attr_search_by_qualified_oid(NULL, request->dict, SvPV_nolen(ST(1)), true);
+	if (!da) XSRETURN_UNDEF;
+
+	name = perl_tied_next_name(list, da);
+	if (!name) XSRETURN_UNDEF;
+
+	XST_mPV(0, name);
+	XSRETURN(1);
+}
+
+/** Tie one of the %RAD_* hashes to a request list
+ *
+ * The tie persists in the interpreter, so this only does work the
+ * first time it's called for each hash.
+ */
+static void perl_tie_list(HV *hv, tmpl_pair_list_t list_name)
+{
+	SV *obj;
+
+	if (SvTIED_mg((SV *)hv, PERL_MAGIC_tied)) return;
+
+	hv_clear(hv);
+	obj = sv_bless(newRV_noinc(newSViv(list_name)), gv_stashpv("radiusd::pairs", GV_ADD));
+	sv_magic((SV *)hv, obj, PERL_MAGIC_tied, NULL, 0);
+	SvREFCNT_dec(obj);
+}
+
 static void xs_init(pTHX)
 {
 	char const *file = __FILE__;
@@ -347,6 +698,14 @@ static void xs_init(pTHX)
 
 	newXS("radiusd::log",XS_radiusd_log, "rlm_perl");
 	newXS("radiusd::xlat",XS_radiusd_xlat, "rlm_perl");
+
+	newXS("radiusd::pairs::FETCH", XS_radiusd_pairs_FETCH, "rlm_perl");
+	newXS("radiusd::pairs::STORE", XS_radiusd_pairs_STORE, "rlm_perl");
+	newXS("radiusd::pairs::DELETE", XS_radiusd_pairs_DELETE, "rlm_perl");
+	newXS("radiusd::pairs::CLEAR", XS_radiusd_pairs_CLEAR, "rlm_perl");
+	newXS("radiusd::pairs::EXISTS", XS_radiusd_pairs_EXISTS, "rlm_perl");
+	newXS("radiusd::pairs::FIRSTKEY", XS_radiusd_pairs_FIRSTKEY, "rlm_perl");
+	newXS("radiusd::pairs::NEXTKEY", XS_radiusd_pairs_NEXTKEY, "rlm_perl");
 }
 
 /** Call perl code using an xlat
@@ -414,7 +773,9 @@ static ssize_t perl_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 
 		PUTBACK;
 
+		rlm_perl_request = request;
 		count = call_pv(inst->func_xlat, G_SCALAR | G_EVAL);
+		rlm_perl_request = NULL;
 
 		SPAGAIN;
 		if (SvTRUE(ERRSV)) {
@@ -868,10 +1229,17 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, void *instance, request_t
 		rad_request_hv = get_hv("RAD_REQUEST", 1);
 		rad_state_hv = get_hv("RAD_STATE", 1);
 
-		perl_store_vps(request->packet, request, &request->request_pairs, rad_request_hv, "RAD_REQUEST", "request");
-		perl_store_vps(request->reply, request, &request->reply_pairs, rad_reply_hv, "RAD_REPLY", "reply");
-		perl_store_vps(request, request, &request->control_pairs, rad_config_hv, "RAD_CONFIG", "control");
-		perl_store_vps(request->state_ctx, request, &request->state_pairs, rad_state_hv, "RAD_STATE", "session-state");
+		if (inst->tied_pairs) {
+			perl_tie_list(rad_request_hv, PAIR_LIST_REQUEST);
+			perl_tie_list(rad_reply_hv, PAIR_LIST_REPLY);
+			perl_tie_list(rad_config_hv, PAIR_LIST_CONTROL);
+			perl_tie_list(rad_state_hv, PAIR_LIST_STATE);
+		} else {
+			perl_store_vps(request->packet, request, &request->request_pairs, rad_request_hv, "RAD_REQUEST", "request");
+			perl_store_vps(request->reply, request, &request->reply_pairs, rad_reply_hv, "RAD_REPLY", "reply");
+			perl_store_vps(request, request, &request->control_pairs, rad_config_hv, "RAD_CONFIG", "control");
+			perl_store_vps(request->state_ctx, request, &request->state_pairs, rad_state_hv, "RAD_STATE", "session-state");
+		}
 
 		/*
 		 * Store pointer to request structure globally so radiusd::xlat works
@@ -910,6 +1278,12 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, void *instance, request_t
 		FREETMPS;
 		LEAVE;
 
+		/*
+		 *	Tied hashes have already written any changes
+		 *	to the lists.
+		 */
+		if (inst->tied_pairs) RETURN_MODULE_RCODE(exitstatus);
+
 		vp = NULL;
 		if ((get_hv_content(request->packet, request, rad_request_hv, &vp, "RAD_REQUEST", "request")) == 0) {
 			fr_pair_list_free(&request->request_pairs);
@@ -76,15 +76,31 @@ typedef struct {
 
 	PyObject	*pythonconf_dict;	//!< Configuration parameters defined in the module
 						//!< made available to the python script.
+
+	bool		per_thread_interpreter;	//!< Give each thread its own interpreter, with its own GIL.
+	CONF_SECTION	*conf;			//!< Module configuration, for creating thread interpreters.
 } rlm_python_t;
 
 /** Tracks a python module inst/thread state pair
  *
  * Multiple instances of python create multiple interpreters and each
  * thread must have a PyThreadState per interpreter, to track execution.
+ *
+ * With per_thread_interpreter, the state is the only thread state of
+ * an interpreter belonging to this thread, and the functions are
+ * loaded into that interpreter.
  */
 typedef struct {
 	PyThreadState	*state;			//!< Module instance/thread specific state.
+
+	PyObject	*module;		//!< Thread specific "freeradius" module.
+
+	python_func_def_t
+	authorize,
+	authenticate,
+	preacct,
+	accounting,
+	post_auth;
 } rlm_python_thread_t;
 
 static void		*python_dlhandle;
@@ -94,6 +110,12 @@ static rlm_python_t	*current_inst;		//!< Used for communication with inittab fun
 static CONF_SECTION	*current_conf;		//!< Used for communication with inittab functions.
 static char		*default_path;		//!< The default python path.
 
+/*
+ *	Protects current_inst and current_conf while worker
+ *	threads create their interpreters.
+ */
+static pthread_mutex_t	thread_interpreter_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  *	As of Python 3.8 the GIL will be per-interpreter
  *	If there are still issues with CEXTs,
@@ -133,6 +155,7 @@ static CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("python_path", FR_TYPE_STRING, rlm_python_t, python_path) },
 	{ FR_CONF_OFFSET("python_path_include_conf_dir", FR_TYPE_BOOL, rlm_python_t, python_path_include_conf_dir), .dflt = "yes" },
 	{ FR_CONF_OFFSET("python_path_include_default", FR_TYPE_BOOL, rlm_python_t, python_path_include_default), .dflt = "yes" },
+	{ FR_CONF_OFFSET("per_thread_interpreter", FR_TYPE_BOOL, rlm_python_t, per_thread_interpreter), .dflt = "no" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -620,7 +643,8 @@ static unlang_action_t CC_HINT(nonnull) mod_##x(rlm_rcode_t *p_result, module_ct
 { \
 	rlm_python_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_python_t); \
 	rlm_python_thread_t *thread = talloc_get_type_abort(mctx->thread, rlm_python_thread_t); \
-	return do_python(p_result, inst, thread, request, inst->x.function, #x);\
+	return do_python(p_result, inst, thread, request, \
+			 inst->per_thread_interpreter ? thread->x.function : inst->x.function, #x);\
 }
 
 MOD_FUNC(authenticate)
@@ -766,7 +790,8 @@ static int python_parse_config(rlm_python_t *inst, CONF_SECTION *cs, int lvl, Py
 /** Make the current instance's config available within the module we're initialising
  *
  */
-static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, PyObject *module)
+static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, PyObject *module,
+				       PyObject **dict)
 {
 	CONF_SECTION *cs;
 
@@ -774,12 +799,12 @@ static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, P
 	 *	Convert a FreeRADIUS config structure into a python
 	 *	dictionary.
 	 */
-	inst->pythonconf_dict = PyDict_New();
-	if (!inst->pythonconf_dict) {
+	*dict = PyDict_New();
+	if (!*dict) {
 		ERROR("Unable to create python dict for config");
 	error:
-		Py_XDECREF(inst->pythonconf_dict);
-		inst->pythonconf_dict = NULL;
+		Py_XDECREF(*dict);
+		*dict = NULL;
 		python_error_log(inst, NULL);
 		return -1;
 	}
@@ -787,13 +812,13 @@ static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, P
 	cs = cf_section_find(conf, "config", NULL);
 	if (cs) {
 		DEBUG("Inserting \"config\" section into python environment as radiusd.config");
-		if (python_parse_config(inst, cs, 0, inst->pythonconf_dict) < 0) goto error;
+		if (python_parse_config(inst, cs, 0, *dict) < 0) goto error;
 	}
 
 	/*
 	 *	Add module configuration as a dict
 	 */
-	if (PyModule_AddObject(module, "config", inst->pythonconf_dict) < 0) goto error;
+	if (PyModule_AddObject(module, "config", *dict) < 0) goto error;
 
 	return 0;
 }
@@ -848,26 +873,30 @@ static char *python_path_build(TALLOC_CTX *ctx, rlm_python_t *inst, CONF_SECTION
  */
 static PyObject *python_module_init(void)
 {
-	rlm_python_t	*inst = current_inst;
-	PyObject	*module;
+	/*
+	 *	The module has no state, so it can be created in
+	 *	any number of interpreters, including ones with
+	 *	their own GIL.  That requires multi-phase init.
+	 */
+	static PyModuleDef_Slot py_module_slots[] = {
+#ifdef Py_mod_multiple_interpreters
+		{ Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+		{ 0, NULL }
+	};
 
 	static struct PyModuleDef py_module_def = {
 		PyModuleDef_HEAD_INIT,
 		.m_name = "freeradius",
 		.m_doc = "freeRADIUS python module",
-		.m_size = -1,
-		.m_methods = module_methods
+		.m_size = 0,
+		.m_methods = module_methods,
+		.m_slots = py_module_slots
 	};
 
-	fr_assert(inst);
-
-	module = PyModule_Create(&py_module_def);
-	if (!module) {
-		python_error_log(inst, NULL);
-		Py_RETURN_NONE;
-	}
+	fr_assert(current_inst);
 
-	return module;
+	return PyModuleDef_Init(&py_module_def);
 }
 
 static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
@@ -914,7 +943,7 @@ static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
  		ERROR("Failed importing \"freeradius\" module into interpreter %p", inst->interpreter);
  		return -1;
  	}
-	if ((python_module_import_config(inst, conf, module) < 0) ||
+	if ((python_module_import_config(inst, conf, module, &inst->pythonconf_dict) < 0) ||
 	    (python_module_import_constants(inst, module) < 0)) {
 		Py_DECREF(module);
 		return -1;
@@ -956,6 +985,14 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
+	inst->conf = conf;
+
+#if PY_VERSION_HEX < 0x030C0000
+	if (inst->per_thread_interpreter) {
+		cf_log_err(conf, "per_thread_interpreter requires Python 3.12 or later");
+		return -1;
+	}
+#endif
 
 	if (python_interpreter_init(inst, conf) < 0) return -1;
 
@@ -1050,6 +1087,118 @@ static int mod_detach(void *instance)
 	return 0;
 }
 
+#if PY_VERSION_HEX >= 0x030C0000
+/** Create an interpreter with its own GIL for the current thread
+ *
+ * The user's module is imported again in the new interpreter, so
+ * any state it holds is per-thread.  On success the interpreter's
+ * thread state is released, ready to be swapped in by do_python().
+ */
+static int python_thread_interpreter_init(rlm_python_t *inst, rlm_python_thread_t *this_thread)
+{
+	PyInterpreterConfig	config = {
+					.use_main_obmalloc = 0,
+					.allow_fork = 0,
+					.allow_exec = 0,
+					.allow_threads = 1,
+					.allow_daemon_threads = 0,
+					.check_multi_interp_extensions = 1,
+					.gil = PyInterpreterConfig_OWN_GIL,
+				};
+	PyGILState_STATE	gstate;
+	PyThreadState		*main_state;
+	PyStatus		status;
+	PyObject		*module, *dict;
+	char			*path;
+	wchar_t			*wide_path;
+	int			ret = -1;
+
+	pthread_mutex_lock(&thread_interpreter_mutex);
+	current_inst = inst;
+	current_conf = inst->conf;
+
+	/*
+	 *	We need a thread state in the main interpreter
+	 *	to create the new one.
+	 */
+	gstate = PyGILState_Ensure();
+	main_state = PyThreadState_Get();
+
+	LSAN_DISABLE(status = Py_NewInterpreterFromConfig(&this_thread->state, &config));
+	if (PyStatus_Exception(status)) {
+		ERROR("Failed creating thread interpreter: %s", status.err_msg ? status.err_msg : "unknown error");
+		this_thread->state = NULL;
+		goto finish;
+	}
+	DEBUG3("Created new thread interpreter %p", this_thread->state);
+
+	path = python_path_build(inst, inst, inst->conf);
+	wide_path = Py_DecodeLocale(path, NULL);
+	talloc_free(path);
+	PySys_SetPath(wide_path);
+	PyMem_RawFree(wide_path);
+
+	module = PyImport_ImportModule("freeradius");
+	if (!module) {
+		ERROR("Failed importing \"freeradius\" module into interpreter %p", this_thread->state);
+		python_error_log(inst, NULL);
+		goto release;
+	}
+	if ((python_module_import_config(inst, inst->conf, module, &dict) < 0) ||
+	    (python_module_import_constants(inst, module) < 0)) {
+		Py_DECREF(module);
+		goto release;
+	}
+	this_thread->module = module;
+
+#define PYTHON_THREAD_FUNC_INIT(_x) this_thread->_x.module_name = inst->_x.module_name; \
+	this_thread->_x.function_name = inst->_x.function_name; \
+	if (python_function_load(inst, &this_thread->_x) < 0) goto release
+	PYTHON_THREAD_FUNC_INIT(authenticate);
+	PYTHON_THREAD_FUNC_INIT(authorize);
+	PYTHON_THREAD_FUNC_INIT(preacct);
+	PYTHON_THREAD_FUNC_INIT(accounting);
+	PYTHON_THREAD_FUNC_INIT(post_auth);
+
+	ret = 0;
+
+release:
+	/*
+	 *	Release the new interpreter's GIL, and go back
+	 *	to the main interpreter, so we can release that
+	 *	thread state too.
+	 */
+	PyEval_SaveThread();
+	PyEval_RestoreThread(main_state);
+
+finish:
+	PyGILState_Release(gstate);
+	pthread_mutex_unlock(&thread_interpreter_mutex);
+
+	return ret;
+}
+
+static void python_thread_interpreter_free(rlm_python_thread_t *this_thread)
+{
+	PyEval_RestoreThread(this_thread->state);
+
+#define PYTHON_THREAD_FUNC_DESTROY(_x) python_function_destroy(&this_thread->_x)
+	PYTHON_THREAD_FUNC_DESTROY(authorize);
+	PYTHON_THREAD_FUNC_DESTROY(authenticate);
+	PYTHON_THREAD_FUNC_DESTROY(preacct);
+	PYTHON_THREAD_FUNC_DESTROY(accounting);
+	PYTHON_THREAD_FUNC_DESTROY(post_auth);
+	python_obj_destroy(&this_thread->module);
+
+	/*
+	 *	The interpreter owns its GIL, so there's nothing
+	 *	left to release once it's gone.
+	 */
+	Py_EndInterpreter(this_thread->state);
+	this_thread->state = NULL;
+}
+#endif
+
 static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
 				  UNUSED fr_event_list_t *el, void *thread)
 {
@@ -1057,6 +1206,16 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instanc
 	rlm_python_t		*inst = instance;
 	rlm_python_thread_t	*this_thread = thread;
 
+#if PY_VERSION_HEX >= 0x030C0000
+	if (inst->per_thread_interpreter) {
+		if (python_thread_interpreter_init(inst, this_thread) < 0) {
+			if (this_thread->state) python_thread_interpreter_free(this_thread);
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
 	state = PyThreadState_New(inst->interpreter->interp);
 	if (!state) {
 		ERROR("Failed initialising local PyThreadState");
@@ -1073,6 +1232,13 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_python_thread_t	*this_thread = thread;
 
+#if PY_VERSION_HEX >= 0x030C0000
+	if (this_thread->module) {
+		python_thread_interpreter_free(this_thread);
+		return 0;
+	}
+#endif
+
 	PyEval_RestoreThread(this_thread->state);	/* Swap in our local thread state */
 	PyThreadState_Clear(this_thread->state);
 	PyEval_SaveThread();
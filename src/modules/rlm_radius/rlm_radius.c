@@ -123,6 +123,10 @@ static CONF_PARSER const module_config[] = {
 
 	{ FR_CONF_OFFSET("pool", FR_TYPE_SUBSECTION, rlm_radius_t, trunk_conf), .subcs = (void const *) fr_trunk_config, },
 
+	{ FR_CONF_OFFSET("max_packets_per_second", FR_TYPE_UINT32, rlm_radius_t, max_packets_per_second), .dflt = "0" },
+
+	{ FR_CONF_OFFSET("max_rate_delay", FR_TYPE_TIME_DELTA, rlm_radius_t, max_rate_delay), .dflt = "5" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -363,6 +367,57 @@ static int status_check_update_parse(TALLOC_CTX *ctx, void *out, UNUSED void *pa
 }
 
 
+static int cmd_show_module_stats(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_radius_t const	*inst = talloc_get_type_abort_const(ctx, rlm_radius_t);
+	rlm_radius_shared_t	*shared = inst->shared;
+
+	fprintf(fp, "sent\t\t%" PRIu64 "\n", (uint64_t) atomic_load_explicit(&shared->sent, memory_order_relaxed));
+	fprintf(fp, "ok\t\t%" PRIu64 "\n", (uint64_t) atomic_load_explicit(&shared->ok, memory_order_relaxed));
+	fprintf(fp, "rejected\t%" PRIu64 "\n", (uint64_t) atomic_load_explicit(&shared->rejected, memory_order_relaxed));
+	fprintf(fp, "failed\t\t%" PRIu64 "\n", (uint64_t) atomic_load_explicit(&shared->failed, memory_order_relaxed));
+	fprintf(fp, "delayed\t\t%" PRIu64 "\n", (uint64_t) atomic_load_explicit(&shared->delayed, memory_order_relaxed));
+	fprintf(fp, "dropped\t\t%" PRIu64 "\n", (uint64_t) atomic_load_explicit(&shared->dropped, memory_order_relaxed));
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "stats",
+		.func = cmd_show_module_stats,
+		.help = "Show request counters for a RADIUS client module.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
+
+/** Count the result of a request
+ *
+ */
+static inline CC_HINT(always_inline) void radius_stats_rcode(rlm_radius_t const *inst, rlm_rcode_t rcode)
+{
+	switch (rcode) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_NOOP:
+	case RLM_MODULE_HANDLED:
+		atomic_fetch_add_explicit(&inst->shared->ok, 1, memory_order_relaxed);
+		break;
+
+	case RLM_MODULE_REJECT:
+		atomic_fetch_add_explicit(&inst->shared->rejected, 1, memory_order_relaxed);
+		break;
+
+	default:
+		atomic_fetch_add_explicit(&inst->shared->failed, 1, memory_order_relaxed);
+		break;
+	}
+}
+
 static void mod_radius_signal(module_ctx_t const *mctx, request_t *request, void *rctx, fr_state_signal_t action)
 {
 	rlm_radius_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_radius_t);
@@ -388,8 +443,105 @@ static unlang_action_t mod_radius_resume(rlm_rcode_t *p_result, module_ctx_t con
 {
 	rlm_radius_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_radius_t);
 	rlm_radius_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_radius_thread_t);
+	unlang_action_t ua;
+
+	ua = inst->io->resume(p_result, &(module_ctx_t){.instance = inst->io_instance, .thread = t->io_thread }, request, ctx);
+	if (ua != UNLANG_ACTION_YIELD) radius_stats_rcode(inst, *p_result);
+
+	return ua;
+}
 
-	return inst->io->resume(p_result, &(module_ctx_t){.instance = inst->io_instance, .thread = t->io_thread }, request, ctx);
+/** Hand a request to the IO submodule
+ *
+ */
+static unlang_action_t radius_enqueue(rlm_rcode_t *p_result, rlm_radius_t const *inst, rlm_radius_thread_t *t,
+				      request_t *request)
+{
+	rlm_rcode_t	rcode;
+	void		*rctx = NULL;
+
+	atomic_fetch_add_explicit(&inst->shared->sent, 1, memory_order_relaxed);
+
+	/*
+	 *	Push the request and it's data to the IO submodule.
+	 *
+	 *	This may return YIELD, for "please yield", or it may
+	 *	return another code which indicates what happened to
+	 *	the request...b
+	 */
+	inst->io->enqueue(&rcode, &rctx, inst->io_instance, t->io_thread, request);
+	if (rcode != RLM_MODULE_YIELD) {
+		fr_assert(rctx == NULL);
+		radius_stats_rcode(inst, rcode);
+		RETURN_MODULE_RCODE(rcode);
+	}
+
+	return unlang_module_yield(request, mod_radius_resume, mod_radius_signal, rctx);
+}
+
+/** Work out how long a request has to wait before it can be sent
+ *
+ * This is the generic cell rate algorithm.  next_send is when the
+ * next request would go out if requests were sent at exactly
+ * max_packets_per_second.  A request may get ahead of that by up to
+ * one second worth of requests, so bursts are let through, but the
+ * average rate is not exceeded.
+ *
+ * The state is a single atomic shared by all threads, so the limit
+ * applies to the instance, not to each thread.
+ *
+ * @return
+ *	- 0 if the request can be sent now.
+ *	- > 0 how long the request has to wait.
+ *	- < 0 if the request would have to wait longer than max_rate_delay.
+ */
+static fr_time_delta_t radius_rate_delay(rlm_radius_t const *inst, fr_time_t now)
+{
+	fr_time_delta_t	interval = NSEC / inst->max_packets_per_second;
+	fr_time_delta_t	burst = NSEC - interval;
+	fr_time_delta_t	delay;
+	int_fast64_t	next, when;
+
+	next = atomic_load_explicit(&inst->shared->next_send, memory_order_relaxed);
+	do {
+		when = (next > now) ? next : now;
+
+		delay = when - burst - now;
+		if (delay < 0) delay = 0;
+		if (delay > inst->max_rate_delay) return -1;
+	} while (!atomic_compare_exchange_weak_explicit(&inst->shared->next_send, &next, when + interval,
+							 memory_order_relaxed, memory_order_relaxed));
+
+	return delay;
+}
+
+static void mod_radius_rate_done(UNUSED module_ctx_t const *mctx, request_t *request,
+				 UNUSED void *rctx, UNUSED fr_time_t fired)
+{
+	unlang_interpret_mark_resumable(request);
+}
+
+static void mod_radius_rate_signal(UNUSED module_ctx_t const *mctx, request_t *request, void *rctx,
+				   fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	(void) unlang_module_timeout_delete(request, rctx);
+	talloc_free(rctx);
+}
+
+/** Send a request which was delayed by the rate limit
+ *
+ */
+static unlang_action_t mod_radius_rate_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					      request_t *request, void *rctx)
+{
+	rlm_radius_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_radius_t);
+	rlm_radius_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_radius_thread_t);
+
+	talloc_free(rctx);
+
+	return radius_enqueue(p_result, inst, t, request);
 }
 
 /** Do any RADIUS-layer fixups for proxying.
@@ -434,9 +586,6 @@ static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, modul
 {
 	rlm_radius_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_radius_t);
 	rlm_radius_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_radius_thread_t);
-	rlm_rcode_t		rcode;
-
-	void			*rctx = NULL;
 
 	if (!request->packet->code) {
 		REDEBUG("You MUST specify a packet code");
@@ -477,19 +626,39 @@ static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, modul
 	radius_fixups(inst, request);
 
 	/*
-	 *	Push the request and it's data to the IO submodule.
-	 *
-	 *	This may return YIELD, for "please yield", or it may
-	 *	return another code which indicates what happened to
-	 *	the request...b
+	 *	Spread the requests out if there are more than the
+	 *	home server (or NAS) should get.
 	 */
-	inst->io->enqueue(&rcode, &rctx, inst->io_instance, t->io_thread, request);
-	if (rcode != RLM_MODULE_YIELD) {
-		fr_assert(rctx == NULL);
-		RETURN_MODULE_RCODE(rcode);
+	if (inst->max_packets_per_second) {
+		fr_time_t	now = fr_time();
+		fr_time_delta_t	delay;
+		fr_time_t	*resume_at;
+
+		delay = radius_rate_delay(inst, now);
+		if (delay < 0) {
+			atomic_fetch_add_explicit(&inst->shared->dropped, 1, memory_order_relaxed);
+			REDEBUG("Over max_packets_per_second, and max_rate_delay would be exceeded");
+			RETURN_MODULE_FAIL;
+		}
+
+		if (delay > 0) {
+			atomic_fetch_add_explicit(&inst->shared->delayed, 1, memory_order_relaxed);
+			RDEBUG2("Over max_packets_per_second, delaying request by %pVs", fr_box_time_delta(delay));
+
+			MEM(resume_at = talloc(request, fr_time_t));
+			*resume_at = now + delay;
+
+			if (unlang_module_timeout_add(request, mod_radius_rate_done, resume_at, *resume_at) < 0) {
+				RPEDEBUG("Adding event failed");
+				talloc_free(resume_at);
+				RETURN_MODULE_FAIL;
+			}
+
+			return unlang_module_yield(request, mod_radius_rate_resume, mod_radius_rate_signal, resume_at);
+		}
 	}
 
-	return unlang_module_yield(request, mod_radius_resume, mod_radius_signal, rctx);
+	return radius_enqueue(p_result, inst, t, request);
 }
 
 /** Destroy thread data for the submodule.
@@ -562,6 +731,13 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 
 	if (inst->io->instantiate && inst->io->instantiate(inst->io_instance, inst->io_conf) < 0) return -1;
 
+	MEM(inst->shared = talloc_zero(inst, rlm_radius_shared_t));
+
+	if (fr_command_register_hook(NULL, inst->name, inst, cmd_table) < 0) {
+		PERROR("Failed registering radmin commands for module %s", inst->name);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -24,6 +24,12 @@
 #include <freeradius-devel/unlang/module.h>
 #include <freeradius-devel/radius/radius.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /*
  * $Id$
  *
@@ -45,6 +51,24 @@ typedef struct {
 	void			*io_thread;		//!< thread context for the IO submodule
 } rlm_radius_thread_t;
 
+/** State shared by all threads using a module instance
+ *
+ * Each instance usually talks to a single home server or NAS, so
+ * this is where the per-destination rate limit and counters live.
+ */
+typedef struct {
+	atomic_int_fast64_t	next_send;		//!< Theoretical time the next packet is due to be
+							///< sent, for the rate limit.
+
+	atomic_uint_fast64_t	sent;			//!< Requests passed to the IO submodule.
+	atomic_uint_fast64_t	ok;			//!< Requests which received a positive response.
+	atomic_uint_fast64_t	rejected;		//!< Requests which received a negative response.
+	atomic_uint_fast64_t	failed;			//!< Requests which timed out, or otherwise failed.
+	atomic_uint_fast64_t	delayed;		//!< Requests delayed by the rate limit.
+	atomic_uint_fast64_t	dropped;		//!< Requests failed because the rate limit would
+							///< have delayed them for too long.
+} rlm_radius_shared_t;
+
 /*
  *	Define a structure for our module configuration.
  */
@@ -78,6 +102,13 @@ struct rlm_radius_s {
 	fr_retry_config_t      	retry[FR_RADIUS_MAX_PACKET_CODE];
 
 	fr_trunk_conf_t		trunk_conf;		//!< trunk configuration
+
+	uint32_t		max_packets_per_second;	//!< Maximum rate at which requests are sent.
+							///< 0 for no limit.
+	fr_time_delta_t		max_rate_delay;		//!< Maximum time a request may wait for the
+							///< rate limit, before it fails.
+
+	rlm_radius_shared_t	*shared;		//!< Rate limit and counters.
 };
 
 /** Enqueue a request_t to an IO submodule
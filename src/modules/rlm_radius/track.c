@@ -24,7 +24,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
-#include <freeradius-devel/util/rbtree.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/debug.h>
@@ -63,6 +63,22 @@ radius_track_t *radius_track_alloc(TALLOC_CTX *ctx)
 }
 
 
+/** Hash a radius_track_entry_t
+ *
+ * The Request Authenticator is either random, or an MD5 digest, so its
+ * bits are already uniformly distributed.  There's no need to hash it
+ * again.
+ */
+static uint32_t te_hash(void const *data)
+{
+	radius_track_entry_t const *te = data;
+	uint32_t hash;
+
+	memcpy(&hash, te->vector, sizeof(hash));
+
+	return hash ^ te->id;
+}
+
 /** Compare two radius_track_entry_t
  *
  */
@@ -71,9 +87,31 @@ static int te_cmp(void const *one, void const *two)
 	radius_track_entry_t const *a = one;
 	radius_track_entry_t const *b = two;
 
+	if (a->id != b->id) return (a->id > b->id) - (a->id < b->id);
+
 	return memcmp(a->vector, b->vector, sizeof(a->vector));
 }
 
+/** Remove an entry from the table of authenticators, if it's there
+ *
+ */
+static inline CC_HINT(always_inline) void te_subtree_remove(radius_track_t *tt, radius_track_entry_t *te)
+{
+	if (!tt->subtree) return;
+
+	if (fr_hash_table_find_by_data(tt->subtree, te) == te) (void) fr_hash_table_yank(tt->subtree, te);
+}
+
+/** Allocate the table of authenticators, if it doesn't already exist
+ *
+ */
+static inline CC_HINT(always_inline) void te_subtree_alloc(radius_track_t *tt)
+{
+	if (tt->subtree) return;
+
+	MEM(tt->subtree = fr_hash_table_create(tt, te_hash, te_cmp, NULL));
+}
+
 /** Ensures the entry is released when the ctx passed to radius_track_entry_reserve is freed
  *
  * @param[in] te_p		Entry to release.
@@ -155,15 +193,13 @@ retry:
 	tt->next_id &= 0xff;
 
 	/*
-	 *	If needed, allocate a subtree.
+	 *	If needed, allocate the table of authenticators.
 	 */
-	if (!tt->subtree[tt->next_id]) {
-		MEM(tt->subtree[tt->next_id] = rbtree_talloc_alloc(tt, te_cmp, radius_track_entry_t,
-								    NULL, RBTREE_FLAG_NONE));
-	}
+	te_subtree_alloc(tt);
 
 	/*
-	 *	Allocate a new one, and insert it into the appropriate subtree.
+	 *	Allocate a new one, it's inserted into the table of
+	 *	authenticators when the vector is known.
 	 */
 	te = talloc_zero(tt, radius_track_entry_t);
 	te->id = tt->next_id;
@@ -238,10 +274,10 @@ int radius_track_entry_release(
 	 */
 	if (te == &tt->id[te->id]) {
 		/*
-		 *	This entry MAY be in a subtree.  If so, delete
-		 *	it.
+		 *	This entry MAY be in the table of
+		 *	authenticators.  If so, delete it.
 		 */
-		if (tt->subtree[te->id]) (void) rbtree_deletebydata(tt->subtree[te->id], te);
+		te_subtree_remove(tt, te);
 
 		goto done;
 	}
@@ -252,10 +288,10 @@ int radius_track_entry_release(
 	(void) talloc_get_type_abort(te, radius_track_entry_t);
 
 	/*
-	 *	Delete it from the tracking subtree.
+	 *	Delete it from the table of authenticators.
 	 */
-	fr_assert(tt->subtree[te->id] != NULL);
-	(void) rbtree_deletebydata(tt->subtree[te->id], te);
+	fr_assert(tt->subtree != NULL);
+	te_subtree_remove(tt, te);
 
 	/*
 	 *	Try to free memory if the system gets idle.  If the
@@ -297,7 +333,7 @@ int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 	/*
 	 *	The authentication vector may have changed.
 	 */
-	if (tt->subtree[te->id]) (void) rbtree_deletebydata(tt->subtree[te->id], te);
+	te_subtree_remove(tt, te);
 
 	memcpy(te->vector, vector, sizeof(te->vector));
 
@@ -319,7 +355,8 @@ int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 	 *	array.  That way if the server responds with
 	 *	Original-Request-Authenticator, we can easily find it.
 	 */
-	if (!rbtree_insert(tt->subtree[te->id], te)) return -1;
+	te_subtree_alloc(tt);
+	if (!fr_hash_table_insert(tt->subtree, te)) return -1;
 
 	return 0;
 }
@@ -358,11 +395,12 @@ radius_track_entry_t *radius_track_entry_find(radius_track_t *tt, uint8_t packet
 	}
 
 	/*
-	 *	The entry MAY be in the subtree!
+	 *	The entry MAY be in the table of authenticators!
 	 */
+	my_te.id = packet_id;
 	memcpy(&my_te.vector, vector, sizeof(my_te.vector));
 
-	te = rbtree_finddata(tt->subtree[packet_id], &my_te);
+	te = tt->subtree ? fr_hash_table_find_by_data(tt->subtree, &my_te) : NULL;
 
 	/*
 	 *	Not found, the packet MAY have been allocated in the
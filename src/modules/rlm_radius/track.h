@@ -26,6 +26,7 @@
 
 #include "rlm_radius.h"
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 
 typedef struct radius_track_entry_s radius_track_entry_t;
 typedef struct radius_track_s radius_track_t;
@@ -69,7 +70,8 @@ struct radius_track_s {
 
 	radius_track_entry_t	id[UINT8_MAX + 1];	//!< which ID was used
 
-	rbtree_t	*subtree[UINT8_MAX + 1];	//!< for Original-Request-Authenticator
+	fr_hash_table_t	*subtree;		//!< for Original-Request-Authenticator, keyed by
+						///< ID and Request Authenticator.
 
 #ifndef NDEBUG
 	uint64_t	operation;		//!< Incremented each alloc and de-alloc
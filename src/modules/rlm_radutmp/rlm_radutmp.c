@@ -27,9 +27,11 @@ RCSID("$Id$")
 #include	<freeradius-devel/server/radutmp.h>
 #include	<freeradius-devel/server/module.h>
 #include	<freeradius-devel/util/debug.h>
+#include	<freeradius-devel/util/hash.h>
 #include	<freeradius-devel/radius/radius.h>
 
 #include	<fcntl.h>
+#include	<sys/stat.h>
 
 #include "config.h"
 
@@ -38,18 +40,34 @@ RCSID("$Id$")
 static char const porttypes[] = "ASITX";
 
 /*
- *	used for caching radutmp lookups in the accounting component.
+ *	Where the record for a NAS / port combination is in the file.
  */
-typedef struct nas_port_s NAS_PORT;
-struct nas_port_s {
-	uint32_t		nasaddr;
-	uint16_t		port;
+typedef struct {
+	unsigned int		nas_address;
+	unsigned int		nas_port;
 	off_t			offset;
-	NAS_PORT 		*next;
-};
+} radutmp_slot_t;
+
+/*
+ *	Index of the records in a radutmp file, so that we don't have
+ *	to read the whole file for every accounting packet.
+ *
+ *	The file is still the only store of sessions, so radwho etc.
+ *	keep working.  Every slot we find is checked against the
+ *	record in the file, and the index is rebuilt if someone else
+ *	has rewritten the file.  Records appended by someone else are
+ *	indexed when we next fail to find a slot.
+ */
+typedef struct {
+	char const		*filename;	//!< The index is for.
+	dev_t			dev;		//!< Of the file, to notice it being replaced.
+	ino_t			ino;
+	off_t			end;		//!< How much of the file we've indexed.
+	fr_hash_table_t		*slots;		//!< by NAS address and port.
+} radutmp_index_t;
 
 typedef struct {
-	NAS_PORT	*nas_port_list;
+	radutmp_index_t	*index;
 	char const	*filename;
 	char const	*username;
 	bool		check_nas;
@@ -156,20 +174,134 @@ static unlang_action_t radutmp_zap(rlm_rcode_t *p_result, request_t *request, ch
 	RETURN_MODULE_OK;
 }
 
+static uint32_t radutmp_slot_hash(void const *data)
+{
+	radutmp_slot_t const *slot = data;
+
+	return fr_hash_update(&slot->nas_port, sizeof(slot->nas_port),
+			      fr_hash(&slot->nas_address, sizeof(slot->nas_address)));
+}
+
+static int radutmp_slot_cmp(void const *one, void const *two)
+{
+	radutmp_slot_t const *a = one, *b = two;
+
+	if (a->nas_address != b->nas_address) return (a->nas_address > b->nas_address) - (a->nas_address < b->nas_address);
+
+	return (a->nas_port > b->nas_port) - (a->nas_port < b->nas_port);
+}
+
 /*
- *	Lookup a NAS_PORT in the nas_port_list
+ *	Remember where the record for a NAS / port is.  Only the first
+ *	record is remembered, as that's the one a scan would find.
  */
-static NAS_PORT *nas_port_find(NAS_PORT *nas_port_list, uint32_t nasaddr, uint16_t port)
+static void radutmp_index_add(radutmp_index_t *index, unsigned int nas_address, unsigned int nas_port, off_t offset)
 {
-	NAS_PORT	*cl;
+	radutmp_slot_t	*slot, my_slot;
 
-	for(cl = nas_port_list; cl; cl = cl->next) {
-		if (nasaddr == cl->nasaddr &&
-			port == cl->port)
-			break;
+	my_slot.nas_address = nas_address;
+	my_slot.nas_port = nas_port;
+	if (fr_hash_table_find_by_data(index->slots, &my_slot)) return;
+
+	MEM(slot = talloc(index, radutmp_slot_t));
+	*slot = my_slot;
+	slot->offset = offset;
+
+	if (fr_hash_table_insert(index->slots, slot) < 0) talloc_free(slot);
+}
+
+/*
+ *	Index the records which were added to the file since we last
+ *	looked at it.
+ */
+static int radutmp_index_update(radutmp_index_t *index, int fd)
+{
+	struct radutmp	u;
+
+	if (lseek(fd, index->end, SEEK_SET) < 0) return -1;
+
+	while (read(fd, &u, sizeof(u)) == sizeof(u)) {
+		radutmp_index_add(index, u.nas_address, u.nas_port, index->end);
+		index->end += sizeof(u);
+	}
+
+	return 0;
+}
+
+/*
+ *	Find the record for a NAS / port combination.  The file must
+ *	already be locked.
+ *
+ *	Returns -1 on error, 0 if there's no record, and the file is
+ *	positioned at the end.  Or 1 if there is a record, it's
+ *	written to "u", and the file is positioned at the start of it.
+ */
+static int radutmp_index_find(rlm_radutmp_t *inst, request_t *request, int fd, char const *filename,
+			      struct radutmp *u, unsigned int nas_address, unsigned int nas_port, off_t *offset)
+{
+	radutmp_index_t	*index = inst->index;
+	radutmp_slot_t	*slot, my_slot;
+	struct stat	buf;
+	bool		rebuilt = false;
+
+	if (fstat(fd, &buf) < 0) {
+		REDEBUG("Failed reading status of %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Start again if the file isn't the one we indexed.
+	 */
+	if (!index || (strcmp(index->filename, filename) != 0) ||
+	    (index->dev != buf.st_dev) || (index->ino != buf.st_ino) || (buf.st_size < index->end)) {
+	rebuild:
+		talloc_free(inst->index);
+		MEM(index = inst->index = talloc_zero(inst, radutmp_index_t));
+		MEM(index->filename = talloc_typed_strdup(index, filename));
+		MEM(index->slots = fr_hash_table_create(index, radutmp_slot_hash, radutmp_slot_cmp, NULL));
+		index->dev = buf.st_dev;
+		index->ino = buf.st_ino;
+		rebuilt = true;
 	}
 
-	return cl;
+	my_slot.nas_address = nas_address;
+	my_slot.nas_port = nas_port;
+
+	slot = fr_hash_table_find_by_data(index->slots, &my_slot);
+	if (!slot) {
+		if (radutmp_index_update(index, fd) < 0) goto error;
+
+		slot = fr_hash_table_find_by_data(index->slots, &my_slot);
+		if (!slot) {
+			*offset = lseek(fd, 0, SEEK_END);
+			if (*offset < 0) goto error;
+
+			return 0;
+		}
+	}
+
+	/*
+	 *	Check that the record is still the one we think it is.
+	 */
+	if ((pread(fd, u, sizeof(*u), slot->offset) != sizeof(*u)) ||
+	    (u->nas_address != nas_address) || (u->nas_port != nas_port)) {
+		if (rebuilt) {
+			REDEBUG("Record for NAS port %u in %s is inconsistent", nas_port, filename);
+			return -1;
+		}
+
+		RDEBUG2("%s has been changed by someone else, re-reading it", filename);
+		goto rebuild;
+	}
+
+	if (lseek(fd, slot->offset, SEEK_SET) < 0) {
+	error:
+		REDEBUG("Failed seeking in %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+	*offset = slot->offset;
+
+	return 1;
 }
 
 
@@ -189,9 +321,9 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	int			fd = -1;
 	bool			port_seen = false;
 	int			off;
+	off_t			offset;
 	char			ip_name[INET_ADDRSTRLEN]; /* 255.255.255.255 */
 	char const		*nas;
-	NAS_PORT		*cache;
 	int			r;
 
 	char			*filename = NULL;
@@ -417,20 +549,18 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	/*
 	 *	Find the entry for this NAS / portno combination.
 	 */
-	if ((cache = nas_port_find(inst->nas_port_list, ut.nas_address, ut.nas_port)) != NULL) {
-		if (lseek(fd, (off_t)cache->offset, SEEK_SET) < 0) {
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
-		}
+	r = radutmp_index_find(inst, request, fd, filename, &u, ut.nas_address, ut.nas_port, &offset);
+	if (r < 0) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
 	}
 
-	r = 0;
-	off = 0;
-	while (read(fd, &u, sizeof(u)) == sizeof(u)) {
-		off += sizeof(u);
-		if ((u.nas_address != ut.nas_address) || (u.nas_port != ut.nas_port)) {
-			continue;
-		}
+	/*
+	 *	There's only one record for each NAS / port, so
+	 *	"continue" here means "not found".
+	 */
+	if (r > 0) do {
+		r = 0;
 
 		/*
 		 *	Don't compare stop records to unused entries.
@@ -478,38 +608,14 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 			ut.time = u.time;
 		}
 
-		if (lseek(fd, -(off_t)sizeof(u), SEEK_CUR) < 0) {
-			RWDEBUG("negative lseek!");
-			lseek(fd, (off_t)0, SEEK_SET);
-			off = 0;
-		} else {
-			off -= sizeof(u);
-		}
-
 		r = 1;
-		break;
-	} /* read the file until we find a match */
+	} while (0);
 
 	/*
 	 *	Found the entry, do start/update it with
 	 *	the information from the packet.
 	 */
 	if ((r >= 0) && (status == FR_STATUS_START || status == FR_STATUS_ALIVE)) {
-		/*
-		 *	Remember where the entry was, because it's
-		 *	easier than searching through the entire file.
-		 */
-		if (!cache) {
-			cache = talloc_zero(NULL, NAS_PORT);
-			if (cache) {
-				cache->nasaddr = ut.nas_address;
-				cache->port = ut.nas_port;
-				cache->offset = off;
-				cache->next = inst->nas_port_list;
-				inst->nas_port_list = cache;
-			}
-		}
-
 		ut.type = P_LOGIN;
 		if (write(fd, &ut, sizeof(u)) < 0) {
 			REDEBUG("Failed writing: %s", fr_syserror(errno));
@@ -517,6 +623,15 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
+
+		/*
+		 *	Remember where a new entry is, because it's
+		 *	easier than searching through the entire file.
+		 */
+		if ((r == 0) && (offset == inst->index->end)) {
+			radutmp_index_add(inst->index, ut.nas_address, ut.nas_port, offset);
+			inst->index->end += sizeof(ut);
+		}
 	}
 
 	/*
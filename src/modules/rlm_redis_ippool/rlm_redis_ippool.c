@@ -241,15 +241,14 @@ static char lua_alloc_cmd[] =
 	 */
 	"address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ip[1]" EOL			/* 30 */
 	"redis.call('HMSET', address_key, 'device', ARGV[3], 'gateway', ARGV[4])" EOL			/* 31 */
-	"redis.call('SET', owner_key, ip[1])" EOL							/* 32 */
-	"redis.call('EXPIRE', owner_key, ARGV[2])" EOL							/* 33 */
-	"return { " EOL											/* 34 */
-	"  " STRINGIFY(_IPPOOL_RCODE_SUCCESS) "," EOL							/* 35 */
-	"  ip[1], " EOL											/* 36 */
-	"  redis.call('HGET', address_key, 'range'), " EOL						/* 37 */
-	"  tonumber(ARGV[2]), " EOL									/* 38 */
-	"  redis.call('HINCRBY', address_key, 'counter', 1)" EOL					/* 39 */
-	"}" EOL;											/* 40 */
+	"redis.call('SET', owner_key, ip[1], 'EX', ARGV[2])" EOL					/* 32 */
+	"return { " EOL											/* 33 */
+	"  " STRINGIFY(_IPPOOL_RCODE_SUCCESS) "," EOL							/* 34 */
+	"  ip[1], " EOL											/* 35 */
+	"  redis.call('HGET', address_key, 'range'), " EOL						/* 36 */
+	"  tonumber(ARGV[2]), " EOL									/* 37 */
+	"  redis.call('HINCRBY', address_key, 'counter', 1)" EOL					/* 38 */
+	"}" EOL;											/* 39 */
 static char lua_alloc_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
 /** Lua script for updating leases
@@ -305,17 +304,16 @@ static char lua_update_cmd[] =
 	 */
 	"owner_key = '{' .. KEYS[1] .. '}:"IPPOOL_OWNER_KEY":' .. ARGV[4]" EOL	/* 16 */
 	"if redis.call('EXPIRE', owner_key, ARGV[2]) == 0 then" EOL			/* 17 */
-	"  redis.call('SET', owner_key, ARGV[3])" EOL					/* 18 */
-	"  redis.call('EXPIRE', owner_key, ARGV[2])" EOL				/* 19 */
-	"end" EOL									/* 20 */
+	"  redis.call('SET', owner_key, ARGV[3], 'EX', ARGV[2])" EOL			/* 18 */
+	"end" EOL									/* 19 */
 
 	/*
 	 *	Update the gateway address
 	 */
-	"if ARGV[5] ~= found[3] then" EOL						/* 21 */
-	"  redis.call('HSET', address_key, 'gateway', ARGV[5])" EOL			/* 22 */
-	"end" EOL									/* 23 */
-	"return { " STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", found[1], found[4] }"EOL;	/* 24 */
+	"if ARGV[5] ~= found[3] then" EOL						/* 20 */
+	"  redis.call('HSET', address_key, 'gateway', ARGV[5])" EOL			/* 21 */
+	"end" EOL									/* 22 */
+	"return { " STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", found[1], found[4] }"EOL;	/* 23 */
 static char lua_update_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
 /** Lua script for releasing leases
@@ -535,7 +533,7 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 		redisAppendCommand(conn->handle, "EXEC");
 		pipelined = 4;
 		if (wait_num) {
-			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, wait_timeout);
+			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
 			pipelined++;
 		}
 
@@ -578,7 +576,7 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	case 2:	/* EVALSHA with wait */
 		if (ippool_wait_check(request, wait_num, replies[1]) < 0) goto error;
 		fr_redis_reply_free(&replies[1]);	/* Free the wait response */
-		break;
+		FALL_THROUGH;
 
 	case 1:	/* EVALSHA */
 		*out = replies[0];
@@ -0,0 +1,18 @@
+#  This needs to be cleared explicitly, as the libfreeradius-redis.mk
+#  might not always be available, and the TARGETNAME from the previous
+#  target may stick around.
+TARGETNAME	:=
+-include $(top_builddir)/src/lib/redis/all.mk
+
+ifneq "${TARGETNAME}" ""
+  TARGETNAME	:= rlm_redis_simul
+  TARGET        := $(TARGETNAME).a
+endif
+
+SOURCES		:= $(TARGETNAME).c
+
+#
+#  Append SRC_CFLAGS and leave TGT_LDLIBS alone
+#
+SRC_CFLAGS	+= -I$(top_builddir)/src/lib/redis
+TGT_PREREQS	:= libfreeradius-redis.a
@@ -0,0 +1,475 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_redis_simul.c
+ * @brief Simultaneous-Use checking with a redis backend.
+ *
+ * Creates one type of object:
+ * - @verbatim {<key>}:simul @endverbatim (zset) contains the sessions of a user,
+ *	with priority set by the time the session is considered stale.
+ *
+ * Start and Interim-Update packets add or refresh a session, Stop packets
+ * remove it.  Sessions we never see a Stop for expire on their own, as does
+ * the whole zset.  Each operation is a single Lua script, so it's atomic,
+ * and needs only one round trip.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/modpriv.h>
+
+#include <freeradius-devel/radius/radius.h>
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hex.h>
+#include <freeradius-devel/util/sha1.h>
+
+#include <freeradius-devel/redis/base.h>
+#include <freeradius-devel/redis/cluster.h>
+
+#define SIMUL_KEY		"simul"
+#define SIMUL_MAX_KEY_SIZE	256
+
+/** rlm_redis_simul module instance
+ *
+ */
+typedef struct {
+	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
+						//!< Must be first field in this struct.
+
+	char const		*name;		//!< Instance name.
+
+	tmpl_t			*key;		//!< Who the sessions belong to, usually the User-Name.
+
+	tmpl_t			*session_id;	//!< Unique identifier for the session.
+
+	fr_time_delta_t		session_timeout; //!< How long a session lives without an update.
+
+	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
+} rlm_redis_simul_t;
+
+static CONF_PARSER module_config[] = {
+	REDIS_COMMON_CONFIG,
+
+	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_redis_simul_t, key), .dflt = "%{User-Name}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("session_id", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_redis_simul_t, session_id), .dflt = "%{%{NAS-IP-Address}:-%{NAS-IPv6-Address}}:%{Acct-Session-Id}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("session_timeout", FR_TYPE_TIME_DELTA, rlm_redis_simul_t, session_timeout), .dflt = "7200" },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t const *dict_freeradius;
+static fr_dict_t const *dict_radius;
+
+extern fr_dict_autoload_t rlm_redis_simul_dict[];
+fr_dict_autoload_t rlm_redis_simul_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_simultaneous_use;
+static fr_dict_attr_t const *attr_acct_status_type;
+
+extern fr_dict_attr_autoload_t rlm_redis_simul_dict_attr[];
+fr_dict_attr_autoload_t rlm_redis_simul_dict_attr[] = {
+	{ .out = &attr_simultaneous_use, .name = "Simultaneous-Use", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ NULL }
+};
+
+#define EOL "\n"
+
+/** Lua script for counting sessions
+ *
+ * - KEYS[1] The user key.
+ * - ARGV[1] Wall time (seconds since epoch).
+ *
+ * Returns the number of sessions which aren't stale.
+ */
+static char lua_count_cmd[] =
+	"local key = '{' .. KEYS[1] .. '}:"SIMUL_KEY"'" EOL				/* 1 */
+	"redis.call('ZREMRANGEBYSCORE', key, '-inf', ARGV[1])" EOL			/* 2 */
+	"return redis.call('ZCARD', key)" EOL;						/* 3 */
+static char lua_count_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
+
+/** Lua script for adding or refreshing a session
+ *
+ * - KEYS[1] The user key.
+ * - ARGV[1] Wall time (seconds since epoch).
+ * - ARGV[2] Session timeout (seconds).
+ * - ARGV[3] Session identifier.
+ *
+ * The zset expires when its newest session does, so users
+ * whose NAS never sends a Stop don't leave anything behind.
+ *
+ * Returns the number of sessions which aren't stale.
+ */
+static char lua_update_cmd[] =
+	"local key = '{' .. KEYS[1] .. '}:"SIMUL_KEY"'" EOL				/* 1 */
+	"redis.call('ZREMRANGEBYSCORE', key, '-inf', ARGV[1])" EOL			/* 2 */
+	"redis.call('ZADD', key, ARGV[1] + ARGV[2], ARGV[3])" EOL			/* 3 */
+	"redis.call('EXPIRE', key, ARGV[2])" EOL					/* 4 */
+	"return redis.call('ZCARD', key)" EOL;						/* 5 */
+static char lua_update_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
+
+/** Lua script for removing a session
+ *
+ * - KEYS[1] The user key.
+ * - ARGV[1] Wall time (seconds since epoch).
+ * - ARGV[2] Session identifier.
+ *
+ * Returns the number of sessions which aren't stale.
+ */
+static char lua_stop_cmd[] =
+	"local key = '{' .. KEYS[1] .. '}:"SIMUL_KEY"'" EOL				/* 1 */
+	"redis.call('ZREM', key, ARGV[2])" EOL						/* 2 */
+	"redis.call('ZREMRANGEBYSCORE', key, '-inf', ARGV[1])" EOL			/* 3 */
+	"return redis.call('ZCARD', key)" EOL;						/* 4 */
+static char lua_stop_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
+
+/** Execute a script against Redis cluster
+ *
+ * Handles uploading the script to the server if required.
+ *
+ * @param[out] out		Number of sessions the user has.
+ * @param[in] request		The current request.
+ * @param[in] cluster		configuration.
+ * @param[in] key		to use to determine the cluster node.
+ * @param[in] key_len		length of the key.
+ * @param[in] digest		of script.
+ * @param[in] script		to upload.
+ * @param[in] cmd		EVALSHA command to execute.
+ * @param[in] ...		Arguments for the eval command.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int simul_script(int64_t *out, request_t *request, fr_redis_cluster_t *cluster,
+			uint8_t const *key, size_t key_len,
+			char const digest[], char const *script,
+			char const *cmd, ...)
+{
+	fr_redis_conn_t			*conn;
+	redisReply			*replies[4];	/* Must be equal to the maximum number of pipelined commands */
+	redisReply			*reply;
+	size_t				reply_cnt = 0;
+
+	fr_redis_cluster_state_t	state;
+	fr_redis_rcode_t		s_ret, status;
+	unsigned int			pipelined = 0;
+	int				ret = -1;
+
+	va_list				ap;
+
+#ifndef NDEBUG
+	memset(replies, 0, sizeof(replies));
+#endif
+
+	va_start(ap, cmd);
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
+	     	va_list	copy;
+
+	     	RDEBUG3("Calling script 0x%s", digest);
+	     	va_copy(copy, ap);	/* copy or segv */
+		redisvAppendCommand(conn->handle, cmd, copy);
+		va_end(copy);
+		pipelined = 1;
+		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
+						     replies, NUM_ELEMENTS(replies),
+						     conn);
+		if (status != REDIS_RCODE_NO_SCRIPT) continue;
+
+		/*
+		 *	Clear out the existing reply
+		 */
+		fr_redis_pipeline_free(replies, reply_cnt);
+
+		/*
+		 *	Last command failed with NOSCRIPT, this means
+		 *	we have to send the Lua script up to the node
+		 *	so it can be cached.
+		 */
+	     	RDEBUG3("Loading script 0x%s", digest);
+		redisAppendCommand(conn->handle, "MULTI");
+		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
+	     	va_copy(copy, ap);	/* copy or segv */
+		redisvAppendCommand(conn->handle, cmd, copy);
+		va_end(copy);
+		redisAppendCommand(conn->handle, "EXEC");
+		pipelined = 4;
+
+		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
+						     replies, NUM_ELEMENTS(replies),
+						     conn);
+	}
+	va_end(ap);
+
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		RERROR("Failed calling script");
+		goto finish;
+	}
+
+	switch (reply_cnt) {
+	case 1:	/* EVALSHA */
+		reply = replies[0];
+		break;
+
+	case 4: /* LOADSCRIPT + EVALSHA */
+		if ((replies[3]->type != REDIS_REPLY_ARRAY) || (replies[3]->elements != 2)) {
+			REDEBUG("Bad response to EXEC, expected array of 2 elements, got %s",
+				fr_table_str_by_value(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
+			goto finish;
+		}
+		reply = replies[3]->element[1];
+		break;
+
+	default:
+		REDEBUG("Unexpected number of replies (%zu)", reply_cnt);
+		goto finish;
+	}
+
+	fr_redis_reply_print(L_DBG_LVL_3, reply, request, 0);
+
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		REDEBUG("Expected result to be integer, got %s",
+			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		goto finish;
+	}
+
+	*out = reply->integer;
+	ret = 0;
+
+finish:
+	fr_redis_pipeline_free(replies, reply_cnt);
+
+	return ret;
+}
+
+/** Expand the user key
+ *
+ */
+static ssize_t simul_key(uint8_t const **out, char *buff, size_t bufflen,
+			 rlm_redis_simul_t const *inst, request_t *request)
+{
+	ssize_t slen;
+
+	slen = tmpl_expand((char const **)out, buff, bufflen, request, inst->key, NULL, NULL);
+	if (slen < 0) {
+		REDEBUG("Failed expanding key (%s)", inst->key->name);
+		return -1;
+	}
+	if (slen == 0) {
+		RDEBUG2("Empty key, not tracking sessions");
+		return 0;
+	}
+
+	return slen;
+}
+
+/** Check the number of sessions against Simultaneous-Use
+ *
+ */
+static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_redis_simul_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_redis_simul_t);
+	fr_pair_t		*vp;
+	uint8_t const		*key;
+	char			key_buff[SIMUL_MAX_KEY_SIZE];
+	ssize_t			key_len;
+	int64_t			count;
+
+	vp = fr_pair_find_by_da(&request->control_pairs, attr_simultaneous_use);
+	if (!vp) RETURN_MODULE_NOOP;
+
+	key_len = simul_key(&key, key_buff, sizeof(key_buff), inst, request);
+	if (key_len < 0) RETURN_MODULE_FAIL;
+	if (key_len == 0) RETURN_MODULE_NOOP;
+
+	if (simul_script(&count, request, inst->cluster, key, key_len,
+			 lua_count_digest, lua_count_cmd,
+			 "EVALSHA %s 1 %b %u",
+			 lua_count_digest,
+			 key, (size_t)key_len,
+			 (unsigned int)fr_time_to_sec(fr_time())) < 0) RETURN_MODULE_FAIL;
+
+	if (count >= vp->vp_uint32) {
+		REDEBUG("User already has %" PRId64 " session(s), limit is %u", count, vp->vp_uint32);
+		RETURN_MODULE_REJECT;
+	}
+
+	RDEBUG2("User has %" PRId64 " session(s), limit is %u", count, vp->vp_uint32);
+
+	RETURN_MODULE_OK;
+}
+
+/** Add, refresh, or remove a session
+ *
+ */
+static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_redis_simul_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_redis_simul_t);
+	fr_pair_t		*vp;
+	uint8_t const		*key;
+	char			key_buff[SIMUL_MAX_KEY_SIZE];
+	ssize_t			key_len;
+	char const		*session_id;
+	char			session_id_buff[256];
+	ssize_t			session_id_len;
+	unsigned int		now;
+	int64_t			count;
+	int			ret;
+
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_acct_status_type);
+	if (!vp) {
+		RDEBUG2("Could not find account status type in packet");
+		RETURN_MODULE_NOOP;
+	}
+
+	switch (vp->vp_uint32) {
+	case FR_STATUS_START:
+	case FR_STATUS_ALIVE:
+	case FR_STATUS_STOP:
+		break;
+
+	/*
+	 *	We can't find the sessions on a NAS without
+	 *	scanning everything.  They'll be expired
+	 *	instead.
+	 */
+	default:
+		RETURN_MODULE_NOOP;
+	}
+
+	key_len = simul_key(&key, key_buff, sizeof(key_buff), inst, request);
+	if (key_len < 0) RETURN_MODULE_FAIL;
+	if (key_len == 0) RETURN_MODULE_NOOP;
+
+	session_id_len = tmpl_expand(&session_id, session_id_buff, sizeof(session_id_buff),
+				     request, inst->session_id, NULL, NULL);
+	if (session_id_len < 0) {
+		REDEBUG("Failed expanding session_id (%s)", inst->session_id->name);
+		RETURN_MODULE_FAIL;
+	}
+
+	now = (unsigned int)fr_time_to_sec(fr_time());
+
+	if (vp->vp_uint32 == FR_STATUS_STOP) {
+		ret = simul_script(&count, request, inst->cluster, key, key_len,
+				   lua_stop_digest, lua_stop_cmd,
+				   "EVALSHA %s 1 %b %u %b",
+				   lua_stop_digest,
+				   key, (size_t)key_len,
+				   now,
+				   session_id, (size_t)session_id_len);
+	} else {
+		ret = simul_script(&count, request, inst->cluster, key, key_len,
+				   lua_update_digest, lua_update_cmd,
+				   "EVALSHA %s 1 %b %u %u %b",
+				   lua_update_digest,
+				   key, (size_t)key_len,
+				   now, (unsigned int)fr_time_delta_to_sec(inst->session_timeout),
+				   session_id, (size_t)session_id_len);
+	}
+	if (ret < 0) RETURN_MODULE_FAIL;
+
+	RDEBUG2("User now has %" PRId64 " session(s)", count);
+
+	RETURN_MODULE_UPDATED;
+}
+
+static void simul_digest(char *out, size_t outlen, char const *script, size_t script_len)
+{
+	fr_sha1_ctx	sha1_ctx;
+	uint8_t		digest[SHA1_DIGEST_LENGTH];
+
+	fr_sha1_init(&sha1_ctx);
+	fr_sha1_update(&sha1_ctx, (uint8_t const *)script, script_len);
+	fr_sha1_final(digest, &sha1_ctx);
+	fr_bin2hex(&FR_SBUFF_OUT(out, outlen), &FR_DBUFF_TMP(digest, sizeof(digest)), SIZE_MAX);
+}
+
+static int mod_bootstrap(void *instance, CONF_SECTION *conf)
+{
+	rlm_redis_simul_t *inst = instance;
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	FR_TIME_DELTA_BOUND_CHECK("session_timeout", inst->session_timeout, >=, fr_time_delta_from_sec(1));
+
+	return 0;
+}
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	static bool		done_hash = false;
+	rlm_redis_simul_t	*inst = instance;
+
+	inst->cluster = fr_redis_cluster_alloc(inst, conf, &inst->conf, true, NULL, NULL, NULL);
+	if (!inst->cluster) return -1;
+
+	/*
+	 *	Needed for EVALSHA.
+	 */
+	if (!fr_redis_cluster_min_version(inst->cluster, "2.6.0")) {
+		PERROR("Cluster error");
+		return -1;
+	}
+
+	/*
+	 *	Pre-Compute the SHA1 hashes of the Lua scripts
+	 */
+	if (!done_hash) {
+		simul_digest(lua_count_digest, sizeof(lua_count_digest), lua_count_cmd, sizeof(lua_count_cmd) - 1);
+		simul_digest(lua_update_digest, sizeof(lua_update_digest), lua_update_cmd, sizeof(lua_update_cmd) - 1);
+		simul_digest(lua_stop_digest, sizeof(lua_stop_digest), lua_stop_cmd, sizeof(lua_stop_cmd) - 1);
+		done_hash = true;
+	}
+
+	return 0;
+}
+
+static int mod_load(void)
+{
+	fr_redis_version_print();
+
+	return 0;
+}
+
+extern module_t rlm_redis_simul;
+module_t rlm_redis_simul = {
+	.magic		= RLM_MODULE_INIT,
+	.name		= "redis_simul",
+	.type		= RLM_TYPE_THREAD_SAFE,
+	.inst_size	= sizeof(rlm_redis_simul_t),
+	.config		= module_config,
+	.onload		= mod_load,
+	.bootstrap	= mod_bootstrap,
+	.instantiate	= mod_instantiate,
+	.methods = {
+		[MOD_AUTHORIZE]		= mod_authorize,
+		[MOD_ACCOUNTING]	= mod_accounting
+	},
+};
@@ -1221,6 +1221,127 @@ static int rest_decode_json(rlm_rest_t const *instance, rlm_rest_section_t const
 
 	return ret;
 }
+
+/** Incremental JSON decoder state
+ *
+ * Stored in rlm_rest_response_t.decoder, when JSON bodies are parsed
+ * as they're received, instead of being buffered.
+ */
+typedef struct {
+	json_tokener		*tok;		//!< Incremental parser.
+	json_object		*json;		//!< Root object, once parsing is complete.
+	size_t			len;		//!< How much body data we've received.
+	bool			started;	//!< Whether we've seen any non-whitespace data.
+	bool			failed;		//!< Whether parsing failed.
+} rest_json_decoder_t;
+
+static int _rest_json_decoder_free(rest_json_decoder_t *dec)
+{
+	if (dec->tok) json_tokener_free(dec->tok);
+	if (dec->json) json_object_put(dec->json);
+
+	return 0;
+}
+
+/** Whether we should parse a JSON body as it's received
+ *
+ * We only do this where the body will be decoded, and the raw
+ * data isn't needed for anything else.  The xlat returns the raw
+ * body, error responses are printed, and so is everything at debug
+ * level 3.
+ */
+static bool rest_json_stream(rlm_rest_response_t *ctx)
+{
+	request_t *request = ctx->request; /* Used by RDEBUG */
+
+	if (ctx->decoder) return true;
+	if (ctx->buffer) return false;
+
+	if (RDEBUG_ENABLED3) return false;
+	if (ctx->section->name && (strcmp(ctx->section->name, "xlat") == 0)) return false;
+
+	return ((ctx->code >= 200) && (ctx->code < 300)) || (ctx->code == 401);
+}
+
+/** Feed incoming JSON body data to the incremental parser
+ *
+ */
+static void rest_response_body_json(rlm_rest_response_t *ctx, char const *p, char const *end)
+{
+	request_t		*request = ctx->request; /* Used by RDEBUG */
+	rest_json_decoder_t	*dec = ctx->decoder;
+	json_object		*json;
+	enum json_tokener_error	jerr;
+
+	if (!dec) {
+		MEM(dec = talloc_zero(NULL, rest_json_decoder_t));
+		talloc_set_destructor(dec, _rest_json_decoder_free);
+		MEM(dec->tok = json_tokener_new());
+		ctx->decoder = dec;
+	}
+
+	/*
+	 *  Anything after the root object is ignored, as it
+	 *  is with json_tokener_parse().
+	 */
+	if (dec->failed || dec->json) return;
+
+	dec->len += (end - p);
+	if ((ctx->section->max_body_in > 0) && (dec->len > ctx->section->max_body_in)) {
+		REDEBUG("Incoming data (%zu bytes) exceeds max_body_in (%zu bytes)",
+			dec->len, ctx->section->max_body_in);
+		dec->failed = true;
+		return;
+	}
+
+	if (!dec->started) {
+		while ((p < end) && isspace((uint8_t) *p)) p++;
+		if (p == end) return;
+		dec->started = true;
+	}
+
+	json = json_tokener_parse_ex(dec->tok, p, end - p);
+	if (json) {
+		dec->json = json;
+		return;
+	}
+
+	jerr = json_tokener_get_error(dec->tok);
+	if (jerr != json_tokener_continue) {
+		REDEBUG("Malformed JSON data: %s", json_tokener_error_desc(jerr));
+		dec->failed = true;
+	}
+}
+
+/** Converts JSON which was parsed as it was received into #fr_pair_t
+ *
+ * @param[in] instance	configuration data.
+ * @param[in] section	configuration data.
+ * @param[in] request	Current request.
+ * @param[in] decoder	#rest_json_decoder_t holding the parsed JSON.
+ * @return
+ *	- The number of #fr_pair_t processed.
+ *	- -1 on unrecoverable error.
+ */
+static int rest_decode_json_stream(rlm_rest_t const *instance, rlm_rest_section_t const *section,
+				   request_t *request, void *decoder)
+{
+	rest_json_decoder_t *dec = talloc_get_type_abort(decoder, rest_json_decoder_t);
+
+	if (dec->failed) return -1;
+
+	/*
+	 *  Empty response?
+	 */
+	if (!dec->started) return 0;
+
+	if (!dec->json) {
+		REDEBUG("Malformed JSON data, body ended before the root object was complete");
+		return -1;
+	}
+
+	return json_pair_alloc(instance, section, request, dec->json, 0, REST_BODY_MAX_ATTRS);
+}
 #endif
 
 /** Processes incoming HTTP header data from libcurl.
@@ -1496,6 +1617,15 @@ static size_t rest_response_body(void *in, size_t size, size_t nmemb, void *user
 		if (p != end) RDEBUG3("%pV", fr_box_strvalue_len(p, end - p));
 		break;
 
+#ifdef HAVE_JSON
+	case REST_HTTP_BODY_JSON:
+		if (rest_json_stream(ctx)) {
+			rest_response_body_json(ctx, p, end);
+			break;
+		}
+		FALL_THROUGH;
+#endif
+
 	default:
 	{
 		char *out_p;
@@ -1600,6 +1730,7 @@ static void rest_response_init(rlm_rest_section_t const *section,
 	ctx->alloc = 0;
 	ctx->used = 0;
 	TALLOC_FREE(ctx->buffer);
+	TALLOC_FREE(ctx->decoder);
 }
 
 /** Extracts pointer to buffer containing response data
@@ -1743,6 +1874,16 @@ int rest_request_config(rlm_rest_t const *inst, rlm_rest_thread_t *t, rlm_rest_s
 	 */
 	if (inst->http_negotiation != CURL_HTTP_VERSION_NONE) FR_CURL_SET_OPTION(CURLOPT_HTTP_VERSION, inst->http_negotiation);
 
+#ifdef CURLPIPE_MULTIPLEX
+	/*
+	 *	Wait for an existing connection to be confirmed as
+	 *	capable of multiplexing, instead of opening a new
+	 *	connection (and doing a new TLS handshake) for every
+	 *	request which arrives while the first is connecting.
+	 */
+	if (inst->multiplex) FR_CURL_SET_OPTION(CURLOPT_PIPEWAIT, 1L);
+#endif
+
 	/*
 	 *	Setup any header options and generic headers.
 	 */
@@ -2063,7 +2204,7 @@ int rest_response_decode(rlm_rest_t const *instance, rlm_rest_section_t const *s
 
 	int ret = -1;	/* -Wsometimes-uninitialized */
 
-	if (!ctx->response.buffer) {
+	if (!ctx->response.buffer && !ctx->response.decoder) {
 		RDEBUG2("Skipping attribute processing, no valid body data received");
 		return 0;
 	}
@@ -2082,6 +2223,10 @@ int rest_response_decode(rlm_rest_t const *instance, rlm_rest_section_t const *s
 
 #ifdef HAVE_JSON
 	case REST_HTTP_BODY_JSON:
+		if (ctx->response.decoder) {
+			ret = rest_decode_json_stream(instance, section, request, ctx->response.decoder);
+			break;
+		}
 		ret = rest_decode_json(instance, section, request, randle, ctx->response.buffer, ctx->response.used);
 		break;
 #endif
@@ -156,6 +156,9 @@ typedef struct {
 	bool			multiplex;	//!< Whether to perform multiple requests using a single
 						///< connection.
 
+	uint32_t		max_connections; //!< Maximum number of connections per host, per thread.
+						///< 0 means no limit.
+
 	fr_pool_t		*pool;		//!< Pointer to the connection pool.
 
 	rlm_rest_section_t	xlat;		//!< Configuration specific to xlat.
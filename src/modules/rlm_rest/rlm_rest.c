@@ -114,6 +114,7 @@ static const CONF_PARSER module_config[] = {
 #ifdef CURLPIPE_MULTIPLEX
 	{ FR_CONF_OFFSET("multiplex", FR_TYPE_BOOL, rlm_rest_t, multiplex), .dflt = "yes" },
 #endif
+	{ FR_CONF_OFFSET("max_connections", FR_TYPE_UINT32, rlm_rest_t, max_connections), .dflt = "0" },
 
 #ifndef NDEBUG
 	{ FR_CONF_OFFSET("fail_header_decode", FR_TYPE_BOOL, rlm_rest_t, fail_header_decode), .dflt = "no" },
@@ -1047,7 +1048,13 @@ static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_e
 		return -1;
 	}
 
-	mhandle = fr_curl_io_init(t, el, inst->multiplex);
+	/*
+	 *	Bound the number of connections to each upstream
+	 *	server.  Transfers over the limit are queued by
+	 *	libcurl until a connection becomes available, or
+	 *	with HTTP/2, are multiplexed over an existing one.
+	 */
+	mhandle = fr_curl_io_shared_init(el, inst->multiplex, (long)inst->max_connections);
 	if (!mhandle) return -1;
 
 	t->mhandle = mhandle;
@@ -1068,7 +1075,7 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_rest_thread_t	*t = thread;
 
-	talloc_free(t->mhandle);	/* Ensure this is shutdown before the pool */
+	fr_curl_io_shared_free(t->mhandle);	/* Ensure this is shutdown before the pool */
 	fr_pool_free(t->pool);
 
 	return 0;
@@ -1023,7 +1023,7 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instanc
 
 	t->inst = instance;
 
-	mhandle = fr_curl_io_init(t, el, false);
+	mhandle = fr_curl_io_shared_init(el, false, 0);
 	if (!mhandle) return -1;
 
 	t->mhandle = mhandle;
@@ -1036,7 +1036,7 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instanc
 static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_smtp_thread_t    *t = thread;
-	talloc_free(t->mhandle);
+	fr_curl_io_shared_free(t->mhandle);
 	return 0;
 }
 
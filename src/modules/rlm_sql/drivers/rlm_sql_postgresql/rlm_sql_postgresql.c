@@ -56,6 +56,13 @@ RCSID("$Id$")
 #  define NAMEDATALEN 64
 #endif
 
+/*
+ *	Prepared statements use memory on the server, so limit how
+ *	many each connection keeps.  Queries beyond that are still
+ *	sent with their parameters, but planned every time.
+ */
+#define PG_MAX_STATEMENTS	(256)
+
 /** PostgreSQL configuration
  *
  */
@@ -72,8 +79,19 @@ typedef struct {
 	int		num_fields;
 	int		affected_rows;
 	char		**row;
+
+	fr_hash_table_t	*statements;		//!< Prepared statements, keyed by query.
+	uint32_t	statement_id;		//!< Used to name the next prepared statement.
 } rlm_sql_postgres_conn_t;
 
+/** A statement prepared on a connection
+ *
+ */
+typedef struct {
+	char const	*query;			//!< Text of the query, with placeholders.
+	char		name[NAMEDATALEN];	//!< Name of the statement on the server.
+} rlm_sql_postgres_statement_t;
+
 static CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("send_application_name", FR_TYPE_BOOL, rlm_sql_postgres_t, send_application_name), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
@@ -225,6 +243,20 @@ static int _sql_socket_destructor(rlm_sql_postgres_conn_t *conn)
 	return 0;
 }
 
+static uint32_t statement_hash(void const *data)
+{
+	rlm_sql_postgres_statement_t const *statement = data;
+
+	return fr_hash_string(statement->query);
+}
+
+static int statement_cmp(void const *one, void const *two)
+{
+	rlm_sql_postgres_statement_t const *a = one, *b = two;
+
+	return strcmp(a->query, b->query);
+}
+
 static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
 					    UNUSED fr_time_delta_t timeout)
 {
@@ -233,6 +265,7 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 
 	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_postgres_conn_t));
 	talloc_set_destructor(conn, _sql_socket_destructor);
+	MEM(conn->statements = fr_hash_table_create(conn, statement_hash, statement_cmp, NULL));
 
 	DEBUG2("Connecting using parameters: %s", inst->db_string);
 	conn->db = PQconnectdb(inst->db_string);
@@ -254,33 +287,15 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
-					      char const *query)
+/** Wait for the result of the command we sent, and store it in conn->result
+ *
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_result_wait(rlm_sql_postgres_conn_t *conn, rlm_sql_config_t *config,
+						    int sockfd)
 {
-	rlm_sql_postgres_conn_t	*conn = handle->conn;
-	rlm_sql_postgres_t	*inst = config->driver;
 	fr_time_delta_t		timeout = fr_time_delta_from_sec(config->query_timeout);
 	fr_time_t		start;
-	int			sockfd;
 	PGresult		*tmp_result;
-	int			numfields = 0;
-	ExecStatusType		status;
-
-	if (!conn->db) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	sockfd = PQsocket(conn->db);
-	if (sockfd < 0) {
-		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
-	if (!PQsendQuery(conn->db, query)) {
-		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
 
 	/*
 	 *  We try to avoid blocking by waiting until the driver indicates that
@@ -341,6 +356,103 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 		return RLM_SQL_RECONNECT;
 	}
 
+	return RLM_SQL_OK;
+}
+
+/** Send a query with parameters, preparing it first if we haven't already
+ *
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_send_prepared(rlm_sql_postgres_t *inst, rlm_sql_postgres_conn_t *conn,
+						      rlm_sql_config_t *config, int sockfd,
+						      char const *query, rlm_sql_params_t const *params)
+{
+	rlm_sql_postgres_statement_t	*statement, find = { .query = query };
+	ExecStatusType			status;
+	sql_rcode_t			rcode;
+
+	statement = fr_hash_table_find_by_data(conn->statements, &find);
+	if (!statement) {
+		if (fr_hash_table_num_elements(conn->statements) >= PG_MAX_STATEMENTS) {
+			if (!PQsendQueryParams(conn->db, query, params->num, NULL, params->values, NULL, NULL, 0)) {
+				ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+				return RLM_SQL_RECONNECT;
+			}
+			return RLM_SQL_OK;
+		}
+
+		MEM(statement = talloc_zero(conn, rlm_sql_postgres_statement_t));
+		MEM(statement->query = talloc_strdup(statement, query));
+		snprintf(statement->name, sizeof(statement->name), "freeradius_%u", conn->statement_id++);
+
+		if (!PQsendPrepare(conn->db, statement->name, query, params->num, NULL)) {
+			ERROR("Failed to prepare query: %s", PQerrorMessage(conn->db));
+			talloc_free(statement);
+			return RLM_SQL_RECONNECT;
+		}
+
+		rcode = sql_result_wait(conn, config, sockfd);
+		if (rcode != RLM_SQL_OK) {
+			talloc_free(statement);
+			return rcode;
+		}
+
+		/*
+		 *	Leave the result for sql_error() and
+		 *	sql_free_result() if preparing failed.
+		 */
+		status = PQresultStatus(conn->result);
+		if (status != PGRES_COMMAND_OK) {
+			talloc_free(statement);
+			return sql_classify_error(inst, status, conn->result);
+		}
+		PQclear(conn->result);
+		conn->result = NULL;
+
+		DEBUG3("Prepared statement %s", statement->name);
+		fr_hash_table_insert(conn->statements, statement);
+	}
+
+	if (!PQsendQueryPrepared(conn->db, statement->name, params->num, params->values, NULL, NULL, 0)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return RLM_SQL_OK;
+}
+
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	rlm_sql_postgres_t	*inst = config->driver;
+	int			sockfd;
+	int			numfields = 0;
+	ExecStatusType		status;
+	sql_rcode_t		rcode;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	sockfd = PQsocket(conn->db);
+	if (sockfd < 0) {
+		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (handle->params) {
+		rcode = sql_send_prepared(inst, conn, config, sockfd, query, handle->params);
+		if (rcode != RLM_SQL_OK) return rcode;
+
+	} else if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	rcode = sql_result_wait(conn, config, sockfd);
+	if (rcode != RLM_SQL_OK) return rcode;
+
 	status = PQresultStatus(conn->result);
 	switch (status){
 	/*
@@ -672,5 +784,6 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.placeholder			= "$%u"
 };
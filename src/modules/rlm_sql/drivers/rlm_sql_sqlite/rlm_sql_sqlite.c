@@ -49,12 +49,29 @@ RCSID("$Id$")
 typedef sqlite_int64 sqlite3_int64;
 #endif
 
+/*
+ *	Limit how many prepared statements each connection keeps.
+ */
+#define SQLITE_MAX_STATEMENTS	(256)
+
 typedef struct {
 	sqlite3 *db;
 	sqlite3_stmt *statement;
 	int col_count;
+
+	fr_hash_table_t *statements;		//!< Prepared statements, keyed by query.
+	bool cached;				//!< statement is in statements, so should be reset
+						///< instead of finalized.
 } rlm_sql_sqlite_conn_t;
 
+/** A statement prepared on a connection
+ *
+ */
+typedef struct {
+	char const	*query;			//!< Text of the query, with placeholders.
+	sqlite3_stmt	*statement;
+} rlm_sql_sqlite_statement_t;
+
 typedef struct {
 	char const	*filename;
 	uint32_t	busy_timeout;
@@ -385,6 +402,14 @@ static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 
 	DEBUG2("Socket destructor called, closing socket");
 
+	/*
+	 *	The database can't be closed until all of its
+	 *	statements have been finalized.
+	 */
+	if (conn->statement && !conn->cached) (void) sqlite3_finalize(conn->statement);
+	conn->statement = NULL;
+	TALLOC_FREE(conn->statements);
+
 	if (conn->db) {
 		status = sqlite3_close(conn->db);
 		if (status != SQLITE_OK) WARN("Got SQLite error when closing socket: %s",
@@ -394,6 +419,27 @@ static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 	return 0;
 }
 
+static int _sql_statement_free(rlm_sql_sqlite_statement_t *statement)
+{
+	(void) sqlite3_finalize(statement->statement);
+
+	return 0;
+}
+
+static uint32_t statement_hash(void const *data)
+{
+	rlm_sql_sqlite_statement_t const *statement = data;
+
+	return fr_hash_string(statement->query);
+}
+
+static int statement_cmp(void const *one, void const *two)
+{
+	rlm_sql_sqlite_statement_t const *a = one, *b = two;
+
+	return strcmp(a->query, b->query);
+}
+
 static void _sql_greatest(sqlite3_context *ctx, int num_values, sqlite3_value **values)
 {
 	int i;
@@ -419,6 +465,7 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 
 	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_sqlite_conn_t));
 	talloc_set_destructor(conn, _sql_socket_destructor);
+	MEM(conn->statements = fr_hash_table_create(conn, statement_hash, statement_cmp, NULL));
 
 	INFO("Opening SQLite database \"%s\"", inst->filename);
 #ifdef HAVE_SQLITE3_OPEN_V2
@@ -463,21 +510,62 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return RLM_SQL_OK;
 }
 
-static sql_rcode_t sql_select_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+/** Prepare a query, and bind its parameters
+ *
+ * Queries with parameters are kept, and reused the next time
+ * the same query is run on this connection.
+ */
+static sql_rcode_t sql_prepare(rlm_sql_handle_t *handle, char const *query)
 {
-	rlm_sql_sqlite_conn_t	*conn = handle->conn;
-	char const		*z_tail;
-	int			status;
+	rlm_sql_sqlite_conn_t		*conn = handle->conn;
+	rlm_sql_params_t const		*params = handle->params;
+	rlm_sql_sqlite_statement_t	*statement, find = { .query = query };
+	sqlite3_stmt			*prepared;
+	char const			*z_tail;
+	int				status;
+	unsigned int			i;
+
+	conn->col_count = 0;
+	conn->cached = false;
+
+	if (params) {
+		statement = fr_hash_table_find_by_data(conn->statements, &find);
+		if (statement) {
+			conn->statement = statement->statement;
+			conn->cached = true;
+			goto bind;
+		}
+	}
 
 #ifdef HAVE_SQLITE3_PREPARE_V2
-	status = sqlite3_prepare_v2(conn->db, query, strlen(query), &conn->statement, &z_tail);
+	status = sqlite3_prepare_v2(conn->db, query, strlen(query), &prepared, &z_tail);
 #else
-	status = sqlite3_prepare(conn->db, query, strlen(query), &conn->statement, &z_tail);
+	status = sqlite3_prepare(conn->db, query, strlen(query), &prepared, &z_tail);
 #endif
+	conn->statement = prepared;
+	if (!params || (status != SQLITE_OK)) return sql_check_error(conn->db, status);
+
+	if (fr_hash_table_num_elements(conn->statements) < SQLITE_MAX_STATEMENTS) {
+		MEM(statement = talloc_zero(conn->statements, rlm_sql_sqlite_statement_t));
+		MEM(statement->query = talloc_strdup(statement, query));
+		statement->statement = prepared;
+		talloc_set_destructor(statement, _sql_statement_free);
+		fr_hash_table_insert(conn->statements, statement);
+		conn->cached = true;
+	}
 
-	conn->col_count = 0;
+bind:
+	for (i = 0; i < params->num; i++) {
+		status = sqlite3_bind_text(conn->statement, i + 1, params->values[i], -1, SQLITE_TRANSIENT);
+		if (status != SQLITE_OK) return sql_check_error(conn->db, status);
+	}
 
-	return sql_check_error(conn->db, status);
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t sql_select_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+{
+	return sql_prepare(handle, query);
 }
 
 
@@ -486,15 +574,9 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 
 	sql_rcode_t		rcode;
 	rlm_sql_sqlite_conn_t	*conn = handle->conn;
-	char const		*z_tail;
 	int			status;
 
-#ifdef HAVE_SQLITE3_PREPARE_V2
-	status = sqlite3_prepare_v2(conn->db, query, strlen(query), &conn->statement, &z_tail);
-#else
-	status = sqlite3_prepare(conn->db, query, strlen(query), &conn->statement, &z_tail);
-#endif
-	rcode = sql_check_error(conn->db, status);
+	rcode = sql_prepare(handle, query);
 	if (rcode != RLM_SQL_OK) return rcode;
 
 	status = sqlite3_step(conn->statement);
@@ -621,8 +703,14 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_conf
 	if (conn->statement) {
 		TALLOC_FREE(handle->row);
 
-		(void) sqlite3_finalize(conn->statement);
+		if (conn->cached) {
+			(void) sqlite3_reset(conn->statement);
+			(void) sqlite3_clear_bindings(conn->statement);
+		} else {
+			(void) sqlite3_finalize(conn->statement);
+		}
 		conn->statement = NULL;
+		conn->cached = false;
 		conn->col_count = 0;
 	}
 
@@ -821,5 +909,6 @@ rlm_sql_driver_t rlm_sql_sqlite = {
 	.sql_free_result		= sql_free_result,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
-	.sql_finish_select_query	= sql_finish_query
+	.sql_finish_select_query	= sql_finish_query,
+	.placeholder			= "?%u"
 };
@@ -110,6 +110,13 @@ static const CONF_PARSER module_config[] = {
 	 */
 	{ FR_CONF_OFFSET("query_timeout", FR_TYPE_UINT32, rlm_sql_config_t, query_timeout) },
 
+	/*
+	 *	...as does this.
+	 */
+	{ FR_CONF_OFFSET("bind_parameters", FR_TYPE_BOOL, rlm_sql_config_t, bind_parameters), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("read_replica", FR_TYPE_STRING | FR_TYPE_MULTI, rlm_sql_config_t, read_replica) },
+
 	{ FR_CONF_POINTER("accounting", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
@@ -691,8 +698,8 @@ static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, r
 	entry = *phead = NULL;
 
 	if (!inst->config->groupmemb_query || !*inst->config->groupmemb_query) return 0;
-	if (xlat_aeval(request, &expanded, request, inst->config->groupmemb_query,
-			 inst->sql_escape_func, *handle) < 0) return -1;
+	if (sql_query_expand(request, &expanded, inst, request, *handle,
+			     inst->config->groupmemb_query) < 0) return -1;
 
 	ret = rlm_sql_select_query(inst, request, handle, expanded);
 	talloc_free(expanded);
@@ -738,6 +745,7 @@ static int sql_groupcmp(void *instance, request_t *request, UNUSED fr_pair_list_
 			fr_pair_t *check, UNUSED fr_pair_list_t *check_list)
 {
 	rlm_sql_handle_t	*handle;
+	fr_pool_t		*pool;
 	rlm_sql_t const		*inst = talloc_get_type_abort_const(instance, rlm_sql_t);
 	rlm_sql_grouplist_t	*head, *entry;
 
@@ -765,7 +773,7 @@ static int sql_groupcmp(void *instance, request_t *request, UNUSED fr_pair_list_
 	/*
 	 *	Get a socket for this lookup
 	 */
-	handle = fr_pool_connection_get(inst->pool, request);
+	handle = sql_read_handle_get(&pool, inst, request);
 	if (!handle) {
 		return 1;
 	}
@@ -775,7 +783,7 @@ static int sql_groupcmp(void *instance, request_t *request, UNUSED fr_pair_list_
 	 */
 	if (sql_get_grouplist(inst, &handle, request, &head) < 0) {
 		REDEBUG("Error getting group membership");
-		fr_pool_connection_release(inst->pool, request, handle);
+		fr_pool_connection_release(pool, request, handle);
 		return 1;
 	}
 
@@ -784,14 +792,14 @@ static int sql_groupcmp(void *instance, request_t *request, UNUSED fr_pair_list_
 			RDEBUG2("sql_groupcmp finished: User is a member of group %s",
 			       check->vp_strvalue);
 			talloc_free(head);
-			fr_pool_connection_release(inst->pool, request, handle);
+			fr_pool_connection_release(pool, request, handle);
 			return 0;
 		}
 	}
 
 	/* Free the grouplist */
 	talloc_free(head);
-	fr_pool_connection_release(inst->pool, request, handle);
+	fr_pool_connection_release(pool, request, handle);
 
 	RDEBUG2("sql_groupcmp finished: User is NOT a member of group %pV", &check->data);
 
@@ -863,8 +871,8 @@ static unlang_action_t rlm_sql_process_groups(rlm_rcode_t *p_result,
 			/*
 			 *	Expand the group query
 			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_check_query,
-					 inst->sql_escape_func, *handle) < 0) {
+			if (sql_query_expand(request, &expanded, inst, request, *handle,
+					     inst->config->authorize_group_check_query) < 0) {
 				REDEBUG("Error generating query");
 				rcode = RLM_MODULE_FAIL;
 				goto finish;
@@ -918,8 +926,8 @@ static unlang_action_t rlm_sql_process_groups(rlm_rcode_t *p_result,
 			/*
 			 *	Now get the reply pairs since the paircmp matched
 			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_reply_query,
-					 inst->sql_escape_func, *handle) < 0) {
+			if (sql_query_expand(request, &expanded, inst, request, *handle,
+					     inst->config->authorize_group_reply_query) < 0) {
 				REDEBUG("Error generating query");
 				rcode = RLM_MODULE_FAIL;
 				goto finish;
@@ -1168,6 +1176,43 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 				inst->driver->sql_escape_func :
 				sql_escape_func;
 
+	/*
+	 *	Resolve the replicas.  They're only used for their
+	 *	connection pools, so all we need is for them to be
+	 *	talking to the same kind of database.
+	 */
+	if (inst->config->read_replica) {
+		size_t		i, num = talloc_array_length(inst->config->read_replica);
+		rlm_sql_t const	**replicas;
+
+		MEM(replicas = talloc_array(inst, rlm_sql_t const *, num));
+		for (i = 0; i < num; i++) {
+			module_instance_t	*mi;
+			rlm_sql_t const		*replica;
+
+			mi = module_by_name(NULL, inst->config->read_replica[i]);
+			if (!mi || (mi->dl_inst->module != dl_module_instance_by_data(inst)->module)) {
+				cf_log_err(conf, "Failed to find sql instance named \"%s\"",
+					   inst->config->read_replica[i]);
+				return -1;
+			}
+
+			replica = mi->dl_inst->data;
+			if (replica == inst) {
+				cf_log_err(conf, "Instance \"%s\" can't be a replica of itself", inst->name);
+				return -1;
+			}
+
+			if (replica->driver != inst->driver) {
+				cf_log_err(conf, "Replica \"%s\" uses driver \"%s\", not \"%s\"",
+					   replica->name, replica->driver->name, inst->driver->name);
+				return -1;
+			}
+			replicas[i] = replica;
+		}
+		inst->replicas = replicas;
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, true, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err(conf, "Failed creating log file context");
@@ -1191,6 +1236,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 
 	rlm_sql_t const		*inst = talloc_get_type_abort_const(mctx->instance, rlm_sql_t);
 	rlm_sql_handle_t	*handle;
+	fr_pool_t		*pool;
 
 	fr_pair_t		*check_tmp = NULL;
 	fr_pair_t		*reply_tmp = NULL;
@@ -1225,7 +1271,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	 *	After this point use goto error or goto release to cleanup socket temporary pairlists and
 	 *	temporary attributes.
 	 */
-	handle = fr_pool_connection_get(inst->pool, request);
+	handle = sql_read_handle_get(&pool, inst, request);
 	if (!handle) {
 		sql_unset_user(inst, request);
 		RETURN_MODULE_FAIL;
@@ -1238,8 +1284,8 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 		fr_cursor_t	cursor;
 		fr_pair_t	*vp;
 
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_check_query,
-				 inst->sql_escape_func, handle) < 0) {
+		if (sql_query_expand(request, &expanded, inst, request, handle,
+				     inst->config->authorize_check_query) < 0) {
 			REDEBUG("Failed generating query");
 			rcode = RLM_MODULE_FAIL;
 
@@ -1248,7 +1294,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 			fr_pair_list_free(&reply_tmp);
 			sql_unset_user(inst, request);
 
-			fr_pool_connection_release(inst->pool, request, handle);
+			fr_pool_connection_release(pool, request, handle);
 
 			RETURN_MODULE_RCODE(rcode);
 		}
@@ -1296,8 +1342,8 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 		/*
 		 *	Now get the reply pairs since the paircmp matched
 		 */
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_reply_query,
-				 inst->sql_escape_func, handle) < 0) {
+		if (sql_query_expand(request, &expanded, inst, request, handle,
+				     inst->config->authorize_reply_query) < 0) {
 			REDEBUG("Error generating query");
 			rcode = RLM_MODULE_FAIL;
 			goto error;
@@ -1427,7 +1473,7 @@ skip_reply:
 release:
 	if (!user_found) rcode = RLM_MODULE_NOTFOUND;
 
-	fr_pool_connection_release(inst->pool, request, handle);
+	fr_pool_connection_release(pool, request, handle);
 	sql_unset_user(inst, request);
 
 	RETURN_MODULE_RCODE(rcode);
@@ -1511,7 +1557,7 @@ static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *in
 			goto finish;
 		}
 
-		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
+		if (sql_query_expand(request, &expanded, inst, request, handle, value) < 0) {
 			rcode = RLM_MODULE_FAIL;
 
 			goto finish;
@@ -121,6 +121,10 @@ typedef struct {
 
 	char const		*allowed_chars;			//!< Chars which done need escaping..
 	uint32_t		query_timeout;			//!< How long to allow queries to run for.
+	bool			bind_parameters;		//!< Pass quoted expansions to the driver as
+								//!< bind parameters, instead of escaping them.
+	char const		**read_replica;			//!< Names of rlm_sql instances to send
+								//!< authorization queries to.
 
 	char const		*connect_query;			//!< Query executed after establishing
 								//!< new connection.
@@ -142,13 +146,27 @@ typedef struct {
 
 typedef struct sql_inst rlm_sql_t;
 
+typedef struct rlm_sql_handle_s rlm_sql_handle_t;
+
+/** Values for the placeholders in a query
+ *
+ * Produced by #sql_query_expand, and parented by the query string.
+ */
 typedef struct {
+	rlm_sql_handle_t	*handle;			//!< The handle the query will be run on.
+	char const		**values;			//!< One per placeholder, in order.
+	unsigned int		num;				//!< How many placeholders there are.
+} rlm_sql_params_t;
+
+struct rlm_sql_handle_s {
 	void			*conn;				//!< Database specific connection handle.
 	rlm_sql_row_t		row;				//!< Row data from the last query.
 	rlm_sql_t const		*inst;				//!< The rlm_sql instance this connection belongs to.
 	TALLOC_CTX		*log_ctx;			//!< Talloc pool used to avoid allocing memory
 								//!< when log strings need to be copied.
-} rlm_sql_handle_t;
+	rlm_sql_params_t const	*params;			//!< Values for the placeholders in the query
+								//!< being run, or NULL if it has none.
+};
 
 extern fr_table_num_sorted_t const sql_rcode_description_table[];
 extern size_t sql_rcode_description_table_len;
@@ -211,6 +229,11 @@ typedef struct {
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
 	xlat_escape_legacy_t	sql_escape_func;
+
+	char const	*placeholder;				//!< printf format of the placeholder for the nth
+								///< parameter, e.g. "$%u".  If set, the driver
+								///< must bind handle->params in sql_query and
+								///< sql_select_query.
 } rlm_sql_driver_t;
 
 struct sql_inst {
@@ -226,6 +249,8 @@ struct sql_inst {
 	dl_module_inst_t		*driver_inst;		//!< Driver's instance data.
 	rlm_sql_driver_t const	*driver;		//!< Driver's exported interface.
 
+	rlm_sql_t const		**replicas;		//!< Instances to run read only queries against.
+
 	int (*sql_set_user)(rlm_sql_t const *inst, request_t *request, char const *username);
 	xlat_escape_legacy_t sql_escape_func;
 	sql_rcode_t (*sql_query)(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, char const *query);
@@ -253,6 +278,9 @@ sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, request_t *request, char const *username);
+ssize_t		sql_query_expand(TALLOC_CTX *ctx, char **out, rlm_sql_t const *inst, request_t *request,
+				 rlm_sql_handle_t *handle, char const *fmt);
+rlm_sql_handle_t *sql_read_handle_get(fr_pool_t **pool, rlm_sql_t const *inst, request_t *request);
 
 /*
  *	sql_state.c
@@ -233,6 +233,18 @@ int sql_pair_list_afrom_str(TALLOC_CTX *ctx, request_t *request, fr_cursor_t *cu
 	return 0;
 }
 
+/** Return the instance whose pool a handle came from
+ *
+ * Handles reserved with #sql_read_handle_get may belong to one of the
+ * replicas, and must be reconnected using the replica's pool.
+ */
+static inline rlm_sql_t const *sql_handle_inst(rlm_sql_t const *inst, rlm_sql_handle_t const *handle)
+{
+	if (!handle || !handle->inst || (handle->inst->pool == inst->pool)) return inst;
+
+	return handle->inst;
+}
+
 /** Call the driver's sql_fetch_row function
  *
  * Calls the driver's sql_fetch_row logging any errors. On success, will
@@ -251,6 +263,7 @@ sql_rcode_t rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, request
 	sql_rcode_t ret;
 
 	if (!*handle || !(*handle)->conn) return RLM_SQL_ERROR;
+	inst = sql_handle_inst(inst, *handle);
 
 	/*
 	 *	We can't implement reconnect logic here, because the caller
@@ -325,6 +338,298 @@ void rlm_sql_print_error(rlm_sql_t const *inst, request_t *request, rlm_sql_hand
 	talloc_free_children(handle->log_ctx);
 }
 
+/*
+ *	Expansions are replaced with a marker while the query is
+ *	expanded, and the markers then replaced with either a
+ *	placeholder or the escaped value.  Neither character can
+ *	appear in a query template.
+ */
+#define SQL_PARAM_START		'\001'
+#define SQL_PARAM_END		'\002'
+
+typedef struct {
+	TALLOC_CTX		*ctx;		//!< To allocate values in.
+	char const		**values;	//!< Expanded values, in the order they were expanded.
+	unsigned int		num;		//!< How many values there are.
+} sql_param_ctx_t;
+
+/** Record an expanded value, and replace it with a marker
+ *
+ */
+static size_t sql_param_escape_func(UNUSED request_t *request, char *out, size_t outlen, char const *in, void *arg)
+{
+	sql_param_ctx_t	*pctx = arg;
+	char		marker[16];
+	size_t		len;
+
+	/*
+	 *	The result of an alternation is escaped twice, once
+	 *	for the branch, and once for the whole alternation.
+	 *	Pass our own marker through the second time.
+	 */
+	if (pctx->num > 0) {
+		snprintf(marker, sizeof(marker), "%c%u%c", SQL_PARAM_START, pctx->num - 1, SQL_PARAM_END);
+		if (strcmp(in, marker) == 0) goto done;
+	}
+
+	MEM(pctx->values = talloc_realloc(pctx->ctx, pctx->values, char const *, pctx->num + 1));
+	MEM(pctx->values[pctx->num] = talloc_strdup(pctx->values, in));
+	snprintf(marker, sizeof(marker), "%c%u%c", SQL_PARAM_START, pctx->num++, SQL_PARAM_END);
+
+done:
+	len = strlcpy(out, marker, outlen);
+
+	return (len < outlen) ? len : outlen - 1;
+}
+
+/** Parse a marker
+ *
+ * @param[out] idx	of the value the marker refers to.
+ * @param[out] end	first char after the marker.
+ * @param[in] p		start of the marker.
+ * @param[in] num	number of values.
+ * @return
+ *	- true if the marker is valid.
+ *	- false if it isn't.
+ */
+static bool sql_param_marker(unsigned int *idx, char const **end, char const *p, unsigned int num)
+{
+	unsigned long	value;
+	char		*q;
+
+	if (*p != SQL_PARAM_START) return false;
+	p++;
+
+	if (!isdigit((uint8_t) *p)) return false;
+	value = strtoul(p, &q, 10);
+	if ((*q != SQL_PARAM_END) || (value >= num)) return false;
+
+	*idx = value;
+	*end = q + 1;
+
+	return true;
+}
+
+/** Unlink the placeholder values from the handle, when the query is freed
+ *
+ */
+static int _sql_params_free(rlm_sql_params_t *params)
+{
+	if (params->handle && (params->handle->params == params)) params->handle->params = NULL;
+
+	return 0;
+}
+
+/** Expand a query, binding values to placeholders where the driver supports it
+ *
+ * If the driver and configuration don't support bind parameters, this is
+ * the same as calling xlat_aeval() with the driver's escape function.
+ *
+ * Otherwise an expansion which is the only thing inside a single quoted
+ * string, e.g. `'%{User-Name}'`, is replaced with a placeholder, and the
+ * value is bound to it.  The text of the query then doesn't change from
+ * one request to the next, so the driver can prepare it once, and the
+ * value doesn't need escaping.  Any other expansions are escaped as usual.
+ *
+ * The values are stored in handle->params, until the query is run or freed.
+ *
+ * @param[in] ctx	to allocate the query in.
+ * @param[out] out	Where to write the expanded query.
+ * @param[in] inst	of rlm_sql.
+ * @param[in] request	The current request.
+ * @param[in] handle	the query will be run on.
+ * @param[in] fmt	of the query.
+ * @return
+ *	- >= 0 length of the expanded query.
+ *	- < 0 on error.
+ */
+ssize_t sql_query_expand(TALLOC_CTX *ctx, char **out, rlm_sql_t const *inst, request_t *request,
+			 rlm_sql_handle_t *handle, char const *fmt)
+{
+	sql_param_ctx_t		pctx = { .ctx = NULL };
+	rlm_sql_params_t	*params;
+	ssize_t			slen;
+	char			*expanded, *query;
+	char const		*p, *end;
+	unsigned int		idx;
+	bool			in_quote = false;
+
+	handle->params = NULL;
+
+	if (!inst->config->bind_parameters || !inst->driver->placeholder) {
+		return xlat_aeval(ctx, out, request, fmt, inst->sql_escape_func, handle);
+	}
+
+	MEM(params = talloc_zero(ctx, rlm_sql_params_t));
+	pctx.ctx = params;
+
+	slen = xlat_aeval(ctx, &expanded, request, fmt, sql_param_escape_func, &pctx);
+	if ((slen < 0) || (pctx.num == 0)) {
+		talloc_free(params);
+		if (slen >= 0) *out = expanded;
+		return slen;
+	}
+
+	MEM(params->values = talloc_array(params, char const *, pctx.num));
+	MEM(query = talloc_strdup(ctx, ""));
+
+	for (p = expanded; *p; p++) {
+		char const	*value;
+		char		*escaped;
+		size_t		len;
+
+		switch (*p) {
+		case '\'':
+			/*
+			 *	'<marker>' becomes a placeholder.
+			 */
+			if (!in_quote && sql_param_marker(&idx, &end, p + 1, pctx.num) &&
+			    (end[0] == '\'') && (end[1] != '\'')) {
+				params->values[params->num++] = pctx.values[idx];
+				MEM(query = talloc_asprintf_append_buffer(query, inst->driver->placeholder, params->num));
+				p = end;
+				continue;
+			}
+
+			/*
+			 *	'' inside a string is an escaped quote.
+			 */
+			if (in_quote && (p[1] == '\'')) {
+				MEM(query = talloc_strndup_append_buffer(query, p, 2));
+				p++;
+				continue;
+			}
+
+			in_quote = !in_quote;
+			break;
+
+		case SQL_PARAM_START:
+			if (!sql_param_marker(&idx, &end, p, pctx.num)) {
+				REDEBUG("Failed expanding query, too many expansions");
+				talloc_free(query);
+				talloc_free(expanded);
+				talloc_free(params);
+				return -1;
+			}
+
+			/*
+			 *	Anything else is escaped as it
+			 *	would have been without parameters.
+			 */
+			value = pctx.values[idx];
+			len = (strlen(value) * 3) + 1;
+			MEM(escaped = talloc_array(NULL, char, len));
+			inst->sql_escape_func(request, escaped, len, value, handle);
+			MEM(query = talloc_strdup_append_buffer(query, escaped));
+			talloc_free(escaped);
+			p = end - 1;
+			continue;
+
+		default:
+			break;
+		}
+
+		MEM(query = talloc_strndup_append_buffer(query, p, 1));
+	}
+	talloc_free(expanded);
+
+	if (params->num == 0) {
+		talloc_free(params);
+	} else {
+		params->handle = handle;
+		talloc_set_destructor(params, _sql_params_free);
+		talloc_steal(query, params);
+		handle->params = params;
+	}
+
+	*out = query;
+	return talloc_array_length(query) - 1;
+}
+
+/** Move the placeholder values to a new handle, or unlink them from the handle if it's NULL
+ *
+ * We don't know what happens to the handle after the query has run,
+ * so the values are unlinked from it as soon as the driver is done
+ * with them.
+ */
+static inline void sql_params_move(rlm_sql_handle_t *handle, rlm_sql_params_t const *params)
+{
+	rlm_sql_params_t	*mutable;
+
+	if (!params) return;
+
+	memcpy(&mutable, &params, sizeof(mutable));
+	if (mutable->handle) mutable->handle->params = NULL;
+	mutable->handle = handle;
+	if (handle) handle->params = params;
+}
+
+/** Print the values bound to a query
+ *
+ */
+static void sql_params_debug(rlm_sql_t const *inst, request_t *request, rlm_sql_params_t const *params)
+{
+	unsigned int i;
+
+	if (!params) return;
+
+	for (i = 0; i < params->num; i++) {
+		char placeholder[16];
+
+		snprintf(placeholder, sizeof(placeholder), inst->driver->placeholder, i + 1);
+		ROPTIONAL(RDEBUG2, DEBUG2, "  %s = '%s'", placeholder, params->values[i]);
+	}
+}
+
+/** Reserve a connection for a query which only reads from the database
+ *
+ * If the instance has replicas, one is chosen at random, skipping any
+ * which failed to open their last connection.  If none of the replicas
+ * can provide a connection, the connection comes from the instance's
+ * own pool.
+ *
+ * @param[out] pool	the connection must be released to.
+ * @param[in] inst	#rlm_sql_t instance data.
+ * @param[in] request	Current request.
+ * @return
+ *	- A connection handle.
+ *	- NULL if no connection could be reserved.
+ */
+rlm_sql_handle_t *sql_read_handle_get(fr_pool_t **pool, rlm_sql_t const *inst, request_t *request)
+{
+	size_t	i, num = talloc_array_length(inst->replicas), start;
+
+	if (num > 0) {
+		start = fr_rand() % num;
+
+		for (i = 0; i < num; i++) {
+			rlm_sql_t const		*replica = inst->replicas[(start + i) % num];
+			fr_pool_state_t const	*state;
+			rlm_sql_handle_t	*handle;
+
+			if (!replica->pool) continue;
+
+			/*
+			 *	It's down, don't bother waiting for it.
+			 */
+			state = fr_pool_state(replica->pool);
+			if (state->last_failed > state->last_spawned) continue;
+
+			handle = fr_pool_connection_get(replica->pool, request);
+			if (!handle) continue;
+
+			RDEBUG3("Using replica \"%s\"", replica->name);
+			*pool = replica->pool;
+			return handle;
+		}
+
+		RWDEBUG("No replicas available, using \"%s\"", inst->name);
+	}
+
+	*pool = inst->pool;
+	return fr_pool_connection_get(inst->pool, request);
+}
+
 /** Call the driver's sql_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
@@ -345,9 +650,12 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 {
 	int ret = RLM_SQL_ERROR;
 	int i, count;
+	rlm_sql_params_t const *params;
 
 	/* Caller should check they have a valid handle */
 	fr_assert(*handle);
+	params = (*handle)->params;
+	inst = sql_handle_inst(inst, *handle);
 
 	/* There's no query to run, return an error */
 	if (query[0] == '\0') {
@@ -366,8 +674,10 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 	 */
 	for (i = 0; i < (count + 1); i++) {
 		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query);
+		sql_params_debug(inst, request, params);
 
 		ret = (inst->driver->sql_query)(*handle, inst->config, query);
+		sql_params_move(NULL, params);	/* Only for this attempt */
 		switch (ret) {
 		case RLM_SQL_OK:
 			break;
@@ -381,6 +691,7 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 			/* Reconnection failed */
 			if (!*handle) return RLM_SQL_RECONNECT;
 			/* Reconnection succeeded, try again with the new handle */
+			sql_params_move(*handle, params);
 			continue;
 
 		/*
@@ -446,9 +757,12 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_
 {
 	int ret = RLM_SQL_ERROR;
 	int i, count;
+	rlm_sql_params_t const *params;
 
 	/* Caller should check they have a valid handle */
 	fr_assert(*handle);
+	params = (*handle)->params;
+	inst = sql_handle_inst(inst, *handle);
 
 	/* There's no query to run, return an error */
 	if (query[0] == '\0') {
@@ -467,8 +781,10 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_
 	 */
 	for (i = 0; i < (count + 1); i++) {
 		ROPTIONAL(RDEBUG2, DEBUG2, "Executing select query: %s", query);
+		sql_params_debug(inst, request, params);
 
 		ret = (inst->driver->sql_select_query)(*handle, inst->config, query);
+		sql_params_move(NULL, params);	/* Only for this attempt */
 		switch (ret) {
 		case RLM_SQL_OK:
 			break;
@@ -482,6 +798,7 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_
 			/* Reconnection failed */
 			if (!*handle) return RLM_SQL_RECONNECT;
 			/* Reconnection succeeded, try again with the new handle */
+			sql_params_move(*handle, params);
 			continue;
 
 		case RLM_SQL_QUERY_INVALID:
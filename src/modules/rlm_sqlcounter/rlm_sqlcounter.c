@@ -29,8 +29,13 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+
+#include <freeradius-devel/radius/radius.h>
 
 #include <ctype.h>
+#include <pthread.h>
 
 #define MAX_QUERY_LEN 1024
 
@@ -52,6 +57,8 @@ RCSID("$Id$")
  *	Reset Time.
  */
 
+typedef struct sqlcounter_cache_s sqlcounter_cache_t;
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -71,8 +78,65 @@ typedef struct {
 
 	fr_time_t	reset_time;
 	fr_time_t	last_reset;
+
+	struct {
+		bool			enable;		//!< Keep running totals in memory.
+		tmpl_t			*counter;	//!< What accounting packets add to the total.
+		tmpl_t			*session_id;	//!< Identifies the session an accounting packet is for.
+		fr_time_delta_t		reconcile_interval; //!< How often the totals are read from SQL again.
+		uint32_t		max_entries;	//!< How many totals to keep.
+	} cache_config;
+
+	sqlcounter_cache_t	*cache;		//!< Running totals, NULL if the cache is disabled.
 } rlm_sqlcounter_t;
 
+/** The last counter value seen for one session of a user
+ *
+ * Accounting packets carry the session total so far, so we only
+ * add the difference from the last packet.
+ */
+typedef struct {
+	char const		*id;		//!< Session identifier.
+	uint64_t		last;		//!< Counter value in the last packet.
+	fr_dlist_t		entry;		//!< In the entry's list of sessions.
+} sqlcounter_cache_session_t;
+
+/** Running total for one key
+ *
+ */
+typedef struct {
+	char const		*key;		//!< Usually the User-Name.
+	uint64_t		counter;	//!< Result of the query, plus what we've seen since.
+	fr_time_t		last_reset;	//!< Start of the period the counter is for.
+	fr_time_t		reconciled;	//!< When the query was last run.
+	fr_dlist_head_t		sessions;	//!< Sessions we've seen accounting packets for.
+	fr_dlist_t		entry;		//!< In the reconcile list.
+} sqlcounter_cache_entry_t;
+
+/** Running totals, so most authorizations don't need a query
+ *
+ * Shared by all workers, as accounting packets for a user usually
+ * end up on a different worker from the authentication.  Entries are
+ * ordered by when they were last reconciled with SQL, so the stalest
+ * one is always at the head of the list.
+ */
+struct sqlcounter_cache_s {
+	pthread_mutex_t		mutex;		//!< Protects the table and list.
+	fr_hash_table_t		*ht;		//!< Entries, by key.
+	fr_dlist_head_t		reconcile;	//!< Entries, least recently reconciled first.
+	fr_time_delta_t		reconcile_interval;
+	uint32_t		max_entries;
+};
+
+static const CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, rlm_sqlcounter_t, cache_config.enable), .dflt = "no" },
+	{ FR_CONF_OFFSET("counter", FR_TYPE_TMPL, rlm_sqlcounter_t, cache_config.counter), .dflt = "&Acct-Session-Time", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("session_id", FR_TYPE_TMPL, rlm_sqlcounter_t, cache_config.session_id), .dflt = "&Acct-Unique-Session-Id", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("reconcile_interval", FR_TYPE_TIME_DELTA, rlm_sqlcounter_t, cache_config.reconcile_interval), .dflt = "300" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_sqlcounter_t, cache_config.max_entries), .dflt = "65536" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("sql_module_instance", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_sqlcounter_t, sqlmod_inst) },
 
@@ -88,6 +152,8 @@ static const CONF_PARSER module_config[] = {
 
 	/* Attribute to write remaining session to */
 	{ FR_CONF_OFFSET("reply_name", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE, rlm_sqlcounter_t, reply_attr) },
+
+	{ FR_CONF_POINTER("cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -101,11 +167,13 @@ fr_dict_autoload_t rlm_sqlcounter_dict[] = {
 	{ NULL }
 };
 
+static fr_dict_attr_t const *attr_acct_status_type;
 static fr_dict_attr_t const *attr_reply_message;
 static fr_dict_attr_t const *attr_session_timeout;
 
 extern fr_dict_attr_autoload_t rlm_sqlcounter_dict_attr[];
 fr_dict_attr_autoload_t rlm_sqlcounter_dict_attr[] = {
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_reply_message, .name = "Reply-Message", .type = FR_TYPE_STRING, .dict = &dict_radius },
 	{ .out = &attr_session_timeout, .name = "Session-Timeout", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ NULL }
@@ -337,15 +405,11 @@ static ssize_t sqlcounter_expand(char *out, int outlen, rlm_sqlcounter_t const *
 }
 
 
-/*
- *	See if the counter matches.
+/** Run the query, to get the counter from SQL
+ *
  */
-static int counter_cmp(void *instance, request_t *request, UNUSED fr_pair_list_t *request_list , fr_pair_t *check,
-		       UNUSED fr_pair_list_t *check_list)
+static int sqlcounter_query(uint64_t *out, rlm_sqlcounter_t const *inst, request_t *request)
 {
-	rlm_sqlcounter_t const *inst = talloc_get_type_abort_const(instance, rlm_sqlcounter_t);
-	uint64_t counter;
-
 	char query[MAX_QUERY_LEN], subst[MAX_QUERY_LEN];
 	char *expanded = NULL;
 	size_t len;
@@ -359,22 +423,138 @@ static int counter_cmp(void *instance, request_t *request, UNUSED fr_pair_list_t
 
 	/* Then combine that with the name of the module were using to do the query */
 	len = snprintf(query, sizeof(query), "%%{%s:%s}", inst->sqlmod_inst, subst);
-	if (len >= sizeof(query) - 1) {
+	if (len >= (sizeof(query) - 1)) {
 		REDEBUG("Insufficient query buffer space");
 
 		return -1;
 	}
 
 	/* Finally, xlat resulting SQL query */
-	if (xlat_aeval(request, &expanded, request, query, NULL, NULL) < 0) {
-		return -1;
-	}
+	if (xlat_aeval(request, &expanded, request, query, NULL, NULL) < 0) return -1;
 
-	if (sscanf(expanded, "%" PRIu64, &counter) != 1) {
-		RDEBUG2("No integer found in string \"%s\"", expanded);
+	if (sscanf(expanded, "%" PRIu64, out) != 1) {
+		RDEBUG2("No integer found in result string \"%s\".  May be first session, setting counter to 0",
+			expanded);
+		*out = 0;
 	}
 	talloc_free(expanded);
 
+	return 0;
+}
+
+static uint32_t sqlcounter_cache_entry_hash(void const *data)
+{
+	sqlcounter_cache_entry_t const *entry = data;
+
+	return fr_hash_string(entry->key);
+}
+
+static int sqlcounter_cache_entry_cmp(void const *one, void const *two)
+{
+	sqlcounter_cache_entry_t const *a = one, *b = two;
+
+	return strcmp(a->key, b->key);
+}
+
+/** Get the current value of the counter
+ *
+ * If the cache is enabled, and the running total for the key was
+ * reconciled recently, it's used instead of running the query.
+ * Otherwise the query is run, and the total is reset to its result.
+ */
+static int sqlcounter_counter(uint64_t *out, rlm_sqlcounter_t const *inst, request_t *request)
+{
+	sqlcounter_cache_t		*cache = inst->cache;
+	sqlcounter_cache_entry_t	find, *entry;
+	char				buff[256];
+	fr_time_t			now;
+	uint64_t			counter;
+
+	if (!cache) return sqlcounter_query(out, inst, request);
+
+	if (tmpl_expand(&find.key, buff, sizeof(buff), request, inst->key, NULL, NULL) <= 0) {
+		RDEBUG2("Empty key, not using the cache");
+		return sqlcounter_query(out, inst, request);
+	}
+
+	now = fr_time();
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (entry && (entry->last_reset == inst->last_reset) &&
+	    ((entry->reconciled + cache->reconcile_interval) > now)) {
+		*out = entry->counter;
+		pthread_mutex_unlock(&cache->mutex);
+
+		RDEBUG2("Using cached counter value (%" PRIu64 ")", *out);
+		return 0;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	/*
+	 *	Don't hold the lock while we're waiting for SQL.
+	 */
+	if (sqlcounter_query(&counter, inst, request) < 0) return -1;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/*
+	 *	Throw away totals which are stale, or make room
+	 *	for the new one.
+	 */
+	while ((entry = fr_dlist_head(&cache->reconcile)) &&
+	       (((entry->reconciled + cache->reconcile_interval) <= now) ||
+		(fr_dlist_num_elements(&cache->reconcile) >= cache->max_entries))) {
+		if (strcmp(entry->key, find.key) == 0) break;	/* We're about to reconcile it */
+
+		fr_dlist_remove(&cache->reconcile, entry);
+		fr_hash_table_delete(cache->ht, entry);
+		talloc_free(entry);
+	}
+
+	/*
+	 *	The sessions are kept, as their last values are
+	 *	what SQL has now.
+	 */
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (entry) {
+		fr_dlist_remove(&cache->reconcile, entry);
+	} else {
+		entry = talloc_zero(cache, sqlcounter_cache_entry_t);
+		if (!entry) goto done;
+
+		entry->key = talloc_strdup(entry, find.key);
+		fr_dlist_talloc_init(&entry->sessions, sqlcounter_cache_session_t, entry);
+		if (!entry->key || (fr_hash_table_insert(cache->ht, entry) < 0)) {
+			talloc_free(entry);
+			goto done;
+		}
+	}
+
+	entry->counter = counter;
+	entry->last_reset = inst->last_reset;
+	entry->reconciled = now;
+	fr_dlist_insert_tail(&cache->reconcile, entry);
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+
+	*out = counter;
+
+	return 0;
+}
+
+/*
+ *	See if the counter matches.
+ */
+static int counter_cmp(void *instance, request_t *request, UNUSED fr_pair_list_t *request_list , fr_pair_t *check,
+		       UNUSED fr_pair_list_t *check_list)
+{
+	rlm_sqlcounter_t const *inst = talloc_get_type_abort_const(instance, rlm_sqlcounter_t);
+	uint64_t counter;
+
+	if (sqlcounter_counter(&counter, inst, request) < 0) return -1;
+
 	if (counter < check->vp_uint64) return -1;
 	if (counter > check->vp_uint64) return 1;
 	return 0;
@@ -395,11 +575,6 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	char			msg[128];
 	int			ret;
 
-	char query[MAX_QUERY_LEN], subst[MAX_QUERY_LEN];
-	char *expanded = NULL;
-
-	size_t len;
-
 	/*
 	 *	Before doing anything else, see if we have to reset
 	 *	the counters.
@@ -417,32 +592,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 		RETURN_MODULE_NOOP;
 	}
 
-	/* First, expand %k, %b and %e in query */
-	if (sqlcounter_expand(subst, sizeof(subst), inst, request, inst->query) <= 0) {
-		REDEBUG("Insufficient query buffer space");
-
-		RETURN_MODULE_FAIL;
-	}
-
-	/* Then combine that with the name of the module were using to do the query */
-	len = snprintf(query, sizeof(query), "%%{%s:%s}", inst->sqlmod_inst, subst);
-	if (len >= (sizeof(query) - 1)) {
-		REDEBUG("Insufficient query buffer space");
-
-		RETURN_MODULE_FAIL;
-	}
-
-	/* Finally, xlat resulting SQL query */
-	if (xlat_aeval(request, &expanded, request, query, NULL, NULL) < 0) {
-		RETURN_MODULE_FAIL;
-	}
-	talloc_free(expanded);
-
-	if (sscanf(expanded, "%" PRIu64, &counter) != 1) {
-		RDEBUG2("No integer found in result string \"%s\".  May be first session, setting counter to 0",
-			expanded);
-		counter = 0;
-	}
+	if (sqlcounter_counter(&counter, inst, request) < 0) RETURN_MODULE_FAIL;
 
 	/*
 	 *	Check if check item > counter
@@ -522,6 +672,103 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	RETURN_MODULE_OK;
 }
 
+/** Add what accounting packets report to the running total
+ *
+ * Only totals which are already cached are updated.  If there isn't
+ * one, the next authorization runs the query, and SQL will have
+ * this packet by then.
+ */
+static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_sqlcounter_t const		*inst = talloc_get_type_abort_const(mctx->instance, rlm_sqlcounter_t);
+	sqlcounter_cache_t		*cache = inst->cache;
+	sqlcounter_cache_entry_t	find, *entry;
+	sqlcounter_cache_session_t	*session = NULL;
+	fr_pair_t			*vp;
+	char				key_buff[256], id_buff[256];
+	char const			*id;
+	uint64_t			value, delta = 0;
+
+	if (!cache) RETURN_MODULE_NOOP;
+
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_acct_status_type);
+	if (!vp) RETURN_MODULE_NOOP;
+
+	switch (vp->vp_uint32) {
+	case FR_STATUS_START:
+	case FR_STATUS_ALIVE:
+	case FR_STATUS_STOP:
+		break;
+
+	default:
+		RETURN_MODULE_NOOP;
+	}
+
+	if ((tmpl_expand(&find.key, key_buff, sizeof(key_buff), request, inst->key, NULL, NULL) <= 0) ||
+	    (tmpl_expand(&id, id_buff, sizeof(id_buff), request, inst->cache_config.session_id, NULL, NULL) <= 0)) {
+		RDEBUG2("Empty key or session ID, not updating the cache");
+		RETURN_MODULE_NOOP;
+	}
+
+	if (tmpl_expand(&value, NULL, 0, request, inst->cache_config.counter, NULL, NULL) < 0) {
+		RDEBUG2("No value for %s, not updating the cache", inst->cache_config.counter->name);
+		RETURN_MODULE_NOOP;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_find_by_data(cache->ht, &find);
+	if (!entry) {
+		pthread_mutex_unlock(&cache->mutex);
+		RETURN_MODULE_NOOP;
+	}
+
+	while ((session = fr_dlist_next(&entry->sessions, session))) {
+		if (strcmp(session->id, id) == 0) break;
+	}
+
+	if (!session) {
+		session = talloc_zero(entry, sqlcounter_cache_session_t);
+		if (!session) goto done;
+
+		session->id = talloc_strdup(session, id);
+		if (!session->id) {
+			talloc_free(session);
+			goto done;
+		}
+		fr_dlist_insert_tail(&entry->sessions, session);
+
+		/*
+		 *	If we missed the start of a session, the
+		 *	last query has already counted most of it.
+		 *	Reconciling will pick up the rest.
+		 */
+		session->last = (vp->vp_uint32 == FR_STATUS_START) ? 0 : value;
+	}
+
+	if (value > session->last) delta = value - session->last;
+	session->last = value;
+	entry->counter += delta;
+
+	if (vp->vp_uint32 == FR_STATUS_STOP) {
+		fr_dlist_remove(&entry->sessions, session);
+		talloc_free(session);
+	}
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+
+	RDEBUG2("Added %" PRIu64 " to cached counter value", delta);
+
+	RETURN_MODULE_UPDATED;
+}
+
+static int _sqlcounter_cache_free(sqlcounter_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -557,6 +804,21 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->cache_config.enable) {
+		sqlcounter_cache_t *cache;
+
+		FR_INTEGER_BOUND_CHECK("cache.max_entries", inst->cache_config.max_entries, >=, 1);
+
+		MEM(cache = talloc_zero(inst, sqlcounter_cache_t));
+		MEM(cache->ht = fr_hash_table_create(cache, sqlcounter_cache_entry_hash, sqlcounter_cache_entry_cmp, NULL));
+		fr_dlist_talloc_init(&cache->reconcile, sqlcounter_cache_entry_t, entry);
+		pthread_mutex_init(&cache->mutex, NULL);
+		cache->reconcile_interval = inst->cache_config.reconcile_interval;
+		cache->max_entries = inst->cache_config.max_entries;
+		talloc_set_destructor(cache, _sqlcounter_cache_free);
+		inst->cache = cache;
+	}
+
 	return 0;
 }
 
@@ -620,7 +882,8 @@ module_t rlm_sqlcounter = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.methods = {
-		[MOD_AUTHORIZE]		= mod_authorize
+		[MOD_AUTHORIZE]		= mod_authorize,
+		[MOD_ACCOUNTING]	= mod_accounting
 	},
 };
 
@@ -41,11 +41,37 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /*
  *	@todo - MULTI_PROTOCOL - make this protocol agnostic.
  *	Perhaps keep stats in a hash table by (request->dict, request->code) ?
  */
 
+/*
+ *	Request latency is kept in a log-linear histogram of
+ *	microseconds.  Each power of 2 is split into 4 buckets, so a
+ *	percentile is accurate to within 25%, and 128 buckets go up to
+ *	about two hours.
+ */
+#define STATS_LATENCY_SUB_BITS	(2)
+#define STATS_LATENCY_BUCKETS	(128)
+
+/** Counters for one thing
+ *
+ * Each set of counters is written by exactly one thread, so they're
+ * updated without locked instructions.  Other threads only ever read
+ * them, when statistics are requested.
+ */
+typedef struct {
+	atomic_uint_least64_t	packets[FR_RADIUS_MAX_PACKET_CODE];	//!< by packet code
+	atomic_uint_least64_t	latency[STATS_LATENCY_BUCKETS];		//!< histogram of request latency
+} rlm_stats_counters_t;
+
 typedef struct {
 	pthread_mutex_t		mutex;
 	fr_dict_attr_t const	*type_da;			//!< FreeRADIUS-Stats4-Type
@@ -53,20 +79,19 @@ typedef struct {
 	fr_dict_attr_t const	*ipv6_da;			//!< FreeRADIUS-Stats4-IPv6-Address
 	fr_dlist_head_t		list;				//!< for threads to know about each other
 
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];
+	rlm_stats_counters_t	stats;				//!< from threads which have exited
 } rlm_stats_t;
 
 typedef struct {
 	fr_ipaddr_t		ipaddr;				//!< IP address of this thing
 	fr_time_t		created;			//!< when it was created
 	fr_time_t		last_packet;			//!< when we last saw a packet
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];	//!< actual statistic
+	rlm_stats_counters_t	stats;				//!< actual statistic
 } rlm_stats_data_t;
 
 typedef struct {
 	rlm_stats_t		*inst;
 
-	fr_time_t		last_global_update;
 	fr_dlist_t		entry;				//!< for threads to know about each other
 
 	fr_time_t		last_manage;			//!< when we deleted old things
@@ -74,9 +99,17 @@ typedef struct {
 	rbtree_t		*src;				//!< stats by source
 	rbtree_t		*dst;				//!< stats by destination
 
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];
+	rlm_stats_counters_t	stats;				//!< global stats for this thread
 } rlm_stats_thread_t;
 
+/** A copy of the counters, summed over all threads
+ *
+ */
+typedef struct {
+	uint64_t		packets[FR_RADIUS_MAX_PACKET_CODE];
+	uint64_t		latency[STATS_LATENCY_BUCKETS];
+} rlm_stats_total_t;
+
 static const CONF_PARSER module_config[] = {
 	CONF_PARSER_TERMINATOR
 };
@@ -92,58 +125,167 @@ fr_dict_autoload_t rlm_stats_dict[] = {
 static fr_dict_attr_t const *attr_freeradius_stats4_ipv4_address;
 static fr_dict_attr_t const *attr_freeradius_stats4_ipv6_address;
 static fr_dict_attr_t const *attr_freeradius_stats4_type;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_p50;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_p99;
+static fr_dict_attr_t const *attr_freeradius_stats4_latency_p999;
 
 extern fr_dict_attr_autoload_t rlm_stats_dict_attr[];
 fr_dict_attr_autoload_t rlm_stats_dict_attr[] = {
 	{ .out = &attr_freeradius_stats4_ipv4_address, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-IPv4-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_radius },
 	{ .out = &attr_freeradius_stats4_ipv6_address, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-IPv6-Address", .type = FR_TYPE_IPV6_ADDR, .dict = &dict_radius },
 	{ .out = &attr_freeradius_stats4_type, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_p50, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency-P50", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_p99, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency-P99", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_latency_p999, .name = "Vendor-Specific.FreeRADIUS.Stats4.Stats4-Latency-P999", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ NULL }
 };
 
-static void coalesce(uint64_t final_stats[FR_RADIUS_MAX_PACKET_CODE], rlm_stats_thread_t *t,
-		     size_t tree_offset, rlm_stats_data_t *mydata)
+/** Increment a counter which only this thread writes to
+ *
+ * There's only one writer, so a plain load and store is enough.  The
+ * atomics just stop readers from seeing a torn value.
+ */
+static inline CC_HINT(always_inline) void stats_inc(atomic_uint_least64_t *counter)
 {
-	rlm_stats_data_t *stats;
-	rlm_stats_thread_t *other;
-	rbtree_t **tree;
-	uint64_t local_stats[FR_RADIUS_MAX_PACKET_CODE];
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+			      memory_order_relaxed);
+}
+
+/** Map a latency in microseconds to a histogram bucket
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int stats_latency_bucket(uint64_t usec)
+{
+	unsigned int msb, idx;
+
+	if (usec < (1 << STATS_LATENCY_SUB_BITS)) return usec;
+
+	msb = fr_high_bit_pos(usec) - 1;
+	idx = ((msb - STATS_LATENCY_SUB_BITS + 1) << STATS_LATENCY_SUB_BITS) |
+	      ((usec >> (msb - STATS_LATENCY_SUB_BITS)) & ((1 << STATS_LATENCY_SUB_BITS) - 1));
 
-	tree = (rbtree_t **) (((uint8_t *) t) + tree_offset);
+	if (idx >= STATS_LATENCY_BUCKETS) return STATS_LATENCY_BUCKETS - 1;
+
+	return idx;
+}
+
+/** Return the largest latency which is put into a histogram bucket
+ *
+ */
+static uint64_t stats_latency_bucket_max(unsigned int idx)
+{
+	unsigned int	shift;
+	uint64_t	sub;
+
+	if (idx < (1 << STATS_LATENCY_SUB_BITS)) return idx;
+
+	shift = (idx >> STATS_LATENCY_SUB_BITS) - 1;
+	sub = idx & ((1 << STATS_LATENCY_SUB_BITS) - 1);
 
 	/*
-	 *	Bootstrap with my statistics, where we don't need a
-	 *	lock.
+	 *	The next bucket starts at ((1 << SUB_BITS) + sub + 1) << shift
 	 */
-	stats = rbtree_finddata(*tree, mydata);
-	if (!stats) {
-		memset(final_stats, 0, sizeof(uint64_t) * FR_RADIUS_MAX_PACKET_CODE);
-	} else {
-		memcpy(final_stats, stats->stats, sizeof(stats->stats));
+	return ((sub + (1 << STATS_LATENCY_SUB_BITS) + 1) << shift) - 1;
+}
+
+/** Find a percentile in a latency histogram
+ *
+ * @param[in] total	counters to search.
+ * @param[in] ppm	the percentile, in parts per million.
+ * @return the approximate latency in microseconds.
+ */
+static uint64_t stats_latency_percentile(rlm_stats_total_t const *total, uint64_t ppm)
+{
+	uint64_t	count = 0, rank, seen = 0;
+	unsigned int	i;
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++) count += total->latency[i];
+	if (!count) return 0;
+
+	rank = ((count * ppm) + 999999) / 1000000;
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+		seen += total->latency[i];
+		if (seen >= rank) break;
+	}
+
+	return stats_latency_bucket_max(i);
+}
+
+/** Count a request which is about to be replied to
+ *
+ */
+static inline CC_HINT(always_inline) void stats_count(rlm_stats_counters_t *stats,
+						      int src_code, int dst_code, unsigned int bucket)
+{
+	stats_inc(&stats->packets[src_code]);
+	stats_inc(&stats->packets[dst_code]);
+	stats_inc(&stats->latency[bucket]);
+}
+
+/** Add one set of counters to a total
+ *
+ */
+static void stats_sum(rlm_stats_total_t *total, rlm_stats_counters_t const *stats)
+{
+	int i;
+
+	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
+		total->packets[i] += atomic_load_explicit(&stats->packets[i], memory_order_relaxed);
 	}
 
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+		total->latency[i] += atomic_load_explicit(&stats->latency[i], memory_order_relaxed);
+	}
+}
+
+/** Sum the global counters over all threads
+ *
+ * The thread list is only locked while we read it.  No thread takes
+ * the lock when counting packets.
+ */
+static void stats_global(rlm_stats_total_t *total, rlm_stats_t *inst)
+{
+	rlm_stats_thread_t *t;
+
+	memset(total, 0, sizeof(*total));
+
+	pthread_mutex_lock(&inst->mutex);
+	stats_sum(total, &inst->stats);
+
+	for (t = fr_dlist_head(&inst->list);
+	     t != NULL;
+	     t = fr_dlist_next(&inst->list, t)) {
+		stats_sum(total, &t->stats);
+	}
+	pthread_mutex_unlock(&inst->mutex);
+}
+
+static void coalesce(rlm_stats_total_t *total, rlm_stats_thread_t *t,
+		     size_t tree_offset, rlm_stats_data_t *mydata)
+{
+	rlm_stats_data_t *stats;
+	rlm_stats_thread_t *other;
+	rbtree_t **tree;
+
+	memset(total, 0, sizeof(*total));
+
 	/*
-	 *	Loop over all of the other thread instances, locking
-	 *	them, and adding their statistics in.
+	 *	Loop over all of the thread instances, and add their
+	 *	statistics in.  The list lock stops threads from
+	 *	exiting while we look at their trees.
 	 */
+	pthread_mutex_lock(&t->inst->mutex);
 	for (other = fr_dlist_head(&t->inst->list);
 	     other != NULL;
 	     other = fr_dlist_next(&t->inst->list, other)) {
-		int i;
-
-		if (other == t) continue;
-
 		tree = (rbtree_t **) (((uint8_t *) other) + tree_offset);
 		stats = rbtree_finddata(*tree, mydata);
-		if (!stats) {
-			continue;
-		}
-		memcpy(&local_stats, stats->stats, sizeof(stats->stats));
+		if (!stats) continue;
 
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			final_stats[i] += local_stats[i];
-		}
+		stats_sum(total, &stats->stats);
 	}
+	pthread_mutex_unlock(&t->inst->mutex);
 }
 
 
@@ -162,7 +304,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 	rlm_stats_data_t mydata, *stats;
 	fr_cursor_t cursor;
 	char buffer[64];
-	uint64_t local_stats[NUM_ELEMENTS(inst->stats)];
+	rlm_stats_total_t total;
 
 	/*
 	 *	Increment counters only in "send foo" sections.
@@ -170,7 +312,8 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 	 *	i.e. only when we have a reply to send.
 	 */
 	if (request->request_state == REQUEST_SEND) {
-		int src_code, dst_code;
+		int		src_code, dst_code;
+		unsigned int	bucket;
 
 		src_code = request->packet->code;
 		if (src_code >= FR_RADIUS_MAX_PACKET_CODE) src_code = 0;
@@ -178,8 +321,9 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		dst_code = request->reply->code;
 		if (dst_code >= FR_RADIUS_MAX_PACKET_CODE) dst_code = 0;
 
-		t->stats[src_code]++;
-		t->stats[dst_code]++;
+		bucket = stats_latency_bucket(fr_time_delta_to_usec(fr_time() - request->async->recv_time));
+
+		stats_count(&t->stats, src_code, dst_code, bucket);
 
 		/*
 		 *	Update source statistics
@@ -196,8 +340,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		}
 
 		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
+		stats_count(&stats->stats, src_code, dst_code, bucket);
 
 		/*
 		 *	Update destination statistics
@@ -214,26 +357,12 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		}
 
 		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
+		stats_count(&stats->stats, src_code, dst_code, bucket);
 
 		/*
 		 *	@todo - periodically clean up old entries.
 		 */
 
-		if ((t->last_global_update + NSEC) > request->async->recv_time) {
-			RETURN_MODULE_UPDATED;
-		}
-
-		t->last_global_update = request->async->recv_time;
-
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		pthread_mutex_unlock(&inst->mutex);
-
 		RETURN_MODULE_UPDATED;
 	}
 
@@ -262,19 +391,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 
 	switch (stats_type) {
 	case FR_STATS4_TYPE_VALUE_GLOBAL:			/* global */
-		/*
-		 *	Merge our stats with the global stats, and then copy
-		 *	the global stats to a thread-local variable.
-		 *
-		 *	The copy helps minimize mutex contention.
-		 */
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		memcpy(&local_stats, inst->stats, sizeof(inst->stats));
-		pthread_mutex_unlock(&inst->mutex);
+		stats_global(&total, inst);
 		vp = NULL;
 		break;
 
@@ -284,7 +401,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		if (!vp) RETURN_MODULE_NOOP;
 
 		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, src), &mydata);
+		coalesce(&total, t, offsetof(rlm_stats_thread_t, src), &mydata);
 		break;
 
 	case FR_STATS4_TYPE_VALUE_LISTENER:			/* dst */
@@ -293,7 +410,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		if (!vp) RETURN_MODULE_NOOP;
 
 		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, dst), &mydata);
+		coalesce(&total, t, offsetof(rlm_stats_thread_t, dst), &mydata);
 		break;
 
 	default:
@@ -314,19 +431,31 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
 		fr_dict_attr_t const *da;
 
-		if (!local_stats[i]) continue;
+		if (!total.packets[i]) continue;
 
 		strlcpy(buffer + 18, fr_packet_codes[i], sizeof(buffer) - 18);
 		da = fr_dict_attr_by_name(NULL, fr_dict_root(dict_radius), buffer);
 		if (!da) continue;
 
 		MEM(vp = fr_pair_afrom_da(request->reply, da));
-		vp->vp_uint64 = local_stats[i];
+		vp->vp_uint64 = total.packets[i];
 
 		fr_cursor_append(&cursor, vp);
 		(void) fr_cursor_tail(&cursor);
 	}
 
+	/*
+	 *	Latency percentiles, in microseconds.
+	 */
+	MEM(pair_update_reply(&vp, attr_freeradius_stats4_latency_p50) >= 0);
+	vp->vp_uint32 = stats_latency_percentile(&total, 500000);
+
+	MEM(pair_update_reply(&vp, attr_freeradius_stats4_latency_p99) >= 0);
+	vp->vp_uint32 = stats_latency_percentile(&total, 990000);
+
+	MEM(pair_update_reply(&vp, attr_freeradius_stats4_latency_p999) >= 0);
+	vp->vp_uint32 = stats_latency_percentile(&total, 999000);
+
 	RETURN_MODULE_OK;
 }
 
@@ -371,9 +500,20 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 	rlm_stats_t *inst = t->inst;
 	int i;
 
+	/*
+	 *	Keep the global counts from this thread.  Only
+	 *	threads holding the lock touch inst->stats.
+	 */
 	pthread_mutex_lock(&inst->mutex);
 	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-		inst->stats[i] += t->stats[i];
+		atomic_fetch_add_explicit(&inst->stats.packets[i],
+					  atomic_load_explicit(&t->stats.packets[i], memory_order_relaxed),
+					  memory_order_relaxed);
+	}
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+		atomic_fetch_add_explicit(&inst->stats.latency[i],
+					  atomic_load_explicit(&t->stats.latency[i], memory_order_relaxed),
+					  memory_order_relaxed);
 	}
 	fr_dlist_remove(&inst->list, t);
 	pthread_mutex_unlock(&inst->mutex);
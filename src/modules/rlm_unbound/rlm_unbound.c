@@ -29,55 +29,159 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/log.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include "io.h"
 #include "log.h"
 
+#define RR_TYPE_A	(1)
+#define RR_TYPE_PTR	(12)
+#define RR_TYPE_AAAA	(28)
+
+/** What happened to a query
+ *
+ */
+typedef enum {
+	UNBOUND_PENDING = 0,			//!< Still waiting for libunbound.
+	UNBOUND_FOUND,				//!< We have a record.
+	UNBOUND_NOT_FOUND,			//!< NXDOMAIN, or no records of that type.
+	UNBOUND_FAILED,				//!< Resolution failed, or the result was bogus.
+	UNBOUND_TIMEOUT				//!< We gave up waiting.
+} unbound_result_t;
+
+/** What a query is for
+ *
+ * MUST be the first member of the structures which are looked up by it.
+ */
+typedef struct {
+	char			*owner;		//!< Lowercased owner name.
+	uint16_t		rrtype;		//!< Type of record we want.
+} unbound_key_t;
+
+/** A result shared between all threads
+ *
+ */
+typedef struct {
+	unbound_key_t		key;		//!< MUST BE FIRST.
+	bool			negative;	//!< The owner, or records of that type, don't exist.
+	fr_value_box_t		value;		//!< The first record in the RRSET.
+	fr_time_t		expires;	//!< When the entry is no longer valid.
+	int32_t			heap_id;	//!< Where we are in the expiry heap.
+} unbound_cache_entry_t;
+
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	fr_hash_table_t		*ht;		//!< Entries by key.
+	fr_heap_t		*expiry;	//!< Entries by expiry time.
+	uint32_t		max_entries;
+	fr_time_delta_t		max_ttl;
+	fr_time_delta_t		negative_ttl;
+} unbound_cache_t;
+
 typedef struct {
-	struct ub_ctx	*ub;   /* This must come first.  Do not move */
+	char const		*name;
+	char const		*xlat_a_name;
+	char const		*xlat_aaaa_name;
+	char const		*xlat_ptr_name;
 
-	char const	*name;
-	char const	*xlat_a_name;
-	char const	*xlat_aaaa_name;
-	char const	*xlat_ptr_name;
+	uint32_t		timeout;
 
-	uint32_t	timeout;
+	char const		*filename;
 
-	char const	*filename;
+	struct {
+		bool			enable;
+		uint32_t		max_entries;
+		fr_time_delta_t		max_ttl;
+		fr_time_delta_t		negative_ttl;
+	} cache_config;
 
-	unbound_log_t	*u_log;
+	unbound_cache_t		*cache;		//!< Shared between threads.
 } rlm_unbound_t;
 
+typedef struct {
+	rlm_unbound_t const	*inst;
+	struct ub_ctx		*ub;		//!< This thread's resolver.
+	int			fd;		//!< Readable when libunbound has answers for us.
+	fr_event_list_t		*el;
+	fr_hash_table_t		*queries;	//!< In flight queries, so that identical
+						///< lookups from different requests are merged.
+	unbound_log_t		*u_log;
+} rlm_unbound_thread_t;
+
+/** Wrapper around the module thread struct for individual xlats
+ *
+ */
+typedef struct {
+	rlm_unbound_t const	*inst;		//!< Instance of rlm_unbound.
+	rlm_unbound_thread_t	*t;		//!< rlm_unbound thread instance.
+} xlat_unbound_thread_inst_t;
+
+/** A query sent to libunbound, which one or more requests are waiting for
+ *
+ */
+typedef struct {
+	unbound_key_t		key;		//!< MUST BE FIRST.
+	int			async_id;	//!< So we can cancel the query.
+	rlm_unbound_thread_t	*t;
+	fr_dlist_head_t		waiters;	//!< Requests waiting for the result.
+} unbound_query_t;
+
+/** A request waiting for a query
+ *
+ */
+typedef struct {
+	request_t		*request;	//!< To resume when the query is complete.
+	unbound_query_t		*query;		//!< NULL once we're no longer waiting for it.
+	unbound_result_t	result;
+	fr_value_box_t		value;		//!< If result is UNBOUND_FOUND.
+	fr_dlist_t		entry;
+} unbound_waiter_t;
+
+static const CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, rlm_unbound_t, cache_config.enable), .dflt = "yes" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_unbound_t, cache_config.max_entries), .dflt = "16384" },
+	{ FR_CONF_OFFSET("max_ttl", FR_TYPE_TIME_DELTA, rlm_unbound_t, cache_config.max_ttl), .dflt = "3600" },
+	{ FR_CONF_OFFSET("negative_ttl", FR_TYPE_TIME_DELTA, rlm_unbound_t, cache_config.negative_ttl), .dflt = "60" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	A mapping of configuration file names to internal variables.
  */
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_INPUT | FR_TYPE_REQUIRED, rlm_unbound_t, filename), .dflt = "${modconfdir}/unbound/default.conf" },
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, rlm_unbound_t, timeout), .dflt = "3000" },
+	{ FR_CONF_POINTER("cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
-/*
- *	Callback sent to libunbound for xlat functions.  Simply links the
- *	new ub_result via a pointer that has been allocated from the heap.
- *	This pointer has been pre-initialized to a magic value.
- */
-static void link_ubres(void *my_arg, int err, struct ub_result *result)
+static uint32_t unbound_key_hash(void const *data)
 {
-	struct ub_result **ubres = (struct ub_result **)my_arg;
+	unbound_key_t const *key = data;
 
-	/*
-	 *	Note that while result will be NULL on error, we are explicit
-	 *	here because that is actually a behavior that is suboptimal
-	 *	and only documented in the examples.  It could change.
-	 */
-	if (err) {
-		ERROR("%s", ub_strerror(err));
-		*ubres = NULL;
-	} else {
-		*ubres = result;
-	}
+	return fr_hash_update(&key->rrtype, sizeof(key->rrtype), fr_hash_string(key->owner));
+}
+
+static int unbound_key_cmp(void const *one, void const *two)
+{
+	unbound_key_t const *a = one, *b = two;
+
+	if (a->rrtype != b->rrtype) return (a->rrtype > b->rrtype) - (a->rrtype < b->rrtype);
+
+	return strcmp(a->owner, b->owner);
+}
+
+static int8_t unbound_cache_expiry_cmp(void const *one, void const *two)
+{
+	unbound_cache_entry_t const *a = one, *b = two;
+
+	return (a->expires > b->expires) - (a->expires < b->expires);
 }
 
 /*
@@ -146,259 +250,517 @@ static int rrlabels_tostr(char *out, char *rr, size_t left)
 	return offset;
 }
 
-static int ub_common_wait(rlm_unbound_t const *inst, request_t *request,
-			  char const *name, struct ub_result **ub, int async_id)
+
+static void unbound_cache_entry_free(unbound_cache_t *cache, unbound_cache_entry_t *entry)
 {
-	useconds_t iv, waited;
+	(void) fr_hash_table_delete(cache->ht, entry);
+	(void) fr_heap_extract(cache->expiry, entry);
+	talloc_free(entry);
+}
 
-	iv = inst->timeout > 64 ? 64000 : inst->timeout * 1000;
-	ub_process(inst->ub);
+/** Look up a previous result
+ *
+ * @param[in] ctx	to allocate the value in.
+ * @param[out] out	Where to write the value, if the result is UNBOUND_FOUND.
+ * @param[in] cache	to search.
+ * @param[in] key	to search for.
+ * @return
+ *	- UNBOUND_PENDING if there's no usable entry.
+ *	- UNBOUND_FOUND or UNBOUND_NOT_FOUND for a cached result.
+ */
+static unbound_result_t unbound_cache_find(TALLOC_CTX *ctx, fr_value_box_t *out,
+					   unbound_cache_t *cache, unbound_key_t const *key)
+{
+	unbound_cache_entry_t	*entry;
+	unbound_result_t	rcode = UNBOUND_PENDING;
 
-	for (waited = 0; (void const *)*ub == (void const *)inst; waited += iv, iv *= 2) {
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_find_by_data(cache->ht, key);
+	if (!entry) goto done;
 
-		if (waited + iv > (useconds_t)inst->timeout * 1000) {
-			usleep(inst->timeout * 1000 - waited);
-			ub_process(inst->ub);
-			break;
-		}
+	if (entry->expires <= fr_time()) {
+		unbound_cache_entry_free(cache, entry);
+		goto done;
+	}
 
-		usleep(iv);
+	if (entry->negative) {
+		rcode = UNBOUND_NOT_FOUND;
+		goto done;
+	}
 
-		/* Check if already handled by event loop */
-		if ((void const *)*ub != (void const *)inst) {
-			break;
-		}
+	if (fr_value_box_copy(ctx, out, &entry->value) == 0) rcode = UNBOUND_FOUND;
 
-		/* In case we are running single threaded */
-		ub_process(inst->ub);
-	}
+done:
+	pthread_mutex_unlock(&cache->mutex);
 
-	if ((void const *)*ub == (void const *)inst) {
-		int res;
+	return rcode;
+}
 
-		REDEBUG2("%s - DNS took too long", name);
+/** Add a result for other threads, and later requests, to use
+ *
+ * The TTL from the DNS response is honoured, but capped by max_ttl,
+ * or by negative_ttl for negative results.
+ */
+static void unbound_cache_insert(unbound_cache_t *cache, unbound_key_t const *key,
+				 unbound_result_t rcode, fr_value_box_t const *value, fr_time_delta_t ttl)
+{
+	unbound_cache_entry_t	*entry;
+	fr_time_t		now;
 
-		res = ub_cancel(inst->ub, async_id);
-		if (res) {
-			REDEBUG("%s - ub_cancel: %s", name, ub_strerror(res));
-		}
-		return -1;
+	if (rcode == UNBOUND_NOT_FOUND) {
+		if (ttl > cache->negative_ttl) ttl = cache->negative_ttl;
+	} else {
+		if (ttl > cache->max_ttl) ttl = cache->max_ttl;
 	}
+	if (ttl <= 0) return;
 
-	return 0;
-}
+	pthread_mutex_lock(&cache->mutex);
+	now = fr_time();
 
-static int ub_common_fail(request_t *request, char const *name, struct ub_result *ub)
-{
-	if (ub->bogus) {
-		RWDEBUG("%s - Bogus DNS response", name);
-		return -1;
+	while ((entry = fr_heap_peek(cache->expiry)) && (entry->expires <= now)) {
+		unbound_cache_entry_free(cache, entry);
 	}
 
-	if (ub->nxdomain) {
-		RDEBUG2("%s - NXDOMAIN", name);
-		return -1;
+	entry = fr_hash_table_find_by_data(cache->ht, key);
+	if (entry) unbound_cache_entry_free(cache, entry);
+
+	/*
+	 *	Make room by throwing away whatever would
+	 *	have expired first.
+	 */
+	if ((uint32_t) fr_hash_table_num_elements(cache->ht) >= cache->max_entries) {
+		unbound_cache_entry_free(cache, fr_heap_peek(cache->expiry));
 	}
 
-	if (!ub->havedata) {
-		RDEBUG2("%s - Empty result", name);
-		return -1;
+	MEM(entry = talloc_zero(cache, unbound_cache_entry_t));
+	MEM(entry->key.owner = talloc_strdup(entry, key->owner));
+	entry->key.rrtype = key->rrtype;
+	entry->expires = now + ttl;
+
+	if (rcode == UNBOUND_NOT_FOUND) {
+		entry->negative = true;
+
+	} else if (fr_value_box_copy(entry, &entry->value, value) < 0) {
+		talloc_free(entry);
+		goto done;
+	}
+
+	if (!fr_cond_assert(fr_hash_table_insert(cache->ht, entry))) {
+		talloc_free(entry);
+		goto done;
 	}
+	(void) fr_heap_insert(cache->expiry, entry);
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static int _unbound_cache_free(unbound_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
 
 	return 0;
 }
 
-/** Perform a DNS lookup for an A record
+/** Turn a result from libunbound into a value box
  *
- * @ingroup xlat_functions
  */
-static ssize_t xlat_a(TALLOC_CTX *ctx, char **out, size_t outlen,
-		      void const *mod_inst, UNUSED void const *xlat_inst,
-		      request_t *request, char const *fmt)
+static unbound_result_t unbound_result_decode(TALLOC_CTX *ctx, fr_value_box_t *out, fr_time_delta_t *ttl,
+					      unbound_key_t const *key, int err, struct ub_result *result)
 {
-	rlm_unbound_t const *inst = mod_inst;
-	struct ub_result **ubres;
-	int async_id;
-	char *fmt2; /* For const warnings.  Keep till new libunbound ships. */
+	fr_type_t	type;
 
-	/* This has to be on the heap, because threads. */
-	ubres = talloc(inst, struct ub_result *);
-
-	/* Used and thus impossible value from heap to designate incomplete */
-	memcpy(ubres, &mod_inst, sizeof(*ubres));
+	if (err) {
+		ERROR("%s - %s", key->owner, ub_strerror(err));
+		return UNBOUND_FAILED;
+	}
 
-	fmt2 = talloc_typed_strdup(ctx, fmt);
-	ub_resolve_async(inst->ub, fmt2, 1, 1, ubres, link_ubres, &async_id);
-	talloc_free(fmt2);
+	if (result->bogus) {
+		WARN("%s - Bogus DNS response", key->owner);
+		return UNBOUND_FAILED;
+	}
 
-	if (ub_common_wait(inst, request, inst->xlat_a_name, ubres, async_id)) {
-		goto error0;
+	/*
+	 *	SERVFAIL, REFUSED etc.  These aren't answers, so
+	 *	shouldn't be cached.
+	 */
+	if ((result->rcode != 0) && !result->nxdomain) {
+		DEBUG2("%s - DNS rcode %d", key->owner, result->rcode);
+		return UNBOUND_FAILED;
 	}
 
-	if (*ubres) {
-		if (ub_common_fail(request, inst->xlat_a_name, *ubres)) {
-			goto error1;
+	*ttl = fr_time_delta_from_sec(result->ttl > 0 ? result->ttl : 0);
+
+	if (result->nxdomain || !result->havedata) return UNBOUND_NOT_FOUND;
+
+	switch (key->rrtype) {
+	case RR_TYPE_A:
+		type = FR_TYPE_IPV4_ADDR;
+		goto network;
+
+	case RR_TYPE_AAAA:
+		type = FR_TYPE_IPV6_ADDR;
+	network:
+		if (fr_value_box_from_network(ctx, out, type, NULL,
+					      (uint8_t const *) result->data[0], result->len[0], true) < 0) {
+			return UNBOUND_FAILED;
 		}
+		break;
 
-		if (!inet_ntop(AF_INET, (*ubres)->data[0], *out, outlen)) {
-			goto error1;
-		};
+	case RR_TYPE_PTR:
+	{
+		char	buffer[256];
+		int	len;
+
+		len = rrlabels_tostr(buffer, result->data[0], sizeof(buffer));
+		if (len < 0) return UNBOUND_FAILED;
 
-		ub_resolve_free(*ubres);
-		talloc_free(ubres);
-		return strlen(*out);
+		if (fr_value_box_bstrndup(ctx, out, NULL, buffer, len, true) < 0) return UNBOUND_FAILED;
 	}
+		break;
 
-	RWDEBUG("%s - No result", inst->xlat_a_name);
+	default:
+		return UNBOUND_FAILED;
+	}
 
- error1:
-	ub_resolve_free(*ubres); /* Handles NULL gracefully */
+	return UNBOUND_FOUND;
+}
 
- error0:
-	talloc_free(ubres);
-	return -1;
+static void unbound_query_free(unbound_query_t *query)
+{
+	(void) fr_hash_table_delete(query->t->queries, query);
+	talloc_free(query);
 }
 
-/** Perform a DNS lookup for an AAAA record
+/** Stop a request waiting for a query
  *
- * @ingroup xlat_functions
+ * If no other requests are waiting for it, the query is cancelled.
  */
-static ssize_t xlat_aaaa(TALLOC_CTX *ctx, char **out, size_t outlen,
-			 void const *mod_inst, UNUSED void const *xlat_inst,
-			 request_t *request, char const *fmt)
+static void unbound_waiter_detach(unbound_waiter_t *waiter)
 {
-	rlm_unbound_t const *inst = mod_inst;
-	struct ub_result **ubres;
-	int async_id;
-	char *fmt2; /* For const warnings.  Keep till new libunbound ships. */
+	unbound_query_t	*query = waiter->query;
+	int		ret;
 
-	/* This has to be on the heap, because threads. */
-	ubres = talloc(inst, struct ub_result *);
+	if (!query) return;
+
+	fr_dlist_remove(&query->waiters, waiter);
+	waiter->query = NULL;
+
+	if (!fr_dlist_empty(&query->waiters)) return;
+
+	ret = ub_cancel(query->t->ub, query->async_id);
+	if (ret) DEBUG("%s - ub_cancel: %s", query->key.owner, ub_strerror(ret));
+
+	unbound_query_free(query);
+}
+
+/** Called by ub_process() when libunbound has finished a query
+ *
+ * Resumes every request waiting for the query.
+ */
+static void _unbound_query_done(void *mydata, int err, struct ub_result *result)
+{
+	unbound_query_t		*query = talloc_get_type_abort(mydata, unbound_query_t);
+	unbound_cache_t		*cache = query->t->inst->cache;
+	unbound_waiter_t	*waiter;
+	unbound_result_t	rcode;
+	fr_value_box_t		value;
+	fr_time_delta_t		ttl = 0;
 
-	/* Used and thus impossible value from heap to designate incomplete */
-	memcpy(ubres, &mod_inst, sizeof(*ubres));
+	fr_value_box_init_null(&value);
 
-	fmt2 = talloc_typed_strdup(ctx, fmt);
-	ub_resolve_async(inst->ub, fmt2, 28, 1, ubres, link_ubres, &async_id);
-	talloc_free(fmt2);
+	rcode = unbound_result_decode(query, &value, &ttl, &query->key, err, result);
+	ub_resolve_free(result);	/* Handles NULL gracefully */
 
-	if (ub_common_wait(inst, request, inst->xlat_aaaa_name, ubres, async_id)) {
-		goto error0;
+	if (cache && ((rcode == UNBOUND_FOUND) || (rcode == UNBOUND_NOT_FOUND))) {
+		unbound_cache_insert(cache, &query->key, rcode, &value, ttl);
 	}
 
-	if (*ubres) {
-		if (ub_common_fail(request, inst->xlat_aaaa_name, *ubres)) {
-			goto error1;
+	while ((waiter = fr_dlist_head(&query->waiters))) {
+		fr_dlist_remove(&query->waiters, waiter);
+		waiter->query = NULL;
+		waiter->result = rcode;
+
+		if ((rcode == UNBOUND_FOUND) && (fr_value_box_copy(waiter, &waiter->value, &value) < 0)) {
+			waiter->result = UNBOUND_FAILED;
 		}
-		if (!inet_ntop(AF_INET6, (*ubres)->data[0], *out, outlen)) {
-			goto error1;
-		};
-		ub_resolve_free(*ubres);
-		talloc_free(ubres);
-		return strlen(*out);
+
+		unlang_interpret_mark_resumable(waiter->request);
 	}
 
-	RWDEBUG("%s - No result", inst->xlat_aaaa_name);
+	unbound_query_free(query);
+}
 
-error1:
-	ub_resolve_free(*ubres); /* Handles NULL gracefully */
+static xlat_action_t xlat_unbound_resume(TALLOC_CTX *ctx, fr_cursor_t *out,
+					 request_t *request, UNUSED void const *xlat_inst,
+					 UNUSED void *xlat_thread_inst,
+					 UNUSED fr_value_box_t **in, void *rctx)
+{
+	unbound_waiter_t	*waiter = talloc_get_type_abort(rctx, unbound_waiter_t);
+	unbound_result_t	rcode = waiter->result;
+	fr_value_box_t		*vb;
+
+	switch (rcode) {
+	case UNBOUND_FOUND:
+		MEM(vb = fr_value_box_alloc_null(ctx));
+		if (fr_value_box_copy(vb, vb, &waiter->value) < 0) {
+			talloc_free(vb);
+			break;
+		}
+		fr_cursor_insert(out, vb);
+		break;
 
-error0:
-	talloc_free(ubres);
-	return -1;
+	case UNBOUND_NOT_FOUND:
+		RDEBUG2("No records found");
+		break;
+
+	case UNBOUND_TIMEOUT:
+		REDEBUG2("DNS took too long");
+		break;
+
+	default:
+		REDEBUG2("DNS lookup failed");
+		break;
+	}
+
+	unbound_waiter_detach(waiter);
+	talloc_free(waiter);
+
+	return (rcode == UNBOUND_FOUND) ? XLAT_ACTION_DONE : XLAT_ACTION_FAIL;
 }
 
-typedef struct {
-	struct ub_result	*result;	//!< The result from the previous operation.
-} dns_resume_ctx_t;
+static void xlat_unbound_signal(request_t *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
+				void *rctx, fr_state_signal_t action)
+{
+	unbound_waiter_t	*waiter = talloc_get_type_abort(rctx, unbound_waiter_t);
 
-/*
-static xlat_action_t xlat_ptr(TALLOC_CTX *ctx, fr_cursor_t *out,
-			      request_t *request, void const *xlat_inst, void *xlat_thread_inst,
-			      fr_value_box_t **in)
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Cancelling DNS lookup");
+
+	unbound_waiter_detach(waiter);
+	talloc_free(waiter);
+}
+
+static void _xlat_unbound_timeout(request_t *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
+				  void *rctx, UNUSED fr_time_t fired)
 {
-	if (!*in) return XLAT_ACTION_DONE;
+	unbound_waiter_t	*waiter = talloc_get_type_abort(rctx, unbound_waiter_t);
+
+	if (waiter->result != UNBOUND_PENDING) return; /* it MUST already have been marked resumable. */
+
+	/*
+	 *	Other requests may still be waiting for the
+	 *	same query, so we only stop waiting ourselves.
+	 */
+	unbound_waiter_detach(waiter);
+	waiter->result = UNBOUND_TIMEOUT;
+
+	unlang_interpret_mark_resumable(request);
+}
+
+/** Look up a record, from the cache, or from an in-flight or new query
+ *
+ */
+static xlat_action_t xlat_unbound_common(TALLOC_CTX *ctx, fr_cursor_t *out,
+					 request_t *request, xlat_unbound_thread_inst_t *xt,
+					 fr_value_box_t **in, uint16_t rrtype)
+{
+	rlm_unbound_t const	*inst = xt->inst;
+	rlm_unbound_thread_t	*t = xt->t;
+	unbound_key_t		key;
+	unbound_query_t		*query;
+	unbound_waiter_t	*waiter;
+	char			*p;
+	int			ret;
+
+	if (!*in) return XLAT_ACTION_FAIL;
 
 	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
-		RPEDEBUG("Failed concatenating input string for attribute reference");
+		RPEDEBUG("Failed concatenating input");
 		return XLAT_ACTION_FAIL;
 	}
 
-	yield_to
+	/*
+	 *	DNS names are case insensitive, so don't let
+	 *	the case stop us finding previous results.
+	 */
+	MEM(key.owner = talloc_bstrndup(ctx, (*in)->vb_strvalue, (*in)->vb_length));
+	for (p = key.owner; *p; p++) *p = tolower((uint8_t) *p);
+	key.rrtype = rrtype;
+
+	if (inst->cache) {
+		fr_value_box_t	*vb;
+
+		MEM(vb = fr_value_box_alloc_null(ctx));
+		switch (unbound_cache_find(vb, vb, inst->cache, &key)) {
+		case UNBOUND_FOUND:
+			RDEBUG2("Found cached result for %s", key.owner);
+			talloc_free(key.owner);
+			fr_cursor_insert(out, vb);
+			return XLAT_ACTION_DONE;
+
+		case UNBOUND_NOT_FOUND:
+			RDEBUG2("Found cached negative result for %s", key.owner);
+			talloc_free(key.owner);
+			talloc_free(vb);
+			return XLAT_ACTION_FAIL;
+
+		default:
+			talloc_free(vb);
+			break;
+		}
+	}
 
+	/*
+	 *	Someone else is already looking this up,
+	 *	so wait for their answer.
+	 */
+	query = fr_hash_table_find_by_data(t->queries, &key);
+	if (query) {
+		RDEBUG2("Waiting for in-flight lookup of %s", key.owner);
+		talloc_free(key.owner);
+
+	} else {
+		MEM(query = talloc_zero(t, unbound_query_t));
+		query->key.owner = talloc_steal(query, key.owner);
+		query->key.rrtype = rrtype;
+		query->t = t;
+		fr_dlist_talloc_init(&query->waiters, unbound_waiter_t, entry);
+
+		ret = ub_resolve_async(t->ub, query->key.owner, rrtype, 1, query, _unbound_query_done, &query->async_id);
+		if (ret) {
+			REDEBUG("%s - ub_resolve_async: %s", query->key.owner, ub_strerror(ret));
+			talloc_free(query);
+			return XLAT_ACTION_FAIL;
+		}
+
+		if (!fr_cond_assert(fr_hash_table_insert(t->queries, query))) {
+			(void) ub_cancel(t->ub, query->async_id);
+			talloc_free(query);
+			return XLAT_ACTION_FAIL;
+		}
+	}
+
+	MEM(waiter = talloc_zero(ctx, unbound_waiter_t));
+	waiter->request = request;
+	waiter->query = query;
+	fr_dlist_insert_tail(&query->waiters, waiter);
+
+	if (inst->timeout &&
+	    (unlang_xlat_event_timeout_add(request, _xlat_unbound_timeout, waiter,
+					   fr_time() + fr_time_delta_from_msec(inst->timeout)) < 0)) {
+		RPEDEBUG("Failed adding timeout");
+		unbound_waiter_detach(waiter);
+		talloc_free(waiter);
+		return XLAT_ACTION_FAIL;
+	}
+
+	return unlang_xlat_yield(request, xlat_unbound_resume, xlat_unbound_signal, waiter);
+}
+
+/** Perform a DNS lookup for an A record
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t xlat_a(TALLOC_CTX *ctx, fr_cursor_t *out,
+			    request_t *request, UNUSED void const *xlat_inst, void *xlat_thread_inst,
+			    fr_value_box_t **in)
+{
+	return xlat_unbound_common(ctx, out, request,
+				   talloc_get_type_abort(xlat_thread_inst, xlat_unbound_thread_inst_t),
+				   in, RR_TYPE_A);
+}
+
+/** Perform a DNS lookup for an AAAA record
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t xlat_aaaa(TALLOC_CTX *ctx, fr_cursor_t *out,
+			       request_t *request, UNUSED void const *xlat_inst, void *xlat_thread_inst,
+			       fr_value_box_t **in)
+{
+	return xlat_unbound_common(ctx, out, request,
+				   talloc_get_type_abort(xlat_thread_inst, xlat_unbound_thread_inst_t),
+				   in, RR_TYPE_AAAA);
 }
-*/
 
 /** Perform a DNS lookup for a PTR record
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_ptr(TALLOC_CTX *ctx, char **out, size_t outlen,
-			void const *mod_inst, UNUSED void const *xlat_inst,
-			request_t *request, char const *fmt)
+static xlat_action_t xlat_ptr(TALLOC_CTX *ctx, fr_cursor_t *out,
+			      request_t *request, UNUSED void const *xlat_inst, void *xlat_thread_inst,
+			      fr_value_box_t **in)
 {
-	rlm_unbound_t const *inst = mod_inst;
-	struct ub_result **ubres;
-	int async_id;
-	char *fmt2; /* For const warnings.  Keep till new libunbound ships. */
+	return xlat_unbound_common(ctx, out, request,
+				   talloc_get_type_abort(xlat_thread_inst, xlat_unbound_thread_inst_t),
+				   in, RR_TYPE_PTR);
+}
 
-	/* This has to be on the heap, because threads. */
-	ubres = talloc(inst, struct ub_result *);
+/** Resolves and caches the module's thread instance for use by a specific xlat instance
+ *
+ */
+static int mod_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
+				       UNUSED xlat_exp_t const *exp, void *uctx)
+{
+	rlm_unbound_t			*inst = talloc_get_type_abort(uctx, rlm_unbound_t);
+	xlat_unbound_thread_inst_t	*xt = xlat_thread_inst;
 
-	/* Used and thus impossible value from heap to designate incomplete */
-	memcpy(ubres, &mod_inst, sizeof(*ubres));
+	xt->inst = inst;
+	xt->t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_unbound_thread_t);
 
-	fmt2 = talloc_typed_strdup(ctx, fmt);
-	ub_resolve_async(inst->ub, fmt2, 12, 1, ubres, link_ubres, &async_id);
-	talloc_free(fmt2);
+	return 0;
+}
 
-	if (ub_common_wait(inst, request, inst->xlat_ptr_name,
-			   ubres, async_id)) {
-		goto error0;
-	}
+/** Process answers from libunbound
+ *
+ * libunbound does the resolution in its own thread, and makes the fd
+ * readable when it has answers for us.  ub_process() reads them, and
+ * calls _unbound_query_done() for each one.
+ */
+static void _unbound_fd_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_unbound_thread_t	*t = talloc_get_type_abort(uctx, rlm_unbound_thread_t);
+	int			ret;
 
-	if (*ubres) {
-		if (ub_common_fail(request, inst->xlat_ptr_name, *ubres)) {
-			goto error1;
-		}
-		if (rrlabels_tostr(*out, (*ubres)->data[0], outlen) < 0) {
-			goto error1;
-		}
-		ub_resolve_free(*ubres);
-		talloc_free(ubres);
-		return strlen(*out);
-	}
+	ret = ub_process(t->ub);
+	if (ret) ERROR("ub_process: %s", ub_strerror(ret));
+}
 
-	RWDEBUG("%s - No result", inst->xlat_ptr_name);
+static void _unbound_fd_error(fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_unbound_thread_t	*t = talloc_get_type_abort(uctx, rlm_unbound_thread_t);
 
-error1:
-	ub_resolve_free(*ubres);  /* Handles NULL gracefully */
+	ERROR("Failed reading from libunbound: %s - New lookups will time out", fr_syserror(fd_errno));
 
-error0:
-	talloc_free(ubres);
-	return -1;
+	(void) fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+	t->fd = -1;
 }
 
-static int mod_instantiate(void *instance, CONF_SECTION *conf)
+static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
 {
-	rlm_unbound_t	*inst = instance;
-	int		res;
-	char		k[64]; /* To silence const warns until newer unbound in distros */
+	rlm_unbound_t		*inst = talloc_get_type_abort(instance, rlm_unbound_t);
+	rlm_unbound_thread_t	*t = talloc_get_type_abort(thread, rlm_unbound_thread_t);
+	int			res;
+	char			k[64]; /* To silence const warns until newer unbound in distros */
 
-	/*
-	 *	@todo - move this to the thread-instantiate function
-	 */
-	inst->ub = ub_ctx_create();
-	if (!inst->ub) {
+	t->inst = inst;
+	t->el = el;
+	t->fd = -1;
+
+	t->ub = ub_ctx_create();
+	if (!t->ub) {
 		cf_log_err(conf, "ub_ctx_create failed");
 		return -1;
 	}
 
 	/*
-	 *	Note unbound threads WILL happen with -s option, if it matters.
-	 *	We cannot tell from here whether that option is in effect.
+	 *	Have libunbound do the resolution in a thread of
+	 *	its own, which tells us when it's done via ub_fd().
+	 *	That way, the worker never blocks or polls.
 	 */
-	res = ub_ctx_async(inst->ub, 1);
+	res = ub_ctx_async(t->ub, 1);
 	if (res) goto error;
 
 	/* Now load the config file, which can override gleaned settings. */
@@ -406,11 +768,11 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		char *file;
 
 		memcpy(&file, &inst->filename, sizeof(file));
-		res = ub_ctx_config(inst->ub, file);
+		res = ub_ctx_config(t->ub, file);
 		if (res) goto error;
 	}
 
-	if (unbound_log_init(inst, &inst->u_log, inst->ub) < 0) goto error;
+	if (unbound_log_init(t, &t->u_log, t->ub) < 0) goto fail;
 
 	/*
 	 *  Now we need to finalize the context.
@@ -421,18 +783,88 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	 *  data did not exist.
 	 */
 	strcpy(k, "notar33lsite.foo123.nottld A 127.0.0.1");
-	ub_ctx_data_remove(inst->ub, k);
+	ub_ctx_data_remove(t->ub, k);
+
+	MEM(t->queries = fr_hash_table_create(t, unbound_key_hash, unbound_key_cmp, NULL));
+
+	t->fd = ub_fd(t->ub);
+	if (t->fd < 0) {
+		cf_log_err(conf, "Failed getting libunbound fd");
+		goto fail;
+	}
+
+	if (fr_event_fd_insert(t, el, t->fd, _unbound_fd_read, NULL, _unbound_fd_error, t) < 0) {
+		cf_log_perr(conf, "Failed adding libunbound fd to event loop");
+		t->fd = -1;
+		goto fail;
+	}
+
 	return 0;
 
- error:
+error:
 	cf_log_err(conf, "%s", ub_strerror(res));
 
+fail:
+	talloc_free(t->u_log);	/* Free logging first */
+	t->u_log = NULL;
+	ub_ctx_delete(t->ub);
+	t->ub = NULL;
+
 	return -1;
 }
 
+static int mod_thread_detach(fr_event_list_t *el, void *thread)
+{
+	rlm_unbound_thread_t	*t = talloc_get_type_abort(thread, rlm_unbound_thread_t);
+
+	if (t->fd >= 0) (void) fr_event_fd_delete(el, t->fd, FR_EVENT_FILTER_IO);
+	t->fd = -1;
+
+	if (!t->ub) return 0;
+
+	/*
+	 *	All the requests have been cancelled by now,
+	 *	and with them, any queries.
+	 *
+	 *	This can hang/leave zombies currently
+	 *	see upstream bug #519
+	 *	...so expect valgrind to complain with -m
+	 */
+	talloc_free(t->u_log);	/* Free logging first */
+	t->u_log = NULL;
+
+	ub_ctx_delete(t->ub);
+	t->ub = NULL;
+
+	return 0;
+}
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_unbound_t	*inst = talloc_get_type_abort(instance, rlm_unbound_t);
+	unbound_cache_t	*cache;
+
+	if (!inst->cache_config.enable) return 0;
+
+	FR_INTEGER_BOUND_CHECK("cache.max_entries", inst->cache_config.max_entries, >=, 1);
+
+	MEM(cache = talloc_zero(inst, unbound_cache_t));
+	MEM(cache->ht = fr_hash_table_create(cache, unbound_key_hash, unbound_key_cmp, NULL));
+	MEM(cache->expiry = fr_heap_talloc_alloc(cache, unbound_cache_expiry_cmp, unbound_cache_entry_t, heap_id));
+	pthread_mutex_init(&cache->mutex, NULL);
+	cache->max_entries = inst->cache_config.max_entries;
+	cache->max_ttl = inst->cache_config.max_ttl;
+	cache->negative_ttl = inst->cache_config.negative_ttl;
+	talloc_set_destructor(cache, _unbound_cache_free);
+	inst->cache = cache;
+
+	return 0;
+}
+
 static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 {
-	rlm_unbound_t *inst = instance;
+	rlm_unbound_t	*inst = instance;
+	xlat_t const	*xlat;
 
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
@@ -446,32 +878,23 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	MEM(inst->xlat_aaaa_name = talloc_typed_asprintf(inst, "%s-aaaa", inst->name));
 	MEM(inst->xlat_ptr_name = talloc_typed_asprintf(inst, "%s-ptr", inst->name));
 
-	if (xlat_register_legacy(inst, inst->xlat_a_name, xlat_a, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN) ||
-	    xlat_register_legacy(inst, inst->xlat_aaaa_name, xlat_aaaa, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN) ||
-	    xlat_register_legacy(inst, inst->xlat_ptr_name, xlat_ptr, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN)) {
-		cf_log_err(conf, "Failed registering xlats");
-		return -1;
-	}
-
-	return 0;
-}
+	xlat = xlat_register(inst, inst->xlat_a_name, xlat_a, true);
+	if (!xlat) goto error;
+	xlat_async_thread_instantiate_set(xlat, mod_xlat_thread_instantiate, xlat_unbound_thread_inst_t, NULL, inst);
 
-static int mod_detach(void *instance)
-{
-	rlm_unbound_t *inst = instance;
+	xlat = xlat_register(inst, inst->xlat_aaaa_name, xlat_aaaa, true);
+	if (!xlat) goto error;
+	xlat_async_thread_instantiate_set(xlat, mod_xlat_thread_instantiate, xlat_unbound_thread_inst_t, NULL, inst);
 
-	ub_process(inst->ub);
-
-	/*
-	 *	This can hang/leave zombies currently
-	 *	see upstream bug #519
-	 *	...so expect valgrind to complain with -m
-	 */
-	talloc_free(inst->u_log);	/* Free logging first */
-
-	ub_ctx_delete(inst->ub);
+	xlat = xlat_register(inst, inst->xlat_ptr_name, xlat_ptr, true);
+	if (!xlat) goto error;
+	xlat_async_thread_instantiate_set(xlat, mod_xlat_thread_instantiate, xlat_unbound_thread_inst_t, NULL, inst);
 
 	return 0;
+
+error:
+	cf_log_err(conf, "Failed registering xlats");
+	return -1;
 }
 
 extern module_t rlm_unbound;
@@ -483,5 +906,9 @@ module_t rlm_unbound = {
 	.config			= module_config,
 	.bootstrap		= mod_bootstrap,
 	.instantiate		= mod_instantiate,
-	.detach			= mod_detach
+
+	.thread_inst_size	= sizeof(rlm_unbound_thread_t),
+	.thread_inst_type	= "rlm_unbound_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach
 };
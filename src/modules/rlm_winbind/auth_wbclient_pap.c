@@ -35,36 +35,47 @@ RCSID("$Id$")
 #include "rlm_winbind.h"
 #include "auth_wbclient_pap.h"
 
-/** PAP authentication direct to winbind via Samba's libwbclient library
+/** Release everything an authentication holds
  *
- * @param[in] inst Module instance
- * @param[in] request The current request
- * @param[in] password the User-Password
+ * Always called in the worker which allocated the authentication,
+ * so the connection goes back to the right pool.
+ */
+static int _winbind_auth_free(winbind_auth_t *auth)
+{
+	if (auth->info) wbcFreeMemory(auth->info);
+	if (auth->error) wbcFreeMemory(auth->error);
+	if (auth->wb_ctx) fr_pool_connection_release(auth->inst->wb_pool, NULL, auth->wb_ctx);
+
+	return 0;
+}
+
+/** Prepare a PAP authentication against winbind
  *
- * @return
- *	- 0	Success
- *	- -1	Authentication failure
- *	- -648	Password expired
+ * Expands the username and domain, copies the password and gets a
+ * winbind connection, so that #winbind_auth_run doesn't need the request.
  *
+ * @param[in] ctx	to allocate the authentication in.
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] password	the User-Password.
+ * @return
+ *	- The authentication, to pass to #winbind_auth_run.
+ *	- NULL on error.
  */
-int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_t *password)
+winbind_auth_t *winbind_auth_alloc(TALLOC_CTX *ctx, rlm_winbind_t const *inst, request_t *request,
+				   fr_pair_t *password)
 {
-	int ret = -1;
-	struct wbcContext *wb_ctx;
-	struct wbcAuthUserParams authparams;
-	wbcErr err;
-	int len;
-	struct wbcAuthUserInfo *info = NULL;
-	struct wbcAuthErrorInfo *error = NULL;
-	char user_name_buf[500];
-	char domain_name_buf[500];
+	winbind_auth_t	*auth;
+	ssize_t		slen;
 
 	/*
 	 * Clear the auth parameters - this is important, as
 	 * there are options that will cause wbcAuthenticateUserEx
 	 * to bomb out if not zero.
 	 */
-	memset(&authparams, 0, sizeof(authparams));
+	MEM(auth = talloc_zero(ctx, winbind_auth_t));
+	auth->inst = inst;
+	talloc_set_destructor(auth, _winbind_auth_free);
 
 	/*
 	 * wb_username must be set for this function to be called
@@ -74,61 +85,93 @@ int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_
 	/*
 	 * Get the username and domain from the configuration
 	 */
-	len = tmpl_expand(&authparams.account_name, user_name_buf, sizeof(user_name_buf),
-			  request, inst->wb_username, NULL, NULL);
-	if (len < 0) {
+	slen = tmpl_aexpand(auth, &auth->user_name, request, inst->wb_username, NULL, NULL);
+	if (slen < 0) {
 		REDEBUG2("Unable to expand winbind_username");
-		goto done;
+	error:
+		talloc_free(auth);
+		return NULL;
 	}
+	auth->authparams.account_name = auth->user_name;
 
 	if (inst->wb_domain) {
-		len = tmpl_expand(&authparams.domain_name, domain_name_buf, sizeof(domain_name_buf),
-				  request, inst->wb_domain, NULL, NULL);
-		if (len < 0) {
+		slen = tmpl_aexpand(auth, &auth->domain_name, request, inst->wb_domain, NULL, NULL);
+		if (slen < 0) {
 			REDEBUG2("Unable to expand winbind_domain");
-			goto done;
+			goto error;
 		}
+		auth->authparams.domain_name = auth->domain_name;
 	} else {
 		RWDEBUG2("No domain specified; authentication may fail because of this");
 	}
 
+	/*
+	 * The request's copy may be gone by the
+	 * time the offload thread gets to it.
+	 */
+	MEM(auth->password = talloc_bstrndup(auth, password->vp_strvalue, password->vp_length));
 
 	/*
 	 * Build the wbcAuthUserParams structure with what we know
 	 */
-	authparams.level = WBC_AUTH_USER_LEVEL_PLAIN;
-	authparams.password.plaintext = password->data.vb_strvalue;
+	auth->authparams.level = WBC_AUTH_USER_LEVEL_PLAIN;
+	auth->authparams.password.plaintext = auth->password;
 
 	/*
 	 * Parameters documented as part of the MSV1_0_SUBAUTH_LOGON structure
 	 * at https://msdn.microsoft.com/aa378767.aspx
 	 */
-	authparams.parameter_control |= WBC_MSV1_0_CLEARTEXT_PASSWORD_ALLOWED |
-					WBC_MSV1_0_ALLOW_WORKSTATION_TRUST_ACCOUNT |
-					WBC_MSV1_0_ALLOW_SERVER_TRUST_ACCOUNT;
+	auth->authparams.parameter_control |= WBC_MSV1_0_CLEARTEXT_PASSWORD_ALLOWED |
+					      WBC_MSV1_0_ALLOW_WORKSTATION_TRUST_ACCOUNT |
+					      WBC_MSV1_0_ALLOW_SERVER_TRUST_ACCOUNT;
 
-	/*
-	 * Send auth request across to winbind
-	 */
-	wb_ctx = fr_pool_connection_get(inst->wb_pool, request);
-	if (wb_ctx == NULL) {
+	auth->wb_ctx = fr_pool_connection_get(inst->wb_pool, request);
+	if (auth->wb_ctx == NULL) {
 		RERROR("Unable to get winbind connection from pool");
-		goto done;
+		goto error;
 	}
 
-	RDEBUG2("Sending authentication request user='%s' domain='%s'", authparams.account_name,
-									authparams.domain_name);
+	RDEBUG2("Sending authentication request user='%s' domain='%s'", auth->authparams.account_name,
+									auth->authparams.domain_name);
 
-	err = wbcCtxAuthenticateUserEx(wb_ctx, &authparams, &info, &error);
+	return auth;
+}
 
-	fr_pool_connection_release(inst->wb_pool, request, wb_ctx);
+/** Send the authentication request across to winbind
+ *
+ * Called from an offload thread, or from the worker if offload is
+ * disabled.  Must not touch the request.
+ *
+ * @param[in] uctx	The #winbind_auth_t from #winbind_auth_alloc.
+ */
+void winbind_auth_run(void *uctx)
+{
+	winbind_auth_t	*auth = talloc_get_type_abort(uctx, winbind_auth_t);
+
+	auth->err = wbcCtxAuthenticateUserEx(auth->wb_ctx, &auth->authparams, &auth->info, &auth->error);
+}
 
+/** Interpret the result of a PAP authentication against winbind
+ *
+ * @param[in] request	The current request.
+ * @param[in] auth	after #winbind_auth_run has been called.
+ *
+ * @return
+ *	- 0	Success
+ *	- -1	Authentication failure
+ *	- -648	Password expired
+ *
+ */
+int winbind_auth_result(request_t *request, winbind_auth_t const *auth)
+{
+	int				ret = -1;
+	struct wbcAuthErrorInfo const	*error = auth->error;
 
 	/*
 	 * Try and give some useful feedback on what happened. There are only
 	 * a few errors that can actually be returned from wbcCtxAuthenticateUserEx.
 	 */
-	switch (err) {
+	switch (auth->err) {
 	case WBC_ERR_SUCCESS:
 		ret = 0;
 		RDEBUG2("Authenticated successfully");
@@ -176,18 +219,12 @@ int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_
 		 * neither of which are particularly likely.
 		 */
 		if (error && error->display_string) {
-			REDEBUG2("Failed authenticating user: %s (%s)", error->display_string, wbcErrorString(err));
+			REDEBUG2("Failed authenticating user: %s (%s)", error->display_string, wbcErrorString(auth->err));
 		} else {
-			REDEBUG2("Failed authenticating user: Winbind error (%s)", wbcErrorString(err));
+			REDEBUG2("Failed authenticating user: Winbind error (%s)", wbcErrorString(auth->err));
 		}
 		break;
 	}
 
-
-done:
-	if (info) wbcFreeMemory(info);
-	if (error) wbcFreeMemory(error);
-
 	return ret;
 }
-
@@ -4,4 +4,26 @@
 
 RCSIDH(auth_wbclient_h, "$Id$")
 
-int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_t *password);
+/** A PAP authentication, run in an offload thread or the worker
+ *
+ */
+typedef struct {
+	rlm_winbind_t const		*inst;		//!< Module instance.
+	struct wbcContext		*wb_ctx;	//!< Connection from the pool.
+
+	char				*user_name;	//!< Expanded winbind username.
+	char				*domain_name;	//!< Expanded winbind domain.
+	char				*password;	//!< Copy of the User-Password.
+	struct wbcAuthUserParams	authparams;	//!< Points to the above.
+
+	wbcErr				err;		//!< Result of the call.
+	struct wbcAuthUserInfo		*info;
+	struct wbcAuthErrorInfo		*error;
+} winbind_auth_t;
+
+winbind_auth_t *winbind_auth_alloc(TALLOC_CTX *ctx, rlm_winbind_t const *inst, request_t *request,
+				   fr_pair_t *password);
+
+void winbind_auth_run(void *uctx);
+
+int winbind_auth_result(request_t *request, winbind_auth_t const *auth);
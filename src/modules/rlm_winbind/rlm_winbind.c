@@ -47,6 +47,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("username", FR_TYPE_TMPL, rlm_winbind_t, wb_username) },
 	{ FR_CONF_OFFSET("domain", FR_TYPE_TMPL, rlm_winbind_t, wb_domain) },
 	{ FR_CONF_POINTER("group", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) group_config },
+	{ FR_CONF_OFFSET("offload", FR_TYPE_SUBSECTION, rlm_winbind_t, offload_conf), .subcs = (void const *) fr_offload_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -436,13 +437,56 @@ no_domain:
 		wbcFreeMemory(wb_info);
 	}
 
+	/*
+	 *	Start the threads which make the blocking
+	 *	calls to winbind.
+	 */
+	if (inst->offload_conf.threads) {
+		FR_INTEGER_BOUND_CHECK("offload.threads", inst->offload_conf.threads, <=, 128);
+		FR_INTEGER_BOUND_CHECK("offload.max_queued", inst->offload_conf.max_queued, >=, 1);
+
+		inst->offload = fr_offload_alloc(inst, &inst->offload_conf);
+		if (!inst->offload) {
+			cf_log_perr(conf, "Failed starting offload threads");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/** Set up the per-thread offload state
+ *
+ * @param[in] conf	Module configuration (unused)
+ * @param[in] instance	This module's instance
+ * @param[in] el	The worker's event list
+ * @param[in] thread	This module's thread instance
+ *
+ * @return
+ *	- 0	success
+ *	- -1	failure
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_winbind_t const	*inst = talloc_get_type_abort_const(instance, rlm_winbind_t);
+	rlm_winbind_thread_t	*t = thread;
+
+	if (!inst->offload) return 0;
+
+	t->offload = fr_offload_thread_alloc(t, inst->offload, el);
+	if (!t->offload) {
+		PERROR("Failed setting up offload");
+		return -1;
+	}
+
 	return 0;
 }
 
 
 /** Tidy up module instance
  *
- * Frees up the libwbclient connection pool.
+ * Stops the offload threads, and frees up the libwbclient connection pool.
  *
  * @param[in] instance This module's instance (unused)
  * @return 0
@@ -451,6 +495,7 @@ static int mod_detach(void *instance)
 {
 	rlm_winbind_t *inst = instance;
 
+	TALLOC_FREE(inst->offload);
 	fr_pool_free(inst->wb_pool);
 
 	return 0;
@@ -491,7 +536,33 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 }
 
 
+/** Return the result of authenticating against winbind
+ *
+ * No need for many debug outputs or errors as the auth function is
+ * chatty enough.
+ *
+ * @param[out] p_result		The result of the module call.
+ * @param[in] mctx		Module instance data.
+ * @param[in] request		The current request
+ * @param[in] rctx		The #winbind_auth_t.
+ */
+static unlang_action_t mod_authenticate_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					       request_t *request, void *rctx)
+{
+	winbind_auth_t		*auth = talloc_get_type_abort(rctx, winbind_auth_t);
+
+	if (winbind_auth_result(request, auth) == 0) {
+		REDEBUG2("User authenticated successfully using winbind");
+		RETURN_MODULE_OK;
+	}
+
+	RETURN_MODULE_REJECT;
+}
+
 /** Authenticate the user via libwbclient and winbind
+ *
+ * The call to winbind blocks, so it's made in an offload thread
+ * if any are configured.
  *
  * @param[out] p_result		The result of the module call.
  * @param[in] mctx		Module instance data.
@@ -500,7 +571,9 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_winbind_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_winbind_t);
+	rlm_winbind_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_winbind_thread_t);
 	fr_pair_t		*username, *password;
+	winbind_auth_t		*auth;
 
 	username = fr_pair_find_by_da(&request->request_pairs, attr_user_name);
 	password = fr_pair_find_by_da(&request->request_pairs, attr_user_password);
@@ -537,16 +610,13 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	}
 
 	/*
-	 *	Authenticate and return OK if successful. No need for
-	 *	many debug outputs or errors as the auth function is
-	 *	chatty enough.
+	 *	The job is parented by NULL, as it's freed
+	 *	by the offload code once we've resumed.
 	 */
-	if (do_auth_wbclient_pap(inst, request, password) == 0) {
-		REDEBUG2("User authenticated successfully using winbind");
-		RETURN_MODULE_OK;
-	}
+	auth = winbind_auth_alloc(NULL, inst, request, password);
+	if (!auth) RETURN_MODULE_REJECT;
 
-	RETURN_MODULE_REJECT;
+	return fr_offload_yield(p_result, mctx, request, t->offload, winbind_auth_run, mod_authenticate_resume, auth);
 }
 
 
@@ -564,8 +634,11 @@ module_t rlm_winbind = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "winbind",
 	.inst_size	= sizeof(rlm_winbind_t),
+	.thread_inst_size = sizeof(rlm_winbind_thread_t),
+	.thread_inst_type = "rlm_winbind_thread_t",
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.thread_instantiate = mod_thread_instantiate,
 	.bootstrap	= mod_bootstrap,
 	.detach		= mod_detach,
 	.methods = {
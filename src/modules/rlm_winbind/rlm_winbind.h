@@ -4,6 +4,7 @@
 #include "config.h"
 #include <wbclient.h>
 #include <freeradius-devel/server/pool.h>
+#include <freeradius-devel/server/offload.h>
 
 /*
  *      Structure for the module configuration.
@@ -21,4 +22,15 @@ typedef struct {
 	tmpl_t		*group_username;
 	bool			group_add_domain;
 	char const		*group_attribute;
+
+	/* offload config */
+	fr_offload_conf_t	offload_conf;
+	fr_offload_t		*offload;
 } rlm_winbind_t;
+
+/*
+ *      Per-thread data.
+ */
+typedef struct {
+	fr_offload_thread_t	*offload;	//!< NULL if offload is disabled.
+} rlm_winbind_thread_t;
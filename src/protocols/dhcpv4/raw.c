@@ -48,11 +48,32 @@
 #ifdef HAVE_LINUX_IF_PACKET_H
 #  include <linux/if_packet.h>
 #  include <linux/if_ether.h>
+#  include <linux/filter.h>
 #endif
 
 #include <net/if_arp.h>
 
 #ifdef HAVE_LINUX_IF_PACKET_H
+/** Only pass unfragmented IPv4 UDP frames, to the DHCPv4 server or client ports
+ *
+ * ETH_P_ALL sockets otherwise get a copy of every frame on the interface,
+ * which all have to be read, and discarded, in userspace.
+ */
+static struct sock_filter dhcpv4_raw_filter_code[] = {
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),				/* Ethernet type */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 9),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ETH_HDR_SIZE + 9),		/* IP protocol */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 7),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, ETH_HDR_SIZE + 6),		/* IP fragment offset */
+	BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 5, 0),
+	BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, ETH_HDR_SIZE),		/* IP header length */
+	BPF_STMT(BPF_LD | BPF_H | BPF_IND, ETH_HDR_SIZE + 2),		/* UDP destination port */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 67, 1, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 68, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0x40000),				/* accept */
+	BPF_STMT(BPF_RET | BPF_K, 0),					/* drop */
+};
+
 /** Open a raw socket to read/write packets from/to
  *
  * @param[out] link_layer	A sockaddr_ll struct to populate.  Must be passed to other raw
@@ -76,6 +97,22 @@ int fr_dhcpv4_raw_socket_open(struct sockaddr_ll *link_layer, int ifindex)
 		return fd;
 	}
 
+	/*
+	 *	Have the kernel discard anything which isn't DHCP.
+	 *	This is an optimisation, the receive path still
+	 *	checks every layer, so failure isn't fatal.
+	 */
+	{
+		struct sock_fprog filter = {
+			.len = NUM_ELEMENTS(dhcpv4_raw_filter_code),
+			.filter = dhcpv4_raw_filter_code
+		};
+
+		if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0) {
+			fr_strerror_printf("Failed attaching DHCP filter to raw socket: %s", fr_syserror(errno));
+		}
+	}
+
 	/* Set link layer parameters */
 	memset(link_layer, 0, sizeof(struct sockaddr_ll));
 
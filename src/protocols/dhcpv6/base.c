@@ -622,14 +622,25 @@ bool fr_dhcpv6_verify(uint8_t const *packet, size_t packet_len, fr_dhcpv6_decode
       +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 */
 
-/** Decode a DHCPv6 packet
+/** Decode a DHCPv6 packet, or a packet nested inside a Relay-Message option
+ *
+ * Nested packets use the same decode context as the packet which contains
+ * them, so that relay layers don't each need their own temporary context.
  *
+ * @param[in] ctx		to allocate pairs in.
+ * @param[in] packet		to decode.
+ * @param[in] packet_len	length of the packet.
+ * @param[in] cursor		to insert pairs into.
+ * @param[in] packet_ctx	with a tmp_ctx which can be freed between options.
+ * @return
+ *	- <0 on error.
+ *	- the length of the packet.
  */
-ssize_t	fr_dhcpv6_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, fr_cursor_t *cursor)
+ssize_t	fr_dhcpv6_decode_nested(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, fr_cursor_t *cursor,
+				fr_dhcpv6_decode_ctx_t *packet_ctx)
 {
 	ssize_t			slen;
 	uint8_t const		*p, *end;
-	fr_dhcpv6_decode_ctx_t	packet_ctx;
 	fr_pair_t		*vp;
 
 	/*
@@ -705,18 +716,16 @@ ssize_t	fr_dhcpv6_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_l
 
 decode_options:
 	end = packet + packet_len;
-	packet_ctx.tmp_ctx = talloc_init_const("tmp");
 
 	/*
 	 *	The caller MUST have called fr_dhcpv6_ok() first.  If
 	 *	he doesn't, all hell breaks loose.
 	 */
 	while (p < end) {
-		slen = fr_dhcpv6_decode_option(ctx, cursor, dict_dhcpv6, p, (end - p), &packet_ctx);
+		slen = fr_dhcpv6_decode_option(ctx, cursor, dict_dhcpv6, p, (end - p), packet_ctx);
 		if (slen < 0) {
 			fr_cursor_head(cursor);
 			fr_cursor_free_list(cursor);
-			talloc_free(packet_ctx.tmp_ctx);
 			return slen;
 		}
 
@@ -727,21 +736,34 @@ decode_options:
 		 if (!fr_cond_assert(slen <= (end - p))) {
 			 fr_cursor_head(cursor);
 			 fr_cursor_free_list(cursor);
-			 talloc_free(packet_ctx.tmp_ctx);
 			 return -1;
 		 }
 
 		 p += slen;
-		 talloc_free_children(packet_ctx.tmp_ctx);
+		 talloc_free_children(packet_ctx->tmp_ctx);
 	}
 
 	/*
 	 *	We've parsed the whole packet, return that.
 	 */
-	talloc_free(packet_ctx.tmp_ctx);
 	return packet_len;
 }
 
+/** Decode a DHCPv6 packet
+ *
+ */
+ssize_t	fr_dhcpv6_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, fr_cursor_t *cursor)
+{
+	ssize_t			slen;
+	fr_dhcpv6_decode_ctx_t	packet_ctx = { 0 };
+
+	packet_ctx.tmp_ctx = talloc_init_const("tmp");
+	slen = fr_dhcpv6_decode_nested(ctx, packet, packet_len, cursor, &packet_ctx);
+	talloc_free(packet_ctx.tmp_ctx);
+
+	return slen;
+}
+
 /** DHCPV6-specific iterator
  *
  */
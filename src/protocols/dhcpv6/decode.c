@@ -549,7 +549,7 @@ static ssize_t decode_option(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t con
 		if (!vp) return PAIR_DECODE_FATAL_ERROR;
 
 		fr_cursor_init(&cursor_group, &vp->vp_group);
-		slen = fr_dhcpv6_decode(vp, data + 4, len, &cursor_group);
+		slen = fr_dhcpv6_decode_nested(vp, data + 4, len, &cursor_group, packet_ctx);
 		if (slen < 0) {
 			talloc_free(vp);
 			return slen;
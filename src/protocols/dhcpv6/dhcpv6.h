@@ -157,6 +157,9 @@ ssize_t		fr_dhcpv6_encode(fr_dbuff_t *dbuff, uint8_t const *original, size_t len
 ssize_t		fr_dhcpv6_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len,
 				 fr_cursor_t *cursor);
 
+ssize_t		fr_dhcpv6_decode_nested(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len,
+					fr_cursor_t *cursor, fr_dhcpv6_decode_ctx_t *packet_ctx);
+
 void		fr_dhcpv6_print_hex(FILE *fp, uint8_t const *packet, size_t packet_len);
 
 int		fr_dhcpv6_global_init(void);
@@ -620,6 +620,11 @@ bool fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
 	 *	This would ONLY happen with buggy RADIUS implementations,
 	 *	or with an intentional attack.  Either way, we do NOT want
 	 *	to be vulnerable to this problem.
+	 *
+	 *	The walk jumps from header to header, and never looks at
+	 *	the attribute data.  Each header's position depends on the
+	 *	length of the previous one, so there's nothing to do in
+	 *	parallel.
 	 */
 	attr = packet + RADIUS_HEADER_LENGTH;
 	end = packet + packet_len;
@@ -1046,7 +1051,11 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_l
 	uint8_t const		*attr, *end;
 	fr_radius_ctx_t		packet_ctx;
 
-	packet_ctx.tmp_ctx = talloc_init_const("tmp");
+	packet_ctx.tmp_ctx = talloc_pool(NULL, RADIUS_DECODE_TMP_POOL_SIZE);
+	if (!packet_ctx.tmp_ctx) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
 	packet_ctx.secret = secret;
 	memcpy(packet_ctx.vector, original ? original + 4 : packet + 4, sizeof(packet_ctx.vector));
 
@@ -1342,6 +1342,13 @@ ssize_t fr_radius_encode_pair(fr_dbuff_t *dbuff, fr_cursor_t *cursor, void *enco
 
 	/*
 	 *	Do more work to set up the stack for the complex case.
+	 *
+	 *	This is a copy of the stack which the dictionary
+	 *	caches in each attribute, so there's no walk up the
+	 *	hierarchy.  The vendor formats come from the vendor
+	 *	attribute in the stack.  The remaining per-pair work
+	 *	depends on the value (lengths, encryption, long
+	 *	attributes), so there's nothing more to precompute.
 	 */
 	fr_proto_da_stack_build(&da_stack, vp->da);
 	FR_PROTO_STACK_PRINT(&da_stack, 0);
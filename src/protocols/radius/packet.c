@@ -172,7 +172,11 @@ int fr_radius_packet_decode(fr_radius_packet_t *packet, fr_pair_list_t *list,
 		return -1;
 	}
 
-	packet_ctx.tmp_ctx = talloc(packet, uint8_t);
+	packet_ctx.tmp_ctx = talloc_pool(NULL, RADIUS_DECODE_TMP_POOL_SIZE);
+	if (!packet_ctx.tmp_ctx) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
 
 	/*
 	 *	Extract attribute-value pairs
@@ -167,6 +167,14 @@ typedef struct {
 	fr_cursor_t	cursor;
 } fr_radius_tag_ctx_t;
 
+/*
+ *	The decoders free everything in tmp_ctx after each attribute,
+ *	so a small pool is enough to hold the unknown attributes,
+ *	tags and decrypted values of any one attribute, without going
+ *	to malloc.
+ */
+#define RADIUS_DECODE_TMP_POOL_SIZE	(1024)
+
 typedef struct {
 	TALLOC_CTX		*tmp_ctx;		//!< for temporary things cleaned up during decoding
 	uint8_t 		vector[RADIUS_AUTH_VECTOR_LENGTH]; //!< vector for encryption / decryption of data
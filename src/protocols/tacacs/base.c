@@ -131,9 +131,9 @@ void fr_tacacs_free(void)
 
 int fr_tacacs_body_xor(fr_tacacs_packet_t const *pkt, uint8_t *body, size_t body_len, char const *secret, size_t secret_len)
 {
-	uint8_t pad[MD5_DIGEST_LENGTH];
-	uint8_t *buf;
-	int pad_offset;
+	uint8_t		pad[MD5_DIGEST_LENGTH];
+	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	size_t		pos, i;
 
 	if (!secret) {
 		if (pkt->hdr.flags & FR_TAC_PLUS_UNENCRYPTED_FLAG)
@@ -149,32 +149,48 @@ int fr_tacacs_body_xor(fr_tacacs_packet_t const *pkt, uint8_t *body, size_t body
 		return -1;
 	}
 
-	pad_offset = sizeof(pkt->hdr.session_id) + secret_len + sizeof(pkt->hdr.version) + sizeof(pkt->hdr.seq_no);
-
 	/* MD5_1 = MD5{session_id, key, version, seq_no} */
 	/* MD5_n = MD5{session_id, key, version, seq_no, MD5_n-1} */
-	buf = talloc_array(NULL, uint8_t, pad_offset + MD5_DIGEST_LENGTH);
 
-	memcpy(&buf[0], &pkt->hdr.session_id, sizeof(pkt->hdr.session_id));
-	memcpy(&buf[sizeof(pkt->hdr.session_id)], secret, secret_len);
-	memcpy(&buf[sizeof(pkt->hdr.session_id) + secret_len], &pkt->hdr.version, sizeof(pkt->hdr.version));
-	memcpy(&buf[sizeof(pkt->hdr.session_id) + secret_len + sizeof(pkt->hdr.version)], &pkt->hdr.seq_no, sizeof(pkt->hdr.seq_no));
+	/*
+	 *	The prefix is the same for every pad in the packet,
+	 *	so hash it once, and save the intermediate state.
+	 *	The session_id comes first, so the state can't be
+	 *	shared between packets.
+	 */
+	md5_ctx = fr_md5_ctx_alloc(false);
+	md5_ctx_old = fr_md5_ctx_alloc(true);
+
+	fr_md5_update(md5_ctx, (uint8_t const *) &pkt->hdr.session_id, sizeof(pkt->hdr.session_id));
+	fr_md5_update(md5_ctx, (uint8_t const *) secret, secret_len);
+	fr_md5_update(md5_ctx, &pkt->hdr.version, sizeof(pkt->hdr.version));
+	fr_md5_update(md5_ctx, &pkt->hdr.seq_no, sizeof(pkt->hdr.seq_no));
+	fr_md5_ctx_copy(md5_ctx_old, md5_ctx); /* save intermediate work */
 
-	fr_md5_calc(pad, buf, pad_offset);
+	fr_md5_final(pad, md5_ctx);
 
-	size_t pos = 0;
+	pos = 0;
 	do {
-		for (size_t i = 0; i < MD5_DIGEST_LENGTH && pos < body_len; i++, pos++)
-			body[pos] ^= pad[i];
+		/*
+		 *	Full pads are a fixed size loop, which the
+		 *	compiler can turn into wide XORs.
+		 */
+		if ((body_len - pos) >= MD5_DIGEST_LENGTH) {
+			for (i = 0; i < MD5_DIGEST_LENGTH; i++) body[pos + i] ^= pad[i];
+			pos += MD5_DIGEST_LENGTH;
+		} else {
+			for (i = 0; pos < body_len; i++, pos++) body[pos] ^= pad[i];
+		}
 
-		if (pos == body_len)
-			break;
+		if (pos == body_len) break;
 
-		memcpy(&buf[pad_offset], pad, MD5_DIGEST_LENGTH);
-		fr_md5_calc(pad, buf, pad_offset + MD5_DIGEST_LENGTH);
+		fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+		fr_md5_update(md5_ctx, pad, MD5_DIGEST_LENGTH);
+		fr_md5_final(pad, md5_ctx);
 	} while (1);
 
-	talloc_free(buf);
+	fr_md5_ctx_free(&md5_ctx);
+	fr_md5_ctx_free(&md5_ctx_old);
 
 	return 0;
 }
@@ -0,0 +1,11 @@
+#
+#	Performance scenarios.  These are not run as part of "make test",
+#	as the results depend on the machine.
+#
+#	make test.bench
+#
+#	See src/tests/performance/README.md for the options.
+#
+.PHONY: test.bench
+test.bench: ${BUILD_DIR}/bin/radiusd ${BUILD_DIR}/bin/radclient
+	${Q}BUILD_DIR=$(abspath ${BUILD_DIR}) src/tests/performance/bench $(BENCH)
@@ -3,6 +3,7 @@
 #include <netdb.h>
 
 #include <freeradius-devel/util/base.h>
+#include <freeradius-devel/util/btree.h>
 
 /*
  *	We need knowlege of the internal structures.
@@ -156,6 +157,57 @@ ascend:
 	goto ascend;
 }
 
+/*
+ *	Do the same inserts and deletes on a B+tree, and check that
+ *	it ends up with the same elements as the rbtree, in the
+ *	same order.
+ */
+static int btmonkey(uint32_t const *vals, int n, uint32_t thresh)
+{
+	fr_btree_t	*bt;
+	fr_btree_iter_t	iter;
+	uint32_t	*p, *copy;
+	int		i, j;
+
+	bt = fr_btree_alloc(NULL, comp, NULL, FR_BTREE_FLAG_NONE);
+	copy = talloc_memdup(bt, vals, sizeof(vals[0]) * n);
+
+	/*
+	 *	Insert in a different order to the rbtree.
+	 */
+	for (i = n - 1; i >= 0; i--) (void) fr_btree_insert(bt, &copy[i]);
+
+	for (i = 0; i < n; i++) {
+		if (!fr_btree_finddata(bt, &vals[i])) {
+			fprintf(stderr, "btree lost %x\n", vals[i]);
+			goto bad;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (filter_cb(&copy[i], &thresh) == 2) (void) fr_btree_deletebydata(bt, &vals[i]);
+	}
+
+	if (fr_btree_num_elements(bt) != (uint32_t) cb_stored) {
+		fprintf(stderr, "btree has %u elements, rbtree has %i\n", fr_btree_num_elements(bt), cb_stored);
+		goto bad;
+	}
+
+	for (p = fr_btree_iter_init(bt, &iter), j = 0; p; p = fr_btree_iter_next(&iter), j++) {
+		if (*p != rvals[j]) {
+			fprintf(stderr, "btree %i: %x %x\n", j, *p, rvals[j]);
+			goto bad;
+		}
+	}
+
+	talloc_free(bt);
+	return 0;
+
+bad:
+	talloc_free(bt);
+	return -1;
+}
+
 #define REPS 10
 
 static void freenode(void *data)
@@ -230,6 +282,10 @@ again:
 		}
 	}
 	fprintf(stderr,"matched OK\n");
+
+	if (btmonkey(vals, n, thresh) < 0) return -1;
+	fprintf(stderr,"btree matched OK\n");
+
 	talloc_free(t);
 	goto again;
 
@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <string.h>
 #include <sys/time.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/time.h>
 
 #ifdef HAVE_GETOPT_H
 #	include <getopt.h>
@@ -35,6 +36,7 @@ RCSID("$Id$")
 #define OFFSET	(1024)
 
 static int		debug_lvl = 0;
+static bool		do_timing = false;
 
 
 /**********************************************************************/
@@ -67,6 +69,7 @@ static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: atomic_queue_test [OPTS]\n");
 	fprintf(stderr, "  -s size                set queue size.\n");
+	fprintf(stderr, "  -t                     Compare single and batched throughput.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	fr_exit_now(EXIT_SUCCESS);
@@ -79,6 +82,8 @@ int main(int argc, char *argv[])
 	intptr_t		val;
 	void			*data;
 	fr_atomic_queue_t	*aq;
+	void			**array;
+	size_t			num;
 	TALLOC_CTX		*autofree = talloc_autofree_context();
 
 	size = 4;
@@ -88,6 +93,10 @@ int main(int argc, char *argv[])
 			size = atoi(optarg);
 			break;
 
+		case 't':
+			do_timing = true;
+			break;
+
 		case 'x':
 			debug_lvl++;
 			break;
@@ -190,6 +199,74 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	/*
+	 *	Do it all again with the batch API.  Ask for one more
+	 *	entry than will fit, so that we check the partial push.
+	 */
+	array = talloc_array(autofree, void *, size + 1);
+	for (i = 0; i <= size; i++) {
+		val = i + OFFSET;
+		array[i] = (void *) val;
+	}
+
+	num = fr_atomic_queue_push_batch(aq, array, size + 1);
+	if (num != (size_t) size) {
+		fprintf(stderr, "Batch push expected %d, got %zu\n", size, num);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_atomic_queue_push_batch(aq, array, 1) != 0) {
+		fprintf(stderr, "Batch pushed an entry past the end of the queue.");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	memset(array, 0, sizeof(array[0]) * (size + 1));
+
+	num = fr_atomic_queue_pop_batch(aq, array, size + 1);
+	if (num != (size_t) size) {
+		fprintf(stderr, "Batch pop expected %d, got %zu\n", size, num);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < size; i++) {
+		val = (intptr_t) array[i];
+		if (val != (i + OFFSET)) {
+			fprintf(stderr, "Batch pop expected %d, got %d\n",
+				i + OFFSET, (int) val);
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	if (fr_atomic_queue_pop_batch(aq, array, 1) != 0) {
+		fprintf(stderr, "Batch popped an entry past the end of the queue.");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (do_timing) {
+		int		j, rounds = 100000;
+		fr_time_t	start_t, end_t;
+
+		start_t = fr_time();
+		for (j = 0; j < rounds; j++) {
+			for (i = 0; i < size; i++) (void) fr_atomic_queue_push(aq, array[i]);
+			for (i = 0; i < size; i++) (void) fr_atomic_queue_pop(aq, &data);
+		}
+		end_t = fr_time();
+
+		printf("SINGLE %d.%09d seconds, %d push / pop\n",
+		       (int) ((end_t - start_t) / NSEC), (int) ((end_t - start_t) % NSEC), rounds * size);
+
+		start_t = fr_time();
+		for (j = 0; j < rounds; j++) {
+			(void) fr_atomic_queue_push_batch(aq, array, size);
+			(void) fr_atomic_queue_pop_batch(aq, array, size);
+		}
+		end_t = fr_time();
+
+		printf("BATCH  %d.%09d seconds, %d push / pop\n",
+		       (int) ((end_t - start_t) / NSEC), (int) ((end_t - start_t) % NSEC), rounds * size);
+	}
+
 	return ret;
 }
 
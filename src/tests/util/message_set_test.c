@@ -412,6 +412,27 @@ int main(int argc, char *argv[])
 	ret = fr_message_set_messages_used(ms);
 	fr_assert(ret == 0);
 
+	/*
+	 *	Everything is free, so shrinking the message set
+	 *	MUST free every array it grew, and a second shrink
+	 *	MUST NOT find anything more to free.
+	 */
+	{
+		fr_message_set_stats_t stats;
+		uint64_t shrunk;
+
+		fr_message_set_shrink(ms);
+		if (debug_lvl) fr_message_set_debug(ms, stdout);
+
+		fr_message_set_stats(ms, &stats);
+		fr_assert(stats.shrunk == stats.grown);
+		shrunk = stats.shrunk;
+
+		fr_message_set_shrink(ms);
+		fr_message_set_stats(ms, &stats);
+		fr_assert(stats.shrunk == shrunk);
+	}
+
 	return ret;
 }
 